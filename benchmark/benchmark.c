@@ -0,0 +1,404 @@
+/**
+ * Microbenchmarks
+ *
+ * This program measures the performance of the main kernels of REBOUND:
+ * direct summation gravity, the tree (build, update and walk), the
+ * collision search backends, the Kepler solver of WHFast, IAS15 steps
+ * and SimulationArchive input/output.
+ *
+ * Each kernel is repeated until it has run for at least a minimum time.
+ * This is done several times and the fastest run is reported. Results are
+ * written as JSON (to benchmark.json by default) so that they can be
+ * compared between versions with compare.py. A summary is printed to stderr.
+ *
+ * Usage: benchmark [--quick] [--filter NAME] [-o FILE]
+ *   --quick        Smaller problem sizes and shorter runs (for CI).
+ *   --filter NAME  Only run benchmarks whose name starts with NAME.
+ *   -o FILE        Write the results to FILE instead of benchmark.json ("-" for stdout).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rebound.h"
+#include "gravity.h"
+#include "tree.h"
+#include "collision.h"
+#include "integrator_whfast.h"
+#include "simulationarchive.h"
+
+#define BENCHMARK_SAMPLES 3             // Number of timed runs, the fastest is reported
+#define BENCHMARK_ARCHIVE "benchmark_archive.bin"
+
+struct benchmark {
+    const char* name;                   // Name of the benchmark
+    char params[256];                   // Parameters as JSON object members
+    const char* unit;                   // Unit of the rate
+    double work;                        // Amount of work done by one call of the kernel, in units of the rate
+    struct reb_simulation* r;           // Simulation the kernel operates on
+    void (*kernel)(struct benchmark* const b);
+    struct reb_particle* particles;     // Scratch particles (Kepler solver)
+    double* M;                          // Scratch masses (Kepler solver)
+    struct reb_simulationarchive_map* map; // SimulationArchive read benchmark
+    long snapshot;                      // Next snapshot to read
+    int N;                              // Number of particles
+};
+
+static double min_time = 0.2;           // Minimum time of each timed run in seconds
+static const char* filter = NULL;
+static FILE* out = NULL;
+static int results_N = 0;
+
+static double benchmark_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Deterministic random numbers, so that every version is benchmarked with the same particles.
+static unsigned long long benchmark_seed = 1;
+static double benchmark_uniform(double min, double max){
+    benchmark_seed = benchmark_seed*6364136223846793005ULL + 1442695040888963407ULL;
+    return min + (max-min)*((benchmark_seed>>11)*(1.0/9007199254740992.0));
+}
+
+static int benchmark_skip(const char* const name){
+    return filter && strncmp(name, filter, strlen(filter))!=0;
+}
+
+// Times the kernel and writes one result.
+static void benchmark_run(struct benchmark* const b){
+    // Calibrate the number of calls per run.
+    long calls = 1;
+    while (1){
+        const double start = benchmark_clock();
+        for (long i=0;i<calls;i++){
+            b->kernel(b);
+        }
+        const double t = benchmark_clock() - start;
+        if (t>=min_time/4. || calls>(1L<<40)) break;
+        calls *= t>0.?(long)fmin(100.,ceil(min_time/4./t)+1):100;
+    }
+    double best = 1e300;
+    for (int s=0;s<BENCHMARK_SAMPLES;s++){
+        const double start = benchmark_clock();
+        long done = 0;
+        double t = 0.;
+        while (t<min_time){
+            for (long i=0;i<calls;i++){
+                b->kernel(b);
+            }
+            done += calls;
+            t = benchmark_clock() - start;
+        }
+        if (t/done<best){
+            best = t/done;
+        }
+    }
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"params\": {%s}, \"time\": %.6e, \"rate\": %.6e, \"unit\": \"%s\"}",
+            results_N?",":"", b->name, b->params, best, b->work/best, b->unit);
+    results_N++;
+    fprintf(stderr, "%-22s %-44s %12.3e s %12.3e %s\n", b->name, b->params, best, b->work/best, b->unit);
+}
+
+static void benchmark_free(struct benchmark* const b){
+    if (b->r){
+        reb_free_simulation(b->r);
+    }
+    free(b->particles);
+    free(b->M);
+    if (b->map){
+        reb_free_simulationarchive_map(b->map);
+    }
+}
+
+// Particles with uniform random positions in a cube of size boxsize.
+static struct reb_simulation* benchmark_box(const int N, const double boxsize, const double radius){
+    struct reb_simulation* const r = reb_create_simulation();
+    reb_configure_box(r, boxsize, 1, 1, 1);
+    r->softening = 0.01*boxsize;
+    benchmark_seed = 1;
+    for (int i=0;i<N;i++){
+        struct reb_particle p = {0};
+        p.x = benchmark_uniform(-0.5*boxsize, 0.5*boxsize);
+        p.y = benchmark_uniform(-0.5*boxsize, 0.5*boxsize);
+        p.z = benchmark_uniform(-0.5*boxsize, 0.5*boxsize);
+        p.vx = benchmark_uniform(-1., 1.);
+        p.vy = benchmark_uniform(-1., 1.);
+        p.vz = benchmark_uniform(-1., 1.);
+        p.m = 1./N;
+        p.r = radius;
+        reb_add(r, p);
+    }
+    return r;
+}
+
+// A star with N-1 planets on nearly circular orbits.
+static struct reb_simulation* benchmark_planets(const int N){
+    struct reb_simulation* const r = reb_create_simulation();
+    benchmark_seed = 1;
+    struct reb_particle star = {0};
+    star.m = 1.;
+    reb_add(r, star);
+    for (int i=1;i<N;i++){
+        const double a = 1.+0.5*i;
+        reb_add(r, reb_tools_orbit_to_particle(r->G, star, 1e-8, a, benchmark_uniform(0.,0.05), benchmark_uniform(0.,0.05), benchmark_uniform(0.,2.*M_PI), benchmark_uniform(0.,2.*M_PI), benchmark_uniform(0.,2.*M_PI)));
+    }
+    reb_move_to_com(r);
+    r->dt = 0.01;
+    return r;
+}
+
+/*************************
+ * Kernels             */
+
+static void kernel_gravity(struct benchmark* const b){
+    reb_calculate_acceleration(b->r);
+}
+
+static void kernel_tree_build(struct benchmark* const b){
+    reb_tree_delete(b->r);
+    reb_tree_build(b->r);
+}
+
+static void kernel_tree_update(struct benchmark* const b){
+    reb_tree_update(b->r);
+}
+
+static void kernel_tree_walk(struct benchmark* const b){
+    reb_tree_update_gravity_data(b->r);
+    reb_calculate_acceleration(b->r);
+}
+
+static void kernel_collision(struct benchmark* const b){
+    reb_collision_search(b->r);
+}
+
+static int collision_resolve_none(struct reb_simulation* const r, struct reb_collision c){
+    return 0; // Only the search is benchmarked.
+}
+
+static void kernel_kepler(struct benchmark* const b){
+    for (int i=1;i<b->N;i++){
+        kepler_step(b->r, b->particles, b->M[i], i, 1e-3);
+    }
+}
+
+static void kernel_kepler_batch(struct benchmark* const b){
+    for (int i=1;i+WHFAST_KEPLER_BATCH<=b->N;i+=WHFAST_KEPLER_BATCH){
+        kepler_step_batch(b->r, b->particles, b->M+i, i, 1e-3);
+    }
+}
+
+static void kernel_step(struct benchmark* const b){
+    reb_step(b->r);
+}
+
+static void kernel_archive_write(struct benchmark* const b){
+    if (++b->snapshot%1000==0){
+        // Start a new archive from time to time to limit the file size.
+        b->r->simulationarchive_walltime = 0.;
+    }
+    b->r->t += b->r->simulationarchive_interval;
+    reb_simulationarchive_heartbeat(b->r);
+}
+
+static void kernel_archive_read(struct benchmark* const b){
+    reb_simulationarchive_map_load_snapshot(b->r, b->map, b->snapshot);
+    b->snapshot = b->snapshot%(b->map->N_snapshots-1)+1;
+}
+
+/*************************
+ * Benchmarks          */
+
+static void benchmark_gravity(const int* const Ns){
+    const int gravities[] = {REB_GRAVITY_BASIC, REB_GRAVITY_COMPENSATED};
+    const char* const names[] = {"gravity_basic", "gravity_compensated"};
+    for (int g=0;g<2;g++){
+        if (benchmark_skip(names[g])) continue;
+        for (int n=0;Ns[n];n++){
+            struct benchmark b = {.name = names[g], .unit = "pairs/s", .kernel = kernel_gravity};
+            b.r = benchmark_box(Ns[n], 1., 0.);
+            b.r->gravity = gravities[g];
+            b.work = (double)Ns[n]*(Ns[n]-1);
+            snprintf(b.params, sizeof(b.params), "\"N\": %d", Ns[n]);
+            benchmark_run(&b);
+            benchmark_free(&b);
+        }
+    }
+}
+
+static void benchmark_tree(const int N){
+    if (!benchmark_skip("tree_build")){
+        struct benchmark b = {.name = "tree_build", .unit = "particles/s", .kernel = kernel_tree_build, .work = N};
+        b.r = benchmark_box(N, 1., 0.);
+        b.r->gravity = REB_GRAVITY_TREE;
+        snprintf(b.params, sizeof(b.params), "\"N\": %d", N);
+        benchmark_run(&b);
+        benchmark_free(&b);
+    }
+    if (!benchmark_skip("tree_update")){
+        struct benchmark b = {.name = "tree_update", .unit = "particles/s", .kernel = kernel_tree_update, .work = N};
+        b.r = benchmark_box(N, 1., 0.);
+        b.r->gravity = REB_GRAVITY_TREE;
+        reb_tree_update(b.r);
+        snprintf(b.params, sizeof(b.params), "\"N\": %d", N);
+        benchmark_run(&b);
+        benchmark_free(&b);
+    }
+    if (!benchmark_skip("tree_walk")){
+        const double opening_angle2s[] = {0.1, 0.25, 0.5, 1.0};
+        for (int i=0;i<4;i++){
+            struct benchmark b = {.name = "tree_walk", .unit = "particles/s", .kernel = kernel_tree_walk, .work = N};
+            b.r = benchmark_box(N, 1., 0.);
+            b.r->gravity = REB_GRAVITY_TREE;
+            b.r->opening_angle2 = opening_angle2s[i];
+            reb_tree_update(b.r);
+            snprintf(b.params, sizeof(b.params), "\"N\": %d, \"opening_angle2\": %g", N, opening_angle2s[i]);
+            benchmark_run(&b);
+            benchmark_free(&b);
+        }
+    }
+}
+
+static void benchmark_collision(const int N, const int N_direct){
+    const int collisions[] = {REB_COLLISION_DIRECT, REB_COLLISION_TREE, REB_COLLISION_SWEEP, REB_COLLISION_GRID};
+    const char* const names[] = {"collision_direct", "collision_tree", "collision_sweep", "collision_grid"};
+    for (int c=0;c<4;c++){
+        if (benchmark_skip(names[c])) continue;
+        const int _N = collisions[c]==REB_COLLISION_DIRECT?N_direct:N;
+        struct benchmark b = {.name = names[c], .unit = "particles/s", .kernel = kernel_collision, .work = _N};
+        // About one overlapping pair per particle.
+        b.r = benchmark_box(_N, 1., 0.5*cbrt(3./(4.*M_PI*_N)));
+        b.r->collision = collisions[c];
+        b.r->collision_resolve = collision_resolve_none;
+        snprintf(b.params, sizeof(b.params), "\"N\": %d", _N);
+        benchmark_run(&b);
+        benchmark_free(&b);
+    }
+}
+
+static void benchmark_kepler(const int N){
+    const char* const names[] = {"kepler_step", "kepler_step_batch"};
+    for (int k=0;k<2;k++){
+        if (benchmark_skip(names[k])) continue;
+        struct benchmark b = {.name = names[k], .unit = "steps/s"};
+        b.kernel = k?kernel_kepler_batch:kernel_kepler;
+        b.r = reb_create_simulation();
+        b.N = 1+(N-1)/WHFAST_KEPLER_BATCH*WHFAST_KEPLER_BATCH;
+        b.work = b.N-1;
+        b.particles = calloc(b.N, sizeof(struct reb_particle));
+        b.M = calloc(b.N, sizeof(double));
+        benchmark_seed = 1;
+        struct reb_particle primary = {0};
+        primary.m = 1.;
+        for (int i=1;i<b.N;i++){
+            b.M[i] = 1.;
+            b.particles[i] = reb_tools_orbit_to_particle(1., primary, 0., benchmark_uniform(1.,2.), benchmark_uniform(0.,0.5), benchmark_uniform(0.,1.), benchmark_uniform(0.,2.*M_PI), benchmark_uniform(0.,2.*M_PI), benchmark_uniform(0.,2.*M_PI));
+        }
+        snprintf(b.params, sizeof(b.params), "\"N\": %d", b.N-1);
+        benchmark_run(&b);
+        benchmark_free(&b);
+    }
+}
+
+static void benchmark_ias15(const int* const Ns){
+    if (benchmark_skip("ias15_step")) return;
+    for (int n=0;Ns[n];n++){
+        struct benchmark b = {.name = "ias15_step", .unit = "steps/s", .kernel = kernel_step, .work = 1};
+        b.r = benchmark_planets(Ns[n]);
+        b.r->integrator = REB_INTEGRATOR_IAS15;
+        reb_step(b.r); // Allocate memory and find the timestep.
+        snprintf(b.params, sizeof(b.params), "\"N\": %d", Ns[n]);
+        benchmark_run(&b);
+        benchmark_free(&b);
+    }
+}
+
+static void benchmark_archive(const int N){
+    for (int compression=0;compression<2;compression++){
+        if (!benchmark_skip("archive_write")){
+            unlink(BENCHMARK_ARCHIVE);
+            struct benchmark b = {.name = "archive_write", .unit = "bytes/s", .kernel = kernel_archive_write};
+            b.r = benchmark_planets(N);
+            b.r->integrator = REB_INTEGRATOR_WHFAST;
+            b.r->simulationarchive_filename = BENCHMARK_ARCHIVE;
+            b.r->simulationarchive_interval = b.r->dt;
+            b.r->simulationarchive_compression = compression;
+            reb_simulationarchive_heartbeat(b.r); // Initial binary file
+            b.work = b.r->simulationarchive_size_snapshot; // Uncompressed size
+            snprintf(b.params, sizeof(b.params), "\"N\": %d, \"compression\": %d", N, compression);
+            benchmark_run(&b);
+            benchmark_free(&b);
+        }
+        if (!benchmark_skip("archive_read")){
+            unlink(BENCHMARK_ARCHIVE);
+            struct reb_simulation* const r = benchmark_planets(N);
+            r->integrator = REB_INTEGRATOR_WHFAST;
+            r->simulationarchive_filename = BENCHMARK_ARCHIVE;
+            r->simulationarchive_interval = r->dt;
+            r->simulationarchive_compression = compression;
+            reb_integrate(r, 100.*r->dt);
+            const long size_snapshot = r->simulationarchive_size_snapshot;
+            reb_free_simulation(r);
+            struct benchmark b = {.name = "archive_read", .unit = "bytes/s", .kernel = kernel_archive_read, .work = size_snapshot, .snapshot = 1};
+            b.r = reb_create_simulation_from_simulationarchive(BENCHMARK_ARCHIVE);
+            b.map = reb_create_simulationarchive_map(BENCHMARK_ARCHIVE);
+            if (b.r==NULL || b.map==NULL || b.map->N_snapshots<2){
+                fprintf(stderr, "Cannot read %s.\n", BENCHMARK_ARCHIVE);
+                exit(EXIT_FAILURE);
+            }
+            snprintf(b.params, sizeof(b.params), "\"N\": %d, \"compression\": %d", N, compression);
+            benchmark_run(&b);
+            benchmark_free(&b);
+        }
+    }
+    unlink(BENCHMARK_ARCHIVE);
+}
+
+int main(int argc, char* argv[]){
+    int quick = 0;
+    const char* filename = "benchmark.json";
+    for (int i=1;i<argc;i++){
+        if (strcmp(argv[i], "--quick")==0){
+            quick = 1;
+        }else if (strcmp(argv[i], "--filter")==0 && i+1<argc){
+            filter = argv[++i];
+        }else if (strcmp(argv[i], "-o")==0 && i+1<argc){
+            filename = argv[++i];
+        }else{
+            fprintf(stderr, "Usage: %s [--quick] [--filter NAME] [-o FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (quick){
+        min_time = 0.02;
+    }
+    out = strcmp(filename, "-")==0?stdout:fopen(filename, "w");
+    if (out==NULL){
+        fprintf(stderr, "Cannot open %s.\n", filename);
+        return EXIT_FAILURE;
+    }
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    fprintf(out, "{\n  \"version\": \"%s\",\n  \"githash\": \"%s\",\n  \"date\": \"%s\",\n  \"quick\": %d,\n  \"results\": [", reb_version_str, reb_githash_str, date, quick);
+
+    const int gravity_N[] = {100, 1000, quick?0:4000, 0};
+    benchmark_gravity(gravity_N);
+    benchmark_tree(quick?2000:20000);
+    benchmark_collision(quick?2000:20000, quick?500:2000);
+    benchmark_kepler(quick?1000:10000);
+    const int ias15_N[] = {2, 10, quick?0:100, 0};
+    benchmark_ias15(ias15_N);
+    benchmark_archive(quick?100:1000);
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out!=stdout){
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
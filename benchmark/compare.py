@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+"""
+Compares two result files written by the benchmark program.
+
+Usage: python compare.py baseline.json current.json [--threshold 0.1]
+
+Prints the ratio of the rates (current/baseline) of every benchmark found
+in both files. Exits with status 1 if any benchmark got slower by more
+than the threshold (default 10%).
+"""
+import json
+import sys
+import argparse
+
+def load(filename):
+    with open(filename) as f:
+        data = json.load(f)
+    results = {}
+    for r in data["results"]:
+        key = r["name"] + " " + json.dumps(r["params"], sort_keys=True)
+        results[key] = r
+    return data, results
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two REBOUND benchmark result files.")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.1, help="Relative slowdown which counts as a regression. Default: 0.1")
+    args = parser.parse_args()
+
+    base_data, base = load(args.baseline)
+    cur_data, cur = load(args.current)
+    print("baseline: %s (%s)" % (base_data["version"], base_data["githash"][:10]))
+    print("current:  %s (%s)" % (cur_data["version"], cur_data["githash"][:10]))
+    regressions = 0
+    for key in base:
+        if key not in cur:
+            continue
+        ratio = cur[key]["rate"]/base[key]["rate"]
+        flag = ""
+        if ratio < 1.-args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-70s %8.3f%s" % (key, ratio, flag))
+    if regressions:
+        print("%d benchmark(s) slower by more than %.0f%%." % (regressions, args.threshold*100.))
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
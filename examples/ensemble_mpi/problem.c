@@ -0,0 +1,70 @@
+/**
+ * Ensemble of independent simulations with MPI
+ *
+ * This example integrates many independent two planet systems,
+ * distributed over MPI nodes. The outer planet is placed at a
+ * different semi-major axis in every simulation. Unstable systems
+ * stop early once a planet escapes, so the run time of the
+ * simulations varies a lot. Nodes take new simulations from
+ * a shared counter whenever they run out of work. Every node
+ * integrates its simulations on a pool of threads. The final
+ * states are written to one ensemble archive. To test this
+ * example on your local computer, type make && mpirun -np 4 rebound.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "rebound.h"
+
+const long N_simulations = 400;
+
+void setup(struct reb_simulation* const r, const long k, void* args){
+	// Semi-major axis of the outer planet between 1.2 and 2.4.
+	double a = 1.2 + 1.2*(double)k/(double)(N_simulations-1);
+	struct reb_particle primary = r->particles[0];
+	reb_add(r, reb_tools_orbit_to_particle(r->G, primary, 1e-3, a, 0.05, 0., 0., 0., 2.));
+	reb_move_to_com(r);
+}
+
+int main(int argc, char* argv[]) {
+	// The template is a local simulation, reb_mpi_init() is not called for it.
+	struct reb_simulation* r = reb_create_simulation();
+	r->integrator		= REB_INTEGRATOR_WHFAST;
+	r->dt 			= 0.05;
+	r->exit_max_distance	= 10.;
+	struct reb_particle star = {0};
+	star.m = 1.;
+	reb_add(r, star);
+	reb_add(r, reb_tools_orbit_to_particle(r->G, star, 1e-3, 1., 0., 0., 0., 0., 0.));
+
+	struct reb_mpi_ensemble e;
+	reb_init_mpi_ensemble(&e, N_simulations, 1e3);
+	e.setup		= setup;
+	e.threads	= 2;
+	e.filename	= "ensemble.bin";
+	reb_mpi_ensemble_run(&e, r);
+
+	int mpi_id;
+	MPI_Comm_rank(MPI_COMM_WORLD, &mpi_id);
+	printf("MPI-node %d integrated %ld simulations.\n", mpi_id, e.N_local);
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (mpi_id==0){
+		long N_escaped = 0;
+		for (long k=0;k<e.N;k++){
+			if (e.status[k]==REB_EXIT_ESCAPE){
+				N_escaped++;
+			}
+		}
+		printf("%ld of %ld systems are unstable.\n", N_escaped, e.N);
+		// Any simulation can be loaded from the archive.
+		struct reb_simulation* s = reb_create_simulation_from_ensemble_archive("ensemble.bin", e.N-1);
+		if (s){
+			printf("Simulation %ld: t=%.1f, N=%d, a=%.3f\n", e.N-1, s->t, s->N, reb_tools_particle_to_orbit(s->G, s->particles[2], s->particles[0]).a);
+			reb_free_simulation(s);
+		}
+	}
+	reb_free_mpi_ensemble_pointers(&e);
+	reb_mpi_finalize(r);
+	reb_free_simulation(r);
+}
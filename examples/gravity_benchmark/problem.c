@@ -0,0 +1,102 @@
+/**
+ * Gravity benchmark
+ *
+ * This example measures the performance of the direct
+ * summation gravity routine (REB_GRAVITY_BASIC). It
+ * compares the vectorized kernel used by REBOUND with
+ * a straightforward scalar loop over the particle
+ * structure and reports the number of particle pairs
+ * evaluated per second for both. The maximum relative
+ * difference between the two accelerations is also
+ * printed. The number of particles can be passed as
+ * a command line argument.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include "rebound.h"
+#include "gravity.h"
+
+static double wall_time(void){
+	struct timeval tim;
+	gettimeofday(&tim, NULL);
+	return tim.tv_sec+(tim.tv_usec/1000000.0);
+}
+
+// Reference implementation: scalar loop over the array of structs.
+static void scalar_acceleration(struct reb_simulation* const r, double* const a){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	for (int i=0; i<N; i++){
+		a[3*i+0] = 0.;
+		a[3*i+1] = 0.;
+		a[3*i+2] = 0.;
+		for (int j=0; j<N; j++){
+			if (i==j) continue;
+			const double dx = particles[i].x - particles[j].x;
+			const double dy = particles[i].y - particles[j].y;
+			const double dz = particles[i].z - particles[j].z;
+			const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+			const double prefact = -G/(_r*_r*_r)*particles[j].m;
+			a[3*i+0] += prefact*dx;
+			a[3*i+1] += prefact*dy;
+			a[3*i+2] += prefact*dz;
+		}
+	}
+}
+
+int main(int argc, char* argv[]){
+	int N = 4000;
+	if (argc>1){
+		N = atoi(argv[1]);
+	}
+	const int repeat = 10;
+	struct reb_simulation* const r = reb_create_simulation();
+	r->gravity	= REB_GRAVITY_BASIC;
+	r->softening 	= 0.01;
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		p.x = reb_random_uniform(-1,1);
+		p.y = reb_random_uniform(-1,1);
+		p.z = reb_random_uniform(-1,1);
+		p.m = 1./(double)N;
+		reb_add(r, p);
+	}
+	const double pairs = (double)N*(double)(N-1)*(double)repeat;
+
+	double* a = malloc(sizeof(double)*3*N);
+	double t0 = wall_time();
+	for (int k=0;k<repeat;k++){
+		scalar_acceleration(r, a);
+	}
+	const double t_scalar = wall_time()-t0;
+
+	t0 = wall_time();
+	for (int k=0;k<repeat;k++){
+		reb_calculate_acceleration(r);
+	}
+	const double t_basic = wall_time()-t0;
+
+	double maxdiff = 0.;
+	for (int i=0;i<N;i++){
+		const struct reb_particle p = r->particles[i];
+		const double anorm = sqrt(a[3*i]*a[3*i] + a[3*i+1]*a[3*i+1] + a[3*i+2]*a[3*i+2]);
+		const double dax = p.ax-a[3*i];
+		const double day = p.ay-a[3*i+1];
+		const double daz = p.az-a[3*i+2];
+		const double diff = sqrt(dax*dax + day*day + daz*daz)/anorm;
+		if (diff>maxdiff) maxdiff = diff;
+	}
+
+	printf("N = %d\n", N);
+	printf("Scalar loop:         %.3e pairs/s\n", pairs/t_scalar);
+	printf("REB_GRAVITY_BASIC:   %.3e pairs/s\n", pairs/t_basic);
+	printf("Speedup:             %.2f\n", t_scalar/t_basic);
+	printf("Max relative difference: %.3e\n", maxdiff);
+
+	free(a);
+	reb_free_simulation(r);
+}
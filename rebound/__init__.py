@@ -18,7 +18,7 @@ if suffix is None:
 import os
 import warnings
 pymodulepath = os.path.dirname(__file__)
-from ctypes import cdll, c_char_p
+from ctypes import cdll, c_char_p, c_int
 clibrebound = cdll.LoadLibrary(pymodulepath+"/../librebound"+suffix)
 
 # Version
@@ -30,6 +30,9 @@ __build__ = c_char_p.in_dll(clibrebound, "reb_build_str").value.decode('ascii')
 # Githash
 __githash__ = c_char_p.in_dll(clibrebound, "reb_githash_str").value.decode('ascii')
 
+# Compiled with zlib (compressed SimulationArchives)
+__zlib__ = c_int.in_dll(clibrebound, "reb_zlib").value==1
+
 # Check for version
 try:
     moduleversion = pkg_resources.require("rebound")[0].version
@@ -67,8 +70,11 @@ class ParticleNotFound(Exception):
 from .simulation import Simulation, Orbit, Variation, reb_simulation_integrator_whfast, reb_simulation_integrator_sei
 from .particle import Particle
 from .plotting import OrbitPlot
-from .tools import hash
-from .simulationarchive import SimulationArchive
+from .tools import hash, particles_to_orbits, orbits_to_particles
+from .simulationarchive import SimulationArchive, SimulationArchiveContainer
+from .ensemble import Ensemble
+from .batch import Batch, MegnoMap
+from .output_shm import SharedMemoryView
 from .interruptible_pool import InterruptiblePool
 
-__all__ = ["__version__", "__build__", "__githash__", "SimulationArchive", "Simulation", "Orbit", "OrbitPlot", "Particle", "SimulationError", "Encounter", "Escape", "NoParticles", "ParticleNotFound", "InterruptiblePool","Variation", "reb_simulation_integrator_whfast", "reb_simulation_integrator_sei"]
+__all__ = ["__version__", "__build__", "__githash__", "SimulationArchive", "SimulationArchiveContainer", "Ensemble", "Batch", "MegnoMap", "SharedMemoryView", "Simulation", "Orbit", "OrbitPlot", "Particle", "SimulationError", "Encounter", "Escape", "NoParticles", "ParticleNotFound", "particles_to_orbits", "orbits_to_particles", "InterruptiblePool","Variation", "reb_simulation_integrator_whfast", "reb_simulation_integrator_sei"]
@@ -0,0 +1,278 @@
+from ctypes import Structure, c_double, c_int, c_long, c_void_p, POINTER, CFUNCTYPE, byref, sizeof
+from . import clibrebound
+from .simulation import Simulation
+
+class Batch(Structure):
+    """
+    Batch Class.
+
+    A batch contains many independent copies of one template simulation,
+    stored in one contiguous array in C. The copies are created in memory 
+    (without pickling or files) and integrated by a pool of native threads 
+    which all run in the same process. Unlike an Ensemble, every copy is a 
+    complete Simulation, so any integrator, gravity routine, collision 
+    detection and built-in force can be used.
+
+    Python callback functions are copied to every simulation, but they 
+    need the global interpreter lock and therefore serialize the threads. 
+    Use C functions or built-in forces (see `Simulation.add_force()`) instead.
+
+    Examples
+    --------
+
+    >>> sim = rebound.Simulation()
+    >>> sim.add(m=1.)
+    >>> sim.add(m=1e-3, a=1.)
+    >>> sim.add(m=1e-3, a=1.5)
+    >>> batch = rebound.Batch(sim, 1000)
+    >>> data = batch.particle_data       # shape (1000,3,7): m, x, y, z, vx, vy, vz
+    >>> data[:,2,1] *= np.linspace(1.,1.1,1000)
+    >>> batch.particle_data = data
+    >>> batch.integrate(100.)
+    >>> t, status = batch.status
+    >>> print(batch[42].particles[2].a)
+
+    """
+    def __init__(self, sim, N, threads=0):
+        """
+        Arguments
+        ---------
+        sim : Simulation
+            The template simulation.
+        N : int
+            Number of copies.
+        threads : int, optional
+            Number of threads used to create and integrate the copies. 
+            Default: 0 (number of processors).
+        """
+        if N<1:
+            raise ValueError("A batch needs at least one simulation.")
+        self._template = sim # keep python callbacks alive
+        self._N_particles = sim.N - sim.N_var
+        clibrebound.reb_init_batch(byref(self), byref(sim), c_int(N), c_int(threads))
+        sim.process_messages()
+
+    def __del__(self):
+        if self._b_needsfree_ == 1:
+            clibrebound.reb_free_batch_pointers(byref(self))
+
+    def __len__(self):
+        return self.N
+
+    def __getitem__(self, k):
+        """
+        Returns simulation k. The Simulation object accesses the memory of the
+        batch directly, changes are made in the batch.
+        """
+        if k<0:
+            k += self.N
+        if k<0 or k>=self.N:
+            raise IndexError("Simulation index out of range.")
+        sim = Simulation.from_address(self._simulations+k*sizeof(Simulation))
+        sim._batch = self # keep the batch alive as long as the simulation is used
+        return sim
+
+    def __iter__(self):
+        for k in range(self.N):
+            yield self[k]
+
+    def integrate(self, tmax):
+        """
+        Integrates all simulations until tmax. 
+
+        The global interpreter lock is released during the integration.
+        Exceptions are not raised for individual simulations. Use `status`
+        to check which simulations finished successfully.
+        """
+        clibrebound.reb_batch_integrate(byref(self), c_double(tmax))
+
+    @property
+    def status(self):
+        """
+        Returns two numpy arrays of length N: the time and the status of every
+        simulation. A status of 0 means the integration finished successfully, 
+        1 means an error occured, 2 that no particles are left, 3 a close 
+        encounter and 4 an escape (see `Simulation.integrate()`).
+        """
+        import numpy as np
+        t = np.zeros(self.N, dtype="float64")
+        status = np.zeros(self.N, dtype="intc")
+        clibrebound.reb_batch_get_status(byref(self), t.ctypes.data_as(POINTER(c_double)), status.ctypes.data_as(POINTER(c_int)))
+        return t, status
+
+    @property
+    def particle_data(self):
+        """
+        Get or set the particles of all simulations as a numpy array of shape
+        (N, number of particles in the template when the batch was created, 7) with columns m, x, y, z, vx, vy, vz. 
+        Particles which no longer exist (e.g. after a merger) are nan.
+        """
+        import numpy as np
+        Np = self._N_particles
+        data = np.zeros((self.N,Np,7), dtype="float64")
+        clibrebound.reb_batch_get_particle_data(byref(self), c_int(Np), data.ctypes.data_as(POINTER(c_double)))
+        return data
+    @particle_data.setter
+    def particle_data(self, data):
+        import numpy as np
+        data = np.ascontiguousarray(data, dtype="float64")
+        if data.ndim != 3 or data.shape[0] != self.N or data.shape[2] != 7:
+            raise ValueError("Need an array of shape (N, number of particles, 7).")
+        clibrebound.reb_batch_set_particle_data(byref(self), c_int(data.shape[1]), data.ctypes.data_as(POINTER(c_double)))
+
+Batch._fields_ = [("N", c_int),
+                  ("threads", c_int),
+                  ("_simulations", c_void_p),
+                  ]
+
+MEGNOMAPSETUPFUNC = CFUNCTYPE(None, POINTER(Simulation), c_double, c_double, c_void_p)
+
+class MegnoMap(Structure):
+    """
+    MegnoMap Class.
+
+    Calculates a MEGNO stability map on a grid of two parameters x and y with 
+    a pool of native threads. For every grid point, a copy of the template
+    simulation is passed to the setup function, MEGNO is initialized and the
+    copy is integrated. Integrations stop early once MEGNO exceeds megno_max,
+    or if the template sets exit_max_distance or exit_min_distance and a 
+    particle escapes or has a close encounter. With refine>0, the grid spacing
+    is halved refine times and only cells with different MEGNO values at their
+    corners are integrated.
+
+    The setup function is a python function and needs the global interpreter
+    lock, but it is only called once per grid point.
+
+    Examples
+    --------
+
+    >>> sim = rebound.Simulation()
+    >>> sim.add(m=1.)
+    >>> sim.add(m=1e-3, a=1.)
+    >>> def setup(s, a, e):
+    ...     s.add(m=1e-3, a=a, e=e, primary=s.particles[0])
+    ...     s.move_to_com()
+    >>> m = rebound.MegnoMap(sim, setup, 50, 40, (1.3,1.8), (0.,0.3), tmax=1e3, refine=2)
+    >>> m.calculate()
+    >>> plt.imshow(m.megno, origin="lower", extent=m.extent)
+
+    """
+    def __init__(self, sim, setup, Nx, Ny, xlim, ylim, tmax, refine=0, megno_max=5., check_interval=None, t_min=0., refine_threshold=1., threads=0):
+        """
+        Arguments
+        ---------
+        sim : Simulation
+            The template simulation. It must not have variational particles.
+        setup : function
+            Called as setup(sim, x, y) with a copy of the template for every grid point.
+        Nx, Ny : int
+            Number of grid points before refinement.
+        xlim, ylim : (float, float)
+            First and last values of x and y.
+        tmax : float
+            Maximum integration time.
+        refine : int, optional
+            Number of refinement levels. Default: 0.
+        megno_max : float, optional
+            Integrations stop once MEGNO exceeds this value. Default: 5.
+        check_interval : float, optional
+            Time between the checks of MEGNO. Default: tmax/100.
+        t_min : float, optional 
+            MEGNO does not stop an integration before this time. Default: 0.
+        refine_threshold : float, optional
+            Cells are refined if MEGNO at their corners differs by more than this. Default: 1.
+        threads : int, optional
+            Number of threads. Default: 0 (number of processors).
+        """
+        clibrebound.reb_init_megno_map(byref(self), c_int(Nx), c_int(Ny), c_double(xlim[0]), c_double(xlim[1]), c_double(ylim[0]), c_double(ylim[1]), c_double(tmax))
+        self._template = sim
+        def _setup(simp, x, y, args):
+            setup(simp.contents, x, y)
+        self._setupfp = MEGNOMAPSETUPFUNC(_setup) # keep the callback alive
+        self._setup = self._setupfp
+        self.refine = refine
+        self.megno_max = megno_max
+        if check_interval is not None:
+            self.check_interval = check_interval
+        self.t_min = t_min
+        self.refine_threshold = refine_threshold
+        self.threads = threads
+
+    def __del__(self):
+        if self._b_needsfree_ == 1:
+            clibrebound.reb_free_megno_map_pointers(byref(self))
+
+    def calculate(self):
+        """
+        Calculates the map. The global interpreter lock is released while 
+        the points are integrated. Returns the number of integrations.
+        """
+        clibrebound.reb_megno_map_calculate.restype = c_long
+        N = clibrebound.reb_megno_map_calculate(byref(self), byref(self._template))
+        self._template.process_messages()
+        return N
+
+    def _array(self, pointer, dtype):
+        import numpy as np
+        if not pointer:
+            raise RuntimeError("The map has not been calculated yet.")
+        return np.ctypeslib.as_array(pointer, shape=(self.Ny_fine, self.Nx_fine)).astype(dtype)
+
+    @property
+    def megno(self):
+        """
+        MEGNO of every grid point as a numpy array of shape (Ny_fine, Nx_fine).
+        """
+        return self._array(self._megno, "float64")
+
+    @property
+    def t(self):
+        """
+        Time at which the integration of every grid point ended, 0 for points which have been filled in.
+        """
+        return self._array(self._t, "float64")
+
+    @property
+    def status(self):
+        """
+        Exit status of every grid point, see `Batch.status`.
+        """
+        return self._array(self._status, "intc")
+
+    @property
+    def level(self):
+        """
+        Refinement level in which every grid point has been integrated, -1 for points which have been filled in.
+        """
+        return self._array(self._level, "intc")
+
+    @property
+    def extent(self):
+        """
+        (xmin, xmax, ymin, ymax), e.g. for matplotlib's imshow.
+        """
+        return (self.xmin, self.xmax, self.ymin, self.ymax)
+
+MegnoMap._fields_ = [("Nx", c_int),
+                  ("Ny", c_int),
+                  ("xmin", c_double),
+                  ("xmax", c_double),
+                  ("ymin", c_double),
+                  ("ymax", c_double),
+                  ("_setup", MEGNOMAPSETUPFUNC),
+                  ("_setup_args", c_void_p),
+                  ("tmax", c_double),
+                  ("check_interval", c_double),
+                  ("t_min", c_double),
+                  ("megno_max", c_double),
+                  ("refine", c_int),
+                  ("refine_threshold", c_double),
+                  ("threads", c_int),
+                  ("Nx_fine", c_int),
+                  ("Ny_fine", c_int),
+                  ("_megno", POINTER(c_double)),
+                  ("_t", POINTER(c_double)),
+                  ("_status", POINTER(c_int)),
+                  ("_level", POINTER(c_int)),
+                  ("N_integrated", c_long),
+                  ]
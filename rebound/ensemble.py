@@ -0,0 +1,111 @@
+from ctypes import Structure, c_double, c_int, c_void_p, POINTER, byref
+from . import clibrebound
+from .simulation import Simulation
+from .particle import Particle
+
+class Ensemble(Structure):
+    """
+    Ensemble Class.
+
+    An ensemble stores many independent systems with the same number of 
+    particles in one contiguous buffer and integrates all of them with 
+    WHFast in one call. This avoids creating one Simulation (and one 
+    process) per system, for example when calculating stability maps.
+
+    All systems share the time, the timestep and the gravitational constant.
+    Symplectic correctors, softening and additional forces are not supported.
+
+    Examples
+    --------
+
+    >>> ens = rebound.Ensemble(1000, 3)
+    >>> ens.dt = 0.01
+    >>> for k in range(1000):
+    >>>     sim = rebound.Simulation()
+    >>>     sim.add(m=1.)
+    >>>     sim.add(m=1e-3, a=1.)
+    >>>     sim.add(m=1e-3, a=1.5+k*0.001)
+    >>>     sim.move_to_com()
+    >>>     ens.set_simulation(k, sim)
+    >>> ens.integrate(100.)
+    >>> sim = ens.get_simulation(42)
+    >>> print(sim.particles[2].a)
+
+    """
+    def __init__(self, N_systems, N):
+        """
+        Arguments
+        ---------
+        N_systems : int
+            Number of systems.
+        N : int
+            Number of particles in each system (at least 2).
+        """
+        if N_systems<1 or N<2:
+            raise ValueError("An ensemble needs at least one system and two particles per system.")
+        clibrebound.reb_init_ensemble(byref(self), c_int(N_systems), c_int(N))
+
+    def __del__(self):
+        if self._b_needsfree_ == 1:
+            clibrebound.reb_free_ensemble_pointers(byref(self))
+
+    def _check_index(self, k):
+        if k<0 or k>=self.N_systems:
+            raise IndexError("System index out of range.")
+
+    def set_simulation(self, k, sim):
+        """
+        Copies the particles of a simulation to system k.
+
+        Only positions, velocities and masses are used. The simulation 
+        needs to have exactly N particles.
+        """
+        self._check_index(k)
+        if sim.N != self.N:
+            raise ValueError("Simulation needs to have %d particles."%self.N)
+        clibrebound.reb_ensemble_set_particles(byref(self), c_int(k), sim._particles)
+
+    def get_simulation(self, k):
+        """
+        Returns a new Simulation with the particles of system k.
+
+        The time, the timestep and the gravitational constant are set to 
+        the values of the ensemble. The integrator is set to WHFast. 
+        """
+        self._check_index(k)
+        ps = (Particle*self.N)()
+        clibrebound.reb_ensemble_get_particles(byref(self), c_int(k), ps)
+        sim = Simulation()
+        sim.G = self.G
+        sim.t = self.t
+        sim.dt = self.dt
+        sim.integrator = "whfast"
+        for p in ps:
+            sim.add(p)
+        return sim
+
+    def integrate(self, tmax):
+        """
+        Integrates all systems until the time of the ensemble reaches tmax.
+
+        Takes the same number of timesteps as Simulation.integrate() with
+        exact_finish_time=0. The systems are distributed over OpenMP 
+        threads if REBOUND was compiled with OpenMP.
+        """
+        for k in range(self.N_systems):
+            if self._is_set[k]==0:
+                raise RuntimeError("Not all systems of the ensemble have been set.")
+        clibrebound.reb_ensemble_integrate(byref(self), c_double(tmax))
+
+Ensemble._fields_ = [("t", c_double),
+                     ("dt", c_double),
+                     ("G", c_double),
+                     ("N_systems", c_int),
+                     ("N", c_int),
+                     ("_r", c_void_p),
+                     ("_N_tiles", c_int),
+                     ("_particles", c_void_p),
+                     ("_p_j", c_void_p),
+                     ("_eta", c_void_p),
+                     ("_is_set", POINTER(c_int)),
+                     ]
@@ -5,23 +5,29 @@ Pull data from HORIZONS and format it for use as a REBOUND particle.
 
 """
 from __future__ import print_function
-import telnetlib
 import datetime
 import re
 import sys
+import os
+import json
 import math
 import warnings
 
-__all__ = ["getParticle"]
+__all__ = ["getParticle", "prefetch"]
 
 # Default date for orbital elements is the current time when first particle added, if no date is passed.
 # Cached at the beginning to ensure that all particles are synchronized.
 # If a date is passed, the same date is used for all subsequent particle adds (that don't themselves pass a date).
 INITDATE = None
 
-def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None, vz=None, primary=None, a=None, anom=None, e=None, omega=None, inc=None, Omega=None, MEAN=None, date=None, plane="ecliptic"):   
-    if plane not in ["ecliptic","frame"]:
-        raise AttributeError("Reference plane needs to be either 'ecliptic' or 'frame'. See Horizons for a definition of these coordinate systems.")
+# Results of HORIZONS queries are stored in this file, keyed by body, date and reference plane.
+# Subsequent queries for the same body, date and plane are read from the file and do not 
+# require an internet connection. Set to None to disable the cache.
+CACHE_FILENAME = os.environ.get("REBOUND_HORIZONS_CACHE", os.path.join(os.path.expanduser("~"), ".rebound", "horizons_cache.json"))
+_cache = None
+_cache_filename = None
+
+def _parseDate(date):
     if date is not None:
         if type(date) is datetime.datetime:
             pass
@@ -36,6 +42,116 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
 
     if date is None: # if no date passed, used cached value
         date = INITDATE
+    return date
+
+def _cacheKey(particle, date, plane):
+    return "%s|%s|%s"%(particle, date.strftime("%Y-%m-%d %H:%M:%S"), plane)
+
+def _loadCache():
+    """
+    Returns the cache as a dictionary. The file is only read once or if CACHE_FILENAME changes.
+    """
+    global _cache, _cache_filename
+    if CACHE_FILENAME is None:
+        return None
+    if _cache is None or _cache_filename != CACHE_FILENAME:
+        _cache_filename = CACHE_FILENAME
+        _cache = {}
+        try:
+            with open(CACHE_FILENAME) as f:
+                _cache = json.load(f)
+        except (IOError, OSError, ValueError):
+            pass
+    return _cache
+
+def _saveCache(entries):
+    """
+    Adds entries to the cache and writes it to disk. The file is written to 
+    a temporary file first and then renamed so that concurrent readers never 
+    see a partially written file.
+    """
+    cache = _loadCache()
+    if cache is None:
+        return
+    try:
+        with open(CACHE_FILENAME) as f:
+            cache.update(json.load(f)) # Keep entries written by other processes
+    except (IOError, OSError, ValueError):
+        pass
+    cache.update(entries)
+    try:
+        directory = os.path.dirname(CACHE_FILENAME)
+        if directory and not os.path.isdir(directory):
+            os.makedirs(directory)
+        tmpfilename = "%s.%d.tmp"%(CACHE_FILENAME, os.getpid())
+        with open(tmpfilename, "w") as f:
+            json.dump(cache, f, indent=1, sort_keys=True)
+        os.rename(tmpfilename, CACHE_FILENAME)
+    except (IOError, OSError):
+        warnings.warn("Cannot write HORIZONS cache file '%s'."%CACHE_FILENAME, RuntimeWarning)
+
+def prefetch(particles, date=None, plane="ecliptic"):
+    """
+    Queries HORIZONS for all bodies in the list particles which are not yet 
+    stored in the cache and adds them to the cache file. This can be used 
+    to prepare the cache on a machine with internet access, for example 
+    before running simulations on compute nodes without internet access. 
+
+    Examples
+    --------
+
+    >>> rebound.horizons.prefetch(["Sun", "Jupiter", "Saturn"], date="2000-01-01 00:00")
+    """
+    if CACHE_FILENAME is None:
+        raise AttributeError("The HORIZONS cache is disabled. Set rebound.horizons.CACHE_FILENAME first.")
+    if plane not in ["ecliptic","frame"]:
+        raise AttributeError("Reference plane needs to be either 'ecliptic' or 'frame'. See Horizons for a definition of these coordinate systems.")
+    date = _parseDate(date)
+    cache = _loadCache()
+    entries = {}
+    for particle in particles:
+        key = _cacheKey(particle, date, plane)
+        if key not in cache:
+            entries[key] = _queryHorizons(particle, date, plane)
+    if entries:
+        _saveCache(entries)
+
+def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None, vz=None, primary=None, a=None, anom=None, e=None, omega=None, inc=None, Omega=None, MEAN=None, date=None, plane="ecliptic", cache=True):   
+    if plane not in ["ecliptic","frame"]:
+        raise AttributeError("Reference plane needs to be either 'ecliptic' or 'frame'. See Horizons for a definition of these coordinate systems.")
+    date = _parseDate(date)
+    key = _cacheKey(particle, date, plane)
+    entries = _loadCache() if cache else None
+    if entries is not None and key in entries:
+        data = entries[key]
+    else:
+        data = _queryHorizons(particle, date, plane)
+        if entries is not None:
+            _saveCache({key: data})
+    p = Particle()
+    p.x, p.y, p.z = data["xyz"]
+    p.vx, p.vy, p.vz = data["vxyz"]
+    idn = data["idn"]
+    if m is not None:
+        p.m = m
+    elif idn is not None:
+        try:
+            p.m = float(re.search(r"BODY%d\_GM .* \( *([\.E\+\-0-9]+ *)\)"%int(idn), HORIZONS_MASS_DATA).group(1))
+            p.m /= Gkmkgs # divide by G (horizons masses give GM)
+        except:
+            warnings.warn("Warning: Mass cannot be retrieved from NASA HORIZONS. Set to 0.", RuntimeWarning)
+            p.m = 0
+    else:
+        warnings.warn("Warning: Mass cannot be retrieved from NASA HORIZONS. Set to 0.", RuntimeWarning)
+        p.m = 0
+    return p
+
+def _queryHorizons(particle, date, plane):
+    """
+    Queries HORIZONS for the position and velocity of particle. Returns a 
+    dictionary with the cartesian coordinates and the HORIZONS id (if found).
+    """
+    import telnetlib
     print("Searching NASA Horizons for '%s'... "%(particle),end="")
     sys.stdout.flush()
 
@@ -62,7 +178,8 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
                ( b'Select\.\.\. .A.gain.* :', 'X\n' ),
                ( b'Select \.\.\. .F.tp.*:', 'selectID' )
     )
-    p = Particle()
+    xyz = [0.,0.,0.]
+    vxyz = [0.,0.,0.]
     startdata = 0
     message = ""
     idn = None
@@ -78,15 +195,9 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
                 if line.strip() == "$$EOE":
                     break
                 if startdata == 2:
-                    pos = [float(i) for i in line.split()]
-                    p.x = pos[0]
-                    p.y = pos[1]
-                    p.z = pos[2]
+                    xyz = [float(i) for i in line.split()][:3]
                 if startdata == 3:
-                    vel = [float(i) for i in line.split()]
-                    p.vx = vel[0]
-                    p.vy = vel[1]
-                    p.vz = vel[2]
+                    vxyz = [float(i) for i in line.split()][:3]
                 if startdata > 0:
                     startdata += 1
                 if "Target body name:" in line:
@@ -115,19 +226,7 @@ def getParticle(particle=None, m=None, x=None, y=None, z=None, vx=None, vy=None,
     if startdata == 0:
         print(message)
         raise SyntaxError("Object not found. See above output from HORIZONS. Please try different identifier or look up JPL Body Number.")
-    if m is not None:
-        p.m = m
-    elif idn is not None:
-        try:
-            p.m = float(re.search(r"BODY%d\_GM .* \( *([\.E\+\-0-9]+ *)\)"%int(idn), HORIZONS_MASS_DATA).group(1))
-            p.m /= Gkmkgs # divide by G (horizons masses give GM)
-        except:
-            warnings.warn("Warning: Mass cannot be retrieved from NASA HORIZONS. Set to 0.", RuntimeWarning)
-            p.m = 0
-    else:
-        warnings.warn("Warning: Mass cannot be retrieved from NASA HORIZONS. Set to 0.", RuntimeWarning)
-        p.m = 0
-    return p
+    return {"xyz": xyz, "vxyz": vxyz, "idn": idn}
 
 
 # There is currently no way to get mass data from HORIZONS.
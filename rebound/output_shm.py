@@ -0,0 +1,127 @@
+from ctypes import Structure, c_double, c_int32, c_uint32, c_uint64, c_void_p, c_char_p, POINTER, cast, memmove, sizeof, addressof
+from . import clibrebound
+
+class reb_output_shm_header(Structure):
+    """
+    Header of a shared memory segment (see `Simulation.output_shm_open()`).
+    """
+    _fields_ = [("magic", c_uint32),
+                ("version", c_uint32),
+                ("seq", c_uint64),
+                ("size", c_uint64),
+                ("hash_offset", c_uint64),
+                ("data_offset", c_uint64),
+                ("N_max", c_int32),
+                ("N", c_int32),
+                ("N_total", c_int32),
+                ("N_active", c_int32),
+                ("snapshots", c_uint64),
+                ("steps", c_uint64),
+                ("t", c_double),
+                ("dt", c_double),
+                ("G", c_double),
+                ("walltime", c_double),
+                ("energy", c_double)]
+
+clibrebound.reb_output_shm_attach.restype = POINTER(reb_output_shm_header)
+clibrebound.reb_output_shm_read_begin.restype = c_uint64
+
+class SharedMemorySnapshot(object):
+    """
+    Copy of one snapshot of a shared memory segment.
+
+    The diagnostics (t, dt, G, N, N_total, N_active, snapshots, steps,
+    walltime and energy) are attributes. The particle data is stored in
+    the lists hash, m, x, y, z, vx, vy and vz, which have N entries each.
+    """
+    _columns = ["m", "x", "y", "z", "vx", "vy", "vz"]
+
+    def __init__(self, header, hash, columns):
+        for name in ["t", "dt", "G", "N", "N_total", "N_active", "snapshots", "steps", "walltime", "energy"]:
+            setattr(self, name, getattr(header, name))
+        self.hash = list(hash)
+        N = header.N
+        for k, name in enumerate(self._columns):
+            setattr(self, name, list(columns[k*N:(k+1)*N]))
+
+class SharedMemoryView(object):
+    """
+    Read-only view of the live snapshots of a simulation running in another process.
+
+    The simulation publishes its particles into a shared memory segment
+    (see `Simulation.output_shm_open()`). Reading a snapshot never slows
+    down the simulation. If the snapshot changes while it is copied,
+    the copy is repeated.
+
+    Examples
+    --------
+
+    >>> view = rebound.SharedMemoryView("/rebound")
+    >>> s = view.snapshot()
+    >>> print(s.t, s.x[1])
+
+    """
+    def __init__(self, name):
+        """
+        Arguments
+        ---------
+        name : str
+            Name of the segment, as passed to `Simulation.output_shm_open()`.
+        """
+        h = clibrebound.reb_output_shm_attach(c_char_p(name.encode("ascii")))
+        if not h:
+            raise RuntimeError("Cannot attach to shared memory segment %s." % name)
+        self._h = h
+
+    def __del__(self):
+        self.detach()
+
+    def detach(self):
+        """
+        Unmap the segment. The view cannot be used afterwards.
+        """
+        if getattr(self, "_h", None):
+            clibrebound.reb_output_shm_detach(self._h)
+            self._h = None
+
+    @property
+    def N_max(self):
+        """
+        Number of particles the segment can hold.
+        """
+        return self._h.contents.N_max
+
+    @property
+    def snapshots(self):
+        """
+        Number of snapshots published so far. Can be used to check for a new snapshot without copying it.
+        """
+        return self._h.contents.snapshots
+
+    def snapshot(self):
+        """
+        Copy the current snapshot.
+
+        Returns
+        -------
+        A SharedMemorySnapshot.
+        """
+        if not self._h:
+            raise RuntimeError("Shared memory segment has been detached.")
+        h = self._h
+        base = cast(h, c_void_p).value
+        N_max = h.contents.N_max
+        header = reb_output_shm_header()
+        hash = (c_uint32*N_max)()
+        columns = (c_double*(7*N_max))()
+        while True:
+            seq = clibrebound.reb_output_shm_read_begin(h)
+            memmove(addressof(header), base, sizeof(reb_output_shm_header))
+            N = min(max(header.N, 0), N_max)
+            memmove(hash, base+header.hash_offset, sizeof(c_uint32)*N)
+            for k in range(7):
+                memmove(addressof(columns)+sizeof(c_double)*k*N, base+header.data_offset+sizeof(c_double)*k*N_max, sizeof(c_double)*N)
+            if clibrebound.reb_output_shm_read_retry(h, c_uint64(seq))==0:
+                break
+        header.N = N
+        return SharedMemorySnapshot(header, hash[:N], columns[:7*N])
@@ -415,6 +415,60 @@ class Particle(Structure):
             raise ValueError("Particle and primary positions are the same.")
 
         return o
+
+    def calculate_derivatives(self, primary=None, G=None, elements="pal", order=1):
+        """ 
+        Returns the derivatives of the particle's Cartesian coordinates 
+        with respect to all orbital elements. 
+
+        Computes the orbital elements only once, so this is faster than 
+        creating one variational particle after another.
+        
+        Examples
+        --------
+        
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1e-3, a=1., e=0.1)
+        >>> first, second = sim.particles[1].calculate_derivatives(order=2)
+        >>> print(first[1].x) # derivative of x with respect to a
+
+        Parameters
+        ----------
+        primary : rebound.Particle
+            Central body (Optional. Default uses the first particle of the simulation)
+        G : float
+            Gravitational constant (Optional. Default takes G from simulation in which particle is in)
+        elements : str
+            "pal" for the elements m, a, k, h, lambda, ix, iy of Pal (2009) 
+            or "orbit" for m, a, e, inc, omega, Omega, f.
+        order : int
+            1 for first derivatives only, 2 for first and second derivatives.
+        
+        Returns
+        -------
+        A list of 7 rebound.Particle objects with the first derivatives. 
+        If order=2, a tuple of this list and a 7x7 list of lists with the second derivatives.
+        """
+        if primary is None:
+            if not self._sim:
+                raise ValueError("Particle does not belong to any simulation and no primary given.")
+            primary = self._sim.contents.particles[0]
+        if G is None:
+            if not self._sim:
+                raise ValueError("Particle does not belong to any simulation and G not given.")
+            G = self._sim.contents.G
+        ELEMENTS = {"pal": 0, "orbit": 1}
+        if elements not in ELEMENTS:
+            raise ValueError("Elements need to be either 'pal' or 'orbit'.")
+        if order not in [1, 2]:
+            raise ValueError("Order needs to be 1 or 2.")
+        first = (Particle*7)()
+        second = (Particle*49)() if order==2 else None
+        clibrebound.reb_derivatives_all(c_double(G), byref(primary), byref(self), c_int(1), c_int(ELEMENTS[elements]), first, second)
+        if order==1:
+            return list(first)
+        return list(first), [list(second[7*j:7*j+7]) for j in range(7)]
     
     # Simple operators for particles.
 
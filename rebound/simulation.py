@@ -1,9 +1,10 @@
-from ctypes import Structure, c_double, POINTER, c_float, c_int, c_uint, c_uint32, c_int64, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast
+from ctypes import Structure, c_double, POINTER, c_float, c_int, c_uint, c_uint32, c_uint64, c_int64, c_long, c_ulong, c_ulonglong, c_void_p, c_char, c_char_p, c_size_t, CFUNCTYPE, byref, create_string_buffer, addressof, pointer, cast, sizeof
 from . import clibrebound, Escape, NoParticles, Encounter, SimulationError, ParticleNotFound
 from .particle import Particle
 from .units import units_convert_particle, check_units, convert_G
 from .tools import hash as rebhash
 import math
+import array
 import os
 import sys
 import ctypes.util
@@ -20,10 +21,10 @@ import types
 ### The following enum and class definitions need to
 ### consitent with those in rebound.h
         
-INTEGRATORS = {"ias15": 0, "whfast": 1, "sei": 2, "leapfrog": 4, "hermes": 5, "whfasthelio": 6, "none": 7, "janus": 8}
+INTEGRATORS = {"ias15": 0, "whfast": 1, "sei": 2, "leapfrog": 4, "hermes": 5, "whfasthelio": 6, "none": 7, "janus": 8, "saba": 9, "mercurius": 10}
 BOUNDARIES = {"none": 0, "open": 1, "periodic": 2, "shear": 3}
-GRAVITIES = {"none": 0, "basic": 1, "compensated": 2, "tree": 3}
-COLLISIONS = {"none": 0, "direct": 1, "tree": 2}
+GRAVITIES = {"none": 0, "basic": 1, "compensated": 2, "tree": 3, "fmm": 4, "opencl": 5, "fft": 6, "treepm": 7}
+COLLISIONS = {"none": 0, "direct": 1, "tree": 2, "sweep": 3, "grid": 4}
 VISUALIZATIONS = {"none": 0, "opengl": 1, "webgl": 2}
 BINARY_WARNINGS = [
     ("Cannot read binary file. Check filename and file contents.", 1),
@@ -66,6 +67,101 @@ class reb_collision(Structure):
                 ("time", c_double),
                 ("ri", c_int)]
 
+class reb_neighbour(Structure):
+    _fields_ = [("index", c_int),
+                ("dx", c_double),
+                ("dy", c_double),
+                ("dz", c_double),
+                ("r2", c_double)]
+
+class reb_particles_soa(Structure):
+    _fields_ = [("x", POINTER(c_double)),
+                ("y", POINTER(c_double)),
+                ("z", POINTER(c_double)),
+                ("vx", POINTER(c_double)),
+                ("vy", POINTER(c_double)),
+                ("vz", POINTER(c_double)),
+                ("m", POINTER(c_double)),
+                ("r", POINTER(c_double)),
+                ("N", c_int),
+                ("allocatedN", c_int)]
+
+class reb_output_stream_batch(Structure):
+    """
+    One batch of particle data passed to the callback of an output stream 
+    (see Simulation.add_output_stream). The arrays have N entries and are 
+    only valid during the callback.
+    """
+    _fields_ = [("t", c_double),
+                ("G", c_double),
+                ("N", c_int),
+                ("dropped", c_ulong),
+                ("hash", POINTER(c_uint32)),
+                ("m", POINTER(c_double)),
+                ("x", POINTER(c_double)),
+                ("y", POINTER(c_double)),
+                ("z", POINTER(c_double)),
+                ("vx", POINTER(c_double)),
+                ("vy", POINTER(c_double)),
+                ("vz", POINTER(c_double)),
+                ("a", POINTER(c_double)),
+                ("e", POINTER(c_double)),
+                ("inc", POINTER(c_double)),
+                ("Omega", POINTER(c_double)),
+                ("omega", POINTER(c_double)),
+                ("f", POINTER(c_double))]
+
+OSFF = CFUNCTYPE(None, POINTER(reb_output_stream_batch), c_void_p)
+
+class reb_samples(Structure):
+    """
+    Output buffers of Simulation.integrate_samples.
+    """
+    _fields_ = [("N", c_int),
+                ("t", POINTER(c_double)),
+                ("xyz", POINTER(c_double)),
+                ("vxvyvz", POINTER(c_double)),
+                ("orbits", POINTER(c_double)),
+                ("energy", POINTER(c_double))]
+
+class reb_metrics(Structure):
+    """
+    Counters of the work done by a simulation (see Simulation.get_metrics).
+    """
+    _fields_ = [("steps", c_uint64),
+                ("interactions", c_uint64),
+                ("cells_opened", c_uint64),
+                ("collisions_found", c_uint64),
+                ("collisions_resolved", c_uint64),
+                ("ias15_iterations", c_uint64),
+                ("ias15_rejections", c_uint64),
+                ("hermes_activations", c_uint64),
+                ("simulationarchive_bytes", c_uint64),
+                ("walltime", c_double),
+                ("_walltime_start", c_double),
+                ("energy_initial", c_double),
+                ("energy_drift", c_double),
+                ("steps_per_second", c_double),
+                ("interactions_per_second", c_double),
+                ("collisions_per_second", c_double)]
+
+    def __repr__(self):
+        return "<rebound.reb_metrics steps=%d interactions=%d walltime=%g>" % (self.steps, self.interactions, self.walltime)
+
+class reb_profiling_region(Structure):
+    """
+    Timing data of one profiling region (see Simulation.get_profiling).
+    """
+    _fields_ = [("name", c_char_p),
+                ("parent", c_int),
+                ("calls", c_ulonglong),
+                ("time", c_double),
+                ("time_self", c_double),
+                ("counters", c_ulonglong*5)]
+
+REB_PROFILING_CAT_N = 14
+REB_PROFILING_COUNTERS = ["cycles", "instructions", "cache_references", "cache_misses", "branch_misses"]
+
 class reb_simulation_integrator_sei(Structure):
     """
     This class is an abstraction of the C-struct reb_simulation_integrator_sei.
@@ -98,8 +194,11 @@ class reb_simulation_integrator_ias15(Structure):
     _fields_ = [("epsilon", c_double),
                 ("min_dt", c_double),
                 ("epsilon_global", c_uint),
+                ("block_levels", c_uint),
+                ("lean", c_uint),
                 ("iterations_max_exceeded", c_ulong),
                 ("allocatedN", c_int),
+                ("csb_allocatedN", c_int),
                 ("at", POINTER(c_double)),
                 ("x0", POINTER(c_double)),
                 ("v0", POINTER(c_double)),
@@ -112,7 +211,8 @@ class reb_simulation_integrator_ias15(Structure):
                 ("csb", reb_dp7),
                 ("e", reb_dp7),
                 ("br", reb_dp7),
-                ("er", reb_dp7)]
+                ("er", reb_dp7),
+                ("_block", c_void_p)]
 
 class reb_simulation_integrator_whfast(Structure):
     """
@@ -155,7 +255,87 @@ class reb_simulation_integrator_whfast(Structure):
                 ("is_synchronized", c_uint),
                 ("allocatedN", c_uint),
                 ("timestep_warning", c_uint),
-                ("recalculate_jacobi_but_not_synchronized_warning", c_uint)]
+                ("recalculate_jacobi_but_not_synchronized_warning", c_uint),
+                ("N_massive", c_uint),
+                ("_p_j_resume", POINTER(Particle)),
+                ("_particles_resume", POINTER(Particle)),
+                ("_resume_N", c_uint),
+                ("_resume_allocated_N", c_uint),
+                ("_resume_dt", c_double)]
+
+class reb_simulation_integrator_saba(Structure):
+    """
+    This class is an abstraction of the C-struct reb_simulation_integrator_saba.
+    It controls the behaviour of the SABAn and SABACn integrators of Laskar
+    and Robutel (2001). They use the same Jacobi coordinates as WHFast, but
+    chain several drift and kick stages per timestep.
+    
+    This struct should be accessed via the simulation class only. Here is an 
+    example:
+
+    >>> sim = rebound.Simulation()
+    >>> sim.integrator = "saba"
+    >>> sim.ri_saba.type = 3
+    
+    :ivar int type:      
+        The number of stages (kicks) per timestep, between 1 and 4 (default 2).
+    :ivar int corrector:
+        If set to 1, the SABACn scheme is used which removes the error term
+        which is second order in the perturbation with a corrector (default 0).
+    :ivar int safe_mode:
+        If safe_mode is 1 (default), particles are synchronised after every 
+        timestep. If set to 0, the last drift of one timestep is combined with
+        the first drift of the next one. Set ri_whfast.recalculate_jacobi_this_timestep
+        if you change particles inbetween timesteps.
+    """
+    _fields_ = [("type", c_uint),
+                ("corrector", c_uint),
+                ("safe_mode", c_uint),
+                ("is_synchronized", c_uint),
+                ("_corrector_buffer", POINTER(c_double)),
+                ("_corrector_buffer_N", c_uint)]
+
+class reb_simulation_integrator_mercurius(Structure):
+    """
+    This class is an abstraction of the C-struct reb_simulation_integrator_mercurius.
+    It controls the behaviour of the hybrid symplectic MERCURIUS integrator. 
+    Interactions between particles are split with a smooth changeover function.
+    Particles in close encounters are integrated with a Bulirsch-Stoer integrator,
+    all others with the WHFast Kepler solver in democratic heliocentric coordinates.
+    
+    This struct should be accessed via the simulation class only. Here is an 
+    example:
+
+    >>> sim = rebound.Simulation()
+    >>> sim.integrator = "mercurius"
+    >>> sim.ri_mercurius.hillfac = 4.
+    
+    :ivar float hillfac:      
+        Changeover radius in units of the Hill radius (default 3).
+    :ivar float encounter_epsilon:      
+        Relative accuracy of the Bulirsch-Stoer integrator used for close encounters (default 1e-12).
+    :ivar int recalculate_coordinates_this_timestep:
+        Setting this flag to 1 recalculates the heliocentric coordinates and 
+        changeover radii in the next timestep.
+    :ivar int safe_mode:
+        If safe_mode is 1 (default) particles are synchronised after every timestep.
+        Set it to 0 to combine the kicks of subsequent timesteps.
+    :ivar int encounter_N:
+        Number of particles in close encounters during the last timestep.
+    """
+    _fields_ = [("hillfac", c_double),
+                ("encounter_epsilon", c_double),
+                ("recalculate_coordinates_this_timestep", c_uint),
+                ("safe_mode", c_uint),
+                ("encounter_N", c_uint),
+                ("is_synchronized", c_uint),
+                ("_allocated_N", c_uint),
+                ("_p_h", POINTER(Particle)),
+                ("_p_h0", POINTER(Particle)),
+                ("_dcrit", POINTER(c_double)),
+                ("_encounter_map", POINTER(c_int)),
+                ("_encounter_buffer", POINTER(c_double)),
+                ("_encounter_allocated_N", c_uint)]
 
 class reb_simulation_integrator_whfasthelio(Structure):
     """
@@ -198,7 +378,10 @@ class reb_simulation_integrator_whfasthelio(Structure):
                 ("keep_unsynchronized", c_uint),
                 ("allocatedN", c_uint),
                 ("is_synchronized", c_uint),
-                ("recalculate_heliocentric_but_not_synchronized_warning", c_uint)]
+                ("recalculate_heliocentric_but_not_synchronized_warning", c_uint),
+                ("_particles_sync", POINTER(Particle)),
+                ("_sync_N", c_uint),
+                ("_sync_allocated_N", c_uint)]
 
 
 class Orbit(Structure):
@@ -374,6 +557,35 @@ class Simulation(Structure):
                 warnings.warn(message, RuntimeWarning)
         return sim
 
+    def copy(self):
+        """
+        Returns a deep copy of the simulation.
+
+        The copy is made in memory, without going through a binary file.
+        It includes the particles, variational particles, built-in forces
+        and the state of the integrator. Integrating the copy gives exactly
+        the same result as integrating the original. Python functions set
+        as callbacks (additional_forces, heartbeat, etc) are shared
+        with the original. Visualizations, the SimulationArchive file and
+        REBOUNDx effects are not copied.
+
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.add(m=1.)
+        >>> sim.add(m=1.e-3,x=1.,vy=1.)
+        >>> sim_copy = sim.copy()
+        >>> sim_copy.particles[1].x += 1e-8  # shadow trajectory
+        """
+        sim = Simulation.__new__(Simulation)
+        clibrebound.reb_init_simulation_copy(byref(sim), byref(self))
+        for name in ["_afp", "_pretmp", "_posttmp", "_hb", "_corfp", "_colrfp"]:
+            if hasattr(self, name):     # Keep python callbacks alive
+                setattr(sim, name, getattr(self, name))
+        self.process_messages()
+        return sim
+
     def getWidget(self,**kwargs):
         """
         Wrapper function that returns a new widget attached to this simulation.
@@ -467,7 +679,7 @@ class Simulation(Structure):
         self.process_messages()
         return estsize
         
-    def initSimulationArchive(self, filename, interval=None, interval_walltime=None):
+    def initSimulationArchive(self, filename, interval=None, interval_walltime=None, fsync_interval=0, compression=0, keyframe_interval=0, member=None):
         """
         This function initializes the Simulation Archive so that
         binary data can be outputted to the SimulationArchive file 
@@ -483,6 +695,24 @@ class Simulation(Structure):
         interval_walltime : float
             Interval between outputs in wall time (seconds). 
             Useful when using IAS15 with adaptive timesteps. 
+        fsync_interval : int
+            Flush the file to disk (fsync) after this many snapshots.
+            Default: 0 (never, the operating system decides).
+        compression : int
+            If set to 1, snapshots are compressed (lossless).
+            Default: 0 (no compression).
+        keyframe_interval : int
+            If larger than 0, only every keyframe_interval-th snapshot is
+            stored in full. The snapshots in between are stored as compressed
+            differences to the previous snapshot. Implies compression.
+            Default: 0 (all snapshots are stored in full).
+        member : int
+            If given, the snapshots are appended as this member to the 
+            SimulationArchive container `filename`, which can hold the
+            archives of many simulations. Every simulation appending to 
+            the same container needs to use a different member index.
+            Read it with the SimulationArchiveContainer class.
+            Default: None (the SimulationArchive is a file of its own).
         
         Examples
         --------
@@ -503,6 +733,10 @@ class Simulation(Structure):
         self.simulationarchive_next = 0.
         self.simulationarchive_interval = 0. 
         self.simulationarchive_interval_walltime = 0.
+        self.simulationarchive_fsync_interval = fsync_interval
+        self.simulationarchive_compression = compression
+        self.simulationarchive_keyframe_interval = keyframe_interval
+        self.simulationarchive_member = -1 if member is None else member
         if interval:
             self.simulationarchive_interval = interval
         if interval_walltime:
@@ -567,6 +801,57 @@ class Simulation(Structure):
         self._afp = AFF(func)
         self._additional_forces = self._afp
 
+    def add_force(self, name, **kwargs):
+        """
+        Adds a built-in additional force. 
+
+        The built-in forces are compiled C functions. They run in every force
+        evaluation without calling back into python and can be combined with each 
+        other and with `additional_forces`. Forces act on all particles except the 
+        primary, which does not feel any back-reaction. Velocity dependent forces 
+        set `force_is_velocity_dependent`.
+
+        Parameters
+        ----------
+        name : str
+            One of the following:
+
+            - ``'drag'``: Linear drag, a = -gamma*v. Parameter: gamma.
+            - ``'j2'``: Oblateness of the primary. Parameters: J2, R (radius of the primary), obliquity.
+            - ``'prdrag'``: Radiation pressure and Poynting-Robertson drag, only acting on massless particles. Parameters: beta, c.
+            - ``'gr'``: First order post-Newtonian correction for test particles. Parameter: c.
+        
+            The default speed of light c is that in units where G=1, with masses in solar masses,
+            distances in AU and time in yr/(2 pi).
+        primary : int, optional
+            Index of the central body (j2, prdrag and gr). Default: 0.
+        **kwargs 
+            Parameters of the force.
+
+        Returns
+        -------
+        The index of the force.
+
+        Examples
+        --------
+
+        >>> sim.add_force("j2", J2=16298e-6, R=0.00038925688)
+        >>> sim.add_force("drag", gamma=1e-3)
+
+        """
+        index = clibrebound.reb_add_force(byref(self), c_char_p(name.encode("ascii")))
+        self.process_messages()
+        for k, v in kwargs.items():
+            clibrebound.reb_set_force_parameter(byref(self), c_int(index), c_char_p(k.encode("ascii")), c_double(v))
+            self.process_messages()
+        return index
+
+    def remove_forces(self):
+        """
+        Removes all built-in additional forces (see `add_force()`).
+        """
+        clibrebound.reb_remove_forces(byref(self))
+
     @property
     def pre_timestep_modifications(self):
         """
@@ -612,6 +897,10 @@ class Simulation(Structure):
 
         The function called will receive a pointer to the simulation
         object as its argument.
+
+        A python heartbeat function needs to reacquire the global interpreter
+        lock every time it is called. Set `heartbeat_interval` to call it only 
+        every `heartbeat_interval` timesteps.
         
         Examples
         --------
@@ -668,6 +957,66 @@ class Simulation(Structure):
         else:
             self._colrfp = COLRFF(func)
             self._collision_resolve = self._colrfp
+
+    @property 
+    def collision_resolve_batch(self):
+        """
+        Get or set a function which resolves all collisions of a timestep at once.
+
+        If set, it is used instead of `collision_resolve`. The function is called 
+        once per timestep (if there are any collisions) with two arguments: a 
+        pointer to the simulation and a dictionary of numpy arrays with one entry 
+        per collision (each pair of particles appears only once):
+
+        - "p1", "p2": indices of the colliding particles (int32)
+        - "gb": ghostbox shift of particle p1, shape (N,6): x, y, z, vx, vy, vz
+        - "time": time of the collision
+        - "dx", "dv": relative position and velocity of p1 (shifted by its 
+          ghostbox) with respect to p2, shape (N,3)
+
+        The function can change the particles, for example with `particle_views`. 
+        It returns None if no particles are removed, or a sequence of N outcomes 
+        with the same meaning as the return value of `collision_resolve`: 
+        1 (2) removes particle p1 (p2), 3 removes both. Particles are removed after 
+        the function returns, so all indices in the arrays stay valid. 
+        Set to None to go back to `collision_resolve`.
+
+        Examples
+        --------
+
+        >>> def merge_all(sim_pointer, c):
+        >>>     views = sim_pointer.contents.particle_views
+        >>>     ...  # merge particle c["p2"] into c["p1"]
+        >>>     return np.full(len(c["p1"]), 2)
+        >>> sim.collision_resolve_batch = merge_all
+        """
+        raise AttributeError("You can only set C function pointers from python.")
+    @collision_resolve_batch.setter
+    def collision_resolve_batch(self, func):
+        if func is None:
+            self._colrbfp = COLRBFF()
+            self._collision_resolve_batch = self._colrbfp
+            return
+        def _batch(sim_pointer, collisions, N, outcomes):
+            import numpy as np
+            dtype = np.dtype({"names": ["p1", "p2", "gb", "time"],
+                              "formats": [np.int32, np.int32, (np.float64, 6), np.float64],
+                              "offsets": [reb_collision.p1.offset, reb_collision.p2.offset, reb_collision.gb.offset, reb_collision.time.offset],
+                              "itemsize": sizeof(reb_collision)})
+            buf = (c_char*(N*sizeof(reb_collision))).from_address(addressof(collisions.contents))
+            raw = np.frombuffer(buf, dtype=dtype)
+            dxv = np.empty((N,6), dtype="float64")
+            clibrebound.reb_collision_relative_states(sim_pointer, collisions, c_int(N), dxv.ctypes.data_as(POINTER(c_double)))
+            c = {"p1": raw["p1"].copy(), "p2": raw["p2"].copy(), "gb": raw["gb"].copy(), "time": raw["time"].copy(),
+                 "dx": dxv[:,0:3], "dv": dxv[:,3:6]}
+            result = func(sim_pointer, c)
+            if result is not None:
+                result = np.ascontiguousarray(result, dtype=np.int32)
+                if result.shape != (N,):
+                    raise ValueError("collision_resolve_batch needs to return None or one outcome per collision.")
+                ctypes.memmove(outcomes, result.ctypes.data, sizeof(c_int)*N)
+        self._colrbfp = COLRBFF(_batch)
+        self._collision_resolve_batch = self._colrbfp
     
     @property 
     def free_particle_ap(self):
@@ -701,6 +1050,10 @@ class Simulation(Structure):
         - ``'sei'``
         - ``'leapfrog'``
         - ``'hermes'``
+        - ``'janus'``
+        - ``'mercurius'``
+        - ``'saba'``, or ``'saba1'`` to ``'saba4'`` and ``'sabac1'`` to ``'sabac4'`` 
+          which also set the type and corrector in ``ri_saba``
         - ``'none'``
         
         Check the online documentation for a full description of each of the integrators. 
@@ -720,6 +1073,10 @@ class Simulation(Structure):
             value = value.lower()
             if value in INTEGRATORS: 
                 self._integrator = INTEGRATORS[value]
+            elif value in ["saba1", "saba2", "saba3", "saba4", "sabac1", "sabac2", "sabac3", "sabac4"]:
+                self._integrator = INTEGRATORS["saba"]
+                self.ri_saba.type = int(value[-1])
+                self.ri_saba.corrector = 1 if value[4]=="c" else 0
             elif value.lower() == "mercury":
                 debug.integrator_package = "MERCURY"
             elif value.lower() == "swifter-whm":
@@ -774,6 +1131,10 @@ class Simulation(Structure):
         - ``'basic'`` (default)
         - ``'compensated'``
         - ``'tree'``
+        - ``'fmm'``
+        - ``'opencl'`` (requires compiling with OPENCL=1)
+        - ``'fft'`` (thin sheets in periodic or shear periodic boxes, set fft_nx and fft_ny)
+        - ``'treepm'`` (as ``'fft'``, but the short range force is calculated with the tree, set fft_rs)
         
         Check the online documentation for a full description of each of the modules. 
         """
@@ -803,6 +1164,8 @@ class Simulation(Structure):
         - ``'none'`` (default)
         - ``'direct'``
         - ``'tree'``
+        - ``'sweep'``
+        - ``'grid'``
         
         Check the online documentation for a full description of each of the modules. 
         """
@@ -1004,13 +1367,18 @@ class Simulation(Structure):
         """
         if particle is not None:
             if isinstance(particle, Particle):
-                if (self.gravity == "tree" or self.collision == "tree") and self.root_size <=0.:
+                if (self.gravity == "tree" or self.gravity == "fmm" or self.gravity == "treepm" or self.collision == "tree") and self.root_size <=0.:
                     raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
 
                 clibrebound.reb_add(byref(self), particle)
             elif isinstance(particle, list):
-                for p in particle:
-                    self.add(p, **kwargs)
+                if len(particle) and not kwargs and all(isinstance(p, Particle) for p in particle):
+                    if (self.gravity == "tree" or self.gravity == "fmm" or self.gravity == "treepm" or self.collision == "tree") and self.root_size <=0.:
+                        raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
+                    clibrebound.reb_add_many(byref(self), (Particle*len(particle))(*particle), c_int(len(particle)))
+                else:
+                    for p in particle:
+                        self.add(p, **kwargs)
             elif isinstance(particle,str):
                 if None in self.units.values():
                     self.units = ('AU', 'yr2pi', 'Msun')
@@ -1080,6 +1448,66 @@ class Simulation(Structure):
 
         self.process_messages()
 
+    def reorder_particles(self):
+        """
+        Sorts the particle array along a Morton (Z-order) curve so that particles which
+        are close in space are also close in memory. This speeds up the tree code, the 
+        collision search and the direct summation. Active particles and test particles 
+        are sorted separately. Set `reorder_interval` to do this automatically every 
+        `reorder_interval` timesteps.
+
+        Returns
+        -------
+        True if the particles have been reordered. False if the integrator does not support 
+        reordering (WHFast, SABA, HERMES, IAS15 with block timesteps) or if there are 
+        variational particles.
+
+        Examples
+        --------
+
+        >>> sim = rebound.Simulation()
+        >>> sim.integrator = "leapfrog"
+        >>> sim.add(m=1., x=1.)
+        >>> sim.add(m=1., x=-1.)
+        >>> sim.add(m=1., x=0.5)
+        >>> sim.reorder_particles()
+        True
+        >>> [p.x for p in sim.particles]
+        [-1.0, 0.5, 1.0]
+        """
+        ret = clibrebound.reb_reorder_particles(byref(self))
+        self.process_messages()
+        return bool(ret)
+
+    def remove_mark(self, index):
+        """
+        Marks a particle for removal. The particle is removed when remove_marked() is called.
+        This is much faster than calling remove() for each particle when removing many particles.
+
+        Parameters
+        ----------
+        index : int
+            Index of the particle to remove.
+        """
+        clibrebound.reb_remove_mark(byref(self), index)
+        self.process_messages()
+
+    def remove_marked(self, keepSorted=True):
+        """
+        Removes all particles marked with remove_mark() at once. Returns the number of particles removed.
+
+        Parameters
+        ----------
+        keepSorted : bool, optional
+            By default, the order of the remaining particles is preserved. 
+            Otherwise, particles from the end of the particles array are moved into the gaps.
+        """
+        N = clibrebound.reb_remove_marked(byref(self), keepSorted)
+        if hasattr(self, '_widgets'):
+            self._display_heartbeat(pointer(self))
+        self.process_messages()
+        return N
+
     def particles_ascii(self, prec=8):
         """
         Returns an ASCII string with all particles' masses, radii, positions and velocities.
@@ -1105,15 +1533,110 @@ class Simulation(Structure):
         s : string
             One particle per line. Each line should include particle's mass, radius, position and velocity.
         """
+        data = array.array('d')
         for l in s.split("\n"):
-            r = l.split()
+            r = l.replace(","," ").split()
             if len(r):
                 try:
-                    r = [float(x) for x in r]
-                    p = Particle(simulation=self, m=r[0], r=r[1], x=r[2], y=r[3], z=r[4], vx=r[5], vy=r[6], vz=r[7])
-                    self.add(p)
+                    data.extend([float(x) for x in r[:8]])
+                    if len(r)<8:
+                        raise ValueError()
                 except:
                     raise AttributeError("Each line requires 8 floats corresponding to mass, radius, position (x,y,z) and velocity (x,y,z).")
+        self._add_particle_records(data)
+
+    def add_particles_file(self, filename, binary=False):
+        """
+        Adds particles from an initial-condition file.
+
+        Parameters
+        ----------
+        filename : string
+            Name of the file.
+        binary : bool, optional
+            If False (default), the file is a text file with one particle per line, 
+            see add_particles_ascii(). Columns can be separated by whitespace or commas. 
+            If True, the file contains 8 native float64 values per particle:
+            mass, radius, position (x,y,z) and velocity (x,y,z).
+        """
+        if binary:
+            data = array.array('d')
+            with open(filename, "rb") as f:
+                data.frombytes(f.read())
+            if len(data)%8:
+                raise AttributeError("Binary file does not contain a multiple of 8 float64 values.")
+            self._add_particle_records(data)
+        else:
+            with open(filename, "r") as f:
+                self.add_particles_ascii(f.read())
+
+    def _add_particle_records(self, data):
+        # data is an array.array('d') with 8 values (m, r, x, y, z, vx, vy, vz) per particle
+        N = len(data)//8
+        if N==0:
+            return
+        m, radius = data[0::8], data[1::8]
+        xyz, vxvyvz = array.array('d', bytes(8*3*N)), array.array('d', bytes(8*3*N))
+        for k in range(3):
+            xyz[k::3] = data[2+k::8]
+            vxvyvz[k::3] = data[5+k::8]
+        d = [(c_double*len(a)).from_buffer(a) for a in (m, radius, xyz, vxvyvz)]
+        self._add_particle_data(N, None, *d)
+
+    def _add_particle_data(self, N, hash, m, radius, xyz, vxvyvz):
+        if (self.gravity == "tree" or self.gravity == "fmm" or self.gravity == "treepm" or self.collision == "tree") and self.root_size <=0.:
+            raise ValueError("The tree code for gravity and/or collision detection has been selected. However, the simulation box has not been configured yet. You cannot add particles until the the simulation box has a finite size.")
+        clibrebound.reb_add_serialized_particle_data(byref(self), c_int(N), hash, m, radius, xyz, vxvyvz)
+        self.process_messages()
+        if hasattr(self, '_widgets'):
+            self._display_heartbeat(pointer(self))
+
+    def add_particle_data(self, **kwargs):
+        """
+        Fast way to add many particles from numpy arrays.
+
+        This is the inverse of serialize_particle_data(). All particles are
+        copied on the C side, the particle array is only reallocated once and
+        the tree (if used) is only built once.
+        Possible argument names are "hash", "m", "r", "xyz", "vxvyvz" with the 
+        same data types and shapes as in serialize_particle_data(). 
+        All arrays need to describe the same number of particles. Fields
+        that are not given are set to zero. 
+
+        Examples
+        --------
+        This adds 1000 particles at rest on a line:
+
+        >>> import numpy as np
+        >>> xyz = np.zeros((1000,3),dtype="float64")
+        >>> xyz[:,0] = np.linspace(1.,2.,1000)
+        >>> m = np.full(1000,1e-6)
+        >>> sim.add_particle_data(m=m, xyz=xyz)
+
+        """
+        possible_keys = ["hash","m","r","xyz","vxvyvz"]
+        d = {x:None for x in possible_keys}
+        N = None
+        for k,v in kwargs.items():
+            if k in d:
+                if not v.flags["C_CONTIGUOUS"]:
+                    raise AttributeError("Array '%s' needs to be contiguous."%k)
+                if k == "hash":
+                    if v.dtype!= "uint32":
+                        raise AttributeError("Expected 'uint32' data type for '%s' array."%k)
+                    d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32))
+                else:
+                    if v.dtype!= "float64":
+                        raise AttributeError("Expected 'float64' data type for %s array."%k)
+                    d[k] = v.ctypes.data_as(ctypes.POINTER(ctypes.c_double))
+                n = v.size//3 if k in ["xyz", "vxvyvz"] else v.size
+                if N is not None and n!=N:
+                    raise AttributeError("All arrays need to have the same number of particles.")
+                N = n
+            else:
+                raise AttributeError("Only '%s' are currently supported attributes." % "', '".join(d.keys()))
+        if N:
+            self._add_particle_data(N, d["hash"], d["m"], d["r"], d["xyz"], d["vxvyvz"])
 
 # Orbit calculation
     def calculate_orbits(self, heliocentric=False, barycentric=False):
@@ -1263,6 +1786,83 @@ class Simulation(Structure):
 
         clibrebound.reb_serialize_particle_data(byref(self), d["hash"], d["m"], d["r"], d["xyz"], d["vxvyvz"])
 
+    @property
+    def particles_soa(self):
+        """
+        Structure-of-arrays access to the particle state via numpy arrays.
+
+        Returns a dictionary with the keys "x", "y", "z", "vx", "vy", "vz", "m" and "r".
+        Each entry is a numpy array of length sim.N which directly accesses the 
+        memory of the structure-of-arrays storage on the C side. No data is copied
+        into Python objects. The storage is updated from the particles array when 
+        this property is accessed. If `particles_soa_enabled` is set to 1, it is also 
+        updated after every timestep, so the arrays can be kept and read during
+        the integration (e.g. in a heartbeat function).
+
+        The arrays become invalid if the number of particles grows beyond the 
+        allocated size. Changes made to the arrays are only copied back into the 
+        particles array when `particles_soa_apply()` is called.
+
+        Examples
+        --------
+
+        >>> sim.particles_soa_enabled = 1
+        >>> soa = sim.particles_soa
+        >>> sim.integrate(10.)
+        >>> print(soa["x"].mean())
+
+        """
+        import numpy as np
+        clibrebound.reb_particles_soa_update(byref(self))
+        soa = self._particles_soa
+        N = soa.N
+        d = {}
+        for k in ["x","y","z","vx","vy","vz","m","r"]:
+            if N>0:
+                d[k] = np.ctypeslib.as_array(getattr(soa,k), shape=(N,))
+            else:
+                d[k] = np.zeros(0, dtype="float64")
+        return d
+
+    @property
+    def particle_views(self):
+        """
+        Writable numpy views of the particle state without any copies.
+
+        Returns a `ParticleViews` object with the attributes "x", "v", "a" 
+        (numpy arrays of shape (sim.N,3)) and "m", "r" (shape (sim.N,)). The 
+        arrays are strided views directly onto the particles array on the C side.
+        Reading them does not copy any data and writing to them changes the 
+        particles immediately.
+
+        The particles array is reallocated when particles are added beyond the 
+        allocated size. Arrays obtained earlier then point to freed memory. The 
+        `ParticleViews` object checks this every time an attribute is accessed and 
+        recreates the arrays if needed, so keep the object, not the arrays.
+        If you change positions or velocities while using WHFast, set 
+        `ri_whfast.recalculate_jacobi_this_timestep = 1`.
+
+        Examples
+        --------
+
+        >>> views = sim.particle_views
+        >>> views.v[:,0] *= 1.01      # change all vx in place
+        >>> sim.integrate(10.)
+        >>> print(views.x.mean(axis=0))
+
+        """
+        if "_particle_views" not in self.__dict__:
+            self._particle_views = ParticleViews(self)
+        return self._particle_views
+
+    def particles_soa_apply(self):
+        """
+        Copies the data of the structure-of-arrays storage (see `particles_soa`) 
+        back into the particles array. 
+        """
+        clibrebound.reb_particles_soa_apply(byref(self))
+        self.process_messages()
+
     def move_to_com(self):
         """
         This function moves all particles in the simulation to a center of momentum frame.
@@ -1332,11 +1932,242 @@ class Simulation(Structure):
         """
         clibrebound.reb_output_binary(byref(self), c_char_p(filename.encode("ascii")))
 
+    def add_output_stream(self, callback, capacity=16, orbits=False, drop=False):
+        """
+        Add a consumer of particle data running on its own thread.
+
+        Every call of `output_stream_push()` copies the particle data into a 
+        ring buffer. The callback is then called on a background thread with 
+        a `reb_output_stream_batch` as its only argument. The callback must 
+        not access the simulation. Calculating orbital elements, formatting 
+        and writing files can thus be moved out of the integration loop.
+
+        Parameters
+        ----------
+        callback : function
+            Called with a reb_output_stream_batch for every pushed batch, in order.
+        capacity : int
+            Number of batches in the ring buffer. Default: 16.
+        orbits : bool
+            If True, Jacobi orbital elements are calculated on the stream's thread.
+        drop : bool
+            If True, batches are dropped if the ring buffer is full. By default,
+            `output_stream_push()` waits for the callback to catch up.
+
+        Examples
+        --------
+        >>> es = []
+        >>> sim.add_output_stream(lambda b: es.append(b.e[1]), orbits=True)
+        >>> for i in range(100):
+        >>>     sim.integrate(sim.t+1.)
+        >>>     sim.output_stream_push()
+        >>> sim.output_stream_flush()
+        """
+        def _callback(batch, userdata):
+            callback(batch.contents)
+        fp = OSFF(_callback)
+        try:
+            self._output_stream_callbacks.append(fp)
+        except AttributeError:
+            self._output_stream_callbacks = [fp]
+        flags = (1 if orbits else 0) | (2 if drop else 0)
+        clibrebound.reb_output_stream_add(byref(self), fp, None, c_int(capacity), c_uint(flags))
+        self.process_messages()
+
+    def output_stream_push(self):
+        """
+        Push the current particle data to all output streams (see `add_output_stream`).
+        """
+        clibrebound.reb_output_stream_push(byref(self))
+
+    def output_stream_flush(self):
+        """
+        Wait until all output streams have processed all pushed batches.
+        """
+        clibrebound.reb_output_stream_flush(byref(self))
+
+    def output_shm_open(self, name, N_max=0, interval=0., energy=False):
+        """
+        Publish live snapshots of the simulation into a shared memory segment.
+
+        A snapshot of the particles (hash, mass, position and velocity) and 
+        diagnostics (time, timestep, number of steps, wall time and optionally 
+        the energy) is published now and then after every timestep once the 
+        simulation time has advanced by at least interval. Other processes 
+        attach read-only with `rebound.SharedMemoryView` (or 
+        reb_output_shm_attach() in C) and never slow down the simulation.
+        The segment is removed when the simulation is freed.
+
+        Parameters
+        ----------
+        name : str
+            Name of the segment, e.g. "/rebound".
+        N_max : int
+            Number of particles the segment can hold. Default: current number of particles.
+        interval : float
+            Cadence in simulation time. Default: 0 (after every timestep).
+        energy : bool
+            If True, the total energy is calculated for every snapshot (O(N^2)).
+        """
+        clibrebound.reb_output_shm_open(byref(self), c_char_p(name.encode("ascii")), c_int(N_max), c_double(interval), c_uint(1 if energy else 0))
+        self.process_messages()
+
+    def output_shm_publish(self):
+        """
+        Publish a snapshot to the shared memory segment now (see `output_shm_open`).
+        """
+        clibrebound.reb_output_shm_publish(byref(self))
+
+    def output_shm_close(self):
+        """
+        Remove the shared memory segment (see `output_shm_open`).
+        """
+        clibrebound.reb_output_shm_close(byref(self))
+
+# Metrics
+    def get_metrics(self, energy=False):
+        """
+        Return the counters of the work done by the simulation.
+
+        The counters (steps, interactions, cells_opened, collisions_found,
+        collisions_resolved, ias15_iterations, ias15_rejections,
+        hermes_activations and simulationarchive_bytes) are always updated 
+        and cost next to nothing. The rates (steps_per_second, 
+        interactions_per_second and collisions_per_second) are averages over 
+        the wall time spent integrating.
+
+        Parameters
+        ----------
+        energy : bool
+            If True, the energy is calculated (O(N^2)) and energy_drift is 
+            updated. The drift is relative to the energy at the first such call.
+
+        Returns
+        -------
+        A reb_metrics object.
+        """
+        clibrebound.reb_metrics_get.restype = reb_metrics
+        return clibrebound.reb_metrics_get(byref(self), c_int(1 if energy else 0))
+
+    def reset_metrics(self):
+        """
+        Set all counters to zero (see `get_metrics`).
+        """
+        clibrebound.reb_metrics_reset(byref(self))
+
+    def output_metrics(self, filename=None):
+        """
+        Export the metrics in the OpenMetrics text format.
+
+        Parameters
+        ----------
+        filename : str, optional
+            If given, the file is replaced atomically, as expected by 
+            textfile collectors. Otherwise the text is returned.
+        """
+        if filename is not None:
+            clibrebound.reb_output_metrics(byref(self), c_char_p(filename.encode("ascii")))
+            self.process_messages()
+            return
+        clibrebound.reb_metrics_get.restype = reb_metrics
+        m = clibrebound.reb_metrics_get(byref(self), c_int(0))
+        n = clibrebound.reb_metrics_openmetrics(byref(m), None, c_size_t(0))
+        buf = create_string_buffer(n+1)
+        clibrebound.reb_metrics_openmetrics(byref(m), buf, c_size_t(n+1))
+        return buf.value.decode("ascii")
+
+# Profiling
+    def enable_profiling(self):
+        """
+        Start timing the integrator, gravity, collisions and their sub-steps.
+
+        Timers are kept separately for every OpenMP thread. Use `get_profiling()` 
+        to read them. Profiling is disabled by default (unless REBOUND was 
+        compiled with PROFILING=1).
+        """
+        clibrebound.reb_profiling_enable(byref(self))
+
+    def disable_profiling(self):
+        """
+        Stop profiling and discard all timing data.
+        """
+        clibrebound.reb_profiling_disable(byref(self))
+
+    def reset_profiling(self):
+        """
+        Set all timers to zero.
+        """
+        clibrebound.reb_profiling_reset(byref(self))
+
+    def get_profiling(self, thread=None):
+        """
+        Return the timing data collected since profiling was enabled or reset.
+
+        Parameters
+        ----------
+        thread : int
+            Only return the timers of this OpenMP thread. By default, the
+            timers of all threads are summed up.
+
+        Returns
+        -------
+        A tuple (wall, regions). wall is the wall time in seconds since profiling 
+        was enabled or reset. regions is a dictionary with one entry per region. 
+        Each entry is a dictionary with the number of calls, the total time, the 
+        time not spent in nested regions (time_self), and the name of the region 
+        it is nested in (parent, None for top level regions).
+
+        If REBOUND was compiled with PERF=1, each entry also contains the hardware 
+        counters (cycles, instructions, cache_references, cache_misses, 
+        branch_misses) measured in the region. Call `reset_profiling()` after 
+        every `step()` to get per step numbers.
+        """
+        if self._profiling is None:
+            raise RuntimeError("Profiling is not enabled. Call enable_profiling() first.")
+        regions = (reb_profiling_region*REB_PROFILING_CAT_N)()
+        clibrebound.reb_profiling_get.restype = c_double
+        wall = clibrebound.reb_profiling_get(byref(self), c_int(-1 if thread is None else thread), regions)
+        names = [r.name.decode("ascii") for r in regions]
+        d = {}
+        for r in regions:
+            d[r.name.decode("ascii")] = {"calls": r.calls, "time": r.time, "time_self": r.time_self, "parent": names[r.parent] if r.parent>=0 else None}
+            if clibrebound.reb_profiling_get_counters_N(byref(self))>0:
+                d[r.name.decode("ascii")]["counters"] = dict(zip(REB_PROFILING_COUNTERS, r.counters))
+        return wall, d
+
+    def enable_trace(self, capacity=100000):
+        """
+        Record a timeline of the simulation (and enable profiling).
+
+        Every profiling region and every timestep is recorded. For each 
+        timestep, the step size, the number of particles, the number of IAS15 
+        iterations and rejected steps, the number of collisions, the tree depth 
+        and whether the HERMES mini simulation was active are stored. Only the 
+        most recent `capacity` timesteps (and events per thread) are kept.
+        Use `save_trace()` to write the timeline to a file.
+        """
+        clibrebound.reb_profiling_trace_enable(byref(self), c_int(capacity))
+
+    def disable_trace(self):
+        """
+        Stop recording the timeline and discard it. Profiling stays enabled.
+        """
+        clibrebound.reb_profiling_trace_disable(byref(self))
+
+    def save_trace(self, filename):
+        """
+        Write the recorded timeline in the Chrome trace event format (JSON).
+
+        The file can be opened with chrome://tracing or https://ui.perfetto.dev.
+        """
+        if clibrebound.reb_profiling_trace_write(byref(self), c_char_p(filename.encode("ascii"))):
+            raise RuntimeError("Cannot write trace. Call enable_trace() first and check the filename.")
+
 # Integration
     def step(self):
         """
         Perform exactly one integration step with REBOUND. This function is rarely needed.
-        Instead, use integrate().
+        Instead, use integrate(). Like integrate(), this releases the global interpreter lock.
         """
         clibrebound.reb_step(byref(self))
         self.process_messages()
@@ -1356,6 +2187,16 @@ class Simulation(Structure):
         ----------
         Exceptions are thrown when no more particles are left in the simulation or when a generic integration error occured. 
         If you specified exit_min_distance or exit_max_distance, then additional exceptions might thrown for escaping particles or particles that undergo a clos encounter.
+
+        Threads
+        -------
+        The global interpreter lock is released while the C code runs. Different simulations 
+        can therefore be integrated at the same time in different python threads. Python 
+        callback functions (e.g. `additional_forces` or `heartbeat`) reacquire the lock 
+        whenever they are called, so simulations with python callbacks mostly run one 
+        at a time. Use C functions as callbacks, or set `heartbeat_interval` if only a 
+        python heartbeat is needed. The same simulation must not be integrated by two 
+        threads at the same time.
         
         Examples
         -------- 
@@ -1371,18 +2212,93 @@ class Simulation(Structure):
         if debug.integrator_package =="REBOUND":
             self.exact_finish_time = c_int(exact_finish_time)
             ret_value = clibrebound.reb_integrate(byref(self), c_double(tmax))
-            if ret_value == 1:
-                raise SimulationError("An error occured during the integration.")
-            if ret_value == 2:
-                raise NoParticles("No more particles left in simulation.")
-            if ret_value == 3:
-                raise Encounter("Two particles had a close encounter (d<exit_min_distance).")
-            if ret_value == 4:
-                raise Escape("A particle escaped (r>exit_max_distance).")
+            _raise_integrate_status(ret_value)
         else:
             debug.integrate_other_package(tmax,exact_finish_time)
         self.process_messages()
 
+    def integrate_async(self, tmax, exact_finish_time=1):
+        """
+        Starts the integration in a separate C thread and returns immediately.
+
+        The arguments are the same as for `integrate`. The returned 
+        `IntegrateAsync` object can be used to poll the progress, to 
+        retrieve snapshots and to cancel the integration. The simulation 
+        must not be accessed until `wait()` has been called on it.
+
+        Examples
+        --------
+
+        >>> handle = sim.integrate_async(1e6)
+        >>> while handle.poll() is None:
+        >>>     do_something_else()
+        >>> handle.wait()
+        """
+        self.exact_finish_time = c_int(exact_finish_time)
+        return IntegrateAsync(self, tmax)
+
+    def integrate_samples(self, times, exact_finish_time=1, **kwargs):
+        """
+        Integrates through a sorted sequence of times and stores outputs at every time.
+
+        This gives the same result as calling `integrate` for every time and 
+        copying the particle data afterwards, but the whole time series is 
+        computed in one C call. Particles are only synchronized at the sample
+        times. No memory is allocated by this function. The keyword arguments 
+        are float64 numpy arrays (or ctypes arrays of c_double) which are 
+        filled with the outputs. Possible argument names are:
+
+        - "t": times of the samples (n values)
+        - "xyz", "vxvyvz": positions and velocities (n*sim.N*3 values)
+        - "orbits": Jacobi orbital elements a, e, inc, Omega, omega, f of 
+          all particles but the first one (n*(sim.N-1)*6 values)
+        - "energy": total energy (n values)
+
+        Exceptions are raised as in `integrate`. The arrays are filled up to
+        the last sample time which has been reached.
+
+        Returns
+        -------
+        The number of samples stored.
+
+        Examples
+        --------
+
+        >>> import numpy as np
+        >>> times = np.linspace(0.,100.,1000)
+        >>> xyz = np.zeros((1000,sim.N,3))
+        >>> energy = np.zeros(1000)
+        >>> sim.integrate_samples(times, xyz=xyz, energy=energy)
+        """
+        n = len(times)
+        N = self.N_real
+        sizes = {"t": n, "xyz": n*N*3, "vxvyvz": n*N*3, "orbits": n*max(N-1,0)*6, "energy": n}
+        out = reb_samples()
+        out.N = N
+        for k,v in kwargs.items():
+            if k not in sizes:
+                raise AttributeError("Only '%s' are currently supported outputs." % "', '".join(sizes.keys()))
+            if isinstance(v, ctypes.Array):
+                if v._type_ is not c_double:
+                    raise AttributeError("Expected c_double data type for '%s' array."%k)
+                size = len(v)
+                ptr = ctypes.cast(v, POINTER(c_double))
+            else:
+                if v.dtype!= "float64":
+                    raise AttributeError("Expected 'float64' data type for '%s' array."%k)
+                size = v.size
+                ptr = v.ctypes.data_as(POINTER(c_double))
+            if size<sizes[k]:
+                raise AttributeError("Array '%s' is not large enough."%k)
+            setattr(out, k, ptr)
+        self.exact_finish_time = c_int(exact_finish_time)
+        ctimes = (c_double*n)(*times)
+        clibrebound.reb_integrate_samples.restype = c_int
+        ret = clibrebound.reb_integrate_samples(byref(self), ctimes, c_int(n), byref(out))
+        self.process_messages()
+        _raise_integrate_status(self._status)
+        return ret
+
     def integrator_synchronize(self):
         """
         Call this function if safe-mode is disabled and you need synchronize particle positions and velocities between timesteps.
@@ -1394,7 +2310,130 @@ class Simulation(Structure):
         Call this function to update the tree structure manually after removing particles.
         """
         clibrebound.reb_tree_update(byref(self))
+
+    def tree_query_radius(self, x, y, z, radius, exclude=-1):
+        """
+        Returns all particles within a distance radius of the point (x, y, z), including
+        periodic images in the ghost boxes. Requires a tree (a tree based gravity or 
+        collision module) which is up to date.
+
+        Each element of the returned list has the attributes index (the index of the 
+        particle), dx, dy, dz (its position relative to the query point) and r2 (the 
+        square of the distance). The particle with index exclude is not returned.
+
+        Examples
+        --------
+
+        >>> for n in sim.tree_query_radius(0., 0., 0., 0.1):
+        >>>     print(n.index, n.r2)
+        """
+        args = [byref(self), c_double(x), c_double(y), c_double(z), c_double(radius), c_int(exclude)]
+        found = clibrebound.reb_tree_query_radius(*(args+[None, c_int(0)]))
+        if found < 0:
+            raise RuntimeError("Neighbour queries require a tree. Use a tree based gravity or collision module.")
+        neighbours = (reb_neighbour*max(found,1))()
+        found = clibrebound.reb_tree_query_radius(*(args+[neighbours, c_int(found)]))
+        return neighbours[:found]
+
+    def tree_query_knn(self, x, y, z, k, exclude=-1):
+        """
+        Returns the k particles closest to the point (x, y, z), sorted by distance. 
+        Works like `tree_query_radius`.
+        """
+        neighbours = (reb_neighbour*max(k,1))()
+        found = clibrebound.reb_tree_query_knn(byref(self), c_double(x), c_double(y), c_double(z), c_int(k), c_int(exclude), neighbours)
+        if found < 0:
+            raise RuntimeError("Neighbour queries require a tree. Use a tree based gravity or collision module.")
+        return neighbours[:found]
     
+def _raise_integrate_status(ret_value):
+    if ret_value == 1:
+        raise SimulationError("An error occured during the integration.")
+    if ret_value == 2:
+        raise NoParticles("No more particles left in simulation.")
+    if ret_value == 3:
+        raise Encounter("Two particles had a close encounter (d<exit_min_distance).")
+    if ret_value == 4:
+        raise Escape("A particle escaped (r>exit_max_distance).")
+
+class IntegrateAsync(object):
+    """
+    Handle of an integration started with `Simulation.integrate_async`.
+    """
+    def __init__(self, sim, tmax):
+        self.sim = sim
+        clibrebound.reb_integrate_async.restype = c_void_p
+        self._handle = clibrebound.reb_integrate_async(byref(sim), c_double(tmax))
+        if not self._handle:
+            sim.process_messages()
+            raise SimulationError("Cannot start asynchronous integration.")
+        self.t = sim.t
+        self.steps = 0
+
+    def _check_handle(self):
+        if self._handle is None:
+            raise RuntimeError("wait() has already been called.")
+
+    def poll(self):
+        """
+        Returns None while the integration is running and the return status otherwise.
+        The attributes `t` and `steps` are updated with the progress.
+        """
+        self._check_handle()
+        t = c_double(0.)
+        steps = c_ulonglong(0)
+        clibrebound.reb_integrate_async_poll.restype = c_int
+        status = clibrebound.reb_integrate_async_poll(c_void_p(self._handle), byref(t), byref(steps))
+        self.t = t.value
+        self.steps = steps.value
+        return None if status < 0 else status
+
+    def request_snapshot(self):
+        """
+        Asks the integration thread to make a copy of the simulation after the next timestep.
+        """
+        self._check_handle()
+        clibrebound.reb_integrate_async_request_snapshot(c_void_p(self._handle))
+
+    def snapshot(self):
+        """
+        Returns the snapshot requested with `request_snapshot` as a new 
+        Simulation, or None if it is not ready yet.
+        """
+        self._check_handle()
+        clibrebound.reb_integrate_async_snapshot.restype = c_void_p
+        ptr = clibrebound.reb_integrate_async_snapshot(c_void_p(self._handle))
+        if not ptr:
+            return None
+        sim = Simulation.__new__(Simulation)
+        clibrebound.reb_init_simulation_copy(byref(sim), c_void_p(ptr))
+        clibrebound.reb_free_simulation(c_void_p(ptr))
+        for name in ["_afp", "_pretmp", "_posttmp", "_hb", "_corfp", "_colrfp"]:
+            if hasattr(self.sim, name):     # Keep python callbacks alive
+                setattr(sim, name, getattr(self.sim, name))
+        return sim
+
+    def cancel(self):
+        """
+        Stops the integration after the current timestep.
+        """
+        self._check_handle()
+        clibrebound.reb_integrate_async_cancel(c_void_p(self._handle))
+
+    def wait(self):
+        """
+        Blocks until the integration has finished. Raises the same exceptions 
+        as `Simulation.integrate`. A cancelled integration does not raise an
+        exception. Returns the status.
+        """
+        self._check_handle()
+        clibrebound.reb_integrate_async_wait.restype = c_int
+        ret_value = clibrebound.reb_integrate_async_wait(c_void_p(self._handle))
+        self._handle = None
+        self.sim.process_messages()
+        _raise_integrate_status(ret_value)
+        return ret_value
+
 class Variation(Structure):
     """
     REBOUND Variational Configuration Object.
@@ -1530,6 +2569,8 @@ class reb_simulation_integrator_janus(Structure):
                 ("recalculate_integer_coordinates_this_timestep", c_uint),
                 ("p_int", POINTER(reb_particle_int)),
                 ("allocated_N",c_uint),
+                ("_p_int_soa", POINTER(c_int64)),
+                ("_allocated_N_soa",c_uint),
                 ]
 
 
@@ -1551,6 +2592,15 @@ class reb_simulation_integrator_hermes(Structure):
                 ("_a_i", POINTER(c_double)),
                 ("_a_f", POINTER(c_double)),
                 ("_a_Nmax", c_int),
+                ("_hill_radius", POINTER(c_double)),
+                ("_encounter_intervals", c_void_p),
+                ("_encounter_intervals_N", c_int),
+                ("_encounter_axis", c_int),
+                ("_encounter_open", POINTER(c_int)),
+                ("_encounter_Nmax", c_int),
+                ("_encounter_pairs", POINTER(c_int)),
+                ("_encounter_pairs_N", c_int),
+                ("_encounter_pairs_Nmax", c_int),
                 ("_timestep_too_large_warning", c_int),
                 ("_steps", c_ulonglong),
                 ("_steps_miniactive", c_ulonglong),
@@ -1562,23 +2612,19 @@ class timeval(Structure):
 
 class reb_display_data(Structure):
     _fields_ = [("r", POINTER(Simulation)),
-                ("r_copy", POINTER(Simulation)),
                 ("particle_data", c_void_p),
                 ("orbit_data", c_void_p),
-                ("particles_copy", POINTER(Particle)),
-                ("p_j_copy", POINTER(Particle)),
-                ("p_h_copy", POINTER(Particle)),
-                ("eta_copy", POINTER(c_double)),
                 ("allocated_N", c_ulong),
-                ("allocated_N_whfast", c_ulong),
-                ("allocated_N_whfasthelio", c_ulong),
+                ("N", c_int),
                 ("opengl_enabled", c_int),
                 ("scale", c_double),
                 ("mouse_x", c_double),
                 ("mouse_y", c_double),
                 ("retina", c_double),
+                ("max_bandwidth", c_double),
+                ("bandwidth_budget", c_double),
+                ("_frame_size", c_size_t)]
                 # ignoring other data (never used)
-                ]
 
 
 # Setting up fields after class definition (because of self-reference)
@@ -1602,9 +2648,58 @@ Simulation._fields_ = [
                 ("_particles", POINTER(Particle)),
                 ("gravity_cs", POINTER(reb_vec3d)),
                 ("gravity_cs_allocatedN", c_int),
+                ("_gravity_soa", POINTER(c_double)),
+                ("_gravity_soa_allocatedN", c_int),
+                ("_particles_soa", reb_particles_soa),
+                ("particles_soa_enabled", c_int),
+                ("_remove_marks", c_void_p),
+                ("_remove_marks_allocatedN", c_int),
+                ("remove_marks_N", c_int),
                 ("tree_root", c_void_p),
                 ("tree_needs_update", c_int),
+                ("tree_rebuild", c_int),
+                ("tree_refit", c_int),
+                ("tree_active_only", c_int),
+                ("_tree_cell_blocks", c_void_p),
+                ("_tree_cell_blocks_N", c_int),
+                ("_tree_cell_multipoles", c_void_p),
+                ("_tree_cell_free", c_void_p),
                 ("opening_angle2", c_double),
+                ("multipole_order", c_int),
+                ("tree_flatten", c_int),
+                ("_tree_flat", c_void_p),
+                ("_tree_flat_N", c_int),
+                ("_tree_flat_allocatedN", c_int),
+                ("_tree_flat_order", POINTER(c_int)),
+                ("_tree_flat_order_N", c_int),
+                ("_tree_flat_order_allocatedN", c_int),
+                ("_tree_flat_multipoles", c_void_p),
+                ("tree_group_size", c_int),
+                ("tree_leaf_size", c_int),
+                ("tree_single_precision", c_int),
+                ("_tree_groups", c_void_p),
+                ("_tree_groups_N", c_int),
+                ("_tree_groups_allocatedN", c_int),
+                ("tree_tasks", c_int),
+                ("_tree_task_cost", POINTER(c_float)),
+                ("_tree_task_order", POINTER(c_int)),
+                ("_tree_task_allocatedN", c_int),
+                ("tree_force_accuracy", c_double),
+                ("tree_force_accuracy_interval", c_uint),
+                ("tree_force_accuracy_samples", c_int),
+                ("_tree_force_accuracy_steps", c_uint),
+                ("tree_force_error", c_double),
+                ("fmm_order", c_int),
+                ("_fmm_multipoles", POINTER(c_double)),
+                ("_fmm_locals", POINTER(c_double)),
+                ("_fmm_rmax", POINTER(c_double)),
+                ("_fmm_allocatedN", c_int),
+                ("_fmm_allocated_order", c_int),
+                ("_opencl", c_void_p),
+                ("fft_nx", c_int),
+                ("fft_ny", c_int),
+                ("fft_rs", c_double),
+                ("_fft", c_void_p),
                 ("_status", c_int),
                 ("exact_finish_time", c_int),
                 ("force_is_velocity_dependent", c_uint),
@@ -1615,10 +2710,22 @@ Simulation._fields_ = [
                 ("messages", c_void_p),
                 ("exit_max_distance", c_double),
                 ("exit_min_distance", c_double),
+                ("_exit_min_distance_checked", c_int),
                 ("usleep", c_double),
+                ("heartbeat_interval", c_uint),
+                ("_heartbeat_steps", c_uint),
+                ("reorder_interval", c_uint),
+                ("_reorder_steps", c_uint),
+                ("reproducible", c_int),
+                ("memory_policy", c_uint),
+                ("rand_seed", c_uint64),
+                ("_rand_streams", c_uint64),
                 ("display_data", POINTER(reb_display_data)),
                 ("track_energy_offset", c_int),
                 ("energy_offset", c_double),
+                ("_forces", c_void_p),
+                ("_forces_N", c_int),
+                ("_forces_allocatedN", c_int),
                 ("boxsize", reb_vec3d),
                 ("boxsize_max", c_double),
                 ("root_size", c_double),
@@ -1630,12 +2737,24 @@ Simulation._fields_ = [
                 ("nghosty", c_int),
                 ("nghostz", c_int),
                 ("collision_resolve_keep_sorted", c_int),
+                ("collision_resolve_parallel", c_int),
+                ("collision_swept", c_int),
+                ("collision_verlet_skin", c_double),
+                ("collision_fused", c_int),
+                ("_collision_verlet_list", c_void_p),
                 ("collisions", c_void_p),
                 ("collisions_allocatedN", c_int),
                 ("minimum_collision_celocity", c_double),
                 ("collisions_plog", c_double),
                 ("max_radius", c_double*2),
                 ("collisions_Nlog", c_long),
+                ("collisions_seed", c_uint32),
+                ("sleep_velocity", c_double),
+                ("sleep_steps", c_uint),
+                ("_sleep_state", c_void_p),
+                ("_sleep_allocatedN", c_int),
+                ("_sleep_N", c_int),
+                ("sleeping_N", c_int),
                 ("_calculate_megno", c_int),
                 ("megno_Ys", c_double),
                 ("megno_Yss", c_double),
@@ -1652,6 +2771,22 @@ Simulation._fields_ = [
                 ("_simulationarchive_filename", c_char_p),
                 ("simulationarchive_walltime", c_double),
                 ("simulationarchive_time", timeval),
+                ("simulationarchive_fsync_interval", c_uint),
+                ("simulationarchive_async", c_uint),
+                ("simulationarchive_compression", c_uint),
+                ("simulationarchive_keyframe_interval", c_uint),
+                ("simulationarchive_member", c_long),
+                ("simulationarchive_extras", c_uint),
+                ("_simulationarchive_fd", c_int),
+                ("_simulationarchive_buffer", c_void_p),
+                ("_simulationarchive_buffer_allocated", c_size_t),
+                ("_simulationarchive_fsync_counter", c_uint),
+                ("_simulationarchive_writer", c_void_p),
+                ("_simulationarchive_encoder", c_void_p),
+                ("_output_streams", c_void_p),
+                ("_output_shm", c_void_p),
+                ("_metrics", reb_metrics),
+                ("_profiling", c_void_p),
                 ("_visualization", c_int),
                 ("_collision", c_int),
                 ("_integrator", c_int),
@@ -1663,6 +2798,8 @@ Simulation._fields_ = [
                 ("ri_hermes", reb_simulation_integrator_hermes),
                 ("ri_whfasthelio", reb_simulation_integrator_whfasthelio),
                 ("ri_janus", reb_simulation_integrator_janus),
+                ("ri_saba", reb_simulation_integrator_saba),
+                ("ri_mercurius", reb_simulation_integrator_mercurius),
                 ("_additional_forces", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_pre_timestep_modifications", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_post_timestep_modifications", CFUNCTYPE(None,POINTER(Simulation))),
@@ -1670,6 +2807,7 @@ Simulation._fields_ = [
                 ("_display_heartbeat", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_coefficient_of_restitution", CFUNCTYPE(c_double,POINTER(Simulation), c_double)),
                 ("_collision_resolve", CFUNCTYPE(c_int,POINTER(Simulation), reb_collision)),
+                ("_collision_resolve_batch", CFUNCTYPE(None,POINTER(Simulation), POINTER(reb_collision), c_int, POINTER(c_int))),
                 ("_free_particle_ap", CFUNCTYPE(None, POINTER(Particle))),
                 ("extras", c_void_p),
                  ]
@@ -1695,6 +2833,7 @@ POINTER_REB_SIM = POINTER(Simulation)
 AFF = CFUNCTYPE(None,POINTER_REB_SIM)
 CORFF = CFUNCTYPE(c_double,POINTER_REB_SIM, c_double)
 COLRFF = CFUNCTYPE(c_int, POINTER_REB_SIM, reb_collision)
+COLRBFF = CFUNCTYPE(None, POINTER_REB_SIM, POINTER(reb_collision), c_int, POINTER(c_int))
 FPA = CFUNCTYPE(None, POINTER(Particle))
 
 class Particles(MutableMapping):
@@ -1764,6 +2903,62 @@ class Particles(MutableMapping):
     def __len__(self):
         return self.sim.N
 
+class ParticleViews(object):
+    """
+    Zero-copy numpy views of the particle state of a simulation.
+
+    Use `Simulation.particle_views` to get an instance. The arrays are 
+    recreated whenever the particles array has been reallocated or the
+    number of particles has changed.
+    """
+    _vectors = {"x": "x", "v": "vx", "a": "ax"}
+    _scalars = {"m": "m", "r": "r"}
+
+    def __init__(self, sim):
+        self._sim = sim
+        self._key = None
+        self._arrays = {}
+
+    def _update(self):
+        import numpy as np
+        sim = self._sim
+        N = sim.N
+        address = ctypes.addressof(sim._particles.contents) if sim._particles else 0
+        if self._key == (address, N):
+            return
+        self._arrays = {}
+        size = sizeof(Particle)
+        if N>0 and address:
+            buf = (c_char*(N*size)).from_address(address)
+        for k, field in list(self._vectors.items())+list(self._scalars.items()):
+            vector = k in self._vectors
+            if N==0 or not address:
+                self._arrays[k] = np.zeros((0,3) if vector else (0,), dtype="float64")
+                continue
+            offset = getattr(Particle, field).offset
+            if vector:
+                self._arrays[k] = np.ndarray(shape=(N,3), dtype="float64", buffer=buf, offset=offset, strides=(size,sizeof(c_double)))
+            else:
+                self._arrays[k] = np.ndarray(shape=(N,), dtype="float64", buffer=buf, offset=offset, strides=(size,))
+        self._key = (address, N)
+
+    @property
+    def valid(self):
+        """
+        False if the particles array has been reallocated or the number of particles
+        has changed since the arrays were last created. Accessing any of the arrays
+        through this object recreates them.
+        """
+        sim = self._sim
+        address = ctypes.addressof(sim._particles.contents) if sim._particles else 0
+        return self._key == (address, sim.N)
+
+    def __getattr__(self, name):
+        if name in ParticleViews._vectors or name in ParticleViews._scalars:
+            self._update()
+            return self._arrays[name]
+        raise AttributeError("ParticleViews has no attribute '%s'." % name)
+
 # Import at the end to avoid circular dependence
 from . import horizons
 from . import debug
@@ -1,14 +1,53 @@
-from ctypes import POINTER, c_int, c_long, c_char_p, byref, pointer
+from ctypes import Structure, POINTER, c_int, c_uint, c_long, c_double, c_char, c_char_p, c_void_p, c_size_t, byref, pointer, memmove, sizeof, addressof
 from .simulation import Simulation, BINARY_WARNINGS
+from .particle import Particle
 from . import clibrebound 
 import os
 import sys
 import math
 import warnings
-from collections import Mapping
+from collections import Mapping, OrderedDict
 
 POINTER_REB_SIM = POINTER(Simulation) 
 
+class SimulationArchiveMap(Structure):
+    """
+    Read-only, memory mapped view of a SimulationArchive file (reb_simulationarchive_map).
+    Used internally by the SimulationArchive class.
+    """
+    _fields_ = [("_data", c_void_p),
+                ("size", c_size_t),
+                ("size_first", c_long),
+                ("size_snapshot", c_long),
+                ("N_snapshots", c_long),
+                ("_offset", POINTER(c_long)),
+                ("_t", POINTER(c_double)),
+                ("_walltime", POINTER(c_double)),
+                ("N", c_int),
+                ("integrator", c_int),
+                ("compression", c_int),
+                ("keyframe_interval", c_uint),
+                ("_keyframe", c_void_p),
+                ("_fd", c_int),
+                ("_buffer", c_void_p),
+                ("_buffer_snapshot", c_long),
+                ("_scratch", c_void_p),
+                ("_filename", c_void_p)]
+
+class SimulationArchiveContainerStruct(Structure):
+    """
+    Read-only, memory mapped view of a SimulationArchive container (reb_simulationarchive_container).
+    Used internally by the SimulationArchiveContainer class.
+    """
+    _fields_ = [("_data", c_void_p),
+                ("size", c_size_t),
+                ("_fd", c_int),
+                ("_filename", c_void_p),
+                ("N_members", c_long),
+                ("_start", POINTER(c_long)),
+                ("_records", POINTER(c_long)),
+                ("_maps", c_void_p)]
+
 class SimulationArchive(Mapping):
     """
     SimulationArchive Class.
@@ -27,13 +66,28 @@ class SimulationArchive(Mapping):
     The SimulationArchive Class only works when the following 
     requirements are satisfied.  
 
-    - Only the WHFast, WHFastHelio and IAS15 integrators are supported.
+    - Only the WHFast, WHFastHelio, IAS15, JANUS, Leapfrog and SEI 
+      integrators are supported.
     - Symplectic correcters are supported.
+    - All gravity and collision modules are supported. Particle radii, 
+      hashes, collision statistics and the MEGNO state are stored in each
+      snapshot if needed.
     - The number of particles can not change.
     - Any additional forces or post-timestep modifications that are
       present during the integration also need to be present when 
       the SimulationArchive class is accessed at a later time.
 
+    Simulations which have been integrated forward from a snapshot
+    (`mode="close"` or `mode="exact"` in `getSimulation`) are kept in a 
+    least recently used cache with `cache_size` entries. A request for a 
+    later time continues the integration of the closest cached simulation 
+    instead of reloading a snapshot. Iterating over sorted times thus 
+    requires only one integration. 
+
+
+    A SimulationArchive can also be one member of a SimulationArchive 
+    container (see the SimulationArchiveContainer class). In that case
+    `filename` is the container and `member` the index of the member.
 
     Examples
     --------
@@ -46,22 +100,36 @@ class SimulationArchive(Mapping):
     >>>     print(sim.t, sim.particles[1].e)
 
     """
-    def __init__(self,filename,setup=None, setup_args=(), rebxfilename=None):
+    def __init__(self,filename,setup=None, setup_args=(), rebxfilename=None, cache_size=4, member=None, _container=None):
         self.cfilename = c_char_p(filename.encode("ascii"))
+        self.member = member
         self.setup = setup
         self.setup_args = setup_args
         self.rebxfilename = rebxfilename
+        # Copies of a simulation do not include REBOUNDx effects
+        self.cache_size = 1 if rebxfilename else max(1,cache_size)
+        self._cache = OrderedDict()
+        self._cachekey = 0
 
         # Recreate simulation at t=0
-        w = c_int(0)
         clibrebound.reb_create_simulation.restype = POINTER(Simulation)
         simp = clibrebound.reb_create_simulation() 
-        clibrebound.reb_create_simulation_from_binary_with_messages(simp, self.cfilename,byref(w))
-        if (not simp) or (w.value & 1):     # Major error
-            raise ValueError(BINARY_WARNINGS[0][0])
-        if (w.value & 2):     
-            warnings.warn(BINARY_WARNINGS[1][0], RuntimeWarning)
-            # Note: Other warnings not shown!
+        if member is not None:
+            # The map of a member belongs to the container. 
+            self._container = _container if _container is not None else SimulationArchiveContainer(filename)
+            self._map = self._container._memberMap(member)
+            clibrebound.reb_simulationarchive_map_load_snapshot.restype = c_int
+            if (not simp) or clibrebound.reb_simulationarchive_map_load_snapshot(simp, self._map, c_long(0)):
+                raise ValueError(BINARY_WARNINGS[0][0])
+        else:
+            self._container = None
+            w = c_int(0)
+            clibrebound.reb_create_simulation_from_binary_with_messages(simp, self.cfilename,byref(w))
+            if (not simp) or (w.value & 1):     # Major error
+                raise ValueError(BINARY_WARNINGS[0][0])
+            if (w.value & 2):     
+                warnings.warn(BINARY_WARNINGS[1][0], RuntimeWarning)
+                # Note: Other warnings not shown!
         self.simp = simp
         sim = self.simp.contents
         if self.setup:
@@ -70,6 +138,13 @@ class SimulationArchive(Mapping):
             import reboundx
             rebx = reboundx.Extras.from_file(sim, self.rebxfilename)
 
+        # Keep the file mapped. All snapshots other than the first are read from the map.
+        if member is None:
+            clibrebound.reb_create_simulationarchive_map.restype = POINTER(SimulationArchiveMap)
+            self._map = clibrebound.reb_create_simulationarchive_map(self.cfilename)
+            if not self._map:
+                raise ValueError("Cannot map SimulationArchive file.")
+
         self.filesize = os.path.getsize(filename)
         self.dt = sim.dt
         if sim.simulationarchive_interval>0. and sim.simulationarchive_interval_walltime>0.:
@@ -82,16 +157,20 @@ class SimulationArchive(Mapping):
             self.interval_walltime = sim.simulationarchive_interval_walltime
 
         self.tmin = sim.t
-        self.Nblob = int((self.filesize-sim.simulationarchive_size_first)/sim.simulationarchive_size_snapshot)
+        m = self._map.contents
+        self.Nblob = m.N_snapshots-1
+        # Time index, built in one pass when the file was mapped.
+        self.timetable = m._t[:m.N_snapshots]
         if sim.simulationarchive_interval_walltime>0.:
-            self.timetable = [-1.]*(self.Nblob+1)
-            self.timetable[0] = sim.t
-            self._loadAndSynchronize(-1)
-            self.timetable[-1] = sim.t
-            self.tmax = sim.t
+            self.tmax = self.timetable[-1]
         else:
             self.tmax = self.tmin + self.interval*(self.Nblob)
 
+    def __del__(self):
+        if hasattr(self, "_map") and self._map and not getattr(self, "_container", None):
+            clibrebound.reb_free_simulationarchive_map(self._map)
+        self._map = None
+
     def __str__(self):
         """
         Returns a string with details of this simulation archive.
@@ -129,15 +208,30 @@ class SimulationArchive(Mapping):
     def __len__(self):
         return self.Nblob+1  # number of binary blobs plus binary of t=0
 
+    def _loadSnapshot(self, snapshot, sim=None):
+        """
+        Update self.sim (or sim if given) by loading a snapshot from the mapped file (or the initial binary file). 
+        """
+        simp = self.simp if sim is None else byref(sim)
+        if snapshot == 0 and self._container is None:
+            clibrebound.reb_simulationarchive_load_snapshot.restype = c_int
+            retv = clibrebound.reb_simulationarchive_load_snapshot(simp, self.cfilename, c_long(snapshot))
+        else:
+            clibrebound.reb_simulationarchive_map_load_snapshot.restype = c_int
+            retv = clibrebound.reb_simulationarchive_map_load_snapshot(simp, self._map, c_long(snapshot))
+        if retv:
+            raise ValueError("Error while loading snapshot in binary file. Errorcode: %d."%retv)
+
     def _loadAndSynchronize(self, snapshot, keep_unsynchronized=1):
         """
         Update self.sim by loading a snapshopt from the binary file. 
         """
         sim = self.simp.contents
-        clibrebound.reb_simulationarchive_load_snapshot.restype = c_int
-        retv = clibrebound.reb_simulationarchive_load_snapshot(self.simp, self.cfilename, c_long(snapshot))
-        if retv:
-            raise ValueError("Error while loading snapshot in binary file. Errorcode: %d."%retv)
+        # self.sim is overwritten and can no longer be reused
+        for key, cached in list(self._cache.items()):
+            if addressof(cached)==addressof(sim):
+                del self._cache[key]
+        self._loadSnapshot(snapshot)
         if sim.integrator=="whfast" and sim.ri_whfast.safe_mode == 1:
             keep_unsynchronized = 0
         if sim.integrator=="whfasthelio" and sim.ri_whfasthelio.safe_mode == 1:
@@ -163,27 +257,9 @@ class SimulationArchive(Mapping):
             bt = self.tmin + self.interval*bi
             return bi, bt
         except AttributeError: # No interval, need to use timetable
-            # Bisection method
-            sim = self.simp.contents
-            l = 0
-            r = self.Nblob
-            while True:
-                bi = l+(r-l)//2
-                if self.timetable[bi] == -1.:
-                    clibrebound.reb_simulationarchive_load_snapshot.restype = c_int
-                    retv = clibrebound.reb_simulationarchive_load_snapshot(self.simp, self.cfilename, bi)
-                    if retv:
-                        raise ValueError("Error while loading snapshot in binary file. Errorcode: %d."%retv)
-                    self.timetable[bi] = sim.t
-                if self.timetable[bi]>t:
-                    r = bi
-                else:
-                    l = bi
-                if r-1<=l:
-                    bi = l
-                    break
-            return bi, sim.t
-        return 0, 0.
+            clibrebound.reb_simulationarchive_map_find.restype = c_long
+            bi = clibrebound.reb_simulationarchive_map_find(self._map, c_double(t))
+            return bi, self.timetable[bi]
 
     def getSimulation(self, t, mode='snapshot', keep_unsynchronized=1):
         """
@@ -200,12 +276,15 @@ class SimulationArchive(Mapping):
             - 'snapshot' This loads a nearby snapshot such that sim.t<t. This is the default.
             - 'close' This integrates the simulation to get to the time t but may overshoot by at most one timestep sim.dt.
             - 'exact' This integrates the simulation to exactly time t. This is not compatible with keep_unsynchronized=1. 
+              For IAS15, the simulation is integrated with its own timesteps and the particles are then evaluated 
+              at time t using the dense output of the step containing t. Subsequent requests within the same 
+              step do not require any integration. In this case a copy of the simulation is returned.
         keep_unsynchronized : int
             By default this argument is 1. This means that if the simulation had to be synchronized to generate this output, then it will nevertheless use the unsynchronized values if one integrates the simulation further in time. This is important for exact (bit-by-bit) reproducibility. If the value of this argument is 0, then one can modify the particles coordinates and these changes are taken into account when integrating the simulation further in time.
         
         Returns
         ------- 
-        A rebound.Simulation object. This object will be modified 
+        A rebound.Simulation object. This object might be modified 
         the next time getSimulation is called. Making any manual 
         changes to this object could have unforseen consequences.
         
@@ -232,17 +311,16 @@ class SimulationArchive(Mapping):
             return self.simp.contents
         else:
             sim = self.simp.contents
-            if sim.t<t and bt-sim.dt<sim.t \
-                and (sim.integrator != "whfast" or (sim.ri_whfast.keep_unsynchronized==1 or sim.ri_whfast.safe_mode == 1))\
-                and (sim.integrator != "whfasthelio" or (sim.ri_whfasthelio.keep_unsynchronized==1 or sim.ri_whfasthelio_safe_mode == 1)):
-                # Reuse current simulation
-                pass
-            else:
+            dense = mode=='exact' and sim.integrator=="ias15" and sim.ri_ias15.block_levels==0 and sim.ri_ias15.lean==0
+            if dense:
+                for cached in reversed(self._cache.values()):
+                    densesim = self._denseOutput(cached, t)
+                    if densesim is not None:
+                        return densesim
+            sim, new = self._cachedSimulation(bi, bt, t)
+            if new:
                 # Load from snapshot
-                clibrebound.reb_simulationarchive_load_snapshot.restype = c_int
-                retv = clibrebound.reb_simulationarchive_load_snapshot(self.simp, self.cfilename, c_long(bi));
-                if retv:
-                    raise ValueError("Error while loading snapshot in binary file. Errorcode: %d."%retv)
+                self._loadSnapshot(bi, sim)
 
             if mode=='exact':
                 keep_unsynchronized==0
@@ -253,18 +331,107 @@ class SimulationArchive(Mapping):
 
             sim.ri_whfast.keep_unsynchronized = keep_unsynchronized
             sim.ri_whfasthelio.keep_unsynchronized = keep_unsynchronized
-            if bi == 0:
+            if new and bi == 0:
                 if self.setup:
                     self.setup(sim, *self.setup_args)
                 if self.rebxfilename:
                     import reboundx
                     rebx = reboundx.Extras.from_file(sim, self.rebxfilename)
 
+            if dense:
+                sim.integrate(t,exact_finish_time=0)
+                densesim = self._denseOutput(sim, t)
+                if densesim is not None:
+                    return densesim
             exact_finish_time = 1 if mode=='exact' else 0
             sim.integrate(t,exact_finish_time=exact_finish_time)
                 
             return sim
 
+    def _cachedSimulation(self, bi, bt, t):
+        """
+        Returns a reconstructed simulation from which time t can be reached 
+        by integrating forward, and a flag which is True if the 
+        snapshot bi still needs to be loaded. The most recently integrated 
+        simulations are kept in an LRU cache. A cached simulation is reused 
+        if it is closer to t than the snapshot bi. Otherwise the least 
+        recently used simulation is overwritten.
+        """
+        best = None
+        for key, sim in self._cache.items():
+            if sim.t<t and bt-sim.dt<sim.t \
+                and (sim.integrator != "whfast" or (sim.ri_whfast.keep_unsynchronized==1 or sim.ri_whfast.safe_mode == 1))\
+                and (sim.integrator != "whfasthelio" or (sim.ri_whfasthelio.keep_unsynchronized==1 or sim.ri_whfasthelio.safe_mode == 1)):
+                if best is None or sim.t>self._cache[best].t:
+                    best = key
+        if best is not None:
+            # Reuse cached simulation
+            self._cache.move_to_end(best)
+            return self._cache[best], False
+        if len(self._cache)<self.cache_size:
+            if len(self._cache)==0:
+                sim = self.simp.contents
+            else:
+                sim = self.simp.contents.copy()
+        else:
+            key, sim = self._cache.popitem(last=False)
+        self._cachekey += 1
+        self._cache[self._cachekey] = sim
+        return sim, True
+
+    def _denseOutput(self, sim, t):
+        """
+        Returns a copy of the simulation sim with the particles evaluated at
+        time t using the dense output of its last IAS15 step. Returns None if 
+        t is not within the last step.
+        """
+        particles = (Particle*sim.N)()
+        clibrebound.reb_integrator_ias15_dense_output.restype = c_int
+        if not clibrebound.reb_integrator_ias15_dense_output(byref(sim), c_double(t), particles):
+            return None
+        densesim = sim.copy()
+        memmove(densesim._particles, particles, sizeof(particles))
+        densesim.t = t
+        densesim.dt_last_done = 0.
+        self._densesim = densesim
+        return densesim
+
+    def getParticleData(self, snapshot):
+        """
+        Returns the particle data stored in a snapshot as a read-only numpy 
+        array of shape (N,7) with columns m, x, y, z, vx, vy, vz. 
+
+        The array is a view of the memory mapped file. No data is copied 
+        and no simulation is recreated. This is useful for quickly analysing 
+        many snapshots. Note that the coordinates are the ones stored by the 
+        integrator: Jacobi coordinates for WHFast and democratic heliocentric
+        coordinates for WHFastHelio if safe_mode is turned off, and the 
+        snapshot might not be synchronized. The initial binary file 
+        (snapshot 0) and JANUS snapshots are not supported. For compressed
+        archives, the snapshot is decompressed and the array is a copy.
+
+        Arguments
+        ---------
+        snapshot : int
+            Index of the snapshot. Negative values count from the end.
+        """
+        import numpy as np
+        if snapshot < 0:
+            snapshot += len(self)
+        clibrebound.reb_simulationarchive_map_particles.restype = c_void_p
+        ptr = clibrebound.reb_simulationarchive_map_particles(self._map, c_long(snapshot))
+        if not ptr:
+            raise IndexError("Particle data not available for this snapshot.")
+        m = self._map.contents
+        # The data is not necessarily 8 byte aligned. Use a buffer of bytes.
+        buf = (c_char*(m.N*7*8)).from_address(ptr)
+        buf._sa = self # keep the file mapped as long as the array exists
+        a = np.frombuffer(buf, dtype="float64").reshape((m.N,7))
+        if m.compression:
+            # Decompressed into a buffer which is reused for the next snapshot.
+            a = a.copy()
+        a.flags.writeable = False
+        return a
 
     def getSimulations(self, times, **kwargs):
         """
@@ -274,6 +441,74 @@ class SimulationArchive(Mapping):
         for t in times:
             yield self.getSimulation(t, **kwargs)
 
+    def extractParticles(self, snapshots=None, times=None, t=None, xyz=None, vxvyvz=None, orbits=None):
+        """
+        Decodes many snapshots at once in C and writes the synchronized particle
+        data into numpy arrays. This is much faster than looping over
+        `getSimulations` because no Simulation object is created in python.
+        If REBOUND is compiled with OpenMP, the snapshots are decoded in parallel.
+        The GIL is released during the call, so other python threads can 
+        continue to run.
+
+        Note that additional forces are not applied during the synchronization
+        and that the `setup` function and REBOUNDx effects are not used. 
+
+        Arguments
+        ---------
+        snapshots : list of int
+            Indices of the snapshots. Negative values count from the end. 
+        times : list of float
+            Alternatively, times. The last snapshot at or before each time is used.
+        t : numpy array, True or None
+            Output array of shape (Ns,) for the times of the snapshots.
+        xyz, vxvyvz : numpy arrays, True or None
+            Output arrays of shape (Ns,N,3) for positions and velocities.
+        orbits : numpy array, True or None
+            Output array of shape (Ns,N-1,6) for the Jacobi orbital elements 
+            a, e, inc, Omega, omega, f of particles 1 to N-1.
+
+        If an output argument is True, a new array is allocated. If it is None,
+        the quantity is not calculated. The arrays need to be C contiguous and 
+        of type float64. 
+
+        Returns
+        -------
+        A tuple (t, xyz, vxvyvz, orbits), with None for every quantity not calculated.
+
+        Examples
+        --------
+        >>> sa = rebound.SimulationArchive("archive.bin")
+        >>> t, xyz, _, orbits = sa.extractParticles(range(len(sa)), t=True, xyz=True, orbits=True)
+        >>> print(orbits[:,0,1]) # eccentricity of the inner planet
+        """
+        import numpy as np
+        if (snapshots is None) == (times is None):
+            raise AttributeError("Need to specify either snapshots or times.")
+        if times is not None:
+            snapshots = [self._getSnapshotIndex(_t)[0] for _t in times]
+        snapshots = np.ascontiguousarray(snapshots, dtype=np.int64)
+        Ns = len(snapshots)
+        N = self._map.contents.N
+        def output(a, shape):
+            if a is None:
+                return None, None
+            if a is True:
+                a = np.zeros(shape, dtype="float64")
+            if not isinstance(a, np.ndarray) or a.dtype != np.float64 or not a.flags["C_CONTIGUOUS"]:
+                raise AttributeError("Output arrays need to be C contiguous numpy arrays of type float64.")
+            if a.size < np.prod(shape):
+                raise AttributeError("Output array too small, need at least shape %s."%(shape,))
+            return a, a.ctypes.data_as(POINTER(c_double))
+        t, tp = output(t, (Ns,))
+        xyz, xyzp = output(xyz, (Ns,N,3))
+        vxvyvz, vxvyvzp = output(vxvyvz, (Ns,N,3))
+        orbits, orbitsp = output(orbits, (Ns,N-1,6))
+        clibrebound.reb_simulationarchive_map_extract.restype = c_int
+        retv = clibrebound.reb_simulationarchive_map_extract(self._map, snapshots.ctypes.data_as(POINTER(c_long)), c_long(Ns), tp, xyzp, vxvyvzp, orbitsp)
+        if retv:
+            raise ValueError("Error while extracting snapshots from binary file. Errorcode: %d."%retv)
+        return t, xyz, vxvyvz, orbits
+
     
     def estimateTime(self, t, tbefore=None):
         """
@@ -330,3 +565,109 @@ class SimulationArchive(Mapping):
         return runtime_estimate
 
 
+
+
+class SimulationArchiveContainer(Mapping):
+    """
+    SimulationArchiveContainer Class.
+
+    A SimulationArchive container stores the SimulationArchives of many 
+    simulations (members) in one file. This avoids creating one file per 
+    simulation for large ensembles. A simulation appends to a container if 
+    the SimulationArchive is initialized with a member index:
+    `sim.initSimulationArchive(filename, interval=..., member=k)`.
+    Many simulations, in different threads or processes, can append to the 
+    same container at the same time. Every simulation needs to use its 
+    own member index. 
+
+    The container is a mapping from the member indices to SimulationArchive 
+    objects which support all the functionality of a SimulationArchive file.
+    The index of all records is built when the container is opened. A member 
+    is only read when it is accessed. Snapshots appended after the container
+    has been opened are not visible.
+
+    Examples
+    --------
+
+    >>> for k in range(100):
+    ...     sim = rebound.Simulation()
+    ...     sim.add(m=1.)
+    ...     sim.add(m=1.e-3, a=1.+0.01*k)
+    ...     sim.initSimulationArchive("ensemble.bin", interval=10., member=k)
+    ...     sim.integrate(100.)
+    >>> sac = rebound.SimulationArchiveContainer("ensemble.bin")
+    >>> sim = sac.getSimulation(42, 3)   # snapshot 3 of member 42
+    >>> sa = sac[42]                     # SimulationArchive of member 42
+    >>> sim = sa.getSimulation(t=55., mode="close")
+    """
+    def __init__(self, filename):
+        self.filename = filename
+        self.cfilename = c_char_p(filename.encode("ascii"))
+        clibrebound.reb_create_simulationarchive_container.restype = POINTER(SimulationArchiveContainerStruct)
+        self._c = clibrebound.reb_create_simulationarchive_container(self.cfilename)
+        if not self._c:
+            raise ValueError("Cannot map SimulationArchive container.")
+        c = self._c.contents
+        start = c._start[:c.N_members+1]
+        self.members = [k for k in range(c.N_members) if start[k+1]>start[k]]
+        self._members = set(self.members)
+
+    def __del__(self):
+        if hasattr(self, "_c") and self._c:
+            clibrebound.reb_free_simulationarchive_container(self._c)
+            self._c = None
+
+    def __str__(self):
+        """
+        Returns a string with details of this simulation archive container.
+        """
+        return "<rebound.SimulationArchiveContainer instance, members={0} filesize={1} >".format(str(len(self)), str(self._c.contents.size))
+
+    def __getitem__(self, member):
+        return self.getSimulationArchive(member)
+
+    def __contains__(self, member):
+        return member in self._members
+
+    def __iter__(self):
+        return iter(self.members)
+
+    def __len__(self):
+        return len(self.members)
+
+    def _memberMap(self, member):
+        clibrebound.reb_simulationarchive_container_map.restype = POINTER(SimulationArchiveMap)
+        m = clibrebound.reb_simulationarchive_container_map(self._c, c_long(member))
+        if not m:
+            raise KeyError("Member %d not found in SimulationArchive container."%member)
+        return m
+
+    def getSimulationArchive(self, member, setup=None, setup_args=(), rebxfilename=None, cache_size=4):
+        """
+        Returns the SimulationArchive of one member. The arguments other 
+        than the member index are the same as for the SimulationArchive class.
+        """
+        return SimulationArchive(self.filename, setup=setup, setup_args=setup_args, rebxfilename=rebxfilename, cache_size=cache_size, member=member, _container=self)
+
+    def getSimulation(self, member, snapshot=-1):
+        """
+        Loads one snapshot of one member into a new simulation. 
+        Like Simulation.from_archive(), the simulation is not synchronized 
+        and function pointers need to be reset manually.
+
+        Arguments
+        ---------
+        member : int
+            Index of the member.
+        snapshot : int
+            Index of the snapshot. Negative values count from the end.
+            Default: -1 (last snapshot).
+        """
+        sim = Simulation()
+        clibrebound.reb_simulationarchive_container_load_snapshot.restype = c_int
+        retv = clibrebound.reb_simulationarchive_container_load_snapshot(byref(sim), self._c, c_long(member), c_long(snapshot))
+        if retv == -1:
+            raise KeyError("Member %d not found in SimulationArchive container."%member)
+        if retv:
+            raise ValueError("Error while loading snapshot in SimulationArchive container. Errorcode: %d."%retv)
+        return sim
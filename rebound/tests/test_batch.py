@@ -0,0 +1,109 @@
+import rebound
+import unittest
+
+def setup_system():
+    sim = rebound.Simulation()
+    sim.add(m=1.)
+    sim.add(m=1e-4, a=1., e=0.05)
+    sim.add(m=1e-4, a=1.6, e=0.02, inc=0.01, f=1.1)
+    sim.move_to_com()
+    return sim
+
+class TestBatch(unittest.TestCase):
+
+    def test_copies(self):
+        for integrator in ["ias15", "whfast", "leapfrog"]:
+            sim = setup_system()
+            sim.integrator = integrator
+            sim.dt = 0.01
+            batch = rebound.Batch(sim, 7, threads=3)
+            self.assertEqual(len(batch), 7)
+            for k, s in enumerate(batch):
+                s.particles[2].vx += 1e-3*k
+            batch.integrate(10.)
+            for k in range(7):
+                sim2 = setup_system()
+                sim2.integrator = integrator
+                sim2.dt = 0.01
+                sim2.particles[2].vx += 1e-3*k
+                sim2.integrate(10.)
+                self.assertEqual(batch[k].t, sim2.t)
+                self.assertEqual(batch[k]._status, 0)
+                for i in range(3):
+                    self.assertEqual(batch[k].particles[i].x, sim2.particles[i].x)
+                    self.assertEqual(batch[k].particles[i].vy, sim2.particles[i].vy)
+            # Template is not changed
+            self.assertEqual(sim.t, 0.)
+
+    def test_forces(self):
+        sim = setup_system()
+        sim.add_force("drag", gamma=1e-3)
+        batch = rebound.Batch(sim, 2)
+        batch.integrate(1.)
+        sim.integrate(1.)
+        self.assertEqual(batch[1].particles[1].x, sim.particles[1].x)
+
+    def test_errors(self):
+        with self.assertRaises(ValueError):
+            rebound.Batch(setup_system(), 0)
+        batch = rebound.Batch(setup_system(), 2)
+        with self.assertRaises(IndexError):
+            batch[2]
+        self.assertEqual(batch[-1].N, 3)
+
+    def test_particle_data(self):
+        import numpy as np
+        batch = rebound.Batch(setup_system(), 5)
+        data = batch.particle_data
+        self.assertEqual(data.shape, (5,3,7))
+        self.assertEqual(data[3,1,1], batch[3].particles[1].x)
+        data[:,2,1] *= np.linspace(1.,1.1,5)
+        batch.particle_data = data
+        self.assertEqual(batch[4].particles[2].x, data[4,2,1])
+        batch.integrate(10.)
+        t, status = batch.status
+        self.assertTrue(np.all(t==10.))
+        self.assertTrue(np.all(status==0))
+        data2 = batch.particle_data
+        self.assertEqual(data2[4,2,1], batch[4].particles[2].x)
+        with self.assertRaises(ValueError):
+            batch.particle_data = data[:,:,:6]
+
+    def test_megno_map(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.integrator = "whfast"
+        sim.dt = 0.05
+        sim.exit_max_distance = 10.
+        sim.rand_seed = 1
+        def setup(s, a, e):
+            s.add(m=1e-3, a=a, e=e, f=2., primary=s.particles[0])
+            s.move_to_com()
+        maps = []
+        for threads in [1, 3]:
+            m = rebound.MegnoMap(sim, setup, 9, 3, (1.2,2.4), (0.,0.2), tmax=300., refine=1, threads=threads)
+            N = m.calculate()
+            self.assertEqual((m.Nx_fine, m.Ny_fine), (17, 5))
+            self.assertEqual(N, m.N_integrated)
+            self.assertLess(N, 17*5)
+            maps.append(m)
+        for k in range(17*5):
+            self.assertEqual(maps[0]._megno[k], maps[1]._megno[k])
+        m = maps[0]
+        # Close to the inner planet: chaotic or escaped early
+        self.assertLess(m._t[0], 300.)
+        self.assertEqual(m._level[0], 0)
+        # Far away: regular, integrated to tmax
+        self.assertEqual(m._t[16], 300.)
+        self.assertAlmostEqual(m._megno[16], 2., delta=0.3)
+        self.assertEqual(m._level[15], -1)
+        self.assertEqual(m._t[15], 0.)
+        self.assertEqual(sim.N, 2)
+        sim.add(m=1e-3, a=2.)
+        sim.add_variation()
+        with self.assertRaises(RuntimeError):
+            m.calculate()
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,5 +1,6 @@
 import rebound
 import unittest
+import random
 import math
 import numpy as np
 
@@ -91,6 +92,228 @@ class TestCollisions(unittest.TestCase):
         sim.integrate(2.*sim.dt)
         self.assertLess(sim.N,25)
 
+    def test_sweep_grid_shear(self):
+        x = []
+        Nlog = []
+        for collision in ["direct", "sweep", "grid"]:
+            sim = rebound.Simulation()
+            sim.ri_sei.OMEGA = 1.
+            sim.configure_box(10.,1,1,1)
+            sim.integrator = "sei"
+            sim.boundary = "shear"
+            sim.collision = collision
+            sim.nghostx = 1
+            sim.nghosty = 1
+            sim.nghostz = 0
+            sim.dt = 1e-3*2.*math.pi
+            for i in range(100):
+                px, py, pz = (i*1.37)%10.-5., (i*2.91)%10.-5., (i*0.71)%1.-0.5
+                sim.add(m=1., r=0.05+0.01*(i%3), x=px, y=py, z=pz, vy=-1.5*px, vz=(i*0.113)%0.2-0.1, hash=i)
+            sim.integrate(0.1*2.*math.pi)
+            Nlog.append(sim.collisions_Nlog)
+            x.append({p.hash.value: (p.x, p.y, p.z) for p in sim.particles})
+        self.assertGreater(Nlog[0], 0)
+        for k in range(1,3):
+            self.assertEqual(Nlog[0], Nlog[k])
+            for h in x[0]:
+                for l in range(3):
+                    self.assertAlmostEqual(x[0][h][l], x[k][h][l], delta=1e-10)
+
+    def test_verlet(self):
+        x = []
+        Nlog = []
+        for skin in [0., 0.1]:
+            sim = rebound.Simulation()
+            sim.ri_sei.OMEGA = 1.
+            sim.configure_box(10.,1,1,1)
+            sim.integrator = "sei"
+            sim.boundary = "shear"
+            sim.collision = "tree"
+            sim.collision_verlet_skin = skin
+            sim.nghostx = 1
+            sim.nghosty = 1
+            sim.nghostz = 0
+            sim.dt = 1e-3*2.*math.pi
+            for i in range(300):
+                px, py, pz = (i*1.37)%10.-5., (i*2.91)%10.-5., (i*0.71)%1.-0.5
+                sim.add(m=1., r=0.05+0.01*(i%3), x=px, y=py, z=pz, vy=-1.5*px, vz=(i*0.113)%0.2-0.1, hash=i)
+            sim.collisions_seed = 1
+            sim.integrate(0.2*2.*math.pi)
+            Nlog.append(sim.collisions_Nlog)
+            x.append({p.hash.value: (p.x, p.y, p.z) for p in sim.particles})
+        self.assertGreater(Nlog[0], 0)
+        self.assertEqual(Nlog[0], Nlog[1])
+        for h in x[0]:
+            self.assertEqual(x[0][h], x[1][h])
+
+    def test_fused(self):
+        x = []
+        Nlog = []
+        for fused, skin in [(0, 0.), (1, 0.), (1, 0.1)]:
+            sim = rebound.Simulation()
+            sim.ri_sei.OMEGA = 1.
+            sim.configure_box(10.,1,1,1)
+            sim.integrator = "sei"
+            sim.boundary = "shear"
+            sim.gravity = "tree"
+            sim.collision = "tree"
+            sim.collision_fused = fused
+            sim.collision_verlet_skin = skin
+            sim.opening_angle2 = 0.5
+            sim.G = 1e-3
+            sim.nghostx = 2
+            sim.nghosty = 2
+            sim.nghostz = 0
+            sim.dt = 1e-3*2.*math.pi
+            for i in range(300):
+                px, py, pz = (i*1.37)%10.-5., (i*2.91)%10.-5., (i*0.71)%1.-0.5
+                sim.add(m=1., r=0.15+0.01*(i%3), x=px, y=py, z=pz, vy=-1.5*px, vz=(i*0.113)%0.2-0.1, hash=i)
+            sim.collisions_seed = 1
+            sim.integrate(0.2*2.*math.pi)
+            Nlog.append(sim.collisions_Nlog)
+            x.append({p.hash.value: (p.x, p.y, p.z) for p in sim.particles})
+        self.assertGreater(Nlog[0], 0)
+        for k in range(1,3):
+            self.assertEqual(Nlog[0], Nlog[k])
+            for h in x[0]:
+                self.assertEqual(x[0][h], x[k][h])
+
+    def test_resolve_parallel(self):
+        x = []
+        for cor, parallel in [(None, 0), (None, 1), (lambda r, v: 0.5, 0), (lambda r, v: 0.5, 1)]:
+            sim = rebound.Simulation()
+            sim.ri_sei.OMEGA = 1.
+            sim.configure_box(10.,1,1,1)
+            sim.integrator = "sei"
+            sim.boundary = "shear"
+            sim.collision = "direct"
+            sim.collision_resolve_parallel = parallel
+            if cor is not None:
+                sim.coefficient_of_restitution = cor # falls back to the serial resolve
+            sim.nghostx = 1
+            sim.nghosty = 1
+            sim.nghostz = 0
+            sim.dt = 1e-3*2.*math.pi
+            for i in range(100):
+                px, py, pz = (i*1.37)%10.-5., (i*2.91)%10.-5., (i*0.71)%1.-0.5
+                sim.add(m=1., r=0.05+0.01*(i%3), x=px, y=py, z=pz, vy=-1.5*px, vz=(i*0.113)%0.2-0.1)
+            sim.collisions_seed = 1 # same collision order in both runs
+            sim.integrate(2.*math.pi)
+            x.append((sim.collisions_Nlog, sim.collisions_plog, [(p.x, p.vx) for p in sim.particles]))
+        self.assertGreater(x[0][0], 0)
+        self.assertEqual(x[0], x[1])
+        self.assertEqual(x[2], x[3])
+
+    def test_resolve_batch(self):
+        for collision in ["direct", "tree"]:
+            N = []
+            for batch in [0, 1]:
+                sim = rebound.Simulation()
+                sim.configure_box(20.)
+                sim.integrator = "leapfrog"
+                sim.gravity = "none"
+                sim.collision = collision
+                sim.dt = 0.01
+                # Five pairs of approaching particles, far apart from each other.
+                for i in range(5):
+                    sim.add(m=1., r=0.3, x=-0.25, y=3.*i-6., vx=1.)
+                    sim.add(m=1., r=0.3, x=0.25, y=3.*i-6.+0.1*i, vx=-1.)
+                calls = []
+                def resolve(sim_pointer, c):
+                    ps = sim_pointer.contents.particles
+                    self.assertEqual(len(set(zip(np.minimum(c["p1"],c["p2"]), np.maximum(c["p1"],c["p2"])))), len(c["p1"]))
+                    for k in range(len(c["p1"])):
+                        p1, p2 = ps[int(c["p1"][k])], ps[int(c["p2"][k])]
+                        self.assertAlmostEqual(c["dx"][k][0], p1.x+c["gb"][k][0]-p2.x, delta=1e-14)
+                        self.assertAlmostEqual(c["dv"][k][1], p1.vy+c["gb"][k][4]-p2.vy, delta=1e-14)
+                    calls.append(len(c["p1"]))
+                    return np.full(len(c["p1"]), 2)
+                if batch:
+                    sim.collision_resolve_batch = resolve
+                else:
+                    sim.collision_resolve = lambda sim_pointer, c: 2
+                sim.integrate(0.1)
+                N.append(sim.N)
+                if batch:
+                    self.assertGreater(len(calls), 0)
+                    self.assertEqual(sum(calls), 5)
+            self.assertEqual(N, [5, 5])
+
+    def test_swept(self):
+        for collision in ["direct", "tree", "sweep", "grid"]:
+            for swept in [0, 1]:
+                sim = rebound.Simulation()
+                sim.configure_box(10.)
+                sim.gravity = "none"
+                sim.collision = collision
+                sim.collision_swept = swept
+                sim.dt = 0.1
+                # Particles pass through each other within one timestep.
+                sim.add(m=1., r=0.1, x=-0.55, vx=10., hash=1)
+                sim.add(m=1., r=0.1, x=0.55, vx=-10., hash=2)
+                sim.integrate(0.1)
+                self.assertEqual(sim.collisions_Nlog, swept)
+                p = sim.particles[rebound.hash(1)]
+                if swept:
+                    self.assertAlmostEqual(p.x, -0.65, delta=1e-12)
+                    self.assertAlmostEqual(p.vx, -10., delta=1e-12)
+                else:
+                    self.assertAlmostEqual(p.x, 0.45, delta=1e-12)
+
+    def test_sleep(self):
+        for collision in ["direct", "tree", "sweep"]:
+            sim = rebound.Simulation()
+            sim.configure_box(10.)
+            sim.gravity = "none"
+            sim.collision = collision
+            sim.integrator = "leapfrog"
+            sim.dt = 0.01
+            sim.sleep_velocity = 0.1
+            sim.sleep_steps = 5
+            sim.add(m=1., r=0.1, x=0., hash=1)
+            sim.add(m=1., r=0.1, x=-2., vx=1., hash=2)
+            sim.add(m=1., r=0.1, y=2., vy=0.05, hash=3)
+            sim.integrate(1., exact_finish_time=0)
+            # The slow particles fall asleep and stop moving.
+            self.assertEqual(sim.sleeping_N, 2)
+            self.assertEqual(sim.particles[rebound.hash(3)].vy, 0.)
+            y3 = sim.particles[rebound.hash(3)].y
+            sim.integrate(3., exact_finish_time=0)
+            # The sleeping particle is woken up by the impact, the other one falls asleep.
+            self.assertEqual(sim.collisions_Nlog, 1)
+            self.assertAlmostEqual(sim.particles[rebound.hash(1)].vx, 1., delta=1e-12)
+            self.assertEqual(sim.particles[rebound.hash(2)].vx, 0.)
+            self.assertEqual(sim.particles[rebound.hash(3)].y, y3)
+            self.assertEqual(sim.sleeping_N, 2)
+
+    def test_tree_query(self):
+        random.seed(3)
+        sim = rebound.Simulation()
+        sim.configure_box(10., 1, 1, 1)
+        sim.boundary = "periodic"
+        sim.collision = "tree"
+        sim.nghostx = 1
+        sim.nghosty = 1
+        sim.nghostz = 1
+        for i in range(300):
+            sim.add(m=1., r=0.01, x=random.uniform(-5,5), y=random.uniform(-5,5), z=random.uniform(-5,5))
+        sim.tree_update()
+        def brute(x, y, z, exclude):
+            d = []
+            for j, p in enumerate(sim.particles):
+                if j == exclude: continue
+                dx, dy, dz = [(a-b+5.)%10.-5. for a, b in zip((p.x, p.y, p.z), (x, y, z))]
+                d.append((dx*dx+dy*dy+dz*dz, j))
+            return sorted(d)
+        for x, y, z, exclude in [(0.,0.,0.,-1), (4.9,-4.9,4.9,-1), (sim.particles[7].x, sim.particles[7].y, sim.particles[7].z, 7)]:
+            d = brute(x, y, z, exclude)
+            res = sim.tree_query_radius(x, y, z, 2., exclude)
+            self.assertEqual(sorted(n.index for n in res), sorted(j for r2, j in d if r2 <= 4.))
+            for n in res:
+                self.assertAlmostEqual(n.r2, n.dx*n.dx+n.dy*n.dy+n.dz*n.dz, delta=1e-12)
+            res = sim.tree_query_knn(x, y, z, 10, exclude)
+            self.assertEqual([n.index for n in res], [j for r2, j in d[:10]])
+            self.assertAlmostEqual(res[-1].r2, d[9][0], delta=1e-12)
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,60 @@
+import rebound
+import unittest
+
+def setup_system(k):
+    sim = rebound.Simulation()
+    sim.add(m=1.)
+    sim.add(m=1e-4, a=1., e=0.05, f=0.3*k)
+    sim.add(m=1e-4, a=1.6+0.01*k, e=0.02, inc=0.01, f=1.1)
+    sim.add(m=1e-5, a=2.5, f=2.*k)
+    sim.move_to_com()
+    return sim
+
+class TestEnsemble(unittest.TestCase):
+
+    def test_compare_whfast(self):
+        N_systems = 11 # Not a multiple of the number of lanes
+        ens = rebound.Ensemble(N_systems, 4)
+        ens.dt = 0.01
+        for k in range(N_systems):
+            ens.set_simulation(k, setup_system(k))
+        ens.integrate(20.)
+        for k in range(N_systems):
+            sim = setup_system(k)
+            sim.integrator = "whfast"
+            sim.ri_whfast.safe_mode = 0
+            sim.dt = 0.01
+            sim.integrate(20., exact_finish_time=0)
+            sim2 = ens.get_simulation(k)
+            self.assertEqual(sim.t, sim2.t)
+            for i in range(sim.N):
+                self.assertEqual(sim.particles[i].m, sim2.particles[i].m)
+                self.assertAlmostEqual(sim.particles[i].x, sim2.particles[i].x, delta=1e-12)
+                self.assertAlmostEqual(sim.particles[i].vy, sim2.particles[i].vy, delta=1e-12)
+
+    def test_energy(self):
+        ens = rebound.Ensemble(3, 4)
+        ens.dt = 0.01
+        E0 = []
+        for k in range(3):
+            sim = setup_system(k)
+            E0.append(sim.calculate_energy())
+            ens.set_simulation(k, sim)
+        ens.integrate(10.)
+        ens.integrate(20.)
+        for k in range(3):
+            E1 = ens.get_simulation(k).calculate_energy()
+            self.assertLess(abs((E1-E0[k])/E0[k]), 1e-5)
+
+    def test_errors(self):
+        ens = rebound.Ensemble(2, 4)
+        ens.set_simulation(0, setup_system(0))
+        with self.assertRaises(RuntimeError):
+            ens.integrate(1.)
+        with self.assertRaises(ValueError):
+            ens.set_simulation(1, rebound.Simulation())
+        with self.assertRaises(IndexError):
+            ens.get_simulation(2)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,6 +1,8 @@
 import rebound
 import unittest
 import math
+import random
+import os
 import numpy as np
 
 class TestGravity(unittest.TestCase):
@@ -90,6 +92,341 @@ class TestGravity(unittest.TestCase):
         x1ias = sim.particles[1].x
         self.assertAlmostEqual(x1ias, x1,delta=1e-9)
 
+    def test_basic_vs_compensated(self):
+        for integrator in ["ias15", "whfast", "whfasthelio"]:
+            x = []
+            for gravity in ["basic", "compensated"]:
+                sim = rebound.Simulation()
+                sim.gravity = gravity
+                sim.integrator = integrator
+                sim.dt = 0.01
+                sim.add(m=1.)
+                for i in range(20):
+                    sim.add(m=1e-5, a=1.+0.1*i, e=0.01, inc=0.01*i, f=0.3*i)
+                sim.move_to_com()
+                sim.integrate(10.)
+                x.append([p.x for p in sim.particles])
+            for i in range(len(x[0])):
+                self.assertAlmostEqual(x[0][i], x[1][i], delta=1e-12)
+
+    def test_tree_flatten(self):
+        x = []
+        for flatten in [0, 1]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = "tree"
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.5
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_flatten = flatten
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz)
+            sim.integrate(0.5)
+            x.append(sorted([p.x for p in sim.particles]))
+        self.assertEqual(x[0], x[1])
+
+    def test_tree_group_size(self):
+        x = []
+        for gravity, group_size in [("basic", 0), ("tree", 16)]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = gravity
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_group_size = group_size
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+            sim.integrate(0.1)
+            x.append({p.hash.value: p.x for p in sim.particles})
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-5)
+
+    def test_tree_leaf_size(self):
+        x = {}
+        cells = {}
+        for gravity, leaf_size, group_size in [("basic", 1, 0), ("tree", 1, 0), ("tree", 16, 0), ("tree", 16, 8), ("tree", 16, 32)]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = gravity
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.multipole_order = 2
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_flatten = 1
+            sim.tree_leaf_size = leaf_size
+            sim.tree_group_size = group_size
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+            sim.integrate(0.1)
+            x[(gravity,leaf_size,group_size)] = {p.hash.value: p.x for p in sim.particles}
+            cells[(gravity,leaf_size,group_size)] = sim._tree_flat_N
+        self.assertLess(cells[("tree",16,0)], cells[("tree",1,0)]/4)
+        ref = x[("basic",1,0)]
+        for k in x:
+            for h in ref:
+                self.assertAlmostEqual(ref[h], x[k][h], delta=1e-5)
+
+    def test_tree_single_precision(self):
+        x = []
+        for single_precision, multipole_order in [(0, 0), (1, 0), (0, 3), (1, 3)]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.boundary = "periodic"
+            sim.nghostx = 1
+            sim.gravity = "tree"
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.multipole_order = multipole_order
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_group_size = 16
+            sim.tree_single_precision = single_precision
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+            sim.integrate(0.1)
+            x.append({p.hash.value: p.x for p in sim.particles})
+        self.assertTrue(any(x[0][h]!=x[1][h] for h in x[0]))
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-8)
+            self.assertAlmostEqual(x[2][h], x[3][h], delta=1e-8)
+
+    def test_fmm(self):
+        x = []
+        for gravity, boundary in [("basic", "open"), ("fmm", "open"), ("basic", "periodic"), ("fmm", "periodic")]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = gravity
+            sim.boundary = boundary
+            if boundary == "periodic":
+                sim.nghostx = 1
+                sim.nghosty = 1
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.16
+            sim.fmm_order = 4
+            sim.softening = 0.02
+            sim.dt = 0.01
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+            sim.integrate(0.1)
+            x.append({p.hash.value: p.x for p in sim.particles})
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-5)
+            self.assertAlmostEqual(x[2][h], x[3][h], delta=1e-5)
+
+    def test_opencl_name(self):
+        sim = rebound.Simulation()
+        sim.gravity = "opencl"
+        self.assertEqual(sim.gravity, "opencl")
+        self.assertEqual(sim._gravity, 5)
+
+    def test_fft_treepm(self):
+        def simulation(boundary, gravity, nghost):
+            sim = rebound.Simulation()
+            sim.configure_box(1.)
+            sim.boundary = boundary
+            sim.ri_sei.OMEGA = 1.
+            sim.t = 0.37
+            sim.gravity = gravity
+            sim.fft_nx = 128
+            sim.fft_ny = 128
+            sim.fft_rs = 2.5/128
+            sim.opening_angle2 = 0.01
+            sim.nghostx = nghost
+            sim.nghosty = nghost
+            sim.nghostz = 0
+            sim.integrator = "leapfrog"
+            sim.dt = 1e-8
+            rng = random.Random(1)
+            for i in range(40):
+                sim.add(m=0.025, x=rng.uniform(-0.5,0.5), y=rng.uniform(-0.5,0.5))
+            sim.step()
+            return sim
+        def accelerations(boundary, gravity, nghost):
+            sim = simulation(boundary, gravity, nghost)
+            return [(p.vx/sim.dt, p.vy/sim.dt) for p in sim.particles]
+        for boundary in ["shear", "periodic"]:
+            # Richardson extrapolation of the sum over ghost boxes.
+            a1 = accelerations(boundary, "basic", 20)
+            a2 = accelerations(boundary, "basic", 40)
+            ref = [(2.*b[0]-a[0], 2.*b[1]-a[1]) for a, b in zip(a1, a2)]
+            treepm = accelerations(boundary, "treepm", 1)
+            norm = (sum(a[0]**2+a[1]**2 for a in ref)/len(ref))**0.5
+            for a, b in zip(ref, treepm):
+                self.assertLess(((a[0]-b[0])**2+(a[1]-b[1])**2)**0.5, 1e-3*norm)
+        # The FFT alone agrees with TreePM for particles without neighbours within the cutoff radius.
+        fft = accelerations("periodic", "fft", 0)
+        sim = simulation("periodic", "fft", 0)
+        d = lambda u: abs(u-round(u))
+        for i, p in enumerate(sim.particles):
+            nearest = min([(d(p.x-q.x)**2+d(p.y-q.y)**2)**0.5 for q in sim.particles if q is not p])
+            if nearest > 0.15:
+                a, b = treepm[i], fft[i]
+                self.assertLess(((a[0]-b[0])**2+(a[1]-b[1])**2)**0.5, 1e-3*norm)
+
+    def test_multipole_order(self):
+        a = []
+        for gravity, multipole_order in [("basic", 0), ("tree", 0), ("tree", 2), ("tree", 3)]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = gravity
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.multipole_order = multipole_order
+            sim.dt = 0.01
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+            sim.step()
+            a.append({p.hash.value: (p.ax, p.ay, p.az) for p in sim.particles})
+        errors = []
+        for k in range(1,4):
+            e = 0.
+            for h in a[0]:
+                e += sum((a[k][h][l]-a[0][h][l])**2 for l in range(3))
+            errors.append(e)
+        self.assertLess(errors[1], errors[0])
+        self.assertLess(errors[2], errors[1])
+
+    def test_tree_rebuild(self):
+        x = []
+        for tree_rebuild in [0, 1]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = "tree"
+            sim.boundary = "periodic"
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_rebuild = tree_rebuild
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, vx=(i*0.113)%1.-0.5, hash=i)
+            sim.integrate(1.)
+            self.assertEqual(sim.N, 200)
+            x.append({p.hash.value: p.x for p in sim.particles})
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-12)
+
+    def test_tree_refit(self):
+        x = []
+        for tree_refit in [0, 1]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = "tree"
+            sim.boundary = "open"
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.25
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_refit = tree_refit
+            sim.add(m=1e-3, x=3.5, vx=10., hash=200) # leaves the box
+            for i in range(200):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz, vx=(i*0.113)%1.-0.5, hash=i)
+            sim.integrate(1.)
+            self.assertEqual(sim.N, 200)
+            if tree_refit:
+                # Only the last particle moved into the slot of the removed one.
+                self.assertEqual(sim.particles[0].hash.value, 199)
+                for i in range(1,200):
+                    self.assertEqual(sim.particles[i].hash.value, i-1)
+            x.append({p.hash.value: p.x for p in sim.particles})
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-12)
+
+    def test_tree_active_only(self):
+        x = []
+        for active_only in [0, 1]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = "tree"
+            sim.boundary = "periodic"
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = 0.
+            sim.softening = 0.02
+            sim.dt = 0.01
+            sim.tree_active_only = active_only
+            for i in range(20):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-2, x=px, y=py, z=pz, vx=(i*0.113)%1.-0.5, hash=i)
+            for i in range(20, 400):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=0., x=px, y=py, z=pz, vx=(i*0.113)%1.-0.5, hash=i)
+            sim.N_active = 20
+            sim.integrate(1.)
+            self.assertEqual(sim.N, 400)
+            if active_only:
+                # Test particles never move into the range of active particles.
+                self.assertEqual(sorted(sim.particles[i].hash.value for i in range(20)), list(range(20)))
+            x.append({p.hash.value: p.x for p in sim.particles})
+        for h in x[0]:
+            self.assertAlmostEqual(x[0][h], x[1][h], delta=1e-10)
+
+    def test_tree_tasks(self):
+        x = {}
+        for flatten in [0, 1]:
+            for tasks in [0, 1]:
+                sim = rebound.Simulation()
+                sim.configure_box(4.,2,2,1)
+                sim.gravity = "tree"
+                sim.boundary = "open"
+                sim.integrator = "leapfrog"
+                sim.opening_angle2 = 0.5
+                sim.softening = 0.02
+                sim.dt = 0.01
+                sim.tree_flatten = flatten
+                sim.tree_tasks = tasks
+                # Clumpy distribution: most particles in one corner.
+                for i in range(300):
+                    s = 0.05 if i%4 else 1.
+                    px, py, pz = (i*0.137)%s-0.9, (i*0.291)%s-0.4, (i*0.071)%0.2-0.1
+                    sim.add(m=1e-3, x=px, y=py, z=pz, hash=i)
+                sim.integrate(0.2)
+                x[(flatten,tasks)] = {p.hash.value: p.x for p in sim.particles}
+                if tasks:
+                    self.assertGreater(sim._tree_task_cost[0], 1.)
+        for flatten in [0, 1]:
+            self.assertEqual(x[(flatten,0)], x[(flatten,1)])
+
+    def test_tree_force_accuracy(self):
+        angles = []
+        for target in [1e-2, 1e-4]:
+            sim = rebound.Simulation()
+            sim.configure_box(4.,2,2,1)
+            sim.gravity = "tree"
+            sim.integrator = "leapfrog"
+            sim.softening = 0.02
+            sim.dt = 0.001
+            for i in range(400):
+                px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                sim.add(m=1e-3, x=px, y=py, z=pz)
+            self.assertEqual(sim.tree_force_error, -1.)
+            sim.tree_force_accuracy = target
+            sim.tree_force_accuracy_interval = 1
+            sim.tree_force_accuracy_samples = 64
+            for k in range(15):
+                sim.step()
+            self.assertLess(sim.tree_force_error, 3.*target)
+            self.assertGreater(sim.tree_force_error, 0.)
+            angles.append(sim.opening_angle2)
+        self.assertLess(angles[1], angles[0])
+        sim.save("bintest.bin")
+        sim2 = rebound.Simulation.from_file("bintest.bin")
+        os.remove("bintest.bin")
+        self.assertEqual(sim2.tree_force_accuracy, 1e-4)
+        self.assertEqual(sim2.opening_angle2, sim.opening_angle2)
+        self.assertEqual(sim2.tree_force_error, sim.tree_force_error)
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -99,6 +99,25 @@ class TestZeroHash(unittest.TestCase):
         self.assertAlmostEqual(self.sim.particles["jupiter"].m, 3., delta=1e-15)
         self.assertEqual(self.sim.N_lookup, 3)
 
+class TestLookupAfterRemove(unittest.TestCase):
+    def test_remove(self):
+        sim = rebound.Simulation()
+        for i in range(1,101):
+            sim.add(m=i, hash=c_uint32(i))
+        self.assertAlmostEqual(sim.particles[c_uint32(50)].m, 50., delta=1e-15)
+        self.assertEqual(sim.N_lookup, 100)
+        sim.remove(0, keepSorted=1)
+        sim.remove(10, keepSorted=0)
+        for i in range(0,20,3):
+            sim.remove_mark(i)
+        sim.remove_marked(keepSorted=False)
+        self.assertEqual(sim.N_lookup, sim.N)
+        for i in range(sim.N):
+            h = sim.particles[i].hash
+            self.assertAlmostEqual(sim.particles[h].m, sim.particles[i].m, delta=1e-15)
+        with self.assertRaises(rebound.ParticleNotFound):
+            sim.particles[c_uint32(1)]
+
 class TestSort(unittest.TestCase):
     def setUp(self):
         self.sim = rebound.Simulation()
@@ -62,6 +62,26 @@ class TestHermes(unittest.TestCase):
         x_ias15 = sim.particles[1].x
         self.assertEqual(x_hermes,x_ias15)
 
+    def test_close_encounter_many_active(self):
+        # More active particles than REB_HERMES_ENCOUNTER_SWEEP_N_ACTIVE use the sweep.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(24):
+            sim.add(m=1e-5, a=1.+0.4*i, f=0.7*i)
+        sim.N_active = sim.N
+        p = sim.particles[13]
+        rh = p.a*pow(p.m/(3.*sim.particles[0].m),1./3)
+        sim.add(primary=p, a=0.5*rh, f=1.)
+        sim.add(a=1.2+0.4*13, f=0.7*13+3.)
+        sim.integrator = "hermes"
+        sim.testparticle_type = 1
+        sim.ri_hermes.adaptive_hill_switch_factor = 0
+        sim.dt = 1e-3
+        sim.step()
+        self.assertEqual(sim.ri_hermes.mini_active,1)
+        self.assertEqual(sim.ri_hermes._global_index_from_mini_index_N,sim.N_active+1)
+        self.assertEqual(sim.ri_hermes._global_index_from_mini_index[sim.N_active],sim.N_active)
+
     def test_planetesimal_collision(self):
         sim = rebound.Simulation()
         sim.add(m=1.)
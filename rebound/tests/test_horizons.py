@@ -31,6 +31,24 @@ class TestHorizons(unittest.TestCase):
                 print("Socket error. Most likely due to HORIZON being slow. Ignoring.")
                 raise Exception("Socket error. Should have been bogus planet error. Ignoring")
 
+    def test_cache(self):
+        import json, os, tempfile
+        filename = os.path.join(tempfile.mkdtemp(), "horizons_cache.json")
+        au = 149597870.7 # km
+        with open(filename, "w") as f:
+            json.dump({"Earth|2000-01-01 00:00:00|ecliptic": {"xyz": [-0.17568959237103887*au, 0.9659716145*au, 0.], "vxyz": [-30., -5., 0.], "idn": "3"}}, f)
+        cache_filename = rebound.horizons.CACHE_FILENAME
+        rebound.horizons.CACHE_FILENAME = filename
+        try:
+            # Served from the cache without connecting to HORIZONS
+            self.sim.add("Earth",date="2000-01-01 00:00")
+            self.assertAlmostEqual(self.sim.particles[0].x,-0.17568959237103887,delta=1e-14)
+            self.assertAlmostEqual(self.sim.particles[0].m,3.0404326480226416e-06,delta=1e-15)
+            rebound.horizons.prefetch(["Earth"], date="2000-01-01 00:00")
+        finally:
+            rebound.horizons.CACHE_FILENAME = cache_filename
+            os.remove(filename)
+
 
 if __name__ == "__main__":
     unittest.main()
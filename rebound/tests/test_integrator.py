@@ -55,6 +55,45 @@ class TestIntegrator2(unittest.TestCase):
         x1 = sim.calculate_energy()
         self.assertAlmostEqual(x0, x1, delta=1e-14)
     
+    def test_whfast_batch(self):
+        # Particles are integrated in batches unless there are variational particles.
+        # Results must be the same as for one particle at a time.
+        x = []
+        for variation in [False, True]:
+            sim = rebound.Simulation()
+            sim.integrator = "whfast"
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=5.)
+            for i in range(15):
+                sim.add(a=1.+0.1*i, e=0.05*i, f=0.1*i)
+            sim.add(a=-1., e=1.5)
+            sim.add(a=-2., e=3.)
+            if variation:
+                sim.add_variation()
+            sim.dt = 0.0123
+            sim.integrate(10.)
+            x.append([(p.x, p.vy) for p in sim.particles[:sim.N_real]])
+        self.assertEqual(x[0], x[1])
+
+    def test_whfast_testparticles(self):
+        # With N_active set, massless test particles are transformed and kicked separately.
+        x = []
+        for N_active in [-1, 3]:
+            sim = rebound.Simulation()
+            sim.integrator = "whfast"
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1.)
+            sim.add(m=1e-3, a=2., e=0.1)
+            for i in range(20):
+                sim.add(a=3.+0.1*i, e=0.01*i, inc=0.01*i, f=0.3*i)
+            sim.N_active = N_active
+            sim.dt = 0.0123
+            sim.integrate(20.)
+            x.append([(p.x, p.y, p.vz) for p in sim.particles])
+        for p0, p1 in zip(x[0], x[1]):
+            for k in range(3):
+                self.assertAlmostEqual(p0[k], p1[k], delta=1e-12)
+
     def test_whfast_verylargedt_hyperbolic(self):
         sim = rebound.Simulation()
         sim.add(m=1.)
@@ -122,6 +161,80 @@ class TestIntegrator(unittest.TestCase):
         e1 = self.sim.calculate_energy()
         self.assertLess(math.fabs((e0-e1)/e1),1e-14)
     
+    def test_ias15_block(self):
+        def setup(block_levels):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.01)
+            sim.add(primary=sim.particles[1], m=1e-8, a=0.002)  # Tight moon
+            sim.add(m=1e-5, a=2.1, e=0.05, f=1.)
+            sim.add(m=1e-5, a=3.3, e=0.02, f=2.)
+            for i in range(30):
+                sim.add(m=1e-9, a=2.5+0.05*i, e=0.01, f=0.7*i)
+            sim.move_to_com()
+            sim.ri_ias15.block_levels = block_levels
+            return sim
+        sim0 = setup(0)
+        sim1 = setup(10)
+        e0 = sim1.calculate_energy()
+        sim0.integrate(2.)
+        sim1.integrate(2.)
+        e1 = sim1.calculate_energy()
+        self.assertLess(math.fabs((e0-e1)/e1),1e-13)
+        for i in range(sim0.N):
+            self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+            self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-10)
+        # Outer planets are not limited by the timestep of the moon
+        sim0.step()
+        sim1.step()
+        self.assertGreater(sim1.dt, 4.*sim0.dt)
+        # Substeps of the moon do not keep getting shorter
+        sim0.integrate(10.)
+        sim1.integrate(10.)
+        self.assertLess(sim1.get_metrics().interactions, sim0.get_metrics().interactions)
+
+    def test_ias15_lean(self):
+        def setup(lean):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.7)
+            sim.add(m=1e-4, a=2.3, e=0.1, f=1.)
+            sim.N_active = 3
+            for i in range(20):
+                sim.add(a=1.5+0.1*i, e=0.05, f=0.5*i)
+            sim.move_to_com()
+            sim.ri_ias15.lean = lean
+            sim.dt = 1.     # First steps get rejected
+            return sim
+        sims = [setup(lean) for lean in [0, 1, 2]]
+        e0 = sims[0].calculate_energy()
+        for sim in sims:
+            sim.integrate(50.)
+            self.assertLess(math.fabs((e0-sim.calculate_energy())/e0),1e-14)
+        self.assertTrue(bool(sims[0].ri_ias15.br.p0))
+        self.assertFalse(bool(sims[1].ri_ias15.br.p0))
+        self.assertFalse(bool(sims[2].ri_ias15.er.p0))
+        self.assertEqual(sims[1].ri_ias15.csb_allocatedN, 3*sims[1].N)
+        self.assertEqual(sims[2].ri_ias15.csb_allocatedN, 3*sims[2].N_active)
+        for sim in sims[1:]:
+            for i in range(sim.N):
+                self.assertAlmostEqual(sims[0].particles[i].x, sim.particles[i].x, delta=1e-8)
+
+        # Lean Simulation Archive snapshots are smaller and can be restarted
+        sims[0].initSimulationArchive("test.bin", 10.)
+        sims[0].integrate(100.)
+        size0 = sims[0].simulationarchive_size_snapshot
+        sims[2].initSimulationArchive("test.bin", 10.)
+        sims[2].integrate(100.)
+        self.assertLess(2*sims[2].simulationarchive_size_snapshot, size0)
+        sa = rebound.SimulationArchive("test.bin")
+        sim = sa[-1]
+        self.assertEqual(sim.ri_ias15.lean, 2)
+        self.assertEqual(sim.t, sims[2].t)
+        sim.integrate(120.)
+        sims[2].integrate(120.)
+        self.assertAlmostEqual(sim.particles[1].x, sims[2].particles[1].x, delta=1e-10)
+
     def test_whfast_largedt(self):
         self.sim.integrator = "whfast"
         jupyr = 11.86*2.*math.pi
@@ -175,5 +288,94 @@ class TestIntegrator(unittest.TestCase):
         e1 = self.sim.calculate_energy()
         self.assertLess(math.fabs((e0-e1)/e1),1e-9)
 
+    def test_whfast_nosafemode_outputs(self):
+        # Synchronizing for outputs does not change the trajectory
+        def setup():
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.05)
+            sim.add(m=1e-3, a=1.6, e=0.05, inc=0.02)
+            sim.integrator = "whfast"
+            sim.dt = 0.05
+            sim.ri_whfast.safe_mode = 0
+            sim.ri_whfast.corrector = 11
+            return sim
+        sim = setup()
+        for t in range(1,101):
+            sim.integrate(t, exact_finish_time=0)
+        sim2 = setup()
+        sim2.integrate(100., exact_finish_time=0)
+        self.assertEqual(sim.particles[1].x, sim2.particles[1].x)
+        self.assertEqual(sim.particles[2].vy, sim2.particles[2].vy)
+
+    def test_whfast_nosafemode_modifications(self):
+        # Only the modified part of the Jacobi chain gets recalculated.
+        def run(safe_mode):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.05)
+            sim.add(m=1e-3, a=1.6, e=0.05, inc=0.02)
+            sim.add(m=1e-4, a=2.5, e=0.1)
+            sim.add(a=3., e=0.1)
+            sim.N_active = 4
+            sim.integrator = "whfast"
+            sim.dt = 0.05
+            sim.ri_whfast.safe_mode = safe_mode
+            def modify(simp):
+                ps = simp.contents.particles
+                ps[2].m *= 0.9999
+                ps[3].vx *= 0.9999
+                ps[4].vy *= 1.0001
+            sim.post_timestep_modifications = modify
+            sim.integrate(10., exact_finish_time=0)
+            return sim
+        sim0 = run(0)
+        sim1 = run(1)
+        for i in range(5):
+            self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+            self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-12)
+        self.assertEqual(sim0.particles[2].m, sim1.particles[2].m)
+
+    def test_saba(self):
+        def energy_error(integrator, safe_mode=1):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.05)
+            sim.add(m=1e-3, a=1.7, e=0.05, inc=0.1)
+            sim.move_to_com()
+            sim.integrator = integrator
+            sim.ri_saba.safe_mode = safe_mode
+            sim.dt = 0.05
+            e0 = sim.calculate_energy()
+            sim.integrate(20., exact_finish_time=0)
+            return abs((sim.calculate_energy()-e0)/e0)
+        e_whfast = energy_error("whfast")
+        e_saba1 = energy_error("saba1")
+        e_saba2 = energy_error("saba2")
+        e_sabac3 = energy_error("sabac3")
+        self.assertAlmostEqual(e_whfast, e_saba1, delta=1e-3*e_whfast)
+        self.assertLess(e_saba2, 1e-2*e_whfast)
+        self.assertLess(e_sabac3, 1e-1*e_saba2)
+        self.assertAlmostEqual(e_sabac3, energy_error("sabac3", safe_mode=0), delta=1e-12)
+    def test_leapfrog_fused(self):
+        # An additional force which does nothing disables the fused step. 
+        # Both need to give exactly the same result.
+        def run(gravity, boundary, disable_fused):
+            sim = rebound.Simulation()
+            sim.integrator = "leapfrog"
+            sim.gravity = gravity
+            sim.configure_box(10.)
+            sim.boundary = boundary
+            sim.dt = 1e-3
+            for i in range(20):
+                sim.add(m=0.01*(i+1), x=0.1*i-1., y=0.01*i*i-1., z=0.3*(i%3), vx=0.1*(i%5))
+            if disable_fused:
+                sim.additional_forces = lambda s: None
+            sim.integrate(1.)
+            return [(p.x, p.y, p.z, p.vx, p.vy, p.vz) for p in sim.particles]+[sim.t]
+        for gravity in ["basic", "none"]:
+            for boundary in ["none", "periodic", "open"]:
+                self.assertEqual(run(gravity, boundary, 0), run(gravity, boundary, 1))
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,56 @@
+import rebound
+import unittest
+import random
+
+class TestMercurius(unittest.TestCase):
+
+    def test_no_close_encounter(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1.e-3, a=1.523,e=0.0146,f=0.24)
+        sim.add(m=1.e-3, a=2.423523,e=0.01246,f=0.324)
+        sim.move_to_com()
+        sim.integrator = "mercurius"
+        sim.dt = 1e-2*sim.particles[1].P
+        e0 = sim.calculate_energy()
+        sim.integrate(100.)
+        self.assertEqual(sim.ri_mercurius.encounter_N, 0)
+        self.assertLess(abs((sim.calculate_energy()-e0)/e0), 2e-6)
+
+    def test_close_encounter(self):
+        def setup(safe_mode):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.05)
+            sim.add(m=1e-3, a=1.2, e=0.05, f=2.)
+            sim.move_to_com()
+            sim.integrator = "mercurius"
+            sim.ri_mercurius.safe_mode = safe_mode
+            sim.dt = 0.01
+            return sim
+        for safe_mode in [1, 0]:
+            sim = setup(safe_mode)
+            e0 = sim.calculate_energy()
+            encounters = 0
+            for t in range(1,201):
+                sim.integrate(t*0.1, exact_finish_time=0)
+                encounters += sim.ri_mercurius.encounter_N
+            self.assertGreater(encounters, 0)
+            self.assertLess(abs((sim.calculate_energy()-e0)/e0), 1e-5)
+
+    def test_planetesimals(self):
+        random.seed(1)
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1., e=0.02)
+        for i in range(20):
+            sim.add(m=1e-7, a=random.uniform(1.1,1.5), e=random.uniform(0,0.1), f=random.uniform(0,6.28), inc=random.uniform(0,0.02))
+        sim.move_to_com()
+        sim.integrator = "mercurius"
+        sim.dt = 0.01
+        e0 = sim.calculate_energy()
+        sim.integrate(30.)
+        self.assertLess(abs((sim.calculate_energy()-e0)/e0), 1e-8)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -35,6 +35,110 @@ class TestSerialize(unittest.TestCase):
         with self.assertRaises(AttributeError):
             self.sim.serialize_particle_data(xyz=c)
 
+    def test_particles_soa(self):
+        soa = self.sim.particles_soa
+        self.assertEqual(soa["x"][1],1)
+        self.assertEqual(soa["m"][0],1)
+        self.sim.particles_soa_enabled = 1
+        self.sim.integrate(1.)
+        self.assertEqual(soa["x"][1],self.sim.particles[1].x)
+        self.assertEqual(soa["vy"][1],self.sim.particles[1].vy)
+        soa["m"][1] = 1e-3
+        self.sim.particles_soa_apply()
+        self.assertEqual(self.sim.particles[1].m,1e-3)
+
+    def test_particle_views(self):
+        views = self.sim.particle_views
+        self.assertEqual(views.x.shape,(2,3))
+        self.assertEqual(views.m.shape,(2,))
+        self.assertEqual(views.x[1][0],1)
+        self.assertEqual(views.m[0],1)
+        self.assertEqual(views.v[1][1],self.sim.particles[1].vy)
+        views.v[1][1] = 0.5
+        views.r[1] = 0.1
+        self.assertEqual(self.sim.particles[1].vy,0.5)
+        self.assertEqual(self.sim.particles[1].r,0.1)
+        self.sim.integrate(1.)
+        self.assertEqual(views.x[1][0],self.sim.particles[1].x)
+        self.assertEqual(views.a[1][0],self.sim.particles[1].ax)
+        self.assertTrue(views.valid)
+        for i in range(100):
+            self.sim.add(a=2.+i)
+        self.assertFalse(views.valid)
+        self.assertEqual(views.x.shape,(102,3))
+        self.assertTrue(views.valid)
+        self.assertEqual(views.x[101][0],self.sim.particles[101].x)
+
+    def test_particles_to_orbits(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(1,20):
+            sim.add(m=1e-3, a=1.+0.1*i, e=0.05*i, inc=0.1*i, Omega=0.2*i, omega=0.3*i, f=0.4*i, primary=sim.particles[0])
+        sim.add(m=0., a=-2., e=1.5, f=0.1, primary=sim.particles[0])
+        ps = sim.particles
+        data = np.array([[p.m,p.x,p.y,p.z,p.vx,p.vy,p.vz] for p in ps])
+        orbits = rebound.particles_to_orbits(data[1:], data[0], G=sim.G)
+        self.assertEqual(orbits.shape,(sim.N-1,7))
+        for i in range(1,sim.N):
+            o = ps[i].calculate_orbit(primary=ps[0])
+            self.assertEqual(orbits[i-1][0], ps[i].m)
+            for j, k in enumerate(["a","e","inc","Omega","omega","f"]):
+                self.assertAlmostEqual(orbits[i-1][j+1], getattr(o,k), delta=1e-14*(1.+abs(getattr(o,k))))
+        back = rebound.orbits_to_particles(orbits, np.tile(data[0],(sim.N-1,1)), G=sim.G)
+        self.assertLess(np.max(np.abs(back-data[1:])), 1e-10)
+        orbits[3][2] = -0.1
+        back, err = rebound.orbits_to_particles(orbits, data[0], G=sim.G, return_errors=True)
+        self.assertEqual(err[3], 2)
+        self.assertEqual(np.sum(err), 2)
+        self.assertTrue(np.isnan(back[3][1]))
+        _, err = rebound.particles_to_orbits(data, data[0], return_errors=True)
+        self.assertEqual(err[0], 2)
+        with self.assertRaises(ValueError):
+            rebound.particles_to_orbits(data[:,:6], data[0])
+        with self.assertRaises(ValueError):
+            rebound.particles_to_orbits(data, data[:2])
+
+    def test_simulationarchive_particle_data(self):
+        self.sim.integrator = "ias15"
+        self.sim.initSimulationArchive("test.bin", 1.)
+        self.sim.integrate(5.,exact_finish_time=0)
+        self.sim = None
+        sa = rebound.SimulationArchive("test.bin")
+        a = sa.getParticleData(3)
+        self.assertEqual(a.shape,(2,7))
+        with self.assertRaises(ValueError):
+            a[1][1] = 0.
+        sim = sa[3]
+        self.assertEqual(a[1][0],sim.particles[1].m)
+        self.assertEqual(a[1][1],sim.particles[1].x)
+        self.assertEqual(a[1][5],sim.particles[1].vy)
+        with self.assertRaises(IndexError):
+            sa.getParticleData(0)
+
+    def test_simulationarchive_extract(self):
+        self.sim.integrator = "whfast"
+        self.sim.dt = 0.01
+        self.sim.initSimulationArchive("test.bin", 1.)
+        self.sim.integrate(5.,exact_finish_time=0)
+        self.sim = None
+        sa = rebound.SimulationArchive("test.bin")
+        xyz = np.zeros((3,2,3))
+        t, xyz, vxvyvz, orbits = sa.extractParticles([0,2,-1], t=True, xyz=xyz, orbits=True)
+        self.assertEqual(vxvyvz,None)
+        self.assertEqual(orbits.shape,(3,1,6))
+        for i, snapshot in enumerate([0,2,-1]):
+            sim = sa[snapshot]
+            self.assertEqual(t[i],sim.t)
+            self.assertEqual(xyz[i][1][0],sim.particles[1].x)
+            self.assertEqual(xyz[i][0][2],sim.particles[0].z)
+            self.assertAlmostEqual(orbits[i][0][1],sim.particles[1].e,delta=1e-15)
+        t = sa.extractParticles(times=[2.5], t=True)[0]
+        self.assertEqual(t[0],sa.getSimulation(2.5).t)
+        with self.assertRaises(ValueError):
+            sa.extractParticles([100], t=True)
+        with self.assertRaises(AttributeError):
+            sa.extractParticles([1], xyz=np.zeros((1,1,3)))
+
     
 if __name__ == "__main__":
     unittest.main()
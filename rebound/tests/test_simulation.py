@@ -32,6 +32,20 @@ class TestSimulation(unittest.TestCase):
         with self.assertRaises(rebound.Encounter):
             self.sim.integrate(1.)
     
+    def test_encounter_testparticles(self):
+        # Pairs of test particles are not visited by the gravity routine
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(x=10.)
+        sim.add(x=10.5, vx=-1.)
+        sim.N_active = 1
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        sim.exit_min_distance = 0.01
+        with self.assertRaises(rebound.Encounter):
+            sim.integrate(1.)
+        self.assertAlmostEqual(sim.t, 0.5, delta=0.02)
+    
     def test_removeall(self):
         del self.sim.particles
         self.assertEqual(self.sim.N,0)
@@ -58,6 +72,193 @@ class TestSimulation(unittest.TestCase):
         self.sim.remove(1,keepSorted=0)
         self.assertEqual(self.sim.N,1)
     
+    def test_remove_marked(self):
+        for i in range(8):
+            self.sim.add(m=float(i+2))
+        for i in [3, 7, 3, 9]:
+            self.sim.remove_mark(i)
+        self.assertEqual(self.sim.remove_marked(), 3)
+        self.assertEqual([p.m for p in self.sim.particles[2:]], [2., 4., 5., 6., 8.])
+        self.sim.remove_mark(2)
+        self.assertEqual(self.sim.remove_marked(keepSorted=0), 1)
+        self.assertEqual([p.m for p in self.sim.particles[2:]], [8., 4., 5., 6.])
+        with self.assertRaises(RuntimeError):
+            self.sim.remove_mark(10)
+    
+    def test_reorder_particles(self):
+        def run(integrator, gravity, reorder_interval):
+            sim = rebound.Simulation()
+            sim.integrator = integrator
+            sim.gravity = gravity
+            if gravity == "tree":
+                sim.configure_box(20.)
+            sim.add(m=1., hash=0)
+            for i in range(1,40):
+                sim.add(m=1e-5, a=1.+0.1*((i*7)%40), f=0.37*i, e=0.01, hash=i)
+            sim.N_active = 30
+            sim.dt = 0.01
+            sim.reorder_interval = reorder_interval
+            sim.integrate(3.)
+            return sim
+        for integrator, gravity in [("ias15", "basic"), ("leapfrog", "tree"), ("whfasthelio", "basic")]:
+            sim0 = run(integrator, gravity, 0)
+            sim1 = run(integrator, gravity, 7)
+            self.assertEqual(sim1.reorder_interval, 7)
+            for i in range(40):
+                p0 = sim0.particles[rebound.hash(i)]
+                p1 = sim1.particles[rebound.hash(i)]
+                self.assertEqual(p0.hash.value, i)
+                self.assertEqual(p1.hash.value, i)
+                self.assertAlmostEqual(p0.x, p1.x, delta=1e-9)
+                self.assertAlmostEqual(p0.vy, p1.vy, delta=1e-9)
+            if gravity != "tree":
+                # Active particles and test particles are sorted separately
+                self.assertTrue(all(p.hash.value<30 for p in sim1.particles[:30]))
+            self.assertNotEqual([p.hash.value for p in sim1.particles], list(range(40)))
+            if integrator == "whfasthelio":
+                self.assertEqual(sim1.particles[0].hash.value, 0)
+
+    def test_reorder_particles_whfast(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=2.)
+        sim.add(m=1e-3, a=1.)
+        sim.integrator = "whfast"
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            self.assertFalse(sim.reorder_particles())
+            self.assertEqual(len(w), 1)
+        self.assertEqual(sim.particles[1].a, 2.)
+
+    def test_memory_policy(self):
+        def run(memory_policy, integrator):
+            sim = rebound.Simulation()
+            sim.memory_policy = memory_policy
+            sim.integrator = integrator
+            sim.add(m=1.)
+            for i in range(200):
+                sim.add(m=1e-7, a=1.+0.01*i, f=0.1*i)
+            sim.integrate(1.)
+            return [(p.x, p.vy) for p in sim.particles]
+        for integrator in ["ias15", "whfast", "leapfrog"]:
+            self.assertEqual(run(0, integrator), run(7, integrator))
+
+    def test_reproducible(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        for i in range(50):
+            sim.add(m=1e-5, a=1.+0.1*i, f=0.3*i)
+        e0 = sim.calculate_energy()
+        L0 = sim.calculate_angular_momentum()
+        sim.reproducible = 1
+        self.assertAlmostEqual(sim.calculate_energy(), e0, delta=1e-15)
+        for a, b in zip(sim.calculate_angular_momentum(), L0):
+            self.assertAlmostEqual(a, b, delta=1e-15)
+        sim.save("test.bin")
+        sim2 = rebound.Simulation.from_file("test.bin")
+        self.assertEqual(sim2.reproducible, 1)
+
+    def test_integrate_async(self):
+        import time
+        def setup():
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.1)
+            sim.add(m=1e-3, a=2., f=1.)
+            sim.integrator = "whfast"
+            sim.dt = 0.01
+            return sim
+        sim = setup()
+        handle = sim.integrate_async(10.)
+        handle.request_snapshot()
+        snapshot = None
+        while handle.poll() is None:
+            if snapshot is None:
+                snapshot = handle.snapshot()
+            time.sleep(0.001)
+        if snapshot is not None:
+            self.assertLessEqual(snapshot.t, 10.)
+            self.assertEqual(snapshot.N, 3)
+        self.assertEqual(handle.wait(), 0)
+        self.assertEqual(handle.steps, 1000)
+        with self.assertRaises(RuntimeError):
+            handle.snapshot()
+        sim2 = setup()
+        sim2.integrate(10.)
+        self.assertEqual(sim.t, sim2.t)
+        self.assertEqual(sim.particles[2].xyz, sim2.particles[2].xyz)
+
+        sim = setup()
+        handle = sim.integrate_async(float("inf"))
+        handle.cancel()
+        self.assertEqual(handle.wait(), 5)
+
+    def test_integrate_samples(self):
+        from ctypes import c_double
+        def setup(integrator):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.1)
+            sim.add(m=1e-3, a=2., f=1.)
+            sim.integrator = integrator
+            sim.dt = 0.01
+            return sim
+        n = 50
+        times = [0.37*k for k in range(n)]
+        for integrator in ["ias15", "whfast"]:
+            sim = setup(integrator)
+            t = (c_double*n)()
+            xyz = (c_double*(n*3*3))()
+            orbits = (c_double*(n*2*6))()
+            energy = (c_double*n)()
+            self.assertEqual(sim.integrate_samples(times, t=t, xyz=xyz, orbits=orbits, energy=energy), n)
+            sim2 = setup(integrator)
+            for k in range(n):
+                sim2.integrate(times[k])
+                self.assertEqual(t[k], sim2.t)
+                self.assertEqual(xyz[k*9+7], sim2.particles[2].y)
+                o = sim2.particles[2].calculate_orbit()
+                self.assertAlmostEqual(orbits[k*12+6], o.a, delta=1e-12)
+                self.assertAlmostEqual(orbits[k*12+11], o.f, delta=1e-12)
+                self.assertEqual(energy[k], sim2.calculate_energy())
+            self.assertEqual(sim.dt, sim2.dt)
+        
+        sim = setup("whfast")
+        with self.assertRaises(AttributeError):
+            sim.integrate_samples(times, xyz=(c_double*10)())
+        with self.assertRaises(RuntimeError):
+            sim.integrate_samples([1.,0.5])
+        sim.exit_max_distance = 1.5
+        t = (c_double*n)()
+        with self.assertRaises(rebound.Escape):
+            sim.integrate_samples(times, t=t)
+        self.assertEqual(t[0], 0.)
+        self.assertEqual(t[n-1], 0.)
+
+    def test_rng_bulk_generators(self):
+        from ctypes import byref, c_int, c_double
+        def run(seed):
+            sim = rebound.Simulation()
+            sim.rand_seed = seed
+            rebound.clibrebound.reb_tools_add_plummer(byref(sim), c_int(100), c_double(1.), c_double(1.))
+            primary = rebound.Particle(m=1.)
+            rebound.clibrebound.reb_tools_add_disc(byref(sim), c_int(100), primary, c_double(1e-9), c_double(1.), c_double(2.), c_double(-1.5), c_double(0.01), c_double(0.01))
+            return sim
+        sim = run(42)
+        self.assertEqual(sim.N, 200)
+        self.assertAlmostEqual(sum(p.m for p in sim.particles[:100]), 1., delta=1e-14)
+        for p in sim.particles[100:]:
+            o = p.calculate_orbit(primary=rebound.Particle(m=1.))
+            self.assertGreaterEqual(o.a, 1.-1e-12)
+            self.assertLessEqual(o.a, 2.+1e-12)
+        xyz = [p.xyz for p in sim.particles]
+        self.assertEqual(xyz, [p.xyz for p in run(42).particles])
+        self.assertNotEqual(xyz, [p.xyz for p in run(43).particles])
+        sim.save("test.bin")
+        sim2 = rebound.Simulation.from_file("test.bin")
+        self.assertEqual(sim2.rand_seed, 42)
+        self.assertEqual(sim2._rand_streams, 200)
+
     def test_removehash(self):
         self.sim.add(m=1e-3, a=1., e=0.01, omega=0.02, M=0.04, inc=0.1)
         self.sim.particles[-1].hash = 99
@@ -79,6 +280,28 @@ class TestSimulation(unittest.TestCase):
             self.assertAlmostEqual(self.sim.particles[i].x,sim.particles[i].x,delta=1e-7)
             self.assertAlmostEqual(self.sim.particles[i].vy,sim.particles[i].vy,delta=1e-7)
     
+    def test_add_many(self):
+        sim = rebound.Simulation()
+        sim.configure_box(10.)
+        sim.gravity = "tree"
+        sim.add([rebound.Particle(m=1e-3, x=-4.+0.008*i, y=0.001*i, r=0.01*i, hash=i) for i in range(1000)])
+        self.assertEqual(sim.N, 1000)
+        self.assertEqual(sim.particles[700].hash.value, 700)
+        self.assertAlmostEqual(sim.particles[700].x, 1.6, delta=1e-14)
+        self.assertAlmostEqual(sim.max_radius[0], 9.99, delta=1e-14)
+        sim.step()
+        self.assertEqual(sim.N, 1000)
+
+    def test_add_particles_file(self):
+        with open("ic.csv", "w") as f:
+            f.write("1.,0.1,1.,2.,3.,4.,5.,6.\n2., 0.2, 1., 2., 4., 4., 5., 7.\n")
+        sim = rebound.Simulation()
+        sim.add_particles_file("ic.csv")
+        self.assertEqual(sim.N, 2)
+        self.assertEqual(sim.particles[1].m, 2.)
+        self.assertEqual(sim.particles[1].vz, 7.)
+        os.remove("ic.csv")
+
     def test_configure_ghostboxes(self):
         self.sim.configure_ghostboxes(1,1,1)
    
@@ -148,6 +371,26 @@ class TestSimulation(unittest.TestCase):
         energy = self.sim.calculate_energy()
         self.assertAlmostEqual(energy, -0.5e-3, delta=1e-14)
 
+    def test_calculate_energy_testparticles(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.N_active = 2
+        for i in range(100):
+            sim.add(m=1e-9, a=2.+0.01*i, f=0.1*i)
+        e0 = sim.calculate_energy()
+        sim.testparticle_type = 1
+        e1 = 0.
+        ps = sim.particles
+        for i in range(sim.N):
+            e1 += 0.5*ps[i].m*(ps[i].vx**2+ps[i].vy**2+ps[i].vz**2)
+            if i<2:
+                for j in range(i+1,sim.N):
+                    dx, dy, dz = ps[i].x-ps[j].x, ps[i].y-ps[j].y, ps[i].z-ps[j].z
+                    e1 -= ps[i].m*ps[j].m/math.sqrt(dx*dx+dy*dy+dz*dz)
+        self.assertAlmostEqual(sim.calculate_energy(), e1, delta=1e-15)
+        self.assertNotEqual(e0, e1)
+
     def test_calculate_angular_momentum(self):
         sim = rebound.Simulation()
         sim.add(m=1.)
@@ -247,6 +490,314 @@ class TestSimulation(unittest.TestCase):
         self.assertEqual(self.sim.N, sim2.N)
         self.assertEqual(self.sim.integrator, sim2.integrator)
         os.remove("bintest.bin")
+
+    def test_copy(self):
+        self.sim.integrate(1.5)
+        sim2 = self.sim.copy()
+        self.sim.integrate(5.)
+        sim2.integrate(5.)
+        self.assertEqual(self.sim.particles[1].x, sim2.particles[1].x)
+        self.assertEqual(self.sim.particles[1].vx, sim2.particles[1].vx)
+        self.assertEqual(self.sim.t, sim2.t)
+        sim2.particles[1].x += 1.
+        self.assertNotEqual(self.sim.particles[1].x, sim2.particles[1].x)
+    
+    def test_copy_whfast(self):
+        self.sim.integrator = "whfast"
+        self.sim.ri_whfast.safe_mode = 0
+        self.sim.add_variation()
+        self.sim.dt = 0.01
+        self.sim.integrate(1.5)
+        sim2 = self.sim.copy()
+        self.sim.integrate(5.)
+        sim2.integrate(5.)
+        for i in range(self.sim.N):
+            self.assertEqual(self.sim.particles[i].x, sim2.particles[i].x)
+            self.assertEqual(self.sim.particles[i].vy, sim2.particles[i].vy)
+    
+    def test_copy_mercurius(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(m=1e-3, a=1.)
+        sim.add(m=1e-3, a=1.1, f=0.3)   # Close encounters
+        sim.add(m=1e-5, a=1.6, e=0.1)
+        sim.move_to_com()
+        sim.integrator = "mercurius"
+        sim.ri_mercurius.safe_mode = 0
+        sim.dt = 0.01
+        sim.integrate(2.)
+        sim2 = sim.copy()
+        sim.integrate(10.)
+        sim2.integrate(10.)
+        for i in range(sim.N):
+            self.assertEqual(sim.particles[i].x, sim2.particles[i].x)
+            self.assertEqual(sim.particles[i].vy, sim2.particles[i].vy)
+    
+    def test_copy_ias15_block(self):
+        self.sim.add(primary=self.sim.particles[1], m=1e-8, a=0.002)
+        self.sim.add(m=1e-5, a=2.3, f=1.)
+        self.sim.ri_ias15.block_levels = 10
+        self.sim.integrate(1.5)
+        sim2 = self.sim.copy()
+        self.sim.integrate(5.)
+        sim2.integrate(5.)
+        for i in range(self.sim.N):
+            self.assertEqual(self.sim.particles[i].x, sim2.particles[i].x)
+            self.assertEqual(self.sim.particles[i].vy, sim2.particles[i].vy)
+    
+    def test_output_stream(self):
+        batches = []
+        def callback(b):
+            batches.append((b.t, b.N, b.x[1], b.e[1]))
+        self.sim.add_output_stream(callback, capacity=2, orbits=True)
+        expected = []
+        for i in range(10):
+            self.sim.integrate(self.sim.t+0.1)
+            self.sim.output_stream_push()
+            expected.append((self.sim.t, self.sim.particles[1].x, self.sim.particles[1].e))
+        self.sim.output_stream_flush()
+        self.assertEqual(len(batches), 10)
+        for b, e in zip(batches, expected):
+            self.assertEqual(b[0], e[0])
+            self.assertEqual(b[1], 2)
+            self.assertEqual(b[2], e[1])
+            self.assertAlmostEqual(b[3], e[2], delta=1e-14)
+
+    def test_output_shm(self):
+        import os
+        name = "/rebound_test_%d" % os.getpid()
+        self.sim.integrator = "leapfrog"
+        self.sim.dt = 0.01
+        self.sim.output_shm_open(name, interval=0.1, energy=True)
+        view = rebound.SharedMemoryView(name)
+        self.assertEqual(view.N_max, 2)
+        self.assertEqual(view.snapshots, 1)
+        s = view.snapshot()
+        self.assertEqual(s.t, self.sim.t)
+        self.assertEqual(s.N, 2)
+        self.assertEqual(s.x[1], self.sim.particles[1].x)
+        tmax = self.sim.t+1.
+        self.sim.integrate(tmax)
+        s = view.snapshot()
+        self.assertAlmostEqual(s.t, tmax, delta=0.1)
+        self.assertGreater(s.steps, 90)
+        self.assertGreater(s.snapshots, 5)
+        self.assertLess(s.snapshots, 15)
+        self.sim.output_shm_publish()
+        s = view.snapshot()
+        self.assertEqual(s.t, self.sim.t)
+        self.assertEqual(s.vy[1], self.sim.particles[1].vy)
+        self.assertEqual(s.hash[1], self.sim.particles[1].hash.value)
+        self.assertAlmostEqual(s.energy, self.sim.calculate_energy(), delta=1e-14)
+        self.sim.output_shm_close()
+        with self.assertRaises(RuntimeError):
+            rebound.SharedMemoryView(name)
+        # The last snapshot stays readable while attached
+        self.assertEqual(view.snapshot().t, self.sim.t)
+        view.detach()
+
+    def test_metrics(self):
+        import math
+        sim = self.sim
+        sim.integrator = "leapfrog"
+        sim.dt = 0.01
+        m = sim.get_metrics()
+        self.assertEqual(m.steps, 0)
+        self.assertTrue(math.isnan(m.energy_drift))
+        sim.get_metrics(energy=True)
+        sim.integrate(sim.t+1., exact_finish_time=0)
+        m = sim.get_metrics(energy=True)
+        self.assertAlmostEqual(m.steps, 100, delta=1)
+        self.assertEqual(m.interactions, 2*m.steps)
+        self.assertGreater(m.walltime, 0.)
+        self.assertGreater(m.steps_per_second, 0.)
+        self.assertGreater(m.energy_drift, 0.)
+        self.assertLess(m.energy_drift, 1e-3)
+        text = sim.output_metrics()
+        self.assertIn("rebound_steps_total %d\n" % m.steps, text)
+        self.assertIn("# TYPE rebound_energy_drift gauge\n", text)
+        self.assertTrue(text.endswith("# EOF\n"))
+        sim.reset_metrics()
+        self.assertEqual(sim.get_metrics().steps, 0)
+        sim.integrator = "ias15"
+        sim.integrate(sim.t+1.)
+        m = sim.get_metrics()
+        self.assertGreater(m.ias15_iterations, m.steps)
+
+        sim = rebound.Simulation()
+        sim.configure_box(10.)
+        sim.gravity = "tree"
+        sim.collision = "direct"
+        sim.add(m=1., r=0.1, x=-0.15, vx=1.)
+        sim.add(m=1., r=0.1, x=0.15, vx=-1.)
+        sim.add(m=1., r=0.1, y=3.)
+        sim.dt = 0.01
+        sim.integrate(0.1)
+        m = sim.get_metrics()
+        self.assertGreater(m.collisions_found, 0)
+        self.assertEqual(m.collisions_resolved, m.collisions_found)
+        self.assertGreater(m.interactions, 0)
+        self.assertGreater(m.cells_opened, 0)
+
+    def test_heartbeat_interval(self):
+        self.sim.integrator = "leapfrog"
+        self.sim.dt = 0.01
+        times = []
+        def heartbeat(sim):
+            times.append(sim.contents.t)
+        self.sim.heartbeat = heartbeat
+        self.sim.heartbeat_interval = 10
+        self.sim.integrate(self.sim.t+0.995,exact_finish_time=0)
+        self.assertEqual(len(times), 11)
+        self.assertEqual(times[0], 1.246)
+        self.assertAlmostEqual(times[1], 1.346, delta=1e-12)
+        self.assertAlmostEqual(times[10], 2.246, delta=1e-12)
+
+    def test_integrate_threads(self):
+        import threading
+        def setup(i):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1.+0.1*i, e=0.1)
+            sim.add(m=1e-3, a=2., e=0.1)
+            return sim
+        sims = [setup(i) for i in range(4)]
+        threads = [threading.Thread(target=sim.integrate, args=(100.,)) for sim in sims]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for i, sim in enumerate(sims):
+            sim2 = setup(i)
+            sim2.integrate(100.)
+            self.assertEqual(sim.t, sim2.t)
+            self.assertEqual(sim.particles[1].x, sim2.particles[1].x)
+            self.assertEqual(sim.particles[2].vy, sim2.particles[2].vy)
+
+    def test_force_drag(self):
+        sim = rebound.Simulation()
+        sim.gravity = "none"
+        sim.add(m=0., x=1., vx=-1.)
+        sim.add_force("drag", gamma=0.5)
+        self.assertEqual(sim.force_is_velocity_dependent, 1)
+        sim.integrate(2.)
+        self.assertAlmostEqual(sim.particles[0].vx, -math.exp(-1.), delta=1e-12)
+        self.assertAlmostEqual(sim.particles[0].x, 1.-2.*(1.-math.exp(-1.)), delta=1e-12)
+        with self.assertRaises(RuntimeError):
+            sim.add_force("magic")
+        with self.assertRaises(RuntimeError):
+            sim.add_force("drag", alpha=1.)
+
+    def test_force_j2(self):
+        J2, R = 16298e-6, 0.00038925688
+        def setup():
+            sim = rebound.Simulation()
+            sim.add(m=0.00028588598)
+            sim.add(primary=sim.particles[0], a=3.*R, e=0.1, inc=0.3)
+            sim.move_to_com()
+            return sim
+        def force_J2(simp):
+            sim = simp.contents
+            ps = sim.particles
+            planet = ps[0]
+            for p in ps[1:]:
+                prx, pry, prz = p.x-planet.x, p.y-planet.y, p.z-planet.z
+                pr2 = prx*prx + pry*pry + prz*prz
+                fac = 3.*sim.G*J2*planet.m*R*R/2./math.pow(pr2,3.5)
+                p.ax += fac*prx*(prx*prx + pry*pry - 4.*prz*prz)
+                p.ay += fac*pry*(prx*prx + pry*pry - 4.*prz*prz)
+                p.az += fac*prz*(3.*(prx*prx + pry*pry) - 2.*prz*prz)
+        sim1 = setup()
+        sim1.add_force("j2", J2=J2, R=R)
+        self.assertEqual(sim1.force_is_velocity_dependent, 0)
+        sim1.integrate(0.1)
+        sim2 = setup()
+        sim2.additional_forces = force_J2
+        sim2.integrate(0.1)
+        o1 = sim1.particles[1].calculate_orbit(primary=sim1.particles[0])
+        o2 = sim2.particles[1].calculate_orbit(primary=sim2.particles[0])
+        self.assertAlmostEqual(o1.omega, o2.omega, delta=1e-10)
+        self.assertAlmostEqual(o1.Omega, o2.Omega, delta=1e-10)
+        o0 = setup().particles[1].calculate_orbit()
+        self.assertGreater(abs(o1.Omega-o0.Omega), 1e-3)
+
+    def test_force_save(self):
+        self.sim.add_force("gr", c=100.)
+        self.sim.add_force("prdrag", beta=0.1, primary=0)
+        self.sim.save("test.bin")
+        sim2 = rebound.Simulation.from_file("test.bin")
+        self.sim.integrate(self.sim.t+10.)
+        sim2.integrate(sim2.t+10.)
+        self.assertEqual(self.sim.particles[1].x, sim2.particles[1].x)
+        sim3 = rebound.Simulation.from_file("test.bin")
+        sim3.remove_forces()
+        sim3.integrate(sim3.t+10.)
+        self.assertNotEqual(self.sim.particles[1].x, sim3.particles[1].x)
+
+    def test_profiling(self):
+        with self.assertRaises(RuntimeError):
+            self.sim.get_profiling()
+        self.sim.enable_profiling()
+        self.sim.integrate(10.)
+        wall, regions = self.sim.get_profiling()
+        self.assertGreater(regions["integrator"]["calls"], 0)
+        self.assertGreater(regions["force"]["calls"], 0)
+        self.assertEqual(regions["force"]["parent"], "gravity")
+        self.assertEqual(regions["tree"]["calls"], 0)
+        self.assertEqual(regions["kepler"]["calls"], 0)
+        self.assertGreater(regions["ias15_predictor"]["calls"], 0)
+        self.assertEqual(regions["ias15_predictor"]["parent"], "integrator")
+        # IAS15 calculates forces within the integrator region. Self times are never counted twice.
+        self.assertLessEqual(sum(r["time_self"] for r in regions.values()), wall)
+        self.assertLessEqual(regions["force"]["time"], regions["gravity"]["time"])
+        self.assertLessEqual(regions["gravity"]["time_self"], regions["gravity"]["time"])
+        self.sim.reset_profiling()
+        wall, regions = self.sim.get_profiling(thread=0)
+        self.assertEqual(regions["integrator"]["calls"], 0)
+        self.sim.disable_profiling()
+
+    def test_trace(self):
+        import json
+        with self.assertRaises(RuntimeError):
+            self.sim.save_trace("trace.json")
+        self.sim.enable_trace(capacity=50)
+        self.sim.integrate(100.)
+        self.sim.save_trace("trace.json")
+        with open("trace.json") as f:
+            events = json.load(f)["traceEvents"]
+        os.remove("trace.json")
+        steps = [e for e in events if e["name"]=="step"]
+        self.assertEqual(len(steps), 50)
+        self.assertEqual(steps[-1]["args"]["t"], self.sim.t)
+        self.assertEqual(steps[-1]["args"]["dt"], self.sim.dt_last_done)
+        self.assertGreater(steps[-1]["args"]["ias15_iterations"], 0)
+        regions = [e for e in events if e["ph"]=="X" and e["name"]!="step"]
+        self.assertEqual(len(regions), 50)
+        for e in regions:
+            self.assertGreaterEqual(e["dur"], 0.)
+        counters = set(e["name"] for e in events if e["ph"]=="C")
+        self.assertIn("dt", counters)
+        self.assertIn("collisions", counters)
+
+    def test_checkpoint_particle_columns(self):
+        self.sim.add(m=1e-3, a=2., e=0.1)
+        self.sim.particles[1].r = 0.1
+        self.sim.particles[1].lastcollision = 0.5
+        self.sim.particles[2].hash = "planet"
+        self.sim.integrator = "whfast"
+        self.sim.ri_whfast.safe_mode = 0
+        self.sim.dt = 0.01
+        self.sim.integrate(1.)
+        self.sim.save("bintest.bin")
+        self.sim.integrate(5.)
+        sim2 = rebound.Simulation.from_file("bintest.bin")
+        self.assertEqual(sim2.particles[1].r, 0.1)
+        self.assertEqual(sim2.particles[1].lastcollision, 0.5)
+        self.assertEqual(sim2.particles["planet"].hash.value, self.sim.particles[2].hash.value)
+        sim2.integrate(5.)
+        self.assertEqual(self.sim.particles[1].x, sim2.particles[1].x)
+        self.assertEqual(self.sim.particles[2].vy, sim2.particles[2].vy)
+        os.remove("bintest.bin")
     
 class TestSimulationCollisions(unittest.TestCase):
     def setUp(self):
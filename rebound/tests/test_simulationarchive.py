@@ -1,5 +1,6 @@
 import rebound
 import unittest
+import os
 import warnings
 
 class TestSimulationArchive(unittest.TestCase):
@@ -316,6 +317,209 @@ class TestSimulationArchive(unittest.TestCase):
         self.assertAlmostEqual(sim.t,tget,delta=sim.dt)
 
 class TestSimulationArchiveEstimates(unittest.TestCase):
+    def test_sa_reinit_fsync(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.integrator = "whfast"
+        sim.dt = 0.1313
+        sim.initSimulationArchive("test.bin", 10.)
+        sim.integrate(100.,exact_finish_time=0)
+        # Reinitializing the archive starts a new file even though the old one is still open.
+        sim.initSimulationArchive("test.bin", 10., fsync_interval=3)
+        sim.integrate(140.,exact_finish_time=0)
+        x0 = sim.particles[1].x
+        t0 = sim.t
+        sa = rebound.SimulationArchive("test.bin")
+        self.assertEqual(len(sa), 5)
+        self.assertEqual(sa[0].simulationarchive_fsync_interval, 3)
+        sim = sa[-1]
+        sim.integrate(t0,exact_finish_time=0)
+        self.assertEqual(x0,sim.particles[1].x)
+
+    def test_sa_async(self):
+        x = []
+        for async_ in [0, 1]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=-2,e=1.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.integrator = "ias15"
+            sim.dt = 0.1313
+            sim.initSimulationArchive("test.bin", 10.)
+            sim.simulationarchive_async = async_
+            sim.integrate(100.,exact_finish_time=0)
+            sim = None # flushes remaining snapshots
+            sa = rebound.SimulationArchive("test.bin")
+            x.append([(s.t, s.particles[1].x, s.particles[2].vy) for s in sa])
+        self.assertEqual(len(x[0]), 11)
+        self.assertEqual(x[0], x[1])
+
+    @unittest.skipIf(rebound.__zlib__, "compiled with zlib")
+    def test_sa_compression_without_zlib(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1)
+        sim.initSimulationArchive("test.bin", 10., compression=1)
+        with self.assertRaises(rebound.SimulationError):
+            sim.integrate(100.,exact_finish_time=0)
+        with self.assertRaisesRegex(RuntimeError, "zlib"):
+            sim.process_messages()
+
+    @unittest.skipUnless(rebound.__zlib__, "requires zlib (ZLIB=1)")
+    def test_sa_compression(self):
+        x = []
+        for compression in [0, 1]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=-2,e=1.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.integrator = "ias15"
+            sim.dt = 0.1313
+            sim.initSimulationArchive("test.bin", 10., compression=compression)
+            sim.integrate(100.,exact_finish_time=0)
+            sim = None
+            sa = rebound.SimulationArchive("test.bin")
+            self.assertEqual(sa.tmax, 100.)
+            sim = sa.getSimulation(55., mode="exact")
+            x.append([(s.t, s.particles[1].x, s.particles[2].vy) for s in sa] + [sim.particles[1].x])
+            # Restart from the latest (compressed) snapshot
+            sim = rebound.Simulation.from_archive("test.bin")
+            sim.integrate(120.,exact_finish_time=0)
+            x[-1].append(sim.particles[2].x)
+        self.assertEqual(len(x[0]), 13)
+        self.assertEqual(x[0], x[1])
+
+    @unittest.skipUnless(rebound.__zlib__, "requires zlib (ZLIB=1)")
+    def test_sa_keyframes(self):
+        x = []
+        sizes = []
+        for keyframe_interval in [0, 4]:
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            for i in range(50):
+                sim.add(a=10.+0.1*i, e=0.01, f=0.2*i)
+            sim.N_active = 2
+            sim.integrator = "whfast"
+            sim.dt = 0.01
+            sim.initSimulationArchive("test.bin", 0.1, compression=1, keyframe_interval=keyframe_interval)
+            sim.integrate(3.,exact_finish_time=0)
+            sim = None
+            sizes.append(os.path.getsize("test.bin"))
+            sa = rebound.SimulationArchive("test.bin")
+            # Random access and access in order
+            x.append([sa[i].particles[20].x for i in [17, 3, 11, 12, 30, 29]])
+            x[-1] += [s.particles[30].vy for s in sa]
+        self.assertEqual(len(x[0]), 37)
+        self.assertEqual(x[0], x[1])
+        self.assertLess(sizes[1], sizes[0])
+
+    def test_sa_container(self):
+        def setup(k):
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1+0.1*k,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=2,e=0.1)
+            sim.integrator = "whfast"
+            sim.dt = 0.1313
+            return sim
+        x = []
+        for kwargs in [{}, {"compression":1, "keyframe_interval":3}] if rebound.__zlib__ else [{}]:
+            if os.path.isfile("test.bin"):
+                os.remove("test.bin")
+            sims = [setup(k) for k in range(4)]
+            for k, sim in enumerate(sims):
+                sim.initSimulationArchive("test.bin", 10., member=k, **kwargs)
+            sims[3].simulationarchive_async = 1
+            # The records of all members are interleaved.
+            for t in range(10, 101, 10):
+                for sim in sims:
+                    sim.integrate(t, exact_finish_time=0)
+            sims = None
+            sim = setup(2)
+            sim.initSimulationArchive("test2.bin", 10., **kwargs)
+            sim.integrate(100., exact_finish_time=0)
+            sim = None
+
+            sac = rebound.SimulationArchiveContainer("test.bin")
+            self.assertEqual(list(sac), [0, 1, 2, 3])
+            self.assertFalse(4 in sac)
+            with self.assertRaises(KeyError):
+                sac.getSimulation(4)
+            sa = sac[2]
+            sa2 = rebound.SimulationArchive("test2.bin")
+            self.assertEqual(len(sa), 11)
+            self.assertEqual([(s.t, s.particles[1].x) for s in sa], [(s.t, s.particles[1].x) for s in sa2])
+            sim = sa.getSimulation(55., mode="exact")
+            # Random access by member and snapshot
+            sim1 = sac.getSimulation(3, 6)
+            sim1.integrator_synchronize()
+            sim2 = sac.getSimulation(0, -1)
+            x.append([sim.particles[1].x, sim1.t, sim1.particles[1].x, sim2.t, sim2.particles[2].vy, sac[1][4].particles[1].vx])
+        self.assertEqual(x[0], x[-1])
+        self.assertAlmostEqual(x[0][1], 60., delta=0.2)
+
+    def test_sa_tree_collisions(self):
+        # Without collisions, the tree is out of date at the end of a timestep.
+        for integrator, boundary, collision in [("leapfrog", "periodic", "tree"), ("sei", "shear", "tree"), ("leapfrog", "periodic", "none")]:
+            sims = []
+            for archive in [0, 1]:
+                sim = rebound.Simulation()
+                sim.configure_box(4.,2,2,1)
+                sim.integrator = integrator
+                sim.boundary = boundary
+                sim.gravity = "tree"
+                sim.collision = collision
+                sim.ri_sei.OMEGA = 1.
+                sim.nghostx = 1
+                sim.nghosty = 1
+                sim.opening_angle2 = 0.25
+                sim.softening = 0.02
+                sim.dt = 0.01
+                for i in range(200):
+                    px, py, pz = (i*0.137)%4.-2., (i*0.291)%2.-1., (i*0.071)%0.2-0.1
+                    sim.add(m=1e-3, r=0.05, x=px, y=py, z=pz, vx=(i*0.113)%1.-0.5, hash=i)
+                sim.move_to_com() # The tree is out of date at the first output.
+                sim.collisions_seed = 1
+                if archive:
+                    sim.initSimulationArchive("test.bin", 0.3)
+                sim.integrate(1.)
+                sims.append(sim)
+            sa = rebound.SimulationArchive("test.bin")
+            sims.append(sa[0])
+            sims.append(sa[-1])
+            self.assertAlmostEqual(sims[3].t, 0.9, delta=1e-12)
+            sims[2].integrate(1.)
+            sims[3].integrate(1.)
+            sim = sims[0]
+            if collision=="tree":
+                self.assertGreater(sim.collisions_Nlog, 0)
+            # The archive does not change the trajectory and restarts are exact.
+            for sim2 in sims[1:]:
+                self.assertEqual(sim.collisions_Nlog, sim2.collisions_Nlog)
+                self.assertEqual(sim.collisions_plog, sim2.collisions_plog)
+                for i in range(sim.N):
+                    self.assertEqual(sim.particles[i].hash.value, sim2.particles[i].hash.value)
+                    self.assertEqual(sim.particles[i].x, sim2.particles[i].x)
+                    self.assertEqual(sim.particles[i].vy, sim2.particles[i].vy)
+    
+    def test_sa_megno(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.add(m=1e-3,a=1.6,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        sim.init_megno()
+        sim.initSimulationArchive("test.bin", 1.)
+        sim.integrate(20.)
+        sim2 = rebound.SimulationArchive("test.bin")[10]
+        sim2.integrate(20.)
+        self.assertEqual(sim.calculate_megno(), sim2.calculate_megno())
+        self.assertEqual(sim.calculate_lyapunov(), sim2.calculate_lyapunov())
+        self.assertEqual(sim.particles[5].x, sim2.particles[5].x)
+
     def test_sa_esimatesize(self):
         sim = rebound.Simulation()
         sim.add(m=1)
@@ -383,6 +587,52 @@ class TestSimulationArchiveTmin(unittest.TestCase):
         self.assertEqual(tmin,sa.tmin)
         self.assertNotEqual(tmin,sa.tmax)
     
+    def test_sa_ias15_dense_output(self):
+        def setup():
+            sim = rebound.Simulation()
+            sim.add(m=1)
+            sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+            sim.add(m=1e-3,a=1.6,e=0.05,omega=0.3,M=1.,inc=0.05,Omega=0.2)
+            sim.move_to_com()
+            return sim
+        sim = setup()
+        sim.initSimulationArchive("test.bin", interval = 1.)
+        sim.integrate(20.,exact_finish_time=0)
+        sa = rebound.SimulationArchive("test.bin")
+        for t in [5.3, 5.31, 12.7]:
+            sim1 = sa.getSimulation(t, mode="exact")
+            self.assertEqual(sim1.t, t)
+            sim2 = setup()
+            sim2.integrate(t)
+            for p1, p2 in zip(sim1.particles, sim2.particles):
+                for a, b in zip(p1.xyz+p1.vxyz, p2.xyz+p2.vxyz):
+                    self.assertAlmostEqual(a, b, delta=1e-12)
+        # Requests within the last step are evaluated without integrating
+        tstep = sa.simp.contents.t
+        sim1 = sa.getSimulation(12.7+1e-4, mode="exact")
+        self.assertEqual(tstep, sa.simp.contents.t)
+    
+    def test_sa_cache(self):
+        sim = rebound.Simulation()
+        sim.add(m=1)
+        sim.add(m=1e-3,a=1,e=0.1,omega=0.1,M=0.1,inc=0.1,Omega=0.1)
+        sim.add(m=1e-3,a=1.6,e=0.05,omega=0.3,M=1.,inc=0.05,Omega=0.2)
+        sim.integrator = "whfast"
+        sim.dt = 0.01
+        sim.initSimulationArchive("test.bin", interval = 10.)
+        sim.integrate(100.,exact_finish_time=0)
+        sa1 = rebound.SimulationArchive("test.bin", cache_size=1)
+        sa4 = rebound.SimulationArchive("test.bin", cache_size=4)
+        for t in [15.,55.,16.,56.,17.,57.]:
+            sim1 = sa1.getSimulation(t, mode="close")
+            sim4 = sa4.getSimulation(t, mode="close")
+            self.assertEqual(sim1.t, sim4.t)
+            self.assertEqual(sim1.particles[2].xyz, sim4.particles[2].xyz)
+        self.assertEqual(len(sa4._cache), 2)
+        # Loading a snapshot overwrites the first cached simulation
+        sa4[3]
+        self.assertEqual(len(sa4._cache), 1)
+    
 
 if __name__ == "__main__":
     unittest.main()
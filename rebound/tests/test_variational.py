@@ -42,6 +42,87 @@ class TestVariational(unittest.TestCase):
                 self.assertLess(abs(dp.vy),prec)
                 self.assertLess(abs(dp.vz),prec)
                 self.assertLess(abs(dp.m ),prec)
+
+    def test_tree(self):
+        def simulation(gravity, opening_angle2, multipole_order, leaf_size, softening=0.01):
+            sim = rebound.Simulation()
+            sim.configure_box(4.)
+            sim.gravity = gravity
+            sim.integrator = "leapfrog"
+            sim.opening_angle2 = opening_angle2
+            sim.multipole_order = multipole_order
+            sim.tree_flatten = 1
+            sim.tree_leaf_size = leaf_size
+            sim.softening = softening
+            sim.dt = 1e-3
+            for i in range(200):
+                px, py, pz = (i*0.137)%2.-1., (i*0.291)%2.-1., (i*0.071)%1.-0.5
+                sim.add(m=1e-3*(1.+(i%3)), x=px, y=py, z=pz, vx=0.1*pz, vy=-0.1*px)
+            var = sim.add_variation()
+            for i in range(sim.N_real):
+                var.particles[i].x = 1e-3*((i*0.173)%1.-0.5)
+                var.particles[i].vy = 1e-3*((i*0.311)%1.-0.5)
+                var.particles[i].m = 1e-5*(i%2)
+            var_tp = sim.add_variation(testparticle=7)
+            var_tp.particles[0].z = 1e-3
+            sim.integrate(0.05)
+            return [(var.particles[i].vx, var.particles[i].vy, var.particles[i].vz) for i in range(sim.N_real)] + [(var_tp.particles[0].vx, var_tp.particles[0].vy, var_tp.particles[0].vz)]
+        # All cells are opened for small opening angles.
+        exact = simulation("tree", 1e-8, 0, 1, softening=0.)
+        basic = simulation("basic", 0., 0, 1, softening=0.)
+        for a, b in zip(exact, basic):
+            for c, d in zip(a, b):
+                self.assertAlmostEqual(c, d, delta=1e-12)
+        ref = simulation("tree", 1e-8, 0, 1)
+        for opening_angle2, multipole_order, leaf_size, prec in [(0.25, 0, 1, 2e-2), (0.25, 2, 1, 2e-2), (0.25, 2, 16, 2e-2), (0.1, 2, 1, 5e-3)]:
+            v = simulation("tree", opening_angle2, multipole_order, leaf_size)
+            scale = max(abs(c) for a in ref for c in a)
+            error = max(abs(c-d) for a, b in zip(ref, v) for c, d in zip(a, b))
+            self.assertLess(error, prec*scale)
+            self.assertGreater(error, 0.)
+
+    def test_calculate_derivatives(self):
+        elements = {"pal": ["m","a","k","h","lambda","ix","iy"], "orbit": ["m","a","e","inc","omega","Omega","f"]}
+        for params in self.paramlist:
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(**dict(zip(self.paramkeys, params)))
+            for e in elements:
+                first, second = sim.particles[1].calculate_derivatives(elements=e, order=2)
+                self.assertEqual([q.xyz for q in first], [q.xyz for q in sim.particles[1].calculate_derivatives(elements=e)])
+                names = elements[e]
+                for j in range(7):
+                    p = rebound.Particle(simulation=sim, particle=sim.particles[1], variation=names[j])
+                    self.assertEqual(first[j].xyz+first[j].vxyz+[first[j].m], p.xyz+p.vxyz+[p.m])
+                    for k in range(7):
+                        p = rebound.Particle(simulation=sim, particle=sim.particles[1], variation=names[j], variation2=names[k])
+                        self.assertEqual(second[j][k].xyz+second[j][k].vxyz+[second[j][k].m], p.xyz+p.vxyz+[p.m])
+
+    def test_many_1st_order(self):
+        # Variational particles are calculated in batches. The result for each set of
+        # variational particles must not depend on the number of sets.
+        def simulation():
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1., e=0.1)
+            sim.add(m=1e-3, a=1.76, e=0.05, inc=0.1)
+            # Fixed timestep. Otherwise the timestep depends on all variational particles.
+            sim.ri_ias15.epsilon = 0.
+            sim.dt = 0.01
+            return sim
+        sim = simulation()
+        variations = [sim.add_variation() for i in range(10)]
+        for i, var in enumerate(variations):
+            var.vary(1+i%2, self.paramkeys[i%len(self.paramkeys)])
+        sim.integrate(1.4)
+        for i, var in enumerate(variations):
+            sim1 = simulation()
+            var1 = sim1.add_variation()
+            var1.vary(1+i%2, self.paramkeys[i%len(self.paramkeys)])
+            sim1.integrate(1.4)
+            for p, p1 in zip(var.particles, var1.particles):
+                self.assertEqual(p.x, p1.x)
+                self.assertEqual(p.vy, p1.vy)
     
     
     
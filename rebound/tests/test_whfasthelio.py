@@ -66,6 +66,27 @@ class TestIntegratorWHFastHelio(unittest.TestCase):
         self.assertAlmostEqual(sim1.particles[2].y, sim2.particles[1].y, delta=1e-14)
         
     
+    def test_whfasthelio_batch(self):
+        # Test particles are integrated in batches. Results must be the same as for one particle at a time.
+        orbits = [(1.+0.1*i, 0.05*i) for i in range(15)] + [(-1., 1.5), (-2., 3.)]
+        def setup():
+            sim = rebound.Simulation()
+            sim.integrator = "whfasthelio"
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=5.)
+            sim.dt = 0.0123
+            return sim
+        sim = setup()
+        for a, e in orbits:
+            sim.add(a=a, e=e, f=a*e)
+        sim.integrate(10.)
+        for k, (a, e) in enumerate(orbits):
+            sim1 = setup()
+            sim1.add(a=a, e=e, f=a*e)
+            sim1.integrate(10.)
+            self.assertEqual(sim.particles[2+k].x, sim1.particles[2].x)
+            self.assertEqual(sim.particles[2+k].vy, sim1.particles[2].vy)
+
     def test_whfasthelio_nosafemode(self):
         sim = rebound.Simulation()
         sim.add(m=1.)
@@ -81,5 +102,29 @@ class TestIntegratorWHFastHelio(unittest.TestCase):
         e1 = sim.calculate_energy()
         self.assertLess(math.fabs((e0-e1)/e1),1e-7)
 
+    def test_whfasthelio_nosafemode_modifications(self):
+        # Only the modified particles get new heliocentric coordinates.
+        def run(safe_mode):
+            sim = rebound.Simulation()
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=1.,e=.1)
+            sim.add(m=1e-3, a=3.,e=0.1)
+            sim.add(m=1e-4, a=5.,e=0.1)
+            sim.integrator = "whfasthelio"
+            sim.ri_whfasthelio.safe_mode = safe_mode
+            sim.dt = 0.005123*2.*math.pi
+            def modify(simp):
+                ps = simp.contents.particles
+                ps[1].m *= 0.9999
+                ps[3].vx *= 0.9999
+            sim.post_timestep_modifications = modify
+            sim.integrate(10., exact_finish_time=0)
+            return sim
+        sim0 = run(0)
+        sim1 = run(1)
+        for i in range(4):
+            self.assertAlmostEqual(sim0.particles[i].x, sim1.particles[i].x, delta=1e-12)
+            self.assertAlmostEqual(sim0.particles[i].vy, sim1.particles[i].vy, delta=1e-12)
+
 if __name__ == "__main__":
     unittest.main()
@@ -1,4 +1,4 @@
-from ctypes import c_uint32, c_uint, c_ulong, c_char_p
+from ctypes import c_uint32, c_uint, c_ulong, c_char_p, c_double, c_int, POINTER
 from . import clibrebound
 import sys
 
@@ -22,3 +22,87 @@ def hash(key):
     else:
         raise AttributeError("Need to pash hash an integer or string.")
 
+
+def _orbit_arrays(data, primary):
+    import numpy as np
+    data = np.ascontiguousarray(data, dtype="float64")
+    primary = np.ascontiguousarray(primary, dtype="float64")
+    if data.ndim != 2 or data.shape[1] != 7:
+        raise ValueError("Need an array of shape (N,7).")
+    N = data.shape[0]
+    if primary.shape == (7,):
+        Nprimaries = 1
+    elif primary.shape == (N,7):
+        Nprimaries = N
+    else:
+        raise ValueError("The primary needs to be an array of shape (7,) or (N,7).")
+    return np, data, primary, N, Nprimaries
+
+def particles_to_orbits(particles, primary, G=1., return_errors=False):
+    """
+    Calculates the orbital elements of many particles at once.
+
+    Arguments
+    ---------
+    particles : array_like of shape (N,7)
+        Rows of m, x, y, z, vx, vy, vz. This is the same layout as 
+        `SimulationArchive.getParticleData()`.
+    primary : array_like of shape (7,) or (N,7)
+        The reference body (m, x, y, z, vx, vy, vz), either the same for all 
+        particles or one per particle.
+    G : float, optional
+        The gravitational constant. Default: 1.
+    return_errors : bool, optional
+        If True, also return an int array of length N with the error codes
+        of `Particle.calculate_orbit()` (0 means no error).
+
+    Returns
+    -------
+    A numpy array of shape (N,7) with rows m, a, e, inc, Omega, omega, f.
+    Rows for which no orbit could be calculated are set to nan.
+
+    Examples
+    --------
+    >>> sa = rebound.SimulationArchive("archive.bin")
+    >>> p = sa.getParticleData(-1)
+    >>> o = rebound.particles_to_orbits(p[1:], p[0], G=sa[0].G)
+    >>> print(o[:,2]) # eccentricities
+    """
+    np, particles, primary, N, Nprimaries = _orbit_arrays(particles, primary)
+    orbits = np.zeros((N,7), dtype="float64")
+    err = np.zeros(N, dtype="intc")
+    clibrebound.reb_tools_particles_to_orbits(c_double(G), c_int(N), particles.ctypes.data_as(POINTER(c_double)), primary.ctypes.data_as(POINTER(c_double)), c_int(Nprimaries), orbits.ctypes.data_as(POINTER(c_double)), err.ctypes.data_as(POINTER(c_int)))
+    if return_errors:
+        return orbits, err
+    return orbits
+
+def orbits_to_particles(orbits, primary, G=1., return_errors=False):
+    """
+    Calculates positions and velocities of many particles from their orbital 
+    elements at once. This is the inverse of `particles_to_orbits()`.
+
+    Arguments
+    ---------
+    orbits : array_like of shape (N,7)
+        Rows of m, a, e, inc, Omega, omega, f.
+    primary : array_like of shape (7,) or (N,7)
+        The reference body (m, x, y, z, vx, vy, vz), either the same for all 
+        particles or one per particle.
+    G : float, optional
+        The gravitational constant. Default: 1.
+    return_errors : bool, optional
+        If True, also return an int array of length N with the error codes
+        used when adding particles with orbital elements (0 means no error).
+
+    Returns
+    -------
+    A numpy array of shape (N,7) with rows m, x, y, z, vx, vy, vz.
+    Rows for which the orbital elements are invalid are set to nan.
+    """
+    np, orbits, primary, N, Nprimaries = _orbit_arrays(orbits, primary)
+    particles = np.zeros((N,7), dtype="float64")
+    err = np.zeros(N, dtype="intc")
+    clibrebound.reb_tools_orbits_to_particles(c_double(G), c_int(N), orbits.ctypes.data_as(POINTER(c_double)), primary.ctypes.data_as(POINTER(c_double)), c_int(Nprimaries), particles.ctypes.data_as(POINTER(c_double)), err.ctypes.data_as(POINTER(c_int)))
+    if return_errors:
+        return particles, err
+    return particles
@@ -296,14 +296,51 @@ function startGL(reboundView) {
     gl.clear(gl.COLOR_BUFFER_BIT);
     drawGL(reboundView);
 }
-function updateRenderData(reboundView){
-    var previousN = reboundView.N;
-    reboundView.N = reboundView.model.get("N");
-    reboundView.t = reboundView.model.get("t");
-    reboundView.particle_data = reboundView.model.get('particle_data');
-    if (reboundView.orbits){
-        reboundView.orbit_data = reboundView.model.get('orbit_data');
+function applyFrame(reboundView){
+    // Decodes a binary frame (see reb_display_encode_frame()).
+    var frame = reboundView.model.get('frame');
+    if (!frame || frame.byteLength<32){
+        return;
+    }
+    var dv = new DataView(frame.buffer, frame.byteOffset, frame.byteLength);
+    var keyframe = dv.getUint32(0,true) & 1;
+    var N = dv.getUint32(4,true);
+    var qscale = dv.getFloat32(16,true)/32767.;
+    var N_p = dv.getUint32(20,true);
+    var N_o = dv.getUint32(24,true);
+    var N_orbits = dv.getUint32(28,true);
+    if (!keyframe && (!reboundView.particle_data || reboundView.N!=N)){
+        return; // Wait for the next keyframe
+    }
+    if (keyframe && reboundView.N!=N){
+        reboundView.particle_data = new Float32Array(7*N);
+        reboundView.orbit_data = new Float32Array(9*Math.max(N-1,0));
+    }
+    reboundView.N = N;
+    reboundView.N_orbits = N_orbits;
+    reboundView.t = dv.getFloat64(8,true);
+    var offset = 32;
+    var pd = reboundView.particle_data;
+    var values = offset + (keyframe?0:4*N_p);
+    for(var k=0;k<N_p;k++){
+        var i = keyframe?k:dv.getUint32(offset+4*k,true);
+        for(var j=0;j<3;j++){
+            pd[7*i+j] = dv.getInt16(values+2*(3*k+j),true)*qscale;
+        }
     }
+    offset = (values+6*N_p+3)&~3;
+    var od = reboundView.orbit_data;
+    var scales = [qscale, qscale, qscale, qscale, 4./32767., 4.*Math.PI/32767., 4.*Math.PI/32767., 4.*Math.PI/32767., 4.*Math.PI/32767.];
+    values = offset + (keyframe?0:4*N_o);
+    for(var k=0;k<N_o;k++){
+        var i = keyframe?k:dv.getUint32(offset+4*k,true);
+        for(var j=0;j<9;j++){
+            od[9*i+j] = dv.getInt16(values+2*(9*k+j),true)*scales[j];
+        }
+    }
+}
+function updateRenderData(reboundView){
+    applyFrame(reboundView);
     var gl = reboundView.gl
     if (reboundView.N>0){
         gl.bindBuffer(gl.ARRAY_BUFFER, reboundView.particle_data_buffer);
@@ -345,7 +382,7 @@ function drawGL(reboundView) {
     gl.uniformMatrix4fv(reboundView.point_shader_mvp_location,false,mattransp(mvp));
     gl.drawArrays(gl.POINTS,0,reboundView.N);
    
-    if (reboundView.orbits){
+    if (reboundView.orbits && reboundView.N_orbits>0){
         gl.useProgram(reboundView.orbit_shader_program);
         gl.bindBuffer(gl.ARRAY_BUFFER, reboundView.orbit_lintwopi_buffer);
         var ltp = gl.getAttribLocation(reboundView.orbit_shader_program,"lintwopi");
@@ -356,7 +393,7 @@ function drawGL(reboundView) {
         // Need to do this one by one
         // because WebGL is not supporting
         // instancing:
-        for(i=0;i<reboundView.N-1;i++){
+        for(i=0;i<reboundView.N_orbits;i++){
             var focus = new Float32Array(reboundView.orbit_data.buffer,4*9*i,3);
             gl.uniform3fv(reboundView.orbit_shader_focus_location,focus);
             var aef = new Float32Array(reboundView.orbit_data.buffer,4*(9*i+3),3);
@@ -373,10 +410,12 @@ define('rebound', ["jupyter-js-widgets"], function(widgets) {
     var ReboundView = widgets.DOMWidgetView.extend({
         render: function() {
             this.el.innerHTML = '<canvas style="display: inline" id="reboundcanvas-'+this.id+'" style="border: none;" width="'+this.model.get("width")+'" height="'+this.model.get("height")+'"></canvas>';
-            this.model.on('change:t', this.trigger_refresh, this);
-            this.model.on('change:count', this.trigger_refresh, this);
+            this.model.on('change:frame', this.trigger_refresh, this);
             this.startCount = 0;
             this.gl = null;
+            this.N = 0;
+            this.N_orbits = 0;
+            this.particle_data = null;
             // Only copy those once
             this.scale = this.model.get("scale");
             this.width = this.model.get("width");
@@ -401,7 +440,7 @@ define('rebound', ["jupyter-js-widgets"], function(widgets) {
 from ipywidgets import DOMWidget
 import traitlets
 import math
-from ctypes import c_float, byref, create_string_buffer, c_int, c_char, pointer
+from ctypes import c_float, byref, create_string_buffer, c_int, c_char, c_double, c_size_t, c_void_p, pointer, string_at
 from . import clibrebound
 
 class Widget(DOMWidget):
@@ -413,11 +452,10 @@ class Widget(DOMWidget):
     width = traitlets.Float().tag(sync=True)
     height = traitlets.Float().tag(sync=True)
     scale = traitlets.Float().tag(sync=True)
-    particle_data = traitlets.Bytes().tag(sync=True)
-    orbit_data = traitlets.Bytes().tag(sync=True)
+    frame = traitlets.Bytes().tag(sync=True)
     orientation = traitlets.Tuple().tag(sync=True)
     orbits = traitlets.Int().tag(sync=True)
-    def __init__(self,simulation,size=(200,200),orientation=(0.,0.,0.,1.),scale=None,autorefresh=True,orbits=True):
+    def __init__(self,simulation,size=(200,200),orientation=(0.,0.,0.,1.),scale=None,autorefresh=True,orbits=True,max_bandwidth=1e6):
         """ 
         Initializes a Widget.
 
@@ -444,6 +482,10 @@ class Widget(DOMWidget):
             The default value for this is True and the widget will draw the instantaneous 
             orbits of the particles. For simulations in which particles are not on
             Keplerian orbits, the orbits shown will not be accurate. 
+        max_bandwidth : float, optional
+            Upper limit on the average number of bytes per second sent to the
+            browser while a simulation is running. Frames are skipped when the
+            limit is reached. The default is 1e6. Set to 0 for no limit.
         """
         self.width, self.height  = size
         self.t, self.N = simulation.t, simulation.N
@@ -451,7 +493,9 @@ class Widget(DOMWidget):
         self.autorefresh = autorefresh
         self.orbits = orbits
         self.simp = pointer(simulation)
-        clibrebound.reb_display_copy_data.restype = c_int
+        simulation.display_data.contents.max_bandwidth = max_bandwidth
+        clibrebound.reb_display_encoder_create.restype = c_void_p
+        self._encoder = clibrebound.reb_display_encoder_create()
         if scale is None:
             self.scale = simulation.display_data.contents.scale
         else:
@@ -473,19 +517,20 @@ class Widget(DOMWidget):
         if self.autorefresh==0 and isauto==1:
             return
         sim = simp.contents
-        size_changed = clibrebound.reb_display_copy_data(simp)
-        clibrebound.reb_display_prepare_data(simp,c_int(self.orbits))
-        if sim.N>0:
-            self.particle_data = (c_char * (4*7*sim.N)).from_address(sim.display_data.contents.particle_data).raw
-            if self.orbits:
-                self.orbit_data = (c_char * (4*9*(sim.N-1))).from_address(sim.display_data.contents.orbit_data).raw
-        if size_changed:
-            #TODO: Implement better GPU size change
-            pass
-        self.N = sim.N
+        size = c_size_t(0)
+        clibrebound.reb_display_encode_frame.restype = c_void_p
+        frame = clibrebound.reb_display_encode_frame(simp, c_void_p(self._encoder), c_double(self.scale), c_int(self.orbits), byref(size))
+        self.N = sim.display_data.contents.N
         self.t = sim.t
+        if frame:
+            self.frame = string_at(frame, size.value)
         self.count += 1
 
+    def __del__(self):
+        if getattr(self, "_encoder", None):
+            clibrebound.reb_display_encoder_free(c_void_p(self._encoder))
+            self._encoder = None
+
     @staticmethod
     def getClientCode():
         return shader_code + js_code
@@ -25,6 +25,15 @@ if sys.platform == 'darwin':
     vars = sysconfig.get_config_vars()
     vars['LDSHARED'] = vars['LDSHARED'].replace('-bundle', '-shared')
     extra_link_args=['-Wl,-install_name,@rpath/librebound'+suffix]
+
+libraries=['pthread'] # reb_integrate_async(), batches, output streams, SimulationArchive writer
+define_macros=[ ('LIBREBOUND', None) ]
+if sys.platform.startswith('linux'):
+    libraries.append('rt') # shm_open() on older glibc versions
+if os.environ.get('ZLIB')=='1':
+    # Compressed SimulationArchives
+    libraries.append('z')
+    define_macros.append(('REB_ZLIB', None))
     
 libreboundmodule = Extension('librebound',
                     sources = [ 'src/rebound.c',
@@ -34,9 +43,15 @@ libreboundmodule = Extension('librebound',
                                 'src/integrator_hermes.c',
                                 'src/integrator_leapfrog.c',
                                 'src/integrator_janus.c',
+                                'src/integrator_saba.c',
+                                'src/integrator_mercurius.c',
                                 'src/integrator_sei.c',
                                 'src/integrator.c',
                                 'src/gravity.c',
+                                'src/gravity_fmm.c',
+                                'src/gravity_opencl.c',
+                                'src/gravity_fft.c',
+                                'src/ensemble.c',
                                 'src/boundary.c',
                                 'src/display.c',
                                 'src/collision.c',
@@ -45,14 +60,21 @@ libreboundmodule = Extension('librebound',
                                 'src/tree.c',
                                 'src/particle.c',
                                 'src/output.c',
+                                'src/output_stream.c',
+                                'src/output_shm.c',
+                                'src/metrics.c',
+                                'src/profiling.c',
+                                'src/forces.c',
+                                'src/batch.c',
                                 'src/input.c',
                                 'src/simulationarchive.c',
                                 'src/transformations.c',
                                 ],
                     include_dirs = ['src'],
-                    define_macros=[ ('LIBREBOUND', None) ],
+                    define_macros=define_macros,
+                    libraries=libraries,
                     # Removed '-march=native' for now.
-                    extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99','-Wno-unknown-pragmas', ghash_arg, '-DLIBREBOUND', '-D_GNU_SOURCE', '-fPIC'],
+                    extra_compile_args=['-fstrict-aliasing', '-O3','-std=c99','-Wno-unknown-pragmas', '-fopenmp-simd', '-fno-math-errno', ghash_arg, '-DLIBREBOUND', '-D_GNU_SOURCE', '-fPIC'],
                     extra_link_args=extra_link_args,
                     )
 
@@ -0,0 +1,678 @@
+/**
+ * @file 	batch.c
+ * @brief 	Many copies of one simulation, integrated by a pool of threads.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	The copies of the template simulation are made with 
+ * reb_init_simulation_copy() and stored in one contiguous array of 
+ * simulations. Copies are created and integrated by a pool of threads which 
+ * take the next simulation from a shared counter, so that short and long 
+ * integrations balance out. There is no serialization per job and nothing 
+ * needs to go through python. The same pool calculates MEGNO maps, where 
+ * every job is one grid point and the copy only lives during its integration.
+ * With MPI, ensembles of independent simulations are distributed over 
+ * nodes, each of which runs its own pool of threads.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rebound.h"
+#include "tools.h"
+#include "batch.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif
+#ifdef MPI
+#include <limits.h>
+#include <time.h>
+#include "mpi.h"
+#include "communication_mpi.h"
+#include "output.h"
+#endif // MPI
+
+struct reb_batch_job {
+    struct reb_batch* b;
+    void (*func)(struct reb_batch* const b, const int k, void* args);
+    void* args;
+    int next;       ///< Index of the next simulation to process, shared by all threads
+};
+
+static void* reb_batch_worker(void* args){
+    struct reb_batch_job* const job = args;
+#ifdef OPENMP
+    omp_set_num_threads(1); // The pool already uses all cores.
+#endif
+    while (1){
+        const int k = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (k>=job->b->N) break;
+        job->func(job->b, k, job->args);
+    }
+    return NULL;
+}
+
+// Calls func for every simulation of the batch on the thread pool.
+static void reb_batch_run(struct reb_batch* const b, void (*func)(struct reb_batch* const b, const int k, void* args), void* args){
+    struct reb_batch_job job = {.b = b, .func = func, .args = args, .next = 0};
+    int threads = b->threads;
+    if (threads<=0){
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads>b->N){
+        threads = b->N;
+    }
+    if (threads<=1){
+        reb_batch_worker(&job);
+        return;
+    }
+    pthread_t* const tids = malloc(sizeof(pthread_t)*threads);
+    int started = 0;
+    for (int i=0;i<threads;i++){
+        if (pthread_create(&tids[i], NULL, reb_batch_worker, &job)){
+            break; // The remaining work is done by the threads which did start (or below).
+        }
+        started++;
+    }
+    if (started==0){
+        reb_batch_worker(&job);
+    }
+    for (int i=0;i<started;i++){
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+}
+
+static void reb_batch_copy(struct reb_batch* const b, const int k, void* args){
+    struct reb_simulation* const s = &b->simulations[k];
+    reb_init_simulation_copy(s, args);
+    s->visualization = REB_VISUALIZATION_NONE;
+}
+
+void reb_init_batch(struct reb_batch* const b, struct reb_simulation* const r, const int N, const int threads){
+    memset(b, 0, sizeof(struct reb_batch));
+    if (N<1){
+        reb_error(r, "A batch needs at least one simulation.");
+        return;
+    }
+    b->N = N;
+    b->threads = threads;
+    b->simulations = malloc(sizeof(struct reb_simulation)*N);
+    reb_batch_run(b, reb_batch_copy, r);
+}
+
+struct reb_batch* reb_create_batch(struct reb_simulation* const r, const int N, const int threads){
+    if (N<1){
+        return NULL;
+    }
+    struct reb_batch* b = malloc(sizeof(struct reb_batch));
+    reb_init_batch(b, r, N, threads);
+    return b;
+}
+
+void reb_free_batch_pointers(struct reb_batch* const b){
+    for (int k=0;k<b->N;k++){
+        reb_free_pointers(&b->simulations[k]);
+    }
+    free(b->simulations);
+    b->simulations = NULL;
+    b->N = 0;
+}
+
+void reb_free_batch(struct reb_batch* const b){
+    reb_free_batch_pointers(b);
+    free(b);
+}
+
+static void reb_batch_integrate_one(struct reb_batch* const b, const int k, void* args){
+    const double tmax = *(double*)args;
+    reb_integrate(&b->simulations[k], tmax);
+}
+
+void reb_batch_integrate(struct reb_batch* const b, double tmax){
+    reb_batch_run(b, reb_batch_integrate_one, &tmax);
+}
+
+void reb_batch_get_status(const struct reb_batch* const b, double* const t, int* const status){
+    for (int k=0;k<b->N;k++){
+        if (t) t[k] = b->simulations[k].t;
+        if (status) status[k] = b->simulations[k].status;
+    }
+}
+
+int reb_batch_get_particle_data(const struct reb_batch* const b, const int N, double* const data){
+    int incomplete = 0;
+    for (int k=0;k<b->N;k++){
+        const struct reb_simulation* const s = &b->simulations[k];
+        const int N_real = s->N - s->N_var;
+        for (int i=0;i<N;i++){
+            double* const d = data+((size_t)k*N+i)*7;
+            if (i<N_real){
+                const struct reb_particle p = s->particles[i];
+                d[0] = p.m; d[1] = p.x;  d[2] = p.y;  d[3] = p.z;
+                d[4] = p.vx; d[5] = p.vy; d[6] = p.vz;
+            }else{
+                d[0] = d[1] = d[2] = d[3] = d[4] = d[5] = d[6] = nan("");
+            }
+        }
+        incomplete += (N_real<N);
+    }
+    return incomplete;
+}
+
+int reb_batch_set_particle_data(struct reb_batch* const b, const int N, const double* const data){
+    int incomplete = 0;
+    for (int k=0;k<b->N;k++){
+        struct reb_simulation* const s = &b->simulations[k];
+        const int N_real = s->N - s->N_var;
+        const int n = N<N_real?N:N_real;
+        for (int i=0;i<n;i++){
+            const double* const d = data+((size_t)k*N+i)*7;
+            struct reb_particle* const p = &s->particles[i];
+            p->m = d[0]; p->x = d[1];  p->y = d[2];  p->z = d[3];
+            p->vx = d[4]; p->vy = d[5]; p->vz = d[6];
+        }
+        // Jacobi/heliocentric coordinates need to be recalculated.
+        s->ri_whfast.recalculate_jacobi_this_timestep = 1;
+        s->ri_whfasthelio.recalculate_heliocentric_this_timestep = 1;
+        incomplete += (N_real<N);
+    }
+    return incomplete;
+}
+
+/******************************
+ * MEGNO maps                 */
+
+void reb_init_megno_map(struct reb_megno_map* const m, const int Nx, const int Ny, const double xmin, const double xmax, const double ymin, const double ymax, const double tmax){
+    memset(m, 0, sizeof(struct reb_megno_map));
+    m->Nx = Nx;
+    m->Ny = Ny;
+    m->xmin = xmin;
+    m->xmax = xmax;
+    m->ymin = ymin;
+    m->ymax = ymax;
+    m->tmax = tmax;
+    m->check_interval = tmax/100.;
+    m->megno_max = 5.;
+    m->refine_threshold = 1.;
+}
+
+void reb_free_megno_map_pointers(struct reb_megno_map* const m){
+    free(m->megno);
+    m->megno = NULL;
+    free(m->t);
+    m->t = NULL;
+    free(m->status);
+    m->status = NULL;
+    free(m->level);
+    m->level = NULL;
+}
+
+struct reb_megno_map_job {
+    struct reb_megno_map* m;
+    const struct reb_simulation* r;
+    const int* points;  ///< Indices of the grid points to be integrated
+    int level;
+};
+
+// Integrates grid point job->points[k] until tmax or until the fate of the system is clear.
+static void reb_megno_map_point(struct reb_batch* const b, const int k, void* args){
+    const struct reb_megno_map_job* const job = args;
+    struct reb_megno_map* const m = job->m;
+    const int index = job->points[k];
+    const int ix = index%m->Nx_fine;
+    const int iy = index/m->Nx_fine;
+    const double x = m->Nx_fine>1 ? m->xmin + (m->xmax-m->xmin)*ix/(m->Nx_fine-1) : m->xmin;
+    const double y = m->Ny_fine>1 ? m->ymin + (m->ymax-m->ymin)*iy/(m->Ny_fine-1) : m->ymin;
+
+    struct reb_simulation* const s = malloc(sizeof(struct reb_simulation));
+    reb_init_simulation_copy(s, job->r);
+    s->visualization = REB_VISUALIZATION_NONE;
+    m->setup(s, x, y, m->setup_args);
+    // One stream per grid point, independent of the order of the jobs.
+    struct reb_rng rng = reb_rng_init(s->rand_seed, (uint64_t)index);
+    reb_tools_megno_init_rng(s, &rng);
+
+    enum REB_STATUS status = REB_EXIT_SUCCESS;
+    double megno = 0.;
+    while (s->t<m->tmax){
+        double t_next = s->t + m->check_interval;
+        if (t_next>m->tmax){
+            t_next = m->tmax;
+        }
+        status = reb_integrate(s, t_next);
+        megno = reb_tools_calculate_megno(s);
+        if (status!=REB_EXIT_SUCCESS){
+            break;      // Escape, close encounter or error.
+        }
+        if (s->t>=m->t_min && megno>m->megno_max){
+            break;      // Chaotic.
+        }
+    }
+    m->megno[index] = megno;
+    m->t[index] = s->t;
+    m->status[index] = status;
+    m->level[index] = job->level;
+    reb_free_simulation(s);
+}
+
+// MEGNO used to decide whether a cell gets refined and to fill in points.
+static double reb_megno_map_value(const struct reb_megno_map* const m, const int index){
+    if (m->status[index]!=REB_EXIT_SUCCESS){
+        return m->megno_max;
+    }
+    return m->megno[index]<m->megno_max ? m->megno[index] : m->megno_max;
+}
+
+long reb_megno_map_calculate(struct reb_megno_map* const m, struct reb_simulation* const r){
+    if (m->Nx<1 || m->Ny<1 || m->refine<0 || m->refine>20 || m->setup==NULL || !(m->tmax>0.) || !(m->check_interval>0.)){
+        reb_error(r, "Invalid settings for the MEGNO map. Nx and Ny need to be at least 1, tmax and check_interval positive, and a setup function is needed.");
+        return -1;
+    }
+    if (r->N_var){
+        reb_error(r, "The template of a MEGNO map must not have variational particles.");
+        return -1;
+    }
+    const int S = 1<<m->refine;     // Spacing of the initial grid in the refined grid
+    const int Nxf = (m->Nx-1)*S+1;
+    const int Nyf = (m->Ny-1)*S+1;
+    const int N = Nxf*Nyf;
+    m->Nx_fine = Nxf;
+    m->Ny_fine = Nyf;
+    m->megno = realloc(m->megno, sizeof(double)*N);
+    m->t = realloc(m->t, sizeof(double)*N);
+    m->status = realloc(m->status, sizeof(int)*N);
+    m->level = realloc(m->level, sizeof(int)*N);
+    m->N_integrated = 0;
+    int* const points = malloc(sizeof(int)*N);
+    char* const refined = calloc(N, sizeof(char));
+
+    struct reb_megno_map_job job = {.m = m, .r = r, .points = points, .level = 0};
+    struct reb_batch pool = {.threads = m->threads};
+    for (int l=0;l<=m->refine;l++){
+        const int s = S>>l;         // Spacing of this level
+        int N_points = 0;
+        if (l==0){
+            for (int iy=0;iy<Nyf;iy+=S){
+                for (int ix=0;ix<Nxf;ix+=S){
+                    points[N_points++] = iy*Nxf+ix;
+                }
+            }
+        }else{
+            // Cells of the previous level. Their new points are integrated if the corners differ.
+            const int cx = Nxf>1?2*s:0;
+            const int cy = Nyf>1?2*s:0;
+            for (int iy=0;iy<(Nyf>1?Nyf-1:1);iy+=2*s){
+                for (int ix=0;ix<(Nxf>1?Nxf-1:1);ix+=2*s){
+                    double vmin = INFINITY;
+                    double vmax = -INFINITY;
+                    for (int j=0;j<=cy;j+=2*s){
+                        for (int i=0;i<=cx;i+=2*s){
+                            const double v = reb_megno_map_value(m, (iy+j)*Nxf+ix+i);
+                            vmin = v<vmin?v:vmin;
+                            vmax = v>vmax?v:vmax;
+                        }
+                    }
+                    if (vmax-vmin<=m->refine_threshold){
+                        continue;
+                    }
+                    for (int j=0;j<=cy;j+=s){
+                        for (int i=0;i<=cx;i+=s){
+                            const int index = (iy+j)*Nxf+ix+i;
+                            if ((i/s)%2==0 && (j/s)%2==0) continue;    // Corner
+                            if (!refined[index]){
+                                refined[index] = 1;
+                                points[N_points++] = index;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        pool.N = N_points;
+        job.level = l;
+        if (N_points){
+            reb_batch_run(&pool, reb_megno_map_point, &job);
+        }
+        m->N_integrated += N_points;
+        if (l==0){
+            continue;
+        }
+        // Fill in the points of this level which have not been integrated.
+        for (int iy=0;iy<Nyf;iy+=s){
+            for (int ix=0;ix<Nxf;ix+=s){
+                const int oddx = (ix/s)%2;
+                const int oddy = (iy/s)%2;
+                const int index = iy*Nxf+ix;
+                if ((!oddx && !oddy) || refined[index]) continue;
+                double sum = 0.;
+                int n = 0;
+                int first = -1;
+                for (int j=-oddy;j<=oddy;j+=2){
+                    for (int i=-oddx;i<=oddx;i+=2){
+                        const int neighbour = (iy+j*s)*Nxf+ix+i*s;
+                        sum += reb_megno_map_value(m, neighbour);
+                        n++;
+                        if (first<0) first = neighbour;
+                    }
+                }
+                m->megno[index] = sum/n;
+                m->t[index] = 0.;
+                m->status[index] = m->status[first];
+                m->level[index] = -1;
+            }
+        }
+    }
+    free(refined);
+    free(points);
+    return m->N_integrated;
+}
+
+#ifdef MPI
+/**
+ * Ensembles distributed over MPI nodes. The main thread of every node 
+ * takes chunks of simulation indices from a counter on the root node 
+ * (MPI_Fetch_and_op on a window) and keeps a local queue filled, from which
+ * a pool of worker threads takes one simulation at a time. Workers never 
+ * call MPI. Finished simulations are serialized by the workers and written
+ * to the archive by the main thread. A second counter on the root node 
+ * hands out the file offsets, so nodes write independently.
+ */
+struct reb_mpi_ensemble_result {
+    struct reb_ensemble_archive_record record;
+    char* data;             ///< Binary file of the final state, NULL if no archive is written.
+};
+
+struct reb_mpi_ensemble_job {
+    struct reb_mpi_ensemble* e;
+    struct reb_simulation* r;                   ///< Template
+    pthread_mutex_t mutex;
+    pthread_cond_t work;                        ///< Signalled when the queue has been filled
+    pthread_cond_t done;                        ///< Signalled when a worker has finished a simulation
+    long* queue;                                ///< Ring buffer of simulation indices
+    int queue_size;
+    int queue_start;
+    int queue_N;
+    int no_more_work;                           ///< Set once the counter has reached N
+    int busy;                                   ///< Number of workers integrating a simulation
+    struct reb_mpi_ensemble_result* results;    ///< Finished simulations which have not been written yet
+    int results_N;
+    int results_allocatedN;
+};
+
+static void reb_mpi_ensemble_integrate_one(struct reb_mpi_ensemble_job* const job, const long k, struct reb_mpi_ensemble_result* const result){
+    struct reb_mpi_ensemble* const e = job->e;
+    struct reb_simulation* const s = malloc(sizeof(struct reb_simulation));
+    reb_init_simulation_copy(s, job->r);
+    s->visualization = REB_VISUALIZATION_NONE;
+    if (e->setup){
+        e->setup(s, k, e->setup_args);
+    }
+    reb_integrate(s, e->tmax);
+    result->record.index = k;
+    result->record.t = s->t;
+    result->record.status = s->status;
+    result->record.size = 0;
+    result->data = NULL;
+    if (e->filename){
+        size_t size = 0;
+        FILE* of = open_memstream(&result->data, &size);
+        reb_output_binary_stream(s, of);
+        fclose(of);
+        result->record.size = size;
+    }
+    reb_free_simulation(s);
+}
+
+static void* reb_mpi_ensemble_worker(void* args){
+    struct reb_mpi_ensemble_job* const job = args;
+#ifdef OPENMP
+    omp_set_num_threads(1); // The pool already uses all cores.
+#endif
+    pthread_mutex_lock(&job->mutex);
+    while (1){
+        while (job->queue_N==0 && !job->no_more_work){
+            pthread_cond_wait(&job->work, &job->mutex);
+        }
+        if (job->queue_N==0){
+            break;
+        }
+        const long k = job->queue[job->queue_start];
+        job->queue_start = (job->queue_start+1)%job->queue_size;
+        job->queue_N--;
+        job->busy++;
+        pthread_mutex_unlock(&job->mutex);
+
+        struct reb_mpi_ensemble_result result;
+        reb_mpi_ensemble_integrate_one(job, k, &result);
+
+        pthread_mutex_lock(&job->mutex);
+        if (job->results_N>=job->results_allocatedN){
+            job->results_allocatedN = job->results_allocatedN?2*job->results_allocatedN:16;
+            job->results = realloc(job->results, sizeof(struct reb_mpi_ensemble_result)*job->results_allocatedN);
+        }
+        job->results[job->results_N++] = result;
+        job->busy--;
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+// Stores the results in e and appends them to the archive. Called by the main thread without holding the mutex.
+static void reb_mpi_ensemble_write(struct reb_mpi_ensemble* const e, struct reb_mpi_ensemble_result* const results, const int N, MPI_Win win, MPI_File fh){
+    long size = 0;
+    for (int i=0;i<N;i++){
+        const long k = results[i].record.index;
+        e->t[k] = results[i].record.t;
+        e->status[k] = results[i].record.status;
+        size += sizeof(struct reb_ensemble_archive_record) + results[i].record.size;
+    }
+    e->N_local += N;
+    if (e->filename){
+        char* const buffer = malloc(size);
+        char* p = buffer;
+        for (int i=0;i<N;i++){
+            memcpy(p, &results[i].record, sizeof(struct reb_ensemble_archive_record));
+            p += sizeof(struct reb_ensemble_archive_record);
+            memcpy(p, results[i].data, results[i].record.size);
+            p += results[i].record.size;
+            free(results[i].data);
+        }
+        long offset;
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+        MPI_Fetch_and_op(&size, &offset, MPI_LONG, 0, 1, MPI_SUM, win);
+        MPI_Win_unlock(0, win);
+        MPI_File_write_at(fh, offset, buffer, (int)size, MPI_BYTE, MPI_STATUS_IGNORE);
+        free(buffer);
+    }
+}
+
+void reb_init_mpi_ensemble(struct reb_mpi_ensemble* const e, const long N, const double tmax){
+    memset(e, 0, sizeof(struct reb_mpi_ensemble));
+    e->N = N;
+    e->tmax = tmax;
+}
+
+void reb_free_mpi_ensemble_pointers(struct reb_mpi_ensemble* const e){
+    free(e->t);
+    free(e->status);
+    e->t = NULL;
+    e->status = NULL;
+}
+
+int reb_mpi_ensemble_run(struct reb_mpi_ensemble* const e, struct reb_simulation* const r){
+    if (e->N<1 || e->N>INT_MAX){
+        reb_error(r, "An ensemble needs at least one and at most INT_MAX simulations.");
+        return -1;
+    }
+    if (r->mpi_num>0){
+        reb_error(r, "The template of an ensemble needs to be a local simulation. Do not call reb_mpi_init() for it.");
+        return -1;
+    }
+    reb_communication_mpi_initialize(NULL, NULL);
+    int mpi_id;
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_id);
+    int threads = e->threads;
+    if (threads<=0){
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads<1){
+        threads = 1;
+    }
+    long chunk = e->chunk>0?e->chunk:threads;
+
+    MPI_File fh = MPI_FILE_NULL;
+    if (e->filename){
+        int error = MPI_File_open(MPI_COMM_WORLD, e->filename, MPI_MODE_CREATE|MPI_MODE_WRONLY, MPI_INFO_NULL, &fh)!=MPI_SUCCESS;
+        int error_any = 0;
+        MPI_Allreduce(&error, &error_any, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        if (error_any){
+            if (!error){
+                MPI_File_close(&fh);
+            }
+            reb_error(r, "Cannot open ensemble archive.");
+            return -1;
+        }
+        MPI_File_set_size(fh, 0);
+    }
+    // Next simulation index and next file offset, on the root node.
+    long counters[2] = {0, 0};
+    MPI_Win win;
+    MPI_Win_create(counters, mpi_id==0?sizeof(counters):0, sizeof(long), MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+
+    e->t = realloc(e->t, sizeof(double)*e->N);
+    e->status = realloc(e->status, sizeof(int)*e->N);
+    for (long k=0;k<e->N;k++){
+        e->t[k] = -INFINITY;    // Results of other nodes are combined with MPI_MAX.
+        e->status[k] = INT_MIN;
+    }
+    e->N_local = 0;
+
+    struct reb_mpi_ensemble_job job = {
+        .e = e,
+        .r = r,
+        .queue_size = 2*chunk,
+    };
+    job.queue = malloc(sizeof(long)*job.queue_size);
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.work, NULL);
+    pthread_cond_init(&job.done, NULL);
+    pthread_t* const tids = malloc(sizeof(pthread_t)*threads);
+    int started = 0;
+    for (int i=0;i<threads;i++){
+        if (pthread_create(&tids[i], NULL, reb_mpi_ensemble_worker, &job)){
+            break;
+        }
+        started++;
+    }
+    if (started==0){
+        reb_warning(r, "Cannot create threads. Integrating on the main thread.");
+    }
+
+    struct reb_mpi_ensemble_result* results = NULL;
+    int results_allocatedN = 0;
+    pthread_mutex_lock(&job.mutex);
+    while (1){
+        if (!job.no_more_work && job.queue_N<chunk){
+            // Keep the queue filled so that workers do not wait for the counter.
+            pthread_mutex_unlock(&job.mutex);
+            long first;
+            MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+            MPI_Fetch_and_op(&chunk, &first, MPI_LONG, 0, 0, MPI_SUM, win);
+            MPI_Win_unlock(0, win);
+            pthread_mutex_lock(&job.mutex);
+            for (long k=first;k<first+chunk && k<e->N;k++){
+                job.queue[(job.queue_start+job.queue_N)%job.queue_size] = k;
+                job.queue_N++;
+            }
+            if (first+chunk>=e->N){
+                job.no_more_work = 1;
+            }
+            pthread_cond_broadcast(&job.work);
+            continue;
+        }
+        if (job.results_N>0){
+            // Swap the result buffers, then write without holding the mutex.
+            struct reb_mpi_ensemble_result* const tmp = job.results;
+            const int N = job.results_N;
+            const int tmp_allocatedN = job.results_allocatedN;
+            job.results = results;
+            job.results_allocatedN = results_allocatedN;
+            job.results_N = 0;
+            results = tmp;
+            results_allocatedN = tmp_allocatedN;
+            pthread_mutex_unlock(&job.mutex);
+            reb_mpi_ensemble_write(e, results, N, win, fh);
+            pthread_mutex_lock(&job.mutex);
+            continue;
+        }
+        if (started==0 && job.queue_N>0){
+            const long k = job.queue[job.queue_start];
+            job.queue_start = (job.queue_start+1)%job.queue_size;
+            job.queue_N--;
+            pthread_mutex_unlock(&job.mutex);
+            struct reb_mpi_ensemble_result result;
+            reb_mpi_ensemble_integrate_one(&job, k, &result);
+            reb_mpi_ensemble_write(e, &result, 1, win, fh);
+            pthread_mutex_lock(&job.mutex);
+            continue;
+        }
+        if (job.no_more_work && job.queue_N==0 && job.busy==0){
+            break;
+        }
+        // Passive target communication needs progress on the root node, so do not block for long.
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec>=1000000000){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&job.done, &job.mutex, &ts);
+        pthread_mutex_unlock(&job.mutex);
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+        pthread_mutex_lock(&job.mutex);
+    }
+    pthread_mutex_unlock(&job.mutex);
+    for (int i=0;i<started;i++){
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+    free(results);
+    free(job.results);
+    free(job.queue);
+    pthread_mutex_destroy(&job.mutex);
+    pthread_cond_destroy(&job.work);
+    pthread_cond_destroy(&job.done);
+
+    MPI_Win_free(&win);
+    if (e->filename){
+        MPI_File_close(&fh);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, e->t, (int)e->N, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, e->status, (int)e->N, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    return 0;
+}
+#endif // MPI
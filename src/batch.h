@@ -0,0 +1,28 @@
+/**
+ * @file 	batch.h
+ * @brief 	Many copies of one simulation, integrated by a pool of threads.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _BATCH_H
+#define _BATCH_H
+// The batch functions are part of the public API, see rebound.h.
+#endif
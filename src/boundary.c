@@ -66,21 +66,13 @@ void reb_boundary_check(struct reb_simulation* const r){
 				if (removep==1){
                     // If hermes calculate energy offset in global
                     if(r->track_energy_offset){
-                        double Ei = reb_tools_energy(r);
-                        reb_remove(r, i,1);
-                        r->energy_offset += Ei - reb_tools_energy(r);
-                    } else {
-                    reb_remove(r, i,0); // keepSorted=0 by default in C version
-                    }
-                    if (r->tree_root==NULL){
-                        i--; // need to recheck the particle that replaced the removed one
-                        N--; // This is the local N
-                    }else{
-                        // particle just marked, will be removed later
-                        r->tree_needs_update= 1;
+                        r->energy_offset += reb_particle_energy_contribution(r, i, -1);
                     }
+                    reb_remove_mark(r, i);
 				}
 			}
+            // Remove all particles at once. keepSorted=0 by default in C version
+            reb_remove_marked(r, r->track_energy_offset);
 			break;
 		case REB_BOUNDARY_SHEAR:
 		{
@@ -202,6 +194,20 @@ struct reb_ghostbox reb_boundary_get_ghostbox(struct reb_simulation* const r, in
 	}
 }
 
+struct reb_ghostbox* reb_boundary_get_ghostbox_table(struct reb_simulation* const r, const int nghostx, const int nghosty, const int nghostz, int* const N){
+	*N = (2*nghostx+1)*(2*nghosty+1)*(2*nghostz+1);
+	struct reb_ghostbox* const gbs = malloc(sizeof(struct reb_ghostbox)*(*N));
+	int n = 0;
+	for (int gbx=-nghostx; gbx<=nghostx; gbx++){
+	for (int gby=-nghosty; gby<=nghosty; gby++){
+	for (int gbz=-nghostz; gbz<=nghostz; gbz++){
+		gbs[n++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+	}
+	}
+	}
+	return gbs;
+}
+
 /**
  * @brief Checks if a given particle is within the computational domain.
  * @param p reb_particle to be checked.
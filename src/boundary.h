@@ -42,6 +42,20 @@ void reb_boundary_check(struct reb_simulation* r);
  */
 struct reb_ghostbox reb_boundary_get_ghostbox(struct reb_simulation* const r, int i, int j, int k);
 
+/**
+ * @brief Creates all ghostboxes with -nghostx<=i<=nghostx, -nghosty<=j<=nghosty, -nghostz<=k<=nghostz.
+ * @details The boxes are ordered with k running fastest, the same order as in the 
+ * usual triple loop over ghostboxes. Calculating the table once per timestep avoids 
+ * recalculating the (time dependent) shifts for every particle.
+ * @param r REBOUND Simulation to consider
+ * @param nghostx Number of ghostboxes in x direction.
+ * @param nghosty Number of ghostboxes in y direction.
+ * @param nghostz Number of ghostboxes in z direction.
+ * @param N Output. Number of ghostboxes in the table.
+ * @return Array of ghostboxes. Needs to be freed by the caller.
+ */
+struct reb_ghostbox* reb_boundary_get_ghostbox_table(struct reb_simulation* const r, const int nghostx, const int nghosty, const int nghostz, int* const N);
+
 /**
  * @details Return 1 if a particle is in the box, 0 otherwise.
  * @param r REBOUND Simulation to consider
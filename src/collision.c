@@ -34,21 +34,285 @@
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
+#include "rebound.h"
 #include "particle.h"
 #include "collision.h"
-#include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "profiling.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
 
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r,  double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
+/**
+ * @brief Collisions found by one thread during the collision search.
+ * @details Each thread appends to its own buffer without locking. The buffers
+ * are merged into r->collisions after the search (see reb_collision_buffer_merge()).
+ */
+struct reb_collision_buffer {
+	struct reb_collision* collisions;   ///< Collisions found by this thread
+	int N;                              ///< Number of collisions in buffer
+	int allocatedN;                     ///< Number of collisions allocated
+};
+
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double margin, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
+
+/**
+ * @brief Tests if two particles collide.
+ * @details By default, particles collide if they overlap and are approaching each other.
+ * If r->collision_swept is set, the relative motion during the last timestep is
+ * approximated by a straight line. Particles then also collide if they touched at
+ * some point during the timestep, even if they no longer overlap.
+ * @param r REBOUND simulation to work on.
+ * @param dx Relative position, x (also dy, dz).
+ * @param dvx Relative velocity, x (also dvy, dvz).
+ * @param sr Sum of the radii.
+ * @param time Set to the time of impact if the particles collide.
+ * @return 1 if the particles collide, 0 otherwise.
+ */
+static inline int reb_collision_test(const struct reb_simulation* const r, const double dx, const double dy, const double dz, const double dvx, const double dvy, const double dvz, const double sr, double* const time){
+	const double r2 = dx*dx + dy*dy + dz*dz;
+	if (!r->collision_swept){
+		// Check if particles are overlapping 
+		if (r2>sr*sr) return 0;
+		// Check if particles are approaching each other
+		if (dvx*dx + dvy*dy + dvz*dz >0) return 0;
+		*time = r->t;
+		return 1;
+	}
+	const double dt = r->dt_last_done;
+	// Relative position at the beginning of the timestep.
+	const double dx0 = dx - dt*dvx;
+	const double dy0 = dy - dt*dvy;
+	const double dz0 = dz - dt*dvz;
+	const double c0 = dx0*dx0 + dy0*dy0 + dz0*dz0 - sr*sr;
+	if (c0<=0.){
+		// Already overlapping at the beginning of the timestep.
+		if (r2>sr*sr) return 0;
+		if (dvx*dx + dvy*dy + dvz*dz >0) return 0;
+		*time = r->t - dt;
+		return 1;
+	}
+	// Solve |d0 + v u|^2 = sr^2 for the first contact time u.
+	const double b = dx0*dvx + dy0*dvy + dz0*dvz;
+	if (b>=0.) return 0; // Not approaching
+	const double v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+	const double disc = b*b - v2*c0;
+	if (disc<0.) return 0; // Closest approach larger than sr
+	const double u = c0/(-b + sqrt(disc));
+	if (u>dt) return 0; // Contact after the end of the timestep 
+	*time = r->t - dt + u;
+	return 1;
+}
+
+/**
+ * @brief Returns the search margin needed for swept collision detection.
+ * @details This is the maximum distance a particle, moving with speed |v|,
+ * can travel relative to any other particle during the last timestep.
+ * Zero if r->collision_swept is not set.
+ * @param r REBOUND simulation to work on.
+ * @param v Speed of the particle (including ghostbox shift).
+ * @param vmax Largest speed of all particles.
+ */
+static inline double reb_collision_swept_margin(const struct reb_simulation* const r, const double v, const double vmax){
+	if (!r->collision_swept) return 0.;
+	return (v+vmax)*r->dt_last_done;
+}
+
+/**
+ * @brief Returns the largest particle speed if r->collision_swept is set, zero otherwise.
+ */
+static double reb_collision_max_speed(const struct reb_simulation* const r){
+	if (!r->collision_swept) return 0.;
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	double v2max = 0.;
+#pragma omp parallel for reduction(max:v2max)
+	for (int i=0;i<N;i++){
+		const double v2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
+		if (v2>v2max) v2max = v2;
+	}
+	return sqrt(v2max);
+}
+
+/**
+ * @brief Appends a collision to a thread-local buffer.
+ */
+static inline void reb_collision_buffer_add(struct reb_collision_buffer* const buffer, const struct reb_collision c){
+	if (buffer->allocatedN<=buffer->N){
+		buffer->allocatedN = buffer->allocatedN?2*buffer->allocatedN:32;
+		buffer->collisions = realloc(buffer->collisions,sizeof(struct reb_collision)*buffer->allocatedN);
+	}
+	buffer->collisions[buffer->N] = c;
+	buffer->N++;
+}
+
+/**
+ * @brief Moves the collisions of a thread-local buffer to r->collisions and frees the buffer.
+ * @details Called once per thread at the end of a parallel search.
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Pointer to current number of collisions
+ * @param buffer Buffer to merge.
+ */
+static void reb_collision_buffer_merge(struct reb_simulation* const r, int* collisions_N, struct reb_collision_buffer* const buffer){
+	if (buffer->N){
+#pragma omp critical
+		{
+			if (r->collisions_allocatedN<(*collisions_N)+buffer->N){
+				r->collisions_allocatedN = (*collisions_N)+buffer->N+32;
+				r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
+			}
+			memcpy(r->collisions+(*collisions_N), buffer->collisions, sizeof(struct reb_collision)*buffer->N);
+			(*collisions_N) += buffer->N;
+		}
+	}
+	free(buffer->collisions);
+	buffer->collisions = NULL;
+	buffer->N = 0;
+	buffer->allocatedN = 0;
+}
+
+/**
+ * @brief Returns the next number of the random number generator used to shuffle collisions (xorshift32).
+ * @details The state is stored in r->collisions_seed, so that a simulation restarted from 
+ * a binary file or SimulationArchive resolves collisions in the same order.
+ */
+static inline uint32_t reb_collision_rand(struct reb_simulation* const r){
+	uint32_t x = r->collisions_seed?r->collisions_seed:2463534242u; // The state must not be zero.
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	r->collisions_seed = x;
+	return x;
+}
+
+/**
+ * @brief Orders collisions by particle indices and ghost box.
+ * @details Used to make the collision list independent of the number of threads.
+ */
+static int reb_collision_compare(const void* a, const void* b){
+	const struct reb_collision* const ca = a;
+	const struct reb_collision* const cb = b;
+	if (ca->p1!=cb->p1) return ca->p1<cb->p1?-1:1;
+	if (ca->p2!=cb->p2) return ca->p2<cb->p2?-1:1;
+	if (ca->ri!=cb->ri) return ca->ri<cb->ri?-1:1;
+	if (ca->gb.shiftx!=cb->gb.shiftx) return ca->gb.shiftx<cb->gb.shiftx?-1:1;
+	if (ca->gb.shifty!=cb->gb.shifty) return ca->gb.shifty<cb->gb.shifty?-1:1;
+	if (ca->gb.shiftz!=cb->gb.shiftz) return ca->gb.shiftz<cb->gb.shiftz?-1:1;
+	return 0;
+}
+
+#ifndef MPI
+/**
+ * @brief Pair of particles of a collision, used to find collisions which are reported twice.
+ */
+struct reb_collision_pair {
+	int lo;     ///< Smaller particle index
+	int hi;     ///< Larger particle index
+	int index;  ///< Index of the collision in r->collisions
+};
+
+static int reb_collision_pair_compare(const void* a, const void* b){
+	const struct reb_collision_pair* const pa = a;
+	const struct reb_collision_pair* const pb = b;
+	if (pa->lo!=pb->lo) return pa->lo<pb->lo?-1:1;
+	if (pa->hi!=pb->hi) return pa->hi<pb->hi?-1:1;
+	if (pa->index!=pb->index) return pa->index<pb->index?-1:1;
+	return 0;
+}
+
+/**
+ * @brief Removes all but the first collision of each pair of particles from r->collisions.
+ * @details Most collision searches find a collision from both sides. The sequential resolve 
+ * loop skips the second one because the particles are receding by then. A batch resolve 
+ * function sees all collisions at once, so they are removed beforehand. The order of the 
+ * remaining collisions is not changed.
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Pointer to current number of collisions.
+ */
+static void reb_collision_remove_mirrored(struct reb_simulation* const r, int* const collisions_N){
+	const int N = *collisions_N;
+	if (N<2) return;
+	struct reb_collision_pair* const pairs = malloc(sizeof(struct reb_collision_pair)*N);
+	char* const keep = malloc(sizeof(char)*N);
+	for (int i=0;i<N;i++){
+		const struct reb_collision* const c = &(r->collisions[i]);
+		pairs[i].lo = c->p1<c->p2?c->p1:c->p2;
+		pairs[i].hi = c->p1<c->p2?c->p2:c->p1;
+		pairs[i].index = i;
+	}
+	qsort(pairs, N, sizeof(struct reb_collision_pair), reb_collision_pair_compare);
+	for (int k=0;k<N;k++){
+		keep[pairs[k].index] = (k==0 || pairs[k].lo!=pairs[k-1].lo || pairs[k].hi!=pairs[k-1].hi);
+	}
+	int n = 0;
+	for (int i=0;i<N;i++){
+		if (keep[i]){
+			r->collisions[n++] = r->collisions[i];
+		}
+	}
+	*collisions_N = n;
+	free(keep);
+	free(pairs);
+}
+#endif // MPI
+
+/**
+ * @brief Collision search using a sort and sweep algorithm along the longest box dimension, O(N log(N)).
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Pointer to current number of collisions
+ */
+static void reb_collision_search_sweep(struct reb_simulation* const r, int* collisions_N);
+
+/**
+ * @brief Collision search using a hashed uniform grid with a cell size of twice the largest particle radius, O(N).
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Pointer to current number of collisions
+ */
+static void reb_collision_search_grid(struct reb_simulation* const r, int* collisions_N);
+
+#ifndef MPI
+/**
+ * @brief Collision search using a cached neighbour list (Verlet list) built with the tree.
+ * @details Used by REB_COLLISION_TREE if r->collision_verlet_skin is larger than 0.
+ * The tree needs to be up to date.
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Pointer to current number of collisions
+ */
+static void reb_collision_search_verlet(struct reb_simulation* const r, int* collisions_N);
+#endif // MPI
+
+#ifndef MPI
+/**
+ * @brief Returns 1 if the Verlet list has been built during the gravity calculation of the current timestep (see collision_fused).
+ */
+static int reb_collision_verlet_fused(const struct reb_simulation* const r);
+#endif // MPI
+
+/**
+ * @brief Hard sphere collision model. Momentum exchange and collision count are added to plog and Nlog.
+ */
+static int reb_collision_resolve_hardsphere_log(struct reb_simulation* const r, struct reb_collision c, double* plog, long* Nlog);
+
+#ifndef MPI
+/**
+ * @brief Resolves all hard sphere collisions in parallel.
+ * @details The collision list is partitioned into sets in which no particle appears twice.
+ * A collision is placed in the set following the last set that contains one of its
+ * particles. The collisions of any one particle are therefore resolved in the same
+ * order as in the serial loop and the result does not depend on the number of threads.
+ * @param r REBOUND simulation to work on.
+ * @param collisions_N Number of collisions in r->collisions.
+ */
+static void reb_collision_resolve_hardsphere_parallel(struct reb_simulation* const r, const int collisions_N);
+#endif // MPI
 
 void reb_collision_search(struct reb_simulation* const r){
 	const int N = r->N;
 	int collisions_N = 0;
 	const struct reb_particle* const particles = r->particles;
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
 	switch (r->collision){
 		case REB_COLLISION_NONE:
 		break;
@@ -63,6 +327,8 @@ void reb_collision_search(struct reb_simulation* const r){
 			for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
 				// Loop over all particles
 				for (int i=0;i<N;i++){
+					// Collisions of sleeping particles with awake ones are found from the other side.
+					if (reb_collision_sleeping(r, i)) continue;
 					struct reb_particle p1 = particles[i];
 					struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
 					struct reb_ghostbox gb = gborig;
@@ -82,14 +348,12 @@ void reb_collision_search(struct reb_simulation* const r){
 						double dy = gb.shifty - p2.y; 
 						double dz = gb.shiftz - p2.z; 
 						double sr = p1.r + p2.r; 
-						double r2 = dx*dx+dy*dy+dz*dz;
-						// Check if particles are overlapping 
-						if (r2>sr*sr) continue;	
 						double dvx = gb.shiftvx - p2.vx; 
 						double dvy = gb.shiftvy - p2.vy; 
 						double dvz = gb.shiftvz - p2.vz; 
-						// Check if particles are approaching each other
-						if (dvx*dx + dvy*dy + dvz*dz >0) continue; 
+						double time;
+						// Check if particles are overlapping and approaching each other
+						if (!reb_collision_test(r, dx, dy, dz, dvx, dvy, dvz, sr, &time)) continue;
 						// Add particles to collision array.
 						if (r->collisions_allocatedN<=collisions_N){
 							// Allocate memory if there is no space in array.
@@ -100,6 +364,8 @@ void reb_collision_search(struct reb_simulation* const r){
 						r->collisions[collisions_N].p1 = i;
 						r->collisions[collisions_N].p2 = j;
 						r->collisions[collisions_N].gb = gborig;
+						r->collisions[collisions_N].time = time;
+						r->collisions[collisions_N].ri = 0;
 						collisions_N++;
 					}
 				}
@@ -110,19 +376,17 @@ void reb_collision_search(struct reb_simulation* const r){
 		break;
 		case REB_COLLISION_TREE:
 		{
-			// Update and simplify tree. 
-			// Prepare particles for distribution to other nodes. 
-			reb_tree_update(r);          
-
+			// The tree has been updated and the particles have been distributed in reb_step().
 #ifdef MPI
-			// Distribute particles and add newly received particles to tree.
-			reb_communication_mpi_distribute_particles(r);
-			
-			// Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
-			reb_tree_prepare_essential_tree_for_collisions(r);
-
-			// Transfer essential tree and particles needed for collisions.
-			reb_communication_mpi_distribute_essential_tree_for_collisions(r);
+			if (r->mpi_num>0){ // Not a local simulation
+				PROFILING_START(r, REB_PROFILING_CAT_MPI)
+				// Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
+				reb_tree_prepare_essential_tree_for_collisions(r);
+
+				// Transfer essential tree and particles needed for collisions.
+				reb_communication_mpi_distribute_essential_tree_for_collisions(r);
+				PROFILING_STOP(r, REB_PROFILING_CAT_MPI)
+			}
 #endif // MPI
 
 			// Loop over ghost boxes, but only the inner most ring.
@@ -131,9 +395,22 @@ void reb_collision_search(struct reb_simulation* const r){
 			int nghostzcol = (r->nghostz>1?1:r->nghostz);
 			const struct reb_particle* const particles = r->particles;
 			const int N = r->N;
+#ifndef MPI
+			if (r->collision_verlet_skin>0. || reb_collision_verlet_fused(r)){
+				reb_collision_search_verlet(r, &collisions_N);
+				qsort(r->collisions, collisions_N, sizeof(struct reb_collision), reb_collision_compare);
+				break;
+			}
+#endif // MPI
+			const double vmax = reb_collision_max_speed(r);
+#pragma omp parallel
+			{
+			struct reb_collision_buffer buffer = {0};
 			// Loop over all particles
-#pragma omp parallel for schedule(guided)
+#pragma omp for schedule(guided)
 			for (int i=0;i<N;i++){
+				// Collisions of sleeping particles with awake ones are found from the other side.
+				if (reb_collision_sleeping(r, i)) continue;
 				struct reb_particle p1 = particles[i];
 				struct reb_collision collision_nearest;
 				collision_nearest.p1 = i;
@@ -153,11 +430,12 @@ void reb_collision_search(struct reb_simulation* const r){
 					gb.shiftvx += p1.vx; 
 					gb.shiftvy += p1.vy; 
 					gb.shiftvz += p1.vz; 
+					const double margin = reb_collision_swept_margin(r, sqrt(gb.shiftvx*gb.shiftvx + gb.shiftvy*gb.shiftvy + gb.shiftvz*gb.shiftvz), vmax);
 					// Loop over all root boxes.
 					for (int ri=0;ri<r->root_n;ri++){
 						struct reb_treecell* rootcell = r->tree_root[ri];
 						if (rootcell!=NULL){
-							reb_tree_get_nearest_neighbour_in_cell(r, &collisions_N, gb, gbunmod,ri,p1_r,&nearest_r2,&collision_nearest,rootcell);
+							reb_tree_get_nearest_neighbour_in_cell(r, &buffer, gb, gbunmod,ri,p1_r,margin,&nearest_r2,&collision_nearest,rootcell);
 						}
 					}
 				}
@@ -166,19 +444,59 @@ void reb_collision_search(struct reb_simulation* const r){
 				// Continue if no collision was found
 				if (collision_nearest.p2==-1) continue;
 			}
+			reb_collision_buffer_merge(r, &collisions_N, &buffer);
+			}
+			// Merge order depends on thread scheduling. Sort for reproducibility.
+			qsort(r->collisions, collisions_N, sizeof(struct reb_collision), reb_collision_compare);
 		}
 		break;
+		case REB_COLLISION_SWEEP:
+			reb_collision_search_sweep(r, &collisions_N);
+			qsort(r->collisions, collisions_N, sizeof(struct reb_collision), reb_collision_compare);
+		break;
+		case REB_COLLISION_GRID:
+			reb_collision_search_grid(r, &collisions_N);
+			qsort(r->collisions, collisions_N, sizeof(struct reb_collision), reb_collision_compare);
+		break;
 		default:
 			reb_exit("Collision routine not implemented.");
 	}
 
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+	PROFILING_COUNT(r, REB_PROFILING_COUNT_COLLISIONS, collisions_N)
+	r->metrics.collisions_found += collisions_N;
+
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
 	// randomize
 	for (int i=0;i<collisions_N;i++){
-		int new = rand()%collisions_N;
+		int new = reb_collision_rand(r)%collisions_N;
 		struct reb_collision c1 = r->collisions[i];
 		r->collisions[i] = r->collisions[new];
 		r->collisions[new] = c1;
 	}
+	if (r->collision_resolve_batch){
+#ifndef MPI
+		reb_collision_remove_mirrored(r, &collisions_N);
+#endif // MPI
+		if (collisions_N>0){
+			int* const outcomes = calloc(collisions_N, sizeof(int));
+			r->collision_resolve_batch(r, r->collisions, collisions_N, outcomes);
+			r->metrics.collisions_resolved += collisions_N;
+			for (int i=0;i<collisions_N;i++){
+				if (outcomes[i] & 1){
+					reb_remove_mark(r,r->collisions[i].p1);
+				}
+				if (outcomes[i] & 2){
+					reb_remove_mark(r,r->collisions[i].p2);
+				}
+			}
+			free(outcomes);
+			reb_remove_marked(r,r->collision_resolve_keep_sorted);
+		}
+		reb_collision_sleep_update(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+		return;
+	}
 	// Loop over all collisions previously found in reb_collision_search().
 	
 	int (*resolve) (struct reb_simulation* const r, struct reb_collision c) = r->collision_resolve;
@@ -186,60 +504,759 @@ void reb_collision_search(struct reb_simulation* const r){
 		// Default is hard sphere
 		resolve = reb_collision_resolve_hardsphere;
 	}
+#ifndef MPI
+	// A user defined coefficient of restitution might not be thread-safe (e.g. a Python callback).
+	if (r->collision_resolve_parallel && resolve==reb_collision_resolve_hardsphere && r->coefficient_of_restitution==NULL){
+		reb_collision_resolve_hardsphere_parallel(r, collisions_N);
+		r->metrics.collisions_resolved += collisions_N;
+		reb_collision_sleep_update(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+		return;
+	}
+#endif // MPI
 	for (int i=0;i<collisions_N;i++){
         
         struct reb_collision c = r->collisions[i];
-        if (c.p1 != -1 && c.p2 != -1){
-            // Resolve collision
-            int outcome = resolve(r, c);
-            
-            // Remove particles
-            if (outcome & 1){
-                // Remove p1
-                if (c.p2==r->N-1 && !(r->tree_root)){
-                    // Particles swapped
-                    c.p2 = c.p1;
-                }
-                reb_remove(r,c.p1,r->collision_resolve_keep_sorted);
-                // Check for pair
-                for (int j=i+1;j<collisions_N;j++){
-                    struct reb_collision cp = r->collisions[j];
-                    if (cp.p1==c.p1 || cp.p2==c.p1){
-                        r->collisions[j].p1 = -1;
-                        r->collisions[j].p2 = -1;
-                        // Will be skipped.
-                    }
-                    if (cp.p1==r->N){
-                        r->collisions[j].p1 = c.p1;
-                    }
-                    if (cp.p2==r->N){
-                        r->collisions[j].p2 = c.p1;
-                    }
-                }
-            }
-            if (outcome & 2){
-                // Remove p2
-                reb_remove(r,c.p2,r->collision_resolve_keep_sorted);
-                // Check for pair
-                for (int j=i+1;j<collisions_N;j++){
-                    struct reb_collision cp = r->collisions[j];
-                    if (cp.p1==c.p2 || cp.p2==c.p2){
-                        r->collisions[j].p1 = -1;
-                        r->collisions[j].p2 = -1;
-                        // Will be skipped.
-                    }
-                    if (cp.p1==r->N){
-                        r->collisions[j].p1 = c.p2;
-                    }
-                    if (cp.p2==r->N){
-                        r->collisions[j].p2 = c.p2;
-                    }
-                }
-            }
+        // Skip collisions with particles which have already been removed.
+        if (r->remove_marks_N && (r->remove_marks[c.p1] || r->remove_marks[c.p2])) continue;
+
+        // Resolve collision
+        int outcome = resolve(r, c);
+        r->metrics.collisions_resolved++;
+        
+        // Mark particles for removal. Indices of the other collisions stay valid 
+        // until all particles are removed at once below.
+        if (outcome & 1){
+            reb_remove_mark(r,c.p1);
+        }
+        if (outcome & 2){
+            reb_remove_mark(r,c.p2);
         }
 	}
+    reb_remove_marked(r,r->collision_resolve_keep_sorted);
+	reb_collision_sleep_update(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+}
+
+void reb_collision_sleep_update(struct reb_simulation* const r){
+	if (r->sleep_velocity<=0.){
+		return;
+	}
+#ifdef MPI
+	reb_warning(r, "Particle sleeping is not supported with MPI. Ignoring sleep_velocity.");
+	r->sleep_velocity = 0.;
+	return;
+#endif // MPI
+	const int N = r->N - r->N_var;
+	if (r->sleep_allocatedN<N){
+		r->sleep_allocatedN = N;
+		r->sleep_state = realloc(r->sleep_state, sizeof(unsigned int)*N);
+	}
+	// Particles added since the last update start awake.
+	const int sleep_N = r->sleep_N<N?r->sleep_N:N;
+	for (int i=sleep_N;i<N;i++){
+		r->sleep_state[i] = 0;
+	}
+	r->sleep_N = N;
+	unsigned int* const sleep_state = r->sleep_state;
+	struct reb_particle* const particles = r->particles;
+	const unsigned int sleep_steps = r->sleep_steps>0?r->sleep_steps:1;
+	const double v2max = r->sleep_velocity*r->sleep_velocity;
+	int sleeping_N = 0;
+#pragma omp parallel for schedule(guided) reduction(+:sleeping_N)
+	for (int i=0;i<N;i++){
+		struct reb_particle* const p = &particles[i];
+		const double v2 = p->vx*p->vx + p->vy*p->vy + p->vz*p->vz;
+		if (v2>=v2max){
+			// Moving, or a sleeping particle which has been hit hard enough to wake up.
+			sleep_state[i] = 0;
+			continue;
+		}
+		if (sleep_state[i]<sleep_steps){
+			sleep_state[i]++;
+		}
+		if (sleep_state[i]>=sleep_steps){
+			// Velocities below the threshold are absorbed while asleep.
+			p->vx = 0.;
+			p->vy = 0.;
+			p->vz = 0.;
+			sleeping_N++;
+		}
+	}
+	r->sleeping_N = sleeping_N;
+}
+
+void reb_collision_sleep_remove(struct reb_simulation* const r, const int index, const int keepSorted){
+	if (r->sleep_state==NULL || index>=r->sleep_N){
+		return;
+	}
+	const int N = r->N;
+	if (keepSorted){
+		memmove(r->sleep_state+index, r->sleep_state+index+1, sizeof(unsigned int)*(r->sleep_N-index-1));
+		r->sleep_N--;
+	}else{
+		// The particle moved into the gap is treated as awake if its state is not known.
+		r->sleep_state[index] = N<r->sleep_N?r->sleep_state[N]:0;
+		if (r->sleep_N>N){
+			r->sleep_N = N;
+		}
+	}
+}
+
+void reb_collision_sleep_remove_marked(struct reb_simulation* const r, const char* const marks, const int keepSorted){
+	if (r->sleep_state==NULL || r->sleep_N!=r->N){
+		r->sleep_N = 0;
+		return;
+	}
+	unsigned int* const sleep_state = r->sleep_state;
+	const int N = r->N;
+	int N_new = N;
+	if (keepSorted){
+		int j = 0;
+		for (int i=0;i<N;i++){
+			if (marks[i]) continue;
+			sleep_state[j++] = sleep_state[i];
+		}
+		N_new = j;
+	}else{
+		// Same order of moves as in reb_remove_marked().
+		for (int i=N-1;i>=0;i--){
+			if (marks[i]){
+				N_new--;
+				sleep_state[i] = sleep_state[N_new];
+			}
+		}
+	}
+	r->sleep_N = N_new;
+}
+
+void reb_collision_sleep_reorder(struct reb_simulation* const r, const int* const perm){
+	const int N = r->N;
+	if (r->sleep_state==NULL || r->sleep_N!=N){
+		r->sleep_N = 0;
+		return;
+	}
+	unsigned int* const tmp = malloc(sizeof(unsigned int)*N);
+	memcpy(tmp, r->sleep_state, sizeof(unsigned int)*N);
+	for (int i=0;i<N;i++){
+		r->sleep_state[i] = tmp[perm[i]];
+	}
+	free(tmp);
 }
 
+/**
+ * @brief Checks if two particles are overlapping and approaching each other. If so, the collision is added to the buffer.
+ * @param r REBOUND simulation to work on.
+ * @param buffer Thread-local collision buffer
+ * @param i Index of the first particle.
+ * @param j Index of the second particle.
+ * @param gb Ghostbox plus position and velocity of the first particle (precalculated).
+ * @param gborig Ghostbox unmodified
+ */
+static inline void reb_collision_check_pair(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, const int i, const int j, const struct reb_ghostbox gb, const struct reb_ghostbox gborig){
+	if (reb_collision_sleeping(r, i) && reb_collision_sleeping(r, j)) return;
+	const struct reb_particle* const particles = r->particles;
+	const struct reb_particle p2 = particles[j];
+	const double dx = gb.shiftx - p2.x; 
+	const double dy = gb.shifty - p2.y; 
+	const double dz = gb.shiftz - p2.z; 
+	const double sr = particles[i].r + p2.r; 
+	const double dvx = gb.shiftvx - p2.vx; 
+	const double dvy = gb.shiftvy - p2.vy; 
+	const double dvz = gb.shiftvz - p2.vz; 
+	double time;
+	// Check if particles are overlapping and approaching each other
+	if (!reb_collision_test(r, dx, dy, dz, dvx, dvy, dvz, sr, &time)) return;
+	struct reb_collision c = {0};
+	c.p1 = i;
+	c.p2 = j;
+	c.gb = gborig;
+	c.time = time;
+	reb_collision_buffer_add(buffer, c);
+}
+
+/**
+ * @brief Returns the largest particle radius.
+ */
+static double reb_collision_max_radius(const struct reb_simulation* const r){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	double rmax = 0.;
+#pragma omp parallel for reduction(max:rmax)
+	for (int i=0;i<N;i++){
+		if (particles[i].r>rmax) rmax = particles[i].r;
+	}
+	return rmax;
+}
+
+/**
+ * @brief Position of a particle in the sorted list used by reb_collision_search_sweep().
+ */
+struct reb_collision_sweep_entry {
+	double x;   ///< Position along the sweep axis
+	int pt;     ///< Index of the particle
+};
+
+static int reb_collision_sweep_compare(const void* a, const void* b){
+	const double xa = ((const struct reb_collision_sweep_entry*)a)->x;
+	const double xb = ((const struct reb_collision_sweep_entry*)b)->x;
+	return (xa>xb) - (xa<xb);
+}
+
+static void reb_collision_search_sweep(struct reb_simulation* const r, int* collisions_N){
+#ifdef MPI
+	reb_exit("REB_COLLISION_SWEEP is not supported with MPI.");
+#endif // MPI
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	if (N<2) return;
+	// Sweep along the longest side of the box.
+	int axis = 0;
+	if (r->boxsize.y>r->boxsize.x) axis = 1;
+	if (r->boxsize.z>(axis==1?r->boxsize.y:r->boxsize.x)) axis = 2;
+	struct reb_collision_sweep_entry* const list = malloc(sizeof(struct reb_collision_sweep_entry)*N);
+#pragma omp parallel for
+	for (int i=0;i<N;i++){
+		list[i].x = axis==0?particles[i].x:(axis==1?particles[i].y:particles[i].z);
+		list[i].pt = i;
+	}
+	qsort(list, N, sizeof(struct reb_collision_sweep_entry), reb_collision_sweep_compare);
+	const double rmax = reb_collision_max_radius(r);
+	const double vmax = reb_collision_max_speed(r);
+
+	// Loop over ghost boxes, but only the inner most ring.
+	int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	int nghostycol = (r->nghosty>1?1:r->nghosty);
+	int nghostzcol = (r->nghostz>1?1:r->nghostz);
+#pragma omp parallel
+	{
+	struct reb_collision_buffer buffer = {0};
+	for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+	for (int gby=-nghostycol; gby<=nghostycol; gby++){
+	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+		const struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+#pragma omp for schedule(guided) nowait
+		for (int i=0;i<N;i++){
+			const struct reb_particle p1 = particles[i];
+			struct reb_ghostbox gb = gborig;
+			// Precalculate shifted position 
+			gb.shiftx += p1.x;
+			gb.shifty += p1.y;
+			gb.shiftz += p1.z;
+			gb.shiftvx += p1.vx;
+			gb.shiftvy += p1.vy;
+			gb.shiftvz += p1.vz;
+			const double xi = axis==0?gb.shiftx:(axis==1?gb.shifty:gb.shiftz);
+			const double d = p1.r + rmax + reb_collision_swept_margin(r, sqrt(gb.shiftvx*gb.shiftvx + gb.shiftvy*gb.shiftvy + gb.shiftvz*gb.shiftvz), vmax);
+			const double lo = xi - d;
+			const double hi = xi + d;
+			// Binary search for the first particle which might overlap.
+			int k0 = 0;
+			int k1 = N;
+			while (k0<k1){
+				const int k = (k0+k1)/2;
+				if (list[k].x<lo){
+					k0 = k+1;
+				}else{
+					k1 = k;
+				}
+			}
+			for (int k=k0; k<N && list[k].x<=hi; k++){
+				const int j = list[k].pt;
+				// Do not collide particle with itself.
+				if (i==j) continue;
+				reb_collision_check_pair(r, &buffer, i, j, gb, gborig);
+			}
+		}
+	}
+	}
+	}
+	reb_collision_buffer_merge(r, collisions_N, &buffer);
+	}
+	free(list);
+}
+
+/**
+ * @brief Hash function for the cells of the uniform grid used by reb_collision_search_grid().
+ */
+static inline unsigned int reb_collision_grid_hash(const long ix, const long iy, const long iz, const unsigned int mask){
+	return ((unsigned int)ix*73856093u ^ (unsigned int)iy*19349663u ^ (unsigned int)iz*83492791u) & mask;
+}
+
+static void reb_collision_search_grid(struct reb_simulation* const r, int* collisions_N){
+#ifdef MPI
+	reb_exit("REB_COLLISION_GRID is not supported with MPI.");
+#endif // MPI
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	if (N<2) return;
+	const double rmax = reb_collision_max_radius(r);
+	if (rmax<=0.) return;
+	const double vmax = reb_collision_max_speed(r);
+	const double h = 2.*rmax;
+	unsigned int Ntable = 1;
+	while (Ntable<2*(unsigned int)N) Ntable *= 2;
+	const unsigned int mask = Ntable-1;
+	long* const cell = malloc(sizeof(long)*3*N);
+	unsigned int* const bucket = malloc(sizeof(unsigned int)*N);
+	int* const start = calloc(Ntable+1,sizeof(int));
+	int* const sorted = malloc(sizeof(int)*N);
+#pragma omp parallel for
+	for (int i=0;i<N;i++){
+		cell[3*i+0] = (long)floor(particles[i].x/h);
+		cell[3*i+1] = (long)floor(particles[i].y/h);
+		cell[3*i+2] = (long)floor(particles[i].z/h);
+		bucket[i] = reb_collision_grid_hash(cell[3*i+0], cell[3*i+1], cell[3*i+2], mask);
+	}
+	// Counting sort of the particles by bucket.
+	for (int i=0;i<N;i++){
+		start[bucket[i]+1]++;
+	}
+	for (unsigned int b=0;b<Ntable;b++){
+		start[b+1] += start[b];
+	}
+	{
+		int* const fill = malloc(sizeof(int)*Ntable);
+		memcpy(fill, start, sizeof(int)*Ntable);
+		for (int i=0;i<N;i++){
+			sorted[fill[bucket[i]]++] = i;
+		}
+		free(fill);
+	}
+
+	// Loop over ghost boxes, but only the inner most ring.
+	int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	int nghostycol = (r->nghosty>1?1:r->nghosty);
+	int nghostzcol = (r->nghostz>1?1:r->nghostz);
+#pragma omp parallel
+	{
+	struct reb_collision_buffer buffer = {0};
+	for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+	for (int gby=-nghostycol; gby<=nghostycol; gby++){
+	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+		const struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+#pragma omp for schedule(guided) nowait
+		for (int i=0;i<N;i++){
+			const struct reb_particle p1 = particles[i];
+			struct reb_ghostbox gb = gborig;
+			// Precalculate shifted position 
+			gb.shiftx += p1.x;
+			gb.shifty += p1.y;
+			gb.shiftz += p1.z;
+			gb.shiftvx += p1.vx;
+			gb.shiftvy += p1.vy;
+			gb.shiftvz += p1.vz;
+			const double d = p1.r + rmax + reb_collision_swept_margin(r, sqrt(gb.shiftvx*gb.shiftvx + gb.shiftvy*gb.shiftvy + gb.shiftvz*gb.shiftvz), vmax);
+			const long ix0 = (long)floor((gb.shiftx-d)/h), ix1 = (long)floor((gb.shiftx+d)/h);
+			const long iy0 = (long)floor((gb.shifty-d)/h), iy1 = (long)floor((gb.shifty+d)/h);
+			const long iz0 = (long)floor((gb.shiftz-d)/h), iz1 = (long)floor((gb.shiftz+d)/h);
+			for (long ix=ix0; ix<=ix1; ix++){
+			for (long iy=iy0; iy<=iy1; iy++){
+			for (long iz=iz0; iz<=iz1; iz++){
+				const unsigned int b = reb_collision_grid_hash(ix, iy, iz, mask);
+				for (int k=start[b]; k<start[b+1]; k++){
+					const int j = sorted[k];
+					// Skip particles in other cells with the same hash.
+					if (cell[3*j+0]!=ix || cell[3*j+1]!=iy || cell[3*j+2]!=iz) continue;
+					// Do not collide particle with itself.
+					if (i==j) continue;
+					reb_collision_check_pair(r, &buffer, i, j, gb, gborig);
+				}
+			}
+			}
+			}
+		}
+	}
+	}
+	}
+	reb_collision_buffer_merge(r, collisions_N, &buffer);
+	}
+	free(sorted);
+	free(start);
+	free(bucket);
+	free(cell);
+}
+
+/**
+ * @brief Cached neighbour list used if r->collision_verlet_skin is set.
+ * @details The candidates of particle i are p2[start[i]] to p2[start[i+1]-1]. The 
+ * list contains all particles which were closer than r_i+r_j+skin to particle i (or 
+ * one of its ghostboxes) at the time it was built. Because candidates are checked 
+ * in all ghostboxes, the list does not depend on which periodic image a particle is in.
+ * The list uses the particle indices at the time it was built. The tree code moves
+ * particles within the particle array, which is tracked with id and pos. 
+ */
+struct reb_collision_verlet_list {
+	int N;                  ///< Number of particles when the list was built
+	int allocatedN;         ///< Size allocated for start, r0 and x0
+	int p2_allocatedN;      ///< Size allocated for p2
+	int nghostxcol;         ///< Ghostboxes searched when the list was built (also y, z)
+	int nghostycol;
+	int nghostzcol;
+	double skin;            ///< Skin used for building the list, including the margin for swept collisions
+	double t0;              ///< Time when the list was built
+	double rmax0;           ///< Largest radius when the list was built
+	int p2_N;               ///< Number of candidates of all particles
+	int fused;              ///< Set if the list was built during the gravity calculation of the current timestep
+	int* start;             ///< Index of the first candidate of each particle, N+1 entries
+	int* p2;                ///< Candidates of all particles
+	double* x0;             ///< Positions at the time the list was built, 3N entries
+	double* r0;             ///< Radii at the time the list was built
+	int* id;                ///< Index at the time the list was built of the particle currently at index i
+	int* pos;               ///< Current index of the particle which had index i when the list was built
+};
+
+void reb_collision_verlet_list_swap(struct reb_simulation* const r, const int i, const int j){
+	struct reb_collision_verlet_list* const vl = r->collision_verlet_list;
+	if (vl==NULL || i==j || i>=vl->N || j>=vl->N) return;
+	const int idi = vl->id[i];
+	vl->id[i] = vl->id[j];
+	vl->id[j] = idi;
+	vl->pos[vl->id[i]] = i;
+	vl->pos[vl->id[j]] = j;
+}
+
+void reb_collision_verlet_list_free(struct reb_simulation* const r){
+	struct reb_collision_verlet_list* const vl = r->collision_verlet_list;
+	if (vl==NULL) return;
+	free(vl->start);
+	free(vl->p2);
+	free(vl->x0);
+	free(vl->r0);
+	free(vl->id);
+	free(vl->pos);
+	free(vl);
+	r->collision_verlet_list = NULL;
+}
+
+void reb_collision_verlet_add_cell(const struct reb_simulation* const r, struct reb_collision_verlet_candidate** candidates, int* candidates_N, int* candidates_allocatedN, const struct reb_ghostbox gb, const int i, const double p1_r, const double skin, const struct reb_treecell* const c){
+	if (c->pt>=0){
+		// c is a leaf node. Do not collide particle with itself.
+		if (c->pt==i) return;
+		const struct reb_particle p2 = r->particles[c->pt];
+		const double dx = gb.shiftx - p2.x;
+		const double dy = gb.shifty - p2.y;
+		const double dz = gb.shiftz - p2.z;
+		const double rp = p1_r + p2.r + skin;
+		if (dx*dx + dy*dy + dz*dz > rp*rp) return;
+		if ((*candidates_allocatedN)<=(*candidates_N)){
+			*candidates_allocatedN = (*candidates_allocatedN)?2*(*candidates_allocatedN):128;
+			*candidates = realloc(*candidates, sizeof(struct reb_collision_verlet_candidate)*(*candidates_allocatedN));
+		}
+		(*candidates)[*candidates_N].p1 = i;
+		(*candidates)[*candidates_N].p2 = c->pt;
+		(*candidates_N)++;
+	}else{
+		// c is not a leaf node
+		const double dx = gb.shiftx - c->x;
+		const double dy = gb.shifty - c->y;
+		const double dz = gb.shiftz - c->z;
+		const double rp = p1_r + r->max_radius[1] + 0.86602540378443*c->w + skin;
+		if (dx*dx + dy*dy + dz*dz < rp*rp){
+			for (int o=0;o<8;o++){
+				const struct reb_treecell* const d = c->oct[o];
+				if (d!=NULL){
+					reb_collision_verlet_add_cell(r, candidates, candidates_N, candidates_allocatedN, gb, i, p1_r, skin, d);
+				}
+			}
+		}
+	}
+}
+
+static int reb_collision_verlet_compare(const void* a, const void* b){
+	const int pa = ((const struct reb_collision_verlet_candidate*)a)->p2;
+	const int pb = ((const struct reb_collision_verlet_candidate*)b)->p2;
+	return (pa > pb) - (pa < pb);
+}
+
+#ifndef MPI
+/**
+ * @brief Allocates the Verlet list for the current particles and stores their positions and radii.
+ * @param r REBOUND simulation to work on.
+ * @param vl Verlet list.
+ * @param skin Skin used for building the list, including the margin for swept collisions.
+ */
+static void reb_collision_verlet_prepare(struct reb_simulation* const r, struct reb_collision_verlet_list* const vl, const double skin){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	if (vl->allocatedN<N){
+		vl->allocatedN = N;
+		vl->start = realloc(vl->start, sizeof(int)*(N+1));
+		vl->x0 = realloc(vl->x0, sizeof(double)*3*N);
+		vl->r0 = realloc(vl->r0, sizeof(double)*N);
+		vl->id = realloc(vl->id, sizeof(int)*N);
+		vl->pos = realloc(vl->pos, sizeof(int)*N);
+	}
+	vl->N = N;
+	vl->nghostxcol = (r->nghostx>1?1:r->nghostx);
+	vl->nghostycol = (r->nghosty>1?1:r->nghosty);
+	vl->nghostzcol = (r->nghostz>1?1:r->nghostz);
+	vl->skin = skin;
+	vl->t0 = r->t;
+	vl->rmax0 = reb_collision_max_radius(r);
+	vl->p2_N = 0;
+	vl->fused = 0;
+	vl->start[0] = 0;
+#pragma omp parallel for
+	for (int i=0;i<N;i++){
+		vl->start[i+1] = 0;
+		vl->x0[3*i+0] = particles[i].x;
+		vl->x0[3*i+1] = particles[i].y;
+		vl->x0[3*i+2] = particles[i].z;
+		vl->r0[i] = particles[i].r;
+		vl->id[i] = i;
+		vl->pos[i] = i;
+	}
+}
+#endif // MPI
+
+void reb_collision_verlet_unique(struct reb_collision_verlet_candidate* const candidates, const int first, int* const candidates_N){
+	qsort(candidates+first, (*candidates_N)-first, sizeof(struct reb_collision_verlet_candidate), reb_collision_verlet_compare);
+	int n = first;
+	for (int k=first;k<(*candidates_N);k++){
+		if (n==first || candidates[n-1].p2!=candidates[k].p2){
+			candidates[n++] = candidates[k];
+		}
+	}
+	*candidates_N = n;
+}
+
+void reb_collision_verlet_assemble(struct reb_simulation* const r, const struct reb_collision_verlet_candidate* const candidates, const int candidates_N){
+	struct reb_collision_verlet_list* const vl = r->collision_verlet_list;
+	const int N = vl->N;
+	// Candidates of all threads are sorted by particle (counting sort).
+#pragma omp critical
+	{
+		for (int k=0;k<candidates_N;k++){
+			vl->start[candidates[k].p1+1]++;
+		}
+		vl->p2_N += candidates_N;
+	}
+#pragma omp barrier
+#pragma omp single
+	{
+		for (int i=0;i<N;i++){
+			vl->start[i+1] += vl->start[i];
+		}
+		if (vl->p2_allocatedN<vl->p2_N){
+			vl->p2_allocatedN = vl->p2_N;
+			vl->p2 = realloc(vl->p2, sizeof(int)*vl->p2_N);
+		}
+	}
+	// Candidates of one particle are all found by the same thread and are stored contiguously.
+	for (int k=0;k<candidates_N;){
+		const int i = candidates[k].p1;
+		int s = vl->start[i];
+		for (;k<candidates_N && candidates[k].p1==i;k++){
+			vl->p2[s++] = candidates[k].p2;
+		}
+	}
+}
+
+#ifndef MPI
+/**
+ * @brief Builds the Verlet list using the tree.
+ * @param r REBOUND simulation to work on.
+ * @param vl Verlet list.
+ * @param margin Margin needed for swept collision detection.
+ */
+static void reb_collision_verlet_build(struct reb_simulation* const r, struct reb_collision_verlet_list* const vl, const double margin){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double skin = r->collision_verlet_skin + margin;
+	reb_collision_verlet_prepare(r, vl, skin);
+	const int nghostxcol = vl->nghostxcol;
+	const int nghostycol = vl->nghostycol;
+	const int nghostzcol = vl->nghostzcol;
+#pragma omp parallel
+	{
+	struct reb_collision_verlet_candidate* candidates = NULL;
+	int candidates_N = 0;
+	int candidates_allocatedN = 0;
+#pragma omp for schedule(guided)
+	for (int i=0;i<N;i++){
+		const struct reb_particle p1 = particles[i];
+		const int first = candidates_N;
+		for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+		for (int gby=-nghostycol; gby<=nghostycol; gby++){
+		for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+			struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			gb.shiftx += p1.x;
+			gb.shifty += p1.y;
+			gb.shiftz += p1.z;
+			for (int ri=0;ri<r->root_n;ri++){
+				const struct reb_treecell* const rootcell = r->tree_root[ri];
+				if (rootcell!=NULL){
+					reb_collision_verlet_add_cell(r, &candidates, &candidates_N, &candidates_allocatedN, gb, i, p1.r, skin, rootcell);
+				}
+			}
+		}
+		}
+		}
+		// Remove particles found in more than one ghostbox.
+		reb_collision_verlet_unique(candidates, first, &candidates_N);
+	}
+	reb_collision_verlet_assemble(r, candidates, candidates_N);
+	free(candidates);
+	}
+}
+#endif // MPI
+
+int reb_collision_fused_begin(struct reb_simulation* const r, double* const skin){
+#ifdef MPI
+	return 0;
+#else // MPI
+	if (!r->collision_fused || r->collision!=REB_COLLISION_TREE || r->N_var || r->tree_active_only || r->integrator==REB_INTEGRATOR_HERMES){
+		return 0;
+	}
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double vmax = reb_collision_max_speed(r);
+	double s = r->collision_verlet_skin;
+	if (s<=0.){
+		// Particles move for less than a timestep until the collision search. Their 
+		// speed is measured relative to the background shear flow (see reb_collision_verlet_needs_rebuild()).
+		const double OMEGA = (r->boundary==REB_BOUNDARY_SHEAR)?r->ri_sei.OMEGA:0.;
+		double v2max = 0.;
+#pragma omp parallel for reduction(max:v2max)
+		for (int i=0;i<N;i++){
+			const double vy = particles[i].vy + 1.5*OMEGA*particles[i].x;
+			const double v2 = particles[i].vx*particles[i].vx + vy*vy + particles[i].vz*particles[i].vz;
+			if (v2>v2max) v2max = v2;
+		}
+		s = 2.*sqrt(v2max)*fabs(r->dt);
+	}
+	s += reb_collision_swept_margin(r, vmax, vmax);
+	if (r->collision_verlet_list==NULL){
+		r->collision_verlet_list = calloc(1, sizeof(struct reb_collision_verlet_list));
+	}
+	reb_collision_verlet_prepare(r, r->collision_verlet_list, s);
+	r->collision_verlet_list->fused = 1;
+	*skin = s;
+	return 1;
+#endif // MPI
+}
+
+#ifndef MPI
+/**
+ * @brief Checks if the Verlet list needs to be rebuilt.
+ * @details The displacement of a particle since the list was built is measured 
+ * relative to the background shear flow (shearing sheet only) and to the nearest 
+ * periodic image, so that particles crossing the boundary do not trigger a rebuild.
+ * Radius increases count as displacement. A pair which is not in the list was at 
+ * least D=r_i+r_j+skin apart. It can since have come closer by at most twice the 
+ * largest displacement plus the shear across D. The list is valid as long as this 
+ * and the search margin for swept collisions are smaller than the skin.
+ * @param r REBOUND simulation to work on.
+ * @param vl Verlet list.
+ * @param margin Margin needed for swept collision detection.
+ */
+static int reb_collision_verlet_needs_rebuild(struct reb_simulation* const r, const struct reb_collision_verlet_list* const vl, const double margin){
+	const int N = r->N;
+	if (vl->N!=N || vl->skin<r->collision_verlet_skin){
+		return 1; 
+	}
+	const int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	const int nghostycol = (r->nghosty>1?1:r->nghosty);
+	const int nghostzcol = (r->nghostz>1?1:r->nghostz);
+	if (vl->nghostxcol!=nghostxcol || vl->nghostycol!=nghostycol || vl->nghostzcol!=nghostzcol){
+		return 1;
+	}
+	const double dt = r->t - vl->t0;
+	const double shear = (r->boundary==REB_BOUNDARY_SHEAR)?1.5*r->ri_sei.OMEGA*dt:0.;
+	const int gb_N = (2*nghostxcol+1)*(2*nghostycol+1)*(2*nghostzcol+1);
+	struct reb_ghostbox gbs[27];
+	int gb_n = 0;
+	for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+	for (int gby=-nghostycol; gby<=nghostycol; gby++){
+	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+		gbs[gb_n++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+	}
+	}
+	}
+	const struct reb_particle* const particles = r->particles;
+	const double* const x0 = vl->x0;
+	const double* const r0 = vl->r0;
+	const int* const id = vl->id;
+	double dmax = 0.;
+#pragma omp parallel for reduction(max:dmax)
+	for (int i=0;i<N;i++){
+		const int b = id[i];
+		const double dx = particles[i].x - x0[3*b+0];
+		const double dy = particles[i].y - x0[3*b+1] + shear*x0[3*b+0];
+		const double dz = particles[i].z - x0[3*b+2];
+		double d2 = dx*dx + dy*dy + dz*dz;
+		for (int g=0;g<gb_N;g++){
+			const double gx = dx + gbs[g].shiftx;
+			const double gy = dy + gbs[g].shifty;
+			const double gz = dz + gbs[g].shiftz;
+			const double g2 = gx*gx + gy*gy + gz*gz;
+			if (g2<d2) d2 = g2;
+		}
+		const double dr = particles[i].r - r0[b];
+		const double d = sqrt(d2) + (dr>0.?dr:0.);
+		if (d>dmax) dmax = d;
+	}
+	return 2.*dmax + fabs(shear)*(2.*vl->rmax0 + vl->skin) + margin > vl->skin;
+}
+#endif // MPI
+
+#ifndef MPI
+static int reb_collision_verlet_fused(const struct reb_simulation* const r){
+	return r->collision_verlet_list!=NULL && r->collision_verlet_list->fused;
+}
+#endif // MPI
+
+#ifndef MPI
+static void reb_collision_search_verlet(struct reb_simulation* const r, int* collisions_N){
+	const double vmax = reb_collision_max_speed(r);
+	const double margin = reb_collision_swept_margin(r, vmax, vmax);
+	if (r->collision_verlet_list==NULL){
+		r->collision_verlet_list = calloc(1, sizeof(struct reb_collision_verlet_list));
+		reb_collision_verlet_build(r, r->collision_verlet_list, margin);
+	}else if (reb_collision_verlet_needs_rebuild(r, r->collision_verlet_list, margin)){
+		reb_collision_verlet_build(r, r->collision_verlet_list, margin);
+	}
+	struct reb_collision_verlet_list* const vl = r->collision_verlet_list;
+	// Without collision_verlet_skin, a list built during the gravity calculation is only used once.
+	vl->fused = 0;
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	struct reb_ghostbox gbs[27];
+	int gb_N = 0;
+	for (int gbx=-vl->nghostxcol; gbx<=vl->nghostxcol; gbx++){
+	for (int gby=-vl->nghostycol; gby<=vl->nghostycol; gby++){
+	for (int gbz=-vl->nghostzcol; gbz<=vl->nghostzcol; gbz++){
+		gbs[gb_N++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+	}
+	}
+	}
+#pragma omp parallel
+	{
+	struct reb_collision_buffer buffer = {0};
+#pragma omp for schedule(guided)
+	for (int i=0;i<N;i++){
+		const struct reb_particle p1 = particles[i];
+		const int b = vl->id[i];
+		for (int k=vl->start[b];k<vl->start[b+1];k++){
+			const int j = vl->pos[vl->p2[k]];
+			for (int g=0;g<gb_N;g++){
+				struct reb_ghostbox gb = gbs[g];
+				gb.shiftx += p1.x;
+				gb.shifty += p1.y;
+				gb.shiftz += p1.z;
+				gb.shiftvx += p1.vx;
+				gb.shiftvy += p1.vy;
+				gb.shiftvz += p1.vz;
+				reb_collision_check_pair(r, &buffer, i, j, gb, gbs[g]);
+			}
+		}
+	}
+	reb_collision_buffer_merge(r, collisions_N, &buffer);
+	}
+}
+#endif // MPI
+
 /**
  * @brief Workaround for python setters.
  **/
@@ -256,13 +1273,14 @@ void reb_set_collision_resolve(struct reb_simulation* r, int (*resolve) (struct
  * @param gb (Shifted) position and velocity of the particle.
  * @param ri Index of the root box currently being searched in.
  * @param p1_r Radius of the particle (this is not in gb).
+ * @param margin Additional search distance for swept collision detection.
  * @param nearest_r2 Pointer to the nearest neighbour found so far.
  * @param collision_nearest Pointer to the nearest collision found so far.
  * @param c Pointer to the cell currently being searched in.
- * @param collisions_N Pointer to current number of collisions
+ * @param buffer Thread-local collision buffer
  * @param gbunmod Ghostbox unmodified
  */
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double margin, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
 	const struct reb_particle* const particles = r->particles;
 	if (c->pt>=0){ 	
 		// c is a leaf node
@@ -290,8 +1308,7 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 				p2 = particles[c->pt];
 #ifdef MPI
 			}else{
-				int root_n_per_node = r->root_n/r->mpi_num;
-				int proc_id = ri/root_n_per_node;
+				int proc_id = r->mpi_root_owner[ri];
 				p2 = r->particles_recv[proc_id][c->pt];
 			}
 #endif // MPI
@@ -303,28 +1320,20 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 			// A closer neighbour has already been found 
 			//if (r2 > *nearest_r2) return;
 			double rp = p1_r+p2.r;
-			// reb_particles are not overlapping 
-			if (r2 > rp*rp) return;
 			double dvx = gb.shiftvx - p2.vx;
 			double dvy = gb.shiftvy - p2.vy;
 			double dvz = gb.shiftvz - p2.vz;
-			// reb_particles are not approaching each other
-			if (dvx*dx + dvy*dy + dvz*dz >0) return;
+			double time;
+			// reb_particles are not overlapping or not approaching each other
+			if (!reb_collision_test(r, dx, dy, dz, dvx, dvy, dvz, rp, &time)) return;
 			// Found a new nearest neighbour. Save it for later.
 			*nearest_r2 = r2;
 			collision_nearest->ri = ri;
 			collision_nearest->p2 = c->pt;
 			collision_nearest->gb = gbunmod;
-			// Save collision in collisions array.
-#pragma omp critical
-			{
-				if (r->collisions_allocatedN<=(*collisions_N)){
-					r->collisions_allocatedN += 32;
-					r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
-				}
-				r->collisions[(*collisions_N)] = *collision_nearest;
-				(*collisions_N)++;
-			}
+			collision_nearest->time = time;
+			// Save collision in thread-local buffer.
+			reb_collision_buffer_add(buffer, *collision_nearest);
 		}
 	}else{		
 		// c is not a leaf node
@@ -332,13 +1341,13 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 		double dy = gb.shifty - c->y;
 		double dz = gb.shiftz - c->z;
 		double r2 = dx*dx + dy*dy + dz*dz;
-		double rp  = p1_r + r->max_radius[1] + 0.86602540378443*c->w;
+		double rp  = p1_r + r->max_radius[1] + 0.86602540378443*c->w + margin;
 		// Check if we need to decent into daughter cells
 		if (r2 < rp*rp ){
 			for (int o=0;o<8;o++){
 				struct reb_treecell* d = c->oct[o];
 				if (d!=NULL){
-					reb_tree_get_nearest_neighbour_in_cell(r, collisions_N, gb,gbunmod,ri,p1_r,nearest_r2,collision_nearest,d);
+					reb_tree_get_nearest_neighbour_in_cell(r, buffer, gb,gbunmod,ri,p1_r,margin,nearest_r2,collision_nearest,d);
 				}
 			}
 		}
@@ -346,7 +1355,93 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 }
 
 
+#ifndef MPI
+static void reb_collision_resolve_hardsphere_parallel(struct reb_simulation* const r, const int collisions_N){
+	if (collisions_N==0) return;
+	const int N = r->N;
+	const struct reb_collision* const collisions = r->collisions;
+	int* const lastset = calloc(N,sizeof(int));
+	int* const set = malloc(sizeof(int)*collisions_N);
+	int Nsets = 0;
+	for (int i=0;i<collisions_N;i++){
+		const int p1 = collisions[i].p1;
+		const int p2 = collisions[i].p2;
+		const int s = 1 + (lastset[p1]>lastset[p2]?lastset[p1]:lastset[p2]);
+		lastset[p1] = s;
+		lastset[p2] = s;
+		set[i] = s;
+		if (s>Nsets) Nsets = s;
+	}
+	free(lastset);
+	// Counting sort of collisions by set, keeping the order within each set.
+	int* const start = calloc(Nsets+2,sizeof(int));
+	int* const sorted = malloc(sizeof(int)*collisions_N);
+	for (int i=0;i<collisions_N;i++){
+		start[set[i]+1]++;
+	}
+	for (int s=1;s<=Nsets;s++){
+		start[s+1] += start[s];
+	}
+	for (int i=0;i<collisions_N;i++){
+		sorted[start[set[i]]++] = i;
+	}
+	for (int s=Nsets;s>=1;s--){
+		start[s] = start[s-1];
+	}
+	// Momentum exchange is summed up afterwards in the original order.
+	double* const plog = calloc(collisions_N,sizeof(double));
+	long Nlog = 0;
+	for (int s=1;s<=Nsets;s++){
+		const int k0 = start[s];
+		const int k1 = start[s+1];
+#pragma omp parallel for reduction(+:Nlog)
+		for (int k=k0;k<k1;k++){
+			const int i = sorted[k];
+			reb_collision_resolve_hardsphere_log(r, collisions[i], &plog[i], &Nlog);
+		}
+	}
+	for (int i=0;i<collisions_N;i++){
+		r->collisions_plog += plog[i];
+	}
+	r->collisions_Nlog += Nlog;
+	free(plog);
+	free(sorted);
+	free(start);
+	free(set);
+}
+#endif // MPI
+
+void reb_collision_relative_states(struct reb_simulation* const r, const struct reb_collision* const collisions, const int N, double* const dxv){
+	const struct reb_particle* const particles = r->particles;
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<N;i++){
+		const struct reb_collision c = collisions[i];
+		const struct reb_particle p1 = particles[c.p1];
+		struct reb_particle p2;
+#ifdef MPI
+		if (reb_communication_mpi_rootbox_is_local(r, c.ri)==1){
+			p2 = particles[c.p2];
+		}else{
+			p2 = r->particles_recv[r->mpi_root_owner[c.ri]][c.p2];
+		}
+#else // MPI
+		p2 = particles[c.p2];
+#endif // MPI
+		double* const d = &(dxv[6*i]);
+		d[0] = p1.x  + c.gb.shiftx  - p2.x;
+		d[1] = p1.y  + c.gb.shifty  - p2.y;
+		d[2] = p1.z  + c.gb.shiftz  - p2.z;
+		d[3] = p1.vx + c.gb.shiftvx - p2.vx;
+		d[4] = p1.vy + c.gb.shiftvy - p2.vy;
+		d[5] = p1.vz + c.gb.shiftvz - p2.vz;
+	}
+}
+
 int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_collision c){
+	return reb_collision_resolve_hardsphere_log(r, c, &r->collisions_plog, &r->collisions_Nlog);
+}
+
+static int reb_collision_resolve_hardsphere_log(struct reb_simulation* const r, struct reb_collision c, double* plog, long* Nlog){
 	struct reb_particle* const particles = r->particles;
 	struct reb_particle p1 = particles[c.p1];
 	struct reb_particle p2;
@@ -357,8 +1452,7 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
 		p2 = particles[c.p2];
 #ifdef MPI
 	}else{
-		int root_n_per_node = r->root_n/r->mpi_num;
-		int proc_id = c.ri/root_n_per_node;
+		int proc_id = r->mpi_root_owner[c.ri];
 		p2 = r->particles_recv[proc_id][c.p2];
 	}
 #endif // MPI
@@ -368,16 +1462,25 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
 	double y21  = p1.y + gb.shifty  - p2.y; 
 	double z21  = p1.z + gb.shiftz  - p2.z; 
 	double rp   = p1.r+p2.r;
+	double vx21 = p1.vx + gb.shiftvx - p2.vx; 
+	double vy21 = p1.vy + gb.shiftvy - p2.vy; 
+	double vz21 = p1.vz + gb.shiftvz - p2.vz; 
+	// Time since impact (only non-zero for swept collision detection)
+	const double dt_impact = r->collision_swept?(r->t - c.time):0.;
+	if (dt_impact>0.){
+		// Move particles back to the point of impact
+		x21 -= dt_impact*vx21;
+		y21 -= dt_impact*vy21;
+		z21 -= dt_impact*vz21;
+	}else{
+		if (rp*rp < x21*x21 + y21*y21 + z21*z21) return 0;
+	}
 	double oldvyouter;
 	if (x21>0){
 	 	oldvyouter = p1.vy;
 	}else{
 		oldvyouter = p2.vy;
 	}
-	if (rp*rp < x21*x21 + y21*y21 + z21*z21) return 0;
-	double vx21 = p1.vx + gb.shiftvx - p2.vx; 
-	double vy21 = p1.vy + gb.shiftvy - p2.vy; 
-	double vz21 = p1.vz + gb.shiftvz - p2.vz; 
 	if (vx21*x21 + vy21*y21 + vz21*z21 >0) return 0; // not approaching
 	// Bring the to balls in the xy plane.
 	// NOTE: this could probabely be an atan (which is faster than atan2)
@@ -421,6 +1524,12 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
 	particles[c.p2].vx -=	p2pf*dvx2n;
 	particles[c.p2].vy -=	p2pf*dvy2nn;
 	particles[c.p2].vz -=	p2pf*dvz2nn;
+	if (dt_impact>0.){
+		// Move particle from the point of impact with the new velocity
+		particles[c.p2].x -=	p2pf*dvx2n*dt_impact;
+		particles[c.p2].y -=	p2pf*dvy2nn*dt_impact;
+		particles[c.p2].z -=	p2pf*dvz2nn*dt_impact;
+	}
 	particles[c.p2].lastcollision = r->t;
 #ifdef MPI
 	}
@@ -429,15 +1538,20 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
 	particles[c.p1].vx +=	p1pf*dvx2n; 
 	particles[c.p1].vy +=	p1pf*dvy2nn; 
 	particles[c.p1].vz +=	p1pf*dvz2nn; 
+	if (dt_impact>0.){
+		particles[c.p1].x +=	p1pf*dvx2n*dt_impact; 
+		particles[c.p1].y +=	p1pf*dvy2nn*dt_impact; 
+		particles[c.p1].z +=	p1pf*dvz2nn*dt_impact; 
+	}
 	particles[c.p1].lastcollision = r->t;
 		
 	// Return y-momentum change
 	if (x21>0){
-		r->collisions_plog += -fabs(x21)*(oldvyouter-particles[c.p1].vy) * p1.m;
-		r->collisions_Nlog ++;
+		*plog += -fabs(x21)*(oldvyouter-particles[c.p1].vy) * p1.m;
+		(*Nlog)++;
 	}else{
-		r->collisions_plog += -fabs(x21)*(oldvyouter-particles[c.p2].vy) * p2.m;
-		r->collisions_Nlog ++;
+		*plog += -fabs(x21)*(oldvyouter-particles[c.p2].vy) * p2.m;
+		(*Nlog)++;
 	}
     return 0;
 }
@@ -463,9 +1577,11 @@ int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_colli
                 
     double invmass = 1.0/(pi->m + pj->m);
     
-    //Scale out energy from collision - initial energy
-    double Ei=0, Ef=0;
-    if(r->track_energy_offset) Ei = reb_tools_energy(r);
+    //Scale out energy from collision - initial energy of the two particles
+    double dE = 0.;
+    if(r->track_energy_offset){
+        dE = reb_particle_energy_contribution(r, j, -1) + reb_particle_energy_contribution(r, i, j);
+    }
     
     // Merge by conserving mass, volume and momentum
     pi->vx = (pi->vx*pi->m + pj->vx*pj->m)*invmass;
@@ -478,32 +1594,9 @@ int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_colli
     pi->r  = pow(pow(pi->r,3.)+pow(pj->r,3.),1./3.);
     pi->lastcollision = r->t;
     
-    //Scale out energy from collision - final energy
+    //Scale out energy from collision - final energy (j is the particle that will be removed but hasn't yet)
     if(r->track_energy_offset){
-        Ef = r->energy_offset;
-        const int N = r->N;
-        const int N_var = r->N_var;
-        const int _N_active = ((r->N_active==-1)?N:r->N_active) - N_var;
-        int N_interact = (r->testparticle_type==0)?_N_active:(N-N_var);
-        const struct reb_particle* restrict const particles = r->particles;
-        for (int k=0;k<N_interact;k++){
-            if(k==j) continue;      //j is the particle that will be removed but hasn't yet
-            struct reb_particle pk = particles[k];
-            Ef += 0.5 * pk.m * (pk.vx*pk.vx + pk.vy*pk.vy + pk.vz*pk.vz);
-        }
-        for (int k=0;k<_N_active;k++){
-            if(k==j) continue;
-            struct reb_particle pk = particles[k];
-            for (int l=k+1;l<N_interact;l++){
-                if(l==j)continue;
-                struct reb_particle pl = particles[l];
-                double dx = pl.x - pk.x;
-                double dy = pl.y - pk.y;
-                double dz = pl.z - pk.z;
-                Ef -= r->G*pk.m*pl.m/sqrt(dx*dx + dy*dy + dz*dz);
-            }
-        }
-        r->energy_offset += Ei - Ef;
+        r->energy_offset += dE - reb_particle_energy_contribution(r, i, j);
     }
     
     // If hermes calculate energy offset in global - hasn't been removed from global yet
@@ -29,4 +29,91 @@
  */
 void reb_collision_search(struct reb_simulation* const r);
 
+/**
+ * @brief Updates the neighbour list used if collision_verlet_skin is set after the particles i and j have been swapped.
+ * @details Called by the tree code when it moves particles. Does nothing if there is no neighbour list.
+ */
+void reb_collision_verlet_list_swap(struct reb_simulation* const r, const int i, const int j);
+
+/**
+ * @brief Frees the neighbour list used if collision_verlet_skin is set.
+ */
+void reb_collision_verlet_list_free(struct reb_simulation* const r);
+
+/**
+ * @brief Neighbour candidate found by one thread while building the Verlet list.
+ */
+struct reb_collision_verlet_candidate {
+	int p1;     ///< Index of the first particle
+	int p2;     ///< Index of the other particle
+};
+
+/**
+ * @brief Prepares the neighbour list to be filled during the gravity calculation (see collision_fused).
+ * @details Stores the current positions in the neighbour list. The search distance is
+ * collision_verlet_skin or, if not set, the distance particles travel in two timesteps. 
+ * The collision search after the timestep checks whether the particles have moved too 
+ * far and queries the tree again only in that case.
+ * @param r REBOUND simulation to work on.
+ * @param skin Set to the additional search distance.
+ * @return 1 if the neighbour list should be filled, 0 if collision_fused is not set or not supported.
+ */
+int reb_collision_fused_begin(struct reb_simulation* const r, double* const skin);
+
+/**
+ * @brief Adds all particles in a cell or its daughters which are closer than p1_r+r_j+skin to a thread-local list.
+ * @param r REBOUND simulation to work on.
+ * @param candidates Pointer to thread-local list of candidates.
+ * @param candidates_N Pointer to number of candidates in list.
+ * @param candidates_allocatedN Pointer to size allocated for list.
+ * @param gb (Shifted) position of the particle.
+ * @param i Index of the particle.
+ * @param p1_r Radius of the particle.
+ * @param skin Additional search distance.
+ * @param c Pointer to the cell currently being searched in.
+ */
+void reb_collision_verlet_add_cell(const struct reb_simulation* const r, struct reb_collision_verlet_candidate** candidates, int* candidates_N, int* candidates_allocatedN, const struct reb_ghostbox gb, const int i, const double p1_r, const double skin, const struct reb_treecell* const c);
+
+/**
+ * @brief Sorts the candidates of one particle, starting at index first, and removes duplicates found in more than one ghostbox.
+ */
+void reb_collision_verlet_unique(struct reb_collision_verlet_candidate* const candidates, const int first, int* const candidates_N);
+
+/**
+ * @brief Copies the thread-local candidates to the neighbour list.
+ * @details Must be called by all threads of the parallel region in which the candidates were found.
+ * The candidates of one particle must be stored contiguously.
+ */
+void reb_collision_verlet_assemble(struct reb_simulation* const r, const struct reb_collision_verlet_candidate* const candidates, const int candidates_N);
+
+/**
+ * @brief Returns 1 if particle i is asleep (see sleep_velocity), 0 otherwise.
+ */
+static inline int reb_collision_sleeping(const struct reb_simulation* const r, const int i){
+	return r->sleep_state && i<r->sleep_N && r->sleep_state[i]>=r->sleep_steps;
+}
+
+/**
+ * @brief Puts particles which have been slow for sleep_steps timesteps to sleep and wakes up particles which have been hit.
+ * @details Called after the collisions have been resolved. Does nothing if sleep_velocity is not set.
+ */
+void reb_collision_sleep_update(struct reb_simulation* const r);
+
+/**
+ * @brief Updates the sleep state after the particle at index has been removed.
+ * @details Must be called after r->N has been decreased. Without keepSorted, the particle 
+ * at index r->N is assumed to have been moved to index.
+ */
+void reb_collision_sleep_remove(struct reb_simulation* const r, const int index, const int keepSorted);
+
+/**
+ * @brief Updates the sleep state before all particles flagged in marks are removed by reb_remove_marked().
+ */
+void reb_collision_sleep_remove_marked(struct reb_simulation* const r, const char* const marks, const int keepSorted);
+
+/**
+ * @brief Applies the permutation perm (new index -> old index) to the sleep state.
+ */
+void reb_collision_sleep_reorder(struct reb_simulation* const r, const int* const perm);
+
 #endif // _COLLISIONS_H
@@ -44,90 +44,65 @@
 #include "rebound.h"
 #include "tree.h"
 #include "boundary.h"
+#include "collision.h"
 #include "communication_mpi.h"
 
+int reb_communication_mpi_initialize(int* argc, char*** argv){
+	int initialized;
+	int provided = MPI_THREAD_SINGLE;
+	MPI_Initialized(&initialized);
+	if (!initialized){
+#ifdef OPENMP
+		// MPI is only called from the master thread (see mpi_pipeline).
+		MPI_Init_thread(argc,argv,MPI_THREAD_FUNNELED,&provided);
+#else // OPENMP
+		MPI_Init(argc,argv);
+#endif // OPENMP
+	}else{
+		MPI_Query_thread(&provided);
+	}
+	return provided;
+}
+
 void reb_communication_mpi_init(struct reb_simulation* const r, int argc, char** argv){
-	MPI_Init(&argc,&argv);
+	r->mpi_thread_support = reb_communication_mpi_initialize(&argc,&argv);
 	MPI_Comm_size(MPI_COMM_WORLD,&(r->mpi_num));
 	MPI_Comm_rank(MPI_COMM_WORLD,&(r->mpi_id));
 	
 	
-	// Setup MPI description of the particle structure 
-	int bnum = 0;
-	int blen[5];
-	MPI_Aint indices[5];
-	MPI_Datatype oldtypes[5];
-    {
-        blen[bnum] 	= 12;
-        indices[bnum] 	= 0; 
-        oldtypes[bnum] 	= MPI_DOUBLE;
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&p.c - (char*)&p; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&p.hash - (char*)&p; 
-        oldtypes[bnum] 	= MPI_INT; // hash is a uint32_t, but not all MPI headers seem to have MPI_UINT32_T
-    }
-	bnum++;
-    {
-        struct reb_particle p;
-        blen[bnum] 	= 2; 
-        indices[bnum] 	= (char*)&p.ap - (char*)&p; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= sizeof(struct reb_particle); 
-        oldtypes[bnum] 	= MPI_UB;
-    }
-	bnum++;
-	MPI_Type_struct(bnum, blen, indices, oldtypes, &(r->mpi_particle) );
-	MPI_Type_commit(&(r->mpi_particle)); 
-
-	// Setup MPI description of the cell structure 
-	struct reb_treecell c;
-	bnum = 0;
-    {
-        blen[bnum] 	= 8; 
-#ifdef QUADRUPOLE
-        blen[bnum] 	+= 6;
-#endif // QUADRUPOLE
-        indices[bnum] 	= 0; 
-        oldtypes[bnum] 	= MPI_DOUBLE;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 8; 
-        indices[bnum] 	= (char*)&c.oct - (char*)&c; 
-        oldtypes[bnum] 	= MPI_CHAR;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= (char*)&c.pt - (char*)&c; 
-        oldtypes[bnum] 	= MPI_INT;
-    }
-	bnum++;
-    {
-        blen[bnum] 	= 1; 
-        indices[bnum] 	= sizeof(struct reb_treecell); 
-        oldtypes[bnum] 	= MPI_UB;
-    }
-	bnum++;
-	MPI_Type_struct(bnum, blen, indices, oldtypes, &(r->mpi_cell) );
-	MPI_Type_commit(&(r->mpi_cell)); 
+	// Setup MPI description of the particle wire format and of the 
+	// same fields at their place in struct reb_particle.
+	{
+		struct reb_particle_mpi pw;
+		int blen[2] = {9, 1};
+		MPI_Aint indices[2] = {0, (char*)&pw.hash - (char*)&pw};
+		MPI_Datatype oldtypes[2] = {MPI_DOUBLE, MPI_INT}; // hash is a uint32_t, but not all MPI headers seem to have MPI_UINT32_T
+		MPI_Datatype mpi_particle;
+		MPI_Type_create_struct(2, blen, indices, oldtypes, &mpi_particle);
+		MPI_Type_create_resized(mpi_particle, 0, sizeof(struct reb_particle_mpi), &(r->mpi_particle));
+		MPI_Type_free(&mpi_particle);
+		MPI_Type_commit(&(r->mpi_particle)); 
+	}
+	{
+		struct reb_particle p;
+		int blen[3] = {6, 3, 1};
+		MPI_Aint indices[3] = {0, (char*)&p.m - (char*)&p, (char*)&p.hash - (char*)&p};
+		MPI_Datatype oldtypes[3] = {MPI_DOUBLE, MPI_DOUBLE, MPI_INT};
+		MPI_Datatype mpi_particle;
+		MPI_Type_create_struct(3, blen, indices, oldtypes, &mpi_particle);
+		MPI_Type_create_resized(mpi_particle, 0, sizeof(struct reb_particle), &(r->mpi_particle_recv));
+		MPI_Type_free(&mpi_particle);
+		MPI_Type_commit(&(r->mpi_particle_recv)); 
+	}
 	
+	// Assign contiguous ranges of root boxes to nodes. See reb_mpi_balance().
+	r->mpi_root_owner = malloc(r->root_n*sizeof(int));
+	for (int i=0;i<r->root_n;i++){
+		r->mpi_root_owner[i] = (int)(((long)i*r->mpi_num)/r->root_n);
+	}
+
 	// Prepare send/recv buffers for particles
-	r->particles_send   	= calloc(r->mpi_num,sizeof(struct reb_particle*));
+	r->particles_send   	= calloc(r->mpi_num,sizeof(struct reb_particle_mpi*));
 	r->particles_send_N 	= calloc(r->mpi_num,sizeof(int));
 	r->particles_send_Nmax 	= calloc(r->mpi_num,sizeof(int));
 	r->particles_recv   	= calloc(r->mpi_num,sizeof(struct reb_particle*));
@@ -135,70 +110,259 @@ void reb_communication_mpi_init(struct reb_simulation* const r, int argc, char**
 	r->particles_recv_Nmax 	= calloc(r->mpi_num,sizeof(int));
 
 	// Prepare send/recv buffers for essential tree
-	r->tree_essential_send   	= calloc(r->mpi_num,sizeof(struct reb_treecell*));
+	r->tree_essential_send   	= calloc(r->mpi_num,sizeof(struct reb_treecell_mpi*));
 	r->tree_essential_send_N 	= calloc(r->mpi_num,sizeof(int));
 	r->tree_essential_send_Nmax = calloc(r->mpi_num,sizeof(int));
-	r->tree_essential_recv   	= calloc(r->mpi_num,sizeof(struct reb_treecell*));
+	r->tree_essential_recv   	= calloc(r->mpi_num,sizeof(struct reb_treecell_mpi*));
 	r->tree_essential_recv_N 	= calloc(r->mpi_num,sizeof(int));
 	r->tree_essential_recv_Nmax = calloc(r->mpi_num,sizeof(int));
+	r->tree_essential_cells   	= calloc(r->mpi_num,sizeof(struct reb_treecell*));
+	r->tree_essential_cells_Nmax = calloc(r->mpi_num,sizeof(int));
+	r->tree_essential_recv_requests = malloc(r->mpi_num*sizeof(MPI_Request));
+	r->tree_essential_send_requests = malloc(r->mpi_num*sizeof(MPI_Request));
+	for (int i=0;i<r->mpi_num;i++){
+		r->tree_essential_recv_requests[i] = MPI_REQUEST_NULL;
+		r->tree_essential_send_requests[i] = MPI_REQUEST_NULL;
+	}
 }
 
 int reb_communication_mpi_rootbox_is_local(struct reb_simulation* const r, int i){
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = i/root_n_per_node;
-	if (proc_id != r->mpi_id){
+	if (r->mpi_num==0){
+		// Local simulation, see reb_mpi_init().
+		return 1;
+	}
+	if (r->mpi_root_owner[i] != r->mpi_id){
 		return 0;
 	}else{
 		return 1;
 	}
 }
 
+void reb_mpi_balance(struct reb_simulation* const r){
+	r->mpi_balance_steps = 0;
+	const int root_n = r->root_n;
+	// Number of particles in each root box.
+	long* N_root_local = calloc(root_n,sizeof(long));
+	long* N_root = malloc(root_n*sizeof(long));
+	for (int i=0;i<r->N;i++){
+		N_root_local[reb_get_rootbox_for_particle(r, r->particles[i])]++;
+	}
+	MPI_Allreduce(N_root_local, N_root, root_n, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	long N_total = 0;
+	for (int i=0;i<root_n;i++){
+		N_total += N_root[i];
+	}
+	// Split the root boxes into contiguous ranges. Every node gets at least one 
+	// root box. A root box is added to a range as long as its centre (in terms of 
+	// the cumulative particle number) is below the node's share. All nodes 
+	// use the same numbers and therefore end up with the same assignment.
+	int changed = 0;
+	int root = 0;
+	long N_sum = 0;
+	for (int proc=0; proc<r->mpi_num; proc++){
+		const long N_target = N_total*(proc+1)/r->mpi_num;
+		do{
+			if (r->mpi_root_owner[root]!=proc) changed = 1;
+			r->mpi_root_owner[root] = proc;
+			N_sum += N_root[root];
+			root++;
+		}while(root<root_n-(r->mpi_num-proc-1) && (proc==r->mpi_num-1 || 2*N_sum+N_root[root]<=2*N_target));
+	}
+	free(N_root_local);
+	free(N_root);
+	if (!changed) return;
 
-void reb_communication_mpi_distribute_particles(struct reb_simulation* const r){
-	// Distribute the number of particles to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->particles_send_N, 1, MPI_INT, &(r->particles_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
+	// Send particles to their new nodes.
+	const int tree = (r->tree_root!=NULL);
+	reb_tree_delete(r);
+	for (int i=r->N-1;i>=0;i--){
+		const int proc = r->mpi_root_owner[reb_get_rootbox_for_particle(r, r->particles[i])];
+		if (proc==r->mpi_id) continue;
+		reb_communication_mpi_add_particle_to_send_queue(r, r->particles[i], proc);
+		reb_particle_lookup_table_remove(r, i);
+		(r->N)--;
+		reb_collision_verlet_list_swap(r, i, r->N);
+		r->particles[i] = r->particles[r->N];
+		if (i<r->N){
+			reb_particle_lookup_table_set(r, i);
+		}
 	}
-	// Allocate memory for incoming particles
+	reb_communication_mpi_distribute_particles(r);
+	// Received particles have been added to a new tree. Build the whole tree from scratch.
+	reb_tree_delete(r);
+	if (tree){
+		reb_tree_build(r);
+	}
+}
+
+
+/**
+ * @brief Starts exchanging the contents of per-node send buffers with all other nodes.
+ * @details The counts are exchanged with a single MPI_Alltoall, the data 
+ * itself with non-blocking point to point messages, only between nodes which
+ * have something to send. Receive buffers are grown as needed. The send 
+ * buffers must not be modified until the send requests have completed.
+ * @param send Send buffers (one per node).
+ * @param send_N Number of elements in each send buffer. Set to zero.
+ * @param recv Receive buffers (one per node).
+ * @param recv_N Number of elements received from each node (output).
+ * @param recv_Nmax Space allocated in each receive buffer.
+ * @param send_type MPI datatype of one element in the send buffers (wire format).
+ * @param recv_type MPI datatype of one element in the receive buffers. Needs to have the same type signature as send_type.
+ * @param size Size of one element in the receive buffers in bytes.
+ * @param recv_requests Receive request for each node (output). MPI_REQUEST_NULL if nothing is received.
+ * @param send_requests Send request for each node (output). MPI_REQUEST_NULL if nothing is sent.
+ */
+static void reb_communication_mpi_exchange_start(struct reb_simulation* const r, void** send, int* send_N, void** recv, int* recv_N, int* recv_Nmax, MPI_Datatype send_type, MPI_Datatype recv_type, size_t size, MPI_Request* recv_requests, MPI_Request* send_requests){
+	// Distribute the number of elements to be transferred.
+	MPI_Alltoall(send_N, 1, MPI_INT, recv_N, 1, MPI_INT, MPI_COMM_WORLD);
+	recv_N[r->mpi_id] = 0;
+	// Allocate memory for incoming elements
 	for (int i=0;i<r->mpi_num;i++){
 		if  (i==r->mpi_id) continue;
-		while (r->particles_recv_Nmax[i]<r->particles_recv_N[i]){
-			r->particles_recv_Nmax[i] += 32;
-			r->particles_recv[i] = realloc(r->particles_recv[i],sizeof(struct reb_particle)*r->particles_recv_Nmax[i]);
+		if (recv_Nmax[i]<recv_N[i]){
+			recv_Nmax[i] = recv_N[i]+32;
+			recv[i] = realloc(recv[i],size*recv_Nmax[i]);
 		}
 	}
-
-	// Exchange particles via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
+	// Exchange elements in pairs. Only one message is sent between 
+	// each pair of nodes, so the tag does not need to be unique.
 	for (int i=0;i<r->mpi_num;i++){
+		recv_requests[i] = MPI_REQUEST_NULL;
 		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Irecv(r->particles_recv[i], r->particles_recv_N[i], r->mpi_particle, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
+		if (recv_N[i]==0) continue;
+		MPI_Irecv(recv[i], recv_N[i], recv_type, i, 0, MPI_COMM_WORLD, &(recv_requests[i]));
 	}
-	// Using blocking send call.
 	for (int i=0;i<r->mpi_num;i++){
+		send_requests[i] = MPI_REQUEST_NULL;
 		if (i==r->mpi_id) continue;
-		if (r->particles_send_N[i]==0) continue;
-		MPI_Send(r->particles_send[i], r->particles_send_N[i], r->mpi_particle, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
+		if (send_N[i]==0) continue;
+		MPI_Isend(send[i], send_N[i], send_type, i, 0, MPI_COMM_WORLD, &(send_requests[i]));
 	}
-	// Wait for all particles to be received.
 	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
+		send_N[i] = 0;
 	}
+}
+
+/**
+ * @brief Exchanges the contents of per-node send buffers with all other nodes.
+ * @details Same as reb_communication_mpi_exchange_start() but waits until
+ * all elements have been sent and received.
+ */
+static void reb_communication_mpi_exchange(struct reb_simulation* const r, void** send, int* send_N, void** recv, int* recv_N, int* recv_Nmax, MPI_Datatype send_type, MPI_Datatype recv_type, size_t size){
+	MPI_Request recv_requests[r->mpi_num];
+	MPI_Request send_requests[r->mpi_num];
+	reb_communication_mpi_exchange_start(r, send, send_N, recv, recv_N, recv_Nmax, send_type, recv_type, size, recv_requests, send_requests);
+	MPI_Waitall(r->mpi_num, recv_requests, MPI_STATUSES_IGNORE);
+	MPI_Waitall(r->mpi_num, send_requests, MPI_STATUSES_IGNORE);
+}
+
+/**
+ * @brief Sets up the MPI datatype for essential tree cells.
+ * @details Higher order multipole moments are only part of the wire format 
+ * if they are used (see multipole_order). Cells are sent and received in 
+ * the wire format. The datatype needs to be freed by the caller.
+ * @param cell_type Datatype for struct reb_treecell_mpi (output).
+ */
+static void reb_communication_mpi_cell_type(struct reb_simulation* const r, MPI_Datatype* cell_type){
+	int Nmp = 0;
+	if (r->multipole_order>=2) Nmp += 6;	// quadrupole
+	if (r->multipole_order>=3) Nmp += 10;	// octupole
+	struct reb_treecell_mpi cw;
+	int blen[3] = {8, Nmp, 1};
+	MPI_Aint indices[3] = {0, (char*)&cw.mp - (char*)&cw, (char*)&cw.pt - (char*)&cw};
+	MPI_Datatype oldtypes[3] = {MPI_DOUBLE, MPI_DOUBLE, MPI_INT};
+	MPI_Datatype mpi_cell;
+	MPI_Type_create_struct(3, blen, indices, oldtypes, &mpi_cell);
+	MPI_Type_create_resized(mpi_cell, 0, sizeof(struct reb_treecell_mpi), cell_type);
+	MPI_Type_free(&mpi_cell);
+	MPI_Type_commit(cell_type);
+}
+
+/**
+ * @brief Adds the cells received from one node to the non-local root boxes.
+ * @details The cells are copied from the wire format to r->tree_essential_cells[proc]. 
+ * Their multipole moments are not copied but point into the receive buffer.
+ */
+static void reb_communication_mpi_add_essential_cells(struct reb_simulation* const r, const int proc){
+	const int N = r->tree_essential_recv_N[proc];
+	if (r->tree_essential_cells_Nmax[proc]<N){
+		r->tree_essential_cells_Nmax[proc] = r->tree_essential_recv_Nmax[proc];
+		r->tree_essential_cells[proc] = realloc(r->tree_essential_cells[proc],sizeof(struct reb_treecell)*r->tree_essential_cells_Nmax[proc]);
+	}
+	for (int j=0;j<N;j++){
+		struct reb_treecell_mpi* const cw = &(r->tree_essential_recv[proc][j]);
+		struct reb_treecell* const c = &(r->tree_essential_cells[proc][j]);
+		c->x  = cw->x;
+		c->y  = cw->y;
+		c->z  = cw->z;
+		c->w  = cw->w;
+		c->m  = cw->m;
+		c->mx = cw->mx;
+		c->my = cw->my;
+		c->mz = cw->mz;
+		c->mp = r->multipole_order>=2?&(cw->mp):NULL;
+		c->pt = cw->pt;
+		reb_tree_add_essential_node(r, c);
+	}
+	r->tree_essential_recv_N[proc] = 0;
+}
+
+/**
+ * @brief Copies the cell data needed by other nodes into the wire format.
+ */
+static void reb_communication_mpi_add_cell_to_send_queue(struct reb_simulation* const r, struct reb_treecell* node, int proc){
+	if (r->tree_essential_send_N[proc]>=r->tree_essential_send_Nmax[proc]){
+		r->tree_essential_send_Nmax[proc] += 32;
+		r->tree_essential_send[proc] = realloc(r->tree_essential_send[proc],sizeof(struct reb_treecell_mpi)*r->tree_essential_send_Nmax[proc]);
+	}
+	struct reb_treecell_mpi* const cw = &(r->tree_essential_send[proc][r->tree_essential_send_N[proc]]);
+	cw->x  = node->x;
+	cw->y  = node->y;
+	cw->z  = node->z;
+	cw->w  = node->w;
+	cw->m  = node->m;
+	cw->mx = node->mx;
+	cw->my = node->my;
+	cw->mz = node->mz;
+	if (r->multipole_order>=2){
+		cw->mp = *(node->mp);
+	}
+	cw->pt = node->pt;
+	r->tree_essential_send_N[proc]++;
+}
+
+/**
+ * @brief Copies the particle data needed by other nodes into the wire format.
+ */
+static void reb_communication_mpi_pack_particle(struct reb_particle_mpi* const pw, const struct reb_particle* const p){
+	pw->x  = p->x;
+	pw->y  = p->y;
+	pw->z  = p->z;
+	pw->vx = p->vx;
+	pw->vy = p->vy;
+	pw->vz = p->vz;
+	pw->m  = p->m;
+	pw->r  = p->r;
+	pw->lastcollision = p->lastcollision;
+	pw->hash = p->hash;
+}
+
+void reb_communication_mpi_distribute_particles(struct reb_simulation* const r){
+	reb_communication_mpi_exchange(r, (void**)r->particles_send, r->particles_send_N, (void**)r->particles_recv, r->particles_recv_N, r->particles_recv_Nmax, r->mpi_particle, r->mpi_particle_recv, sizeof(struct reb_particle));
 	// Add particles to local tree
 	for (int i=0;i<r->mpi_num;i++){
 		for (int j=0;j<r->particles_recv_N[i];j++){
-			reb_add(r,r->particles_recv[i][j]);
+			// Fields which are not part of the wire format.
+			struct reb_particle p = r->particles_recv[i][j];
+			p.ax = 0.;
+			p.ay = 0.;
+			p.az = 0.;
+			p.c = NULL;
+			p.ap = NULL;
+			p.sim = r;
+			reb_add(r,p);
 		}
-	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
-	for (int i=0;i<r->mpi_num;i++){
-		r->particles_send_N[i] = 0;
 		r->particles_recv_N[i] = 0;
 	}
 }
@@ -207,9 +371,9 @@ void reb_communication_mpi_add_particle_to_send_queue(struct reb_simulation* con
 	int send_N = r->particles_send_N[proc_id];
 	while (r->particles_send_Nmax[proc_id] <= send_N){
 		r->particles_send_Nmax[proc_id] += 128;
-		r->particles_send[proc_id] = realloc(r->particles_send[proc_id],sizeof(struct reb_particle)*r->particles_send_Nmax[proc_id]);
+		r->particles_send[proc_id] = realloc(r->particles_send[proc_id],sizeof(struct reb_particle_mpi)*r->particles_send_Nmax[proc_id]);
 	}
-	r->particles_send[proc_id][send_N] = pt;
+	reb_communication_mpi_pack_particle(&(r->particles_send[proc_id][send_N]), &pt);
 	r->particles_send_N[proc_id]++;
 }
 
@@ -241,12 +405,16 @@ struct reb_aabb communication_boundingbox_for_root(struct reb_simulation* const
 }
 
 struct reb_aabb reb_communication_boundingbox_for_proc(struct reb_simulation* const r, int proc_id){
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int root_start = proc_id*root_n_per_node;
-	int root_stop  = (proc_id+1)*root_n_per_node;
-	struct reb_aabb boundingbox = communication_boundingbox_for_root(r, root_start);
-	for (int i=root_start+1;i<root_stop;i++){
+	struct reb_aabb boundingbox = {0};
+	int first = 1;
+	for (int i=0;i<r->root_n;i++){
+		if (r->mpi_root_owner[i]!=proc_id) continue;
 		struct reb_aabb boundingbox2 = communication_boundingbox_for_root(r,i);
+		if (first){
+			boundingbox = boundingbox2;
+			first = 0;
+			continue;
+		}
 		if (boundingbox.xmin > boundingbox2.xmin) boundingbox.xmin = boundingbox2.xmin;
 		if (boundingbox.ymin > boundingbox2.ymin) boundingbox.ymin = boundingbox2.ymin;
 		if (boundingbox.zmin > boundingbox2.zmin) boundingbox.zmin = boundingbox2.zmin;
@@ -273,43 +441,42 @@ double reb_communication_distance2_of_proc_to_node(struct reb_simulation* const
 	int nghostzcol = (r->nghostz>0?1:0);
 	double distance2 = r->root_size*(double)r->root_n; // A conservative estimate for the minimum distance.
 	distance2 *= distance2;
-	for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
-	for (int gby=-nghostycol; gby<=nghostycol; gby++){
-	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-		struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-		struct reb_aabb boundingbox = reb_communication_boundingbox_for_proc(r, proc_id);
-		boundingbox.xmin+=gb.shiftx;
-		boundingbox.xmax+=gb.shiftx;
-		boundingbox.ymin+=gb.shifty;
-		boundingbox.ymax+=gb.shifty;
-		boundingbox.zmin+=gb.shiftz;
-		boundingbox.zmax+=gb.shiftz;
-		// calculate distance
-		double distance2new = reb_communication_distance2_of_aabb_to_cell(boundingbox,node);
-		if (distance2 > distance2new) distance2 = distance2new;
-	}
-	}
+	// The root boxes of a node do not necessarily form a box. Use the closest one.
+	for (int i=0;i<r->root_n;i++){
+		if (r->mpi_root_owner[i]!=proc_id) continue;
+		const struct reb_aabb rootbox = communication_boundingbox_for_root(r, i);
+		for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+		for (int gby=-nghostycol; gby<=nghostycol; gby++){
+		for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+			struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			struct reb_aabb boundingbox = rootbox;
+			boundingbox.xmin+=gb.shiftx;
+			boundingbox.xmax+=gb.shiftx;
+			boundingbox.ymin+=gb.shifty;
+			boundingbox.ymax+=gb.shifty;
+			boundingbox.zmin+=gb.shiftz;
+			boundingbox.zmax+=gb.shiftz;
+			// calculate distance
+			double distance2new = reb_communication_distance2_of_aabb_to_cell(boundingbox,node);
+			if (distance2 > distance2new) distance2 = distance2new;
+		}
+		}
+		}
 	}
 	return distance2;
 }
 
 void reb_communication_mpi_prepare_essential_cell_for_collisions_for_proc(struct reb_simulation* const r, struct reb_treecell* node, int proc){
 	// Add essential cell to tree_essential_send
-	if (r->tree_essential_send_N[proc]>=r->tree_essential_send_Nmax[proc]){
-		r->tree_essential_send_Nmax[proc] += 32;
-		r->tree_essential_send[proc] = realloc(r->tree_essential_send[proc],sizeof(struct reb_treecell)*r->tree_essential_send_Nmax[proc]);
-	}
-	// Copy node to send buffer
-	r->tree_essential_send[proc][r->tree_essential_send_N[proc]] = (*node);
-	r->tree_essential_send_N[proc]++;
+	reb_communication_mpi_add_cell_to_send_queue(r, node, proc);
 	if (node->pt>=0){ // Is leaf
 		// Also transmit particle (Here could be another check if the particle actually overlaps with the other box)
 		if (r->particles_send_N[proc]>=r->particles_send_Nmax[proc]){
 			r->particles_send_Nmax[proc] += 32;
-			r->particles_send[proc] = realloc(r->particles_send[proc],sizeof(struct reb_treecell)*r->particles_send_Nmax[proc]);
+			r->particles_send[proc] = realloc(r->particles_send[proc],sizeof(struct reb_particle_mpi)*r->particles_send_Nmax[proc]);
 		}
 		// Copy particle to send buffer
-		r->particles_send[proc][r->particles_send_N[proc]] = r->particles[node->pt];
+		reb_communication_mpi_pack_particle(&(r->particles_send[proc][r->particles_send_N[proc]]), &(r->particles[node->pt]));
 		// Update reference from cell to particle
 		r->tree_essential_send[proc][r->tree_essential_send_N[proc]-1].pt = r->particles_send_N[proc];
 		r->particles_send_N[proc]++;
@@ -337,13 +504,7 @@ void reb_communication_mpi_prepare_essential_tree_for_collisions(struct reb_simu
 
 void reb_communication_mpi_prepare_essential_cell_for_gravity_for_proc(struct reb_simulation* const r, struct reb_treecell* node, int proc){
 	// Add essential cell to tree_essential_send
-	if (r->tree_essential_send_N[proc]>=r->tree_essential_send_Nmax[proc]){
-		r->tree_essential_send_Nmax[proc] += 32;
-		r->tree_essential_send[proc] = realloc(r->tree_essential_send[proc],sizeof(struct reb_treecell)*r->tree_essential_send_Nmax[proc]);
-	}
-	// Copy node to send buffer
-	r->tree_essential_send[proc][r->tree_essential_send_N[proc]] = (*node);
-	r->tree_essential_send_N[proc]++;
+	reb_communication_mpi_add_cell_to_send_queue(r, node, proc);
 	if (node->pt<0){		// Not a leaf. Check if we need to transfer daughters.
 		double width = node->w;
 		double distance2 = reb_communication_distance2_of_proc_to_node(r, proc,node);
@@ -369,152 +530,63 @@ void reb_communication_mpi_prepare_essential_tree_for_gravity(struct reb_simulat
 
 void reb_communication_mpi_distribute_essential_tree_for_gravity(struct reb_simulation* const r){
 	///////////////////////////////////////////////////////////////
-	// Distribute essential tree needed for gravity and collisions
+	// Distribute essential tree needed for gravity 
 	///////////////////////////////////////////////////////////////
-	
-	// Distribute the number of cells to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->tree_essential_send_N, 1, MPI_INT, &(r->tree_essential_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming tree_essential
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->tree_essential_recv_Nmax[i]<r->tree_essential_recv_N[i]){
-			r->tree_essential_recv_Nmax[i] += 32;
-			r->tree_essential_recv[i] = realloc(r->tree_essential_recv[i],sizeof(struct reb_treecell)*r->tree_essential_recv_Nmax[i]);
-		}
-	}
-	
-	// Exchange tree_essential via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Irecv(r->tree_essential_recv[i], r->tree_essential_recv_N[i], r->mpi_cell, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_send_N[i]==0) continue;
-		MPI_Send(r->tree_essential_send[i], r->tree_essential_send_N[i], r->mpi_cell, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all tree_essential to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	MPI_Datatype cell_type;
+	reb_communication_mpi_cell_type(r, &cell_type);
+	reb_communication_mpi_exchange(r, (void**)r->tree_essential_send, r->tree_essential_send_N, (void**)r->tree_essential_recv, r->tree_essential_recv_N, r->tree_essential_recv_Nmax, cell_type, cell_type, sizeof(struct reb_treecell_mpi));
+	MPI_Type_free(&cell_type);
 	// Add tree_essential to local tree
 	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		for (int j=0;j<r->tree_essential_recv_N[i];j++){
-			reb_tree_add_essential_node(r, &(r->tree_essential_recv[i][j]));
-		}
+		reb_communication_mpi_add_essential_cells(r, i);
 	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
-	for (int i=0;i<r->mpi_num;i++){
-		r->tree_essential_send_N[i] = 0;
-		r->tree_essential_recv_N[i] = 0;
+}
+
+void reb_communication_mpi_start_essential_tree_for_gravity(struct reb_simulation* const r){
+	// The datatypes are only released by MPI once the pending messages have completed.
+	MPI_Datatype cell_type;
+	reb_communication_mpi_cell_type(r, &cell_type);
+	reb_communication_mpi_exchange_start(r, (void**)r->tree_essential_send, r->tree_essential_send_N, (void**)r->tree_essential_recv, r->tree_essential_recv_N, r->tree_essential_recv_Nmax, cell_type, cell_type, sizeof(struct reb_treecell_mpi), r->tree_essential_recv_requests, r->tree_essential_send_requests);
+	MPI_Type_free(&cell_type);
+	r->tree_essential_pending = 1;
+}
+
+int reb_communication_mpi_wait_essential_tree_for_gravity(struct reb_simulation* const r){
+	if (r->tree_essential_pending==0){
+		return -1;
+	}
+	int proc;
+	MPI_Waitany(r->mpi_num, r->tree_essential_recv_requests, &proc, MPI_STATUS_IGNORE);
+	if (proc==MPI_UNDEFINED){
+		// All cells received. Send buffers can be reused once our messages are out.
+		MPI_Waitall(r->mpi_num, r->tree_essential_send_requests, MPI_STATUSES_IGNORE);
+		r->tree_essential_pending = 0;
+		return -1;
 	}
+	// Add tree_essential to local tree
+	reb_communication_mpi_add_essential_cells(r, proc);
+	return proc;
 }
 
 void reb_communication_mpi_distribute_essential_tree_for_collisions(struct reb_simulation* const r){
 	///////////////////////////////////////////////////////////////
 	// Distribute essential tree needed for gravity and collisions
 	///////////////////////////////////////////////////////////////
-	
-	// Distribute the number of cells to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->tree_essential_send_N, 1, MPI_INT, &(r->tree_essential_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming tree_essential
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->tree_essential_recv_Nmax[i]<r->tree_essential_recv_N[i]){
-			r->tree_essential_recv_Nmax[i] += 32;
-			r->tree_essential_recv[i] = realloc(r->tree_essential_recv[i],sizeof(struct reb_treecell)*r->tree_essential_recv_Nmax[i]);
-		}
-	}
-
-	// Exchange tree_essential via MPI.
-	// Using non-blocking receive call.
-	MPI_Request request[r->mpi_num];
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Irecv(r->tree_essential_recv[i], r->tree_essential_recv_N[i], r->mpi_cell, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_send_N[i]==0) continue;
-		MPI_Send(r->tree_essential_send[i], r->tree_essential_send_N[i], r->mpi_cell, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all tree_essential to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->tree_essential_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	MPI_Datatype cell_type;
+	reb_communication_mpi_cell_type(r, &cell_type);
+	reb_communication_mpi_exchange(r, (void**)r->tree_essential_send, r->tree_essential_send_N, (void**)r->tree_essential_recv, r->tree_essential_recv_N, r->tree_essential_recv_Nmax, cell_type, cell_type, sizeof(struct reb_treecell_mpi));
+	MPI_Type_free(&cell_type);
 	// Add tree_essential to local tree
 	for (int i=0;i<r->mpi_num;i++){
-		for (int j=0;j<r->tree_essential_recv_N[i];j++){
-			reb_tree_add_essential_node(r, &(r->tree_essential_recv[i][j]));
-		}
-	}
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
-	for (int i=0;i<r->mpi_num;i++){
-		r->tree_essential_send_N[i] = 0;
-		r->tree_essential_recv_N[i] = 0;
+		reb_communication_mpi_add_essential_cells(r, i);
 	}
 
 	//////////////////////////////////////////////////////
 	// Distribute particles needed for collisiosn search 
 	//////////////////////////////////////////////////////
-	
-	// Distribute the number of particles to be transferred.
-	for (int i=0;i<r->mpi_num;i++){
-		MPI_Scatter(r->particles_send_N, 1, MPI_INT, &(r->particles_recv_N[i]), 1, MPI_INT, i, MPI_COMM_WORLD);
-	}
-	// Allocate memory for incoming particles
-	for (int i=0;i<r->mpi_num;i++){
-		if  (i==r->mpi_id) continue;
-		while (r->particles_recv_Nmax[i]<r->particles_recv_N[i]){
-			r->particles_recv_Nmax[i] += 32;
-			r->particles_recv[i] = realloc(r->particles_recv[i],sizeof(struct reb_particle)*r->particles_recv_Nmax[i]);
-		}
-	}
-	
-	// Exchange particles via MPI.
-	// Using non-blocking receive call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Irecv(r->particles_recv[i], r->particles_recv_N[i], r->mpi_particle, i, i*r->mpi_num+r->mpi_id, MPI_COMM_WORLD, &(request[i]));
-	}
-	// Using blocking send call.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_send_N[i]==0) continue;
-		MPI_Send(r->particles_send[i], r->particles_send_N[i], r->mpi_particle, i, r->mpi_id*r->mpi_num+i, MPI_COMM_WORLD);
-	}
-	// Wait for all particles to be received.
-	for (int i=0;i<r->mpi_num;i++){
-		if (i==r->mpi_id) continue;
-		if (r->particles_recv_N[i]==0) continue;
-		MPI_Status status;
-		MPI_Wait(&(request[i]), &status);
-	}
+	reb_communication_mpi_exchange(r, (void**)r->particles_send, r->particles_send_N, (void**)r->particles_recv, r->particles_recv_N, r->particles_recv_Nmax, r->mpi_particle, r->mpi_particle_recv, sizeof(struct reb_particle));
 	// No need to add particles to tree as reference already set.
-	// Bring everybody into sync, clean up. 
-	MPI_Barrier(MPI_COMM_WORLD);
 	for (int i=0;i<r->mpi_num;i++){
-		r->particles_send_N[i] = 0;
 		r->particles_recv_N[i] = 0;
 	}
 }
@@ -38,7 +38,45 @@
 #ifndef _COMMUNICATION_MPI_H
 #define _COMMUNICATION_MPI_H
 #ifdef MPI
+#include <stdint.h>
 #include "mpi.h"
+#include "tree.h"
+
+/**
+ * @brief Wire format of a particle sent to another node.
+ * @details Only contains the fields a remote node needs for gravity, collisions 
+ * and when taking over the particle. Pointers and accelerations are not sent.
+ */
+struct reb_particle_mpi {
+    double x;               ///< x-position of the particle. 
+    double y;               ///< y-position of the particle. 
+    double z;               ///< z-position of the particle. 
+    double vx;              ///< x-velocity of the particle. 
+    double vy;              ///< y-velocity of the particle. 
+    double vz;              ///< z-velocity of the particle. 
+    double m;               ///< Mass of the particle. 
+    double r;               ///< Radius of the particle. 
+    double lastcollision;   ///< Last time the particle had a physical collision.
+    uint32_t hash;          ///< hash to identify particle.
+};
+
+/**
+ * @brief Wire format of an essential tree cell sent to another node.
+ * @details The higher order multipole moments are only sent if they are 
+ * used (see multipole_order). Pointers to daughter cells are not sent.
+ */
+struct reb_treecell_mpi {
+    double x;   ///< The x position of the center of the cell
+    double y;   ///< The y position of the center of the cell
+    double z;   ///< The z position of the center of the cell
+    double w;   ///< The width of the cell
+    double m;   ///< The total mass of the cell
+    double mx;  ///< The x position of the center of mass of the cell
+    double my;  ///< The y position of the center of mass of the cell
+    double mz;  ///< The z position of the center of mass of the cell
+    struct reb_treecell_multipoles mp; ///< Higher order multipole moments of the cell
+    int pt;     ///< Same as in reb_treecell. For leaves, the index in the particle buffer sent along with the cells.
+};
 
 /**
  * \defgroup mpistructures Data structures for MPI comminication.
@@ -53,6 +91,15 @@
  */
 
 
+/**
+ * Initializes MPI if this has not been done yet. With OpenMP, MPI_THREAD_FUNNELED
+ * thread support is requested.
+ * @param argc Pointer to the number of command line arguments (can be NULL).
+ * @param argv Pointer to the command line arguments (can be NULL).
+ * @return The level of thread support provided by MPI.
+ */
+int reb_communication_mpi_initialize(int* argc, char*** argv);
+
 /**
  * Initializes MPI and sets up all necessary data structures.
  * @param argc Number of command line arguments. 
@@ -87,6 +134,20 @@ int  reb_communication_mpi_rootbox_is_local(struct reb_simulation* const r, int
  */
 void reb_communication_mpi_distribute_essential_tree_for_gravity(struct reb_simulation* const r);
 
+/**
+ * Starts sending the cells in buffer tree_essential_send to the corresponding nodes 
+ * without waiting for them to arrive. Use reb_communication_mpi_wait_essential_tree_for_gravity()
+ * to complete the exchange.
+ */
+void reb_communication_mpi_start_essential_tree_for_gravity(struct reb_simulation* const r);
+
+/**
+ * Waits until the cells of one more node have arrived and adds them to the 
+ * non-local root boxes of that node.
+ * @return The id of the node, or -1 once the exchange is complete.
+ */
+int reb_communication_mpi_wait_essential_tree_for_gravity(struct reb_simulation* const r);
+
 /**
  * Prepares the essential tree of a root box for communication with other nodes.
  * @param root The root cell under investigation.
@@ -32,29 +32,70 @@
 #include "tools.h"
 #include "derivatives.h"
 
+/**
+ * @brief Quantities shared by all derivatives with respect to the Pal (2009) elements.
+ */
+struct reb_derivatives_pal_state {
+    double a, lambda, k, h, ix, iy; ///< Elements
+    double p, q;                    ///< Solution of the Kepler equation, see reb_tools_solve_kepler_pal()
+    double slp, clp;                ///< sin(lambda+p), cos(lambda+p)
+    double sqrt_1mhk;               ///< sqrt(1-h^2-k^2)
+    double iz;                      ///< sqrt(|4-ix^2-iy^2|)
+};
+
+static void reb_derivatives_pal_state_init(const double G, const struct reb_particle primary, const struct reb_particle po, struct reb_derivatives_pal_state* const s){
+    reb_tools_particle_to_pal(G, po, primary, &s->a, &s->lambda, &s->k, &s->h, &s->ix, &s->iy);
+    s->p = 0.;
+    s->q = 0.;
+    reb_tools_solve_kepler_pal(s->h, s->k, s->lambda, &s->p, &s->q);
+    s->slp = sin(s->lambda+s->p);
+    s->clp = cos(s->lambda+s->p);
+    s->sqrt_1mhk = sqrt(1.-s->h*s->h-s->k*s->k);
+    s->iz = sqrt(fabs(4.-s->ix*s->ix-s->iy*s->iy));
+}
 
-
-struct reb_particle reb_derivatives_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+/**
+ * @brief Quantities shared by all derivatives with respect to the classical orbital elements.
+ */
+struct reb_derivatives_orbit_state {
+    struct reb_orbit o;             ///< Orbital elements
+    double cf, sf;                  ///< cos(f), sin(f)
+    double co, so;                  ///< cos(omega), sin(omega)
+    double cO, sO;                  ///< cos(Omega), sin(Omega)
+    double ci, si;                  ///< cos(inc), sin(inc)
+};
+
+static void reb_derivatives_orbit_state_init(const double G, const struct reb_particle primary, const struct reb_particle po, struct reb_derivatives_orbit_state* const s){
+    s->o = reb_tools_particle_to_orbit(G, po, primary);
+    s->cf = cos(s->o.f);
+    s->sf = sin(s->o.f);
+    s->co = cos(s->o.omega);
+    s->so = sin(s->o.omega);
+    s->cO = cos(s->o.Omega);
+    s->sO = sin(s->o.Omega);
+    s->ci = cos(s->o.inc);
+    s->si = sin(s->o.inc);
+}
+
+static struct reb_particle reb_derivatives_pal_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
 
     np.x = dxi_dlambda+0.5*iy*dW_dlambda;
@@ -74,26 +115,24 @@ struct reb_particle reb_derivatives_lambda(double G, struct reb_particle primary
     return np;
 }
 
-struct reb_particle reb_derivatives_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_h(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
 
     np.x = dxi_dh+0.5*iy*dW_dh;
@@ -116,26 +155,24 @@ struct reb_particle reb_derivatives_h(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
 
     np.x = dxi_dk+0.5*iy*dW_dk;
@@ -158,22 +195,20 @@ struct reb_particle reb_derivatives_k(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k_k(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
-    double dl_dkk = 1./sqrt(1.-h*h-k*k) + (k*k)/(sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k));
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
+    double dl_dkk = 1./s->sqrt_1mhk + (k*k)/(s->sqrt_1mhk*s->sqrt_1mhk*s->sqrt_1mhk);
     double dp_dk = 1./(1.-q)*(slp);
     double dq_dk = 1./(1.-q)*(clp-k);
     double dp_dkk = dq_dk/((1.-q)*(1.-q))*(slp) + 1./(1.-q)*(dslp_dk);
@@ -185,7 +220,7 @@ struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, s
     double deta_dkk = a*(dslp_dkk - dp_dkk/(2.-l)*k - dl_dk*dp_dk/((2.-l)*(2.-l))*k - dp_dk/(2.-l) - dp_dk/(2.-l) - dl_dk*p/((2.-l)*(2.-l)) 
                 - dp_dk/((2.-l)*(2.-l))*dl_dk*k - 2.*dl_dk*p/((2.-l)*(2.-l)*(2.-l))*dl_dk*k - p/((2.-l)*(2.-l))*dl_dkk*k - p/((2.-l)*(2.-l))*dl_dk);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dkk = deta_dkk*ix-dxi_dkk*iy;
 
     np.x = dxi_dkk+0.5*iy*dW_dkk;
@@ -212,22 +247,20 @@ struct reb_particle reb_derivatives_k_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_h_h(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
-    double dl_dhh = 1./sqrt(1.-h*h-k*k) + (h*h)/(sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k));
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
+    double dl_dhh = 1./s->sqrt_1mhk + (h*h)/(s->sqrt_1mhk*s->sqrt_1mhk*s->sqrt_1mhk);
     double dp_dh = 1./(1.-q)*(-clp);
     double dq_dh = 1./(1.-q)*(slp-h);
     double dq_dhh = 1./((1.-q)*(1.-q))*dq_dh*(slp-h) + 1./(1.-q)*(dslp_dh-1);
@@ -239,7 +272,7 @@ struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, s
         + (dp_dh/((2.-l)*(2.-l))*dl_dh*h + 2.*p/((2.-l)*(2.-l)*(2.-l))*dl_dh*dl_dh*h + p/((2.-l)*(2.-l))*dl_dhh*h + p/((2.-l)*(2.-l))*dl_dh));
     double deta_dhh = a*(dslp_dhh + (-dp_dhh/(2.-l)*k - dl_dh*dp_dh/((2.-l)*(2.-l))*k) +(- dp_dh/((2.-l)*(2.-l))*k*dl_dh - 2.*p/((2.-l)*(2.-l)*(2.-l))*k*dl_dh*dl_dh- p/((2.-l)*(2.-l))*k*dl_dhh ));
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dhh = deta_dhh*ix-dxi_dhh*iy;
 
     np.x = dxi_dhh+0.5*iy*dW_dhh;
@@ -267,31 +300,29 @@ struct reb_particle reb_derivatives_h_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_lambda_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
     double dq_dlambdalambda = -dp_dlambda/(1.-q) - p/((1.-q)*(1.-q))*dq_dlambda ;
     double dp_dlambdalambda = dq_dlambda/(1.-q) + q/((1.-q)*(1.-q))*dq_dlambda ;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     double dclp_dlambdalambda = -1./((1.-q)*(1.-q))*dq_dlambda*slp -1./(1.-q)*dslp_dlambda;
     double dslp_dlambdalambda = 1./((1.-q)*(1.-q))*dq_dlambda*clp + 1./(1.-q)*dclp_dlambda;    
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_dlambdalambda = a*(dclp_dlambdalambda + dp_dlambdalambda/(2.-l)*h);
     double deta_dlambdalambda = a*(dslp_dlambdalambda - dp_dlambdalambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dlambdalambda = deta_dlambdalambda*ix-dxi_dlambdalambda*iy;
 
     np.x = dxi_dlambdalambda+0.5*iy*dW_dlambdalambda;
@@ -314,23 +345,21 @@ struct reb_particle reb_derivatives_lambda_lambda(double G, struct reb_particle
     return np;
 }
 
-struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dq_dk = 1./(1.-q)*(clp-k);
     double dq_dlambda = -p/(1.-q);
@@ -344,7 +373,7 @@ struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle prima
     double dxi_dklambda = a*(dclp_dklambda + dp_dklambda/(2.-l)*h + dp_dlambda/((2.-l)*(2.-l))*dl_dk*h);
     double deta_dklambda = a*(dslp_dklambda - dp_dklambda/(2.-l)*k - dp_dlambda/(2.-l) - dp_dlambda/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dklambda = deta_dklambda*ix-dxi_dklambda*iy;
 
     np.x = dxi_dklambda+0.5*iy*dW_dklambda;
@@ -369,23 +398,21 @@ struct reb_particle reb_derivatives_k_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_h_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dq_dh = 1./(1.-q)*(slp-h);
     double dq_dlambda = -p/(1.-q);
@@ -398,7 +425,7 @@ struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle prima
     double dxi_dhlambda = a*(dclp_dhlambda + dp_dhlambda/(2.-l)*h + dp_dlambda/(2.-l) + dp_dlambda/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dhlambda = a*(dslp_dhlambda - dp_dhlambda/(2.-l)*k - dp_dlambda/((2.-l)*(2.-l))*k*dl_dh);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dhlambda = deta_dhlambda*ix-dxi_dhlambda*iy;
 
     np.x = dxi_dhlambda+0.5*iy*dW_dhlambda;
@@ -423,29 +450,27 @@ struct reb_particle reb_derivatives_h_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k_h(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dq_dh = 1./(1.-q)*(slp-h);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dq_dk = 1./(1.-q)*(clp-k);
-    double dl_dkh = k*h/(sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k)*sqrt(1.-h*h-k*k));
+    double dl_dkh = k*h/(s->sqrt_1mhk*s->sqrt_1mhk*s->sqrt_1mhk);
     double dp_dkh = 1./((1.-q)*(1.-q))*dq_dh*(slp) + 1./(1.-q)*(dslp_dh);
     double dq_dkh = 1./((1.-q)*(1.-q))*dq_dh*(clp-k) + 1./(1.-q)*(dclp_dh);
     double dclp_dkh = -1./((1.-q)*(1.-q))*dq_dh*(slp*slp) -2./(1.-q)*(slp*dslp_dh);
@@ -456,7 +481,7 @@ struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, s
     double deta_dkh = a*(dslp_dkh - dp_dkh/(2.-l)*k - dl_dh*dp_dk/((2.-l)*(2.-l))*k - dp_dh/(2.-l)- dl_dh*p/((2.-l)*(2.-l)) 
                 - dp_dh/((2.-l)*(2.-l))*dl_dk*k - p/((2.-l)*(2.-l))*dl_dkh*k - 2.*p/((2.-l)*(2.-l)*(2.-l))*dl_dk*dl_dh*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dkh = deta_dkh*ix-dxi_dkh*iy;
 
     np.x = dxi_dkh+0.5*iy*dW_dkh;
@@ -483,23 +508,21 @@ struct reb_particle reb_derivatives_k_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_da = clp + p/(2.-l)*h -k;
     double deta_da = slp - p/(2.-l)*k -h;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_da = deta_da*ix-dxi_da*iy;
 
     np.x = dxi_da+0.5*iy*dW_da;
@@ -518,23 +541,21 @@ struct reb_particle reb_derivatives_a(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_a_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_a(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_daa = 0.0;//clp + p/(2.-l)*h -k;
     double deta_daa = 0.0;//slp - p/(2.-l)*k -h;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_daa = deta_daa*ix-dxi_daa*iy;
 
     np.x = dxi_daa+0.5*iy*dW_daa;
@@ -553,23 +574,21 @@ struct reb_particle reb_derivatives_a_a(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
     double W = eta*ix-xi*iy;
     double dW_dix = eta;
 
@@ -590,18 +609,16 @@ struct reb_particle reb_derivatives_ix(double G, struct reb_particle primary, st
     return np;
 }
 
-struct reb_particle reb_derivatives_ix_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_ix_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
@@ -630,23 +647,21 @@ struct reb_particle reb_derivatives_ix_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
     double W = eta*ix-xi*iy;
     double dW_diy = -xi;
 
@@ -667,24 +682,22 @@ struct reb_particle reb_derivatives_iy(double G, struct reb_particle primary, st
     return np;
 }
 
-struct reb_particle reb_derivatives_iy_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_iy_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    //double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diyiy = -1./sqrt(fabs(4.-ix*ix-iy*iy)) -iy*iy/( sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy)) );
+    //double iz = s->iz;
+    double diz_diy = -iy/s->iz;
+    double diz_diyiy = -1./s->iz -iy*iy/( s->iz*s->iz*s->iz );
     double W = eta*ix-xi*iy;
     double dW_diy = -xi;
     double dW_diyiy = 0.0;
@@ -707,27 +720,25 @@ struct reb_particle reb_derivatives_iy_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_k_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
     double dW_dkix = deta_dk;
 
@@ -752,27 +763,25 @@ struct reb_particle reb_derivatives_k_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_h_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_h_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
     double dW_dhix = deta_dh;
 
@@ -797,28 +806,26 @@ struct reb_particle reb_derivatives_h_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_lambda_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
     double dW_dlambdaix = deta_dlambda;
 
@@ -840,28 +847,26 @@ struct reb_particle reb_derivatives_lambda_ix(double G, struct reb_particle prim
     return np;
 }
 
-struct reb_particle reb_derivatives_lambda_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_lambda_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_dlambda = a*(dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dlambda = a*(dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
     double dW_dlambda = deta_dlambda*ix-dxi_dlambda*iy;
     double dW_dlambdaiy = -dxi_dlambda;
     np.x = 0.5*dW_dlambda+0.5*iy*dW_dlambdaiy;
@@ -882,27 +887,25 @@ struct reb_particle reb_derivatives_lambda_iy(double G, struct reb_particle prim
     return np;
 }
 
-struct reb_particle reb_derivatives_h_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_h_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dh = a*(dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dh = a*(dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
     double dW_dh = deta_dh*ix-dxi_dh*iy;
     double dW_dhiy = -dxi_dh;
     np.x = 0.5*dW_dh+0.5*iy*dW_dhiy;
@@ -925,27 +928,25 @@ struct reb_particle reb_derivatives_h_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_k_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_k_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dk = a*(dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dk = a*(dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
     double dW_dk = deta_dk*ix-dxi_dk*iy;
     double dW_dkiy = -dxi_dk;
     np.x = 0.5*dW_dk+0.5*iy*dW_dkiy;
@@ -968,25 +969,23 @@ struct reb_particle reb_derivatives_k_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_ix_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_ix_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double xi = a*(clp + p/(2.-l)*h -k);
     double eta = a*(slp - p/(2.-l)*k -h);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dixiy = -ix*iy/(sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy))*sqrt(fabs(4.-ix*ix-iy*iy)));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
+    double diz_diy = -iy/s->iz;
+    double diz_dixiy = -ix*iy/(s->iz*s->iz*s->iz);
     double W = eta*ix-xi*iy;
     double dW_dix = eta;
     double dW_diy = -xi;
@@ -1010,21 +1009,19 @@ struct reb_particle reb_derivatives_ix_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_a_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double deta_da = (slp - p/(2.-l)*k -h);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
     double dW_daix = deta_da;
     double dxi_da = clp + p/(2.-l)*h -k;
     double dW_da = deta_da*ix-dxi_da*iy;
@@ -1046,21 +1043,19 @@ struct reb_particle reb_derivatives_a_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_a_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
     double dxi_da = clp + p/(2.-l)*h -k;
     double deta_da = slp - p/(2.-l)*k -h;
     double dW_da = deta_da*ix-dxi_da*iy;
@@ -1083,27 +1078,25 @@ struct reb_particle reb_derivatives_a_iy(double G, struct reb_particle primary,
 }
 
 
-struct reb_particle reb_derivatives_a_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
 
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
     double dp_dlambda = q/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double l = 1.-s->sqrt_1mhk;
     double dxi_dalambda = (dclp_dlambda + dp_dlambda/(2.-l)*h);
     double deta_dalambda = (dslp_dlambda - dp_dlambda/(2.-l)*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dalambda = deta_dalambda*ix-dxi_dalambda*iy;
 
     np.x = dxi_dalambda+0.5*iy*dW_dalambda;
@@ -1123,26 +1116,24 @@ struct reb_particle reb_derivatives_a_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_a_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_h(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
     double dp_dh = 1./(1.-q)*(-clp);
     double dxi_dah = (dclp_dh + dp_dh/(2.-l)*h + p/(2.-l) + p/((2.-l)*(2.-l))*dl_dh*h);
     double deta_dah = (dslp_dh - dp_dh/(2.-l)*k - p/((2.-l)*(2.-l))*k*dl_dh -1);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dah = deta_dah*ix-dxi_dah*iy;
 
     np.x = dxi_dah+0.5*iy*dW_dah;
@@ -1165,26 +1156,24 @@ struct reb_particle reb_derivatives_a_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_a_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_a_k(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
     double dp_dk = 1./(1.-q)*(slp);
     double dxi_dak = (dclp_dk + dp_dk/(2.-l)*h + p/((2.-l)*(2.-l))*dl_dk*h -1);
     double deta_dak = (dslp_dk - dp_dk/(2.-l)*k - p/(2.-l) - p/((2.-l)*(2.-l))*dl_dk*k);
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     double dW_dak = deta_dak*ix-dxi_dak*iy;
 
     np.x = dxi_dak+0.5*iy*dW_dak;
@@ -1207,20 +1196,18 @@ struct reb_particle reb_derivatives_a_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
     np.m = 1.;
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double iz = s->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
@@ -1237,19 +1224,17 @@ struct reb_particle reb_derivatives_m(double G, struct reb_particle primary, str
     return np;
 }
 
-struct reb_particle reb_derivatives_m_a(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_a(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
-    double l = 1.-sqrt(1.-h*h-k*k);
+    double slp = s->slp;
+    double clp = s->clp;
+    double l = 1.-s->sqrt_1mhk;
 
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double iz = s->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
@@ -1266,22 +1251,20 @@ struct reb_particle reb_derivatives_m_a(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_lambda(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_lambda(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double p = s->p, q = s->q;
     double dq_dlambda = -p/(1.-q);
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dlambda = -1./(1.-q)*slp;
     double dslp_dlambda = 1./(1.-q)*clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double iz = s->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1300,21 +1283,19 @@ struct reb_particle reb_derivatives_m_lambda(double G, struct reb_particle prima
     return np;
 }
 
-struct reb_particle reb_derivatives_m_h(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_h(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = s->q;
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dh = -1./(1.-q)*(-slp*clp);
     double dslp_dh = -1./(1.-q)*(clp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dh = 1./sqrt(1.-h*h-k*k)*h;
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dh = 1./s->sqrt_1mhk*h;
+    double iz = s->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1336,21 +1317,19 @@ struct reb_particle reb_derivatives_m_h(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_k(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_k(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = s->q;
+    double slp = s->slp;
+    double clp = s->clp;
     double dclp_dk = -1./(1.-q)*(slp*slp);
     double dslp_dk = -1./(1.-q)*(-slp*clp);
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double dl_dk = 1./sqrt(1.-h*h-k*k)*k;
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double dl_dk = 1./s->sqrt_1mhk*k;
+    double iz = s->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1372,19 +1351,17 @@ struct reb_particle reb_derivatives_m_k(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_m_ix(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_ix(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = s->q;
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_dix = -ix/sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double iz = s->iz;
+    double diz_dix = -ix/s->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1403,19 +1380,17 @@ struct reb_particle reb_derivatives_m_ix(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_m_iy(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_iy(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    const double q = s->q;
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
-    double diz_diy = -iy/sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double iz = s->iz;
+    double diz_diy = -iy/s->iz;
 
     np.x = 0.0;
     np.y = 0.0;
@@ -1434,19 +1409,17 @@ struct reb_particle reb_derivatives_m_iy(double G, struct reb_particle primary,
     return np;
 }
 
-struct reb_particle reb_derivatives_m_m(double G, struct reb_particle primary, struct reb_particle po){
-    double a, lambda, k, h, ix, iy;
-    reb_tools_particle_to_pal(G, po, primary, &a, &lambda, &k, &h, &ix, &iy);
+static struct reb_particle reb_derivatives_pal_m_m(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s){
+    const double a = s->a, k = s->k, h = s->h, ix = s->ix, iy = s->iy;
 
     struct reb_particle np = {0.};
-    double p=0.,q=0.;
-    reb_tools_solve_kepler_pal(h, k, lambda, &p, &q);
+    const double q = s->q;
 
-    double slp = sin(lambda+p);
-    double clp = cos(lambda+p);
+    double slp = s->slp;
+    double clp = s->clp;
     
-    double l = 1.-sqrt(1.-h*h-k*k);
-    double iz = sqrt(fabs(4.-ix*ix-iy*iy));
+    double l = 1.-s->sqrt_1mhk;
+    double iz = s->iz;
     np.x = 0.0;
     np.y = 0.0;
     np.z = 0.0;
@@ -1463,22 +1436,22 @@ struct reb_particle reb_derivatives_m_m(double G, struct reb_particle primary, s
     return np;
 }
 
-struct reb_particle reb_derivatives_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = dr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1497,23 +1470,23 @@ struct reb_particle reb_derivatives_e(double G, struct reb_particle primary, str
 
 
 
-struct reb_particle reb_derivatives_e_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e_e(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double ddr = o.a*2.*(cosf*cosf-1.)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dv0 = o.e*v0/(1.-o.e*o.e); 
     double ddv0 = v0/((o.e*o.e-1.)*(o.e*o.e-1.)) * (2.*o.e*o.e+1.);
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1530,20 +1503,20 @@ struct reb_particle reb_derivatives_e_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_inc(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.x = r*(- sO*(so*cf+co*sf)*dci);
     p.y = r*(+ cO*(so*cf+co*sf)*dci);
@@ -1557,20 +1530,20 @@ struct reb_particle reb_derivatives_inc(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_inc_inc(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ddci = -cos(o.inc);
-    double ddsi = -sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ddci = -s->ci;
+    double ddsi = -s->si;
     
     p.x = r*(- sO*(so*cf+co*sf)*ddci);
     p.y = r*(+ cO*(so*cf+co*sf)*ddci);
@@ -1583,19 +1556,19 @@ struct reb_particle reb_derivatives_inc_inc(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = r*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = r*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1608,19 +1581,19 @@ struct reb_particle reb_derivatives_Omega(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_Omega_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double ddcO = -cos(o.Omega);
-    double ddsO = -sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double ddcO = -s->cO;
+    double ddsO = -s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = r*(ddcO*(co*cf-so*sf) - ddsO*(so*cf+co*sf)*ci);
     p.y = r*(ddsO*(co*cf-so*sf) + ddcO*(so*cf+co*sf)*ci);
@@ -1633,20 +1606,20 @@ struct reb_particle reb_derivatives_Omega_Omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = r*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = r*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1659,20 +1632,20 @@ struct reb_particle reb_derivatives_omega(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_omega_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double ddco = -cos(o.omega);
-    double ddso = -sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double ddco = -s->co;
+    double ddso = -s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = r*(cO*(ddco*cf-ddso*sf) - sO*(ddso*cf+ddco*sf)*ci);
     p.y = r*(sO*(ddco*cf-ddso*sf) + cO*(ddso*cf+ddco*sf)*ci);
@@ -1685,23 +1658,23 @@ struct reb_particle reb_derivatives_omega_omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*sin(o.f);
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
+    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*s->cf)*(1. + o.e*s->cf))*o.e*s->sf;
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = dr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1718,26 +1691,26 @@ struct reb_particle reb_derivatives_f(double G, struct reb_particle primary, str
     return p;
 }
 
-struct reb_particle reb_derivatives_f_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_f_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*sin(o.f);
-    double ddr = 2.*o.a*(1.-o.e*o.e)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)))*o.e*o.e*sin(o.f)*sin(o.f) + o.a*(1.-o.e*o.e)*o.e*cos(o.f)/((1. + o.e*cos(o.f))*(1. + o.e*cos(o.f)));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
+    double dr = o.a*(1.-o.e*o.e)/((1. + o.e*s->cf)*(1. + o.e*s->cf))*o.e*s->sf;
+    double ddr = 2.*o.a*(1.-o.e*o.e)/((1. + o.e*s->cf)*(1. + o.e*s->cf)*(1. + o.e*s->cf))*o.e*o.e*s->sf*s->sf + o.a*(1.-o.e*o.e)*o.e*s->cf/((1. + o.e*s->cf)*(1. + o.e*s->cf));
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ddcf = -cos(o.f);
-    double ddsf = -sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double ddcf = -s->cf;
+    double ddsf = -s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1759,23 +1732,23 @@ struct reb_particle reb_derivatives_f_f(double G, struct reb_particle primary, s
 }
 
 
-struct reb_particle reb_derivatives_a_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_a_e(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double ddr = -(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0_da = -0.5/sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e))*G*(po.m+primary.m)/(o.a*o.a)/(1.-o.e*o.e); 
     
     double dv0_da_de = o.e*dv0_da/(1.-o.e*o.e); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = ddr*(cO*(co*cf-so*sf) - sO*(so*cf+co*sf)*ci);
     p.y = ddr*(sO*(co*cf-so*sf) + cO*(so*cf+co*sf)*ci);
@@ -1792,20 +1765,20 @@ struct reb_particle reb_derivatives_a_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_a_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_a_inc(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double dr = (1.-o.e*o.e)/(1. + o.e*s->cf);
     double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.x = dr*(- sO*(so*cf+co*sf)*dci);
     p.y = dr*(+ cO*(so*cf+co*sf)*dci);
@@ -1818,19 +1791,19 @@ struct reb_particle reb_derivatives_a_inc(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_a_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_a_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double dr = (1.-o.e*o.e)/(1. + o.e*s->cf);
     double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = dr*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = dr*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1841,20 +1814,20 @@ struct reb_particle reb_derivatives_a_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_a_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_a_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double dr = (1.-o.e*o.e)/(1. + o.e*s->cf);
     double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = dr*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1867,23 +1840,23 @@ struct reb_particle reb_derivatives_a_omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_a_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_a_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double dr = (1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double ddr = o.e*sin(o.f)*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
+    double dr = (1.-o.e*o.e)/(1. + o.e*s->cf);
+    double ddr = o.e*s->sf*(1.-o.e*o.e)/(1. + o.e*s->cf)/(1. + o.e*s->cf);
     double dv0 = -0.5/sqrt(o.a*o.a*o.a)*sqrt(G*(po.m+primary.m)/(1.-o.e*o.e));
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(co*dcf-so*dsf) - sO*(so*dcf+co*dsf)*ci);
     p.y = dr*(sO*(co*dcf-so*dsf) + cO*(so*dcf+co*dsf)*ci);
@@ -1900,22 +1873,22 @@ struct reb_particle reb_derivatives_a_f(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_e_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e_inc(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.x = dr*(- sO*(so*cf+co*sf)*dci);
     p.y = dr*(+ cO*(so*cf+co*sf)*dci);
@@ -1933,21 +1906,21 @@ struct reb_particle reb_derivatives_e_inc(double G, struct reb_particle primary,
 }
 
 
-struct reb_particle reb_derivatives_e_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = dr*(dcO*(co*cf-so*sf) - dsO*(so*cf+co*sf)*ci);
     p.y = dr*(dsO*(co*cf-so*sf) + dcO*(so*cf+co*sf)*ci);
@@ -1961,22 +1934,22 @@ struct reb_particle reb_derivatives_e_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_e_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(dco*cf-dso*sf) - sO*(dso*cf+dco*sf)*ci);
     p.y = dr*(sO*(dco*cf-dso*sf) + cO*(dso*cf+dco*sf)*ci);
@@ -1992,25 +1965,25 @@ struct reb_particle reb_derivatives_e_omega(double G, struct reb_particle primar
 
     return p;
 }
-struct reb_particle reb_derivatives_e_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_e_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double cosf = cos(o.f);
+    double cosf = s->cf;
     double dr = -o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.));
-    double ddr = -o.a*(-sin(o.f)*o.e*o.e-sin(o.f))/((cosf*o.e+1.)*(cosf*o.e+1.))
-                -2.*o.e*sin(o.f) * o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
+    double ddr = -o.a*(-s->sf*o.e*o.e-s->sf)/((cosf*o.e+1.)*(cosf*o.e+1.))
+                -2.*o.e*s->sf * o.a*(cosf*o.e*o.e+cosf+2.*o.e)/((cosf*o.e+1.)*(cosf*o.e+1.)*(cosf*o.e+1.));
     double dv0 = sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = dr*(cO*(co*dcf-so*dsf) - sO*(so*dcf+co*dsf)*ci);
     p.y = dr*(sO*(co*dcf-so*dsf) + cO*(so*dcf+co*dsf)*ci);
@@ -2026,20 +1999,20 @@ struct reb_particle reb_derivatives_e_f(double G, struct reb_particle primary, s
     
     return p;
 }
-struct reb_particle reb_derivatives_m_e(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_m_e(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
     double dv0m = 0.5*G/o.a/(1.-o.e*o.e)/sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
     double dv0ea = 0.5*G/o.a/sqrt(G*(po.m+primary.m)/o.a)*o.e/((1.-o.e*o.e)*sqrt(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.vx = dv0ea*((o.e+cf)*(-ci*co*sO - cO*so) - sf*(co*cO - ci*so*sO));
     p.vy = dv0ea*((o.e+cf)*(ci*co*cO - sO*so)  - sf*(co*sO + ci*so*cO));
@@ -2052,19 +2025,19 @@ struct reb_particle reb_derivatives_m_e(double G, struct reb_particle primary, s
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_inc_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
     
     p.x = r*(- dsO*(so*cf+co*sf)*dci);
     p.y = r*(+ dcO*(so*cf+co*sf)*dci);
@@ -2075,20 +2048,20 @@ struct reb_particle reb_derivatives_inc_Omega(double G, struct reb_particle prim
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_inc_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.x = r*(- sO*(dso*cf+dco*sf)*dci);
     p.y = r*(+ cO*(dso*cf+dco*sf)*dci);
@@ -2101,23 +2074,23 @@ struct reb_particle reb_derivatives_inc_omega(double G, struct reb_particle prim
     return p;
 }
 
-struct reb_particle reb_derivatives_inc_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_inc_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
+    double dr = o.e*s->sf*o.a*(1.-o.e*o.e)/(1. + o.e*s->cf)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.x = r*(- sO*(so*dcf+co*dsf)*dci);
     p.y = r*(+ cO*(so*dcf+co*dsf)*dci);
@@ -2134,19 +2107,19 @@ struct reb_particle reb_derivatives_inc_f(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_m_inc(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_m_inc(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
     double dv0 = 0.5/sqrt(po.m+primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double dci = -sin(o.inc);
-    double dsi = cos(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double dci = -s->si;
+    double dsi = s->ci;
     
     p.vx = dv0*((o.e+cf)*(-dci*co*sO) - sf*(- dci*so*sO));
     p.vy = dv0*((o.e+cf)*(dci*co*cO)  - sf*(dci*so*cO));
@@ -2155,19 +2128,19 @@ struct reb_particle reb_derivatives_m_inc(double G, struct reb_particle primary,
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_omega_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = r*(dcO*(dco*cf-dso*sf) - dsO*(dso*cf+dco*sf)*ci);
     p.y = r*(dsO*(dco*cf-dso*sf) + dcO*(dso*cf+dco*sf)*ci);
@@ -2178,22 +2151,22 @@ struct reb_particle reb_derivatives_omega_Omega(double G, struct reb_particle pr
     return p;
 }
 
-struct reb_particle reb_derivatives_Omega_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_Omega_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
+    double dr = o.e*s->sf*o.a*(1.-o.e*o.e)/(1. + o.e*s->cf)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.x = r*(dcO*(co*dcf-so*dsf) - dsO*(so*dcf+co*dsf)*ci);
     p.y = r*(dsO*(co*dcf-so*dsf) + dcO*(so*dcf+co*dsf)*ci);
@@ -2207,18 +2180,18 @@ struct reb_particle reb_derivatives_Omega_f(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_Omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_m_Omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
     double dv0 = 0.5/sqrt(po.m+primary.m)*sqrt(G/o.a/(1.-o.e*o.e)); 
 
-    double dcO = -sin(o.Omega);
-    double dsO = cos(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
+    double dcO = -s->sO;
+    double dsO = s->cO;
+    double co = s->co;
+    double so = s->so;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
     
     p.vx = dv0*((o.e+cf)*(-ci*co*dsO - dcO*so) - sf*(co*dcO - ci*so*dsO));
     p.vy = dv0*((o.e+cf)*(ci*co*dcO - dsO*so)  - sf*(co*dsO + ci*so*dcO));
@@ -2226,23 +2199,23 @@ struct reb_particle reb_derivatives_m_Omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_omega_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
-    double r = o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f));
-    double dr = o.e*sin(o.f)*o.a*(1.-o.e*o.e)/(1. + o.e*cos(o.f))/(1. + o.e*cos(o.f));
+    double r = o.a*(1.-o.e*o.e)/(1. + o.e*s->cf);
+    double dr = o.e*s->sf*o.a*(1.-o.e*o.e)/(1. + o.e*s->cf)/(1. + o.e*s->cf);
     double v0 = sqrt(G*(po.m+primary.m)/o.a/(1.-o.e*o.e)); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.x = r*(cO*(dco*dcf-dso*dsf) - sO*(dso*dcf+dco*dsf)*ci);
     p.y = r*(sO*(dco*dcf-dso*dsf) + cO*(dso*dcf+dco*dsf)*ci);
@@ -2259,19 +2232,19 @@ struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_m_omega(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
     double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(po.m+primary.m); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double dco = -sin(o.omega);
-    double dso = cos(o.omega);
-    double cf = cos(o.f);
-    double sf = sin(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double dco = -s->so;
+    double dso = s->co;
+    double cf = s->cf;
+    double sf = s->sf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.vx = dv0*((o.e+cf)*(-ci*dco*sO - cO*dso) - sf*(dco*cO - ci*dso*sO));
     p.vy = dv0*((o.e+cf)*(ci*dco*cO - sO*dso)  - sf*(dco*sO + ci*dso*cO));
@@ -2280,19 +2253,19 @@ struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primar
     return p;
 }
 
-struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, struct reb_particle po){
-    struct reb_orbit o = reb_tools_particle_to_orbit(G, po, primary);
+static struct reb_particle reb_derivatives_orbit_m_f(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s){
+    const struct reb_orbit o = s->o;
     struct reb_particle p = {0};
     double dv0 = 0.5*sqrt(G/o.a/(1.-o.e*o.e))/sqrt(po.m+primary.m); 
 
-    double cO = cos(o.Omega);
-    double sO = sin(o.Omega);
-    double co = cos(o.omega);
-    double so = sin(o.omega);
-    double dcf = -sin(o.f);
-    double dsf = cos(o.f);
-    double ci = cos(o.inc);
-    double si = sin(o.inc);
+    double cO = s->cO;
+    double sO = s->sO;
+    double co = s->co;
+    double so = s->so;
+    double dcf = -s->sf;
+    double dsf = s->cf;
+    double ci = s->ci;
+    double si = s->si;
     
     p.vx = dv0*(dcf*(-ci*co*sO - cO*so) - dsf*(co*cO - ci*so*sO));
     p.vy = dv0*(dcf*(ci*co*cO - sO*so)  - dsf*(co*sO + ci*so*cO));
@@ -2300,3 +2273,156 @@ struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, s
     
     return p;
 }
+
+// The public functions for one derivative compute the shared quantities and pass them on.
+#define REB_DERIVATIVES_PAL_WRAPPER(NAME) \
+struct reb_particle reb_derivatives_##NAME(double G, struct reb_particle primary, struct reb_particle po){ \
+    struct reb_derivatives_pal_state s; \
+    reb_derivatives_pal_state_init(G, primary, po, &s); \
+    return reb_derivatives_pal_##NAME(G, primary, po, &s); \
+}
+#define REB_DERIVATIVES_ORBIT_WRAPPER(NAME) \
+struct reb_particle reb_derivatives_##NAME(double G, struct reb_particle primary, struct reb_particle po){ \
+    struct reb_derivatives_orbit_state s; \
+    reb_derivatives_orbit_state_init(G, primary, po, &s); \
+    return reb_derivatives_orbit_##NAME(G, primary, po, &s); \
+}
+
+REB_DERIVATIVES_PAL_WRAPPER(lambda)
+REB_DERIVATIVES_PAL_WRAPPER(h)
+REB_DERIVATIVES_PAL_WRAPPER(k)
+REB_DERIVATIVES_PAL_WRAPPER(k_k)
+REB_DERIVATIVES_PAL_WRAPPER(h_h)
+REB_DERIVATIVES_PAL_WRAPPER(lambda_lambda)
+REB_DERIVATIVES_PAL_WRAPPER(k_lambda)
+REB_DERIVATIVES_PAL_WRAPPER(h_lambda)
+REB_DERIVATIVES_PAL_WRAPPER(k_h)
+REB_DERIVATIVES_PAL_WRAPPER(a)
+REB_DERIVATIVES_PAL_WRAPPER(a_a)
+REB_DERIVATIVES_PAL_WRAPPER(ix)
+REB_DERIVATIVES_PAL_WRAPPER(ix_ix)
+REB_DERIVATIVES_PAL_WRAPPER(iy)
+REB_DERIVATIVES_PAL_WRAPPER(iy_iy)
+REB_DERIVATIVES_PAL_WRAPPER(k_ix)
+REB_DERIVATIVES_PAL_WRAPPER(h_ix)
+REB_DERIVATIVES_PAL_WRAPPER(lambda_ix)
+REB_DERIVATIVES_PAL_WRAPPER(lambda_iy)
+REB_DERIVATIVES_PAL_WRAPPER(h_iy)
+REB_DERIVATIVES_PAL_WRAPPER(k_iy)
+REB_DERIVATIVES_PAL_WRAPPER(ix_iy)
+REB_DERIVATIVES_PAL_WRAPPER(a_ix)
+REB_DERIVATIVES_PAL_WRAPPER(a_iy)
+REB_DERIVATIVES_PAL_WRAPPER(a_lambda)
+REB_DERIVATIVES_PAL_WRAPPER(a_h)
+REB_DERIVATIVES_PAL_WRAPPER(a_k)
+REB_DERIVATIVES_PAL_WRAPPER(m)
+REB_DERIVATIVES_PAL_WRAPPER(m_a)
+REB_DERIVATIVES_PAL_WRAPPER(m_lambda)
+REB_DERIVATIVES_PAL_WRAPPER(m_h)
+REB_DERIVATIVES_PAL_WRAPPER(m_k)
+REB_DERIVATIVES_PAL_WRAPPER(m_ix)
+REB_DERIVATIVES_PAL_WRAPPER(m_iy)
+REB_DERIVATIVES_PAL_WRAPPER(m_m)
+
+REB_DERIVATIVES_ORBIT_WRAPPER(e)
+REB_DERIVATIVES_ORBIT_WRAPPER(e_e)
+REB_DERIVATIVES_ORBIT_WRAPPER(inc)
+REB_DERIVATIVES_ORBIT_WRAPPER(inc_inc)
+REB_DERIVATIVES_ORBIT_WRAPPER(Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(Omega_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(omega_omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(f)
+REB_DERIVATIVES_ORBIT_WRAPPER(f_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(a_e)
+REB_DERIVATIVES_ORBIT_WRAPPER(a_inc)
+REB_DERIVATIVES_ORBIT_WRAPPER(a_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(a_omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(a_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(e_inc)
+REB_DERIVATIVES_ORBIT_WRAPPER(e_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(e_omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(e_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(m_e)
+REB_DERIVATIVES_ORBIT_WRAPPER(inc_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(inc_omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(inc_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(m_inc)
+REB_DERIVATIVES_ORBIT_WRAPPER(omega_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(Omega_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(m_Omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(omega_f)
+REB_DERIVATIVES_ORBIT_WRAPPER(m_omega)
+REB_DERIVATIVES_ORBIT_WRAPPER(m_f)
+
+/**
+ * @brief One derivative in the tables of reb_derivatives_all(). Exactly one of the two functions is set.
+ */
+struct reb_derivatives_entry {
+    struct reb_particle (*pal)(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const s);
+    struct reb_particle (*orbit)(const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_orbit_state* const s);
+};
+
+// First derivatives in the order of the elements, see REB_DERIVATIVES_ELEMENTS.
+static const struct reb_derivatives_entry reb_derivatives_first[2][7] = {
+    {{reb_derivatives_pal_m, NULL}, {reb_derivatives_pal_a, NULL}, {reb_derivatives_pal_k, NULL}, {reb_derivatives_pal_h, NULL}, {reb_derivatives_pal_lambda, NULL}, {reb_derivatives_pal_ix, NULL}, {reb_derivatives_pal_iy, NULL}},
+    {{reb_derivatives_pal_m, NULL}, {reb_derivatives_pal_a, NULL}, {NULL, reb_derivatives_orbit_e}, {NULL, reb_derivatives_orbit_inc}, {NULL, reb_derivatives_orbit_omega}, {NULL, reb_derivatives_orbit_Omega}, {NULL, reb_derivatives_orbit_f}},
+};
+
+// Second derivatives (j,k) with j<=k, row by row.
+static const struct reb_derivatives_entry reb_derivatives_second[2][28] = {
+    {
+        {reb_derivatives_pal_m_m, NULL}, {reb_derivatives_pal_m_a, NULL}, {reb_derivatives_pal_m_k, NULL}, {reb_derivatives_pal_m_h, NULL}, {reb_derivatives_pal_m_lambda, NULL}, {reb_derivatives_pal_m_ix, NULL}, {reb_derivatives_pal_m_iy, NULL},
+        {reb_derivatives_pal_a_a, NULL}, {reb_derivatives_pal_a_k, NULL}, {reb_derivatives_pal_a_h, NULL}, {reb_derivatives_pal_a_lambda, NULL}, {reb_derivatives_pal_a_ix, NULL}, {reb_derivatives_pal_a_iy, NULL},
+        {reb_derivatives_pal_k_k, NULL}, {reb_derivatives_pal_k_h, NULL}, {reb_derivatives_pal_k_lambda, NULL}, {reb_derivatives_pal_k_ix, NULL}, {reb_derivatives_pal_k_iy, NULL},
+        {reb_derivatives_pal_h_h, NULL}, {reb_derivatives_pal_h_lambda, NULL}, {reb_derivatives_pal_h_ix, NULL}, {reb_derivatives_pal_h_iy, NULL},
+        {reb_derivatives_pal_lambda_lambda, NULL}, {reb_derivatives_pal_lambda_ix, NULL}, {reb_derivatives_pal_lambda_iy, NULL},
+        {reb_derivatives_pal_ix_ix, NULL}, {reb_derivatives_pal_ix_iy, NULL},
+        {reb_derivatives_pal_iy_iy, NULL},
+    },
+    {
+        {reb_derivatives_pal_m_m, NULL}, {reb_derivatives_pal_m_a, NULL}, {NULL, reb_derivatives_orbit_m_e}, {NULL, reb_derivatives_orbit_m_inc}, {NULL, reb_derivatives_orbit_m_omega}, {NULL, reb_derivatives_orbit_m_Omega}, {NULL, reb_derivatives_orbit_m_f},
+        {reb_derivatives_pal_a_a, NULL}, {NULL, reb_derivatives_orbit_a_e}, {NULL, reb_derivatives_orbit_a_inc}, {NULL, reb_derivatives_orbit_a_omega}, {NULL, reb_derivatives_orbit_a_Omega}, {NULL, reb_derivatives_orbit_a_f},
+        {NULL, reb_derivatives_orbit_e_e}, {NULL, reb_derivatives_orbit_e_inc}, {NULL, reb_derivatives_orbit_e_omega}, {NULL, reb_derivatives_orbit_e_Omega}, {NULL, reb_derivatives_orbit_e_f},
+        {NULL, reb_derivatives_orbit_inc_inc}, {NULL, reb_derivatives_orbit_inc_omega}, {NULL, reb_derivatives_orbit_inc_Omega}, {NULL, reb_derivatives_orbit_inc_f},
+        {NULL, reb_derivatives_orbit_omega_omega}, {NULL, reb_derivatives_orbit_omega_Omega}, {NULL, reb_derivatives_orbit_omega_f},
+        {NULL, reb_derivatives_orbit_Omega_Omega}, {NULL, reb_derivatives_orbit_Omega_f},
+        {NULL, reb_derivatives_orbit_f_f},
+    },
+};
+
+static inline struct reb_particle reb_derivatives_entry_evaluate(const struct reb_derivatives_entry* const e, const double G, const struct reb_particle primary, const struct reb_particle po, const struct reb_derivatives_pal_state* const ps, const struct reb_derivatives_orbit_state* const os){
+    return e->pal?e->pal(G, primary, po, ps):e->orbit(G, primary, po, os);
+}
+
+void reb_derivatives_all(double G, const struct reb_particle* const primaries, const struct reb_particle* const particles, const int N, const enum REB_DERIVATIVES_ELEMENTS elements, struct reb_particle* const first, struct reb_particle* const second){
+    const int set = elements==REB_DERIVATIVES_ORBIT?1:0;
+#pragma omp parallel for schedule(static)
+    for (int i=0;i<N;i++){
+        const struct reb_particle primary = primaries[i];
+        const struct reb_particle po = particles[i];
+        // The derivatives with respect to m and a are the same for both sets of elements 
+        // and only implemented for the Pal elements.
+        struct reb_derivatives_pal_state ps;
+        struct reb_derivatives_orbit_state os;
+        reb_derivatives_pal_state_init(G, primary, po, &ps);
+        if (set==1){
+            reb_derivatives_orbit_state_init(G, primary, po, &os);
+        }
+        if (first){
+            for (int j=0;j<7;j++){
+                first[7*i+j] = reb_derivatives_entry_evaluate(&reb_derivatives_first[set][j], G, primary, po, &ps, &os);
+            }
+        }
+        if (second){
+            int n = 0;
+            for (int j=0;j<7;j++){
+                for (int k=j;k<7;k++){
+                    const struct reb_particle d = reb_derivatives_entry_evaluate(&reb_derivatives_second[set][n++], G, primary, po, &ps, &os);
+                    second[49*i+7*j+k] = d;
+                    second[49*i+7*k+j] = d;
+                }
+            }
+        }
+    }
+}
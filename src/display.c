@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include "rebound.h"
@@ -41,7 +42,16 @@
 #include "display.h"
 #include "output.h"
 #include "integrator.h"
+#include "transformations.h"
+#include "tree.h"
 #define MAX(a, b) ((a) < (b) ? (b) : (a))       ///< Returns the maximum of a and b
+#define MIN(a, b) ((a) > (b) ? (b) : (a))       ///< Returns the minimum of a and b
+#define REB_DISPLAY_ORBITS_PER_FRAME 4096       ///< Maximum number of orbits calculated per frame
+#define REB_DISPLAY_LOD_N 131072                ///< Default maximum number of points drawn
+#define REB_DISPLAY_KEYFRAME_INTERVAL 100       ///< Every n-th frame sent to the widget contains all data
+#define REB_DISPLAY_FRAME_HEADER 32             ///< Size of the header of a widget frame in bytes
+#define REB_DISPLAY_FRAME_EMAX 4.               ///< Range of quantized eccentricities in widget frames
+#define REB_DISPLAY_FRAME_ANGLEMAX (4.*M_PI)    ///< Range of quantized angles in widget frames
 
 #ifdef OPENGL
 #include "simplefont.h"
@@ -74,6 +84,8 @@ static const char* onscreenhelp[] = {
                 " c       | Toggle clear screen after each time-step",
                 " m       | Toggle multisampling",
                 " w       | Draw orbits as wires",
+                " l       | Toggle level of detail (aggregate",
+                "         | particles if N is large)",
                 " t       | Show/hide logo, time, timestep and number ",
                 "         | of particles.",
                 "----------------------------------------------------"
@@ -338,6 +350,11 @@ static void reb_display_keyboard(GLFWwindow* window, int key, int scancode, int
                 break;
             case 'G':
                 data->ghostboxes = !data->ghostboxes;
+                data->dirty = 1;
+                break;
+            case 'L':
+                data->lod_N = data->lod_N?0:REB_DISPLAY_LOD_N;
+                data->dirty = 1;
                 break;
             case 'M':
                 data->multisample = !data->multisample;
@@ -360,6 +377,7 @@ static void reb_display_keyboard(GLFWwindow* window, int key, int scancode, int
                 break;
             case 'W':
                 data->wire = !data->wire;
+                data->dirty = 1;
                 break;
             case 'T':
                 data->onscreentext = !data->onscreentext;
@@ -411,8 +429,8 @@ static void reb_display(GLFWwindow* window){
     float tmp1[16];
     float tmp2[16];
     float tmp3[16];
-    if (data->reference>=0){
-        struct reb_particle p = data->particles_copy[data->reference];
+    if (data->reference>=0 && data->reference<data->N){
+        struct reb_particle_opengl p = data->particle_data[data->reference];
         mattranslate(tmp2,-p.x,-p.y,-p.z);
         quat2mat(data->view,tmp1);
         matmult(tmp1,tmp2,view);
@@ -420,10 +438,12 @@ static void reb_display(GLFWwindow* window){
         quat2mat(data->view,view);
     }
     
+    int n = 0;
     for (int i=-data->ghostboxes*data->r->nghostx;i<=data->ghostboxes*data->r->nghostx;i++){
     for (int j=-data->ghostboxes*data->r->nghosty;j<=data->ghostboxes*data->r->nghosty;j++){
     for (int k=-data->ghostboxes*data->r->nghostz;k<=data->ghostboxes*data->r->nghostz;k++){
-        struct reb_ghostbox gb = reb_boundary_get_ghostbox(data->r_copy, i,j,k);
+        const struct reb_ghostbox gb = (unsigned long)n<data->ghostbox_shifts_allocatedN?data->ghostbox_shifts[n]:(struct reb_ghostbox){0};
+        n++;
         { // Particles
             mattranslate(tmp2,gb.shiftx,gb.shifty,gb.shiftz);
             matmult(view,tmp2,tmp1);
@@ -434,7 +454,7 @@ static void reb_display(GLFWwindow* window){
                 glUseProgram(data->sphere_shader_program);
                 glBindVertexArray(data->sphere_shader_particle_vao);
                 glUniformMatrix4fv(data->sphere_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, data->sphere_shader_vertex_count, data->r_copy->N);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, data->sphere_shader_vertex_count, data->N);
                 glBindVertexArray(0);
                 glDisable(GL_DEPTH_TEST);
             }
@@ -445,7 +465,7 @@ static void reb_display(GLFWwindow* window){
                 glBindVertexArray(data->point_shader_particle_vao);
                 glUniform4f(data->point_shader_color_location, 1.,1.,0.,0.8);
                 glUniformMatrix4fv(data->point_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArrays(GL_POINTS, 0, data->r_copy->N);
+                glDrawArrays(GL_POINTS, 0, data->N);
                 glBindVertexArray(0);
             }
             if (data->wire){
@@ -453,7 +473,7 @@ static void reb_display(GLFWwindow* window){
                 glUseProgram(data->orbit_shader_program);
                 glBindVertexArray(data->orbit_shader_particle_vao);
                 glUniformMatrix4fv(data->orbit_shader_mvp_location, 1, GL_TRUE, (GLfloat*) tmp2);
-                glDrawArraysInstanced(GL_LINE_STRIP, 0, data->orbit_shader_vertex_count, data->r->N-1);
+                glDrawArraysInstanced(GL_LINE_STRIP, 0, data->orbit_shader_vertex_count, MIN(data->N,data->orbit_N)-1);
                 glBindVertexArray(0);
             }
         }
@@ -504,9 +524,9 @@ static void reb_display(GLFWwindow* window){
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, j);
         
-        if (data->r_copy->status == REB_RUNNING){
+        if (data->status == REB_RUNNING){
             sprintf(str, "Simulation is running  ");
-        }else if (data->r_copy->status == REB_RUNNING_PAUSED){
+        }else if (data->status == REB_RUNNING_PAUSED){
             sprintf(str, "Simulation is paused   ");
         }
         glUniform1f(data->simplefont_shader_ypos_location, ypos++);
@@ -520,17 +540,17 @@ static void reb_display(GLFWwindow* window){
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, j);
         
-        sprintf(str, "N = %d ",data->r_copy->N);
+        sprintf(str, "N = %d ",data->N);
         glUniform1f(data->simplefont_shader_ypos_location, ypos++);
         j = convertLine(str,val);
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, j);
         
         glUniform1f(data->simplefont_shader_ypos_location, ypos++);
-        if (data->r_copy->integrator==REB_INTEGRATOR_SEI){
-            sprintf(str, "t = %f [orb]  ", data->r_copy->t*data->r_copy->ri_sei.OMEGA/2./M_PI);
+        if (data->integrator==REB_INTEGRATOR_SEI){
+            sprintf(str, "t = %f [orb]  ", data->t*data->OMEGA/2./M_PI);
         }else{
-            sprintf(str, "t = %f  ", data->r_copy->t);
+            sprintf(str, "t = %f  ", data->t);
         }
         j = convertLine(str,val);
         glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(val), val);
@@ -611,11 +631,6 @@ void reb_display_init(struct reb_simulation * const r){
     data->ghostboxes    = 0; 
     data->reference     = -1;
     data->view.w        = 1.;
-    data->p_h_copy      = NULL;
-    data->p_j_copy      = NULL;
-    data->eta_copy      = NULL;
-    data->allocated_N_whfast = 0;
-    data->allocated_N_whfasthelio = 0;
 
     glfwSetKeyCallback(window,reb_display_keyboard);
     glfwGetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS);
@@ -1006,12 +1021,18 @@ void reb_display_init(struct reb_simulation * const r){
 
     // Main display loop
     while(!glfwWindowShouldClose(window) && r->status<0){
-        // lock mutex for update
+        // lock mutex for update. Nothing is copied if the simulation has not advanced.
+        int size_changed = 0;
         pthread_mutex_lock(&(data->mutex));    
-        int size_changed = reb_display_copy_data(r);
+        if (data->dirty || r->t!=data->t || r->status!=data->status){
+            size_changed = reb_display_copy_data(r);
+            data->dirty = 0;
+        }
         pthread_mutex_unlock(&(data->mutex));  
 
         // prepare data (incl orbit calculation)
+        const int particles_updated = data->back_ready;
+        const int orbit_first = data->orbit_next>0?data->orbit_next:0;
         reb_display_prepare_data(r, data->wire);
 
         // Copy data to GPU
@@ -1021,10 +1042,18 @@ void reb_display_init(struct reb_simulation * const r){
             glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
             glBufferData(GL_ARRAY_BUFFER, data->allocated_N*sizeof(struct reb_orbit_opengl), NULL, GL_STATIC_DRAW);
         }
-        glBindBuffer(GL_ARRAY_BUFFER, particle_buffer);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, data->r_copy->N*sizeof(struct reb_particle_opengl), data->particle_data);
-        glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, (data->r_copy->N-1)*sizeof(struct reb_orbit_opengl), data->orbit_data);
+        // Only data which changed is uploaded
+        if (particles_updated || size_changed){
+            glBindBuffer(GL_ARRAY_BUFFER, particle_buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, data->N*sizeof(struct reb_particle_opengl), data->particle_data);
+        }
+        if (size_changed){
+            glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, MAX(data->orbit_N-1,0)*sizeof(struct reb_orbit_opengl), data->orbit_data);
+        }else if (data->orbit_next>orbit_first){
+            glBindBuffer(GL_ARRAY_BUFFER, orbit_buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, orbit_first*sizeof(struct reb_orbit_opengl), (data->orbit_next-orbit_first)*sizeof(struct reb_orbit_opengl), data->orbit_data+orbit_first);
+        }
 
         // Do actual drawing
         reb_display(window);
@@ -1042,6 +1071,9 @@ void reb_display_init_data(struct reb_simulation* const r){
     if (r->display_data==NULL){
         r->display_data = calloc(sizeof(struct reb_display_data),1);
         r->display_data->r = r;
+        r->display_data->orbits = 1;
+        r->display_data->lod_N = REB_DISPLAY_LOD_N;
+        r->display_data->dirty = 1;
         if (pthread_mutex_init(&(r->display_data->mutex), NULL)){
             reb_error(r,"Mutex creation failed.");
         }
@@ -1062,85 +1094,386 @@ void reb_display_init_data(struct reb_simulation* const r){
     }
 }
 
+// Returns the particles in inertial coordinates. For unsynchronized WHFast and 
+// WHFastHelio simulations positions (and if posvel is set also velocities) are 
+// calculated from the integrator's coordinates without synchronizing the simulation.
+static const struct reb_particle* reb_display_inertial_particles(struct reb_simulation* const r, const int N_real, const int posvel){
+    struct reb_display_data* const data = r->display_data;
+    if (r->integrator==REB_INTEGRATOR_WHFAST && r->ri_whfast.is_synchronized==0 && (int)r->ri_whfast.allocated_N>=N_real){
+        struct reb_particle* const ps = data->particles_inertial;
+        if (posvel){
+            reb_transformations_jacobi_to_inertial_posvel(ps, r->ri_whfast.p_j, r->ri_whfast.eta, r->particles, N_real);
+        }else{
+            reb_transformations_jacobi_to_inertial_pos(ps, r->ri_whfast.p_j, r->ri_whfast.eta, r->particles, N_real);
+        }
+        for (int i=0;i<N_real;i++){
+            ps[i].m = r->particles[i].m;
+            ps[i].r = r->particles[i].r;
+        }
+        return ps;
+    }
+    if (r->integrator==REB_INTEGRATOR_WHFASTHELIO && r->ri_whfasthelio.is_synchronized==0 && (int)r->ri_whfasthelio.allocated_N>=N_real){
+        struct reb_particle* const ps = data->particles_inertial;
+        for (int i=0;i<N_real;i++){
+            ps[i].m = r->particles[i].m;
+            ps[i].r = r->particles[i].r;
+        }
+        if (posvel){
+            reb_transformations_democratic_heliocentric_to_inertial_posvel(ps, r->ri_whfasthelio.p_h, N_real);
+        }else{
+            reb_transformations_democratic_heliocentric_to_inertial_pos(ps, r->ri_whfasthelio.p_h, N_real);
+        }
+        return ps;
+    }
+    return r->particles;
+}
+
+// Fills back with at most N_max points representing all particles. If a tree
+// exists, the tree is opened level by level as long as the number of cells 
+// stays below N_max. Every cell is then drawn at its centre of mass. Without 
+// a tree every k-th particle is drawn. Returns the number of points.
+static int reb_display_copy_lod(struct reb_simulation* const r, struct reb_particle_opengl* const back, const int N_max){
+    const int N_real = r->N - r->N_var;
+    if (r->tree_root==NULL){
+        const int stride = (N_real+N_max-1)/N_max;
+        int n = 0;
+        for (int i=0;i<N_real && n<N_max;i+=stride){
+            const struct reb_particle p = r->particles[i];
+            back[n].x = p.x;
+            back[n].y = p.y;
+            back[n].z = p.z;
+            back[n].r = p.r;
+            n++;
+        }
+        return n;
+    }
+    // Centres of mass are only up to date if the tree is used for gravity.
+    const int com = r->gravity==REB_GRAVITY_TREE;
+    struct reb_treecell** cur = malloc(sizeof(struct reb_treecell*)*N_max);
+    struct reb_treecell** next = malloc(sizeof(struct reb_treecell*)*N_max);
+    int N_cur = 0;
+    for (int i=0;i<r->root_n && N_cur<N_max;i++){
+        if (r->tree_root[i]){
+            cur[N_cur++] = r->tree_root[i];
+        }
+    }
+    while (1){
+        int N_next = 0;
+        int opened = 0;
+        for (int i=0;i<N_cur && N_next<=N_max;i++){
+            struct reb_treecell* const c = cur[i];
+            if (c->pt>=0){ // leaf
+                if (N_next<N_max) next[N_next] = c;
+                N_next++;
+                continue;
+            }
+            opened = 1;
+            for (int o=0;o<8;o++){
+                if (c->oct[o]){
+                    if (N_next<N_max) next[N_next] = c->oct[o];
+                    N_next++;
+                }
+            }
+        }
+        if (!opened || N_next>N_max){
+            break;
+        }
+        struct reb_treecell** const tmp = cur;
+        cur = next;
+        next = tmp;
+        N_cur = N_next;
+    }
+    for (int i=0;i<N_cur;i++){
+        const struct reb_treecell* const c = cur[i];
+        if (c->pt>=0){
+            const struct reb_particle p = r->particles[c->pt];
+            back[i].x = p.x;
+            back[i].y = p.y;
+            back[i].z = p.z;
+            back[i].r = p.r;
+        }else{
+            back[i].x = com?c->mx:c->x;
+            back[i].y = com?c->my:c->y;
+            back[i].z = com?c->mz:c->z;
+            back[i].r = c->w/4.;
+        }
+    }
+    free(cur);
+    free(next);
+    return N_cur;
+}
+
 int reb_display_copy_data(struct reb_simulation* const r){
-    if (r->N==0) return 0;
     struct reb_display_data* data = r->display_data;
+    const int N_real = r->N - r->N_var;
+    const int lod = data->lod_N>0 && N_real>data->lod_N;
+    const int N_points = lod?data->lod_N:N_real;
     int size_changed = 0;
-    if (r->N>data->allocated_N){
+    if (N_points>(int)data->allocated_N){
         size_changed = 1;
-        data->allocated_N = r->N;
-        data->r_copy = realloc(data->r_copy,sizeof(struct reb_simulation));
-        data->particles_copy = realloc(data->particles_copy,r->N*sizeof(struct reb_particle));
+        data->allocated_N = N_points;
         data->particle_data = realloc(data->particle_data, data->allocated_N*sizeof(struct reb_particle_opengl));
+        data->particle_data_back = realloc(data->particle_data_back, data->allocated_N*sizeof(struct reb_particle_opengl));
         data->orbit_data = realloc(data->orbit_data, data->allocated_N*sizeof(struct reb_orbit_opengl));
+        memset(data->orbit_data, 0, data->allocated_N*sizeof(struct reb_orbit_opengl));
+        data->particles_inertial = realloc(data->particles_inertial, data->allocated_N*sizeof(struct reb_particle));
+        data->orbit_state = realloc(data->orbit_state, data->allocated_N*sizeof(double)*7*3);
+    }
+    data->t = r->t;
+    data->OMEGA = r->ri_sei.OMEGA;
+    data->status = r->status;
+    data->integrator = r->integrator;
+    data->back_ready = 1;
+    
+    // Ghost boxes only move with the shearing sheet, but are cheap to recalculate.
+    const int gx = data->ghostboxes*r->nghostx;
+    const int gy = data->ghostboxes*r->nghosty;
+    const int gz = data->ghostboxes*r->nghostz;
+    const unsigned long N_ghostboxes = (2*gx+1)*(2*gy+1)*(2*gz+1);
+    if (N_ghostboxes>data->ghostbox_shifts_allocatedN){
+        data->ghostbox_shifts_allocatedN = N_ghostboxes;
+        data->ghostbox_shifts = realloc(data->ghostbox_shifts, N_ghostboxes*sizeof(struct reb_ghostbox));
+    }
+    int n = 0;
+    for (int i=-gx;i<=gx;i++){
+    for (int j=-gy;j<=gy;j++){
+    for (int k=-gz;k<=gz;k++){
+        data->ghostbox_shifts[n++] = reb_boundary_get_ghostbox(r, i, j, k);
     }
-    memcpy(data->r_copy, r, sizeof(struct reb_simulation));
-    memcpy(data->particles_copy, r->particles, sizeof(struct reb_particle)*r->N);
-    data->r_copy->particles = data->particles_copy;
-    if (r->integrator==REB_INTEGRATOR_WHFAST && r->ri_whfast.is_synchronized==0){
-        if (r->ri_whfast.allocated_N > data->allocated_N_whfast){
-            size_changed = 1;
-            data->allocated_N_whfast = r->ri_whfast.allocated_N;
-            data->p_j_copy = realloc(data->p_j_copy,data->allocated_N_whfast*sizeof(struct reb_particle));
-            data->eta_copy = realloc(data->eta_copy,data->allocated_N_whfast*sizeof(double));
-        }
-        memcpy(data->p_j_copy, r->ri_whfast.p_j, data->allocated_N_whfast*sizeof(struct reb_particle));
-        memcpy(data->eta_copy, r->ri_whfast.eta, data->allocated_N_whfast*sizeof(double));
     }
-    data->r_copy->ri_whfast.p_j= data->p_j_copy;
-    data->r_copy->ri_whfast.eta= data->eta_copy;
-    if (r->integrator==REB_INTEGRATOR_WHFASTHELIO && r->ri_whfasthelio.is_synchronized==0){
-        if (r->ri_whfasthelio.allocated_N > data->allocated_N_whfast){
-            size_changed = 1;
-            data->allocated_N_whfasthelio = r->ri_whfasthelio.allocated_N;
-            data->p_h_copy = realloc(data->p_h_copy,data->allocated_N_whfasthelio*sizeof(struct reb_particle));
+    }
+    if (lod){
+        // Orbits are not drawn for aggregated particles.
+        data->N_back = reb_display_copy_lod(r, data->particle_data_back, data->lod_N);
+        data->orbit_N = 0;
+        data->orbit_next = 0;
+        return size_changed;
+    }
+    data->N_back = N_real;
+    if (N_real==0) return size_changed;
+
+    // Start a new orbit sweep if the previous one is complete. 
+    const int new_sweep = data->orbits && (data->orbit_N<2 || data->orbit_next>=data->orbit_N-1);
+    const struct reb_particle* const ps = reb_display_inertial_particles(r, N_real, new_sweep);
+    struct reb_particle_opengl* const back = data->particle_data_back;
+    for (int i=0;i<N_real;i++){
+        back[i].x = ps[i].x;
+        back[i].y = ps[i].y;
+        back[i].z = ps[i].z;
+        back[i].r = ps[i].r;
+    }
+    if (new_sweep){
+        double* const state = data->orbit_state;
+        for (int i=0;i<N_real;i++){
+            double* const s = state+7*i;
+            s[0] = ps[i].m;  s[1] = ps[i].x;  s[2] = ps[i].y;  s[3] = ps[i].z;
+            s[4] = ps[i].vx; s[5] = ps[i].vy; s[6] = ps[i].vz;
         }
-        memcpy(data->p_h_copy, r->ri_whfasthelio.p_h, data->allocated_N_whfasthelio*sizeof(struct reb_particle));
+        data->orbit_N = N_real;
+        data->orbit_next = -1; // Jacobi primaries not yet calculated
     }
-    data->r_copy->ri_whfasthelio.p_h= data->p_h_copy;
-    
     return size_changed;
 }
 
 void reb_display_prepare_data(struct reb_simulation* const r, int orbits){
-    if (r->N==0) return;
     struct reb_display_data* data = r->display_data;
-    struct reb_simulation* const r_copy = data->r_copy;
-
-    // this only does something for WHFAST + WHFASTHELIO
-    reb_integrator_synchronize(r_copy);
+    data->orbits = orbits;
+
+    // Swap buffers if there is new data
+    if (data->back_ready){
+        struct reb_particle_opengl* const front = data->particle_data_back;
+        data->particle_data_back = data->particle_data;
+        data->particle_data = front;
+        data->N = data->N_back;
+        data->back_ready = 0;
+    }
        
-    // Update data on GPU 
-    for (int i=0;i<r_copy->N;i++){
-        struct reb_particle p = r_copy->particles[i];
-        data->particle_data[i].x  = p.x;
-        data->particle_data[i].y  = p.y;
-        data->particle_data[i].z  = p.z;
-        data->particle_data[i].vx = p.vx;
-        data->particle_data[i].vy = p.vy;
-        data->particle_data[i].vz = p.vz;
-        data->particle_data[i].r  = p.r;
+    if (!orbits || data->orbit_N<2 || data->orbit_next>=data->orbit_N-1){
+        return;
     }
-    if (orbits){
-        struct reb_particle com = r_copy->particles[0];
-        for (int i=1;i<r->N;i++){
-            struct reb_particle p = r_copy->particles[i];
-            data->orbit_data[i-1].x  = com.x;
-            data->orbit_data[i-1].y  = com.y;
-            data->orbit_data[i-1].z  = com.z;
-            struct reb_orbit o = reb_tools_particle_to_orbit(r_copy->G, p,com);
-            data->orbit_data[i-1].a = o.a;
-            data->orbit_data[i-1].e = o.e;
-            data->orbit_data[i-1].f = o.f;
-            data->orbit_data[i-1].omega = o.omega;
-            data->orbit_data[i-1].Omega = o.Omega;
-            data->orbit_data[i-1].inc = o.inc;
+    // Layout of orbit_state: particles (orbit_N rows), Jacobi primaries 
+    // (orbit_N-1 rows), orbital elements (orbit_N-1 rows), all (m,x,y,z,vx,vy,vz).
+    const int N = data->orbit_N-1;
+    double* const ps = data->orbit_state+7;
+    double* const primaries = data->orbit_state+7*data->orbit_N;
+    double* const os = primaries+7*N;
+    if (data->orbit_next<0){
+        struct reb_particle com = {0};
+        const double* const s0 = data->orbit_state;
+        com.m = s0[0];  com.x = s0[1];  com.y = s0[2];  com.z = s0[3];
+        com.vx = s0[4]; com.vy = s0[5]; com.vz = s0[6];
+        for (int i=0;i<N;i++){
+            const double* const pi = ps+7*i;
+            double* const ci = primaries+7*i;
+            ci[0] = com.m; ci[1] = com.x; ci[2] = com.y; ci[3] = com.z;
+            ci[4] = com.vx;ci[5] = com.vy;ci[6] = com.vz;
+            struct reb_particle p = {0};
+            p.m = pi[0];  p.x = pi[1];  p.y = pi[2];  p.z = pi[3];
+            p.vx = pi[4]; p.vy = pi[5]; p.vz = pi[6];
             com = reb_get_com_of_pair(p,com);
         }
+        data->orbit_next = 0;
     }
+    // Only a limited number of orbits is converted per frame.
+    const int i0 = data->orbit_next;
+    const int n = MIN(N-i0, REB_DISPLAY_ORBITS_PER_FRAME);
+    reb_tools_particles_to_orbits(r->G, n, ps+7*i0, primaries+7*i0, n, os+7*i0, NULL);
+    for (int i=i0;i<i0+n;i++){
+        const double* const o = os+7*i;
+        data->orbit_data[i].x  = primaries[7*i+1];
+        data->orbit_data[i].y  = primaries[7*i+2];
+        data->orbit_data[i].z  = primaries[7*i+3];
+        data->orbit_data[i].a = o[1];
+        data->orbit_data[i].e = o[2];
+        data->orbit_data[i].inc = o[3];
+        data->orbit_data[i].Omega = o[4];
+        data->orbit_data[i].omega = o[5];
+        data->orbit_data[i].f = o[6];
+    }
+    data->orbit_next = i0+n;
+}
+
+
+/**
+ * @brief State of one client receiving frames from reb_display_encode_frame().
+ * @details Holds the quantized data of the last frame sent, so that only values 
+ * which changed need to be sent.
+ */
+struct reb_display_encoder {
+    int16_t* q;                 ///< Quantized particles (3 per particle) of the last frame 
+    int16_t* q_orbits;          ///< Quantized orbits (9 per orbit) of the last frame
+    int16_t* q_new;             ///< Scratch space for the current frame
+    int allocated_N;
+    int N;                      ///< Number of particles in the last frame
+    int N_orbits;               ///< Number of orbits in the last frame
+    float qscale;               ///< Positions are quantized as x/qscale*32767
+    unsigned long frames;       ///< Number of frames encoded
+    char* buf;                  ///< The encoded frame
+    size_t buf_allocated;
+};
+
+struct reb_display_encoder* reb_display_encoder_create(void){
+    return calloc(1, sizeof(struct reb_display_encoder));
 }
 
+void reb_display_encoder_free(struct reb_display_encoder* const e){
+    if (e==NULL) return;
+    free(e->q);
+    free(e->q_orbits);
+    free(e->q_new);
+    free(e->buf);
+    free(e);
+}
 
+static int16_t reb_display_quantize(const double x, const double s){
+    const double q = round(x*s);
+    if (q>32767.) return 32767;
+    if (q<-32767.) return -32767;
+    if (q!=q) return 0; // NaN
+    return (int16_t)q;
+}
+
+static size_t reb_display_encode_align(size_t offset){
+    return (offset+3)&~(size_t)3;
+}
+
+// Appends all entries of q_new which differ from q (n values each) to the frame
+// at *offset and updates q. On a keyframe all entries are sent without indices.
+// Returns the number of entries sent.
+static uint32_t reb_display_encode_delta(struct reb_display_encoder* const e, size_t* const offset, int16_t* const q, const int16_t* const q_new, const int N, const int n, const int keyframe){
+    uint32_t changed = 0;
+    if (keyframe){
+        memcpy(e->buf+*offset, q_new, sizeof(int16_t)*n*N);
+        *offset = reb_display_encode_align(*offset+sizeof(int16_t)*n*N);
+        memcpy(q, q_new, sizeof(int16_t)*n*N);
+        return N;
+    }
+    for (int i=0;i<N;i++){
+        if (memcmp(q+n*i, q_new+n*i, sizeof(int16_t)*n)){
+            changed++;
+        }
+    }
+    uint32_t* const idx = (uint32_t*)(e->buf+*offset);
+    int16_t* const values = (int16_t*)(e->buf+*offset+sizeof(uint32_t)*changed);
+    uint32_t k = 0;
+    for (int i=0;i<N;i++){
+        if (memcmp(q+n*i, q_new+n*i, sizeof(int16_t)*n)){
+            idx[k] = i;
+            memcpy(values+n*k, q_new+n*i, sizeof(int16_t)*n);
+            memcpy(q+n*i, q_new+n*i, sizeof(int16_t)*n);
+            k++;
+        }
+    }
+    *offset = reb_display_encode_align(*offset+(sizeof(uint32_t)+sizeof(int16_t)*n)*changed);
+    return changed;
+}
+
+const char* reb_display_encode_frame(struct reb_simulation* const r, struct reb_display_encoder* const e, const double scale, int orbits, size_t* const size){
+    struct reb_display_data* const data = r->display_data;
+    reb_display_copy_data(r);
+    reb_display_prepare_data(r, orbits);
+    const int N = data->N;
+    const int N_orbits = (orbits && data->orbit_N==N && N>1)?N-1:0;
+    const float qscale = 4.*scale;
+    const int keyframe = e->frames%REB_DISPLAY_KEYFRAME_INTERVAL==0 || N!=e->N || N_orbits!=e->N_orbits || qscale!=e->qscale;
+    if (N>e->allocated_N){
+        e->allocated_N = N;
+        e->q = realloc(e->q, sizeof(int16_t)*3*N);
+        e->q_orbits = realloc(e->q_orbits, sizeof(int16_t)*9*N);
+        e->q_new = realloc(e->q_new, sizeof(int16_t)*9*N);
+    }
+    // Worst case: every entry with an index, plus padding.
+    const size_t size_max = REB_DISPLAY_FRAME_HEADER + (sizeof(uint32_t)+sizeof(int16_t)*3)*N + (sizeof(uint32_t)+sizeof(int16_t)*9)*N_orbits + 8;
+    if (size_max>e->buf_allocated){
+        e->buf_allocated = size_max;
+        e->buf = realloc(e->buf, size_max);
+    }
+    const double s = 32767./qscale;
+    for (int i=0;i<N;i++){
+        e->q_new[3*i+0] = reb_display_quantize(data->particle_data[i].x, s);
+        e->q_new[3*i+1] = reb_display_quantize(data->particle_data[i].y, s);
+        e->q_new[3*i+2] = reb_display_quantize(data->particle_data[i].z, s);
+    }
+    size_t offset = REB_DISPLAY_FRAME_HEADER;
+    const uint32_t N_p = reb_display_encode_delta(e, &offset, e->q, e->q_new, N, 3, keyframe);
+    const double se = 32767./REB_DISPLAY_FRAME_EMAX;
+    const double sa = 32767./REB_DISPLAY_FRAME_ANGLEMAX;
+    for (int i=0;i<N_orbits;i++){
+        const struct reb_orbit_opengl o = data->orbit_data[i];
+        int16_t* const q = e->q_new+9*i;
+        q[0] = reb_display_quantize(o.x, s);
+        q[1] = reb_display_quantize(o.y, s);
+        q[2] = reb_display_quantize(o.z, s);
+        q[3] = reb_display_quantize(o.a, s);
+        q[4] = reb_display_quantize(o.e, se);
+        q[5] = reb_display_quantize(o.f, sa);
+        q[6] = reb_display_quantize(o.omega, sa);
+        q[7] = reb_display_quantize(o.Omega, sa);
+        q[8] = reb_display_quantize(o.inc, sa);
+    }
+    const uint32_t N_o = reb_display_encode_delta(e, &offset, e->q_orbits, e->q_new, N_orbits, 9, keyframe);
+
+    // Header
+    const uint32_t flags = keyframe?1:0;
+    const uint32_t N32 = N;
+    const double t = data->t;
+    const uint32_t N_orbits32 = N_orbits;
+    memcpy(e->buf+0, &flags, 4);
+    memcpy(e->buf+4, &N32, 4);
+    memcpy(e->buf+8, &t, 8);
+    memcpy(e->buf+16, &qscale, 4);
+    memcpy(e->buf+20, &N_p, 4);
+    memcpy(e->buf+24, &N_o, 4);
+    memcpy(e->buf+28, &N_orbits32, 4);
+
+    e->N = N;
+    e->N_orbits = N_orbits;
+    e->qscale = qscale;
+    e->frames++;
+    data->frame_size += offset;
+    *size = offset;
+    return e->buf;
+}
 
 void reb_check_for_display_heartbeat(struct reb_simulation* const r){
     if (r->display_heartbeat){                          // Display Heartbeat
@@ -1148,6 +1481,18 @@ void reb_check_for_display_heartbeat(struct reb_simulation* const r){
         gettimeofday(&tim, NULL);
         unsigned long milis = (tim.tv_sec+(tim.tv_usec/1000000.0))*1000;
         if (r->display_clock==0 || (milis - r->display_clock)>25){
+            struct reb_display_data* const data = r->display_data;
+            if (data && data->max_bandwidth>0. && r->display_clock!=0){
+                // Token bucket: wait until the last frames are paid for. About one second of bandwidth can be saved up.
+                const double budget = MIN(data->bandwidth_budget + (milis - r->display_clock)/1000.*data->max_bandwidth, MAX(data->max_bandwidth, (double)data->frame_size));
+                if (budget<(double)data->frame_size){
+                    return;
+                }
+                data->bandwidth_budget = budget - data->frame_size;
+            }
+            if (data){
+                data->frame_size = 0;
+            }
             r->display_clock = milis;
             r->display_heartbeat(r); 
         }
@@ -39,7 +39,55 @@ void reb_check_for_display_heartbeat(struct reb_simulation* const r);
 void reb_display_init(struct reb_simulation* const r);
 
 void reb_display_init_data(struct reb_simulation* const r);
+
+/**
+ * @brief Copies positions and radii into the back buffer of the display data.
+ * @details Needs to be called while the simulation is not running (the mutex is locked).
+ * Only single precision positions and radii are copied. Particle masses and velocities 
+ * are copied only when a new sweep of orbit calculations starts.
+ * @return 1 if the buffers were resized, 0 otherwise.
+ */
 int reb_display_copy_data(struct reb_simulation* const r);
+
+/**
+ * @brief Swaps the particle buffers and, if orbits is set, calculates the next orbits.
+ * @details Can run while the simulation is integrated. At most REB_DISPLAY_ORBITS_PER_FRAME 
+ * orbits are calculated per call.
+ */
 void reb_display_prepare_data(struct reb_simulation* const r, int orbits);
 
+struct reb_display_encoder;
+
+/**
+ * @brief Creates the state needed to send frames to one client (e.g. a Jupyter widget).
+ */
+struct reb_display_encoder* reb_display_encoder_create(void);
+
+/**
+ * @brief Frees an encoder created with reb_display_encoder_create().
+ */
+void reb_display_encoder_free(struct reb_display_encoder* const e);
+
+/**
+ * @brief Copies the current particle data and encodes it into a binary frame.
+ * @details Positions and orbits are quantized to 16 bit integers. Only particles
+ * and orbits whose quantized values changed since the last frame of this encoder 
+ * are sent, except for every REB_DISPLAY_KEYFRAME_INTERVAL-th frame and if the 
+ * number of particles changed. All values are little endian. Layout:
+ *   - Header (32 bytes): uint32 flags (1 = keyframe), uint32 N, float64 t, 
+ *     float32 qscale, uint32 N_p, uint32 N_o, uint32 N_orbits.
+ *   - Unless keyframe: uint32 indices of the N_p particles sent. Then int16 x, y, z 
+ *     of these particles (value*qscale/32767). Padded to 4 bytes.
+ *   - Unless keyframe: uint32 indices of the N_o orbits sent. Then int16 focus x, y, z, a 
+ *     (scaled as positions), e (value*4/32767), f, omega, Omega, inc (value*4*pi/32767). 
+ *     Padded to 4 bytes.
+ * @param r The simulation. reb_display_init_data() needs to be called first.
+ * @param e Encoder of the client.
+ * @param scale Scale of the view. Positions within 4*scale are quantized.
+ * @param orbits If set, orbits are included.
+ * @param size Set to the size of the frame in bytes.
+ * @return Pointer to the frame. It is owned by the encoder and valid until the next call.
+ */
+const char* reb_display_encode_frame(struct reb_simulation* const r, struct reb_display_encoder* const e, const double scale, int orbits, size_t* const size);
+
 #endif
@@ -0,0 +1,399 @@
+/**
+ * @file    ensemble.c
+ * @brief   Integrates many independent small systems with WHFast at once.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details The systems are stored in tiles of REB_ENSEMBLE_LANES systems.
+ * Within a tile, particle i of all systems is stored contiguously, so that
+ * every step of WHFast (Kepler drift, coordinate transformations, kick)
+ * operates on all lanes at once. The Kepler drift uses kepler_step_batch() of
+ * WHFast. Tiles are independent and are distributed over threads with OpenMP.
+ * Each tile is integrated for all timesteps before the next tile is
+ * considered, so the working set stays in cache.
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "integrator_whfast.h"
+#include "ensemble.h"
+
+#define L REB_ENSEMBLE_LANES
+
+void reb_init_ensemble(struct reb_ensemble* const e, const int N_systems, const int N){
+    memset(e, 0, sizeof(struct reb_ensemble));
+    e->G = 1;
+    e->dt = 0.001;
+    e->r = reb_create_simulation();
+    if (N_systems<1 || N<2){
+        reb_error(e->r, "An ensemble needs at least one system and two particles per system.");
+        return;
+    }
+    e->N_systems = N_systems;
+    e->N = N;
+    e->N_tiles = (N_systems+L-1)/L;
+    const size_t N_tot = (size_t)e->N_tiles*N*L;
+    e->particles = calloc(N_tot,sizeof(struct reb_particle));
+    e->p_j = calloc(N_tot,sizeof(struct reb_particle));
+    e->eta = calloc(N_tot,sizeof(double));
+    e->is_set = calloc(N_systems,sizeof(int));
+}
+
+struct reb_ensemble* reb_create_ensemble(const int N_systems, const int N){
+    if (N_systems<1 || N<2){
+        return NULL;
+    }
+    struct reb_ensemble* e = malloc(sizeof(struct reb_ensemble));
+    reb_init_ensemble(e, N_systems, N);
+    return e;
+}
+
+void reb_free_ensemble_pointers(struct reb_ensemble* const e){
+    if (e->r){
+        reb_free_simulation(e->r);
+        e->r = NULL;
+    }
+    free(e->particles);
+    e->particles = NULL;
+    free(e->p_j);
+    e->p_j = NULL;
+    free(e->eta);
+    e->eta = NULL;
+    free(e->is_set);
+    e->is_set = NULL;
+}
+
+void reb_free_ensemble(struct reb_ensemble* const e){
+    if (e==NULL) return;
+    reb_free_ensemble_pointers(e);
+    free(e);
+}
+
+/**
+ * @brief Returns a pointer to particle 0 of system k. Particle i is at offset i*REB_ENSEMBLE_LANES.
+ */
+static struct reb_particle* reb_ensemble_system(const struct reb_ensemble* const e, struct reb_particle* const p, const int k){
+    return p + (size_t)(k/L)*e->N*L + k%L;
+}
+
+void reb_ensemble_set_particles(struct reb_ensemble* const e, const int k, const struct reb_particle* const particles){
+    if (k<0 || k>=e->N_systems){
+        reb_error(e->r, "System index out of range.");
+        return;
+    }
+    struct reb_particle* const p = reb_ensemble_system(e, e->particles, k);
+    for (int i=0;i<e->N;i++){
+        p[i*L] = particles[i];
+        p[i*L].sim = NULL;
+        p[i*L].ap = NULL;
+        p[i*L].c = NULL;
+    }
+    e->is_set[k] = 1;
+}
+
+void reb_ensemble_get_particles(const struct reb_ensemble* const e, const int k, struct reb_particle* const particles){
+    if (k<0 || k>=e->N_systems){
+        reb_error(e->r, "System index out of range.");
+        return;
+    }
+    const struct reb_particle* const p = reb_ensemble_system(e, e->particles, k);
+    for (int i=0;i<e->N;i++){
+        particles[i] = p[i*L];
+    }
+}
+
+/**
+ * @brief Same as reb_transformations_inertial_to_jacobi_posvel() for all lanes of a tile. Also sets eta.
+ */
+static void reb_ensemble_tile_inertial_to_jacobi_posvel(const struct reb_particle* const particles, struct reb_particle* const p_j, double* const eta, const int N){
+    double s_x[L], s_y[L], s_z[L], s_vx[L], s_vy[L], s_vz[L];
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        eta[l] = particles[l].m;
+        p_j[l].m = particles[l].m;
+        s_x[l]  = eta[l] * particles[l].x;
+        s_y[l]  = eta[l] * particles[l].y;
+        s_z[l]  = eta[l] * particles[l].z;
+        s_vx[l] = eta[l] * particles[l].vx;
+        s_vy[l] = eta[l] * particles[l].vy;
+        s_vz[l] = eta[l] * particles[l].vz;
+    }
+    for (int i=1;i<N;i++){
+#pragma omp simd
+        for (int l=0;l<L;l++){
+            const int k = i*L+l;
+            const double m = particles[k].m;
+            eta[k] = eta[k-L] + m;
+            p_j[k].m = m;
+            const double ei = 1./eta[k-L];
+            const double pme = eta[k]*ei;
+            p_j[k].x  = particles[k].x  - s_x[l]*ei;
+            p_j[k].y  = particles[k].y  - s_y[l]*ei;
+            p_j[k].z  = particles[k].z  - s_z[l]*ei;
+            p_j[k].vx = particles[k].vx - s_vx[l]*ei;
+            p_j[k].vy = particles[k].vy - s_vy[l]*ei;
+            p_j[k].vz = particles[k].vz - s_vz[l]*ei;
+            s_x[l]  = s_x[l]  * pme + m*p_j[k].x ;
+            s_y[l]  = s_y[l]  * pme + m*p_j[k].y ;
+            s_z[l]  = s_z[l]  * pme + m*p_j[k].z ;
+            s_vx[l] = s_vx[l] * pme + m*p_j[k].vx;
+            s_vy[l] = s_vy[l] * pme + m*p_j[k].vy;
+            s_vz[l] = s_vz[l] * pme + m*p_j[k].vz;
+        }
+    }
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        const double Mtotali = 1./eta[(N-1)*L+l];
+        p_j[l].x  = s_x[l]  * Mtotali;
+        p_j[l].y  = s_y[l]  * Mtotali;
+        p_j[l].z  = s_z[l]  * Mtotali;
+        p_j[l].vx = s_vx[l] * Mtotali;
+        p_j[l].vy = s_vy[l] * Mtotali;
+        p_j[l].vz = s_vz[l] * Mtotali;
+    }
+}
+
+/**
+ * @brief Same as reb_transformations_jacobi_to_inertial_pos() (or _posvel() if vel is 1) for all lanes of a tile.
+ */
+static void reb_ensemble_tile_jacobi_to_inertial(struct reb_particle* const particles, const struct reb_particle* const p_j, const double* const eta, const int N, const int vel){
+    double s_x[L], s_y[L], s_z[L], s_vx[L], s_vy[L], s_vz[L];
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        const double Mtotal = eta[(N-1)*L+l];
+        s_x[l]  = p_j[l].x  * Mtotal;
+        s_y[l]  = p_j[l].y  * Mtotal;
+        s_z[l]  = p_j[l].z  * Mtotal;
+        s_vx[l] = p_j[l].vx * Mtotal;
+        s_vy[l] = p_j[l].vy * Mtotal;
+        s_vz[l] = p_j[l].vz * Mtotal;
+    }
+    for (int i=N-1;i>0;i--){
+#pragma omp simd
+        for (int l=0;l<L;l++){
+            const int k = i*L+l;
+            const double ei = 1./eta[k];
+            const double m = particles[k].m;
+            s_x[l]  = (s_x[l]  - m * p_j[k].x ) * ei;
+            s_y[l]  = (s_y[l]  - m * p_j[k].y ) * ei;
+            s_z[l]  = (s_z[l]  - m * p_j[k].z ) * ei;
+            particles[k].x  = p_j[k].x  + s_x[l];
+            particles[k].y  = p_j[k].y  + s_y[l];
+            particles[k].z  = p_j[k].z  + s_z[l];
+            s_x[l]  *= eta[k-L];
+            s_y[l]  *= eta[k-L];
+            s_z[l]  *= eta[k-L];
+            if (vel){
+                s_vx[l] = (s_vx[l] - m * p_j[k].vx) * ei;
+                s_vy[l] = (s_vy[l] - m * p_j[k].vy) * ei;
+                s_vz[l] = (s_vz[l] - m * p_j[k].vz) * ei;
+                particles[k].vx = p_j[k].vx + s_vx[l];
+                particles[k].vy = p_j[k].vy + s_vy[l];
+                particles[k].vz = p_j[k].vz + s_vz[l];
+                s_vx[l] *= eta[k-L];
+                s_vy[l] *= eta[k-L];
+                s_vz[l] *= eta[k-L];
+            }
+        }
+    }
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        const double mi = 1./eta[l];
+        particles[l].x  = s_x[l] * mi;
+        particles[l].y  = s_y[l] * mi;
+        particles[l].z  = s_z[l] * mi;
+        if (vel){
+            particles[l].vx = s_vx[l] * mi;
+            particles[l].vy = s_vy[l] * mi;
+            particles[l].vz = s_vz[l] * mi;
+        }
+    }
+}
+
+/**
+ * @brief Kepler drift of all lanes of a tile, see kepler_drift() in integrator_whfast.c.
+ */
+static void reb_ensemble_tile_drift(const struct reb_simulation* const r, struct reb_particle* const p_j, const double* const eta, const double G, const double dt, const int N){
+    for (int i=1;i<N;i++){
+        double M[L];
+        for (int l=0;l<L;l++){
+            M[l] = eta[i*L+l]*G;
+        }
+        kepler_step_batch(r, p_j, M, i*L, dt);
+    }
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        p_j[l].x += dt*p_j[l].vx;
+        p_j[l].y += dt*p_j[l].vy;
+        p_j[l].z += dt*p_j[l].vz;
+    }
+}
+
+/**
+ * @brief Interaction step of all lanes of a tile.
+ * @details Calculates the inertial accelerations (without the interaction of
+ * particles 0 and 1, see gravity_ignore_terms), transforms them to Jacobi
+ * coordinates and applies the kick of interaction_step() in integrator_whfast.c.
+ * The positions are copied to the scratch buffer (7*N*REB_ENSEMBLE_LANES doubles) 
+ * first, so that the force loop works on contiguous arrays. Each pair is only 
+ * calculated once.
+ */
+static void reb_ensemble_tile_kick(struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const double G, const double dt, const int N, double* const scratch){
+    reb_ensemble_tile_jacobi_to_inertial(particles, p_j, eta, N, 0);
+    double* restrict const x  = scratch;
+    double* restrict const y  = scratch + N*L;
+    double* restrict const z  = scratch + 2*N*L;
+    double* restrict const m  = scratch + 3*N*L;
+    double* restrict const ax = scratch + 4*N*L;
+    double* restrict const ay = scratch + 5*N*L;
+    double* restrict const az = scratch + 6*N*L;
+#pragma omp simd
+    for (int k=0;k<N*L;k++){
+        x[k] = particles[k].x;
+        y[k] = particles[k].y;
+        z[k] = particles[k].z;
+        m[k] = particles[k].m;
+        ax[k] = 0.;
+        ay[k] = 0.;
+        az[k] = 0.;
+    }
+    for (int i=0;i<N;i++){
+        for (int j=(i<=1?2:i+1);j<N;j++){
+#pragma omp simd
+            for (int l=0;l<L;l++){
+                const int ki = i*L+l;
+                const int kj = j*L+l;
+                const double dx = x[ki] - x[kj];
+                const double dy = y[ki] - y[kj];
+                const double dz = z[ki] - z[kj];
+                const double r2 = dx*dx + dy*dy + dz*dz;
+                const double _r = sqrt(r2);
+                const double prefact = G/(r2*_r);
+                const double prefactj = -prefact*m[kj];
+                const double prefacti = prefact*m[ki];
+                ax[ki] += prefactj*dx;
+                ay[ki] += prefactj*dy;
+                az[ki] += prefactj*dz;
+                ax[kj] += prefacti*dx;
+                ay[kj] += prefacti*dy;
+                az[kj] += prefacti*dz;
+            }
+        }
+    }
+#pragma omp simd
+    for (int k=0;k<N*L;k++){
+        particles[k].ax = ax[k];
+        particles[k].ay = ay[k];
+        particles[k].az = az[k];
+    }
+    // Jacobi accelerations, see reb_transformations_inertial_to_jacobi_acc()
+    double s_ax[L], s_ay[L], s_az[L];
+#pragma omp simd
+    for (int l=0;l<L;l++){
+        s_ax[l] = eta[l] * particles[l].ax;
+        s_ay[l] = eta[l] * particles[l].ay;
+        s_az[l] = eta[l] * particles[l].az;
+    }
+    for (int i=1;i<N;i++){
+#pragma omp simd
+        for (int l=0;l<L;l++){
+            const int k = i*L+l;
+            const double ei = 1./eta[k-L];
+            const double pme = eta[k]*ei;
+            const double m = particles[k].m;
+            const double ajx = particles[k].ax - s_ax[l]*ei;
+            const double ajy = particles[k].ay - s_ay[l]*ei;
+            const double ajz = particles[k].az - s_az[l]*ei;
+            s_ax[l] = s_ax[l] * pme + m*ajx;
+            s_ay[l] = s_ay[l] * pme + m*ajy;
+            s_az[l] = s_az[l] * pme + m*ajz;
+            // Eq 132
+            p_j[k].vx += dt * ajx;
+            p_j[k].vy += dt * ajy;
+            p_j[k].vz += dt * ajz;
+            if (i>1){
+                const double rj2i = 1./(p_j[k].x*p_j[k].x + p_j[k].y*p_j[k].y + p_j[k].z*p_j[k].z);
+                const double rji  = sqrt(rj2i);
+                const double prefac1 = dt*rji*rj2i*G*eta[k];
+                p_j[k].vx += prefac1*p_j[k].x;
+                p_j[k].vy += prefac1*p_j[k].y;
+                p_j[k].vz += prefac1*p_j[k].z;
+            }
+        }
+    }
+}
+
+void reb_ensemble_integrate(struct reb_ensemble* const e, const double tmax){
+    struct reb_simulation* const r = e->r;
+    for (int k=0;k<e->N_systems;k++){
+        if (e->is_set[k]==0){
+            reb_error(r, "Not all systems of the ensemble have been set.");
+            return;
+        }
+    }
+    const double dt = e->dt;
+    if (dt<=0. || tmax<=e->t){
+        return;
+    }
+    // Same number of timesteps as reb_integrate() with exact_finish_time=0.
+    unsigned long N_steps = 0;
+    double t = e->t;
+    while (t<tmax){
+        // WHFast advances the time by dt/2 in each part
+        t += dt/2.;
+        t += dt/2.;
+        N_steps++;
+    }
+    const int N = e->N;
+    const double G = e->G;
+    r->G = G;
+    r->dt = dt;
+    // Unused lanes of the last tile integrate a copy of the last system.
+    for (int k=e->N_systems;k<e->N_tiles*L;k++){
+        struct reb_particle* const p = reb_ensemble_system(e, e->particles, k);
+        const struct reb_particle* const plast = reb_ensemble_system(e, e->particles, e->N_systems-1);
+        for (int i=0;i<N;i++){
+            p[i*L] = plast[i*L];
+        }
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (int tile=0;tile<e->N_tiles;tile++){
+        const size_t offset = (size_t)tile*N*L;
+        struct reb_particle* const particles = e->particles + offset;
+        struct reb_particle* const p_j = e->p_j + offset;
+        double* const eta = e->eta + offset;
+        double* const scratch = malloc(7*N*L*sizeof(double));
+        reb_ensemble_tile_inertial_to_jacobi_posvel(particles, p_j, eta, N);
+        // DKD with the drifts of consecutive timesteps combined.
+        reb_ensemble_tile_drift(r, p_j, eta, G, dt/2., N);
+        for (unsigned long s=0;s<N_steps;s++){
+            if (s>0){
+                reb_ensemble_tile_drift(r, p_j, eta, G, dt, N);
+            }
+            reb_ensemble_tile_kick(particles, p_j, eta, G, dt, N, scratch);
+        }
+        reb_ensemble_tile_drift(r, p_j, eta, G, dt/2., N);
+        reb_ensemble_tile_jacobi_to_inertial(particles, p_j, eta, N, 1);
+        free(scratch);
+    }
+    e->t = t;
+}
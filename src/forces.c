@@ -0,0 +1,252 @@
+/**
+ * @file 	forces.c
+ * @brief 	Built-in additional forces which can be selected at runtime.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	The forces implemented here are the ones of the dragforce, J2
+ * and prdrag examples, plus a simple post-Newtonian correction. They can be
+ * added by name (e.g. from python) instead of writing an additional_forces
+ * function, and several of them can be combined. All of them are ordinary C
+ * loops, so they run at the same speed as a hand-written callback.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "forces.h"
+
+/**
+ * @brief Speed of light in units where G=1, masses are in solar masses, distances in AU and time in yr/(2 pi).
+ */
+#define REB_FORCES_C_DEFAULT 1.006491504759635e+04
+
+static const char* const reb_force_names[REB_FORCE_N] = {
+    [REB_FORCE_DRAG]    = "drag",
+    [REB_FORCE_J2]      = "j2",
+    [REB_FORCE_PRDRAG]  = "prdrag",
+    [REB_FORCE_GR]      = "gr",
+};
+
+// Parameter names of each force. The position in this table is the index in reb_force.params.
+static const char* const reb_force_param_names[REB_FORCE_N][4] = {
+    [REB_FORCE_DRAG]    = {"gamma", NULL},
+    [REB_FORCE_J2]      = {"J2", "R", "obliquity", NULL},
+    [REB_FORCE_PRDRAG]  = {"beta", "c", NULL},
+    [REB_FORCE_GR]      = {"c", NULL},
+};
+
+int reb_add_force(struct reb_simulation* const r, const char* const name){
+    int type = -1;
+    for (int i=0;i<REB_FORCE_N;i++){
+        if (name && strcmp(name, reb_force_names[i])==0){
+            type = i;
+        }
+    }
+    if (type<0){
+        reb_error(r, "Unknown force. Available forces are drag, j2, prdrag and gr.");
+        return -1;
+    }
+    if (r->forces_allocatedN<=r->forces_N){
+        r->forces_allocatedN = r->forces_allocatedN?2*r->forces_allocatedN:4;
+        r->forces = realloc(r->forces, sizeof(struct reb_force)*r->forces_allocatedN);
+    }
+    struct reb_force* const f = &r->forces[r->forces_N];
+    memset(f, 0, sizeof(struct reb_force));
+    f->type = type;
+    switch (f->type){
+        case REB_FORCE_PRDRAG:
+            f->params[1] = REB_FORCES_C_DEFAULT;
+            break;
+        case REB_FORCE_GR:
+            f->params[0] = REB_FORCES_C_DEFAULT;
+            break;
+        default:
+            break;
+    }
+    if (f->type!=REB_FORCE_J2){
+        r->force_is_velocity_dependent = 1;
+    }
+    return r->forces_N++;
+}
+
+int reb_set_force_parameter(struct reb_simulation* const r, const int index, const char* const name, const double value){
+    if (index<0 || index>=r->forces_N){
+        reb_error(r, "Force index out of range.");
+        return -1;
+    }
+    struct reb_force* const f = &r->forces[index];
+    if (strcmp(name, "primary")==0){
+        f->primary = (int)value;
+        return 0;
+    }
+    for (int i=0;i<4 && reb_force_param_names[f->type][i];i++){
+        if (strcmp(name, reb_force_param_names[f->type][i])==0){
+            f->params[i] = value;
+            return 0;
+        }
+    }
+    reb_error(r, "Unknown parameter for this force.");
+    return -1;
+}
+
+void reb_remove_forces(struct reb_simulation* const r){
+    free(r->forces);
+    r->forces = NULL;
+    r->forces_N = 0;
+    r->forces_allocatedN = 0;
+}
+
+// Linear drag, as in examples/dragforce.
+static void reb_force_drag(struct reb_simulation* const r, const struct reb_force* const f, const int N){
+    struct reb_particle* const particles = r->particles;
+    const double gamma = f->params[0];
+#pragma omp parallel for
+    for (int i=0;i<N;i++){
+        particles[i].ax -= gamma*particles[i].vx;
+        particles[i].ay -= gamma*particles[i].vy;
+        particles[i].az -= gamma*particles[i].vz;
+    }
+}
+
+// Quadrupole moment of the primary, as in examples/J2.
+static void reb_force_j2(struct reb_simulation* const r, const struct reb_force* const f, const int N){
+    struct reb_particle* const particles = r->particles;
+    const struct reb_particle planet = particles[f->primary];
+    const double J2 = f->params[0];
+    const double R = f->params[1];
+    const double co = cos(f->params[2]);
+    const double so = sin(f->params[2]);
+    const double G = r->G;
+#pragma omp parallel for
+    for (int i=0;i<N;i++){
+        if (i==f->primary) continue;
+        const struct reb_particle p = particles[i];
+        const double sprx = p.x-planet.x;
+        const double spry = p.y-planet.y;
+        const double sprz = p.z-planet.z;
+        const double prx  = sprx*co - sprz*so;
+        const double pry  = spry;
+        const double prz  = sprx*so + sprz*co;
+        const double pr2  = prx*prx + pry*pry + prz*prz;
+        const double fac  = 3.*G*J2*planet.m*R*R/2./pow(pr2,3.5);
+        const double pax  = fac*prx*(prx*prx + pry*pry - 4.*prz*prz);
+        const double pay  = fac*pry*(prx*prx + pry*pry - 4.*prz*prz);
+        const double paz  = fac*prz*(3.*(prx*prx + pry*pry) - 2.*prz*prz);
+        particles[i].ax += pax*co + paz*so;
+        particles[i].ay += pay;
+        particles[i].az +=-pax*so + paz*co;
+    }
+}
+
+// Radiation pressure and Poynting-Robertson drag on massless particles, as in examples/prdrag.
+static void reb_force_prdrag(struct reb_simulation* const r, const struct reb_force* const f, const int N){
+    struct reb_particle* const particles = r->particles;
+    const struct reb_particle star = particles[f->primary];
+    const double beta = f->params[0];
+    const double c = f->params[1];
+    const double G = r->G;
+#pragma omp parallel for
+    for (int i=0;i<N;i++){
+        const struct reb_particle p = particles[i];
+        if (p.m!=0. || i==f->primary) continue;
+        const double prx  = p.x-star.x;
+        const double pry  = p.y-star.y;
+        const double prz  = p.z-star.z;
+        const double pr   = sqrt(prx*prx + pry*pry + prz*prz);
+        const double prvx = p.vx-star.vx;
+        const double prvy = p.vy-star.vy;
+        const double prvz = p.vz-star.vz;
+        const double rdot = (prvx*prx + prvy*pry + prvz*prz)/pr;
+        const double F_r  = beta*G*star.m/(pr*pr);
+        // Equation (5) of Burns, Lamy, Soter (1979)
+        particles[i].ax += F_r*((1.-rdot/c)*prx/pr - prvx/c);
+        particles[i].ay += F_r*((1.-rdot/c)*pry/pr - prvy/c);
+        particles[i].az += F_r*((1.-rdot/c)*prz/pr - prvz/c);
+    }
+}
+
+// First order post-Newtonian correction of a test particle orbiting the primary,
+// see e.g. Benitez & Gallardo (2008), Eq. 4. 
+static void reb_force_gr(struct reb_simulation* const r, const struct reb_force* const f, const int N){
+    struct reb_particle* const particles = r->particles;
+    const struct reb_particle star = particles[f->primary];
+    const double c2 = f->params[0]*f->params[0];
+    const double mu = r->G*star.m;
+#pragma omp parallel for
+    for (int i=0;i<N;i++){
+        if (i==f->primary) continue;
+        const struct reb_particle p = particles[i];
+        const double dx = p.x-star.x;
+        const double dy = p.y-star.y;
+        const double dz = p.z-star.z;
+        const double dvx = p.vx-star.vx;
+        const double dvy = p.vy-star.vy;
+        const double dvz = p.vz-star.vz;
+        const double d = sqrt(dx*dx + dy*dy + dz*dz);
+        const double v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+        const double rv = dx*dvx + dy*dvy + dz*dvz;
+        const double fac = mu/(c2*d*d*d);
+        const double A = 4.*mu/d - v2;
+        const double B = 4.*rv;
+        particles[i].ax += fac*(A*dx + B*dvx);
+        particles[i].ay += fac*(A*dy + B*dvy);
+        particles[i].az += fac*(A*dz + B*dvz);
+    }
+}
+
+void reb_forces_apply(struct reb_simulation* const r, const struct reb_force* const forces, const int N){
+    const int N_real = r->N - r->N_var;
+    if (r->gravity==REB_GRAVITY_NONE){
+        // Gravity does not reset the accelerations in this case.
+        struct reb_particle* const particles = r->particles;
+#pragma omp parallel for
+        for (int i=0;i<N_real;i++){
+            particles[i].ax = 0.;
+            particles[i].ay = 0.;
+            particles[i].az = 0.;
+        }
+    }
+    for (int k=0;k<N;k++){
+        const struct reb_force* const f = &forces[k];
+        if (f->type!=REB_FORCE_DRAG && (f->primary<0 || f->primary>=N_real)){
+            reb_warning(r, "The primary of a built-in force does not exist. Force ignored.");
+            continue;
+        }
+        switch (f->type){
+            case REB_FORCE_DRAG:
+                reb_force_drag(r, f, N_real);
+                break;
+            case REB_FORCE_J2:
+                reb_force_j2(r, f, N_real);
+                break;
+            case REB_FORCE_PRDRAG:
+                reb_force_prdrag(r, f, N_real);
+                break;
+            case REB_FORCE_GR:
+                reb_force_gr(r, f, N_real);
+                break;
+            default:
+                break;
+        }
+    }
+}
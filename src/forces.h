@@ -0,0 +1,38 @@
+/**
+ * @file 	forces.h
+ * @brief 	Built-in additional forces which can be selected at runtime.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _FORCES_H
+#define _FORCES_H
+
+/**
+  * @brief Adds the accelerations of a list of built-in forces to the particles of a simulation.
+  * @details Called right before the additional_forces callback. HERMES calls it for its mini
+  * simulation with the forces of the global simulation.
+  * @param r REBOUND simulation to operate on
+  * @param forces Array of forces (usually r->forces)
+  * @param N Number of forces
+  */
+void reb_forces_apply(struct reb_simulation* const r, const struct reb_force* const forces, const int N);
+
+#endif // _FORCES_H
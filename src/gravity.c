@@ -36,24 +36,335 @@
 #include <time.h>
 #include "particle.h"
 #include "rebound.h"
+#include "tools.h"
 #include "tree.h"
+#include "gravity.h"
 #include "boundary.h"
+#include "collision.h"
+#include "gravity_fmm.h"
+#include "gravity_opencl.h"
+#include "gravity_fft.h"
+#include "integrator_mercurius.h"
 
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+/**
+  * @brief Compile versions of vectorized kernels for several instruction sets and select one at runtime.
+  */
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER) && defined(__x86_64__) && defined(__linux__)
+#define REB_GRAVITY_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define REB_GRAVITY_TARGET_CLONES
+#endif
+
+#if defined(__GNUC__)
+#define REB_GRAVITY_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define REB_GRAVITY_ALWAYS_INLINE inline
+#endif
+
+/**
+  * @brief Same as reb_calculate_acceleration_basic_soa() for softening=0.
+  */
+static void reb_calculate_acceleration_basic_soa_unsoftened(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, double* const a);
 
 /**
   * @brief The function loops over all trees to call calculate_forces_for_particle_from_cell() tree to calculate forces for each particle.
   * @param r REBOUND simulation to consider
   * @param pt Index of the particle the force is calculated for.
   * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @param opened Incremented by the number of opened cells.
+  * @return Number of interactions (accepted cells and particles).
+  */
+static int reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, int* const opened);
+
+/**
+  * @brief Same as reb_calculate_acceleration_for_particle() but uses the flattened tree r->tree_flat.
+  * @details The tree is walked with a loop instead of recursive function calls.
+  * @param r REBOUND simulation to consider
+  * @param pt Index of the particle the force is calculated for.
+  * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @param opened Incremented by the number of opened cells.
+  * @return Number of interactions (accepted cells and particles).
+  */
+static int reb_calculate_acceleration_for_particle_flat(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, int* const opened);
+
+/**
+  * @brief Calculates the tree gravity with OpenMP tasks (see tree_tasks).
+  * @details The particles are visited in the order of the tree leaves. This order is 
+  * split into contiguous ranges with a similar number of interactions during the 
+  * previous tree walk. Every range is one task, so idle threads take over ranges 
+  * from busy ones. The interactions of every particle are counted for the next step.
+  * Each particle sums up its forces in the same order as without tasks.
+  * @param r REBOUND simulation to consider
+  * @param gbs Ghostboxes.
+  * @param Ngb Number of ghostboxes.
+  * @param flat If set to 1, the flattened tree is walked.
+  */
+static void reb_calculate_acceleration_tree_tasks(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int Ngb, const int flat);
+
+/**
+  * @brief Calculates the tree gravity and collects the candidates for the collision search in the same tree walk (see collision_fused).
+  * @details Cells which are opened for the gravity calculation are not visited again. 
+  * Candidates inside a cell which is accepted as a whole are found by descending into 
+  * that cell only. Candidates are only collected in the ghostboxes searched by 
+  * REB_COLLISION_TREE. The forces are summed up in the same order as without collision_fused.
+  * @param r REBOUND simulation to consider
+  * @param gbs Ghostboxes.
+  * @param Ngb Number of ghostboxes.
+  * @param skin Additional search distance for collision candidates (see reb_collision_fused_begin()).
+  */
+static void reb_calculate_acceleration_tree_fused(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int Ngb, const double skin);
+
+#ifdef MPI
+/**
+  * @brief Adds the forces from the root boxes owned by one node (including ghost boxes) to all particles.
+  * @details Used to fold in the essential tree of each node as soon as it has arrived (see mpi_pipeline).
+  * @param r REBOUND simulation to consider
+  * @param proc Id of the node owning the root boxes.
+  */
+static void reb_calculate_acceleration_for_roots(struct reb_simulation* const r, const int proc);
+
+#ifdef OPENMP
+/**
+  * @brief Calculates the tree forces while the essential tree is still being received.
+  * @details The master thread receives the essential tree and inserts it into the 
+  * non-local root boxes (it is the only thread calling MPI). All other threads 
+  * calculate the forces from the local root boxes in the meantime. The master 
+  * thread joins them once everything has arrived. The forces from the non-local 
+  * root boxes are calculated afterwards by all threads.
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_tree_comm_thread(struct reb_simulation* const r);
+#endif // OPENMP
+#endif // MPI
+
+/**
+  * @brief Interaction list used by the group-wise tree walk.
+  * @details Accepted cells and particles are stored as structure of arrays.
+  * Each thread uses its own list.
+  */
+struct reb_tree_interaction_list {
+	int N_cells;                ///< Number of cells in the list
+	int N_particles;            ///< Number of particles in the list
+	int allocatedN_cells;       ///< Allocated length of the cell arrays
+	int allocatedN_particles;   ///< Allocated length of the particle arrays
+	double* cells[20];          ///< Cell data: mx, my, mz, m, followed by the quadrupole (mxx..mzz) and octupole (mxxx..mzzz) moments if used.
+	float* cells_float[20];     ///< Same as cells, but in single precision and with mx, my, mz relative to the centre of the group. Used instead of cells if tree_single_precision=1.
+	double* particles[4];       ///< Particle data: x, y, z, m
+	int* index;                 ///< Particle indices
+};
+
+/**
+  * @brief Calculates the tree gravity by walking the tree once for each group in r->tree_groups.
+  * @details For each group, all cells which satisfy the opening angle criterion for every 
+  * particle in the group are collected in an interaction list, together with all particles 
+  * in cells which need to be opened. The list is then applied to all particles of the group. 
+  * Requires the flattened tree (see reb_tree_flatten()).
+  * @param r REBOUND simulation to consider
+  */
+static void reb_calculate_acceleration_tree_groups(struct reb_simulation* const r);
+
+#ifdef OPENMP
+/**
+  * @brief Symmetric compensated summation over all pairs of massive particles (i,j) with i0<=i<i1 and j0<=j<j1.
+  * @details Both particles of a pair receive their contribution. Particles i receive them in the order of 
+  * increasing j, particles j in the order of increasing i. Only used by the OpenMP version.
+  * @param r REBOUND simulation to consider
+  * @param i0 First index of the first block.
+  * @param i1 One past the last index of the first block.
+  * @param j0 First index of the second block.
+  * @param j1 One past the last index of the second block.
+  * @param diagonal If set to 1, both blocks are the same and only pairs with j>i are considered.
+  */
+static void reb_calculate_acceleration_compensated_block(struct reb_simulation* const r, const int i0, const int i1, const int j0, const int j1, const int diagonal);
+#endif // OPENMP
+
+/**
+  * @brief Copies the particle positions and masses into the SoA buffer r->gravity_soa.
+  * @param r REBOUND simulation to consider
+  * @param N Number of particles to copy.
+  */
+static void reb_calculate_acceleration_update_soa(struct reb_simulation* const r, const int N);
+
+/**
+ * @brief Maximum number of variational particles updated in one pass of reb_calculate_acceleration_var_first_order_fused().
+ */
+#define REB_VAR_FUSED_N 8
+
+/**
+ * @brief Calculates the accelerations of all first order variational particles (which are not test particles).
+ * @details The tidal tensor of each pair of real particles is calculated once and applied
+ * to up to REB_VAR_FUSED_N variational configurations at a time. The accelerations are
+ * set (not added). The order of all sums is the same as for a single configuration, so
+ * the results do not depend on the number of configurations.
+ * @param r REBOUND simulation to operate on
+ */
+static void reb_calculate_acceleration_var_first_order_fused(struct reb_simulation* const r);
+
+/**
+ * @brief Calculates the accelerations of all first order variational particles with the tree.
+ * @details The cells and the opening criterion are the same as for REB_GRAVITY_TREE. For 
+ * every real particle, the tidal tensors of all accepted cells and particles are summed up 
+ * in one walk and applied to the variational displacement of the particle. Accepted cells 
+ * include the tidal tensor of their quadrupole moments if r->multipole_order>=2. The 
+ * variational displacements and masses of all other particles enter through their mass 
+ * weighted sums over each cell. The accelerations are set (not added). Second order 
+ * variational equations are not supported.
+ * @param r REBOUND simulation to operate on
+ */
+static void reb_calculate_acceleration_var_tree(struct reb_simulation* const r);
+
+/**
+  * @brief Calls the softened or the unsoftened version of reb_calculate_acceleration_basic_soa().
+  */
+static inline void reb_calculate_acceleration_basic_soa_select(const int softening, const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a){
+	if (softening){
+		reb_calculate_acceleration_basic_soa(soa, stride, j0, j1, xi, yi, zi, softening2, a);
+	}else{
+		reb_calculate_acceleration_basic_soa_unsoftened(soa, stride, j0, j1, xi, yi, zi, a);
+	}
+}
+
+/**
+  * @brief Direct summation for REB_GRAVITY_BASIC.
+  * @details Only called with constant arguments from the wrappers below, so that the compiler 
+  * generates one version per combination in which all checks of ignore_terms, testparticle_type,
+  * ghost boxes and softening are resolved at compile time. 
+  * @param r REBOUND simulation to consider
+  * @param ignore_terms Value of r->gravity_ignore_terms (0, 1 or 2).
+  * @param testparticle_type 1 if test particles act on active particles.
+  * @param ghostboxes 0 if there are no ghost boxes.
+  * @param softening 0 if the softening parameter is 0.
+  */
+static REB_GRAVITY_ALWAYS_INLINE void reb_calculate_acceleration_basic_template(struct reb_simulation* const r, const unsigned int ignore_terms, const int testparticle_type, const int ghostboxes, const int softening){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const unsigned int _gravity_ignore_terms = ignore_terms;
+	const int _N_active = ((r->N_active==-1)?N:r->N_active) - r->N_var;
+	const int _N_real   = N  - r->N_var;
+	const int _testparticle_type = testparticle_type;
+	const int nghostx = ghostboxes?r->nghostx:0;
+	const int nghosty = ghostboxes?r->nghosty:0;
+	const int nghostz = ghostboxes?r->nghostz:0;
+#pragma omp parallel for schedule(guided)
+	for (int i=0; i<N; i++){
+		particles[i].ax = 0; 
+		particles[i].ay = 0; 
+		particles[i].az = 0; 
+	}
+	reb_calculate_acceleration_update_soa(r, _N_real);
+	const double* const soa = r->gravity_soa;
+	const int stride = r->gravity_soa_allocatedN;
+	// Close encounters are checked here if this loop visits every pair, 
+	// so that reb_run_heartbeat() does not need another O(N^2) loop.
+	const int check_encounters = r->exit_min_distance>0. && _gravity_ignore_terms==0 && _N_active==_N_real;
+	const double min2 = r->exit_min_distance*r->exit_min_distance;
+	int encounter = 0;
+	// Summing over all Ghost Boxes
+	for (int gbx=-nghostx; gbx<=nghostx; gbx++){
+	for (int gby=-nghosty; gby<=nghosty; gby++){
+	for (int gbz=-nghostz; gbz<=nghostz; gbz++){
+		const struct reb_ghostbox gb = ghostboxes?reb_boundary_get_ghostbox(r, gbx,gby,gbz):(struct reb_ghostbox){0};
+		// Summing over all particle pairs. 
+		// The self-interaction and the ignored terms are peeled off the inner loop
+		// by splitting the range of j into [jstart,i) and [i+1,_N_active).
+		const int check_box = check_encounters && gbx==0 && gby==0 && gbz==0;
+#pragma omp parallel for schedule(guided) reduction(max:encounter)
+		for (int i=0; i<_N_real; i++){
+			if (_gravity_ignore_terms==2 && i==0) continue;
+			int jstart = 0;
+			if (_gravity_ignore_terms==1 && i<=1) jstart = 2;
+			if (_gravity_ignore_terms==2) jstart = 1;
+			const double xi = gb.shiftx+particles[i].x;
+			const double yi = gb.shifty+particles[i].y;
+			const double zi = gb.shiftz+particles[i].z;
+			double a[3] = {0.,0.,0.};
+			const int jmid = i<_N_active?i:_N_active;
+			if (check_box){
+				// Pairs with j<i only, every pair is visited once.
+				double r2min = INFINITY;
+				reb_calculate_acceleration_basic_soa_r2min(soa, stride, jstart, jmid, xi, yi, zi, softening2, a, &r2min);
+				if (r2min<min2) encounter = 1;
+			}else{
+				reb_calculate_acceleration_basic_soa_select(softening, soa, stride, jstart, jmid, xi, yi, zi, softening2, a);
+			}
+			reb_calculate_acceleration_basic_soa_select(softening, soa, stride, (jmid+1>jstart?jmid+1:jstart), _N_active, xi, yi, zi, softening2, a);
+			particles[i].ax    += -G*a[0];
+			particles[i].ay    += -G*a[1];
+			particles[i].az    += -G*a[2];
+		}
+		if (_testparticle_type){
+#pragma omp parallel for schedule(guided)
+		for (int i=0; i<_N_active; i++){
+			if (_gravity_ignore_terms==2 && i==0) continue;
+			const double xi = gb.shiftx+particles[i].x;
+			const double yi = gb.shifty+particles[i].y;
+			const double zi = gb.shiftz+particles[i].z;
+			double a[3] = {0.,0.,0.};
+			if (_gravity_ignore_terms==1 && i==0 && _N_active<=1 && _N_real>1){
+				// Skip j==1
+				reb_calculate_acceleration_basic_soa_select(softening, soa, stride, _N_active, 1, xi, yi, zi, softening2, a);
+				reb_calculate_acceleration_basic_soa_select(softening, soa, stride, 2, _N_real, xi, yi, zi, softening2, a);
+			}else{
+				reb_calculate_acceleration_basic_soa_select(softening, soa, stride, _N_active, _N_real, xi, yi, zi, softening2, a);
+			}
+			particles[i].ax    += -G*a[0];
+			particles[i].ay    += -G*a[1];
+			particles[i].az    += -G*a[2];
+		}
+		}
+	}
+	}
+	}
+	if (check_encounters){
+		r->exit_min_distance_checked = (encounter || r->exit_min_distance_checked==2)?2:1;
+	}
+}
+
+#define REB_GRAVITY_BASIC_KERNEL(IT,TP,GB,SO) \
+static void reb_calculate_acceleration_basic_##IT##TP##GB##SO(struct reb_simulation* const r){ \
+	reb_calculate_acceleration_basic_template(r, IT, TP, GB, SO); \
+}
+REB_GRAVITY_BASIC_KERNEL(0,0,0,0) REB_GRAVITY_BASIC_KERNEL(0,0,0,1) REB_GRAVITY_BASIC_KERNEL(0,0,1,0) REB_GRAVITY_BASIC_KERNEL(0,0,1,1)
+REB_GRAVITY_BASIC_KERNEL(0,1,0,0) REB_GRAVITY_BASIC_KERNEL(0,1,0,1) REB_GRAVITY_BASIC_KERNEL(0,1,1,0) REB_GRAVITY_BASIC_KERNEL(0,1,1,1)
+REB_GRAVITY_BASIC_KERNEL(1,0,0,0) REB_GRAVITY_BASIC_KERNEL(1,0,0,1) REB_GRAVITY_BASIC_KERNEL(1,0,1,0) REB_GRAVITY_BASIC_KERNEL(1,0,1,1)
+REB_GRAVITY_BASIC_KERNEL(1,1,0,0) REB_GRAVITY_BASIC_KERNEL(1,1,0,1) REB_GRAVITY_BASIC_KERNEL(1,1,1,0) REB_GRAVITY_BASIC_KERNEL(1,1,1,1)
+REB_GRAVITY_BASIC_KERNEL(2,0,0,0) REB_GRAVITY_BASIC_KERNEL(2,0,0,1) REB_GRAVITY_BASIC_KERNEL(2,0,1,0) REB_GRAVITY_BASIC_KERNEL(2,0,1,1)
+REB_GRAVITY_BASIC_KERNEL(2,1,0,0) REB_GRAVITY_BASIC_KERNEL(2,1,0,1) REB_GRAVITY_BASIC_KERNEL(2,1,1,0) REB_GRAVITY_BASIC_KERNEL(2,1,1,1)
+#undef REB_GRAVITY_BASIC_KERNEL
+
+/**
+  * @brief Dispatch table for REB_GRAVITY_BASIC, indexed by [ignore_terms][testparticle_type][ghostboxes][softening].
   */
-static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb);
+static void (* const reb_calculate_acceleration_basic_kernels[3][2][2][2])(struct reb_simulation* const r) = {
+	{{{reb_calculate_acceleration_basic_0000, reb_calculate_acceleration_basic_0001}, {reb_calculate_acceleration_basic_0010, reb_calculate_acceleration_basic_0011}},
+	 {{reb_calculate_acceleration_basic_0100, reb_calculate_acceleration_basic_0101}, {reb_calculate_acceleration_basic_0110, reb_calculate_acceleration_basic_0111}}},
+	{{{reb_calculate_acceleration_basic_1000, reb_calculate_acceleration_basic_1001}, {reb_calculate_acceleration_basic_1010, reb_calculate_acceleration_basic_1011}},
+	 {{reb_calculate_acceleration_basic_1100, reb_calculate_acceleration_basic_1101}, {reb_calculate_acceleration_basic_1110, reb_calculate_acceleration_basic_1111}}},
+	{{{reb_calculate_acceleration_basic_2000, reb_calculate_acceleration_basic_2001}, {reb_calculate_acceleration_basic_2010, reb_calculate_acceleration_basic_2011}},
+	 {{reb_calculate_acceleration_basic_2100, reb_calculate_acceleration_basic_2101}, {reb_calculate_acceleration_basic_2110, reb_calculate_acceleration_basic_2111}}},
+};
 
 /**
  * Main Gravity Routine
  */
+uint64_t reb_calculate_acceleration_direct_interactions(const struct reb_simulation* const r, const int N_active, const int N_real){
+	const uint64_t Ngb = (uint64_t)(2*r->nghostx+1)*(2*r->nghosty+1)*(2*r->nghostz+1);
+	uint64_t n = Ngb*N_active*N_real - N_active;
+	if (r->testparticle_type){
+		n += Ngb*N_active*(N_real-N_active);
+	}
+	return n;
+}
+
 void reb_calculate_acceleration(struct reb_simulation* r){
 	struct reb_particle* const particles = r->particles;
 	const int N = r->N;
@@ -64,69 +375,25 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 	const int _N_active = ((N_active==-1)?N:N_active) - r->N_var;
 	const int _N_real   = N  - r->N_var;
 	const int _testparticle_type   = r->testparticle_type;
+	if (r->integrator==REB_INTEGRATOR_MERCURIUS && r->gravity!=REB_GRAVITY_NONE){
+		reb_integrator_mercurius_calculate_acceleration(r);
+		return;
+	}
 	switch (r->gravity){
 		case REB_GRAVITY_NONE: // Do nothing.
 		break;
 		case REB_GRAVITY_BASIC:
 		{
-			const int nghostx = r->nghostx;
-			const int nghosty = r->nghosty;
-			const int nghostz = r->nghostz;
-#pragma omp parallel for schedule(guided)
-			for (int i=0; i<N; i++){
-				particles[i].ax = 0; 
-				particles[i].ay = 0; 
-				particles[i].az = 0; 
-			}
-			// Summing over all Ghost Boxes
-			for (int gbx=-nghostx; gbx<=nghostx; gbx++){
-			for (int gby=-nghosty; gby<=nghosty; gby++){
-			for (int gbz=-nghostz; gbz<=nghostz; gbz++){
-				struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-				// Summing over all particle pairs
-#pragma omp parallel for schedule(guided)
-				for (int i=0; i<_N_real; i++){
-				for (int j=0; j<_N_active; j++){
-					if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0) )) continue;
-					if (_gravity_ignore_terms==2 && ((j==0 || i==0) )) continue;
-					if (i==j) continue;
-					const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-					const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-					const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-					const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-					const double prefact = -G/(_r*_r*_r)*particles[j].m;
-					
-					particles[i].ax    += prefact*dx;
-					particles[i].ay    += prefact*dy;
-					particles[i].az    += prefact*dz;
-				}
-				}
-                if (_testparticle_type){
-				for (int i=0; i<_N_active; i++){
-				for (int j=_N_active; j<_N_real; j++){
-					if (_gravity_ignore_terms==1 && ((j==1 && i==0) )) continue;
-					if (_gravity_ignore_terms==2 && ((j==0 || i==0) )) continue;
-					const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
-					const double dy = (gb.shifty+particles[i].y) - particles[j].y;
-					const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
-					const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
-					const double prefact = -G/(_r*_r*_r)*particles[j].m;
-					
-					particles[i].ax    += prefact*dx;
-					particles[i].ay    += prefact*dy;
-					particles[i].az    += prefact*dz;
-				}
-				}
-                }
-			}
-			}
-			}
+			const int ghostboxes = r->nghostx || r->nghosty || r->nghostz;
+			const int ignore_terms = _gravity_ignore_terms<=2?_gravity_ignore_terms:2;
+			reb_calculate_acceleration_basic_kernels[ignore_terms][_testparticle_type?1:0][ghostboxes][softening2!=0.](r);
+			r->metrics.interactions += reb_calculate_acceleration_direct_interactions(r, _N_active, _N_real);
 		}
 		break;
 		case REB_GRAVITY_COMPENSATED:
 		{
 			if (r->gravity_cs_allocatedN<N){
-				r->gravity_cs = realloc(r->gravity_cs,N*sizeof(struct reb_vec3d));
+				r->gravity_cs = reb_tools_realloc(r, r->gravity_cs, 0, N*sizeof(struct reb_vec3d));
 				r->gravity_cs_allocatedN = N;
 			}
 			struct reb_vec3d* restrict const cs = r->gravity_cs;
@@ -141,41 +408,27 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 			}
 			// Summing over all massive particle pairs
 #ifdef OPENMP
-#pragma omp parallel for schedule(guided)
-			for (int i=0; i<_N_active; i++){
-			for (int j=0; j<_N_active; j++){
-				if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-				if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-				if (i==j) continue;
-				const double dx = particles[i].x - particles[j].x;
-				const double dy = particles[i].y - particles[j].y;
-				const double dz = particles[i].z - particles[j].z;
-				const double r2 = dx*dx + dy*dy + dz*dz + softening2;
-				const double r = sqrt(r2);
-				const double prefact  = G/(r2*r);
-				const double prefactj = -prefact*particles[j].m;
-				
-				{
-				double ix = prefactj*dx;
-				double yx = ix - cs[i].x;
-				double tx = particles[i].ax + yx;
-				cs[i].x = (tx - particles[i].ax) - yx;
-				particles[i].ax = tx;
-
-				double iy = prefactj*dy;
-				double yy = iy- cs[i].y;
-				double ty = particles[i].ay + yy;
-				cs[i].y = (ty - particles[i].ay) - yy;
-				particles[i].ay = ty;
-				
-				double iz = prefactj*dz;
-				double yz = iz - cs[i].z;
-				double tz = particles[i].az + yz;
-				cs[i].z = (tz - particles[i].az) - yz;
-				particles[i].az = tz;
+			// Each pair is only visited once. Particles are grouped into blocks and pairs 
+			// of blocks (I,J) with I<=J are processed along the anti-diagonals I+J=d. 
+			// Block pairs on the same anti-diagonal do not share any particles and are 
+			// processed in parallel. Every particle receives the contributions from the
+			// other particles in the same order as in the serial version. The result is
+			// therefore identical bit by bit.
+			{
+				int blocksize = _N_active/(4*omp_get_max_threads());
+				if (blocksize<16) blocksize = 16;
+				const int Nblocks = (_N_active+blocksize-1)/blocksize;
+				for (int d=0; d<=2*(Nblocks-1); d++){
+					const int Istart = d-(Nblocks-1)>0?d-(Nblocks-1):0;
+#pragma omp parallel for schedule(dynamic)
+					for (int I=Istart; I<=d/2; I++){
+						const int J = d-I;
+						const int i1 = (I+1)*blocksize<_N_active?(I+1)*blocksize:_N_active;
+						const int j1 = (J+1)*blocksize<_N_active?(J+1)*blocksize:_N_active;
+						reb_calculate_acceleration_compensated_block(r, I*blocksize, i1, J*blocksize, j1, I==J);
+					}
 				}
 			}
-			}
 
 			// Testparticles
 #pragma omp parallel for schedule(guided)
@@ -360,6 +613,7 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 			}
 			}
 #endif // OPENMP
+			r->metrics.interactions += reb_calculate_acceleration_direct_interactions(r, _N_active, _N_real);
 		}
 		break;
 		case REB_GRAVITY_TREE:
@@ -370,22 +624,123 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 				particles[i].ay = 0; 
 				particles[i].az = 0; 
 			}
-			// Summing over all Ghost Boxes
-			for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
-			for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
-			for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
-				// Summing over all particle pairs
-#pragma omp parallel for schedule(guided)
-				for (int i=0; i<N; i++){
-					struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			if (r->tree_flatten || r->tree_group_size>0){
+				reb_tree_flatten(r);
+				if (r->tree_group_size>0 && r->tree_flat_order_N==_N_real){
+					reb_calculate_acceleration_tree_groups(r);
+					break;
+				}
+				// Particles are visited in the order of the tree leaves. Nearby particles
+				// walk similar parts of the tree, which improves cache performance. 
+				const int* const order = r->tree_flat_order;
+				const int use_order = (r->tree_flat_order_N==_N_real);
+				// All ghostboxes are walked in one parallel region, each particle 
+				// sums them up in the same order as a loop over ghostboxes would.
+				int Ngb;
+				struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+				if (r->tree_tasks){
+					reb_calculate_acceleration_tree_tasks(r, gbs, Ngb, 1);
+					free(gbs);
+					break;
+				}
+				uint64_t interactions = 0;
+				uint64_t opened = 0;
+#pragma omp parallel for schedule(guided) reduction(+:interactions,opened)
+				for (int k=0; k<_N_real; k++){
+					const int i = use_order?order[k]:k;
+					int opened_i = 0;
+					for (int g=0; g<Ngb; g++){
+						struct reb_ghostbox gb = gbs[g];
+						gb.shiftx += particles[i].x;
+						gb.shifty += particles[i].y;
+						gb.shiftz += particles[i].z;
+						interactions += reb_calculate_acceleration_for_particle_flat(r, i, gb, &opened_i);
+					}
+					opened += opened_i;
+				}
+				r->metrics.interactions += interactions;
+				r->metrics.cells_opened += opened;
+				free(gbs);
+				break;
+			}
+#ifdef MPI
+			if (r->tree_essential_pending){
+#ifdef OPENMP
+				if (r->mpi_pipeline==2 && omp_get_max_threads()>1 && r->mpi_thread_support>=MPI_THREAD_FUNNELED){
+					reb_calculate_acceleration_tree_comm_thread(r);
+					break;
+				}
+#endif // OPENMP
+				// Forces from the local root boxes first, then from the root boxes 
+				// of each node as soon as its essential tree has arrived.
+				int proc = r->mpi_id;
+				do{
+					reb_calculate_acceleration_for_roots(r, proc);
+				}while((proc = reb_communication_mpi_wait_essential_tree_for_gravity(r))>=0);
+				break;
+			}
+#endif // MPI
+			// Summing over all Ghost Boxes, in one parallel region
+			int Ngb;
+			struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+			double skin;
+			if (!r->tree_tasks && reb_collision_fused_begin(r, &skin)){
+				reb_calculate_acceleration_tree_fused(r, gbs, Ngb, skin);
+				free(gbs);
+				break;
+			}
+			if (r->tree_tasks){
+				reb_calculate_acceleration_tree_tasks(r, gbs, Ngb, 0);
+				free(gbs);
+				break;
+			}
+			uint64_t interactions = 0;
+			uint64_t opened = 0;
+#pragma omp parallel for schedule(guided) reduction(+:interactions,opened)
+			for (int i=0; i<_N_real; i++){
+				int opened_i = 0;
+				for (int g=0; g<Ngb; g++){
+					struct reb_ghostbox gb = gbs[g];
 					// Precalculated shifted position
 					gb.shiftx += particles[i].x;
 					gb.shifty += particles[i].y;
 					gb.shiftz += particles[i].z;
-					reb_calculate_acceleration_for_particle(r, i, gb);
+					interactions += reb_calculate_acceleration_for_particle(r, i, gb, &opened_i);
 				}
+				opened += opened_i;
+			}
+			r->metrics.interactions += interactions;
+			r->metrics.cells_opened += opened;
+			free(gbs);
+		}
+		break;
+		case REB_GRAVITY_FMM:
+		{
+#pragma omp parallel for schedule(guided)
+			for (int i=0; i<N; i++){
+				particles[i].ax = 0; 
+				particles[i].ay = 0; 
+				particles[i].az = 0; 
 			}
+			reb_calculate_acceleration_fmm(r);
+		}
+		break;
+		case REB_GRAVITY_OPENCL:
+			reb_calculate_acceleration_opencl(r);
+		break;
+		case REB_GRAVITY_FFT:
+		case REB_GRAVITY_TREEPM:
+		{
+#pragma omp parallel for schedule(guided)
+			for (int i=0; i<N; i++){
+				particles[i].ax = 0; 
+				particles[i].ay = 0; 
+				particles[i].az = 0; 
 			}
+			if (r->gravity==REB_GRAVITY_FFT){
+				reb_calculate_acceleration_fft(r);
+			}else{
+				reb_calculate_acceleration_treepm(r);
 			}
 		}
 		break;
@@ -395,6 +750,79 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 
 }
 
+void reb_calculate_acceleration_tree_accuracy(struct reb_simulation* const r){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N - r->N_var;
+	const int samples = r->tree_force_accuracy_samples<N?r->tree_force_accuracy_samples:N;
+	if (samples<1) return;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	// Different particles are sampled every time.
+	const unsigned int interval = r->tree_force_accuracy_interval>0?r->tree_force_accuracy_interval:1;
+	const long offset = r->tree_force_accuracy_steps/interval;
+	double error2 = 0.;
+	// In reproducible mode, the errors are stored and summed up in order afterwards.
+	double* const errors = r->reproducible?calloc(samples, sizeof(double)):NULL;
+#pragma omp parallel for reduction(+:error2)
+	for (int s=0; s<samples; s++){
+		const int i = (int)((offset + (long)s*N/samples)%N);
+		double a[3] = {0.,0.,0.};
+		// Same ghost boxes and softening as the tree.
+		for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+		for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+		for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+			const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			const double xi = particles[i].x + gb.shiftx;
+			const double yi = particles[i].y + gb.shifty;
+			const double zi = particles[i].z + gb.shiftz;
+			for (int j=0; j<N; j++){
+				if (i==j) continue;
+				const double dx = xi - particles[j].x;
+				const double dy = yi - particles[j].y;
+				const double dz = zi - particles[j].z;
+				const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+				const double prefact = -G/(_r*_r*_r)*particles[j].m;
+				a[0] += prefact*dx;
+				a[1] += prefact*dy;
+				a[2] += prefact*dz;
+			}
+		}
+		}
+		}
+		const double a2 = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+		if (a2>0.){
+			const double dax = particles[i].ax - a[0];
+			const double day = particles[i].ay - a[1];
+			const double daz = particles[i].az - a[2];
+			const double e2 = (dax*dax + day*day + daz*daz)/a2;
+			if (errors){
+				errors[s] = e2;
+			}else{
+				error2 += e2;
+			}
+		}
+	}
+	if (errors){
+		for (int s=0; s<samples; s++){
+			error2 += errors[s];
+		}
+		free(errors);
+	}
+	const double error = sqrt(error2/samples);
+	r->tree_force_error = error;
+
+	// The error of a cell scales as theta^(p+1) for a multipole expansion of order p 
+	// about the center of mass (the dipole vanishes). Aim for 80% of the target and
+	// leave the opening angle alone within a factor of two of it to avoid oscillations.
+	const double target = r->tree_force_accuracy;
+	if (error>target || error<0.5*target){
+		const double k = r->multipole_order>=2?r->multipole_order+1:2;
+		double f = error>0.?pow(0.8*target/error, 2./k):2.;
+		f = fmin(fmax(f, 0.25), 2.);
+		r->opening_angle2 = fmin(fmax(r->opening_angle2*f, 1e-4), 1.);
+	}
+}
+
 void reb_calculate_acceleration_var(struct reb_simulation* r){
 	struct reb_particle* const particles = r->particles;
 	const double G = r->G;
@@ -415,61 +843,19 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
 			}
         }
 		case REB_GRAVITY_BASIC:
+            reb_calculate_acceleration_var_first_order_fused(r);
             for (int v=0;v<r->var_config_N;v++){
                 struct reb_variational_configuration const vc = r->var_config[v];
+                if (vc.order==1 && vc.testparticle<0){
+                    // Already done in reb_calculate_acceleration_var_first_order_fused().
+                    continue;
+                }
                 if (vc.order==1){
                     //////////////////
                     /// 1st order  ///
                     //////////////////
                     struct reb_particle* const particles_var1 = particles + vc.index;
-                    if (vc.testparticle<0){
-                        for (int i=0; i<_N_real; i++){
-                            particles_var1[i].ax = 0.; 
-                            particles_var1[i].ay = 0.; 
-                            particles_var1[i].az = 0.; 
-                        }
-                        for (int i=0; i<_N_real; i++){
-                        for (int j=i+1; j<_N_real; j++){
-                            if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
-                            if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
-                            const double dx = particles[i].x - particles[j].x;
-                            const double dy = particles[i].y - particles[j].y;
-                            const double dz = particles[i].z - particles[j].z;
-                            const double r2 = dx*dx + dy*dy + dz*dz;
-                            const double _r  = sqrt(r2);
-                            const double r3inv = 1./(r2*_r);
-                            const double r5inv = 3.*r3inv/r2;
-                            const double ddx = particles_var1[i].x - particles_var1[j].x;
-                            const double ddy = particles_var1[i].y - particles_var1[j].y;
-                            const double ddz = particles_var1[i].z - particles_var1[j].z;
-                            const double Gmi = G * particles[i].m;
-                            const double Gmj = G * particles[j].m;
-
-                            // Variational equations
-                            const double dxdx = dx*dx*r5inv - r3inv;
-                            const double dydy = dy*dy*r5inv - r3inv;
-                            const double dzdz = dz*dz*r5inv - r3inv;
-                            const double dxdy = dx*dy*r5inv;
-                            const double dxdz = dx*dz*r5inv;
-                            const double dydz = dy*dz*r5inv;
-                            const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
-                            const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
-                            const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
-
-                            // Variational mass contributions
-                            const double dGmi = G*particles_var1[i].m;
-                            const double dGmj = G*particles_var1[j].m;
-
-                            particles_var1[i].ax += Gmj * dax - dGmj*r3inv*dx;
-                            particles_var1[i].ay += Gmj * day - dGmj*r3inv*dy;
-                            particles_var1[i].az += Gmj * daz - dGmj*r3inv*dz;
-
-                            particles_var1[j].ax -= Gmi * dax - dGmi*r3inv*dx;
-                            particles_var1[j].ay -= Gmi * day - dGmi*r3inv*dy;
-                            particles_var1[j].az -= Gmi * daz - dGmi*r3inv*dz; 
-                        }
-                        }
-                    }else{ //testparticle
+                    { //testparticle
                         int i = vc.testparticle;
                         particles_var1[0].ax = 0.; 
                         particles_var1[0].ay = 0.; 
@@ -680,6 +1066,9 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
                 }
             }
 			break;
+		case REB_GRAVITY_TREE:
+			reb_calculate_acceleration_var_tree(r);
+			break;
 		default:
 			reb_exit("Variational gravity calculation not yet implemented.");
 	}
@@ -687,30 +1076,620 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
 }
 
 
-// Helper routines for REB_GRAVITY_TREE
+static void reb_calculate_acceleration_var_first_order_fused(struct reb_simulation* const r){
+	struct reb_particle* const particles = r->particles;
+	const double G = r->G;
+	const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+	const int _N_real = r->N - r->N_var;
+	int v = 0;
+	while (v<r->var_config_N){
+		// Collect the next batch of configurations.
+		struct reb_particle* vars[REB_VAR_FUSED_N];
+		int Nv = 0;
+		for (; v<r->var_config_N && Nv<REB_VAR_FUSED_N; v++){
+			const struct reb_variational_configuration* const vc = &(r->var_config[v]);
+			if (vc->order==1 && vc->testparticle<0){
+				vars[Nv] = particles + vc->index;
+				Nv++;
+			}
+		}
+		if (Nv==0) break;
+		for (int k=0; k<Nv; k++){
+			for (int i=0; i<_N_real; i++){
+				vars[k][i].ax = 0.; 
+				vars[k][i].ay = 0.; 
+				vars[k][i].az = 0.; 
+			}
+		}
+		for (int i=0; i<_N_real; i++){
+		for (int j=i+1; j<_N_real; j++){
+			if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
+			if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
+			const double dx = particles[i].x - particles[j].x;
+			const double dy = particles[i].y - particles[j].y;
+			const double dz = particles[i].z - particles[j].z;
+			const double r2 = dx*dx + dy*dy + dz*dz;
+			const double _r  = sqrt(r2);
+			const double r3inv = 1./(r2*_r);
+			const double r5inv = 3.*r3inv/r2;
+			const double Gmi = G * particles[i].m;
+			const double Gmj = G * particles[j].m;
 
+			// Tidal tensor
+			const double dxdx = dx*dx*r5inv - r3inv;
+			const double dydy = dy*dy*r5inv - r3inv;
+			const double dzdz = dz*dz*r5inv - r3inv;
+			const double dxdy = dx*dy*r5inv;
+			const double dxdz = dx*dz*r5inv;
+			const double dydz = dy*dz*r5inv;
 
-/**
-  * @brief The function calls itself recursively using cell breaking criterion to check whether it can use center of mass (and mass quadrupole tensor) to calculate forces.
-  * Calculate the acceleration for a particle from a given cell and all its daughter cells.
-  *
-  * @param r REBOUND simulation to consider
-  * @param pt Index of the particle the force is calculated for.
-  * @param node Pointer to the cell the force is calculated from.
-  * @param gb Ghostbox plus position of the particle (precalculated). 
-  */
-static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* const r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb);
+			for (int k=0; k<Nv; k++){
+				struct reb_particle* const vi = &(vars[k][i]);
+				struct reb_particle* const vj = &(vars[k][j]);
+				const double ddx = vi->x - vj->x;
+				const double ddy = vi->y - vj->y;
+				const double ddz = vi->z - vj->z;
+				const double dax =   ddx * dxdx + ddy * dxdy + ddz * dxdz;
+				const double day =   ddx * dxdy + ddy * dydy + ddz * dydz;
+				const double daz =   ddx * dxdz + ddy * dydz + ddz * dzdz;
 
-static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb) {
-	for(int i=0;i<r->root_n;i++){
+				// Variational mass contributions
+				const double dGmi = G*vi->m;
+				const double dGmj = G*vj->m;
+
+				vi->ax += Gmj * dax - dGmj*r3inv*dx;
+				vi->ay += Gmj * day - dGmj*r3inv*dy;
+				vi->az += Gmj * daz - dGmj*r3inv*dz;
+
+				vj->ax -= Gmi * dax - dGmi*r3inv*dx;
+				vj->ay -= Gmi * day - dGmi*r3inv*dy;
+				vj->az -= Gmi * daz - dGmi*r3inv*dz; 
+			}
+		}
+		}
+	}
+}
+
+/**
+ * @brief Adds the tidal tensor of one source (a cell or a particle) to the variational sums of a particle.
+ * @param dx x distance between the particle and the source.
+ * @param dy y distance between the particle and the source.
+ * @param dz z distance between the particle and the source.
+ * @param m Mass of the source.
+ * @param s Sums of m*dx, m*dy, m*dz and dm of the source, four values per configuration.
+ * @param Nv Number of configurations.
+ * @param G Gravitational constant.
+ * @param softening2 Square of the softening length.
+ * @param A Output. G*m times the tidal tensor (xx, xy, xz, yy, yz, zz) is added.
+ * @param b Output. The acceleration due to the displacements and masses of the source is added, three values per configuration.
+ */
+static inline void reb_tree_var_add_source(const double dx, const double dy, const double dz, const double m, const double* const s, const int Nv, const double G, const double softening2, double* const A, double* const b){
+	const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+	const double _r = sqrt(r2);
+	const double r3inv = 1./(r2*_r);
+	const double r5inv = 3.*r3inv/r2;
+	const double dxdx = dx*dx*r5inv - r3inv;
+	const double dydy = dy*dy*r5inv - r3inv;
+	const double dzdz = dz*dz*r5inv - r3inv;
+	const double dxdy = dx*dy*r5inv;
+	const double dxdz = dx*dz*r5inv;
+	const double dydz = dy*dz*r5inv;
+	const double Gm = G*m;
+	A[0] += Gm*dxdx;
+	A[1] += Gm*dxdy;
+	A[2] += Gm*dxdz;
+	A[3] += Gm*dydy;
+	A[4] += Gm*dydz;
+	A[5] += Gm*dzdz;
+	for (int k=0; k<Nv; k++){
+		const double* const sk = &(s[4*k]);
+		b[3*k+0] += G*(sk[0]*dxdx + sk[1]*dxdy + sk[2]*dxdz + sk[3]*r3inv*dx);
+		b[3*k+1] += G*(sk[0]*dxdy + sk[1]*dydy + sk[2]*dydz + sk[3]*r3inv*dy);
+		b[3*k+2] += G*(sk[0]*dxdz + sk[1]*dydz + sk[2]*dzdz + sk[3]*r3inv*dz);
+	}
+}
+
+/**
+ * @brief Adds the tidal tensor of the quadrupole moments of a cell, i.e. the gradient of the acceleration of reb_tree_multipole_acceleration() for order 2.
+ */
+static inline void reb_tree_var_add_quadrupole(const struct reb_treecell_multipoles* const mp, const double dx, const double dy, const double dz, const double softening2, const double G, double* const A){
+	const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+	const double _r = sqrt(r2);
+	const double r5inv = 1./(r2*r2*_r);
+	const double r7inv = r5inv/r2;
+	const double qx = dx*mp->mxx + dy*mp->mxy + dz*mp->mxz;
+	const double qy = dx*mp->mxy + dy*mp->myy + dz*mp->myz;
+	const double qz = dx*mp->mxz + dy*mp->myz + dz*mp->mzz;
+	const double mrr = dx*qx + dy*qy + dz*qz;
+	const double diag = -2.5*mrr*r7inv;
+	const double rr = 17.5*mrr*r7inv/r2;
+	A[0] += G*(mp->mxx*r5inv - 10.*qx*dx*r7inv + diag + rr*dx*dx);
+	A[1] += G*(mp->mxy*r5inv - 5.*(qx*dy + dx*qy)*r7inv + rr*dx*dy);
+	A[2] += G*(mp->mxz*r5inv - 5.*(qx*dz + dx*qz)*r7inv + rr*dx*dz);
+	A[3] += G*(mp->myy*r5inv - 10.*qy*dy*r7inv + diag + rr*dy*dy);
+	A[4] += G*(mp->myz*r5inv - 5.*(qy*dz + dy*qz)*r7inv + rr*dy*dz);
+	A[5] += G*(mp->mzz*r5inv - 10.*qz*dz*r7inv + diag + rr*dz*dz);
+}
+
+/**
+ * @brief Walks the flattened tree for one particle and sums up the variational terms.
+ * @param r REBOUND simulation to consider
+ * @param pt Index of the particle.
+ * @param gb Ghostbox plus position of the particle (precalculated). 
+ * @param sums Sums of m*dx, m*dy, m*dz and dm of all cells (4*Nv values per cell).
+ * @param psums Same as sums for every particle.
+ * @param Nv Number of configurations.
+ * @param A Output. The tidal tensor is added.
+ * @param b Output. The accelerations due to the variational displacements and masses of all other particles are added.
+ */
+static void reb_calculate_acceleration_var_tree_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, const double* const sums, const double* const psums, const int Nv, double* const A, double* const b){
+	const struct reb_particle* const particles = r->particles;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const double opening_angle2 = r->opening_angle2;
+	const int quadrupole = r->multipole_order>=2;
+	const struct reb_treecell_flat* const cells = r->tree_flat;
+	const int Ncells = r->tree_flat_N;
+	const int* const order = r->tree_flat_order;
+	int c = 0;
+	while (c<Ncells){
+		const struct reb_treecell_flat* const node = &(cells[c]);
+		const double dx = gb.shiftx - node->mx;
+		const double dy = gb.shifty - node->my;
+		const double dz = gb.shiftz - node->mz;
+		const double r2 = dx*dx + dy*dy + dz*dz;
+		if ( node->pt < 0 ) { // Not a leaf
+			if ( node->w2 > opening_angle2*r2 ){
+				if (node->first>=0){ // Leaf bucket
+					for (int k=node->first; k<node->first-node->pt; k++){
+						const int j = order[k];
+						if (j==pt) continue;
+						reb_tree_var_add_source(gb.shiftx - particles[j].x, gb.shifty - particles[j].y, gb.shiftz - particles[j].z, particles[j].m, &(psums[4*Nv*j]), Nv, G, softening2, A, b);
+					}
+					c = node->next;
+				}else{
+					c++; // Open cell
+				}
+				continue;
+			}
+			reb_tree_var_add_source(dx, dy, dz, node->m, &(sums[4*Nv*c]), Nv, G, softening2, A, b);
+			if (quadrupole){
+				reb_tree_var_add_quadrupole(&(r->tree_flat_multipoles[c]), dx, dy, dz, softening2, G, A);
+			}
+		} else if (node->pt != pt) { // It's a leaf node
+			reb_tree_var_add_source(dx, dy, dz, node->m, &(sums[4*Nv*c]), Nv, G, softening2, A, b);
+		}
+		c = node->next;
+	}
+}
+
+static void reb_calculate_acceleration_var_tree(struct reb_simulation* const r){
+#ifdef MPI
+	reb_exit("Variational equations are not supported for REB_GRAVITY_TREE with MPI.");
+#endif // MPI
+	struct reb_particle* const particles = r->particles;
+	const int _N_real = r->N - r->N_var;
+	struct reb_particle** const vars = malloc(sizeof(struct reb_particle*)*r->var_config_N);
+	int Nv = 0;
+	for (int v=0; v<r->var_config_N; v++){
+		const struct reb_variational_configuration* const vc = &(r->var_config[v]);
+		if (vc->order!=1){
+			reb_exit("Second order variational equations are not implemented for REB_GRAVITY_TREE.");
+		}
+		if (vc->testparticle<0){
+			vars[Nv++] = particles + vc->index;
+		}
+	}
+	reb_tree_flatten(r);
+	const struct reb_treecell_flat* const cells = r->tree_flat;
+	const int Ncells = r->tree_flat_N;
+	const int* const order = r->tree_flat_order;
+
+	// Mass weighted displacements and mass variations of all particles and cells.
+	double* const psums = malloc(sizeof(double)*(4*Nv*_N_real+1));
+	double* const sums = malloc(sizeof(double)*(4*Nv*Ncells+1));
+#pragma omp parallel for schedule(guided)
+	for (int j=0; j<_N_real; j++){
+		const double m = particles[j].m;
+		for (int k=0; k<Nv; k++){
+			psums[4*Nv*j+4*k+0] = m*vars[k][j].x;
+			psums[4*Nv*j+4*k+1] = m*vars[k][j].y;
+			psums[4*Nv*j+4*k+2] = m*vars[k][j].z;
+			psums[4*Nv*j+4*k+3] = vars[k][j].m;
+		}
+	}
+	// Daughters are stored after their parents.
+	for (int c=Ncells-1; c>=0; c--){
+		const struct reb_treecell_flat* const cell = &(cells[c]);
+		double* const s = &(sums[4*Nv*c]);
+		if (cell->pt>=0){
+			for (int l=0; l<4*Nv; l++){
+				s[l] = psums[4*Nv*cell->pt+l];
+			}
+			continue;
+		}
+		for (int l=0; l<4*Nv; l++){
+			s[l] = 0.;
+		}
+		if (cell->first>=0){
+			for (int k=cell->first; k<cell->first-cell->pt; k++){
+				for (int l=0; l<4*Nv; l++){
+					s[l] += psums[4*Nv*order[k]+l];
+				}
+			}
+		}else{
+			for (int d=c+1; d<cell->next; d=cells[d].next){
+				for (int l=0; l<4*Nv; l++){
+					s[l] += sums[4*Nv*d+l];
+				}
+			}
+		}
+	}
+
+	int Ngb;
+	struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+	if (Nv>0){
+#pragma omp parallel
+		{
+		double* const b = malloc(sizeof(double)*3*Nv);
+#pragma omp for schedule(guided)
+		for (int i=0; i<_N_real; i++){
+			double A[6] = {0.,0.,0.,0.,0.,0.};
+			for (int l=0; l<3*Nv; l++){
+				b[l] = 0.;
+			}
+			for (int g=0; g<Ngb; g++){
+				struct reb_ghostbox gb = gbs[g];
+				gb.shiftx += particles[i].x;
+				gb.shifty += particles[i].y;
+				gb.shiftz += particles[i].z;
+				reb_calculate_acceleration_var_tree_for_particle(r, i, gb, sums, psums, Nv, A, b);
+			}
+			for (int k=0; k<Nv; k++){
+				struct reb_particle* const vi = &(vars[k][i]);
+				vi->ax = A[0]*vi->x + A[1]*vi->y + A[2]*vi->z - b[3*k+0];
+				vi->ay = A[1]*vi->x + A[3]*vi->y + A[4]*vi->z - b[3*k+1];
+				vi->az = A[2]*vi->x + A[4]*vi->y + A[5]*vi->z - b[3*k+2];
+			}
+		}
+		free(b);
+		}
+	}
+	// Test particles: no variational mass contributions, only the tidal tensor is needed.
+	for (int v=0; v<r->var_config_N; v++){
+		const struct reb_variational_configuration* const vc = &(r->var_config[v]);
+		if (vc->testparticle<0){
+			continue;
+		}
+		const int i = vc->testparticle;
+		double A[6] = {0.,0.,0.,0.,0.,0.};
+		for (int g=0; g<Ngb; g++){
+			struct reb_ghostbox gb = gbs[g];
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			reb_calculate_acceleration_var_tree_for_particle(r, i, gb, sums, psums, 0, A, NULL);
+		}
+		struct reb_particle* const vi = particles + vc->index;
+		vi->ax = A[0]*vi->x + A[1]*vi->y + A[2]*vi->z;
+		vi->ay = A[1]*vi->x + A[3]*vi->y + A[4]*vi->z;
+		vi->az = A[2]*vi->x + A[4]*vi->y + A[5]*vi->z;
+	}
+	free(gbs);
+	free(sums);
+	free(psums);
+	free(vars);
+}
+
+// Helper routines for REB_GRAVITY_TREE
+
+
+/**
+  * @brief The function calls itself recursively using cell breaking criterion to check whether it can use center of mass (and mass quadrupole tensor) to calculate forces.
+  * Calculate the acceleration for a particle from a given cell and all its daughter cells.
+  *
+  * @param r REBOUND simulation to consider
+  * @param pt Index of the particle the force is calculated for.
+  * @param node Pointer to the cell the force is calculated from.
+  * @param gb Ghostbox plus position of the particle (precalculated). 
+  * @param opened Incremented by the number of opened cells.
+  * @return Number of interactions (accepted cells and particles).
+  */
+static int reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* const r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb, int* const opened);
+
+/**
+  * @brief Acceleration due to the quadrupole (and octupole if order>=3) moments of a cell.
+  * @details The monopole term is not included. The quadrupole term follows Hernquist (1987).
+  * @param mp Multipole moments of the cell.
+  * @param order Multipole order (2 or 3).
+  * @param dx x distance between the particle and the center of mass of the cell.
+  * @param dy y distance between the particle and the center of mass of the cell.
+  * @param dz z distance between the particle and the center of mass of the cell.
+  * @param _r Softened distance.
+  * @param G Gravitational constant.
+  * @param a Output. The acceleration is added to a[0], a[1], a[2].
+  */
+static inline void reb_tree_multipole_acceleration(const struct reb_treecell_multipoles* const mp, const int order, const double dx, const double dy, const double dz, const double _r, const double G, double* const a){
+	const double _r2 = _r*_r;
+	double qprefact = G/(_r2*_r2*_r);
+	a[0] += qprefact*(dx*mp->mxx + dy*mp->mxy + dz*mp->mxz); 
+	a[1] += qprefact*(dx*mp->mxy + dy*mp->myy + dz*mp->myz); 
+	a[2] += qprefact*(dx*mp->mxz + dy*mp->myz + dz*mp->mzz); 
+	double mrr 	= dx*dx*mp->mxx 	+ dy*dy*mp->myy 	+ dz*dz*mp->mzz
+			+ 2.*dx*dy*mp->mxy 	+ 2.*dx*dz*mp->mxz 	+ 2.*dy*dz*mp->myz; 
+	qprefact *= -5.0/(2.0*_r2)*mrr;
+	a[0] += qprefact * dx; 
+	a[1] += qprefact * dy; 
+	a[2] += qprefact * dz; 
+	if (order>=3){
+		// Octupole term from the third moments S_ijk: V_i = S_ijk d_j d_k, t_i = S_ijj.
+		const double vx = mp->mxxx*dx*dx + mp->mxyy*dy*dy + mp->mxzz*dz*dz + 2.*(mp->mxxy*dx*dy + mp->mxxz*dx*dz + mp->mxyz*dy*dz);
+		const double vy = mp->mxxy*dx*dx + mp->myyy*dy*dy + mp->myzz*dz*dz + 2.*(mp->mxyy*dx*dy + mp->mxyz*dx*dz + mp->myyz*dy*dz);
+		const double vz = mp->mxxz*dx*dx + mp->myyz*dy*dy + mp->mzzz*dz*dz + 2.*(mp->mxyz*dx*dy + mp->mxzz*dx*dz + mp->myzz*dy*dz);
+		const double tx = mp->mxxx + mp->mxyy + mp->mxzz;
+		const double ty = mp->mxxy + mp->myyy + mp->myzz;
+		const double tz = mp->mxxz + mp->myyz + mp->mzzz;
+		const double s3 = dx*vx + dy*vy + dz*vz;
+		const double dt = dx*tx + dy*ty + dz*tz;
+		const double _r5 = _r2*_r2*_r;
+		const double oprefact = G/(_r5*_r2);
+		const double rprefact = oprefact*(7.5*dt - 17.5*s3/_r2);
+		a[0] += 7.5*oprefact*vx - 1.5*G/_r5*tx + rprefact*dx; 
+		a[1] += 7.5*oprefact*vy - 1.5*G/_r5*ty + rprefact*dy; 
+		a[2] += 7.5*oprefact*vz - 1.5*G/_r5*tz + rprefact*dz; 
+	}
+}
+
+/**
+  * @brief Multipole moments of a cell in single precision.
+  */
+struct reb_treecell_multipoles_float {
+	float mxx, mxy, mxz, myy, myz, mzz;
+	float mxxx, mxxy, mxxz, mxyy, mxyz, mxzz, myyy, myyz, myzz, mzzz;
+};
+
+/**
+  * @brief Single precision version of reb_tree_multipole_acceleration().
+  */
+static inline void reb_tree_multipole_acceleration_float(const struct reb_treecell_multipoles_float* const mp, const int order, const float dx, const float dy, const float dz, const float _r, const float G, float* const a){
+	const float _r2 = _r*_r;
+	float qprefact = G/(_r2*_r2*_r);
+	a[0] += qprefact*(dx*mp->mxx + dy*mp->mxy + dz*mp->mxz); 
+	a[1] += qprefact*(dx*mp->mxy + dy*mp->myy + dz*mp->myz); 
+	a[2] += qprefact*(dx*mp->mxz + dy*mp->myz + dz*mp->mzz); 
+	float mrr 	= dx*dx*mp->mxx 	+ dy*dy*mp->myy 	+ dz*dz*mp->mzz
+			+ 2.f*dx*dy*mp->mxy 	+ 2.f*dx*dz*mp->mxz 	+ 2.f*dy*dz*mp->myz; 
+	qprefact *= -5.0f/(2.0f*_r2)*mrr;
+	a[0] += qprefact * dx; 
+	a[1] += qprefact * dy; 
+	a[2] += qprefact * dz; 
+	if (order>=3){
+		const float vx = mp->mxxx*dx*dx + mp->mxyy*dy*dy + mp->mxzz*dz*dz + 2.f*(mp->mxxy*dx*dy + mp->mxxz*dx*dz + mp->mxyz*dy*dz);
+		const float vy = mp->mxxy*dx*dx + mp->myyy*dy*dy + mp->myzz*dz*dz + 2.f*(mp->mxyy*dx*dy + mp->mxyz*dx*dz + mp->myyz*dy*dz);
+		const float vz = mp->mxxz*dx*dx + mp->myyz*dy*dy + mp->mzzz*dz*dz + 2.f*(mp->mxyz*dx*dy + mp->mxzz*dx*dz + mp->myzz*dy*dz);
+		const float tx = mp->mxxx + mp->mxyy + mp->mxzz;
+		const float ty = mp->mxxy + mp->myyy + mp->myzz;
+		const float tz = mp->mxxz + mp->myyz + mp->mzzz;
+		const float s3 = dx*vx + dy*vy + dz*vz;
+		const float dt = dx*tx + dy*ty + dz*tz;
+		const float _r5 = _r2*_r2*_r;
+		const float oprefact = G/(_r5*_r2);
+		const float rprefact = oprefact*(7.5f*dt - 17.5f*s3/_r2);
+		a[0] += 7.5f*oprefact*vx - 1.5f*G/_r5*tx + rprefact*dx; 
+		a[1] += 7.5f*oprefact*vy - 1.5f*G/_r5*ty + rprefact*dy; 
+		a[2] += 7.5f*oprefact*vz - 1.5f*G/_r5*tz + rprefact*dz; 
+	}
+}
+
+#ifdef MPI
+static void reb_calculate_acceleration_for_roots(struct reb_simulation* const r, const int proc){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	int Ngb;
+	struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+	uint64_t interactions = 0;
+	uint64_t opened = 0;
+#pragma omp parallel for schedule(guided) reduction(+:interactions,opened)
+	for (int i=0; i<N; i++){
+		int opened_i = 0;
+		for (int g=0; g<Ngb; g++){
+			struct reb_ghostbox gb = gbs[g];
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			for (int j=0; j<r->root_n; j++){
+				struct reb_treecell* node = r->tree_root[j];
+				if (node!=NULL && r->mpi_root_owner[j]==proc){
+					interactions += reb_calculate_acceleration_for_particle_from_cell(r, i, node, gb, &opened_i);
+				}
+			}
+		}
+		opened += opened_i;
+	}
+	r->metrics.interactions += interactions;
+	r->metrics.cells_opened += opened;
+	free(gbs);
+}
+
+#ifdef OPENMP
+// Adds the forces from either the local or the non-local root boxes (including the Ngb ghost boxes in gbs) to particle i.
+static void reb_calculate_acceleration_for_particle_from_roots(struct reb_simulation* const r, const int i, const int local, const struct reb_ghostbox* const gbs, const int Ngb){
+	struct reb_particle* const particles = r->particles;
+	int interactions = 0;
+	int opened = 0;
+	for (int g=0; g<Ngb; g++){
+		struct reb_ghostbox gb = gbs[g];
+		gb.shiftx += particles[i].x;
+		gb.shifty += particles[i].y;
+		gb.shiftz += particles[i].z;
+		for (int j=0; j<r->root_n; j++){
+			struct reb_treecell* node = r->tree_root[j];
+			if (node!=NULL && (r->mpi_root_owner[j]==r->mpi_id)==local){
+				interactions += reb_calculate_acceleration_for_particle_from_cell(r, i, node, gb, &opened);
+			}
+		}
+	}
+#pragma omp atomic
+	r->metrics.interactions += interactions;
+#pragma omp atomic
+	r->metrics.cells_opened += opened;
+}
+
+static void reb_calculate_acceleration_tree_comm_thread(struct reb_simulation* const r){
+	const int N = r->N;
+	int Ngb;
+	struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+#pragma omp parallel
+	{
+#pragma omp master
+		{
+			// Only writes to non-local root boxes, which are not read by the other threads yet.
+			while (reb_communication_mpi_wait_essential_tree_for_gravity(r)>=0);
+		}
+#pragma omp for schedule(dynamic,16)
+		for (int i=0; i<N; i++){
+			reb_calculate_acceleration_for_particle_from_roots(r, i, 1, gbs, Ngb);
+		}
+#pragma omp for schedule(guided)
+		for (int i=0; i<N; i++){
+			reb_calculate_acceleration_for_particle_from_roots(r, i, 0, gbs, Ngb);
+		}
+	}
+	free(gbs);
+}
+#endif // OPENMP
+#endif // MPI
+
+/**
+  * @brief Number of tasks per thread used by reb_calculate_acceleration_tree_tasks().
+  */
+#define REB_TREE_TASKS_PER_THREAD 8
+
+// Appends the particles of all leaves below node to order, depth first.
+static void reb_tree_tasks_order_cell(const struct reb_treecell* const node, int* const order, int* const n){
+	if (node->pt>=0){
+		order[(*n)++] = node->pt;
+		return;
+	}
+	for (int o=0; o<8; o++){
+		if (node->oct[o]!=NULL){
+			reb_tree_tasks_order_cell(node->oct[o], order, n);
+		}
+	}
+}
+
+static void reb_calculate_acceleration_tree_tasks_range(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int Ngb, const int flat, const int* const order, const int k0, const int k1){
+	const struct reb_particle* const particles = r->particles;
+	float* const cost = r->tree_task_cost;
+	uint64_t interactions_range = 0;
+	uint64_t opened_range = 0;
+	for (int k=k0; k<k1; k++){
+		const int i = order[k];
+		int interactions = 0;
+		int opened = 0;
+		for (int g=0; g<Ngb; g++){
+			struct reb_ghostbox gb = gbs[g];
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			if (flat){
+				interactions += reb_calculate_acceleration_for_particle_flat(r, i, gb, &opened);
+			}else{
+				interactions += reb_calculate_acceleration_for_particle(r, i, gb, &opened);
+			}
+		}
+		cost[i] = interactions>0?interactions:1;
+		interactions_range += interactions;
+		opened_range += opened;
+	}
+#pragma omp atomic
+	r->metrics.interactions += interactions_range;
+#pragma omp atomic
+	r->metrics.cells_opened += opened_range;
+}
+
+static void reb_calculate_acceleration_tree_tasks(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int Ngb, const int flat){
+	const int N = r->N - r->N_var;
+	if (N<1) return;
+	if (r->tree_task_allocatedN<N){
+		r->tree_task_cost = realloc(r->tree_task_cost, sizeof(float)*N);
+		r->tree_task_order = realloc(r->tree_task_order, sizeof(int)*N);
+		// No estimates for new particles yet.
+		for (int i=r->tree_task_allocatedN; i<N; i++){
+			r->tree_task_cost[i] = 1.f;
+		}
+		r->tree_task_allocatedN = N;
+	}
+	const int* order = r->tree_task_order;
+	if (flat && r->tree_flat_order_N==N){
+		order = r->tree_flat_order;
+	}else{
+		int n = 0;
+		for (int i=0; i<r->root_n; i++){
+			if (r->tree_root[i]!=NULL){
+				reb_tree_tasks_order_cell(r->tree_root[i], r->tree_task_order, &n);
+			}
+		}
+		if (n!=N){
+			// Particles which are not in the tree (e.g. with tree_active_only) are visited last.
+			char* const in_tree = calloc(N, sizeof(char));
+			for (int k=0; k<n; k++){
+				in_tree[r->tree_task_order[k]] = 1;
+			}
+			n = 0;
+			for (int i=0; i<N; i++){
+				if (in_tree[i]) continue;
+				r->tree_task_order[N-1-n++] = i;
+			}
+			free(in_tree);
+		}
+	}
+	// Split the leaf order into ranges with similar cost.
+	const float* const cost = r->tree_task_cost;
+	double total = 0.;
+	for (int k=0; k<N; k++){
+		total += cost[order[k]];
+	}
+	int threads = 1;
+#ifdef OPENMP
+	threads = omp_get_max_threads();
+#endif // OPENMP
+	const int N_tasks = N<REB_TREE_TASKS_PER_THREAD*threads?N:REB_TREE_TASKS_PER_THREAD*threads;
+	int* const bounds = malloc(sizeof(int)*(N_tasks+1));
+	bounds[0] = 0;
+	int t = 1;
+	double sum = 0.;
+	for (int k=0; k<N && t<N_tasks; k++){
+		sum += cost[order[k]];
+		while (t<N_tasks && sum>=total*t/N_tasks){
+			bounds[t++] = k+1;
+		}
+	}
+	while (t<=N_tasks){
+		bounds[t++] = N;
+	}
+#pragma omp parallel
+#pragma omp single
+	for (int task=0; task<N_tasks; task++){
+		if (bounds[task]==bounds[task+1]) continue;
+#pragma omp task firstprivate(task)
+		reb_calculate_acceleration_tree_tasks_range(r, gbs, Ngb, flat, order, bounds[task], bounds[task+1]);
+	}
+	free(bounds);
+}
+
+static int reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, int* const opened) {
+	int interactions = 0;
+	for(int i=0;i<r->root_n;i++){
 		struct reb_treecell* node = r->tree_root[i];
 		if (node!=NULL){
-			reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb);
+			interactions += reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb, opened);
 		}
 	}
+	return interactions;
 }
 
-static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb) {
+static int reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb, int* const opened) {
 	const double G = r->G;
 	const double softening2 = r->softening*r->softening;
 	struct reb_particle* const particles = r->particles;
@@ -720,38 +1699,759 @@ static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_s
 	const double r2 = dx*dx + dy*dy + dz*dz;
 	if ( node->pt < 0 ) { // Not a leaf
 		if ( node->w*node->w > r->opening_angle2*r2 ){
+			int interactions = 0;
+			(*opened)++;
 			for (int o=0; o<8; o++) {
 				if (node->oct[o] != NULL) {
-					reb_calculate_acceleration_for_particle_from_cell(r, pt, node->oct[o], gb);
+					interactions += reb_calculate_acceleration_for_particle_from_cell(r, pt, node->oct[o], gb, opened);
 				}
 			}
+			return interactions;
 		} else {
 			double _r = sqrt(r2 + softening2);
 			double prefact = -G/(_r*_r*_r)*node->m;
-#ifdef QUADRUPOLE
-			double qprefact = G/(_r*_r*_r*_r*_r);
-			particles[pt].ax += qprefact*(dx*node->mxx + dy*node->mxy + dz*node->mxz); 
-			particles[pt].ay += qprefact*(dx*node->mxy + dy*node->myy + dz*node->myz); 
-			particles[pt].az += qprefact*(dx*node->mxz + dy*node->myz + dz*node->mzz); 
-			double mrr 	= dx*dx*node->mxx 	+ dy*dy*node->myy 	+ dz*dz*node->mzz
-					+ 2.*dx*dy*node->mxy 	+ 2.*dx*dz*node->mxz 	+ 2.*dy*dz*node->myz; 
-			qprefact *= -5.0/(2.0*_r*_r)*mrr;
-			particles[pt].ax += (qprefact + prefact) * dx; 
-			particles[pt].ay += (qprefact + prefact) * dy; 
-			particles[pt].az += (qprefact + prefact) * dz; 
-#else
 			particles[pt].ax += prefact*dx; 
 			particles[pt].ay += prefact*dy; 
 			particles[pt].az += prefact*dz; 
-#endif
+			if (r->multipole_order>=2){
+				double a[3] = {0.,0.,0.};
+				reb_tree_multipole_acceleration(node->mp, r->multipole_order, dx, dy, dz, _r, G, a);
+				particles[pt].ax += a[0]; 
+				particles[pt].ay += a[1]; 
+				particles[pt].az += a[2]; 
+			}
 		}
 	} else { // It's a leaf node
-		if (node->pt == pt) return;
+		if (node->pt == pt) return 0;
 		double _r = sqrt(r2 + softening2);
 		double prefact = -G/(_r*_r*_r)*node->m;
 		particles[pt].ax += prefact*dx; 
 		particles[pt].ay += prefact*dy; 
 		particles[pt].az += prefact*dz; 
 	}
+	return 1;
 }
 
+/**
+  * @brief Same as reb_calculate_acceleration_for_particle_from_cell() but also adds collision candidates to a thread-local list.
+  * @param skin Additional search distance for collision candidates. No candidates are collected if negative.
+  * @param candidates Pointer to thread-local list of candidates.
+  * @param candidates_N Pointer to number of candidates in list.
+  * @param candidates_allocatedN Pointer to size allocated for list.
+  */
+static int reb_calculate_acceleration_for_particle_from_cell_fused(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb, int* const opened, const double skin, struct reb_collision_verlet_candidate** candidates, int* candidates_N, int* candidates_allocatedN) {
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	struct reb_particle* const particles = r->particles;
+	const double dx = gb.shiftx - node->mx;
+	const double dy = gb.shifty - node->my;
+	const double dz = gb.shiftz - node->mz;
+	const double r2 = dx*dx + dy*dy + dz*dz;
+	if ( node->pt < 0 ) { // Not a leaf
+		if ( node->w*node->w > r->opening_angle2*r2 ){
+			int interactions = 0;
+			(*opened)++;
+			for (int o=0; o<8; o++) {
+				if (node->oct[o] != NULL) {
+					interactions += reb_calculate_acceleration_for_particle_from_cell_fused(r, pt, node->oct[o], gb, opened, skin, candidates, candidates_N, candidates_allocatedN);
+				}
+			}
+			return interactions;
+		} else {
+			double _r = sqrt(r2 + softening2);
+			double prefact = -G/(_r*_r*_r)*node->m;
+			particles[pt].ax += prefact*dx; 
+			particles[pt].ay += prefact*dy; 
+			particles[pt].az += prefact*dz; 
+			if (r->multipole_order>=2){
+				double a[3] = {0.,0.,0.};
+				reb_tree_multipole_acceleration(node->mp, r->multipole_order, dx, dy, dz, _r, G, a);
+				particles[pt].ax += a[0]; 
+				particles[pt].ay += a[1]; 
+				particles[pt].az += a[2]; 
+			}
+		}
+	} else { // It's a leaf node
+		if (node->pt == pt) return 0;
+		double _r = sqrt(r2 + softening2);
+		double prefact = -G/(_r*_r*_r)*node->m;
+		particles[pt].ax += prefact*dx; 
+		particles[pt].ay += prefact*dy; 
+		particles[pt].az += prefact*dz; 
+	}
+	if (skin>=0.){
+		// Accepted cell or leaf. Neighbours inside are not visited by the gravity walk again.
+		reb_collision_verlet_add_cell(r, candidates, candidates_N, candidates_allocatedN, gb, pt, particles[pt].r, skin, node);
+	}
+	return 1;
+}
+
+static void reb_calculate_acceleration_tree_fused(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int Ngb, const double skin){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	// Only the inner most ring of ghostboxes is searched for collisions.
+	char* const collide = malloc(sizeof(char)*Ngb);
+	int n = 0;
+	for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+	for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+	for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+		collide[n++] = (abs(gbx)<=1 && abs(gby)<=1 && abs(gbz)<=1);
+	}
+	}
+	}
+	uint64_t interactions = 0;
+	uint64_t opened = 0;
+#pragma omp parallel reduction(+:interactions,opened)
+	{
+	struct reb_collision_verlet_candidate* candidates = NULL;
+	int candidates_N = 0;
+	int candidates_allocatedN = 0;
+#pragma omp for schedule(guided)
+	for (int i=0; i<N; i++){
+		int opened_i = 0;
+		const int first = candidates_N;
+		for (int g=0; g<Ngb; g++){
+			struct reb_ghostbox gb = gbs[g];
+			// Precalculated shifted position
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			const double skin_g = collide[g]?skin:-1.;
+			for (int ri=0; ri<r->root_n; ri++){
+				struct reb_treecell* node = r->tree_root[ri];
+				if (node!=NULL){
+					interactions += reb_calculate_acceleration_for_particle_from_cell_fused(r, i, node, gb, &opened_i, skin_g, &candidates, &candidates_N, &candidates_allocatedN);
+				}
+			}
+		}
+		// Remove particles found in more than one ghostbox.
+		reb_collision_verlet_unique(candidates, first, &candidates_N);
+		opened += opened_i;
+	}
+	reb_collision_verlet_assemble(r, candidates, candidates_N);
+	free(candidates);
+	}
+	r->metrics.interactions += interactions;
+	r->metrics.cells_opened += opened;
+	free(collide);
+}
+
+static int reb_calculate_acceleration_for_particle_flat(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb, int* const opened) {
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const double opening_angle2 = r->opening_angle2;
+	const int order = r->multipole_order;
+	const struct reb_treecell_flat* const cells = r->tree_flat;
+	const int Ncells = r->tree_flat_N;
+	const int* const order_flat = r->tree_flat_order;
+	const struct reb_particle* const particles = r->particles;
+	double ax = r->particles[pt].ax;
+	double ay = r->particles[pt].ay;
+	double az = r->particles[pt].az;
+	int interactions = 0;
+	int n_opened = 0;
+	int c = 0;
+	while (c<Ncells){
+		const struct reb_treecell_flat* const node = &(cells[c]);
+		const double dx = gb.shiftx - node->mx;
+		const double dy = gb.shifty - node->my;
+		const double dz = gb.shiftz - node->mz;
+		const double r2 = dx*dx + dy*dy + dz*dz;
+		if ( node->pt < 0 ) { // Not a leaf
+			if ( node->w2 > opening_angle2*r2 ){
+				n_opened++;
+				if (node->first>=0){ // Leaf bucket, direct summation
+					const int first = node->first;
+					const int last = first - node->pt;
+					for (int k=first; k<last; k++){
+						const int j = order_flat[k];
+						const double dxj = gb.shiftx - particles[j].x;
+						const double dyj = gb.shifty - particles[j].y;
+						const double dzj = gb.shiftz - particles[j].z;
+						const double r2j = dxj*dxj + dyj*dyj + dzj*dzj;
+						const double _rj = sqrt(r2j + softening2);
+						const double prefact = j==pt?0.:-G/(_rj*_rj*_rj)*particles[j].m;
+						ax += prefact*dxj; 
+						ay += prefact*dyj; 
+						az += prefact*dzj; 
+					}
+					interactions += last - first;
+					c = node->next;
+				}else{
+					c++; // Open cell
+				}
+				continue;
+			}
+			double _r = sqrt(r2 + softening2);
+			double prefact = -G/(_r*_r*_r)*node->m;
+			ax += prefact*dx; 
+			ay += prefact*dy; 
+			az += prefact*dz; 
+			if (order>=2){
+				double a[3] = {0.,0.,0.};
+				reb_tree_multipole_acceleration(&(r->tree_flat_multipoles[c]), order, dx, dy, dz, _r, G, a);
+				ax += a[0]; 
+				ay += a[1]; 
+				az += a[2]; 
+			}
+			interactions++;
+		} else if (node->pt != pt) { // It's a leaf node
+			double _r = sqrt(r2 + softening2);
+			double prefact = -G/(_r*_r*_r)*node->m;
+			ax += prefact*dx; 
+			ay += prefact*dy; 
+			az += prefact*dz; 
+			interactions++;
+		}
+		c = node->next;
+	}
+	r->particles[pt].ax = ax;
+	r->particles[pt].ay = ay;
+	r->particles[pt].az = az;
+	*opened += n_opened;
+	return interactions;
+}
+
+/**
+  * @brief Applies the cells in an interaction list to a particle at position (xi,yi,zi).
+  * @details The multipole order is a compile time constant in each of the callers, so that 
+  * a separate loop is generated for each order and the monopole loop does not contain 
+  * any multipole terms.
+  */
+static inline void reb_tree_interaction_list_apply_cells_order(const struct reb_tree_interaction_list* const list, const int order, const double xi, const double yi, const double zi, const double G, const double softening2, double* const a){
+	const double* restrict const mx = list->cells[0];
+	const double* restrict const my = list->cells[1];
+	const double* restrict const mz = list->cells[2];
+	const double* restrict const m  = list->cells[3];
+	const double* restrict const mxx = list->cells[4];
+	const double* restrict const mxy = list->cells[5];
+	const double* restrict const mxz = list->cells[6];
+	const double* restrict const myy = list->cells[7];
+	const double* restrict const myz = list->cells[8];
+	const double* restrict const mzz = list->cells[9];
+	const double* restrict const mxxx = list->cells[10];
+	const double* restrict const mxxy = list->cells[11];
+	const double* restrict const mxxz = list->cells[12];
+	const double* restrict const mxyy = list->cells[13];
+	const double* restrict const mxyz = list->cells[14];
+	const double* restrict const mxzz = list->cells[15];
+	const double* restrict const myyy = list->cells[16];
+	const double* restrict const myyz = list->cells[17];
+	const double* restrict const myzz = list->cells[18];
+	const double* restrict const mzzz = list->cells[19];
+	const int N = list->N_cells;
+	double ax = 0.;
+	double ay = 0.;
+	double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+	for (int c=0; c<N; c++){
+		const double dx = xi - mx[c];
+		const double dy = yi - my[c];
+		const double dz = zi - mz[c];
+		const double r2 = dx*dx + dy*dy + dz*dz;
+		const double _r = sqrt(r2 + softening2);
+		const double prefact = -G/(_r*_r*_r)*m[c];
+		ax += prefact*dx; 
+		ay += prefact*dy; 
+		az += prefact*dz; 
+		if (order>=2){
+			const struct reb_treecell_multipoles mp = {
+				.mxx = mxx[c], .mxy = mxy[c], .mxz = mxz[c], .myy = myy[c], .myz = myz[c], .mzz = mzz[c],
+				.mxxx = order>=3?mxxx[c]:0., .mxxy = order>=3?mxxy[c]:0., .mxxz = order>=3?mxxz[c]:0.,
+				.mxyy = order>=3?mxyy[c]:0., .mxyz = order>=3?mxyz[c]:0., .mxzz = order>=3?mxzz[c]:0.,
+				.myyy = order>=3?myyy[c]:0., .myyz = order>=3?myyz[c]:0., .myzz = order>=3?myzz[c]:0.,
+				.mzzz = order>=3?mzzz[c]:0.,
+			};
+			double q[3] = {0.,0.,0.};
+			reb_tree_multipole_acceleration(&mp, order, dx, dy, dz, _r, G, q);
+			ax += q[0]; 
+			ay += q[1]; 
+			az += q[2]; 
+		}
+	}
+	a[0] += ax;
+	a[1] += ay;
+	a[2] += az;
+}
+
+/**
+  * @brief Monopole version of reb_tree_interaction_list_apply_cells_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_monopole(const struct reb_tree_interaction_list* const list, const double xi, const double yi, const double zi, const double G, const double softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_order(list, 0, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Quadrupole version of reb_tree_interaction_list_apply_cells_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_quadrupole(const struct reb_tree_interaction_list* const list, const double xi, const double yi, const double zi, const double G, const double softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_order(list, 2, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Octupole version of reb_tree_interaction_list_apply_cells_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_octupole(const struct reb_tree_interaction_list* const list, const double xi, const double yi, const double zi, const double G, const double softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_order(list, 3, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Single precision version of reb_tree_interaction_list_apply_cells_order().
+  * @details Uses list->cells_float. The position (xi,yi,zi) is relative to the centre of the group.
+  * The contributions of the cells are evaluated in single precision, but summed up in double precision.
+  */
+static inline void reb_tree_interaction_list_apply_cells_float_order(const struct reb_tree_interaction_list* const list, const int order, const float xi, const float yi, const float zi, const float G, const float softening2, double* const a){
+	const float* restrict const mx = list->cells_float[0];
+	const float* restrict const my = list->cells_float[1];
+	const float* restrict const mz = list->cells_float[2];
+	const float* restrict const m  = list->cells_float[3];
+	const float* restrict const mxx = list->cells_float[4];
+	const float* restrict const mxy = list->cells_float[5];
+	const float* restrict const mxz = list->cells_float[6];
+	const float* restrict const myy = list->cells_float[7];
+	const float* restrict const myz = list->cells_float[8];
+	const float* restrict const mzz = list->cells_float[9];
+	const float* restrict const mxxx = list->cells_float[10];
+	const float* restrict const mxxy = list->cells_float[11];
+	const float* restrict const mxxz = list->cells_float[12];
+	const float* restrict const mxyy = list->cells_float[13];
+	const float* restrict const mxyz = list->cells_float[14];
+	const float* restrict const mxzz = list->cells_float[15];
+	const float* restrict const myyy = list->cells_float[16];
+	const float* restrict const myyz = list->cells_float[17];
+	const float* restrict const myzz = list->cells_float[18];
+	const float* restrict const mzzz = list->cells_float[19];
+	const int N = list->N_cells;
+	double ax = 0.;
+	double ay = 0.;
+	double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+	for (int c=0; c<N; c++){
+		const float dx = xi - mx[c];
+		const float dy = yi - my[c];
+		const float dz = zi - mz[c];
+		const float r2 = dx*dx + dy*dy + dz*dz;
+		const float _r = sqrtf(r2 + softening2);
+		float prefact = -G/(_r*_r*_r)*m[c];
+		float q[3] = {prefact*dx, prefact*dy, prefact*dz};
+		if (order>=2){
+			const struct reb_treecell_multipoles_float mp = {
+				.mxx = mxx[c], .mxy = mxy[c], .mxz = mxz[c], .myy = myy[c], .myz = myz[c], .mzz = mzz[c],
+				.mxxx = order>=3?mxxx[c]:0.f, .mxxy = order>=3?mxxy[c]:0.f, .mxxz = order>=3?mxxz[c]:0.f,
+				.mxyy = order>=3?mxyy[c]:0.f, .mxyz = order>=3?mxyz[c]:0.f, .mxzz = order>=3?mxzz[c]:0.f,
+				.myyy = order>=3?myyy[c]:0.f, .myyz = order>=3?myyz[c]:0.f, .myzz = order>=3?myzz[c]:0.f,
+				.mzzz = order>=3?mzzz[c]:0.f,
+			};
+			reb_tree_multipole_acceleration_float(&mp, order, dx, dy, dz, _r, G, q);
+		}
+		ax += q[0]; 
+		ay += q[1]; 
+		az += q[2]; 
+	}
+	a[0] += ax;
+	a[1] += ay;
+	a[2] += az;
+}
+
+/**
+  * @brief Monopole version of reb_tree_interaction_list_apply_cells_float_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_float_monopole(const struct reb_tree_interaction_list* const list, const float xi, const float yi, const float zi, const float G, const float softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_float_order(list, 0, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Quadrupole version of reb_tree_interaction_list_apply_cells_float_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_float_quadrupole(const struct reb_tree_interaction_list* const list, const float xi, const float yi, const float zi, const float G, const float softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_float_order(list, 2, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Octupole version of reb_tree_interaction_list_apply_cells_float_order().
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_cells_float_octupole(const struct reb_tree_interaction_list* const list, const float xi, const float yi, const float zi, const float G, const float softening2, double* const a){
+	reb_tree_interaction_list_apply_cells_float_order(list, 3, xi, yi, zi, G, softening2, a);
+}
+
+/**
+  * @brief Applies the particles in an interaction list to the particle with index pt at position (xi,yi,zi).
+  * @details The particle itself is masked out instead of branching.
+  */
+REB_GRAVITY_TARGET_CLONES
+static void reb_tree_interaction_list_apply_particles(const struct reb_tree_interaction_list* const list, const int pt, const double xi, const double yi, const double zi, const double G, const double softening2, double* const a){
+	const double* restrict const x = list->particles[0];
+	const double* restrict const y = list->particles[1];
+	const double* restrict const z = list->particles[2];
+	const double* restrict const m = list->particles[3];
+	const int* restrict const index = list->index;
+	const int N = list->N_particles;
+	double ax = 0.;
+	double ay = 0.;
+	double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+	for (int j=0; j<N; j++){
+		const double dx = xi - x[j];
+		const double dy = yi - y[j];
+		const double dz = zi - z[j];
+		const double r2 = dx*dx + dy*dy + dz*dz;
+		const double _r = sqrt(r2 + softening2);
+		const double prefact = index[j]==pt?0.:-G/(_r*_r*_r)*m[j];
+		ax += prefact*dx; 
+		ay += prefact*dy; 
+		az += prefact*dz; 
+	}
+	a[0] += ax;
+	a[1] += ay;
+	a[2] += az;
+}
+
+/**
+  * @brief Appends a particle to an interaction list.
+  */
+static inline void reb_tree_interaction_list_add_particle(struct reb_tree_interaction_list* const list, const double x, const double y, const double z, const double m, const int index){
+	if (list->N_particles>=list->allocatedN_particles){
+		list->allocatedN_particles = list->allocatedN_particles?2*list->allocatedN_particles:256;
+		for (int l=0; l<4; l++){
+			list->particles[l] = realloc(list->particles[l], sizeof(double)*list->allocatedN_particles);
+		}
+		list->index = realloc(list->index, sizeof(int)*list->allocatedN_particles);
+	}
+	const int l = list->N_particles++;
+	list->particles[0][l] = x;
+	list->particles[1][l] = y;
+	list->particles[2][l] = z;
+	list->particles[3][l] = m;
+	list->index[l] = index;
+}
+
+static void reb_calculate_acceleration_tree_groups(struct reb_simulation* const r){
+	struct reb_particle* const particles = r->particles;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const double opening_angle2 = r->opening_angle2;
+	const struct reb_treecell_flat* const cells = r->tree_flat;
+	const int Ncells = r->tree_flat_N;
+	const int* const order = r->tree_flat_order;
+	const int Ngroups = r->tree_groups_N;
+	const int multipole_order = r->multipole_order;
+	const struct reb_treecell_multipoles* const multipoles = r->tree_flat_multipoles;
+	const int Ncelldata = multipole_order>=3?20:(multipole_order>=2?10:4);
+	const int single_precision = r->tree_single_precision;
+	int Ngb;
+	struct reb_ghostbox* const gbs = reb_boundary_get_ghostbox_table(r, r->nghostx, r->nghosty, r->nghostz, &Ngb);
+	uint64_t interactions = 0;
+	uint64_t opened = 0;
+#pragma omp parallel reduction(+:interactions,opened)
+	{
+	struct reb_tree_interaction_list list = {0};
+#pragma omp for schedule(guided)
+	for (int g=0; g<Ngroups; g++){
+		const struct reb_treegroup group = r->tree_groups[g];
+		// Bounding sphere of the group (without ghostbox shift)
+		double min[3] = {INFINITY, INFINITY, INFINITY};
+		double max[3] = {-INFINITY, -INFINITY, -INFINITY};
+		for (int k=group.first; k<group.first+group.N; k++){
+			const struct reb_particle p = particles[order[k]];
+			min[0] = p.x<min[0]?p.x:min[0];
+			min[1] = p.y<min[1]?p.y:min[1];
+			min[2] = p.z<min[2]?p.z:min[2];
+			max[0] = p.x>max[0]?p.x:max[0];
+			max[1] = p.y>max[1]?p.y:max[1];
+			max[2] = p.z>max[2]?p.z:max[2];
+		}
+		for (int b=0; b<Ngb; b++){
+			const struct reb_ghostbox gb = gbs[b];
+			const double bx = gb.shiftx + 0.5*(min[0]+max[0]);
+			const double by = gb.shifty + 0.5*(min[1]+max[1]);
+			const double bz = gb.shiftz + 0.5*(min[2]+max[2]);
+			const double R = 0.5*sqrt((max[0]-min[0])*(max[0]-min[0]) + (max[1]-min[1])*(max[1]-min[1]) + (max[2]-min[2])*(max[2]-min[2]));
+
+			// Build interaction list
+			list.N_cells = 0;
+			list.N_particles = 0;
+			int c = 0;
+			while (c<Ncells){
+				const struct reb_treecell_flat* const node = &(cells[c]);
+				if ( node->pt < 0 ) { // Not a leaf
+					const double dx = bx - node->mx;
+					const double dy = by - node->my;
+					const double dz = bz - node->mz;
+					const double d = sqrt(dx*dx + dy*dy + dz*dz) - R; // Minimum distance to any particle in the group
+					if ( d<=0. || node->w2 > opening_angle2*d*d ){
+						opened++;
+						if (node->first>=0){ // Leaf bucket, all particles go into the list
+							for (int k=node->first; k<node->first-node->pt; k++){
+								const int j = order[k];
+								reb_tree_interaction_list_add_particle(&list, particles[j].x, particles[j].y, particles[j].z, particles[j].m, j);
+							}
+							c = node->next;
+						}else{
+							c++; // Open cell
+						}
+						continue;
+					}
+					if (list.N_cells>=list.allocatedN_cells){
+						list.allocatedN_cells = list.allocatedN_cells?2*list.allocatedN_cells:256;
+						for (int l=0; l<Ncelldata; l++){
+							if (single_precision){
+								list.cells_float[l] = realloc(list.cells_float[l], sizeof(float)*list.allocatedN_cells);
+							}else{
+								list.cells[l] = realloc(list.cells[l], sizeof(double)*list.allocatedN_cells);
+							}
+						}
+					}
+					const int l = list.N_cells++;
+					if (single_precision){
+						// Relative to the centre of the group, so that the far field
+						// distances do not lose precision far away from the origin.
+						list.cells_float[0][l] = (float)(node->mx - bx);
+						list.cells_float[1][l] = (float)(node->my - by);
+						list.cells_float[2][l] = (float)(node->mz - bz);
+						list.cells_float[3][l] = (float)node->m;
+						if (multipole_order>=2){
+							const struct reb_treecell_multipoles* const mp = &(multipoles[c]);
+							const double q[6] = {mp->mxx, mp->mxy, mp->mxz, mp->myy, mp->myz, mp->mzz};
+							for (int k=0; k<6; k++){
+								list.cells_float[4+k][l] = (float)q[k];
+							}
+						}
+						if (multipole_order>=3){
+							const struct reb_treecell_multipoles* const mp = &(multipoles[c]);
+							const double o[10] = {mp->mxxx, mp->mxxy, mp->mxxz, mp->mxyy, mp->mxyz, mp->mxzz, mp->myyy, mp->myyz, mp->myzz, mp->mzzz};
+							for (int k=0; k<10; k++){
+								list.cells_float[10+k][l] = (float)o[k];
+							}
+						}
+					}else{
+						list.cells[0][l] = node->mx;
+						list.cells[1][l] = node->my;
+						list.cells[2][l] = node->mz;
+						list.cells[3][l] = node->m;
+						if (multipole_order>=2){
+							const struct reb_treecell_multipoles* const mp = &(multipoles[c]);
+							list.cells[4][l] = mp->mxx;
+							list.cells[5][l] = mp->mxy;
+							list.cells[6][l] = mp->mxz;
+							list.cells[7][l] = mp->myy;
+							list.cells[8][l] = mp->myz;
+							list.cells[9][l] = mp->mzz;
+						}
+						if (multipole_order>=3){
+							const struct reb_treecell_multipoles* const mp = &(multipoles[c]);
+							list.cells[10][l] = mp->mxxx;
+							list.cells[11][l] = mp->mxxy;
+							list.cells[12][l] = mp->mxxz;
+							list.cells[13][l] = mp->mxyy;
+							list.cells[14][l] = mp->mxyz;
+							list.cells[15][l] = mp->mxzz;
+							list.cells[16][l] = mp->myyy;
+							list.cells[17][l] = mp->myyz;
+							list.cells[18][l] = mp->myzz;
+							list.cells[19][l] = mp->mzzz;
+						}
+					}
+				}else{ // Leaf
+					reb_tree_interaction_list_add_particle(&list, node->mx, node->my, node->mz, node->m, node->pt);
+				}
+				c = node->next;
+			}
+
+			// Apply interaction list to all particles in the group
+			interactions += (uint64_t)group.N*(list.N_cells+list.N_particles);
+			for (int k=group.first; k<group.first+group.N; k++){
+				const int i = order[k];
+				const double xi = gb.shiftx + particles[i].x;
+				const double yi = gb.shifty + particles[i].y;
+				const double zi = gb.shiftz + particles[i].z;
+				double a[3] = {0.,0.,0.};
+				if (single_precision){
+					const float xf = (float)(xi - bx);
+					const float yf = (float)(yi - by);
+					const float zf = (float)(zi - bz);
+					if (multipole_order>=3){
+						reb_tree_interaction_list_apply_cells_float_octupole(&list, xf, yf, zf, (float)G, (float)softening2, a);
+					}else if (multipole_order>=2){
+						reb_tree_interaction_list_apply_cells_float_quadrupole(&list, xf, yf, zf, (float)G, (float)softening2, a);
+					}else{
+						reb_tree_interaction_list_apply_cells_float_monopole(&list, xf, yf, zf, (float)G, (float)softening2, a);
+					}
+				}else if (multipole_order>=3){
+					reb_tree_interaction_list_apply_cells_octupole(&list, xi, yi, zi, G, softening2, a);
+				}else if (multipole_order>=2){
+					reb_tree_interaction_list_apply_cells_quadrupole(&list, xi, yi, zi, G, softening2, a);
+				}else{
+					reb_tree_interaction_list_apply_cells_monopole(&list, xi, yi, zi, G, softening2, a);
+				}
+				reb_tree_interaction_list_apply_particles(&list, i, xi, yi, zi, G, softening2, a);
+				particles[i].ax += a[0];
+				particles[i].ay += a[1];
+				particles[i].az += a[2];
+			}
+		}
+	}
+	for (int l=0; l<Ncelldata; l++){
+		free(list.cells[l]);
+		free(list.cells_float[l]);
+	}
+	for (int l=0; l<4; l++){
+		free(list.particles[l]);
+	}
+	free(list.index);
+	}
+	r->metrics.interactions += interactions;
+	r->metrics.cells_opened += opened;
+	free(gbs);
+}
+
+static void reb_calculate_acceleration_update_soa(struct reb_simulation* const r, const int N){
+	if (r->gravity_soa_allocatedN<N){
+		r->gravity_soa = reb_tools_realloc(r, r->gravity_soa, 0, 4*N*sizeof(double));
+		r->gravity_soa_allocatedN = N;
+	}
+	const int stride = r->gravity_soa_allocatedN;
+	double* restrict const x = r->gravity_soa;
+	double* restrict const y = x + stride;
+	double* restrict const z = y + stride;
+	double* restrict const m = z + stride;
+	const struct reb_particle* const particles = r->particles;
+#pragma omp parallel for schedule(guided)
+	for (int j=0; j<N; j++){
+		x[j] = particles[j].x;
+		y[j] = particles[j].y;
+		z[j] = particles[j].z;
+		m[j] = particles[j].m;
+	}
+}
+
+static REB_GRAVITY_ALWAYS_INLINE void reb_calculate_acceleration_basic_soa_kernel(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a, const int softening){
+	const double* restrict const x = soa;
+	const double* restrict const y = x + stride;
+	const double* restrict const z = y + stride;
+	const double* restrict const m = z + stride;
+	double ax = 0.;
+	double ay = 0.;
+	double az = 0.;
+#pragma omp simd reduction(+:ax,ay,az)
+	for (int j=j0; j<j1; j++){
+		const double dx = xi - x[j];
+		const double dy = yi - y[j];
+		const double dz = zi - z[j];
+		const double _r = softening?sqrt(dx*dx + dy*dy + dz*dz + softening2):sqrt(dx*dx + dy*dy + dz*dz);
+		const double prefact = m[j]/(_r*_r*_r);
+		ax += prefact*dx;
+		ay += prefact*dy;
+		az += prefact*dz;
+	}
+	a[0] += ax;
+	a[1] += ay;
+	a[2] += az;
+}
+
+REB_GRAVITY_TARGET_CLONES
+void reb_calculate_acceleration_basic_soa(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a){
+	reb_calculate_acceleration_basic_soa_kernel(soa, stride, j0, j1, xi, yi, zi, softening2, a, 1);
+}
+
+REB_GRAVITY_TARGET_CLONES
+static void reb_calculate_acceleration_basic_soa_unsoftened(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, double* const a){
+	reb_calculate_acceleration_basic_soa_kernel(soa, stride, j0, j1, xi, yi, zi, 0., a, 0);
+}
+
+void reb_calculate_acceleration_basic_soa_r2min(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a, double* const r2min){
+	const double* restrict const x = soa;
+	const double* restrict const y = x + stride;
+	const double* restrict const z = y + stride;
+	const double* restrict const m = z + stride;
+	double ax = 0.;
+	double ay = 0.;
+	double az = 0.;
+	double _r2min = *r2min;
+#pragma omp simd reduction(+:ax,ay,az) reduction(min:_r2min)
+	for (int j=j0; j<j1; j++){
+		const double dx = xi - x[j];
+		const double dy = yi - y[j];
+		const double dz = zi - z[j];
+		const double r2 = dx*dx + dy*dy + dz*dz;
+		_r2min = r2<_r2min?r2:_r2min;
+		const double _r = sqrt(r2 + softening2);
+		const double prefact = m[j]/(_r*_r*_r);
+		ax += prefact*dx;
+		ay += prefact*dy;
+		az += prefact*dz;
+	}
+	a[0] += ax;
+	a[1] += ay;
+	a[2] += az;
+	*r2min = _r2min;
+}
+
+#ifdef OPENMP
+static void reb_calculate_acceleration_compensated_block(struct reb_simulation* const r, const int i0, const int i1, const int j0, const int j1, const int diagonal){
+	struct reb_particle* const particles = r->particles;
+	struct reb_vec3d* restrict const cs = r->gravity_cs;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const unsigned int _gravity_ignore_terms = r->gravity_ignore_terms;
+	for (int i=i0; i<i1; i++){
+	for (int j=(diagonal?i+1:j0); j<j1; j++){
+		if (_gravity_ignore_terms==1 && ((j==1 && i==0) || (i==1 && j==0))) continue;
+		if (_gravity_ignore_terms==2 && ((j==0 || i==0))) continue;
+		const double dx = particles[i].x - particles[j].x;
+		const double dy = particles[i].y - particles[j].y;
+		const double dz = particles[i].z - particles[j].z;
+		const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+		const double r = sqrt(r2);
+		const double prefact  = G/(r2*r);
+		const double prefacti = prefact*particles[i].m;
+		const double prefactj = -prefact*particles[j].m;
+		
+		{
+		double ix = prefactj*dx;
+		double yx = ix - cs[i].x;
+		double tx = particles[i].ax + yx;
+		cs[i].x = (tx - particles[i].ax) - yx;
+		particles[i].ax = tx;
+
+		double iy = prefactj*dy;
+		double yy = iy- cs[i].y;
+		double ty = particles[i].ay + yy;
+		cs[i].y = (ty - particles[i].ay) - yy;
+		particles[i].ay = ty;
+		
+		double iz = prefactj*dz;
+		double yz = iz - cs[i].z;
+		double tz = particles[i].az + yz;
+		cs[i].z = (tz - particles[i].az) - yz;
+		particles[i].az = tz;
+		}
+		
+		{
+		double ix = prefacti*dx;
+		double yx = ix - cs[j].x;
+		double tx = particles[j].ax + yx;
+		cs[j].x = (tx - particles[j].ax) - yx;
+		particles[j].ax = tx;
+
+		double iy = prefacti*dy;
+		double yy = iy - cs[j].y;
+		double ty = particles[j].ay + yy;
+		cs[j].y = (ty - particles[j].ay) - yy;
+		particles[j].ay = ty;
+		
+		double iz = prefacti*dz;
+		double yz = iz - cs[j].z;
+		double tz = particles[j].az + yz;
+		cs[j].z = (tz - particles[j].az) - yz;
+		particles[j].az = tz;
+		}
+	}
+	}
+}
+#endif // OPENMP
@@ -38,4 +38,45 @@ void reb_calculate_acceleration(struct reb_simulation* r);
   */
 void reb_calculate_acceleration_var(struct reb_simulation* r);
 
+/**
+  * Measures the relative error of the tree gravity accelerations of a sample of particles 
+  * by direct summation and adjusts opening_angle2 towards r->tree_force_accuracy.
+  * Needs to be called directly after reb_calculate_acceleration().
+  */
+void reb_calculate_acceleration_tree_accuracy(struct reb_simulation* const r);
+
+/**
+  * @brief Sums up the (unscaled) acceleration of all particles with index j0<=j<j1 acting on a point.
+  * @details The particle data is read from the SoA copy in r->gravity_soa. The loop body does not
+  * contain any branches so that the compiler can vectorize it. On x86_64 Linux with GCC, versions
+  * for AVX-512, AVX2 and the default instruction set are compiled and the best one is picked at
+  * runtime. The result needs to be multiplied by -G.
+  * @param soa Pointer to the SoA buffer (x, y, z, m arrays with stride r->gravity_soa_allocatedN).
+  * @param stride Length of each of the arrays in the SoA buffer.
+  * @param j0 First index to sum over.
+  * @param j1 One past the last index to sum over.
+  * @param xi x position of the point (including the ghostbox shift).
+  * @param yi y position of the point (including the ghostbox shift).
+  * @param zi z position of the point (including the ghostbox shift).
+  * @param softening2 Square of the softening parameter.
+  * @param a Output. The acceleration is added to a[0], a[1], a[2].
+  */
+void reb_calculate_acceleration_basic_soa(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a);
+
+/**
+  * @brief Same as reb_calculate_acceleration_basic_soa() but also returns the minimum squared (unsoftened) distance.
+  * @details Used to check for exit_min_distance during the force calculation.
+  */
+void reb_calculate_acceleration_basic_soa_r2min(const double* const soa, const int stride, const int j0, const int j1, const double xi, const double yi, const double zi, const double softening2, double* const a, double* const r2min);
+
+/**
+  * @brief Number of interactions of one direct summation, used for r->metrics.
+  * @details Every real particle feels every active particle in every ghostbox (except 
+  * itself). The active particles also feel the test particles if testparticle_type is 1.
+  * @param r REBOUND simulation to operate on
+  * @param N_active Number of active particles (without variational particles).
+  * @param N_real Number of real particles.
+  */
+uint64_t reb_calculate_acceleration_direct_interactions(const struct reb_simulation* const r, const int N_active, const int N_real);
+
 #endif
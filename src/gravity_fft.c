@@ -0,0 +1,486 @@
+/**
+ * @file 	gravity_fft.c
+ * @brief 	Particle-mesh and TreePM self-gravity for (shearing) periodic sheets.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>, Geoffroy Lesur <geoffroy.lesur@obs.ujf-grenoble.fr>
+ *
+ * @details 	This file implements a 2D particle-mesh (PM) Poisson solver for
+ * thin self-gravitating sheets in periodic and shear periodic boxes
+ * (REB_GRAVITY_FFT), and a TreePM combination of this solver with the
+ * tree code (REB_GRAVITY_TREEPM).
+ *
+ * Masses of the active particles are assigned to a grid of fft_nx times
+ * fft_ny cells covering the entire box using the triangular shaped cloud
+ * (TSC) scheme. In the Fourier domain, the potential of a sheet with
+ * surface density S is -2 pi G S(k)/|k|. The potential is filtered with
+ * erfc(|k| rs) (see below) and deconvolved by the TSC window. The in-plane
+ * accelerations are obtained by spectral differentiation and interpolated
+ * back to the particles with the same TSC scheme. The PM solver does not
+ * calculate vertical accelerations. For REB_GRAVITY_FFT, the filter acts
+ * as a softening of the force on the scale rs. Without it, the truncation
+ * at the Nyquist frequency leads to errors of a few percent at all
+ * separations.
+ *
+ * For shear periodic boundary conditions, the grid is attached to the
+ * sheared frame y' = y - s x/L_x, where s is the current shift of the
+ * ghost boxes in the y direction. A field satisfying the shear periodic
+ * boundary conditions is periodic in this frame. A mode with grid wave
+ * vector (kx, ky) has the physical wave vector (kx - ky s/L_x, ky).
+ * This is equivalent to the remap in Fourier space and the time
+ * dependent wave vectors used in the original implementation, but the
+ * remap is done exactly when the masses are assigned.
+ *
+ * REB_GRAVITY_TREEPM splits the potential of each particle into a long
+ * range part erf(r/(2 rs))/r, which is calculated on the grid using the
+ * filter erfc(|k| rs) (this is the exact 2D Fourier transform of the
+ * long range potential in the plane z=0), and a short range part
+ * erfc(r/(2 rs))/r, which is calculated with the tree. The tree walk
+ * skips all cells further away than REB_TREEPM_RCUT*rs. The vertical long
+ * range force is neglected, which is accurate as long as the sheet is thin
+ * compared to rs.
+ *
+ * The FFTs use FFTW if REBOUND is compiled with FFTW=1. Otherwise a
+ * built-in radix-2 FFT is used, which requires fft_nx and fft_ny to be
+ * powers of two. MPI is not supported.
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein, Geoffroy Lesur
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "tree.h"
+#include "boundary.h"
+#include "gravity_fft.h"
+#ifdef FFTW
+#include <fftw3.h>
+#endif // FFTW
+
+/**
+ * @brief Number of intervals in the table of the short range force.
+ */
+#define REB_TREEPM_TABLE_N 4096
+
+/**
+ * @brief Grid, FFT plans and tables used by REB_GRAVITY_FFT and REB_GRAVITY_TREEPM.
+ */
+struct reb_fft {
+	int nx;                     ///< Number of grid cells in x for which the buffers have been set up
+	int ny;                     ///< Number of grid cells in y for which the buffers have been set up
+	double* grid;               ///< Complex grid, 2*nx*ny doubles, index (ix*ny+iy)
+#ifdef FFTW
+	fftw_plan forward;          ///< In-place forward transform of grid
+	fftw_plan backward;         ///< In-place backward transform of grid
+#else // FFTW
+	double* twiddle_x;          ///< cos and sin of 2 pi k/nx for k<nx/2
+	double* twiddle_y;          ///< cos and sin of 2 pi k/ny for k<ny/2
+#endif // FFTW
+	double g[REB_TREEPM_TABLE_N+2]; ///< Short range force factor as a function of r/rs on [0,REB_TREEPM_RCUT]
+};
+
+#ifndef FFTW
+static double* reb_fft_twiddle(const int n){
+	double* w = malloc(sizeof(double)*(n/2>0?n:2));
+	for (int k=0;k<n/2;k++){
+		w[2*k] = cos(2.*M_PI*k/n);
+		w[2*k+1] = sin(2.*M_PI*k/n);
+	}
+	return w;
+}
+
+/**
+ * @brief In-place radix-2 FFT of n contiguous complex numbers.
+ * @param a Interleaved real and imaginary parts.
+ * @param n Number of complex numbers, a power of two.
+ * @param w Twiddle factors, see reb_fft_twiddle().
+ * @param sign -1 for the forward, +1 for the backward (unnormalized) transform.
+ */
+static void reb_fft_1d(double* const a, const int n, const double* const w, const int sign){
+	for (int i=1, j=0; i<n; i++){
+		int bit = n>>1;
+		for (; j&bit; bit>>=1){
+			j ^= bit;
+		}
+		j ^= bit;
+		if (i<j){
+			double t;
+			t = a[2*i];   a[2*i]   = a[2*j];   a[2*j]   = t;
+			t = a[2*i+1]; a[2*i+1] = a[2*j+1]; a[2*j+1] = t;
+		}
+	}
+	for (int len=2; len<=n; len<<=1){
+		const int half = len/2;
+		const int step = n/len;
+		for (int i=0; i<n; i+=len){
+			for (int k=0; k<half; k++){
+				const double wr = w[2*k*step];
+				const double wi = sign*w[2*k*step+1];
+				double* const u = a+2*(i+k);
+				double* const v = a+2*(i+k+half);
+				const double vr = v[0]*wr - v[1]*wi;
+				const double vi = v[0]*wi + v[1]*wr;
+				v[0] = u[0] - vr;
+				v[1] = u[1] - vi;
+				u[0] += vr;
+				u[1] += vi;
+			}
+		}
+	}
+}
+#endif // FFTW
+
+/**
+ * @brief In-place 2D FFT of the grid.
+ * @param f FFT data.
+ * @param sign -1 for the forward, +1 for the backward (unnormalized) transform.
+ */
+static void reb_fft_2d(struct reb_fft* const f, const int sign){
+#ifdef FFTW
+	fftw_execute(sign<0?f->forward:f->backward);
+#else // FFTW
+	const int nx = f->nx;
+	const int ny = f->ny;
+	double* const grid = f->grid;
+#pragma omp parallel
+	{
+#pragma omp for schedule(static)
+	for (int ix=0; ix<nx; ix++){
+		reb_fft_1d(grid+2*ix*ny, ny, f->twiddle_y, sign);
+	}
+	double* const column = malloc(sizeof(double)*2*nx);
+#pragma omp for schedule(static)
+	for (int iy=0; iy<ny; iy++){
+		for (int ix=0; ix<nx; ix++){
+			column[2*ix]   = grid[2*(ix*ny+iy)];
+			column[2*ix+1] = grid[2*(ix*ny+iy)+1];
+		}
+		reb_fft_1d(column, nx, f->twiddle_x, sign);
+		for (int ix=0; ix<nx; ix++){
+			grid[2*(ix*ny+iy)]   = column[2*ix];
+			grid[2*(ix*ny+iy)+1] = column[2*ix+1];
+		}
+	}
+	free(column);
+	}
+#endif // FFTW
+}
+
+/**
+ * @brief Sets up the grid, plans and tables if needed.
+ */
+static struct reb_fft* reb_fft_init(struct reb_simulation* const r){
+	const int nx = r->fft_nx;
+	const int ny = r->fft_ny;
+	struct reb_fft* f = r->fft;
+	if (f && f->nx==nx && f->ny==ny){
+		return f;
+	}
+	reb_fft_free(r);
+	f = calloc(1, sizeof(struct reb_fft));
+	f->nx = nx;
+	f->ny = ny;
+#ifdef FFTW
+	f->grid = fftw_malloc(sizeof(double)*2*nx*ny);
+	f->forward = fftw_plan_dft_2d(nx, ny, (fftw_complex*)f->grid, (fftw_complex*)f->grid, FFTW_FORWARD, FFTW_MEASURE);
+	f->backward = fftw_plan_dft_2d(nx, ny, (fftw_complex*)f->grid, (fftw_complex*)f->grid, FFTW_BACKWARD, FFTW_MEASURE);
+#else // FFTW
+	if ((nx&(nx-1)) || (ny&(ny-1))){
+		free(f);
+		reb_exit("fft_nx and fft_ny need to be powers of two unless REBOUND is compiled with FFTW=1.");
+	}
+	f->grid = malloc(sizeof(double)*2*nx*ny);
+	f->twiddle_x = reb_fft_twiddle(nx);
+	f->twiddle_y = reb_fft_twiddle(ny);
+#endif // FFTW
+	// Short range force relative to the Newtonian force at distance x*rs.
+	for (int k=0; k<=REB_TREEPM_TABLE_N; k++){
+		const double x = REB_TREEPM_RCUT*k/REB_TREEPM_TABLE_N;
+		f->g[k] = erfc(0.5*x) + x/sqrt(M_PI)*exp(-0.25*x*x);
+	}
+	f->g[REB_TREEPM_TABLE_N+1] = 0.;
+	r->fft = f;
+	return f;
+}
+
+void reb_fft_free(struct reb_simulation* const r){
+	struct reb_fft* const f = r->fft;
+	if (f==NULL) return;
+#ifdef FFTW
+	fftw_destroy_plan(f->forward);
+	fftw_destroy_plan(f->backward);
+	fftw_free(f->grid);
+#else // FFTW
+	free(f->grid);
+	free(f->twiddle_x);
+	free(f->twiddle_y);
+#endif // FFTW
+	free(f);
+	r->fft = NULL;
+}
+
+/**
+ * @brief Indices and weights of the three grid cells used by the TSC scheme.
+ * @param u Position in units of the grid spacing, cell centres are at integer+0.5.
+ * @param n Number of cells (periodic).
+ * @param idx Output. Indices of the cells.
+ * @param w Output. Weights of the cells.
+ */
+static inline void reb_fft_tsc(const double u, const int n, int* const idx, double* const w){
+	const double c = floor(u);
+	const double d = u - c - 0.5;
+	int i = ((int)c) % n;
+	if (i<0) i += n;
+	idx[0] = i==0?n-1:i-1;
+	idx[1] = i;
+	idx[2] = i==n-1?0:i+1;
+	w[0] = 0.5*(0.5-d)*(0.5-d);
+	w[1] = 0.75-d*d;
+	w[2] = 0.5*(0.5+d)*(0.5+d);
+}
+
+/**
+ * @brief Shift of the ghost boxes in the y direction, wrapped to [-L_y/2, L_y/2].
+ */
+static double reb_fft_shear_shift(struct reb_simulation* const r){
+	if (r->boundary!=REB_BOUNDARY_SHEAR){
+		return 0.;
+	}
+	const double Ly = r->boxsize.y;
+	const double s = reb_boundary_get_ghostbox(r, 1, 0, 0).shifty;
+	return s - Ly*floor(s/Ly+0.5);
+}
+
+/**
+ * @brief Particle-mesh part of the force calculation.
+ * @param r REBOUND simulation to operate on
+ * @param rs Splitting scale.
+ */
+static void reb_fft_pm(struct reb_simulation* const r, const double rs){
+#ifdef MPI
+	reb_exit("REB_GRAVITY_FFT and REB_GRAVITY_TREEPM are not supported with MPI.");
+#endif // MPI
+	if (r->boundary!=REB_BOUNDARY_PERIODIC && r->boundary!=REB_BOUNDARY_SHEAR){
+		reb_exit("REB_GRAVITY_FFT and REB_GRAVITY_TREEPM require periodic or shear periodic boundary conditions.");
+	}
+	struct reb_fft* const f = reb_fft_init(r);
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N - r->N_var;
+	const int N_active = r->N_active==-1?N:r->N_active;
+	const int nx = f->nx;
+	const int ny = f->ny;
+	const double Lx = r->boxsize.x;
+	const double Ly = r->boxsize.y;
+	const double dx = Lx/nx;
+	const double dy = Ly/ny;
+	const double s = reb_fft_shear_shift(r);
+	double* const grid = f->grid;
+
+	// Assign masses to the grid (in the sheared frame).
+	memset(grid, 0, sizeof(double)*2*nx*ny);
+	for (int i=0; i<N_active; i++){
+		const struct reb_particle p = particles[i];
+		int ix[3], iy[3];
+		double wx[3], wy[3];
+		reb_fft_tsc((p.x/Lx+0.5)*nx, nx, ix, wx);
+		reb_fft_tsc(((p.y-s*p.x/Lx)/Ly+0.5)*ny, ny, iy, wy);
+		const double q = p.m/(dx*dy);
+		for (int a=0; a<3; a++){
+			for (int b=0; b<3; b++){
+				grid[2*(ix[a]*ny+iy[b])] += q*wx[a]*wy[b];
+			}
+		}
+	}
+
+	reb_fft_2d(f, -1);
+
+	// Solve the Poisson equation and differentiate. The x and y components of the
+	// acceleration are stored as real and imaginary parts of one complex field.
+	const double norm = -2.*M_PI*r->G/((double)nx*(double)ny);
+#pragma omp parallel for schedule(static)
+	for (int ix=0; ix<nx; ix++){
+		const int mx = ix<=nx/2?ix:ix-nx;
+		const double kx = 2.*M_PI/Lx*mx;
+		const double sincx = mx==0?1.:sin(M_PI*mx/nx)/(M_PI*mx/nx);
+		for (int iy=0; iy<ny; iy++){
+			double* const c = grid+2*(ix*ny+iy);
+			const int my = iy<=ny/2?iy:iy-ny;
+			if ((mx==0 && my==0) || 2*ix==nx || 2*iy==ny){
+				// Mean density and Nyquist frequencies
+				c[0] = 0.;
+				c[1] = 0.;
+				continue;
+			}
+			const double ky = 2.*M_PI/Ly*my;
+			const double Kx = kx - ky*s/Lx;
+			const double K = sqrt(Kx*Kx + ky*ky);
+			const double sincy = my==0?1.:sin(M_PI*my/ny)/(M_PI*my/ny);
+			const double W = sincx*sincx*sincx*sincy*sincy*sincy;
+			const double green = norm/K*erfc(K*rs)/(W*W);
+			const double pr = green*c[0];
+			const double pi = green*c[1];
+			c[0] = Kx*pi + ky*pr;
+			c[1] = -Kx*pr + ky*pi;
+		}
+	}
+
+	reb_fft_2d(f, 1);
+
+	// Interpolate accelerations back to the particles.
+#pragma omp parallel for schedule(guided)
+	for (int i=0; i<N; i++){
+		struct reb_particle* const p = &(particles[i]);
+		int ix[3], iy[3];
+		double wx[3], wy[3];
+		reb_fft_tsc((p->x/Lx+0.5)*nx, nx, ix, wx);
+		reb_fft_tsc(((p->y-s*p->x/Lx)/Ly+0.5)*ny, ny, iy, wy);
+		double ax = 0.;
+		double ay = 0.;
+		for (int a=0; a<3; a++){
+			for (int b=0; b<3; b++){
+				const double* const c = grid+2*(ix[a]*ny+iy[b]);
+				ax += wx[a]*wy[b]*c[0];
+				ay += wx[a]*wy[b]*c[1];
+			}
+		}
+		p->ax += ax;
+		p->ay += ay;
+	}
+}
+
+/**
+ * @brief Splitting scale, either fft_rs or 1.25 grid cells.
+ */
+static double reb_fft_rs(const struct reb_simulation* const r){
+	if (r->fft_nx<2 || r->fft_ny<2){
+		reb_exit("fft_nx and fft_ny need to be at least 2.");
+	}
+	return r->fft_rs>0.?r->fft_rs:1.25*fmax(r->boxsize.x/r->fft_nx, r->boxsize.y/r->fft_ny);
+}
+
+void reb_calculate_acceleration_fft(struct reb_simulation* const r){
+	reb_fft_pm(r, reb_fft_rs(r));
+}
+
+/**
+ * @brief Short range force factor at distance x*rs (linear interpolation of the table).
+ */
+static inline double reb_treepm_g(const double* const g, const double x){
+	const double t = x*(REB_TREEPM_TABLE_N/REB_TREEPM_RCUT);
+	if (t>=REB_TREEPM_TABLE_N){
+		return 0.;
+	}
+	const int k = (int)t;
+	return g[k] + (t-k)*(g[k+1]-g[k]);
+}
+
+void reb_calculate_acceleration_treepm(struct reb_simulation* const r){
+	const double rs = reb_fft_rs(r);
+	reb_fft_pm(r, rs);
+
+	// Short range force using the tree.
+	reb_tree_flatten(r);
+	const struct reb_fft* const f = r->fft;
+	const struct reb_treecell_flat* const cells = r->tree_flat;
+	const int Ncells = r->tree_flat_N;
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N - r->N_var;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const double opening_angle2 = r->opening_angle2;
+	const double rcut = REB_TREEPM_RCUT*rs;
+	const double rcut2 = rcut*rcut;
+	const double _rs = 1./rs;
+	const double hx = 0.5*r->boxsize.x;
+	const double hy = 0.5*r->boxsize.y;
+	const double hz = 0.5*r->boxsize.z;
+	// Particles are visited in the order of the tree leaves to improve cache performance.
+	const int* const order = r->tree_flat_order;
+	const int use_order = (r->tree_flat_order_N==N);
+	for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+	for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+	for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+#pragma omp parallel for schedule(guided)
+		for (int k=0; k<N; k++){
+			const int i = use_order?order[k]:k;
+			const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			const double xi = particles[i].x + gb.shiftx;
+			const double yi = particles[i].y + gb.shifty;
+			const double zi = particles[i].z + gb.shiftz;
+			if (fabs(xi)>hx+rcut || fabs(yi)>hy+rcut || fabs(zi)>hz+rcut){
+				// No particle of the box is within the cutoff radius.
+				continue;
+			}
+			double ax = 0.;
+			double ay = 0.;
+			double az = 0.;
+			int c = 0;
+			while (c<Ncells){
+				const struct reb_treecell_flat* const node = &(cells[c]);
+				const double dx = xi - node->mx;
+				const double dy = yi - node->my;
+				const double dz = zi - node->mz;
+				const double r2 = dx*dx + dy*dy + dz*dz;
+				if (node->pt < 0){ // Not a leaf
+					// Skip the cell if it is entirely outside of the cutoff radius.
+					// (rcut+sqrt(3)*w)^2 <= 2*rcut^2+6*w^2 avoids a square root.
+					if (r2 > 2.*rcut2 + 6.*node->w2){
+						c = node->next;
+						continue;
+					}
+					if (node->w2 > opening_angle2*r2){
+						if (node->first>=0){ // Leaf bucket, direct summation
+							for (int k=node->first; k<node->first-node->pt; k++){
+								const int j = order[k];
+								const double dxj = xi - particles[j].x;
+								const double dyj = yi - particles[j].y;
+								const double dzj = zi - particles[j].z;
+								const double r2j = dxj*dxj + dyj*dyj + dzj*dzj;
+								if (j == i || r2j>rcut2) continue;
+								const double _rj = sqrt(r2j + softening2);
+								const double prefact = -G/(_rj*_rj*_rj)*particles[j].m*reb_treepm_g(f->g, _rj*_rs);
+								ax += prefact*dxj;
+								ay += prefact*dyj;
+								az += prefact*dzj;
+							}
+							c = node->next;
+						}else{
+							c++; // Open cell
+						}
+						continue;
+					}
+				}else if (node->pt == i || r2>rcut2){ // Leaf
+					c = node->next;
+					continue;
+				}
+				const double _r = sqrt(r2 + softening2);
+				const double prefact = -G/(_r*_r*_r)*node->m*reb_treepm_g(f->g, _r*_rs);
+				ax += prefact*dx;
+				ay += prefact*dy;
+				az += prefact*dz;
+				c = node->next;
+			}
+			particles[i].ax += ax;
+			particles[i].ay += ay;
+			particles[i].az += az;
+		}
+	}
+	}
+	}
+}
@@ -0,0 +1,57 @@
+/**
+ * @file 	gravity_fft.h
+ * @brief 	Particle-mesh and TreePM self-gravity for (shearing) periodic sheets.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein, Geoffroy Lesur
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _GRAVITY_FFT_H
+#define _GRAVITY_FFT_H
+
+/**
+ * @brief Cutoff radius of the short range force used by REB_GRAVITY_TREEPM in units of fft_rs.
+ */
+#define REB_TREEPM_RCUT 6.0
+
+/**
+  * @brief Calculates the in-plane accelerations of all particles on a grid using an FFT.
+  * @details The force is smoothed on the scale fft_rs. The accelerations are added
+  * to the ax and ay fields of the particles.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_calculate_acceleration_fft(struct reb_simulation* const r);
+
+/**
+  * @brief Calculates the accelerations of all particles using the TreePM method.
+  * @details The long range force is calculated on the grid, the short range force
+  * using the tree (r->tree_root). The tree needs to be up to date and the gravity
+  * data needs to be updated (see reb_tree_update_gravity_data()). The accelerations
+  * are added to the ax, ay, az fields of the particles.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_calculate_acceleration_treepm(struct reb_simulation* const r);
+
+/**
+  * @brief Releases the grid, FFT plans and tables of a simulation (if any).
+  * @param r REBOUND simulation to operate on
+  */
+void reb_fft_free(struct reb_simulation* const r);
+
+#endif // _GRAVITY_FFT_H
@@ -0,0 +1,424 @@
+/**
+ * @file 	gravity_fmm.c
+ * @brief 	Gravity calculation using the fast multipole method, O(N).
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	This file implements a fast multipole method (FMM) on top
+ * of the octree used by REB_GRAVITY_TREE. Multipole expansions of order
+ * r->fmm_order are calculated for every cell about its center of mass.
+ * A dual tree walk then finds pairs of well separated cells. Their
+ * interaction is converted into local expansions (cell-cell interactions,
+ * M2L) which are shifted down to the leaves of the tree. Pairs of cells
+ * which are not well separated are opened until only particle-particle
+ * interactions remain. The expansions use Cartesian Taylor series of 1/r.
+ * Two cells with centers separated by d and with radii rA and rB are
+ * well separated if (rA+rB) < d*sqrt(r->opening_angle2). The method
+ * scales as O(N). Ghost boxes are supported.
+ *
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "tree.h"
+#include "boundary.h"
+#include "gravity_fmm.h"
+
+#ifdef MPI
+#include "communication_mpi.h"
+#endif // MPI
+
+/**
+ * @brief Number of multi-indices with degree <= REB_FMM_MAX_ORDER+1.
+ */
+#define REB_FMM_MAX_TERMS ((REB_FMM_MAX_ORDER+2)*(REB_FMM_MAX_ORDER+3)*(REB_FMM_MAX_ORDER+4)/6)
+
+/**
+ * @brief Precomputed tables used during one FMM force calculation.
+ */
+struct reb_fmm_context {
+	const struct reb_treecell_flat* cells;  ///< Flattened tree (r->tree_flat)
+	struct reb_particle* particles;         ///< Particle array
+	double* M;              ///< Multipole moments, nM per cell
+	double* L;              ///< Local expansion coefficients, nL per cell
+	double* rmax;           ///< Radius of each cell around its center of mass
+	int nM;                 ///< Number of multipole moments (degree <= order)
+	int nL;                 ///< Number of local expansion coefficients (degree <= order+1)
+	int mi[REB_FMM_MAX_TERMS][3];   ///< Multi-indices in graded order
+	int sign[REB_FMM_MAX_TERMS];    ///< (-1)^degree of each multi-index
+	int shift_N;            ///< Number of terms in the shift list
+	int shift_NM;           ///< Number of terms in the shift list with a high index < nM
+	int* shift;             ///< Shift list: high index, low index, index of difference
+	double* shift_coef;     ///< Shift list: product of binomial coefficients
+	int m2l_N;              ///< Number of terms in the M2L list
+	int* m2l;               ///< M2L list: local index, multipole index, index of sum
+	double* m2l_coef;       ///< M2L list: (-1)^|beta| times product of binomial coefficients
+	double G;               ///< Gravitational constant
+	double softening2;      ///< Square of the softening parameter
+	double theta2;          ///< Square of the opening angle (r->opening_angle2)
+};
+
+/**
+ * @brief Position of the multi-index (i,j,k) in the graded ordering.
+ */
+static inline int reb_fmm_index(const int i, const int j, const int k){
+	const int n = i+j+k;
+	const int a = j+k;
+	return n*(n+1)*(n+2)/6 + a*(a+1)/2 + k;
+}
+
+/**
+ * @brief Number of multi-indices with degree <= p.
+ */
+static inline int reb_fmm_nterms(const int p){
+	return (p+1)*(p+2)*(p+3)/6;
+}
+
+static double reb_fmm_binomial(const int n, const int k){
+	double b = 1.;
+	for (int i=1;i<=k;i++){
+		b = b*(double)(n-k+i)/(double)i;
+	}
+	return b;
+}
+
+/**
+ * @brief Sets up the multi-index tables and the term lists for the M2M, L2L and M2L operators.
+ */
+static void reb_fmm_context_init(struct reb_fmm_context* const c, const int p){
+	c->nM = reb_fmm_nterms(p);
+	c->nL = reb_fmm_nterms(p+1);
+	for (int n=0;n<=p+1;n++){
+		for (int i=n;i>=0;i--){
+			for (int k=0;k<=n-i;k++){
+				const int j = n-i-k;
+				const int id = reb_fmm_index(i,j,k);
+				c->mi[id][0] = i;
+				c->mi[id][1] = j;
+				c->mi[id][2] = k;
+				c->sign[id] = (n%2)?-1:1;
+			}
+		}
+	}
+	// Shift list. Sorted by the high index so that the M2M operator can use the first shift_NM terms.
+	c->shift_N = 0;
+	c->shift_NM = 0;
+	c->shift = malloc(sizeof(int)*3*c->nL*c->nL);
+	c->shift_coef = malloc(sizeof(double)*c->nL*c->nL);
+	for (int hi=0;hi<c->nL;hi++){
+		for (int lo=0;lo<=hi;lo++){
+			const int* const h = c->mi[hi];
+			const int* const l = c->mi[lo];
+			if (l[0]>h[0] || l[1]>h[1] || l[2]>h[2]) continue;
+			c->shift[3*c->shift_N+0] = hi;
+			c->shift[3*c->shift_N+1] = lo;
+			c->shift[3*c->shift_N+2] = reb_fmm_index(h[0]-l[0],h[1]-l[1],h[2]-l[2]);
+			c->shift_coef[c->shift_N] = reb_fmm_binomial(h[0],l[0])*reb_fmm_binomial(h[1],l[1])*reb_fmm_binomial(h[2],l[2]);
+			c->shift_N++;
+		}
+		if (hi==c->nM-1){
+			c->shift_NM = c->shift_N;
+		}
+	}
+	// M2L list. Only terms with |alpha|>=1 contribute to the force.
+	c->m2l_N = 0;
+	c->m2l = malloc(sizeof(int)*3*c->nL*c->nM);
+	c->m2l_coef = malloc(sizeof(double)*c->nL*c->nM);
+	for (int ia=1;ia<c->nL;ia++){
+		for (int ib=0;ib<c->nM;ib++){
+			const int* const a = c->mi[ia];
+			const int* const b = c->mi[ib];
+			if (a[0]+a[1]+a[2]+b[0]+b[1]+b[2]>p+1) continue;
+			c->m2l[3*c->m2l_N+0] = ia;
+			c->m2l[3*c->m2l_N+1] = ib;
+			c->m2l[3*c->m2l_N+2] = reb_fmm_index(a[0]+b[0],a[1]+b[1],a[2]+b[2]);
+			c->m2l_coef[c->m2l_N] = c->sign[ib]*reb_fmm_binomial(a[0]+b[0],a[0])*reb_fmm_binomial(a[1]+b[1],a[1])*reb_fmm_binomial(a[2]+b[2],a[2]);
+			c->m2l_N++;
+		}
+	}
+}
+
+static void reb_fmm_context_free(struct reb_fmm_context* const c){
+	free(c->shift);
+	free(c->shift_coef);
+	free(c->m2l);
+	free(c->m2l_coef);
+}
+
+/**
+ * @brief Calculates t^gamma for all multi-indices gamma with index < n.
+ */
+static void reb_fmm_powers(const struct reb_fmm_context* const c, const int n, const double tx, const double ty, const double tz, double* const tp){
+	double px[REB_FMM_MAX_ORDER+2], py[REB_FMM_MAX_ORDER+2], pz[REB_FMM_MAX_ORDER+2];
+	px[0] = 1.; py[0] = 1.; pz[0] = 1.;
+	for (int i=1;i<REB_FMM_MAX_ORDER+2;i++){
+		px[i] = px[i-1]*tx;
+		py[i] = py[i-1]*ty;
+		pz[i] = pz[i-1]*tz;
+	}
+	for (int g=0;g<n;g++){
+		tp[g] = px[c->mi[g][0]]*py[c->mi[g][1]]*pz[c->mi[g][2]];
+	}
+}
+
+/**
+ * @brief Calculates the Taylor coefficients of 1/|d| (the derivatives divided by gamma!) for all multi-indices gamma with index < nL.
+ */
+static void reb_fmm_derivatives(const struct reb_fmm_context* const c, const double dx, const double dy, const double dz, double* const b){
+	const double d[3] = {dx, dy, dz};
+	const double d2 = dx*dx + dy*dy + dz*dz;
+	b[0] = 1./sqrt(d2);
+	for (int g=1;g<c->nL;g++){
+		const int* const m = c->mi[g];
+		const int n = m[0]+m[1]+m[2];
+		double s1 = 0.;
+		double s2 = 0.;
+		for (int i=0;i<3;i++){
+			if (m[i]>=1){
+				const int e[3] = {m[0]-(i==0), m[1]-(i==1), m[2]-(i==2)};
+				s1 += d[i]*b[reb_fmm_index(e[0],e[1],e[2])];
+			}
+			if (m[i]>=2){
+				const int e[3] = {m[0]-2*(i==0), m[1]-2*(i==1), m[2]-2*(i==2)};
+				s2 += b[reb_fmm_index(e[0],e[1],e[2])];
+			}
+		}
+		b[g] = -((2*n-1)*s1 + (n-1)*s2)/(n*d2);
+	}
+}
+
+/**
+ * @brief Calculates the multipole moments and radii of all cells (upward pass).
+ */
+static void reb_fmm_upward(struct reb_fmm_context* const c, const int Ncells){
+	const int nM = c->nM;
+	double tp[REB_FMM_MAX_TERMS];
+	for (int i=Ncells-1;i>=0;i--){
+		const struct reb_treecell_flat* const cell = &(c->cells[i]);
+		double* const Mi = &(c->M[nM*i]);
+		memset(Mi, 0, sizeof(double)*nM);
+		c->rmax[i] = 0.;
+		if (cell->pt>=0){
+			Mi[0] = cell->m;
+			continue;
+		}
+		for (int k=i+1;k<cell->next;k=c->cells[k].next){
+			const struct reb_treecell_flat* const child = &(c->cells[k]);
+			const double* const Mk = &(c->M[nM*k]);
+			const double tx = child->mx - cell->mx;
+			const double ty = child->my - cell->my;
+			const double tz = child->mz - cell->mz;
+			reb_fmm_powers(c, nM, tx, ty, tz, tp);
+			for (int s=0;s<c->shift_NM;s++){
+				const int* const t = &(c->shift[3*s]);
+				Mi[t[0]] += c->shift_coef[s]*Mk[t[1]]*tp[t[2]];
+			}
+			const double rk = sqrt(tx*tx + ty*ty + tz*tz) + c->rmax[k];
+			if (rk>c->rmax[i]){
+				c->rmax[i] = rk;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Shifts the local expansions down to the leaves and evaluates the accelerations (downward pass).
+ */
+static void reb_fmm_downward(struct reb_fmm_context* const c, const int Ncells){
+	const int nL = c->nL;
+	double tp[REB_FMM_MAX_TERMS];
+	for (int i=0;i<Ncells;i++){
+		const struct reb_treecell_flat* const cell = &(c->cells[i]);
+		const double* const Li = &(c->L[nL*i]);
+		if (cell->pt>=0){
+			// Expansion center coincides with the particle.
+			struct reb_particle* const p = &(c->particles[cell->pt]);
+			p->ax -= Li[1];
+			p->ay -= Li[2];
+			p->az -= Li[3];
+			continue;
+		}
+		for (int k=i+1;k<cell->next;k=c->cells[k].next){
+			const struct reb_treecell_flat* const child = &(c->cells[k]);
+			double* const Lk = &(c->L[nL*k]);
+			reb_fmm_powers(c, nL, child->mx - cell->mx, child->my - cell->my, child->mz - cell->mz, tp);
+			for (int s=0;s<c->shift_N;s++){
+				const int* const t = &(c->shift[3*s]);
+				Lk[t[1]] += c->shift_coef[s]*tp[t[2]]*Li[t[0]];
+			}
+		}
+	}
+}
+
+/**
+ * @brief Interaction of two cells.
+ * @details The expansion of cell A is converted into a local expansion of cell B if the cells are
+ * well separated. Otherwise, the larger cell is opened. If mutual is set to 1, cell A also
+ * receives the contribution of cell B. The position of cell B is shifted by (sx,sy,sz).
+ */
+static void reb_fmm_interact(struct reb_fmm_context* const c, const int A, const int B, const double sx, const double sy, const double sz, const int mutual){
+	const struct reb_treecell_flat* const cA = &(c->cells[A]);
+	const struct reb_treecell_flat* const cB = &(c->cells[B]);
+	const double dx = cB->mx + sx - cA->mx;
+	const double dy = cB->my + sy - cA->my;
+	const double dz = cB->mz + sz - cA->mz;
+	const double d2 = dx*dx + dy*dy + dz*dz;
+	const double rAB = c->rmax[A] + c->rmax[B];
+	const int leafA = cA->pt>=0;
+	const int leafB = cB->pt>=0;
+	if (leafA && leafB){
+		// Particle-particle interaction
+		const double _r2 = d2 + c->softening2;
+		const double prefact = c->G/(_r2*sqrt(_r2));
+		struct reb_particle* const pB = &(c->particles[cB->pt]);
+		pB->ax -= prefact*cA->m*dx;
+		pB->ay -= prefact*cA->m*dy;
+		pB->az -= prefact*cA->m*dz;
+		if (mutual){
+			struct reb_particle* const pA = &(c->particles[cA->pt]);
+			pA->ax += prefact*cB->m*dx;
+			pA->ay += prefact*cB->m*dy;
+			pA->az += prefact*cB->m*dz;
+		}
+		return;
+	}
+	if (rAB*rAB < c->theta2*d2){
+		// Cell-cell interaction (M2L)
+		double b[REB_FMM_MAX_TERMS];
+		reb_fmm_derivatives(c, dx, dy, dz, b);
+		const double* const MA = &(c->M[c->nM*A]);
+		double* const LB = &(c->L[c->nL*B]);
+		for (int s=0;s<c->m2l_N;s++){
+			const int* const t = &(c->m2l[3*s]);
+			LB[t[0]] -= c->G*c->m2l_coef[s]*MA[t[1]]*b[t[2]];
+		}
+		if (mutual){
+			// Derivatives at -d differ from those at d by (-1)^|gamma|.
+			const double* const MB = &(c->M[c->nM*B]);
+			double* const LA = &(c->L[c->nL*A]);
+			for (int s=0;s<c->m2l_N;s++){
+				const int* const t = &(c->m2l[3*s]);
+				LA[t[0]] -= c->G*c->m2l_coef[s]*MB[t[1]]*c->sign[t[2]]*b[t[2]];
+			}
+		}
+		return;
+	}
+	if (leafB || (!leafA && c->rmax[A]>=c->rmax[B])){
+		for (int k=A+1;k<cA->next;k=c->cells[k].next){
+			reb_fmm_interact(c, k, B, sx, sy, sz, mutual);
+		}
+	}else{
+		for (int k=B+1;k<cB->next;k=c->cells[k].next){
+			reb_fmm_interact(c, A, k, sx, sy, sz, mutual);
+		}
+	}
+}
+
+/**
+ * @brief Interactions of all particles within one cell with each other.
+ */
+static void reb_fmm_interact_self(struct reb_fmm_context* const c, const int A){
+	const struct reb_treecell_flat* const cA = &(c->cells[A]);
+	if (cA->pt>=0){
+		return;
+	}
+	for (int k=A+1;k<cA->next;k=c->cells[k].next){
+		reb_fmm_interact_self(c, k);
+		for (int l=c->cells[k].next;l<cA->next;l=c->cells[l].next){
+			reb_fmm_interact(c, k, l, 0., 0., 0., 1);
+		}
+	}
+}
+
+void reb_calculate_acceleration_fmm(struct reb_simulation* const r){
+#ifdef MPI
+	reb_exit("REB_GRAVITY_FMM is not supported with MPI.");
+#endif // MPI
+	if (r->fmm_order<1 || r->fmm_order>REB_FMM_MAX_ORDER){
+		char str[128];
+		sprintf(str, "fmm_order needs to be between 1 and %d.", REB_FMM_MAX_ORDER);
+		reb_exit(str);
+	}
+	reb_tree_flatten(r);
+	const int Ncells = r->tree_flat_N;
+	if (Ncells==0){
+		return;
+	}
+	struct reb_fmm_context* const c = malloc(sizeof(struct reb_fmm_context));
+	reb_fmm_context_init(c, r->fmm_order);
+	if (Ncells>r->fmm_allocatedN){
+		r->fmm_allocatedN = Ncells;
+		r->fmm_multipoles = realloc(r->fmm_multipoles, sizeof(double)*c->nM*Ncells);
+		r->fmm_locals = realloc(r->fmm_locals, sizeof(double)*c->nL*Ncells);
+		r->fmm_rmax = realloc(r->fmm_rmax, sizeof(double)*Ncells);
+		r->fmm_allocated_order = r->fmm_order;
+	}else if (r->fmm_order>r->fmm_allocated_order){
+		r->fmm_multipoles = realloc(r->fmm_multipoles, sizeof(double)*c->nM*r->fmm_allocatedN);
+		r->fmm_locals = realloc(r->fmm_locals, sizeof(double)*c->nL*r->fmm_allocatedN);
+		r->fmm_allocated_order = r->fmm_order;
+	}
+	c->cells = r->tree_flat;
+	c->particles = r->particles;
+	c->M = r->fmm_multipoles;
+	c->L = r->fmm_locals;
+	c->rmax = r->fmm_rmax;
+	c->G = r->G;
+	c->softening2 = r->softening*r->softening;
+	c->theta2 = r->opening_angle2;
+
+	reb_fmm_upward(c, Ncells);
+	memset(c->L, 0, sizeof(double)*c->nL*Ncells);
+
+	// Root cells are the top level cells of r->tree_flat.
+	int* roots = malloc(sizeof(int)*r->root_n);
+	int Nroots = 0;
+	for (int i=0;i<Ncells;i=c->cells[i].next){
+		roots[Nroots++] = i;
+	}
+	for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+	for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+	for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+		const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+		if (gbx==0 && gby==0 && gbz==0){
+			for (int i=0;i<Nroots;i++){
+				reb_fmm_interact_self(c, roots[i]);
+				for (int j=i+1;j<Nroots;j++){
+					reb_fmm_interact(c, roots[i], roots[j], 0., 0., 0., 1);
+				}
+			}
+		}else{
+			for (int i=0;i<Nroots;i++){
+				for (int j=0;j<Nroots;j++){
+					reb_fmm_interact(c, roots[i], roots[j], gb.shiftx, gb.shifty, gb.shiftz, 0);
+				}
+			}
+		}
+	}
+	}
+	}
+	free(roots);
+
+	reb_fmm_downward(c, Ncells);
+	reb_fmm_context_free(c);
+	free(c);
+}
@@ -0,0 +1,42 @@
+/**
+ * @file 	gravity_fmm.h
+ * @brief 	Gravity calculation using the fast multipole method, O(N).
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _GRAVITY_FMM_H
+#define _GRAVITY_FMM_H
+
+/**
+ * @brief Maximum expansion order supported by REB_GRAVITY_FMM.
+ */
+#define REB_FMM_MAX_ORDER 8
+
+/**
+  * @brief Calculates the accelerations of all particles using the fast multipole method.
+  * @details Uses the tree of r->tree_root. The tree needs to be up to date and the
+  * gravity data needs to be updated (see reb_tree_update_gravity_data()). The
+  * accelerations are added to the ax, ay, az fields of the particles.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_calculate_acceleration_fmm(struct reb_simulation* const r);
+
+#endif // _GRAVITY_FMM_H
@@ -0,0 +1,308 @@
+/**
+ * @file 	gravity_opencl.c
+ * @brief 	Direct summation gravity on a GPU using OpenCL, O(N^2).
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	This module evaluates the same sum as REB_GRAVITY_BASIC
+ * on an OpenCL device (typically a GPU). One work item calculates the
+ * acceleration of one particle. Work groups load tiles of positions
+ * and masses into local memory and every work item then sums over the
+ * tile. All calculations are done in double precision, the device
+ * therefore needs to support the cl_khr_fp64 extension.
+ *
+ * The OpenCL context, the compiled kernel and the device buffers are
+ * created at the first call and kept in r->opencl until the simulation
+ * is freed. The buffers are only reallocated if the number of particles
+ * grows. The integrators run on the host, so each force calculation
+ * uploads positions and masses (32 bytes per particle) and downloads
+ * the accelerations (32 bytes per particle). This O(N) transfer is
+ * small compared to the O(N^2) work on the device.
+ *
+ * The module needs to be enabled at compile time with OPENCL=1.
+ * Periodic boundary conditions with ghost boxes and MPI are not
+ * supported.
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "gravity_opencl.h"
+
+#ifdef OPENCL
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#ifdef _APPLE
+#include <OpenCL/cl.h>
+#else // _APPLE
+#include <CL/cl.h>
+#endif // _APPLE
+
+/**
+ * @brief Maximum work group size used by the kernel.
+ */
+#define REB_OPENCL_LOCAL_SIZE 256
+
+/**
+ * @brief OpenCL state of a simulation.
+ * @details Created by the first call to reb_calculate_acceleration_opencl()
+ * and freed by reb_opencl_free().
+ */
+struct reb_opencl {
+	cl_context context;         ///< OpenCL context
+	cl_command_queue queue;     ///< Command queue on the selected device
+	cl_program program;         ///< Program containing the gravity kernel
+	cl_kernel kernel;           ///< Gravity kernel
+	cl_mem pos;                 ///< Device buffer with x, y, z, m of all particles
+	cl_mem acc;                 ///< Device buffer with the accelerations of all particles
+	cl_double* pos_host;        ///< Host staging buffer for pos
+	cl_double* acc_host;        ///< Host staging buffer for acc
+	size_t local_size;          ///< Work group size
+	int allocatedN;             ///< Number of particles for which buffers have been allocated
+};
+
+/**
+ * @brief OpenCL source of the gravity kernel.
+ * @details N_active sources act on all particles. If testparticle_type is 1,
+ * the test particles (index >= N_active) also act on the active particles.
+ * The tile buffer has one entry per work item.
+ */
+static const char* reb_opencl_kernel_source =
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+"__kernel void reb_gravity(__global const double4* pos, __global double4* acc, __local double4* tile,\n"
+"		const int N, const int N_active, const int testparticle_type, const int ignore_terms,\n"
+"		const double G, const double softening2){\n"
+"	const int i = get_global_id(0);\n"
+"	const int li = get_local_id(0);\n"
+"	const int ls = get_local_size(0);\n"
+"	const double4 pi = i<N ? pos[i] : (double4)(0.,0.,0.,0.);\n"
+"	const int jmax = (i<N_active && testparticle_type) ? N : N_active;\n"
+"	double ax = 0., ay = 0., az = 0.;\n"
+"	const int tmax = testparticle_type ? N : N_active;\n"
+"	for (int t=0; t<tmax; t+=ls){\n"
+"		const int tj = t+li;\n"
+"		tile[li] = tj<N ? pos[tj] : (double4)(0.,0.,0.,0.);\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"		const int kmax = min(ls, jmax-t);\n"
+"		for (int k=0; k<kmax; k++){\n"
+"			const int j = t+k;\n"
+"			if (j==i) continue;\n"
+"			if (ignore_terms==1 && ((i==0 && j==1) || (i==1 && j==0))) continue;\n"
+"			if (ignore_terms==2 && (i==0 || j==0)) continue;\n"
+"			const double4 pj = tile[k];\n"
+"			const double dx = pi.x - pj.x;\n"
+"			const double dy = pi.y - pj.y;\n"
+"			const double dz = pi.z - pj.z;\n"
+"			const double r2 = dx*dx + dy*dy + dz*dz + softening2;\n"
+"			const double r = sqrt(r2);\n"
+"			const double prefact = pj.w/(r2*r);\n"
+"			ax -= prefact*dx;\n"
+"			ay -= prefact*dy;\n"
+"			az -= prefact*dz;\n"
+"		}\n"
+"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+"	}\n"
+"	if (i<N){\n"
+"		acc[i] = (double4)(G*ax, G*ay, G*az, 0.);\n"
+"	}\n"
+"}\n";
+
+/**
+ * @brief Exits with an error message if an OpenCL call failed.
+ */
+static void reb_opencl_check(const cl_int err, const char* const what){
+	if (err!=CL_SUCCESS){
+		char msg[256];
+		snprintf(msg, sizeof(msg), "OpenCL error %d in %s.", (int)err, what);
+		reb_exit(msg);
+	}
+}
+
+/**
+ * @brief Selects a device, creates the context and compiles the kernel.
+ * @details GPUs are preferred. Any other device supporting double precision is used otherwise.
+ */
+static struct reb_opencl* reb_opencl_init(void){
+	cl_int err;
+	cl_uint platforms_N = 0;
+	err = clGetPlatformIDs(0, NULL, &platforms_N);
+	if (err!=CL_SUCCESS || platforms_N==0){
+		reb_exit("No OpenCL platform found.");
+	}
+	cl_platform_id* platforms = malloc(sizeof(cl_platform_id)*platforms_N);
+	reb_opencl_check(clGetPlatformIDs(platforms_N, platforms, NULL), "clGetPlatformIDs");
+
+	cl_device_id device = NULL;
+	const cl_device_type types[2] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+	for (int t=0; t<2 && device==NULL; t++){
+		for (cl_uint p=0; p<platforms_N && device==NULL; p++){
+			cl_uint devices_N = 0;
+			if (clGetDeviceIDs(platforms[p], types[t], 0, NULL, &devices_N)!=CL_SUCCESS || devices_N==0) continue;
+			cl_device_id* devices = malloc(sizeof(cl_device_id)*devices_N);
+			clGetDeviceIDs(platforms[p], types[t], devices_N, devices, NULL);
+			for (cl_uint d=0; d<devices_N; d++){
+				cl_device_fp_config fp64 = 0;
+				clGetDeviceInfo(devices[d], CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+				if (fp64){
+					device = devices[d];
+					break;
+				}
+			}
+			free(devices);
+		}
+	}
+	free(platforms);
+	if (device==NULL){
+		reb_exit("No OpenCL device with double precision support found.");
+	}
+
+	struct reb_opencl* cl = calloc(1, sizeof(struct reb_opencl));
+	cl->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+	reb_opencl_check(err, "clCreateContext");
+	cl->queue = clCreateCommandQueue(cl->context, device, 0, &err);
+	reb_opencl_check(err, "clCreateCommandQueue");
+	cl->program = clCreateProgramWithSource(cl->context, 1, &reb_opencl_kernel_source, NULL, &err);
+	reb_opencl_check(err, "clCreateProgramWithSource");
+	err = clBuildProgram(cl->program, 1, &device, NULL, NULL, NULL);
+	if (err!=CL_SUCCESS){
+		size_t log_size = 0;
+		clGetProgramBuildInfo(cl->program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		char* log = malloc(log_size+1);
+		clGetProgramBuildInfo(cl->program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		log[log_size] = '\0';
+		fprintf(stderr, "%s\n", log);
+		free(log);
+		reb_opencl_check(err, "clBuildProgram");
+	}
+	cl->kernel = clCreateKernel(cl->program, "reb_gravity", &err);
+	reb_opencl_check(err, "clCreateKernel");
+
+	size_t max_local = 1;
+	clGetKernelWorkGroupInfo(cl->kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local), &max_local, NULL);
+	cl->local_size = REB_OPENCL_LOCAL_SIZE;
+	while (cl->local_size>max_local && cl->local_size>1){
+		cl->local_size /= 2;
+	}
+	return cl;
+}
+
+/**
+ * @brief Makes sure the device and host buffers can hold N particles.
+ */
+static void reb_opencl_reserve(struct reb_opencl* const cl, const int N){
+	if (cl->allocatedN>=N) return;
+	if (cl->pos) clReleaseMemObject(cl->pos);
+	if (cl->acc) clReleaseMemObject(cl->acc);
+	int allocatedN = cl->allocatedN?cl->allocatedN:128;
+	while (allocatedN<N) allocatedN *= 2;
+	cl_int err;
+	cl->pos = clCreateBuffer(cl->context, CL_MEM_READ_ONLY, sizeof(cl_double)*4*allocatedN, NULL, &err);
+	reb_opencl_check(err, "clCreateBuffer");
+	cl->acc = clCreateBuffer(cl->context, CL_MEM_WRITE_ONLY, sizeof(cl_double)*4*allocatedN, NULL, &err);
+	reb_opencl_check(err, "clCreateBuffer");
+	cl->pos_host = realloc(cl->pos_host, sizeof(cl_double)*4*allocatedN);
+	cl->acc_host = realloc(cl->acc_host, sizeof(cl_double)*4*allocatedN);
+	cl->allocatedN = allocatedN;
+}
+
+void reb_calculate_acceleration_opencl(struct reb_simulation* const r){
+#ifdef MPI
+	reb_exit("REB_GRAVITY_OPENCL is not supported with MPI.");
+#endif // MPI
+	if (r->nghostx || r->nghosty || r->nghostz){
+		reb_exit("REB_GRAVITY_OPENCL does not support ghost boxes.");
+	}
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N - r->N_var;
+	const int N_active = r->N_active==-1?N:r->N_active;
+	if (N==0) return;
+	if (r->opencl==NULL){
+		r->opencl = reb_opencl_init();
+	}
+	struct reb_opencl* const cl = r->opencl;
+	reb_opencl_reserve(cl, N);
+
+	cl_double* const pos = cl->pos_host;
+	for (int i=0; i<N; i++){
+		pos[4*i+0] = particles[i].x;
+		pos[4*i+1] = particles[i].y;
+		pos[4*i+2] = particles[i].z;
+		pos[4*i+3] = particles[i].m;
+	}
+	reb_opencl_check(clEnqueueWriteBuffer(cl->queue, cl->pos, CL_FALSE, 0, sizeof(cl_double)*4*N, pos, 0, NULL, NULL), "clEnqueueWriteBuffer");
+
+	const cl_int _N = N;
+	const cl_int _N_active = N_active;
+	const cl_int _testparticle_type = r->testparticle_type;
+	const cl_int _ignore_terms = r->gravity_ignore_terms;
+	const cl_double _G = r->G;
+	const cl_double _softening2 = r->softening*r->softening;
+	cl_int err = CL_SUCCESS;
+	err |= clSetKernelArg(cl->kernel, 0, sizeof(cl_mem), &cl->pos);
+	err |= clSetKernelArg(cl->kernel, 1, sizeof(cl_mem), &cl->acc);
+	err |= clSetKernelArg(cl->kernel, 2, sizeof(cl_double)*4*cl->local_size, NULL);
+	err |= clSetKernelArg(cl->kernel, 3, sizeof(cl_int), &_N);
+	err |= clSetKernelArg(cl->kernel, 4, sizeof(cl_int), &_N_active);
+	err |= clSetKernelArg(cl->kernel, 5, sizeof(cl_int), &_testparticle_type);
+	err |= clSetKernelArg(cl->kernel, 6, sizeof(cl_int), &_ignore_terms);
+	err |= clSetKernelArg(cl->kernel, 7, sizeof(cl_double), &_G);
+	err |= clSetKernelArg(cl->kernel, 8, sizeof(cl_double), &_softening2);
+	reb_opencl_check(err, "clSetKernelArg");
+
+	const size_t local_size = cl->local_size;
+	const size_t global_size = ((N+local_size-1)/local_size)*local_size;
+	reb_opencl_check(clEnqueueNDRangeKernel(cl->queue, cl->kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL), "clEnqueueNDRangeKernel");
+	reb_opencl_check(clEnqueueReadBuffer(cl->queue, cl->acc, CL_TRUE, 0, sizeof(cl_double)*4*N, cl->acc_host, 0, NULL, NULL), "clEnqueueReadBuffer");
+
+	const cl_double* const acc = cl->acc_host;
+#pragma omp parallel for schedule(static)
+	for (int i=0; i<N; i++){
+		particles[i].ax = acc[4*i+0];
+		particles[i].ay = acc[4*i+1];
+		particles[i].az = acc[4*i+2];
+	}
+}
+
+void reb_opencl_free(struct reb_simulation* const r){
+	struct reb_opencl* const cl = r->opencl;
+	if (cl==NULL) return;
+	if (cl->pos) clReleaseMemObject(cl->pos);
+	if (cl->acc) clReleaseMemObject(cl->acc);
+	if (cl->kernel) clReleaseKernel(cl->kernel);
+	if (cl->program) clReleaseProgram(cl->program);
+	if (cl->queue) clReleaseCommandQueue(cl->queue);
+	if (cl->context) clReleaseContext(cl->context);
+	free(cl->pos_host);
+	free(cl->acc_host);
+	free(cl);
+	r->opencl = NULL;
+}
+
+#else // OPENCL
+
+void reb_calculate_acceleration_opencl(struct reb_simulation* const r){
+	reb_exit("REBOUND was compiled without OpenCL support. Compile with OPENCL=1 to use REB_GRAVITY_OPENCL.");
+}
+
+void reb_opencl_free(struct reb_simulation* const r){
+}
+
+#endif // OPENCL
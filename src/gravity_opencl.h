@@ -0,0 +1,43 @@
+/**
+ * @file 	gravity_opencl.h
+ * @brief 	Direct summation gravity on a GPU using OpenCL, O(N^2).
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _GRAVITY_OPENCL_H
+#define _GRAVITY_OPENCL_H
+
+/**
+  * @brief Calculates the accelerations of all particles by direct summation on an OpenCL device.
+  * @details Requires REBOUND to be compiled with OPENCL=1. The device, buffers and kernel
+  * are set up during the first call and kept in r->opencl. The accelerations are set
+  * (not added) in the ax, ay, az fields of the particles.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_calculate_acceleration_opencl(struct reb_simulation* const r);
+
+/**
+  * @brief Releases the OpenCL device state of a simulation (if any).
+  * @param r REBOUND simulation to operate on
+  */
+void reb_opencl_free(struct reb_simulation* const r);
+
+#endif // _GRAVITY_OPENCL_H
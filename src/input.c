@@ -29,10 +29,12 @@
 #include <time.h>
 #include <getopt.h>
 #include <string.h>
+#include <stdint.h>
 #include "particle.h"
 #include "rebound.h"
 #include "collision.h"
 #include "input.h"
+#include "output.h"
 #include "tree.h"
 #ifdef MPI
 #include "communication_mpi.h"
@@ -102,6 +104,52 @@ void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf){
     fread(dp7->p6,sizeof(double),N3,inf);
 }
 
+int reb_read_particle_columns(struct reb_particle* const particles, const int N, const long size, FILE* inf){
+    int unknown = 0;
+    long read = sizeof(long);
+    char buffer[REB_BINARY_COLUMN_CHUNK*sizeof(double)];
+    while (read+(long)sizeof(struct reb_binary_column)<=size){
+        struct reb_binary_column column;
+        if (!fread(&column,sizeof(struct reb_binary_column),1,inf)) break;
+        read += sizeof(struct reb_binary_column)+column.size;
+        const struct reb_binary_column_layout* l = NULL;
+        for (int c=0;c<reb_binary_column_layouts_N;c++){
+            if (reb_binary_column_layouts[c].type==column.type){
+                l = &reb_binary_column_layouts[c];
+            }
+        }
+        if (!l || column.size!=(long)l->size*N){
+            unknown = 1;
+            fseek(inf,column.size,SEEK_CUR);
+            continue;
+        }
+        // Columns are scattered in chunks, so only a small buffer is needed for large N.
+        for (int i=0;i<N;i+=REB_BINARY_COLUMN_CHUNK){
+            const int n = N-i<REB_BINARY_COLUMN_CHUNK?N-i:REB_BINARY_COLUMN_CHUNK;
+            fread(buffer,l->size,n,inf);
+            for (int j=0;j<n;j++){
+                memcpy((char*)&particles[i+j]+l->offset, buffer+j*l->size, l->size);
+            }
+        }
+    }
+    if (read<size){
+        fseek(inf,size-read,SEEK_CUR);
+    }
+    return unknown;
+}
+
+// Reads the number of particles of a particle array field and allocates the array. 
+// Returns NULL if there are no particles.
+static struct reb_particle* reb_read_particle_columns_malloc(long* const N, FILE* inf){
+    *N = 0;
+    fread(N,sizeof(long),1,inf);
+    if (*N<=0){
+        *N = 0;
+        return NULL;
+    }
+    return calloc(*N,sizeof(struct reb_particle));
+}
+
 // Macro to read a single field from a binary file.
 #define CASE(typename, value) case REB_BINARY_FIELD_TYPE_##typename: \
     {\
@@ -116,34 +164,33 @@ void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf){
     }\
     break;
 
+// Reads the seven arrays of a reb_dp7 field.
+static void reb_input_binary_dp7(struct reb_dp7* const dp7, const long size, FILE* inf){
+    dp7->p0 = malloc(size/7);
+    dp7->p1 = malloc(size/7);
+    dp7->p2 = malloc(size/7);
+    dp7->p3 = malloc(size/7);
+    dp7->p4 = malloc(size/7);
+    dp7->p5 = malloc(size/7);
+    dp7->p6 = malloc(size/7);
+    fread(dp7->p0, size/7,1,inf);
+    fread(dp7->p1, size/7,1,inf);
+    fread(dp7->p2, size/7,1,inf);
+    fread(dp7->p3, size/7,1,inf);
+    fread(dp7->p4, size/7,1,inf);
+    fread(dp7->p5, size/7,1,inf);
+    fread(dp7->p6, size/7,1,inf);
+}
+
 #define CASE_MALLOC_DP7(typename, valueref) case REB_BINARY_FIELD_TYPE_##typename: \
     {\
-        valueref.p0 = malloc(field.size/7);\
-        valueref.p1 = malloc(field.size/7);\
-        valueref.p2 = malloc(field.size/7);\
-        valueref.p3 = malloc(field.size/7);\
-        valueref.p4 = malloc(field.size/7);\
-        valueref.p5 = malloc(field.size/7);\
-        valueref.p6 = malloc(field.size/7);\
-        fread(valueref.p0, field.size/7,1,inf);\
-        fread(valueref.p1, field.size/7,1,inf);\
-        fread(valueref.p2, field.size/7,1,inf);\
-        fread(valueref.p3, field.size/7,1,inf);\
-        fread(valueref.p4, field.size/7,1,inf);\
-        fread(valueref.p5, field.size/7,1,inf);\
-        fread(valueref.p6, field.size/7,1,inf);\
+        reb_input_binary_dp7(&(valueref), field.size, inf);\
     }\
     break;
     
 
-void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, char* filename, enum reb_input_binary_messages* warnings){
-    FILE* inf = fopen(filename,"rb"); 
-    
-    if (!inf){
-        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
-        return;
-    }
-
+// Reads the header and all fields from inf until the END field or the end of the stream.
+static void reb_input_binary_fields(struct reb_simulation* r, FILE* inf, enum reb_input_binary_messages* warnings){
     long objects = 0;
     // Input header.
     const char str[] = "REBOUND Binary File. Version: ";
@@ -166,7 +213,9 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
     int reading_fields = 1;
     while(reading_fields){
         struct reb_binary_field field;
-        fread(&field,sizeof(struct reb_binary_field),1,inf);
+        if (!fread(&field,sizeof(struct reb_binary_field),1,inf)){
+            break;
+        }
         switch (field.type){
             CASE(T,                  &r->t);
             CASE(G,                  &r->G);
@@ -205,6 +254,7 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
             CASE(COLLISIONSPLOG,     &r->collisions_plog);
             CASE(MAXRADIUS,          &r->max_radius);
             CASE(COLLISIONSNLOG,     &r->collisions_Nlog);
+            CASE(COLLISIONSSEED,     &r->collisions_seed);
             CASE(CALCULATEMEGNO,     &r->calculate_megno);
             CASE(MEGNOYS,            &r->megno_Ys);
             CASE(MEGNOYSS,           &r->megno_Yss);
@@ -219,6 +269,12 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
             CASE(SAINTERVALWALLTIME, &r->simulationarchive_interval_walltime);
             CASE(SANEXT,             &r->simulationarchive_next);
             CASE(SAWALLTIME,         &r->simulationarchive_walltime);
+            CASE(SAFSYNCINTERVAL,    &r->simulationarchive_fsync_interval);
+            CASE(SAASYNC,            &r->simulationarchive_async);
+            CASE(SACOMPRESSION,      &r->simulationarchive_compression);
+            CASE(SAKEYFRAMEINTERVAL, &r->simulationarchive_keyframe_interval);
+            CASE(SAEXTRAS,           &r->simulationarchive_extras);
+            CASE(SAMEMBER,           &r->simulationarchive_member);
             CASE(COLLISION,          &r->collision);
             CASE(VISUALIZATION,      &r->visualization);
             CASE(INTEGRATOR,         &r->integrator);
@@ -258,6 +314,45 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
             CASE(JANUS_ORDER,        &r->ri_janus.order);
             CASE(JANUS_ALLOCATEDN,   &r->ri_janus.allocated_N);
             CASE(JANUS_RECALC,       &r->ri_janus.recalculate_integer_coordinates_this_timestep);
+            CASE(SABA_TYPE,          &r->ri_saba.type);
+            CASE(SABA_CORRECTOR,     &r->ri_saba.corrector);
+            CASE(SABA_SAFEMODE,      &r->ri_saba.safe_mode);
+            CASE(SABA_ISSYNCHRON,    &r->ri_saba.is_synchronized);
+            CASE(MERCURIUS_HILLFAC,  &r->ri_mercurius.hillfac);
+            CASE(MERCURIUS_EPSILON,  &r->ri_mercurius.encounter_epsilon);
+            CASE(MERCURIUS_SAFEMODE, &r->ri_mercurius.safe_mode);
+            CASE(MERCURIUS_RECALC,   &r->ri_mercurius.recalculate_coordinates_this_timestep);
+            CASE(TREEFLATTEN,        &r->tree_flatten);
+            CASE(TREEGROUPSIZE,      &r->tree_group_size);
+            CASE(FMMORDER,           &r->fmm_order);
+            CASE(MULTIPOLEORDER,     &r->multipole_order);
+            CASE(TREEREBUILD,        &r->tree_rebuild);
+            CASE(TREEREFIT,          &r->tree_refit);
+            CASE(TREEACTIVEONLY,     &r->tree_active_only);
+            CASE(TREETASKS,          &r->tree_tasks);
+            CASE(TREELEAFSIZE,       &r->tree_leaf_size);
+            CASE(TREEFORCEACCURACY,  &r->tree_force_accuracy);
+            CASE(TREEFORCEACCINTERVAL, &r->tree_force_accuracy_interval);
+            CASE(TREEFORCEACCSAMPLES, &r->tree_force_accuracy_samples);
+            CASE(TREEFORCEACCSTEPS,  &r->tree_force_accuracy_steps);
+            CASE(TREEFORCEERROR,     &r->tree_force_error);
+            CASE(HEARTBEATINTERVAL,  &r->heartbeat_interval);
+            CASE(REORDERINTERVAL,    &r->reorder_interval);
+            CASE(TREESINGLEPRECISION, &r->tree_single_precision);
+            CASE(REPRODUCIBLE,       &r->reproducible);
+            CASE(RANDSEED,           &r->rand_seed);
+            CASE(RANDSTREAMS,        &r->rand_streams);
+            CASE(SLEEPVELOCITY,      &r->sleep_velocity);
+            CASE(SLEEPSTEPS,         &r->sleep_steps);
+            CASE(COLLISIONRESOLVEPARALLEL, &r->collision_resolve_parallel);
+            CASE(COLLISIONSWEPT,     &r->collision_swept);
+            CASE(COLLISIONVERLETSKIN, &r->collision_verlet_skin);
+            CASE(COLLISIONFUSED,     &r->collision_fused);
+            CASE(IAS15_BLOCKLEVELS,  &r->ri_ias15.block_levels);
+            CASE(IAS15_LEAN,         &r->ri_ias15.lean);
+            CASE(FFTNX,              &r->fft_nx);
+            CASE(FFTNY,              &r->fft_ny);
+            CASE(FFTRS,              &r->fft_rs);
             case REB_BINARY_FIELD_TYPE_PARTICLES:
                 if(r->particles){
                     free(r->particles);
@@ -273,12 +368,72 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
                     r->particles[l].ap = NULL;
                     r->particles[l].sim = r;
                 }
-                if (r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE){
+                if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision==REB_COLLISION_TREE){
+                    for (int l=0;l<r->allocatedN;l++){
+                        reb_tree_add_particle_to_tree(r, l);
+                    }
+                }
+                break;
+            case REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS:
+                if(r->particles){
+                    free(r->particles);
+                }
+                {
+                    long N;
+                    r->particles = reb_read_particle_columns_malloc(&N, inf);
+                    r->allocatedN = (int)N;
+                }
+                if (r->allocatedN<r->N){
+                    *warnings |= REB_INPUT_BINARY_WARNING_PARTICLES;
+                }
+                if (reb_read_particle_columns(r->particles, r->allocatedN, field.size, inf)){
+                    *warnings |= REB_INPUT_BINARY_WARNING_FIELD_UNKOWN;
+                }
+                for (int l=0;l<r->allocatedN;l++){
+                    r->particles[l].sim = r;
+                }
+                if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision==REB_COLLISION_TREE){
                     for (int l=0;l<r->allocatedN;l++){
                         reb_tree_add_particle_to_tree(r, l);
                     }
                 }
                 break;
+            case REB_BINARY_FIELD_TYPE_TREECELLS:
+                if (r->tree_root!=NULL && field.size==(long)(sizeof(double)*3*r->N)){
+                    double* const cells = malloc(field.size);
+                    fread(cells, field.size, 1, inf);
+                    reb_tree_build_from_cells(r, cells);
+                    free(cells);
+                }else{
+                    fseek(inf,field.size,SEEK_CUR);
+                }
+                break;
+            case REB_BINARY_FIELD_TYPE_WHFAST_PJCOLUMNS:
+                if(r->ri_whfast.p_j){
+                    free(r->ri_whfast.p_j);
+                }
+                {
+                    long N;
+                    r->ri_whfast.p_j = reb_read_particle_columns_malloc(&N, inf);
+                    r->ri_whfast.allocated_N = (unsigned int)N;
+                }
+                if (reb_read_particle_columns(r->ri_whfast.p_j, r->ri_whfast.allocated_N, field.size, inf)){
+                    *warnings |= REB_INPUT_BINARY_WARNING_FIELD_UNKOWN;
+                }
+                break;
+            case REB_BINARY_FIELD_TYPE_WHFASTH_PHCOLUMNS:
+                if(r->ri_whfasthelio.p_h){
+                    free(r->ri_whfasthelio.p_h);
+                }
+                {
+                    long N;
+                    r->ri_whfasthelio.p_h = reb_read_particle_columns_malloc(&N, inf);
+                    r->ri_whfasthelio.allocated_N = (unsigned int)N;
+                }
+                if (reb_read_particle_columns(r->ri_whfasthelio.p_h, r->ri_whfasthelio.allocated_N, field.size, inf)){
+                    *warnings |= REB_INPUT_BINARY_WARNING_FIELD_UNKOWN;
+                }
+                break;
             case REB_BINARY_FIELD_TYPE_WHFAST_PJ:
                 if(r->ri_whfast.p_j){
                     free(r->ri_whfast.p_j);
@@ -323,6 +478,13 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
                     }
                 }
                 break;
+            case REB_BINARY_FIELD_TYPE_FORCES:
+                free(r->forces);
+                r->forces = malloc(field.size);
+                r->forces_N = (int)(field.size/sizeof(struct reb_force));
+                r->forces_allocatedN = r->forces_N;
+                fread(r->forces, field.size,1,inf);
+                break;
             CASE_MALLOC(IAS15_AT,     r->ri_ias15.at);
             CASE_MALLOC(IAS15_X0,     r->ri_ias15.x0);
             CASE_MALLOC(IAS15_V0,     r->ri_ias15.v0);
@@ -332,7 +494,11 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
             CASE_MALLOC(IAS15_CSA0,   r->ri_ias15.csa0);
             CASE_MALLOC_DP7(IAS15_G,  r->ri_ias15.g);
             CASE_MALLOC_DP7(IAS15_B,  r->ri_ias15.b);
-            CASE_MALLOC_DP7(IAS15_CSB,r->ri_ias15.csb);
+            case REB_BINARY_FIELD_TYPE_IAS15_CSB:
+                // Smaller than the other arrays if lean>=2.
+                r->ri_ias15.csb_allocatedN = (int)(field.size/7/sizeof(double));
+                reb_input_binary_dp7(&(r->ri_ias15.csb), field.size, inf);
+                break;
             CASE_MALLOC_DP7(IAS15_E,  r->ri_ias15.e);
             CASE_MALLOC_DP7(IAS15_BR, r->ri_ias15.br);
             CASE_MALLOC_DP7(IAS15_ER, r->ri_ias15.er);
@@ -354,13 +520,31 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
                 break;
         }
     }
+}
+
+void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, char* filename, enum reb_input_binary_messages* warnings){
+    FILE* inf = fopen(filename,"rb"); 
+    
+    if (!inf){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return;
+    }
+    reb_input_binary_fields(r, inf, warnings);
     fclose(inf);
 }
 
-struct reb_simulation* reb_create_simulation_from_binary(char* filename){
-    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
-    struct reb_simulation* r = reb_create_simulation();
-    reb_create_simulation_from_binary_with_messages(r,filename,&warnings);
+void reb_create_simulation_from_binary_buffer_with_messages(struct reb_simulation* r, const char* buffer, const size_t size, enum reb_input_binary_messages* warnings){
+    FILE* inf = fmemopen((void*)buffer, size, "rb");
+    if (!inf){
+        *warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return;
+    }
+    reb_input_binary_fields(r, inf, warnings);
+    fclose(inf);
+}
+
+// Prints warnings and errors. Frees the simulation and returns NULL on error.
+static struct reb_simulation* reb_input_binary_check_messages(struct reb_simulation* r, enum reb_input_binary_messages warnings){
     if (warnings & REB_INPUT_BINARY_WARNING_VERSION){
         reb_warning(r,"Binary file was saved with a different version of REBOUND. Binary format might have changed.");
     }
@@ -381,3 +565,148 @@ struct reb_simulation* reb_create_simulation_from_binary(char* filename){
     return r;
 }
 
+struct reb_simulation* reb_create_simulation_from_binary(char* filename){
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    struct reb_simulation* r = reb_create_simulation();
+    reb_create_simulation_from_binary_with_messages(r,filename,&warnings);
+    return reb_input_binary_check_messages(r, warnings);
+}
+
+struct reb_simulation* reb_create_simulation_from_ensemble_archive(char* filename, const long index){
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    struct reb_simulation* r = reb_create_simulation();
+    FILE* inf = fopen(filename,"rb"); 
+    if (!inf){
+        warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return reb_input_binary_check_messages(r, warnings);
+    }
+    // Records are in the order in which the simulations finished.
+    struct reb_ensemble_archive_record record;
+    char* buffer = NULL;
+    while (fread(&record,sizeof(struct reb_ensemble_archive_record),1,inf)){
+        if (record.index==index){
+            buffer = malloc(record.size);
+            if (fread(buffer,record.size,1,inf)!=1){
+                free(buffer);
+                buffer = NULL;
+            }
+            break;
+        }
+        fseek(inf,record.size,SEEK_CUR);
+    }
+    fclose(inf);
+    if (buffer==NULL){
+        warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return reb_input_binary_check_messages(r, warnings);
+    }
+    inf = fmemopen(buffer,record.size,"rb");
+    reb_input_binary_fields(r, inf, &warnings);
+    fclose(inf);
+    free(buffer);
+    return reb_input_binary_check_messages(r, warnings);
+}
+
+#ifdef MPI
+struct reb_simulation* reb_create_simulation_from_binary_mpi(char* filename){
+    reb_communication_mpi_initialize(NULL,NULL);
+    int mpi_id;
+    MPI_Comm_rank(MPI_COMM_WORLD,&mpi_id);
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    struct reb_simulation* r = reb_create_simulation();
+
+    // The root node finds the particle columns. Everything before is broadcasted.
+    long offset = -1;
+    char* header = NULL;
+    if (mpi_id==0){
+        FILE* inf = fopen(filename,"rb"); 
+        if (inf){
+            fseek(inf,64,SEEK_SET);
+            struct reb_binary_field field;
+            while (fread(&field,sizeof(struct reb_binary_field),1,inf)){
+                if (field.type==REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS){
+                    offset = ftell(inf)-sizeof(struct reb_binary_field);
+                    break;
+                }
+                if (field.type==REB_BINARY_FIELD_TYPE_END){
+                    break;
+                }
+                fseek(inf,field.size,SEEK_CUR);
+            }
+            if (offset>=0){
+                header = malloc(offset);
+                fseek(inf,0,SEEK_SET);
+                fread(header,offset,1,inf);
+            }
+            fclose(inf);
+        }
+    }
+    MPI_Bcast(&offset,1,MPI_LONG,0,MPI_COMM_WORLD);
+    if (offset<0){
+        warnings |= REB_INPUT_BINARY_ERROR_NOFILE;
+        return reb_input_binary_check_messages(r, warnings);
+    }
+    if (mpi_id!=0){
+        header = malloc(offset);
+    }
+    MPI_Bcast(header,offset,MPI_CHAR,0,MPI_COMM_WORLD);
+    FILE* inf = fmemopen(header,offset,"rb");
+    reb_input_binary_fields(r, inf, &warnings);
+    fclose(inf);
+    free(header);
+    r = reb_input_binary_check_messages(r, warnings);
+    if (!r){
+        return NULL;
+    }
+    reb_mpi_init(r);
+    
+    // Every node reads an equal share of the particles, independent of
+    // the number of nodes that wrote the file. 
+    MPI_File fh;
+    MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    struct reb_binary_field field;
+    long N_total;
+    MPI_File_read_at(fh, offset, &field, sizeof(struct reb_binary_field), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_read_at(fh, offset+sizeof(struct reb_binary_field), &N_total, sizeof(long), MPI_BYTE, MPI_STATUS_IGNORE);
+    const long start = N_total*r->mpi_id/r->mpi_num;
+    const long N = N_total*(r->mpi_id+1)/r->mpi_num - start;
+    struct reb_particle* const particles = calloc(N>0?N:1,sizeof(struct reb_particle));
+    char* const buffer = malloc((N>0?N:1)*sizeof(double));
+    long pos = offset+sizeof(struct reb_binary_field)+sizeof(long);
+    const long end = offset+sizeof(struct reb_binary_field)+field.size;
+    while (pos+(long)sizeof(struct reb_binary_column)<=end){
+        struct reb_binary_column column;
+        MPI_File_read_at(fh, pos, &column, sizeof(struct reb_binary_column), MPI_BYTE, MPI_STATUS_IGNORE);
+        pos += sizeof(struct reb_binary_column);
+        const struct reb_binary_column_layout* l = NULL;
+        for (int c=0;c<reb_binary_column_layouts_N;c++){
+            if (reb_binary_column_layouts[c].type==column.type){
+                l = &reb_binary_column_layouts[c];
+            }
+        }
+        if (l && column.size==(long)l->size*N_total){
+            MPI_File_read_at_all(fh, pos+start*l->size, buffer, (int)(N*l->size), MPI_BYTE, MPI_STATUS_IGNORE);
+            for (long i=0;i<N;i++){
+                memcpy((char*)&particles[i]+l->offset, buffer+i*l->size, l->size);
+            }
+        }else{
+            reb_warning(r,"Unknown field found in binary file.");
+        }
+        pos += column.size;
+    }
+    MPI_File_close(&fh);
+    free(buffer);
+
+    // Particles are sent to the node owning their root box.
+    free(r->particles);
+    r->particles = NULL;
+    r->allocatedN = 0;
+    r->N = 0;
+    for (long i=0;i<N;i++){
+        reb_add(r, particles[i]);
+    }
+    free(particles);
+    reb_communication_mpi_distribute_particles(r);
+    return r;
+}
+#endif // MPI
+
@@ -25,6 +25,8 @@
 #ifndef _INPUT_H
 
 void reb_read_dp7(struct reb_dp7* dp7, const int N3, FILE* inf); ///< Internal function to read dp7 structs from file.
+int reb_read_particle_columns(struct reb_particle* const particles, const int N, const long size, FILE* inf); ///< Internal function to read the columns of a particle array field from file. Returns 1 if unknown columns were skipped.
+void reb_create_simulation_from_binary_buffer_with_messages(struct reb_simulation* r, const char* buffer, const size_t size, enum reb_input_binary_messages* warnings); ///< Internal function, same as reb_create_simulation_from_binary_with_messages() but reads the binary file from memory.
 
 #define _INPUT_H
 
@@ -35,6 +35,8 @@
 #include "rebound.h"
 #include "gravity.h"
 #include "output.h"
+#include "profiling.h"
+#include "forces.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
 #include "integrator_whfasthelio.h"
@@ -43,6 +45,8 @@
 #include "integrator_leapfrog.h"
 #include "integrator_sei.h"
 #include "integrator_janus.h"
+#include "integrator_saba.h"
+#include "integrator_mercurius.h"
 
 void reb_integrator_part1(struct reb_simulation* r){
 	switch(r->integrator){
@@ -67,6 +71,12 @@ void reb_integrator_part1(struct reb_simulation* r){
 		case REB_INTEGRATOR_JANUS:
 			reb_integrator_janus_part1(r);
 			break;
+		case REB_INTEGRATOR_SABA:
+			reb_integrator_saba_part1(r);
+			break;
+		case REB_INTEGRATOR_MERCURIUS:
+			reb_integrator_mercurius_part1(r);
+			break;
 		default:
 			break;
 	}
@@ -95,6 +105,12 @@ void reb_integrator_part2(struct reb_simulation* r){
 		case REB_INTEGRATOR_JANUS:
 			reb_integrator_janus_part2(r);
 			break;
+		case REB_INTEGRATOR_SABA:
+			reb_integrator_saba_part2(r);
+			break;
+		case REB_INTEGRATOR_MERCURIUS:
+			reb_integrator_mercurius_part2(r);
+			break;
 		default:
 			break;
 	}
@@ -123,6 +139,12 @@ void reb_integrator_synchronize(struct reb_simulation* r){
 		case REB_INTEGRATOR_JANUS:
 			reb_integrator_janus_synchronize(r);
 			break;
+		case REB_INTEGRATOR_SABA:
+			reb_integrator_saba_synchronize(r);
+			break;
+		case REB_INTEGRATOR_MERCURIUS:
+			reb_integrator_mercurius_synchronize(r);
+			break;
 		default:
 			break;
 	}
@@ -147,18 +169,21 @@ void reb_integrator_reset(struct reb_simulation* r){
 	reb_integrator_whfast_reset(r);
 	reb_integrator_whfasthelio_reset(r);
 	reb_integrator_janus_reset(r);
+	reb_integrator_saba_reset(r);
+	reb_integrator_mercurius_reset(r);
 }
 
 void reb_update_acceleration(struct reb_simulation* r){
 	// This should probably go elsewhere
-	PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	PROFILING_START(r, REB_PROFILING_CAT_FORCE)
 	reb_calculate_acceleration(r);
 	if (r->N_var){
 		reb_calculate_acceleration_var(r);
 	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_FORCE)
+	if (r->forces_N) reb_forces_apply(r, r->forces, r->forces_N);
 	if (r->additional_forces) r->additional_forces(r);
-	PROFILING_STOP(PROFILING_CAT_GRAVITY)
-	PROFILING_START()
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
 }
 
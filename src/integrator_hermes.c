@@ -32,11 +32,13 @@
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <float.h>
 #include "rebound.h"
 #include "output.h"
 #include "integrator_ias15.h"
 #include "integrator_whfast.h"
 #include "integrator_whfasthelio.h"
+#include "forces.h"
 #define MIN(a, b) ((a) > (b) ? (b) : (a))    ///< Returns the minimum of a and b
 #define MAX(a, b) ((a) > (b) ? (a) : (b))    ///< Returns the maximum of a and b
 
@@ -45,6 +47,7 @@ static void reb_integrator_hermes_additional_forces_mini(struct reb_simulation*
 static void reb_integrator_hermes_apply_forces(const struct reb_simulation* r, double* a);
 static void reb_integrator_hermes_autocalc_HSF(struct reb_simulation* r);
 static void reb_integrator_hermes_get_ae(struct reb_simulation* r, struct reb_particle com, int index, double* a, double* e);
+static void reb_integrator_hermes_copy_to_mini(struct reb_simulation* r);
 
 void reb_integrator_hermes_part1(struct reb_simulation* r){
     r->gravity_ignore_terms = 0;
@@ -66,12 +69,13 @@ void reb_integrator_hermes_part1(struct reb_simulation* r){
     mini->testparticle_type = r->testparticle_type;
     mini->collision = r->collision;
     mini->collision_resolve = r->collision_resolve;
+    mini->collision_resolve_batch = r->collision_resolve_batch;
     mini->collision_resolve_keep_sorted = r->collision_resolve_keep_sorted;
     mini->track_energy_offset = r->track_energy_offset;
     mini->force_is_velocity_dependent = r->force_is_velocity_dependent;
     mini->post_timestep_modifications = r->post_timestep_modifications;
 
-    // Remove all particles from mini
+    // Remove all particles from mini. They are only copied in if there is an encounter.
     mini->t = r->t;
     int mini_previously_active = r->ri_hermes.mini_active;
     mini->N = 0;
@@ -80,6 +84,12 @@ void reb_integrator_hermes_part1(struct reb_simulation* r){
     r->ri_hermes.global_index_from_mini_index_N = 0;
     r->ri_hermes.collision_this_global_dt = 0;
     
+    // The mini simulation never has more particles than the global one.
+    if (r->N>r->ri_hermes.global_index_from_mini_index_Nmax){
+        r->ri_hermes.global_index_from_mini_index_Nmax = r->N;
+        r->ri_hermes.global_index_from_mini_index = realloc(r->ri_hermes.global_index_from_mini_index,r->N*sizeof(int));
+    }
+    
     if (_N_active>r->ri_hermes.a_Nmax){
         r->ri_hermes.a_i = realloc(r->ri_hermes.a_i,sizeof(double)*3*_N_active);
         r->ri_hermes.a_f = realloc(r->ri_hermes.a_f,sizeof(double)*3*_N_active);
@@ -93,17 +103,12 @@ void reb_integrator_hermes_part1(struct reb_simulation* r){
     }
     for(int i=_N_active;i<r->N;i++)r->ri_hermes.is_in_mini[i] = 0;
     
-    // Add all massive particles
+    // All massive particles are in mini
     for (int i=0; i<_N_active; i++){
-        reb_add(r->ri_hermes.mini, r->particles[i]);
         r->ri_hermes.is_in_mini[i] = 1;
-        if (r->ri_hermes.global_index_from_mini_index_N>=r->ri_hermes.global_index_from_mini_index_Nmax){
-            while(r->ri_hermes.global_index_from_mini_index_N>=r->ri_hermes.global_index_from_mini_index_Nmax) r->ri_hermes.global_index_from_mini_index_Nmax += 32;
-            r->ri_hermes.global_index_from_mini_index = realloc(r->ri_hermes.global_index_from_mini_index,r->ri_hermes.global_index_from_mini_index_Nmax*sizeof(int));
-        }
-        r->ri_hermes.global_index_from_mini_index[r->ri_hermes.global_index_from_mini_index_N] = i;
-        r->ri_hermes.global_index_from_mini_index_N++;
+        r->ri_hermes.global_index_from_mini_index[i] = i;
     }
+    r->ri_hermes.global_index_from_mini_index_N = _N_active;
     r->ri_hermes.mini->N_active = _N_active;
 
     // Determine HSF
@@ -113,9 +118,15 @@ void reb_integrator_hermes_part1(struct reb_simulation* r){
     }
     
     reb_integrator_hermes_check_for_encounter(r);
-        
-    if (r->N != r->ri_hermes.mini->N || mini_previously_active==0) {
-        reb_integrator_ias15_clear(r->ri_hermes.mini);
+    
+    if (r->ri_hermes.mini_active){
+        if (mini_previously_active==0){
+            r->metrics.hermes_activations++;
+        }
+        reb_integrator_hermes_copy_to_mini(r);
+        if (r->N != r->ri_hermes.mini->N || mini_previously_active==0) {
+            reb_integrator_ias15_clear(r->ri_hermes.mini);
+        }
     }
     
     reb_integrator_hermes_apply_forces(r, r->ri_hermes.a_i);
@@ -138,9 +149,18 @@ void reb_integrator_hermes_part2(struct reb_simulation* r){
         r->ri_hermes.steps_miniN += mini->N;
         reb_integrate(mini,r->t);
 
-        for (int i=0; i<mini->N; i++){
-            r->particles[r->ri_hermes.global_index_from_mini_index[i]] = mini->particles[i];
-            r->particles[r->ri_hermes.global_index_from_mini_index[i]].sim = r;    
+        struct reb_particle* restrict const particles = r->particles;
+        const struct reb_particle* restrict const mini_particles = mini->particles;
+        const int* const global_index_from_mini_index = r->ri_hermes.global_index_from_mini_index;
+        const int _N_active = mini->N_active;
+        // Massive particles are stored in the same order in both simulations
+        memcpy(particles, mini_particles, _N_active*sizeof(struct reb_particle));
+        for (int i=0; i<_N_active; i++){
+            particles[i].sim = r;
+        }
+        for (int i=_N_active; i<mini->N; i++){
+            particles[global_index_from_mini_index[i]] = mini_particles[i];
+            particles[global_index_from_mini_index[i]].sim = r;    
         }
         
         // Correct for energy jump in collision
@@ -182,11 +202,187 @@ void reb_integrator_hermes_reset(struct reb_simulation* r){
         free(r->ri_hermes.a_f);
     }
     r->ri_hermes.a_Nmax = 0;
+    free(r->ri_hermes.hill_radius);
+    r->ri_hermes.hill_radius = NULL;
+    free(r->ri_hermes.encounter_intervals);
+    r->ri_hermes.encounter_intervals = NULL;
+    r->ri_hermes.encounter_intervals_N = 0;
+    free(r->ri_hermes.encounter_open);
+    r->ri_hermes.encounter_open = NULL;
+    r->ri_hermes.encounter_Nmax = 0;
+    free(r->ri_hermes.encounter_pairs);
+    r->ri_hermes.encounter_pairs = NULL;
+    r->ri_hermes.encounter_pairs_N = 0;
+    r->ri_hermes.encounter_pairs_Nmax = 0;
+}
+
+/**
+ * @brief Interval of a particle along the sweep axis used by the encounter search.
+ */
+struct reb_hermes_interval {
+    double lo;      ///< Lower end of the interval
+    double hi;      ///< Upper end of the interval
+    int index;      ///< Index of the particle in the global simulation
+};
+
+/**
+ * @brief Below this number of active particles the encounter search loops over all pairs.
+ * @details For a few planets and many test particles a direct loop with precomputed Hill radii 
+ * is cheaper than sorting.
+ */
+#define REB_HERMES_ENCOUNTER_SWEEP_N_ACTIVE 16
+
+static int reb_integrator_hermes_compare_interval(const void* a, const void* b){
+    const double la = ((const struct reb_hermes_interval*)a)->lo;
+    const double lb = ((const struct reb_hermes_interval*)b)->lo;
+    if (la<lb) return -1;
+    if (la>lb) return 1;
+    return 0;
+}
+
+static int reb_integrator_hermes_compare_pair(const void* a, const void* b){
+    const int* pa = a;
+    const int* pb = b;
+    if (pa[0]!=pb[0]) return pa[0]<pb[0]?-1:1;
+    if (pa[1]!=pb[1]) return pa[1]<pb[1]?-1:1;
+    return 0;
+}
+
+static void reb_integrator_hermes_add_pair(struct reb_simulation* global, const int i, const int j){
+    struct reb_simulation_integrator_hermes* const ri_hermes = &(global->ri_hermes);
+    if (ri_hermes->encounter_pairs_N>=ri_hermes->encounter_pairs_Nmax){
+        ri_hermes->encounter_pairs_Nmax += 32;
+        ri_hermes->encounter_pairs = realloc(ri_hermes->encounter_pairs,2*ri_hermes->encounter_pairs_Nmax*sizeof(int));
+    }
+    ri_hermes->encounter_pairs[2*ri_hermes->encounter_pairs_N] = i;
+    ri_hermes->encounter_pairs[2*ri_hermes->encounter_pairs_N+1] = j;
+    ri_hermes->encounter_pairs_N++;
+}
+
+/**
+ * @brief Hill sphere criterion for particles i>0 and j>i.
+ */
+static inline int reb_integrator_hermes_hill_overlap(const struct reb_particle* const particles, const double* const rh, const double hill_switch_factor2, const int i, const int j){
+    const double rh_sum = rh[i]+rh[j];
+    const double rh_sum2 = rh_sum*rh_sum;
+    const double dx = particles[i].x - particles[j].x;
+    const double dy = particles[i].y - particles[j].y;
+    const double dz = particles[i].z - particles[j].z;
+    const double rij2 = dx*dx + dy*dy + dz*dz;
+    return rij2 < hill_switch_factor2*rh_sum2;
+}
+
+/**
+ * @brief Finds all pairs i<j with 0<i<_N_active that fulfill the Hill sphere criterion.
+ * @details Sort and sweep along one axis. Each particle is represented by the interval 
+ * [x-HSF*rh, x+HSF*rh]. Two particles can only be in an encounter if their intervals overlap.
+ * The order of the intervals is kept between timesteps. It changes little from one
+ * timestep to the next and an insertion sort is close to O(N). Test particles are only 
+ * compared to active particles. The pairs are sorted by (i,j) at the end.
+ */
+static void reb_integrator_hermes_sweep_encounters(struct reb_simulation* global, const int _N_active, const double current_hill_switch_factor){
+    struct reb_simulation_integrator_hermes* const ri_hermes = &(global->ri_hermes);
+    const struct reb_particle* const particles = global->particles;
+    const double* const rh = ri_hermes->hill_radius;
+    const double hill_switch_factor2 = current_hill_switch_factor*current_hill_switch_factor;
+    const int N = global->N;
+    struct reb_hermes_interval* const intervals = ri_hermes->encounter_intervals;
+    if (ri_hermes->encounter_intervals_N != N-1){
+        // (Re)build the interval list. Sweep along the axis with the largest extent.
+        double min[3] = {INFINITY, INFINITY, INFINITY};
+        double max[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (int j=1;j<N;j++){
+            const double pos[3] = {particles[j].x, particles[j].y, particles[j].z};
+            for (int k=0;k<3;k++){
+                min[k] = MIN(min[k],pos[k]);
+                max[k] = MAX(max[k],pos[k]);
+            }
+        }
+        ri_hermes->encounter_axis = 0;
+        if (max[1]-min[1] > max[ri_hermes->encounter_axis]-min[ri_hermes->encounter_axis]) ri_hermes->encounter_axis = 1;
+        if (max[2]-min[2] > max[ri_hermes->encounter_axis]-min[ri_hermes->encounter_axis]) ri_hermes->encounter_axis = 2;
+        for (int j=1;j<N;j++){
+            intervals[j-1].index = j;
+        }
+    }
+    const int axis = ri_hermes->encounter_axis;
+    for (int k=0;k<N-1;k++){
+        const int j = intervals[k].index;
+        const double x = axis==0?particles[j].x:(axis==1?particles[j].y:particles[j].z);
+        // Widen slightly so that round-off never removes a pair that fulfills the criterion.
+        const double w = current_hill_switch_factor*rh[j]*(1.+1e-8) + 4.*DBL_EPSILON*fabs(x);
+        intervals[k].lo = x - w;
+        intervals[k].hi = x + w;
+    }
+    int sorted = 0;
+    if (ri_hermes->encounter_intervals_N == N-1){
+        // Insertion sort. Give up if the order changed too much since the last timestep.
+        long moves = 0;
+        const long moves_max = 8L*N;
+        sorted = 1;
+        for (int k=1;k<N-1 && sorted;k++){
+            const struct reb_hermes_interval tmp = intervals[k];
+            int l = k-1;
+            while (l>=0 && intervals[l].lo>tmp.lo){
+                intervals[l+1] = intervals[l];
+                l--;
+                moves++;
+            }
+            intervals[l+1] = tmp;
+            if (moves>moves_max) sorted = 0;
+        }
+    }
+    if (!sorted){
+        qsort(intervals, N-1, sizeof(struct reb_hermes_interval), reb_integrator_hermes_compare_interval);
+        ri_hermes->encounter_intervals_N = N-1;
+    }
+    
+    int* const open_active = ri_hermes->encounter_open;
+    int* const open_test = ri_hermes->encounter_open + ri_hermes->encounter_Nmax;
+    int open_active_N = 0;
+    int open_test_N = 0;
+    for (int k=0;k<N-1;k++){
+        const double lo = intervals[k].lo;
+        const int j = intervals[k].index;
+        // Compare to open intervals of active particles, closing the ones that ended.
+        int n = 0;
+        for (int l=0;l<open_active_N;l++){
+            const int o = open_active[l];
+            if (intervals[o].hi<=lo) continue;
+            open_active[n++] = o;
+            const int io = intervals[o].index;
+            const int a = MIN(io,j);
+            const int b = MAX(io,j);
+            if (reb_integrator_hermes_hill_overlap(particles, rh, hill_switch_factor2, a, b)){
+                reb_integrator_hermes_add_pair(global, a, b);
+            }
+        }
+        open_active_N = n;
+        if (j<_N_active){
+            // Active particles are also compared to test particles.
+            n = 0;
+            for (int l=0;l<open_test_N;l++){
+                const int o = open_test[l];
+                if (intervals[o].hi<=lo) continue;
+                open_test[n++] = o;
+                const int io = intervals[o].index;
+                if (reb_integrator_hermes_hill_overlap(particles, rh, hill_switch_factor2, j, io)){
+                    reb_integrator_hermes_add_pair(global, j, io);
+                }
+            }
+            open_test_N = n;
+            open_active[open_active_N++] = k;
+        }else{
+            open_test[open_test_N++] = k;
+        }
+    }
+    // Pairs need to be processed in the same order as a loop over i and j.
+    qsort(ri_hermes->encounter_pairs, ri_hermes->encounter_pairs_N, 2*sizeof(int), reb_integrator_hermes_compare_pair);
 }
 
 static void reb_integrator_hermes_check_for_encounter(struct reb_simulation* global){
-    struct reb_simulation* mini = global->ri_hermes.mini;
     const int _N_active = ((global->N_active==-1)?global->N:global->N_active) - global->N_var;
+    const int N = global->N;
     struct reb_particle* global_particles = global->particles;
     struct reb_particle p0 = global_particles[0];
     double solar_check = global->ri_hermes.solar_switch_factor*p0.r;
@@ -194,53 +390,72 @@ static void reb_integrator_hermes_check_for_encounter(struct reb_simulation* glo
     double current_hill_switch_factor = global->ri_hermes.current_hill_switch_factor;
     double hill_switch_factor2 = current_hill_switch_factor*current_hill_switch_factor;
     double min_dt_enc2 = INFINITY;
-    for (int i=0; i<_N_active; i++){
-        struct reb_particle pi = global_particles[i];
-        const double dxi = p0.x - pi.x;
-        const double dyi = p0.y - pi.y;
-        const double dzi = p0.z - pi.z;
-        const double r0i2 = dxi*dxi + dyi*dyi + dzi*dzi;
-        const double mi = pi.m/(p0.m*3.);
-        double rhi = pow(mi*mi*r0i2*r0i2*r0i2,1./6.);
-        for(int j=i+1;j<global->N;j++){
-            struct reb_particle pj = global_particles[j];
-            
-            const double dxj = p0.x - pj.x;
-            const double dyj = p0.y - pj.y;
-            const double dzj = p0.z - pj.z;
-            const double r0j2 = dxj*dxj + dyj*dyj + dzj*dzj;
-            const double mj = pj.m/(p0.m*3.);
-            double rhj = pow(mj*mj*r0j2*r0j2*r0j2,1./6.);
-            const double rh_sum = rhi+rhj;
-            const double rh_sum2 = rh_sum*rh_sum;
-            
-            const double dx = pi.x - pj.x;
-            const double dy = pi.y - pj.y;
-            const double dz = pi.z - pj.z;
+    
+    if (N>global->ri_hermes.encounter_Nmax){
+        global->ri_hermes.encounter_Nmax = N;
+        global->ri_hermes.hill_radius = realloc(global->ri_hermes.hill_radius,N*sizeof(double));
+        global->ri_hermes.encounter_intervals = realloc(global->ri_hermes.encounter_intervals,N*sizeof(struct reb_hermes_interval));
+        global->ri_hermes.encounter_open = realloc(global->ri_hermes.encounter_open,2*N*sizeof(int));
+        global->ri_hermes.encounter_intervals_N = 0;
+    }
+    // Hill radii only depend on one particle. Calculate them once.
+    double* const rh = global->ri_hermes.hill_radius;
+    for (int j=0;j<N;j++){
+        const struct reb_particle pj = global_particles[j];
+        const double dxj = p0.x - pj.x;
+        const double dyj = p0.y - pj.y;
+        const double dzj = p0.z - pj.z;
+        const double r0j2 = dxj*dxj + dyj*dyj + dzj*dzj;
+        const double mj = pj.m/(p0.m*3.);
+        rh[j] = pow(mj*mj*r0j2*r0j2*r0j2,1./6.);
+    }
+    
+    // Find all pairs in an encounter.
+    global->ri_hermes.encounter_pairs_N = 0;
+    if (_N_active>0){
+        for(int j=1;j<N;j++){
+            const double dx = p0.x - global_particles[j].x;
+            const double dy = p0.y - global_particles[j].y;
+            const double dz = p0.z - global_particles[j].z;
             const double rij2 = dx*dx + dy*dy + dz*dz;
-
-            if((rij2 < hill_switch_factor2*rh_sum2 && i>0) || (rij2 < solar_check2 && i==0)){
-                global->ri_hermes.mini_active = 1;
-                // Monitor hill radius/relative velocity
-                const double dvx = pi.vx - pj.vx;
-                const double dvy = pi.vy - pj.vy;
-                const double dvz = pi.vz - pj.vz;
-                const double vij2 = dvx*dvx + dvy*dvy + dvz*dvz;
-                const double dt_enc2 = hill_switch_factor2*rh_sum2/vij2;
-                min_dt_enc2 = MIN(min_dt_enc2,dt_enc2);
-                if (j>=_N_active && global->ri_hermes.is_in_mini[j]==0){//make sure not already added
-                    // Add particle to mini simulation
-                    reb_add(mini,pj);
-                    global->ri_hermes.is_in_mini[j] = 1;
-                    if (global->ri_hermes.global_index_from_mini_index_N>=global->ri_hermes.global_index_from_mini_index_Nmax){
-                        while(global->ri_hermes.global_index_from_mini_index_N>=global->ri_hermes.global_index_from_mini_index_Nmax) global->ri_hermes.global_index_from_mini_index_Nmax += 32;
-                        global->ri_hermes.global_index_from_mini_index = realloc(global->ri_hermes.global_index_from_mini_index,global->ri_hermes.global_index_from_mini_index_Nmax*sizeof(int));
-                    }
-                    global->ri_hermes.global_index_from_mini_index[global->ri_hermes.global_index_from_mini_index_N] = j;
-                    global->ri_hermes.global_index_from_mini_index_N++;
+            if (rij2 < solar_check2){
+                reb_integrator_hermes_add_pair(global, 0, j);
+            }
+        }
+    }
+    if (_N_active<=REB_HERMES_ENCOUNTER_SWEEP_N_ACTIVE){
+        for (int i=1; i<_N_active; i++){
+            for(int j=i+1;j<N;j++){
+                if (reb_integrator_hermes_hill_overlap(global_particles, rh, hill_switch_factor2, i, j)){
+                    reb_integrator_hermes_add_pair(global, i, j);
                 }
             }
         }
+    }else{
+        reb_integrator_hermes_sweep_encounters(global, _N_active, current_hill_switch_factor);
+    }
+
+    for (int k=0; k<global->ri_hermes.encounter_pairs_N; k++){
+        const int i = global->ri_hermes.encounter_pairs[2*k];
+        const int j = global->ri_hermes.encounter_pairs[2*k+1];
+        struct reb_particle pi = global_particles[i];
+        struct reb_particle pj = global_particles[j];
+        const double rh_sum = rh[i]+rh[j];
+        const double rh_sum2 = rh_sum*rh_sum;
+        global->ri_hermes.mini_active = 1;
+        // Monitor hill radius/relative velocity
+        const double dvx = pi.vx - pj.vx;
+        const double dvy = pi.vy - pj.vy;
+        const double dvz = pi.vz - pj.vz;
+        const double vij2 = dvx*dvx + dvy*dvy + dvz*dvz;
+        const double dt_enc2 = hill_switch_factor2*rh_sum2/vij2;
+        min_dt_enc2 = MIN(min_dt_enc2,dt_enc2);
+        if (j>=_N_active && global->ri_hermes.is_in_mini[j]==0){//make sure not already added
+            // Mark particle for mini simulation. Copied in reb_integrator_hermes_copy_to_mini().
+            global->ri_hermes.is_in_mini[j] = 1;
+            global->ri_hermes.global_index_from_mini_index[global->ri_hermes.global_index_from_mini_index_N] = j;
+            global->ri_hermes.global_index_from_mini_index_N++;
+        }
     }
     if (global->ri_hermes.adaptive_hill_switch_factor==0 && global->ri_hermes.timestep_too_large_warning==0 && min_dt_enc2 < 16.*global->dt*global->dt){
         global->ri_hermes.timestep_too_large_warning = 1;
@@ -248,6 +463,54 @@ static void reb_integrator_hermes_check_for_encounter(struct reb_simulation* glo
     }
 }
 
+/**
+ * @brief Copies all particles marked in global_index_from_mini_index to the mini simulation.
+ * @details The particle and IAS15 arrays of the mini simulation are kept between 
+ * timesteps and grow geometrically, so starting an encounter usually does not 
+ * allocate memory. 
+ */
+static void reb_integrator_hermes_copy_to_mini(struct reb_simulation* r){
+    struct reb_simulation* const mini = r->ri_hermes.mini;
+    const int N = r->ri_hermes.global_index_from_mini_index_N;
+    const int* const global_index_from_mini_index = r->ri_hermes.global_index_from_mini_index;
+    const int _N_active = mini->N_active;
+    if (mini->particle_lookup_table || mini->collision==REB_COLLISION_TREE){
+        // Needs the bookkeeping of reb_add()
+        for (int i=0; i<N; i++){
+            reb_add(mini, r->particles[global_index_from_mini_index[i]]);
+        }
+        return;
+    }
+    if (N>mini->allocatedN){
+        mini->allocatedN = MIN(r->N, MAX(N, 2*mini->allocatedN));
+        mini->particles = realloc(mini->particles,sizeof(struct reb_particle)*mini->allocatedN);
+    }
+    if (3*N>mini->ri_ias15.allocatedN){
+        reb_integrator_ias15_reserve(mini, MIN(r->N, MAX(N, 2*mini->ri_ias15.allocatedN/3)));
+    }
+    struct reb_particle* restrict const mini_particles = mini->particles;
+    const struct reb_particle* restrict const particles = r->particles;
+    // Massive particles are stored in the same order in both simulations
+    memcpy(mini_particles, particles, _N_active*sizeof(struct reb_particle));
+    for (int i=_N_active; i<N; i++){
+        mini_particles[i] = particles[global_index_from_mini_index[i]];
+    }
+    double* const max_radius = mini->max_radius;
+    for (int i=0; i<N; i++){
+        mini_particles[i].sim = mini;
+#ifndef COLLISIONS_NONE
+        const double pr = mini_particles[i].r;
+        if (pr>=max_radius[0]){
+            max_radius[1] = max_radius[0];
+            max_radius[0] = pr;
+        }else if (pr>=max_radius[1]){
+            max_radius[1] = pr;
+        }
+#endif  // COLLISIONS_NONE
+    }
+    mini->N = N;
+}
+
 //get min encounter time between overlapping orbits
 static void reb_integrator_hermes_autocalc_HSF(struct reb_simulation* r){
     const int _N_active = ((r->N_active==-1)?r->N:r->N_active) - r->N_var;
@@ -392,6 +655,9 @@ static void reb_integrator_hermes_additional_forces_mini(struct reb_simulation*
         }
     }
     
+    if (global->forces_N){
+        reb_forces_apply(mini, global->forces, global->forces_N);
+    }
     if(global->additional_forces){
         global->additional_forces(mini);
     }
@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 #include <string.h>
 // Uncomment the following line to generate numerical constants with extended precision.
@@ -52,6 +53,7 @@ void integrator_generate_constants(void);
 #include "tools.h"
 #include "integrator.h"
 #include "integrator_ias15.h"
+#include "profiling.h"
 
 /**
  * @brief Struct containing pointers to intermediate values
@@ -67,7 +69,8 @@ struct reb_dpconst7 {
 };
 
 // Helper functions for resetting the b and e coefficients
-static void copybuffers(const struct reb_dpconst7 _a, const struct reb_dpconst7 _b, int N3);
+static void copybuffers_and_predict_next_step(double ratio, int N3, const struct reb_dpconst7 e, const struct reb_dpconst7 b, const struct reb_dpconst7 er, const struct reb_dpconst7 br, const int save);
+static void ias15_rescale_rejected_step(double ratio, int N3, const struct reb_dpconst7 e, const struct reb_dpconst7 b);
 static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _e, const struct reb_dpconst7 _b, const struct reb_dpconst7 e, const struct reb_dpconst7 b);
 
 
@@ -124,14 +127,15 @@ static void clear_dp7(struct reb_dp7* const dp7, const int N3){
         dp7->p6[k] = 0.;
     }
 }
-static void realloc_dp7(struct reb_dp7* const dp7, const int N3){
-    dp7->p0 = realloc(dp7->p0,sizeof(double)*N3);
-    dp7->p1 = realloc(dp7->p1,sizeof(double)*N3);
-    dp7->p2 = realloc(dp7->p2,sizeof(double)*N3);
-    dp7->p3 = realloc(dp7->p3,sizeof(double)*N3);
-    dp7->p4 = realloc(dp7->p4,sizeof(double)*N3);
-    dp7->p5 = realloc(dp7->p5,sizeof(double)*N3);
-    dp7->p6 = realloc(dp7->p6,sizeof(double)*N3);
+// The old content is not needed, all arrays are cleared.
+static void realloc_dp7(const struct reb_simulation* const r, struct reb_dp7* const dp7, const int N3){
+    dp7->p0 = reb_tools_realloc(r, dp7->p0, 0, sizeof(double)*N3);
+    dp7->p1 = reb_tools_realloc(r, dp7->p1, 0, sizeof(double)*N3);
+    dp7->p2 = reb_tools_realloc(r, dp7->p2, 0, sizeof(double)*N3);
+    dp7->p3 = reb_tools_realloc(r, dp7->p3, 0, sizeof(double)*N3);
+    dp7->p4 = reb_tools_realloc(r, dp7->p4, 0, sizeof(double)*N3);
+    dp7->p5 = reb_tools_realloc(r, dp7->p5, 0, sizeof(double)*N3);
+    dp7->p6 = reb_tools_realloc(r, dp7->p6, 0, sizeof(double)*N3);
     clear_dp7(dp7,N3);
 }
 
@@ -148,6 +152,20 @@ static struct reb_dpconst7 dpcast(struct reb_dp7 dp){
     return dpc;
 }
 
+/**
+ * @brief Minimum number of components (3*N) for which the loops of IAS15 run in parallel.
+ * @details All loops use a static schedule so that each thread works on the same 
+ * components in every pass. Below this number, the fork/join overhead dominates.
+ */
+#define IAS15_PARALLEL_N3 300
+
+/**
+ * @brief Same as isnormal() for non-negative arguments, but can be vectorized.
+ */
+static inline int ias15_isnormal_positive(const double a){
+    return a>=DBL_MIN && a<=DBL_MAX;
+}
+
 static inline void add_cs(double* p, double* csp, double inp){
     const double y = inp - *csp;
     const double t = *p + y;
@@ -155,32 +173,298 @@ static inline void add_cs(double* p, double* csp, double inp){
     *p = t;
 }
 
+/**
+ * @brief Clears the compensated summation coefficients of the first N3cs components of b and calculates g from b.
+ */
+static void ias15_init_g(const int N3, const int N3cs, const struct reb_dpconst7 g, const struct reb_dpconst7 b, const struct reb_dpconst7 csb){
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+    for(int k=0;k<N3cs;k++) {
+        csb.p0[k] = 0.;
+        csb.p1[k] = 0.;
+        csb.p2[k] = 0.;
+        csb.p3[k] = 0.;
+        csb.p4[k] = 0.;
+        csb.p5[k] = 0.;
+        csb.p6[k] = 0.;
+    }
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+    for(int k=0;k<N3;k++) {
+        g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
+        g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
+        g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
+        g.p3[k] = b.p6[k]*d[18] + b.p5[k]*d[13] + b.p4[k]*d[9] + b.p3[k];
+        g.p4[k] = b.p6[k]*d[19] + b.p5[k]*d[14] + b.p4[k];
+        g.p5[k] = b.p6[k]*d[20] + b.p5[k];
+        g.p6[k] = b.p6[k];
+    }
+}
+
+#if defined(__GNUC__)
+#define REB_IAS15_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define REB_IAS15_ALWAYS_INLINE inline
+#endif
+
+/**
+ * @brief Adds inp to p, with compensated summation if use_cs is set.
+ */
+static REB_IAS15_ALWAYS_INLINE void add_b(double* p, double* csp, double inp, const int use_cs){
+    if (use_cs){
+        add_cs(p, csp, inp);
+    }else{
+        *p += inp;
+    }
+}
+
+/**
+ * @brief Improves the g and b values of the components k_start to k_end-1 using the acceleration at the n-th Gauss-Radau spacing.
+ * @details use_cs is a compile time constant after inlining. If it is not set, csb is not accessed.
+ * For n==7, the maxima of |at|, of the change of b6 and of their ratio are accumulated in maxima.
+ */
+static REB_IAS15_ALWAYS_INLINE void ias15_correct_range(const int n, const int k_start, const int k_end, const double* const restrict at, const double* const restrict a0, const double* const gravity_cs, const double* const csa0, const struct reb_dpconst7 g, const struct reb_dpconst7 b, const struct reb_dpconst7 csb, const int use_cs, double* const maxima){
+    switch (n) {                            // Improve b and g values
+        case 1: 
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p0[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p0[k]  = gk/rr[0];
+                add_b(&(b.p0[k]), &(csb.p0[k]), g.p0[k]-tmp, use_cs);
+            } break;
+        case 2: 
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p1[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
+                tmp = g.p1[k] - tmp;
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[0], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp, use_cs);
+            } break;
+        case 3: 
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p2[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
+                tmp = g.p2[k] - tmp;
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[1], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp * c[2], use_cs);
+                add_b(&(b.p2[k]), &(csb.p2[k]), tmp, use_cs);
+            } break;
+        case 4:
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p3[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
+                tmp = g.p3[k] - tmp;
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[3], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp * c[4], use_cs);
+                add_b(&(b.p2[k]), &(csb.p2[k]), tmp * c[5], use_cs);
+                add_b(&(b.p3[k]), &(csb.p3[k]), tmp, use_cs);
+            } break;
+        case 5:
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p4[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
+                tmp = g.p4[k] - tmp;
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[6], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp * c[7], use_cs);
+                add_b(&(b.p2[k]), &(csb.p2[k]), tmp * c[8], use_cs);
+                add_b(&(b.p3[k]), &(csb.p3[k]), tmp * c[9], use_cs);
+                add_b(&(b.p4[k]), &(csb.p4[k]), tmp, use_cs);
+            } break;
+        case 6:
+#pragma omp parallel for simd schedule(static) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p5[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
+                tmp = g.p5[k] - tmp;
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[10], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp * c[11], use_cs);
+                add_b(&(b.p2[k]), &(csb.p2[k]), tmp * c[12], use_cs);
+                add_b(&(b.p3[k]), &(csb.p3[k]), tmp * c[13], use_cs);
+                add_b(&(b.p4[k]), &(csb.p4[k]), tmp * c[14], use_cs);
+                add_b(&(b.p5[k]), &(csb.p5[k]), tmp, use_cs);
+            } break;
+        case 7:
+        {
+            double maxak = 0.0;
+            double maxb6ktmp = 0.0;
+            double maxerrork = 0.0;
+#pragma omp parallel for simd schedule(static) reduction(max:maxak,maxb6ktmp,maxerrork) if(k_end-k_start>=IAS15_PARALLEL_N3)
+            for(int k=k_start;k<k_end;++k) {
+                double tmp = g.p6[k];
+                double gk = at[k];
+                double gk_cs = gravity_cs[k];
+                add_cs(&gk, &gk_cs, -a0[k]);
+                add_cs(&gk, &gk_cs, csa0[k]);
+                g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
+                tmp = g.p6[k] - tmp;    
+                add_b(&(b.p0[k]), &(csb.p0[k]), tmp * c[15], use_cs);
+                add_b(&(b.p1[k]), &(csb.p1[k]), tmp * c[16], use_cs);
+                add_b(&(b.p2[k]), &(csb.p2[k]), tmp * c[17], use_cs);
+                add_b(&(b.p3[k]), &(csb.p3[k]), tmp * c[18], use_cs);
+                add_b(&(b.p4[k]), &(csb.p4[k]), tmp * c[19], use_cs);
+                add_b(&(b.p5[k]), &(csb.p5[k]), tmp * c[20], use_cs);
+                add_b(&(b.p6[k]), &(csb.p6[k]), tmp, use_cs);
+                
+                // Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
+                // Both error estimates are calculated without branches so that the loop vectorizes. 
+                const double ak  = fabs(at[k]);
+                maxak = ias15_isnormal_positive(ak) && ak>maxak ? ak : maxak;
+                const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
+                maxb6ktmp = ias15_isnormal_positive(b6ktmp) && b6ktmp>maxb6ktmp ? b6ktmp : maxb6ktmp;
+                const double errork = b6ktmp/ak;
+                maxerrork = ias15_isnormal_positive(errork) && errork>maxerrork ? errork : maxerrork;
+            } 
+            maxima[0] = maxak>maxima[0] ? maxak : maxima[0];
+            maxima[1] = maxb6ktmp>maxima[1] ? maxb6ktmp : maxima[1];
+            maxima[2] = maxerrork>maxima[2] ? maxerrork : maxima[2];
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Improves the g and b values using the acceleration at the n-th Gauss-Radau spacing.
+ * @details For n==7, the convergence estimate of the predictor corrector loop is stored in predictor_corrector_error.
+ * Compensated summation of b is only used for the first N3cs components (see lean).
+ * @param at Accelerations at the n-th spacing
+ * @param a0 Accelerations at the beginning of the step
+ * @param gravity_cs Compensated summation coefficients of at
+ * @param csa0 Compensated summation coefficients of a0
+ */
+static inline void ias15_correct(const int n, const int N3, const int N3cs, const double* const restrict at, const double* const restrict a0, const double* const gravity_cs, const double* const csa0, const struct reb_dpconst7 g, const struct reb_dpconst7 b, const struct reb_dpconst7 csb, const unsigned int epsilon_global, double* const predictor_corrector_error){
+    double maxima[3] = {0.,0.,0.};
+    ias15_correct_range(n, 0, N3cs, at, a0, gravity_cs, csa0, g, b, csb, 1, maxima);
+    if (N3cs<N3){
+        ias15_correct_range(n, N3cs, N3, at, a0, gravity_cs, csa0, g, b, b, 0, maxima); // csb is not accessed
+    }
+    if (n==7){
+        if (epsilon_global){
+            *predictor_corrector_error = maxima[1]/maxima[0];
+        }else{
+            *predictor_corrector_error = maxima[2];
+        }
+    }
+}
+
+/**
+ * @brief Calculates positions and velocities at the end of a step of length dt_done.
+ */
+static void ias15_update_xv(const int N3, const double dt_done, double* const restrict x0, double* const restrict csx, double* const restrict v0, double* const restrict csv, const double* const restrict a0, const struct reb_dpconst7 b){
+    const double dt_done2 = dt_done * dt_done;
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+    for(int k=0;k<N3;++k) {
+        {
+            add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p3[k]/30.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p2[k]/20.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p1[k]/12.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done2);
+            add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
+        }
+        {
+            add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p3[k]/5.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p2[k]/4.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p1[k]/3.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
+            add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
+        }
+    }
+
+}
+
 void reb_integrator_ias15_alloc(struct reb_simulation* r){
-    const int N3 = 3*r->N;
-    if (N3 > r->ri_ias15.allocatedN) {
-        realloc_dp7(&(r->ri_ias15.g),N3);
-        realloc_dp7(&(r->ri_ias15.b),N3);
-        realloc_dp7(&(r->ri_ias15.csb),N3);
-        realloc_dp7(&(r->ri_ias15.e),N3);
-        realloc_dp7(&(r->ri_ias15.br),N3);
-        realloc_dp7(&(r->ri_ias15.er),N3);
-        r->ri_ias15.at = realloc(r->ri_ias15.at,sizeof(double)*N3);
-        r->ri_ias15.x0 = realloc(r->ri_ias15.x0,sizeof(double)*N3);
-        r->ri_ias15.v0 = realloc(r->ri_ias15.v0,sizeof(double)*N3);
-        r->ri_ias15.a0 = realloc(r->ri_ias15.a0,sizeof(double)*N3);
-        r->ri_ias15.csx= realloc(r->ri_ias15.csx,sizeof(double)*N3);
-        r->ri_ias15.csv= realloc(r->ri_ias15.csv,sizeof(double)*N3);
-        r->ri_ias15.csa0 = realloc(r->ri_ias15.csa0,sizeof(double)*N3);
-        double* restrict const csx = r->ri_ias15.csx; 
-        double* restrict const csv = r->ri_ias15.csv; 
+    reb_integrator_ias15_reserve(r, r->N);
+}
+
+/**
+ * @brief Number of components of b which use compensated summation.
+ * @details With lean>=2, only the active particles do. 
+ */
+static int ias15_N3cs(const struct reb_simulation* const r, const int N){
+    if (r->ri_ias15.lean>=2 && r->N_active>=0 && r->N_active<N){
+        return 3*r->N_active;
+    }
+    return 3*N;
+}
+
+void reb_integrator_ias15_reserve(struct reb_simulation* r, const int N){
+    struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+    const int N3 = 3*N;
+    if (N3 > ri_ias15->allocatedN) {
+        realloc_dp7(r, &(ri_ias15->g),N3);
+        realloc_dp7(r, &(ri_ias15->b),N3);
+        realloc_dp7(r, &(ri_ias15->e),N3);
+        if (!ri_ias15->lean){
+            realloc_dp7(r, &(ri_ias15->br),N3);
+            realloc_dp7(r, &(ri_ias15->er),N3);
+        }
+        ri_ias15->at = reb_tools_realloc(r, ri_ias15->at, 0, sizeof(double)*N3);
+        ri_ias15->x0 = reb_tools_realloc(r, ri_ias15->x0, 0, sizeof(double)*N3);
+        ri_ias15->v0 = reb_tools_realloc(r, ri_ias15->v0, 0, sizeof(double)*N3);
+        ri_ias15->a0 = reb_tools_realloc(r, ri_ias15->a0, 0, sizeof(double)*N3);
+        ri_ias15->csx = reb_tools_realloc(r, ri_ias15->csx, 0, sizeof(double)*N3);
+        ri_ias15->csv = reb_tools_realloc(r, ri_ias15->csv, 0, sizeof(double)*N3);
+        ri_ias15->csa0 = reb_tools_realloc(r, ri_ias15->csa0, 0, sizeof(double)*N3);
+        double* restrict const csx = ri_ias15->csx; 
+        double* restrict const csv = ri_ias15->csv; 
         for (int i=0;i<N3;i++){
             // Kill compensated summation coefficients
             csx[i] = 0;
             csv[i] = 0;
         }
-        r->ri_ias15.allocatedN = N3;
+        ri_ias15->allocatedN = N3;
+    }
+    if (ri_ias15->lean){
+        // Not needed, a rejected step reuses the coefficients of the rejected step.
+        free_dp7(&(ri_ias15->br));
+        free_dp7(&(ri_ias15->er));
+    }else if (ri_ias15->br.p0==NULL && ri_ias15->allocatedN){
+        // lean has been turned off.
+        realloc_dp7(r, &(ri_ias15->br),ri_ias15->allocatedN);
+        realloc_dp7(r, &(ri_ias15->er),ri_ias15->allocatedN);
+    }
+    // csb is cleared at the beginning of every step. It does not need to keep its content.
+    const int N3cs = ias15_N3cs(r, N);
+    if (N3cs > ri_ias15->csb_allocatedN || (ri_ias15->lean>=2 && N3cs < ri_ias15->csb_allocatedN)){
+        if (N3cs){
+            realloc_dp7(r, &(ri_ias15->csb),N3cs);
+        }else{
+            free_dp7(&(ri_ias15->csb));
+        }
+        ri_ias15->csb_allocatedN = N3cs;
     }
-
 }
  
 // Does the actual timestep.
@@ -208,6 +492,9 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
     const struct reb_dpconst7 csb= dpcast(r->ri_ias15.csb);
     const struct reb_dpconst7 er = dpcast(r->ri_ias15.er);
     const struct reb_dpconst7 br = dpcast(r->ri_ias15.br);
+    const unsigned int lean = r->ri_ias15.lean;
+    const int N3cs = r->ri_ias15.csb_allocatedN<N3 ? r->ri_ias15.csb_allocatedN : N3;
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
     for(int k=0;k<N;k++) {
         x0[3*k]   = particles[k].x;
         x0[3*k+1] = particles[k].y;
@@ -220,6 +507,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         a0[3*k+2] = particles[k].az;
     }
     if (r->gravity==REB_GRAVITY_COMPENSATED){
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
         for(int k=0;k<N;k++) {
             csa0[3*k]   = gravity_cs[k].x;
             csa0[3*k+1] = gravity_cs[k].y;  
@@ -227,30 +515,12 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         }
     }else{
         gravity_cs = (struct reb_vec3d*)csa0; // Always 0.
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
         for(int k=0;k<N3;k++) {
             csa0[k]   = 0;
         }
     }
-    for (int k=0;k<N3;k++){
-        // Memset might be faster!
-        csb.p0[k] = 0.;
-        csb.p1[k] = 0.;
-        csb.p2[k] = 0.;
-        csb.p3[k] = 0.;
-        csb.p4[k] = 0.;
-        csb.p5[k] = 0.;
-        csb.p6[k] = 0.;
-    }
-
-    for(int k=0;k<N3;k++) {
-        g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
-        g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
-        g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
-        g.p3[k] = b.p6[k]*d[18] + b.p5[k]*d[13] + b.p4[k]*d[9] + b.p3[k];
-        g.p4[k] = b.p6[k]*d[19] + b.p5[k]*d[14] + b.p4[k];
-        g.p5[k] = b.p6[k]*d[20] + b.p5[k];
-        g.p6[k] = b.p6[k];
-    }
+    ias15_init_g(N3, N3cs, g, b, csb);
 
     double integrator_megno_thisdt = 0.;
     double integrator_megno_thisdt_init = 0.;
@@ -267,6 +537,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
     //   1) predictor_corrector_error better than 1e-16 
     //   2) predictor_corrector_error starts to oscillate
     //   3) more than 12 iterations
+    PROFILING_START(r, REB_PROFILING_CAT_IAS15_PREDICTOR)
     while(1){
         if(predictor_corrector_error<1e-16){
             break;
@@ -303,6 +574,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
             r->t = t_beginning + s[0];
 
             // Prepare particles arrays for force calculation
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
             for(int i=0;i<N;i++) {                      // Predict positions at interval n using b values
                 const int k0 = 3*i+0;
                 const int k1 = 3*i+1;
@@ -315,7 +587,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 double xk2  = -csx[k2] + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*a0[k2] + s[0]*v0[k2] );
                 particles[i].z = xk2 + x0[k2];
             }
-            if (r->calculate_megno || (r->additional_forces && r->force_is_velocity_dependent)){
+            if (r->calculate_megno || ((r->additional_forces || r->forces_N) && r->force_is_velocity_dependent)){
                 s[0] = r->dt * h[n];
                 s[1] =      s[0] * h[n] / 2.;
                 s[2] = 2. * s[1] * h[n] / 3.;
@@ -325,6 +597,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 s[6] = 6. * s[5] * h[n] / 7.;
                 s[7] = 7. * s[6] * h[n] / 8.;
 
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
                 for(int i=0;i<N;i++) {                  // Predict velocities at interval n using b values
                     const int k0 = 3*i+0;
                     const int k1 = 3*i+1;
@@ -345,140 +618,18 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 integrator_megno_thisdt += w[n] * r->t * reb_tools_megno_deltad_delta(r);
             }
 
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
             for(int k=0;k<N;++k) {
                 at[3*k]   = particles[k].ax;
                 at[3*k+1] = particles[k].ay;  
                 at[3*k+2] = particles[k].az;
             }
-            switch (n) {                            // Improve b and g values
-                case 1: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p0[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p0[k]  = gk/rr[0];
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), g.p0[k]-tmp);
-                    } break;
-                case 2: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p1[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
-                        tmp = g.p1[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[0]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp);
-                    } break;
-                case 3: 
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p2[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
-                        tmp = g.p2[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[1]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[2]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp);
-                    } break;
-                case 4:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p3[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
-                        tmp = g.p3[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[3]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[4]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[5]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp);
-                    } break;
-                case 5:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p4[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
-                        tmp = g.p4[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[6]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[7]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[8]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[9]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp);
-                    } break;
-                case 6:
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p5[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
-                        tmp = g.p5[k] - tmp;
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[10]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[11]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[12]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[13]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[14]);
-                        add_cs(&(b.p5[k]), &(csb.p5[k]), tmp);
-                    } break;
-                case 7:
-                {
-                    double maxak = 0.0;
-                    double maxb6ktmp = 0.0;
-                    for(int k=0;k<N3;++k) {
-                        double tmp = g.p6[k];
-                        double gk = at[k];
-                        double gk_cs = ((double*)(gravity_cs))[k];
-                        add_cs(&gk, &gk_cs, -a0[k]);
-                        add_cs(&gk, &gk_cs, csa0[k]);
-                        g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
-                        tmp = g.p6[k] - tmp;    
-                        add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[15]);
-                        add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[16]);
-                        add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[17]);
-                        add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[18]);
-                        add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[19]);
-                        add_cs(&(b.p5[k]), &(csb.p5[k]), tmp * c[20]);
-                        add_cs(&(b.p6[k]), &(csb.p6[k]), tmp);
-                        
-                        // Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
-                        if (r->ri_ias15.epsilon_global){
-                            const double ak  = fabs(at[k]);
-                            if (isnormal(ak) && ak>maxak){
-                                maxak = ak;
-                            }
-                            const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
-                            if (isnormal(b6ktmp) && b6ktmp>maxb6ktmp){
-                                maxb6ktmp = b6ktmp;
-                            }
-                        }else{
-                            const double ak  = at[k];
-                            const double b6ktmp = tmp; 
-                            const double errork = fabs(b6ktmp/ak);
-                            if (isnormal(errork) && errork>predictor_corrector_error){
-                                predictor_corrector_error = errork;
-                            }
-                        }
-                    } 
-                    if (r->ri_ias15.epsilon_global){
-                        predictor_corrector_error = maxb6ktmp/maxak;
-                    }
-                    
-                    break;
-                }
-            }
+            ias15_correct(n, N3, N3cs, at, a0, (double*)gravity_cs, csa0, g, b, csb, r->ri_ias15.epsilon_global, &predictor_corrector_error);
         }
     }
+    PROFILING_STOP(r, REB_PROFILING_CAT_IAS15_PREDICTOR)
+    PROFILING_COUNT(r, REB_PROFILING_COUNT_IAS15_ITERATIONS, iterations)
+    r->metrics.ias15_iterations += iterations;
     // Set time back to initial value (will be updated below) 
     r->t = t_beginning;
     // Find new timestep
@@ -497,6 +648,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         if (r->ri_ias15.epsilon_global){
             double maxak = 0.0;
             double maxb6k = 0.0;
+#pragma omp parallel for schedule(static) reduction(max:maxak,maxb6k) if(N3>=IAS15_PARALLEL_N3)
             for(int i=0;i<N;i++){ // Looping over all particles and all 3 components of the acceleration. 
                 const double v2 = particles[i].vx*particles[i].vx+particles[i].vy*particles[i].vy+particles[i].vz*particles[i].vz;
                 const double x2 = particles[i].x*particles[i].x+particles[i].y*particles[i].y+particles[i].z*particles[i].z;
@@ -515,6 +667,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
             }
             integrator_error = maxb6k/maxak;
         }else{
+#pragma omp parallel for schedule(static) reduction(max:integrator_error) if(N3>=IAS15_PARALLEL_N3)
             for(int k=0;k<N3;k++) {
                 const double ak  = at[k];
                 const double b6k = b.p6[k]; 
@@ -537,6 +690,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         
         if (fabs(dt_new/dt_done) < safety_factor) { // New timestep is significantly smaller.
             // Reset particles
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
             for(int k=0;k<N;++k) {
                 particles[k].x = x0[3*k+0]; // Set inital position
                 particles[k].y = x0[3*k+1];
@@ -547,11 +701,17 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
                 particles[k].vz = v0[3*k+2];
             }
             r->dt = dt_new;
-            if (r->dt_last_done!=0.){       // Do not predict next e/b values if this is the first time step.
+            if (lean){
+                // The b values of the rejected step are a better guess than a prediction
+                // from the last successful step, they only need to be rescaled to the new dt.
+                ias15_rescale_rejected_step(dt_new/dt_done, N3, e, b);
+            }else if (r->dt_last_done!=0.){       // Do not predict next e/b values if this is the first time step.
                 double ratio = r->dt/r->dt_last_done;
                 predict_next_step(ratio, N3, er, br, e, b);
             }
             
+            PROFILING_COUNT(r, REB_PROFILING_COUNT_IAS15_REJECTED, 1)
+            r->metrics.ias15_rejections++;
             return 0; // Step rejected. Do again. 
         }       
         if (fabs(dt_new/dt_done) > 1.0) {   // New timestep is larger.
@@ -561,30 +721,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
     }
 
     // Find new position and velocity values at end of the sequence
-    const double dt_done2 = dt_done * dt_done;
-    for(int k=0;k<N3;++k) {
-        {
-            add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p3[k]/30.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p2[k]/20.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p1[k]/12.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done2);
-            add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
-        }
-        {
-            add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p3[k]/5.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p2[k]/4.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p1[k]/3.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
-            add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
-        }
-    }
+    ias15_update_xv(N3, dt_done, x0, csx, v0, csv, a0, b);
 
     r->t += dt_done;
     r->dt_last_done = dt_done;
@@ -595,6 +732,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
     }
 
     // Swap particle buffers
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
     for(int k=0;k<N;++k) {
         particles[k].x = x0[3*k+0]; // Set final position
         particles[k].y = x0[3*k+1];
@@ -604,16 +742,15 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
         particles[k].vy = v0[3*k+1];
         particles[k].vz = v0[3*k+2];
     }
-    copybuffers(e,er,N3);       
-    copybuffers(b,br,N3);       
     double ratio = r->dt/dt_done;
-    predict_next_step(ratio, N3, e, b, e, b);
+    copybuffers_and_predict_next_step(ratio, N3, e, b, er, br, !lean);
     return 1; // Success.
 }
 
 static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _e, const struct reb_dpconst7 _b, const struct reb_dpconst7 e, const struct reb_dpconst7 b){
     if (ratio>20.){
         // Do not predict if stepsize increase is very large. 
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
         for(int k=0;k<N3;++k) {
             e.p0[k] = 0.; e.p1[k] = 0.; e.p2[k] = 0.; e.p3[k] = 0.; e.p4[k] = 0.; e.p5[k] = 0.; e.p6[k] = 0.;
             b.p0[k] = 0.; b.p1[k] = 0.; b.p2[k] = 0.; b.p3[k] = 0.; b.p4[k] = 0.; b.p5[k] = 0.; b.p6[k] = 0.;
@@ -631,6 +768,7 @@ static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _
         const double q6 = q3 * q3;
         const double q7 = q3 * q4;
 
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
         for(int k=0;k<N3;++k) {
             double be0 = _b.p0[k] - _e.p0[k];
             double be1 = _b.p1[k] - _e.p1[k];
@@ -660,20 +798,934 @@ static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _
     }
 }
 
-static void copybuffers(const struct reb_dpconst7 _a, const struct reb_dpconst7 _b, int N3){
-    for (int i=0;i<N3;i++){ 
-        _b.p0[i] = _a.p0[i];
-        _b.p1[i] = _a.p1[i];
-        _b.p2[i] = _a.p2[i];
-        _b.p3[i] = _a.p3[i];
-        _b.p4[i] = _a.p4[i];
-        _b.p5[i] = _a.p5[i];
-        _b.p6[i] = _a.p6[i];
+/**
+ * @brief Rescales the b values of a rejected step to a step which is ratio times as long.
+ * @details Used instead of predict_next_step() if br and er are not stored (lean). 
+ * The rescaled values are used as the prediction e.
+ */
+static void ias15_rescale_rejected_step(double ratio, int N3, const struct reb_dpconst7 e, const struct reb_dpconst7 b){
+    const double q1 = ratio;
+    const double q2 = q1 * q1;
+    const double q3 = q1 * q2;
+    const double q4 = q2 * q2;
+    const double q5 = q2 * q3;
+    const double q6 = q3 * q3;
+    const double q7 = q3 * q4;
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+    for(int k=0;k<N3;++k) {
+        b.p0[k] *= q1; b.p1[k] *= q2; b.p2[k] *= q3; b.p3[k] *= q4; b.p4[k] *= q5; b.p5[k] *= q6; b.p6[k] *= q7;
+        e.p0[k] = b.p0[k]; e.p1[k] = b.p1[k]; e.p2[k] = b.p2[k]; e.p3[k] = b.p3[k]; e.p4[k] = b.p4[k]; e.p5[k] = b.p5[k]; e.p6[k] = b.p6[k];
+    }
+}
+
+/**
+ * @brief Saves the b and e values of a successful step and predicts the values for the next step.
+ * @details Equivalent to copying e to er and b to br, followed by predict_next_step() with the
+ * current e and b values, but only requires one pass over memory. er and br are not written if save is 0.
+ */
+static void copybuffers_and_predict_next_step(double ratio, int N3, const struct reb_dpconst7 e, const struct reb_dpconst7 b, const struct reb_dpconst7 er, const struct reb_dpconst7 br, const int save){
+    if (ratio>20.){
+        // Do not predict if stepsize increase is very large. 
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+        for(int k=0;k<N3;++k) {
+            if (save){
+                er.p0[k] = e.p0[k]; er.p1[k] = e.p1[k]; er.p2[k] = e.p2[k]; er.p3[k] = e.p3[k]; er.p4[k] = e.p4[k]; er.p5[k] = e.p5[k]; er.p6[k] = e.p6[k];
+                br.p0[k] = b.p0[k]; br.p1[k] = b.p1[k]; br.p2[k] = b.p2[k]; br.p3[k] = b.p3[k]; br.p4[k] = b.p4[k]; br.p5[k] = b.p5[k]; br.p6[k] = b.p6[k];
+            }
+            e.p0[k] = 0.; e.p1[k] = 0.; e.p2[k] = 0.; e.p3[k] = 0.; e.p4[k] = 0.; e.p5[k] = 0.; e.p6[k] = 0.;
+            b.p0[k] = 0.; b.p1[k] = 0.; b.p2[k] = 0.; b.p3[k] = 0.; b.p4[k] = 0.; b.p5[k] = 0.; b.p6[k] = 0.;
+        }
+    }else{
+        const double q1 = ratio;
+        const double q2 = q1 * q1;
+        const double q3 = q1 * q2;
+        const double q4 = q2 * q2;
+        const double q5 = q2 * q3;
+        const double q6 = q3 * q3;
+        const double q7 = q3 * q4;
+
+#pragma omp parallel for simd schedule(static) if(N3>=IAS15_PARALLEL_N3)
+        for(int k=0;k<N3;++k) {
+            const double b0 = b.p0[k];
+            const double b1 = b.p1[k];
+            const double b2 = b.p2[k];
+            const double b3 = b.p3[k];
+            const double b4 = b.p4[k];
+            const double b5 = b.p5[k];
+            const double b6 = b.p6[k];
+            const double e0 = e.p0[k];
+            const double e1 = e.p1[k];
+            const double e2 = e.p2[k];
+            const double e3 = e.p3[k];
+            const double e4 = e.p4[k];
+            const double e5 = e.p5[k];
+            const double e6 = e.p6[k];
+            if (save){
+                er.p0[k] = e0; er.p1[k] = e1; er.p2[k] = e2; er.p3[k] = e3; er.p4[k] = e4; er.p5[k] = e5; er.p6[k] = e6;
+                br.p0[k] = b0; br.p1[k] = b1; br.p2[k] = b2; br.p3[k] = b3; br.p4[k] = b4; br.p5[k] = b5; br.p6[k] = b6;
+            }
+
+            const double ne0 = q1*(b6* 7.0 + b5* 6.0 + b4* 5.0 + b3* 4.0 + b2* 3.0 + b1*2.0 + b0);
+            const double ne1 = q2*(b6*21.0 + b5*15.0 + b4*10.0 + b3* 6.0 + b2* 3.0 + b1);
+            const double ne2 = q3*(b6*35.0 + b5*20.0 + b4*10.0 + b3* 4.0 + b2);
+            const double ne3 = q4*(b6*35.0 + b5*15.0 + b4* 5.0 + b3);
+            const double ne4 = q5*(b6*21.0 + b5* 6.0 + b4);
+            const double ne5 = q6*(b6* 7.0 + b5);
+            const double ne6 = q7* b6;
+            e.p0[k] = ne0; e.p1[k] = ne1; e.p2[k] = ne2; e.p3[k] = ne3; e.p4[k] = ne4; e.p5[k] = ne5; e.p6[k] = ne6;
+
+            b.p0[k] = ne0 + (b0 - e0);
+            b.p1[k] = ne1 + (b1 - e1);
+            b.p2[k] = ne2 + (b2 - e2);
+            b.p3[k] = ne3 + (b3 - e3);
+            b.p4[k] = ne4 + (b4 - e4);
+            b.p5[k] = ne5 + (b5 - e5);
+            b.p6[k] = ne6 + (b6 - e6);
+        }
+    }
+}
+
+/******************************
+ * Block timesteps            */
+
+/**
+ * @brief Threshold for the convergence of the iteration between the coarse and fine particle sets.
+ * @details The iteration is converged if the end positions of the fine set change by less than
+ * this value relative to their displacement during the step (or if the change is at the level
+ * of floating point precision).
+ */
+static const double block_convergence       = 1e-15;
+static const int block_iterations_max       = 12;   /**< Maximum number of iterations between the coarse and fine particle sets. */
+static const int block_probe_interval       = 16;   /**< Number of accepted steps after a failed attempt to reduce the level before the next attempt. */
+
+/**
+ * @brief Particles integrated with the same (sub)timestep.
+ * @details All arrays with 3*N entries are indexed by the position of the particle in this set,
+ * not by the index of the particle in the simulation.
+ */
+struct reb_ias15_block_set {
+    int N;                      ///< Number of particles in set
+    int allocatedN;             ///< Number of particles allocated
+    int* index;                 ///< Simulation index of every particle in set
+    double* x0;                 ///< Position at the beginning of the (sub)step
+    double* v0;                 ///< Velocity at the beginning of the (sub)step
+    double* a0;                 ///< Acceleration at the beginning of the (sub)step
+    double* at;                 ///< Acceleration at intermediate spacings
+    double* csx;                ///< Compensated summation for x
+    double* csv;                ///< Compensated summation for v
+    double* csa0;               ///< Compensated summation for a (always 0)
+    double* xend;               ///< Positions at the end of the step in the previous iteration
+    double* error;              ///< Error estimate of every particle, max(|b6|)/max(|a|)
+    struct reb_dp7 g;
+    struct reb_dp7 b;
+    struct reb_dp7 csb;
+    struct reb_dp7 e;
+    struct reb_dp7 br;
+    struct reb_dp7 er;
+    int allocated_dense;        ///< Number of values allocated in dense
+    double* dense;              ///< Dense output: x0, v0, a0, b0..b6 of every substep (30*N values per substep)
+};
+
+/**
+ * @brief Internal data structure for block timesteps.
+ */
+struct reb_ias15_block {
+    int N;                              ///< Number of particles when the partition was created (0: no partition)
+    int level;                          ///< The fine set uses 2^level substeps per timestep
+    int probe;                          ///< Set to 1 if the level has been reduced on trial for the current step
+    int probe_wait;                     ///< Number of accepted steps until the next attempt to reduce the level
+    int warning;                        ///< Set to 1 once a warning about unsupported settings has been shown
+    int* in_fine;                       ///< For every particle: 1 if particle is in the fine set, 0 otherwise
+    double* csx;                        ///< Compensated summation for x of every particle
+    double* csv;                        ///< Compensated summation for v of every particle
+    double* pos;                        ///< Positions of all particles at the current evaluation time
+    double* dt_particle;                ///< Timestep required by every particle
+    double* dt_sorted;                  ///< Scratch space to sort dt_particle
+    struct reb_ias15_block_set coarse;  ///< Particles using the global timestep
+    struct reb_ias15_block_set fine;    ///< Particles using 2^level substeps
+};
+
+static void ias15_block_set_free(struct reb_ias15_block_set* const set){
+    free(set->index);
+    free(set->x0);
+    free(set->v0);
+    free(set->a0);
+    free(set->at);
+    free(set->csx);
+    free(set->csv);
+    free(set->csa0);
+    free(set->xend);
+    free(set->error);
+    free_dp7(&(set->g));
+    free_dp7(&(set->b));
+    free_dp7(&(set->csb));
+    free_dp7(&(set->e));
+    free_dp7(&(set->br));
+    free_dp7(&(set->er));
+    free(set->dense);
+    memset(set, 0, sizeof(struct reb_ias15_block_set));
+}
+
+static void ias15_block_set_alloc(const struct reb_simulation* const r, struct reb_ias15_block_set* const set, const int N){
+    if (N>set->allocatedN){
+        const int N3 = 3*N;
+        set->index = realloc(set->index, sizeof(int)*N);
+        set->x0 = realloc(set->x0, sizeof(double)*N3);
+        set->v0 = realloc(set->v0, sizeof(double)*N3);
+        set->a0 = realloc(set->a0, sizeof(double)*N3);
+        set->at = realloc(set->at, sizeof(double)*N3);
+        set->csx = realloc(set->csx, sizeof(double)*N3);
+        set->csv = realloc(set->csv, sizeof(double)*N3);
+        set->csa0 = realloc(set->csa0, sizeof(double)*N3);
+        set->xend = realloc(set->xend, sizeof(double)*N3);
+        set->error = realloc(set->error, sizeof(double)*N);
+        realloc_dp7(r, &(set->g),N3);
+        realloc_dp7(r, &(set->b),N3);
+        realloc_dp7(r, &(set->csb),N3);
+        realloc_dp7(r, &(set->e),N3);
+        realloc_dp7(r, &(set->br),N3);
+        realloc_dp7(r, &(set->er),N3);
+        set->allocatedN = N;
+    }
+    set->N = N;
+    const int N3 = 3*N;
+    clear_dp7(&(set->b),N3);
+    clear_dp7(&(set->e),N3);
+    clear_dp7(&(set->br),N3);
+    clear_dp7(&(set->er),N3);
+    for (int k=0;k<N3;k++){
+        set->csa0[k] = 0.;
+    }
+}
+
+/**
+ * @brief Frees the block timestep data structure.
+ */
+static void ias15_block_free(struct reb_simulation* const r){
+    struct reb_ias15_block* const block = r->ri_ias15.block;
+    if (block){
+        ias15_block_set_free(&(block->coarse));
+        ias15_block_set_free(&(block->fine));
+        free(block->in_fine);
+        free(block->csx);
+        free(block->csv);
+        free(block->pos);
+        free(block->dt_particle);
+        free(block->dt_sorted);
+        free(block);
+        r->ri_ias15.block = NULL;
+    }
+}
+
+// Returns a newly allocated copy of size bytes of src, or NULL if src is NULL.
+static void* ias15_block_copy_buffer(const void* const src, const size_t size){
+    if (src==NULL || size==0){
+        return NULL;
+    }
+    void* const dst = malloc(size);
+    memcpy(dst, src, size);
+    return dst;
+}
+
+static void ias15_block_copy_dp7(struct reb_dp7* const dst, const struct reb_dp7* const src, const int N3){
+    const size_t size = sizeof(double)*N3;
+    dst->p0 = ias15_block_copy_buffer(src->p0, size);
+    dst->p1 = ias15_block_copy_buffer(src->p1, size);
+    dst->p2 = ias15_block_copy_buffer(src->p2, size);
+    dst->p3 = ias15_block_copy_buffer(src->p3, size);
+    dst->p4 = ias15_block_copy_buffer(src->p4, size);
+    dst->p5 = ias15_block_copy_buffer(src->p5, size);
+    dst->p6 = ias15_block_copy_buffer(src->p6, size);
+}
+
+static void ias15_block_set_copy(struct reb_ias15_block_set* const dst, const struct reb_ias15_block_set* const src){
+    *dst = *src;
+    const int N = src->allocatedN;
+    const int N3 = 3*N;
+    const size_t size = sizeof(double)*N3;
+    dst->index = ias15_block_copy_buffer(src->index, sizeof(int)*N);
+    dst->x0 = ias15_block_copy_buffer(src->x0, size);
+    dst->v0 = ias15_block_copy_buffer(src->v0, size);
+    dst->a0 = ias15_block_copy_buffer(src->a0, size);
+    dst->at = ias15_block_copy_buffer(src->at, size);
+    dst->csx = ias15_block_copy_buffer(src->csx, size);
+    dst->csv = ias15_block_copy_buffer(src->csv, size);
+    dst->csa0 = ias15_block_copy_buffer(src->csa0, size);
+    dst->xend = ias15_block_copy_buffer(src->xend, size);
+    dst->error = ias15_block_copy_buffer(src->error, sizeof(double)*N);
+    ias15_block_copy_dp7(&(dst->g), &(src->g), N3);
+    ias15_block_copy_dp7(&(dst->b), &(src->b), N3);
+    ias15_block_copy_dp7(&(dst->csb), &(src->csb), N3);
+    ias15_block_copy_dp7(&(dst->e), &(src->e), N3);
+    ias15_block_copy_dp7(&(dst->br), &(src->br), N3);
+    ias15_block_copy_dp7(&(dst->er), &(src->er), N3);
+    dst->dense = ias15_block_copy_buffer(src->dense, sizeof(double)*src->allocated_dense);
+}
+
+void reb_integrator_ias15_block_copy(struct reb_simulation* r_copy, const struct reb_simulation* r){
+    const struct reb_ias15_block* const src = r->ri_ias15.block;
+    if (src==NULL){
+        r_copy->ri_ias15.block = NULL;
+        return;
+    }
+    struct reb_ias15_block* const block = malloc(sizeof(struct reb_ias15_block));
+    *block = *src;
+    const int N = src->N;
+    block->in_fine = ias15_block_copy_buffer(src->in_fine, sizeof(int)*N);
+    block->csx = ias15_block_copy_buffer(src->csx, sizeof(double)*3*N);
+    block->csv = ias15_block_copy_buffer(src->csv, sizeof(double)*3*N);
+    block->pos = ias15_block_copy_buffer(src->pos, sizeof(double)*3*N);
+    block->dt_particle = ias15_block_copy_buffer(src->dt_particle, sizeof(double)*N);
+    block->dt_sorted = ias15_block_copy_buffer(src->dt_sorted, sizeof(double)*N);
+    ias15_block_set_copy(&(block->coarse), &(src->coarse));
+    ias15_block_set_copy(&(block->fine), &(src->fine));
+    r_copy->ri_ias15.block = block;
+}
+
+/**
+ * @brief Creates the coarse and fine particle sets from block->in_fine. 
+ * @details Resets the predicted b and e values of both sets.
+ */
+static void ias15_block_partition_apply(const struct reb_simulation* const r, struct reb_ias15_block* const block, const int N){
+    int N_fine = 0;
+    for (int i=0;i<N;i++){
+        N_fine += block->in_fine[i];
+    }
+    ias15_block_set_alloc(r, &(block->coarse), N-N_fine);
+    ias15_block_set_alloc(r, &(block->fine), N_fine);
+    int ic = 0;
+    int jf = 0;
+    for (int i=0;i<N;i++){
+        if (block->in_fine[i]){
+            block->fine.index[jf++] = i;
+        }else{
+            block->coarse.index[ic++] = i;
+        }
+    }
+    if (N_fine==0){
+        block->level = 0;
+    }
+}
+
+/**
+ * @brief Initializes the block timestep data structure if the number of particles changed.
+ */
+static struct reb_ias15_block* ias15_block_init(struct reb_simulation* const r){
+    if (r->ri_ias15.block==NULL){
+        r->ri_ias15.block = calloc(1,sizeof(struct reb_ias15_block));
+    }
+    struct reb_ias15_block* const block = r->ri_ias15.block;
+    const int N = r->N;
+    if (block->N!=N){
+        block->in_fine = realloc(block->in_fine, sizeof(int)*N);
+        block->csx = realloc(block->csx, sizeof(double)*3*N);
+        block->csv = realloc(block->csv, sizeof(double)*3*N);
+        block->pos = realloc(block->pos, sizeof(double)*3*N);
+        block->dt_particle = realloc(block->dt_particle, sizeof(double)*N);
+        block->dt_sorted = realloc(block->dt_sorted, sizeof(double)*N);
+        for (int i=0;i<N;i++){
+            block->in_fine[i] = 0;
+        }
+        for (int k=0;k<3*N;k++){
+            block->csx[k] = 0.;
+            block->csv[k] = 0.;
+        }
+        block->level = 0;
+        block->N = N;
+        ias15_block_partition_apply(r, block, N);
+    }
+    return block;
+}
+
+/**
+ * @brief Checks if the current simulation settings support block timesteps.
+ */
+static int ias15_block_supported(struct reb_simulation* const r){
+    if (r->ri_ias15.block_levels==0){
+        return 0;
+    }
+#ifdef MPI
+    const int mpi = 1;
+#else // MPI
+    const int mpi = 0;
+#endif // MPI
+    if (r->gravity!=REB_GRAVITY_BASIC || r->additional_forces || r->forces_N || r->N_var || r->calculate_megno || r->ri_ias15.epsilon<=0. 
+            || r->nghostx || r->nghosty || r->nghostz || r->testparticle_type==1 || mpi){
+        if (r->ri_ias15.block==NULL || r->ri_ias15.block->warning==0){
+            reb_warning(r, "IAS15 block timesteps require REB_GRAVITY_BASIC, epsilon>0, and no ghost boxes, additional forces, variational equations, MEGNO, interacting test particles or MPI. Using a global timestep instead.");
+            if (r->ri_ias15.block==NULL){
+                r->ri_ias15.block = calloc(1,sizeof(struct reb_ias15_block));
+            }
+            r->ri_ias15.block->warning = 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Coefficients of the position predictor at spacing hn of a step with length dt.
+ */
+static inline void ias15_block_predictor_coefficients(const double dt, const double hn, double s[9]){
+    s[0] = dt * hn;
+    s[1] = s[0] * s[0] / 2.;
+    s[2] = s[1] * hn / 3.;
+    s[3] = s[2] * hn / 2.;
+    s[4] = 3. * s[3] * hn / 5.;
+    s[5] = 2. * s[4] * hn / 3.;
+    s[6] = 5. * s[5] * hn / 7.;
+    s[7] = 3. * s[6] * hn / 4.;
+    s[8] = 7. * s[7] * hn / 9.;
+}
+
+/**
+ * @brief Stores x0, v0, a0 and b of a set as the dense output of substep j.
+ */
+static void ias15_block_dense_store(struct reb_ias15_block_set* const set, const int j){
+    const int N3 = 3*set->N;
+    double* const dense = set->dense + 10*N3*j;
+    memcpy(dense+0*N3, set->x0, sizeof(double)*N3);
+    memcpy(dense+1*N3, set->v0, sizeof(double)*N3);
+    memcpy(dense+2*N3, set->a0, sizeof(double)*N3);
+    memcpy(dense+3*N3, set->b.p0, sizeof(double)*N3);
+    memcpy(dense+4*N3, set->b.p1, sizeof(double)*N3);
+    memcpy(dense+5*N3, set->b.p2, sizeof(double)*N3);
+    memcpy(dense+6*N3, set->b.p3, sizeof(double)*N3);
+    memcpy(dense+7*N3, set->b.p4, sizeof(double)*N3);
+    memcpy(dense+8*N3, set->b.p5, sizeof(double)*N3);
+    memcpy(dense+9*N3, set->b.p6, sizeof(double)*N3);
+}
+
+/**
+ * @brief Writes the positions of a set at time tau (measured from the beginning of the step) to pos.
+ * @details Uses the dense output of the nsub substeps of length dts.
+ */
+static void ias15_block_dense_positions(const struct reb_ias15_block_set* const set, const int nsub, const double dts, const double tau, double* const pos){
+    const int N3 = 3*set->N;
+    int j = (int)(tau/dts);
+    if (j>=nsub) j = nsub-1;
+    if (j<0) j = 0;
+    double s[9];
+    ias15_block_predictor_coefficients(dts, tau/dts-j, s);
+    const double* const x0 = set->dense + 10*N3*j;
+    const double* const v0 = x0 + N3;
+    const double* const a0 = x0 + 2*N3;
+    const double* const b0 = x0 + 3*N3;
+    for (int l=0;l<set->N;l++){
+        const int i = set->index[l];
+        for (int c=0;c<3;c++){
+            const int k = 3*l+c;
+            pos[3*i+c] = x0[k] + (s[8]*b0[k+6*N3] + s[7]*b0[k+5*N3] + s[6]*b0[k+4*N3] + s[5]*b0[k+3*N3] + s[4]*b0[k+2*N3] + s[3]*b0[k+N3] + s[2]*b0[k] + s[1]*a0[k] + s[0]*v0[k]);
+        }
+    }
+}
+
+/**
+ * @brief Calculates the gravitational acceleration of all particles in a set. 
+ * @details Uses the positions in pos for all particles (direct summation).
+ */
+static void ias15_block_accelerations(struct reb_simulation* const r, const struct reb_ias15_block_set* const set, const double* const pos, double* const at){
+    const struct reb_particle* const particles = r->particles;
+    const int N_sources = r->N_active==-1?r->N:r->N_active;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    uint64_t interactions = 0;
+#pragma omp parallel for schedule(guided) reduction(+:interactions) if(set->N>64)
+    for (int l=0;l<set->N;l++){
+        const int i = set->index[l];
+        interactions += N_sources - (i<N_sources);
+        const double xi = pos[3*i+0];
+        const double yi = pos[3*i+1];
+        const double zi = pos[3*i+2];
+        double ax = 0.;
+        double ay = 0.;
+        double az = 0.;
+        for (int j=0;j<N_sources;j++){
+            if (j==i) continue;
+            const double dx = pos[3*j+0] - xi;
+            const double dy = pos[3*j+1] - yi;
+            const double dz = pos[3*j+2] - zi;
+            const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+            const double prefact = G*particles[j].m/(_r*_r*_r);
+            ax += prefact*dx;
+            ay += prefact*dy;
+            az += prefact*dz;
+        }
+        at[3*l+0] = ax;
+        at[3*l+1] = ay;
+        at[3*l+2] = az;
+    }
+    r->metrics.interactions += interactions;
+}
+
+/**
+ * @brief Predictor corrector loop for one (sub)step of a set.
+ * @details The positions of the other set are taken from its dense output. 
+ * Positions and velocities of the set are not updated.
+ * @param tau0 Beginning of the substep measured from the beginning of the global step.
+ * @param dt Length of the substep.
+ * @param other The other set.
+ * @param nsub Number of substeps of the other set.
+ * @param dts Length of the substeps of the other set.
+ */
+static void ias15_block_set_step(struct reb_simulation* const r, struct reb_ias15_block* const block, struct reb_ias15_block_set* const set, const double tau0, const double dt, const struct reb_ias15_block_set* const other, const int nsub, const double dts){
+    const int N3 = 3*set->N;
+    double* const pos = block->pos;
+    const struct reb_dpconst7 g  = dpcast(set->g);
+    const struct reb_dpconst7 b  = dpcast(set->b);
+    const struct reb_dpconst7 csb= dpcast(set->csb);
+    ias15_init_g(N3, N3, g, b, csb);
+
+    double predictor_corrector_error = 1e300;
+    double predictor_corrector_error_last = 2;
+    int iterations = 0; 
+    while(1){
+        if(predictor_corrector_error<1e-16){
+            break;
+        }
+        if(iterations > 2 && predictor_corrector_error_last <= predictor_corrector_error){
+            break;
+        }
+        if (iterations>=12){
+            r->ri_ias15.iterations_max_exceeded++;
+            const int integrator_iterations_warning = 10;
+            if (r->ri_ias15.iterations_max_exceeded==integrator_iterations_warning ){
+                reb_warning(r, "At least 10 predictor corrector loops in IAS15 did not converge. This is typically an indication of the timestep being too large.");
+            }
+            break;
+        }
+        predictor_corrector_error_last = predictor_corrector_error;
+        predictor_corrector_error = 0;
+        iterations++;
+
+        for(int n=1;n<8;n++) {
+            double s[9];
+            ias15_block_predictor_coefficients(dt, h[n], s);
+            for (int l=0;l<set->N;l++){
+                const int i = set->index[l];
+                for (int c=0;c<3;c++){
+                    const int k = 3*l+c;
+                    const double xk = -set->csx[k] + (s[8]*b.p6[k] + s[7]*b.p5[k] + s[6]*b.p4[k] + s[5]*b.p3[k] + s[4]*b.p2[k] + s[3]*b.p1[k] + s[2]*b.p0[k] + s[1]*set->a0[k] + s[0]*set->v0[k]);
+                    pos[3*i+c] = xk + set->x0[k];
+                }
+            }
+            if (other && other->N){
+                ias15_block_dense_positions(other, nsub, dts, tau0 + h[n]*dt, pos);
+            }
+            ias15_block_accelerations(r, set, pos, set->at);
+            ias15_correct(n, N3, N3, set->at, set->a0, set->csa0, set->csa0, g, b, csb, 1, &predictor_corrector_error);
+        }
+    }
+    r->metrics.ias15_iterations += iterations;
+
+    // Error estimate of every particle
+    for (int l=0;l<set->N;l++){
+        double maxak = 0.;
+        double maxb6k = 0.;
+        const double v2 = set->v0[3*l]*set->v0[3*l] + set->v0[3*l+1]*set->v0[3*l+1] + set->v0[3*l+2]*set->v0[3*l+2];
+        const double x2 = set->x0[3*l]*set->x0[3*l] + set->x0[3*l+1]*set->x0[3*l+1] + set->x0[3*l+2]*set->x0[3*l+2];
+        // Skip slowly varying accelerations
+        if (!(fabs(v2*dt*dt/x2) < 1e-16)){
+            for (int k=3*l;k<3*(l+1);k++){
+                const double ak = fabs(set->at[k]);
+                if (isnormal(ak) && ak>maxak){
+                    maxak = ak;
+                }
+                const double b6k = fabs(b.p6[k]); 
+                if (isnormal(b6k) && b6k>maxb6k){
+                    maxb6k = b6k;
+                }
+            }
+        }
+        const double error = maxak>0.?maxb6k/maxak:0.;
+        if (error>set->error[l]){
+            set->error[l] = error;
+        }
+    }
+}
+
+/**
+ * @brief Loads positions, velocities, accelerations and compensated summation coefficients of a set from the simulation.
+ */
+static void ias15_block_set_load(const struct reb_simulation* const r, const struct reb_ias15_block* const block, struct reb_ias15_block_set* const set){
+    const struct reb_particle* const particles = r->particles;
+    for (int l=0;l<set->N;l++){
+        const int i = set->index[l];
+        set->x0[3*l+0] = particles[i].x;
+        set->x0[3*l+1] = particles[i].y;
+        set->x0[3*l+2] = particles[i].z;
+        set->v0[3*l+0] = particles[i].vx;
+        set->v0[3*l+1] = particles[i].vy;
+        set->v0[3*l+2] = particles[i].vz;
+        set->a0[3*l+0] = particles[i].ax;
+        set->a0[3*l+1] = particles[i].ay;
+        set->a0[3*l+2] = particles[i].az;
+        for (int c=0;c<3;c++){
+            set->csx[3*l+c] = block->csx[3*i+c];
+            set->csv[3*l+c] = block->csv[3*i+c];
+        }
+        set->error[l] = 0.;
+    }
+}
+
+/**
+ * @brief Writes the positions, velocities and compensated summation coefficients of a set back to the simulation.
+ */
+static void ias15_block_set_store(struct reb_simulation* const r, struct reb_ias15_block* const block, const struct reb_ias15_block_set* const set){
+    struct reb_particle* const particles = r->particles;
+    for (int l=0;l<set->N;l++){
+        const int i = set->index[l];
+        particles[i].x  = set->x0[3*l+0];
+        particles[i].y  = set->x0[3*l+1];
+        particles[i].z  = set->x0[3*l+2];
+        particles[i].vx = set->v0[3*l+0];
+        particles[i].vy = set->v0[3*l+1];
+        particles[i].vz = set->v0[3*l+2];
+        for (int c=0;c<3;c++){
+            block->csx[3*i+c] = set->csx[3*l+c];
+            block->csv[3*i+c] = set->csv[3*l+c];
+        }
+    }
+}
+
+/**
+ * @brief Integrates the fine set over the global step using nsub substeps.
+ * @details The positions of the coarse set are taken from its dense output.
+ * @return Change of the end positions compared to the previous call in units of the convergence threshold.
+ */
+static double ias15_block_fine_pass(struct reb_simulation* const r, struct reb_ias15_block* const block, const double dt, const int nsub, const int first){
+    struct reb_ias15_block_set* const fine = &(block->fine);
+    const struct reb_ias15_block_set* const coarse = &(block->coarse);
+    const int N3 = 3*fine->N;
+    const double dts = dt/nsub;
+    ias15_block_set_load(r, block, fine);
+    if (!first){
+        // Start with the b values of the first substep of the previous iteration
+        const double* const b0 = fine->dense + 3*N3;
+        memcpy(fine->b.p0, b0+0*N3, sizeof(double)*N3);
+        memcpy(fine->b.p1, b0+1*N3, sizeof(double)*N3);
+        memcpy(fine->b.p2, b0+2*N3, sizeof(double)*N3);
+        memcpy(fine->b.p3, b0+3*N3, sizeof(double)*N3);
+        memcpy(fine->b.p4, b0+4*N3, sizeof(double)*N3);
+        memcpy(fine->b.p5, b0+5*N3, sizeof(double)*N3);
+        memcpy(fine->b.p6, b0+6*N3, sizeof(double)*N3);
+    }
+    const struct reb_dpconst7 b  = dpcast(fine->b);
+    const struct reb_dpconst7 e  = dpcast(fine->e);
+    const struct reb_dpconst7 br = dpcast(fine->br);
+    const struct reb_dpconst7 er = dpcast(fine->er);
+    for (int j=0;j<nsub;j++){
+        ias15_block_set_step(r, block, fine, j*dts, dts, coarse, 1, dt);
+        ias15_block_dense_store(fine, j);
+        ias15_update_xv(N3, dts, fine->x0, fine->csx, fine->v0, fine->csv, fine->a0, b);
+        // Acceleration at the end of the substep
+        for (int l=0;l<fine->N;l++){
+            const int i = fine->index[l];
+            for (int c=0;c<3;c++){
+                block->pos[3*i+c] = fine->x0[3*l+c];
+            }
+        }
+        ias15_block_dense_positions(coarse, 1, dt, (j+1)*dts, block->pos);
+        ias15_block_accelerations(r, fine, block->pos, fine->a0);
+        if (j<nsub-1){
+            copybuffers_and_predict_next_step(1., N3, e, b, er, br, 1);
+        }
+    }
+    // Compare end positions with previous iteration
+    double maxchange = 0.;
+    double maxdisplacement = 0.;
+    double maxposition = 0.;
+    const struct reb_particle* const particles = r->particles;
+    for (int l=0;l<fine->N;l++){
+        const int i = fine->index[l];
+        const double start[3] = {particles[i].x, particles[i].y, particles[i].z};
+        for (int c=0;c<3;c++){
+            const int k = 3*l+c;
+            const double change = fabs(fine->x0[k]-fine->xend[k]);
+            const double displacement = fabs(fine->x0[k]-start[c]);
+            if (change>maxchange) maxchange = change;
+            if (displacement>maxdisplacement) maxdisplacement = displacement;
+            if (fabs(start[c])>maxposition) maxposition = fabs(start[c]);
+            fine->xend[k] = fine->x0[k];
+        }
+    }
+    if (first){
+        return 1e300;
+    }
+    const double threshold = block_convergence*maxdisplacement + 4.*DBL_EPSILON*maxposition;
+    return threshold>0.?maxchange/threshold:0.;
+}
+
+/**
+ * @brief Timestep required by every particle of a set based on its error estimate.
+ * @details Particles without a finite error estimate do not constrain the timestep (INFINITY).
+ */
+static void ias15_block_dt_particle(const struct reb_simulation* const r, struct reb_ias15_block* const block, const struct reb_ias15_block_set* const set, const double dt){
+    for (int l=0;l<set->N;l++){
+        const double error = set->error[l];
+        double dt_new = INFINITY;
+        if (isnormal(error)){
+            dt_new = sqrt7(r->ri_ias15.epsilon/error)*fabs(dt);
+        }
+        if (dt_new<r->ri_ias15.min_dt) dt_new = r->ri_ias15.min_dt;
+        block->dt_particle[set->index[l]] = dt_new;
+    }
+}
+
+/**
+ * @brief Smallest timestep required by any particle in a set.
+ */
+static double ias15_block_dt_min(const struct reb_ias15_block* const block, const struct reb_ias15_block_set* const set){
+    double dt_min = INFINITY;
+    for (int l=0;l<set->N;l++){
+        const double dt = block->dt_particle[set->index[l]];
+        if (dt<dt_min) dt_min = dt;
+    }
+    return dt_min;
+}
+
+static int ias15_block_compare_double(const void* a, const void* b){
+    const double da = *(const double*)a;
+    const double db = *(const double*)b;
+    return (da>db) - (da<db);
+}
+
+/**
+ * @brief Number of levels needed to subdivide dt_coarse into substeps not larger than dt_fine.
+ */
+static int ias15_block_levels_needed(const double dt_coarse, const double dt_fine){
+    int level = 0;
+    while (level<30 && dt_coarse/(double)(1<<level) > dt_fine){
+        level++;
+    }
+    return level;
+}
+
+/**
+ * @brief Relative cost per unit time of a partition.
+ * @details The iteration between the two sets typically converges after one pass of the 
+ * coarse set and two passes of the fine set.
+ */
+static double ias15_block_cost(const int N, const int N_fine, const double dt_coarse, const int level){
+    return ((N-N_fine) + 2.*N_fine*(double)(1<<level))/dt_coarse;
+}
+
+/**
+ * @brief Chooses the coarse timestep, the partition and the number of levels for the next step.
+ * @details Particles are sorted by the timestep they require. For every possible number of 
+ * particles in the fine set, the cost of the step is estimated and the cheapest partition 
+ * is used. To avoid frequent changes (which reset the predicted b values), the partition is
+ * only changed if this reduces the cost by more than 20%.
+ * @return New coarse timestep (positive).
+ */
+static double ias15_block_partition(struct reb_simulation* const r, struct reb_ias15_block* const block, const double dt_max){
+    const int N = r->N;
+    const int levels_max = r->ri_ias15.block_levels;
+    memcpy(block->dt_sorted, block->dt_particle, sizeof(double)*N);
+    qsort(block->dt_sorted, N, sizeof(double), ias15_block_compare_double);
+    const double dt_min = block->dt_sorted[0];
+    if (!isfinite(dt_min)){
+        // No particle constrains the timestep
+        for (int i=0;i<N;i++){
+            block->in_fine[i] = 0;
+        }
+        if (block->fine.N){
+            ias15_block_partition_apply(r, block, N);
+        }
+        return dt_max;
+    }
+    double dt_coarse_max = dt_max;
+    if (dt_coarse_max>dt_min*(double)(1<<levels_max)){
+        dt_coarse_max = dt_min*(double)(1<<levels_max);
+    }
+
+    // Cost of current partition
+    double dt_current_coarse = ias15_block_dt_min(block, &(block->coarse));
+    if (dt_current_coarse>dt_max) dt_current_coarse = dt_max;
+    int level_current = 0;
+    if (block->fine.N){
+        const double dt_current_fine = ias15_block_dt_min(block, &(block->fine));
+        if (dt_current_coarse>dt_current_fine*(double)(1<<levels_max)){
+            dt_current_coarse = dt_current_fine*(double)(1<<levels_max);
+        }
+        level_current = ias15_block_levels_needed(dt_current_coarse, dt_current_fine);
+    }
+    const double cost_current = ias15_block_cost(N, block->fine.N, dt_current_coarse, level_current);
+
+    // Best partition
+    int N_fine_best = 0;
+    double dt_best = dt_min<dt_max?dt_min:dt_max;
+    int level_best = 0;
+    double cost_best = ias15_block_cost(N, 0, dt_best, 0);
+    for (int k=1;k<N;k++){
+        double dt_coarse = block->dt_sorted[k];
+        if (dt_coarse>dt_coarse_max) dt_coarse = dt_coarse_max;
+        const int level = ias15_block_levels_needed(dt_coarse, dt_min);
+        if (level==0) continue;
+        const double cost = ias15_block_cost(N, k, dt_coarse, level);
+        if (cost<cost_best){
+            cost_best = cost;
+            N_fine_best = k;
+            dt_best = dt_coarse;
+            level_best = level;
+        }
+    }
+    
+    if (cost_best<0.8*cost_current){
+        // Change partition
+        const double dt_threshold = N_fine_best?block->dt_sorted[N_fine_best]:0.;
+        int changed = 0;
+        int N_fine = 0;
+        for (int i=0;i<N;i++){
+            // Particles with the same timestep as the threshold might end up in the coarse set
+            const int fine = N_fine<N_fine_best && block->dt_particle[i]<dt_threshold;
+            N_fine += fine;
+            if (fine!=block->in_fine[i]) changed = 1;
+            block->in_fine[i] = fine;
+        }
+        if (changed){
+            ias15_block_partition_apply(r, block, N);
+        }
+        block->level = block->fine.N?level_best:0;
+        return dt_best;
+    }else{
+        block->level = level_current;
+        return dt_current_coarse;
+    }
+}
+
+/**
+ * @brief Does one timestep with block timesteps. 
+ * @return 1 if the step was successful, 0 if it was rejected.
+ */
+static int reb_integrator_ias15_block_step(struct reb_simulation* r){
+    struct reb_ias15_block* const block = ias15_block_init(r);
+    const int levels_max = r->ri_ias15.block_levels;
+    if (block->level>levels_max){
+        block->level = levels_max;
+    }
+    struct reb_ias15_block_set* const coarse = &(block->coarse);
+    struct reb_ias15_block_set* const fine = &(block->fine);
+    const double dt = r->dt;
+    const int nsub = fine->N?1<<block->level:1;
+    const double dts = dt/nsub;
+    if (fine->allocated_dense<30*fine->N*nsub){
+        fine->allocated_dense = 30*fine->N*nsub;
+        fine->dense = realloc(fine->dense, sizeof(double)*fine->allocated_dense);
+    }
+    if (coarse->allocated_dense<30*coarse->N){
+        coarse->allocated_dense = 30*coarse->N;
+        coarse->dense = realloc(coarse->dense, sizeof(double)*coarse->allocated_dense);
+    }
+
+    ias15_block_set_load(r, block, coarse);
+    if (fine->N==0){
+        ias15_block_set_step(r, block, coarse, 0., dt, NULL, 1, dt);
+    }else{
+        // Iterate between fine and coarse set until the trajectories are consistent
+        ias15_block_dense_store(coarse, 0); // Predicted trajectory of coarse set
+        double change_last = 1e300;
+        for (int iteration=0;;iteration++){
+            const double change = ias15_block_fine_pass(r, block, dt, nsub, iteration==0);
+            if (change<1.){
+                break;
+            }
+            if (iteration > 2 && change_last <= change){
+                break;   // Oscillating. Converged to machine precision.
+            }
+            if (iteration>=block_iterations_max){
+                break;
+            }
+            change_last = change;
+            for (int l=0;l<coarse->N;l++){
+                coarse->error[l] = 0.;
+            }
+            ias15_block_set_step(r, block, coarse, 0., dt, fine, nsub, dts);
+            ias15_block_dense_store(coarse, 0);
+        }
+    }
+
+    // Find new timestep
+    ias15_block_dt_particle(r, block, coarse, dt);
+    ias15_block_dt_particle(r, block, fine, dts);
+    double dt_coarse_new = ias15_block_dt_min(block, coarse);
+    if (!isfinite(dt_coarse_new)){
+        dt_coarse_new = fabs(dt)/safety_factor;
+    }
+    if (dt_coarse_new/fabs(dt) < safety_factor){
+        // Coarse step rejected
+        r->dt = copysign(dt_coarse_new, dt);
+        if (fine->N){
+            // Keep the length of the fine substeps instead of the number of substeps
+            const int level = ias15_block_levels_needed(dt_coarse_new, ias15_block_dt_min(block, fine));
+            block->level = level<levels_max?level:levels_max;
+        }
+        block->probe = 0;
+        clear_dp7(&(coarse->b),3*coarse->N);
+        clear_dp7(&(coarse->e),3*coarse->N);
+        PROFILING_COUNT(r, REB_PROFILING_COUNT_IAS15_REJECTED, 1)
+        r->metrics.ias15_rejections++;
+        return 0;
     }
-// The above code seems faster than the code below, probably due to some compiler optimizations. 
-//  for (int i=0;i<7;i++){  
-//      memcpy(_b[i],_a[i], sizeof(double)*N3);
-//  }
+    if (fine->N){
+        const double dts_new = ias15_block_dt_min(block, fine);
+        if (dts_new/fabs(dts) < safety_factor){
+            // Fine substeps rejected
+            const int level = block->level + ias15_block_levels_needed(fabs(dts), dts_new);
+            if (level<=levels_max){
+                block->level = level;
+            }else{
+                block->level = levels_max;
+                r->dt = copysign(dts_new*(double)(1<<levels_max), dt);
+            }
+            if (block->probe){
+                block->probe = 0;
+                block->probe_wait = block_probe_interval;
+            }
+            clear_dp7(&(fine->b),3*fine->N);
+            clear_dp7(&(fine->e),3*fine->N);
+            PROFILING_COUNT(r, REB_PROFILING_COUNT_IAS15_REJECTED, 1)
+            r->metrics.ias15_rejections++;
+            return 0;
+        }
+    }
+
+    // Step accepted
+    ias15_update_xv(3*coarse->N, dt, coarse->x0, coarse->csx, coarse->v0, coarse->csv, coarse->a0, dpcast(coarse->b));
+    ias15_block_set_store(r, block, coarse);
+    ias15_block_set_store(r, block, fine);
+    r->t += dt;
+    r->dt_last_done = dt;
+
+    const int level_last = block->level;
+    const double dt_new = ias15_block_partition(r, block, fabs(dt)/safety_factor);
+    r->dt = copysign(dt_new, dt);
+
+    // If the substeps are much shorter than required, round-off errors dominate the error 
+    // estimate of the fine set. The estimate is then proportional to the substep and never 
+    // asks for fewer levels. Therefore, one level less is tried from time to time.
+    if (block->probe){
+        block->probe = 0;
+        if (block->level>level_last){
+            block->probe_wait = block_probe_interval;
+        }
+    }
+    if (block->probe_wait>0){
+        block->probe_wait--;
+    }else if (fine->N && block->level>0 && block->level>=level_last){
+        block->level--;
+        block->probe = 1;
+    }
+    
+    // Predict b values for next step. Sets have been reset if the partition changed.
+    if (coarse->N){
+        copybuffers_and_predict_next_step(dt_new/fabs(dt), 3*coarse->N, dpcast(coarse->e), dpcast(coarse->b), dpcast(coarse->er), dpcast(coarse->br), 1);
+    }
+    if (fine->N){
+        const double dts_new = dt_new/(double)(1<<block->level);
+        copybuffers_and_predict_next_step(dts_new/fabs(dts), 3*fine->N, dpcast(fine->e), dpcast(fine->b), dpcast(fine->er), dpcast(fine->br), 1);
+    }
+    return 1;
 }
 
 // Do nothing here. This is only used in a leapfrog-like DKD integrator. IAS15 performs one complete timestep.
@@ -686,20 +1738,77 @@ void reb_integrator_ias15_part2(struct reb_simulation* r){
     integrator_generate_constants();
 #endif  // GENERATE_CONSTANTS
     // Try until a step was successful.
-    while(!reb_integrator_ias15_step(r));
+    if (ias15_block_supported(r)){
+        while(!reb_integrator_ias15_block_step(r));
+    }else{
+        while(!reb_integrator_ias15_step(r));
+    }
 }
 
 void reb_integrator_ias15_synchronize(struct reb_simulation* r){
 }
+
+int reb_integrator_ias15_dense_output(const struct reb_simulation* const r, const double t, struct reb_particle* const particles){
+    const int N = r->N;
+    const int N3 = 3*N;
+    const double dt = r->dt_last_done;
+    if (r->integrator!=REB_INTEGRATOR_IAS15 || r->ri_ias15.block_levels || r->ri_ias15.lean || r->ri_ias15.br.p0==NULL || dt==0. || r->ri_ias15.allocatedN<N3){
+        return 0;
+    }
+    // Fraction of the last step, h=0 at the beginning and h=1 at the end.
+    const double hs = 1.+(t-r->t)/dt;
+    if (hs<0. || hs>1.){
+        return 0;
+    }
+    const double* restrict const x0 = r->ri_ias15.x0; 
+    const double* restrict const v0 = r->ri_ias15.v0; 
+    const double* restrict const a0 = r->ri_ias15.a0; 
+    const double* restrict const csx = r->ri_ias15.csx; 
+    const double* restrict const csv = r->ri_ias15.csv; 
+    const struct reb_particle* const ps = r->particles;
+    // x0 and v0 hold the state at the end of the last step. If the particles 
+    // have been changed since then, the coefficients are no longer valid.
+    for(int k=0;k<N;k++){
+        if (x0[3*k]!=ps[k].x || x0[3*k+1]!=ps[k].y || x0[3*k+2]!=ps[k].z
+            || v0[3*k]!=ps[k].vx || v0[3*k+1]!=ps[k].vy || v0[3*k+2]!=ps[k].vz){
+            return 0;
+        }
+    }
+    // br holds the b coefficients of the last step, a0 the accelerations at its beginning.
+    const struct reb_dpconst7 b = dpcast(r->ri_ias15.br);
+    // Powers of h minus one, the polynomials are evaluated relative to the end of the step.
+    double hp[9];
+    double hn = hs;
+    for (int n=0;n<9;n++){
+        hp[n] = hn-1.;
+        hn *= hs;
+    }
+#pragma omp parallel for schedule(static) if(N3>=IAS15_PARALLEL_N3)
+    for(int i=0;i<N;i++){
+        double x[3], v[3];
+        for(int k=3*i, j=0;j<3;k++, j++){
+            const double ve = v0[k] - csv[k];
+            // Velocity at the beginning of the step
+            const double vs = ve - dt*(a0[k] + b.p0[k]/2. + b.p1[k]/3. + b.p2[k]/4. + b.p3[k]/5. + b.p4[k]/6. + b.p5[k]/7. + b.p6[k]/8.);
+            x[j] = x0[k] - csx[k] + dt*hp[0]*vs + dt*dt*(hp[1]*a0[k]/2. + hp[2]*b.p0[k]/6. + hp[3]*b.p1[k]/12. + hp[4]*b.p2[k]/20. + hp[5]*b.p3[k]/30. + hp[6]*b.p4[k]/42. + hp[7]*b.p5[k]/56. + hp[8]*b.p6[k]/72.);
+            v[j] = ve + dt*(hp[0]*a0[k] + hp[1]*b.p0[k]/2. + hp[2]*b.p1[k]/3. + hp[3]*b.p2[k]/4. + hp[4]*b.p3[k]/5. + hp[5]*b.p4[k]/6. + hp[6]*b.p5[k]/7. + hp[7]*b.p6[k]/8.);
+        }
+        particles[i].x = x[0];  particles[i].y = x[1];  particles[i].z = x[2];
+        particles[i].vx = v[0]; particles[i].vy = v[1]; particles[i].vz = v[2];
+    }
+    return 1;
+}
 void reb_integrator_ias15_clear(struct reb_simulation* r){
     const int N3 = r->ri_ias15.allocatedN;
     if (N3){
         clear_dp7(&(r->ri_ias15.g),N3);
         clear_dp7(&(r->ri_ias15.e),N3);
         clear_dp7(&(r->ri_ias15.b),N3);
-        clear_dp7(&(r->ri_ias15.csb),N3);
-        clear_dp7(&(r->ri_ias15.er),N3);
-        clear_dp7(&(r->ri_ias15.br),N3);
+        clear_dp7(&(r->ri_ias15.csb),r->ri_ias15.csb_allocatedN);
+        if (r->ri_ias15.br.p0){
+            clear_dp7(&(r->ri_ias15.er),N3);
+            clear_dp7(&(r->ri_ias15.br),N3);
+        }
         
         double* restrict const csx = r->ri_ias15.csx; 
         double* restrict const csv = r->ri_ias15.csv; 
@@ -709,10 +1818,14 @@ void reb_integrator_ias15_clear(struct reb_simulation* r){
             csv[i] = 0;
         }
     }
+    if (r->ri_ias15.block){
+        r->ri_ias15.block->N = 0;   // Recreate partition
+    }
 }
 
 void reb_integrator_ias15_reset(struct reb_simulation* r){
     r->ri_ias15.allocatedN  = 0;
+    r->ri_ias15.csb_allocatedN  = 0;
     free_dp7(&(r->ri_ias15.g));
     free_dp7(&(r->ri_ias15.e));
     free_dp7(&(r->ri_ias15.b));
@@ -733,6 +1846,7 @@ void reb_integrator_ias15_reset(struct reb_simulation* r){
     r->ri_ias15.csv=  NULL;
     free(r->ri_ias15.csa0);
     r->ri_ias15.csa0 =  NULL;
+    ias15_block_free(r);
 }
 
 #ifdef GENERATE_CONSTANTS
@@ -30,4 +30,6 @@ void reb_integrator_ias15_synchronize(struct reb_simulation* r);        ///< Int
 void reb_integrator_ias15_reset(struct reb_simulation* r);              ///< Internal function used to call a specific integrator
 void reb_integrator_ias15_clear(struct reb_simulation* r);              ///< Internal function used to call a specific integrator
 void reb_integrator_ias15_alloc(struct reb_simulation* r);              ///< Internal function, alloctes memory for IAS15 
+void reb_integrator_ias15_reserve(struct reb_simulation* r, const int N); ///< Internal function, alloctes memory for IAS15 for up to N particles
+void reb_integrator_ias15_block_copy(struct reb_simulation* r_copy, const struct reb_simulation* r); ///< Internal function, copies the block timestep state (used by reb_init_simulation_copy())
 #endif
@@ -42,7 +42,7 @@
 
 struct scheme {
     unsigned int order;
-    unsigned int stages;
+    int stages;
     double gamma[17]; // coefficients padded with 0
 };
 
@@ -143,23 +143,78 @@ static void to_double(struct reb_particle* ps, struct reb_particle_int* psi, uns
     }
 }
 
-static void drift(struct reb_simulation* r, double dt){
+// During a timestep the integer coordinates live in a structure of arrays
+// (x, y, z, vx, vy, vz, each of length N) so that the drift and kick loops
+// run over contiguous int64 data. The array of structures p_int remains the 
+// state between timesteps (it is written to binary files and archives).
+static void aos_to_soa(REB_PARTICLE_INT_TYPE* restrict const soa, const struct reb_particle_int* restrict const psi, const unsigned int N){
+    for(unsigned int i=0; i<N; i++){ 
+        soa[i]     = psi[i].x;
+        soa[N+i]   = psi[i].y;
+        soa[2*N+i] = psi[i].z;
+        soa[3*N+i] = psi[i].vx;
+        soa[4*N+i] = psi[i].vy;
+        soa[5*N+i] = psi[i].vz;
+    }
+}
+static void soa_to_aos(struct reb_particle_int* restrict const psi, const REB_PARTICLE_INT_TYPE* restrict const soa, const unsigned int N){
+    for(unsigned int i=0; i<N; i++){ 
+        psi[i].x  = soa[i];
+        psi[i].y  = soa[N+i];
+        psi[i].z  = soa[2*N+i];
+        psi[i].vx = soa[3*N+i];
+        psi[i].vy = soa[4*N+i];
+        psi[i].vz = soa[5*N+i];
+    }
+}
+
+// Only the positions are needed for the force evaluation, unless forces 
+// depend on velocities.
+static void soa_to_double(struct reb_simulation* r){
     struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
+    struct reb_particle* restrict const ps = r->particles;
+    const REB_PARTICLE_INT_TYPE* restrict const soa = ri_janus->p_int_soa;
     const unsigned int N = r->N;
-    for(int i=0; i<N; i++){
-        ri_janus->p_int[i].x += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vx) ;
-        ri_janus->p_int[i].y += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vy) ;
-        ri_janus->p_int[i].z += (REB_PARTICLE_INT_TYPE)(dt*(double)ri_janus->p_int[i].vz) ;
+    const double scale_pos = ri_janus->scale_pos;
+    const double scale_vel = ri_janus->scale_vel;
+    for(unsigned int i=0; i<N; i++){ 
+        ps[i].x = ((double)soa[i])/scale_pos; 
+        ps[i].y = ((double)soa[N+i])/scale_pos; 
+        ps[i].z = ((double)soa[2*N+i])/scale_pos; 
+    }
+    if (r->force_is_velocity_dependent){
+        for(unsigned int i=0; i<N; i++){ 
+            ps[i].vx = ((double)soa[3*N+i])/scale_vel; 
+            ps[i].vy = ((double)soa[4*N+i])/scale_vel; 
+            ps[i].vz = ((double)soa[5*N+i])/scale_vel; 
+        }
+    }
+}
+
+static void drift(struct reb_simulation* r, double dt){
+    struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
+    const unsigned int N3 = 3*r->N;
+    REB_PARTICLE_INT_TYPE* restrict const x = ri_janus->p_int_soa;
+    const REB_PARTICLE_INT_TYPE* restrict const v = ri_janus->p_int_soa + N3;
+#pragma omp simd
+    for(unsigned int i=0; i<N3; i++){
+        x[i] += (REB_PARTICLE_INT_TYPE)(dt*(double)v[i]);
     }
 }
 
 static void kick(struct reb_simulation* r, double dt, double scale_vel){
     struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
     const unsigned int N = r->N;
-    for(int i=0; i<N; i++){
-        ri_janus->p_int[i].vx += (REB_PARTICLE_INT_TYPE)(scale_vel*dt*r->particles[i].ax) ;
-        ri_janus->p_int[i].vy += (REB_PARTICLE_INT_TYPE)(scale_vel*dt*r->particles[i].ay) ;
-        ri_janus->p_int[i].vz += (REB_PARTICLE_INT_TYPE)(scale_vel*dt*r->particles[i].az) ;
+    const double f = scale_vel*dt;
+    const struct reb_particle* restrict const ps = r->particles;
+    REB_PARTICLE_INT_TYPE* restrict const vx = ri_janus->p_int_soa + 3*N;
+    REB_PARTICLE_INT_TYPE* restrict const vy = ri_janus->p_int_soa + 4*N;
+    REB_PARTICLE_INT_TYPE* restrict const vz = ri_janus->p_int_soa + 5*N;
+#pragma omp simd
+    for(unsigned int i=0; i<N; i++){
+        vx[i] += (REB_PARTICLE_INT_TYPE)(f*ps[i].ax);
+        vy[i] += (REB_PARTICLE_INT_TYPE)(f*ps[i].ay);
+        vz[i] += (REB_PARTICLE_INT_TYPE)(f*ps[i].az);
     }
 }
 
@@ -175,11 +230,16 @@ void reb_integrator_janus_part1(struct reb_simulation* r){
         ri_janus->p_int = realloc(ri_janus->p_int, sizeof(struct reb_particle_int)*N);
         ri_janus->recalculate_integer_coordinates_this_timestep = 1;
     }
+    if (ri_janus->allocated_N_soa != N){
+        ri_janus->allocated_N_soa = N;
+        ri_janus->p_int_soa = realloc(ri_janus->p_int_soa, sizeof(REB_PARTICLE_INT_TYPE)*6*N);
+    }
     
     if (ri_janus->recalculate_integer_coordinates_this_timestep==1){
         to_int(ri_janus->p_int, r->particles, N, scale_pos, scale_vel); 
         ri_janus->recalculate_integer_coordinates_this_timestep = 0;
     }
+    aos_to_soa(ri_janus->p_int_soa, ri_janus->p_int, N);
 
     struct scheme s;
     switch (ri_janus->order){
@@ -204,14 +264,14 @@ void reb_integrator_janus_part1(struct reb_simulation* r){
     }
 
     drift(r,gg(s,0)*dt/2.);
-    to_double(r->particles, r->ri_janus.p_int, r->N, scale_pos, scale_vel); 
+    soa_to_aos(ri_janus->p_int, ri_janus->p_int_soa, N);
+    to_double(r->particles, ri_janus->p_int, N, scale_pos, scale_vel); 
 }
 
 void reb_integrator_janus_part2(struct reb_simulation* r){
     struct reb_simulation_integrator_janus* ri_janus = &(r->ri_janus);
     const unsigned int N = r->N;
     const double scale_vel  = ri_janus->scale_vel;
-    const double scale_pos  = ri_janus->scale_pos;
     const double dt = r->dt;
     
     struct scheme s;
@@ -239,11 +299,12 @@ void reb_integrator_janus_part2(struct reb_simulation* r){
     kick(r,gg(s,0)*dt, scale_vel);
     for (int i=1; i<s.stages; i++){
         drift(r,(gg(s,i-1)+gg(s,i))*dt/2.);
-        to_double(r->particles, r->ri_janus.p_int, N, scale_pos, scale_vel); 
+        soa_to_double(r);
         reb_update_acceleration(r);
         kick(r,gg(s,i)*dt, scale_vel);
     }
     drift(r,gg(s,s.stages-1)*dt/2.);
+    soa_to_aos(ri_janus->p_int, ri_janus->p_int_soa, N);
 
     // Small overhead here: Always get positions and velocities in floating point at 
     // the end of the timestep.
@@ -253,7 +314,7 @@ void reb_integrator_janus_part2(struct reb_simulation* r){
 }
 
 void reb_integrator_janus_synchronize(struct reb_simulation* r){
-    if (r->ri_janus.allocated_N==r->N){
+    if ((int)r->ri_janus.allocated_N==r->N){
         to_double(r->particles, r->ri_janus.p_int, r->N, r->ri_janus.scale_pos, r->ri_janus.scale_vel); 
     }
 }
@@ -269,4 +330,9 @@ void reb_integrator_janus_reset(struct reb_simulation* r){
         free(ri_janus->p_int);
         ri_janus->p_int = NULL;
     }
+    ri_janus->allocated_N_soa = 0;
+    if (ri_janus->p_int_soa){
+        free(ri_janus->p_int_soa);
+        ri_janus->p_int_soa = NULL;
+    }
 }
@@ -33,6 +33,12 @@
 #include <math.h>
 #include <time.h>
 #include "rebound.h"
+#include "tools.h"
+#include "gravity.h"
+#include "boundary.h"
+#include "profiling.h"
+#include "collision.h"
+#include "integrator_leapfrog.h"
 
 // Leapfrog integrator (Drift-Kick-Drift)
 // for non-rotating frame.
@@ -43,6 +49,7 @@ void reb_integrator_leapfrog_part1(struct reb_simulation* r){
 	const double dt = r->dt;
 #pragma omp parallel for schedule(guided)
 	for (int i=0;i<N;i++){
+		if (reb_collision_sleeping(r, i)) continue;
 		particles[i].x  += 0.5* dt * particles[i].vx;
 		particles[i].y  += 0.5* dt * particles[i].vy;
 		particles[i].z  += 0.5* dt * particles[i].vz;
@@ -55,6 +62,8 @@ void reb_integrator_leapfrog_part2(struct reb_simulation* r){
 	const double dt = r->dt;
 #pragma omp parallel for schedule(guided)
 	for (int i=0;i<N;i++){
+		// Sleeping particles are not moved (see sleep_velocity).
+		if (reb_collision_sleeping(r, i)) continue;
 		particles[i].vx += dt * particles[i].ax;
 		particles[i].vy += dt * particles[i].ay;
 		particles[i].vz += dt * particles[i].az;
@@ -73,3 +82,159 @@ void reb_integrator_leapfrog_synchronize(struct reb_simulation* r){
 void reb_integrator_leapfrog_reset(struct reb_simulation* r){
 	// Do nothing.
 }
+
+#if defined(__GNUC__)
+#define REB_LEAPFROG_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define REB_LEAPFROG_ALWAYS_INLINE inline
+#endif
+
+static REB_LEAPFROG_ALWAYS_INLINE void reb_integrator_leapfrog_wrap(struct reb_particle* const p, const struct reb_vec3d boxsize){
+	while(p->x>boxsize.x/2.) p->x -= boxsize.x;
+	while(p->x<-boxsize.x/2.) p->x += boxsize.x;
+	while(p->y>boxsize.y/2.) p->y -= boxsize.y;
+	while(p->y<-boxsize.y/2.) p->y += boxsize.y;
+	while(p->z>boxsize.z/2.) p->z -= boxsize.z;
+	while(p->z<-boxsize.z/2.) p->z += boxsize.z;
+}
+
+/**
+ * Generic fused step. It is only ever called with constant arguments, 
+ * so the compiler generates one branch-free version per combination.
+ * The operations and their order are the same as for part1, 
+ * reb_calculate_acceleration(), part2 and reb_boundary_check(), 
+ * so the results are bitwise identical.
+ */
+static REB_LEAPFROG_ALWAYS_INLINE void reb_integrator_leapfrog_fused(struct reb_simulation* const r, const int gravity_basic, const int periodic){
+	const int N = r->N;
+	struct reb_particle* restrict const particles = r->particles;
+	const double dt = r->dt;
+	const struct reb_vec3d boxsize = r->boxsize;
+	if (!gravity_basic){
+		// Drift, kick (with whatever is in the acceleration fields) and drift in one pass.
+		PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
+#pragma omp parallel for schedule(guided)
+		for (int i=0;i<N;i++){
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+			particles[i].vx += dt * particles[i].ax;
+			particles[i].vy += dt * particles[i].ay;
+			particles[i].vz += dt * particles[i].az;
+			particles[i].x  += 0.5* dt * particles[i].vx;
+			particles[i].y  += 0.5* dt * particles[i].vy;
+			particles[i].z  += 0.5* dt * particles[i].vz;
+			if (periodic) reb_integrator_leapfrog_wrap(&particles[i], boxsize);
+		}
+		// Same round-off as two half steps.
+		r->t+=dt/2.;
+		r->t+=dt/2.;
+		r->dt_last_done = r->dt;
+		PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
+		return;
+	}
+	// First pass: drift and fill the SoA buffer used by the gravity kernel.
+	PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
+	if (r->gravity_soa_allocatedN<N){
+		r->gravity_soa = reb_tools_realloc(r, r->gravity_soa, 0, 4*N*sizeof(double));
+		r->gravity_soa_allocatedN = N;
+	}
+	const int stride = r->gravity_soa_allocatedN;
+	double* restrict const sx = r->gravity_soa;
+	double* restrict const sy = sx + stride;
+	double* restrict const sz = sy + stride;
+	double* restrict const sm = sz + stride;
+#pragma omp parallel for schedule(guided)
+	for (int i=0;i<N;i++){
+		sx[i] = particles[i].x += 0.5* dt * particles[i].vx;
+		sy[i] = particles[i].y += 0.5* dt * particles[i].vy;
+		sz[i] = particles[i].z += 0.5* dt * particles[i].vz;
+		sm[i] = particles[i].m;
+	}
+	r->t+=dt/2.;
+	PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
+
+	// Second pass: accelerations, kick and drift. The kernel only reads 
+	// the SoA buffer, so particles can be moved as soon as they are done.
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	PROFILING_START(r, REB_PROFILING_CAT_FORCE)
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const int N_active = r->N_active==-1?N:r->N_active;
+	const int check_encounters = r->exit_min_distance>0. && N_active==N;
+	const double min2 = r->exit_min_distance*r->exit_min_distance;
+	int encounter = 0;
+#pragma omp parallel for schedule(guided) reduction(max:encounter)
+	for (int i=0;i<N;i++){
+		double a[3] = {0.,0.,0.};
+		const int jmid = i<N_active?i:N_active;
+		if (check_encounters){
+			double r2min = INFINITY;
+			reb_calculate_acceleration_basic_soa_r2min(sx, stride, 0, jmid, sx[i], sy[i], sz[i], softening2, a, &r2min);
+			if (r2min<min2) encounter = 1;
+		}else{
+			reb_calculate_acceleration_basic_soa(sx, stride, 0, jmid, sx[i], sy[i], sz[i], softening2, a);
+		}
+		reb_calculate_acceleration_basic_soa(sx, stride, jmid+1, N_active, sx[i], sy[i], sz[i], softening2, a);
+		particles[i].ax = -G*a[0];
+		particles[i].ay = -G*a[1];
+		particles[i].az = -G*a[2];
+		particles[i].vx += dt * particles[i].ax;
+		particles[i].vy += dt * particles[i].ay;
+		particles[i].vz += dt * particles[i].az;
+		particles[i].x  += 0.5* dt * particles[i].vx;
+		particles[i].y  += 0.5* dt * particles[i].vy;
+		particles[i].z  += 0.5* dt * particles[i].vz;
+		if (periodic) reb_integrator_leapfrog_wrap(&particles[i], boxsize);
+	}
+	if (check_encounters){
+		r->exit_min_distance_checked = (encounter || r->exit_min_distance_checked==2)?2:1;
+	}
+	r->t+=dt/2.;
+	r->dt_last_done = r->dt;
+	PROFILING_STOP(r, REB_PROFILING_CAT_FORCE)
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+}
+
+static void reb_integrator_leapfrog_fused_none(struct reb_simulation* const r){
+	reb_integrator_leapfrog_fused(r, 0, 0);
+}
+static void reb_integrator_leapfrog_fused_none_periodic(struct reb_simulation* const r){
+	reb_integrator_leapfrog_fused(r, 0, 1);
+}
+static void reb_integrator_leapfrog_fused_basic(struct reb_simulation* const r){
+	reb_integrator_leapfrog_fused(r, 1, 0);
+}
+static void reb_integrator_leapfrog_fused_basic_periodic(struct reb_simulation* const r){
+	reb_integrator_leapfrog_fused(r, 1, 1);
+}
+
+int reb_integrator_leapfrog_fused_step(struct reb_simulation* const r){
+#ifdef MPI
+	return 0;
+#endif // MPI
+	if (r->integrator!=REB_INTEGRATOR_LEAPFROG) return 0;
+	if (r->gravity!=REB_GRAVITY_NONE && r->gravity!=REB_GRAVITY_BASIC) return 0;
+	if (r->gravity==REB_GRAVITY_BASIC && (r->nghostx || r->nghosty || r->nghostz)) return 0;
+	if (r->boundary==REB_BOUNDARY_SHEAR) return 0;
+	if (r->collision!=REB_COLLISION_NONE || r->N_var || r->forces_N || r->additional_forces || r->post_timestep_modifications) return 0;
+	if (r->tree_root || r->tree_needs_update) return 0;
+	if (r->N_active!=-1 && r->testparticle_type) return 0;
+	r->gravity_ignore_terms = 0;
+	const int periodic = r->boundary==REB_BOUNDARY_PERIODIC;
+	static void (* const kernels[2][2])(struct reb_simulation* const r) = {
+		{reb_integrator_leapfrog_fused_none, reb_integrator_leapfrog_fused_none_periodic},
+		{reb_integrator_leapfrog_fused_basic, reb_integrator_leapfrog_fused_basic_periodic},
+	};
+	kernels[r->gravity==REB_GRAVITY_BASIC][periodic](r);
+	if (r->gravity==REB_GRAVITY_BASIC){
+		const int N_real = r->N-r->N_var;
+		r->metrics.interactions += reb_calculate_acceleration_direct_interactions(r, r->N_active==-1?N_real:r->N_active, N_real);
+	}
+	if (r->boundary==REB_BOUNDARY_OPEN){
+		PROFILING_START(r, REB_PROFILING_CAT_BOUNDARY)
+		reb_boundary_check(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
+	}
+	return 1;
+}
@@ -28,4 +28,16 @@ void reb_integrator_leapfrog_part1(struct reb_simulation* r);          ///< Inte
 void reb_integrator_leapfrog_part2(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_synchronize(struct reb_simulation* r);    ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_reset(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
+
+/**
+ * @brief Does a full leapfrog step (drift, force calculation, kick, drift and boundary check) in fused passes.
+ * @details Drift and kick are merged into the loops of the force calculation, so that the 
+ * particle array is traversed twice per step for REB_GRAVITY_BASIC and once for REB_GRAVITY_NONE,
+ * instead of five times. Specialized versions for each gravity/boundary combination are 
+ * generated at compile time. Only used if nothing else needs to run between the 
+ * integrator and the force calculation (no collisions, additional forces, trees, ghost boxes, 
+ * variational particles or post timestep modifications).
+ * @return 1 if the step has been done, 0 if the simulation setup is not supported.
+ */
+int reb_integrator_leapfrog_fused_step(struct reb_simulation* const r);
 #endif
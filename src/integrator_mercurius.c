@@ -0,0 +1,593 @@
+/**
+ * @file    integrator_mercurius.c
+ * @brief   MERCURIUS, a hybrid symplectic integrator with a smooth changeover function.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details This file implements a hybrid symplectic integrator in the spirit of
+ * MERCURY (Chambers 1999). It works in the democratic heliocentric coordinates of
+ * WHFastHelio. The interaction potential of every pair of particles is split with a
+ * changeover function K(r) which goes smoothly from 0 (close) to 1 (far). In the kick
+ * step, the particles feel the interactions weighted by K. In the drift step, the
+ * Keplerian motion around the star and the remaining part 1-K of the interactions are
+ * integrated. Only particles which come within the changeover radius of another
+ * particle during the drift step need the latter. They are integrated in place with an
+ * adaptive Bulirsch-Stoer integrator, all other particles with the WHFast Kepler solver.
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "rebound.h"
+#include "particle.h"
+#include "gravity.h"
+#include "integrator.h"
+#include "integrator_whfast.h"
+#include "integrator_mercurius.h"
+#include "transformations.h"
+#include "profiling.h"
+#define MAX(a, b) ((a) < (b) ? (b) : (a))   ///< Returns the maximum of a and b
+#define MIN(a, b) ((a) > (b) ? (b) : (a))   ///< Returns the minimum of a and b
+
+/**
+ * Changeover function of Chambers (1999). Returns 0 for r<0.1 rcrit, 1 for r>rcrit,
+ * and a polynomial with continuous first and second derivatives in between. 
+ * The derivative with respect to r is stored in dK.
+ */
+static double reb_integrator_mercurius_K(const double r, const double rcrit, double* const dK){
+    *dK = 0.;
+    if (rcrit==0.){
+        return 1.;
+    }
+    const double y = (r-0.1*rcrit)/(0.9*rcrit);
+    if (y<0.){
+        return 0.;
+    }
+    if (y>1.){
+        return 1.;
+    }
+    *dK = 30.*y*y*(1.+y*(-2.+y))/(0.9*rcrit);
+    return y*y*y*(10.+y*(-15.+6.*y));
+}
+
+/**
+ * Returns 1 if particle j acts on particle i. Test particles do not interact with
+ * each other, and only act on massive particles if testparticle_type is 1.
+ */
+static inline int reb_integrator_mercurius_acts_on(const int j, const int i, const int N_active, const int testparticle_type){
+    return j<N_active || (testparticle_type==1 && i<N_active);
+}
+
+void reb_integrator_mercurius_calculate_acceleration(struct reb_simulation* r){
+    struct reb_particle* const particles = r->particles;
+    const int N = r->N;
+    const int N_real = N - r->N_var;
+    const int N_active = ((r->N_active==-1)?N:r->N_active) - r->N_var;
+    const int testparticle_type = r->testparticle_type;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    // Changeover radii are only known once the first step has started.
+    const double* const dcrit = ((int)r->ri_mercurius.allocated_N>=N_real)?r->ri_mercurius.dcrit:NULL;
+#pragma omp parallel for schedule(guided)
+    for (int i=0; i<N; i++){
+        particles[i].ax = 0;
+        particles[i].ay = 0;
+        particles[i].az = 0;
+    }
+    // The star does not take part in the interaction step.
+#pragma omp parallel for schedule(guided)
+    for (int i=1; i<N_real; i++){
+        double ax = 0., ay = 0., az = 0.;
+        for (int j=1; j<N_real; j++){
+            if (j==i || !reb_integrator_mercurius_acts_on(j, i, N_active, testparticle_type)) continue;
+            const double dx = particles[j].x - particles[i].x;
+            const double dy = particles[j].y - particles[i].y;
+            const double dz = particles[j].z - particles[i].z;
+            const double r2 = dx*dx + dy*dy + dz*dz + softening2;
+            const double _r = sqrt(r2);
+            // Force from the potential -G*m_i*m_j*K(r)/r
+            double dK = 0.;
+            const double K = dcrit?reb_integrator_mercurius_K(_r, MAX(dcrit[i],dcrit[j]), &dK):1.;
+            const double prefact = G*particles[j].m*(K/(r2*_r) - dK/r2);
+            ax += prefact*dx;
+            ay += prefact*dy;
+            az += prefact*dz;
+        }
+        particles[i].ax = ax;
+        particles[i].ay = ay;
+        particles[i].az = az;
+    }
+}
+
+/*****************************
+ * Operators                 */
+
+static void reb_integrator_mercurius_interaction_step(struct reb_simulation* const r, const double _dt){
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const p_h = r->ri_mercurius.p_h;
+    const int N_real = r->N-r->N_var;
+    const double m0 = particles[0].m;
+#pragma omp parallel for
+    for (int i=1;i<N_real;i++){
+        const double mf = _dt*(particles[i].m+m0)/m0;
+        p_h[i].vx += mf*particles[i].ax;
+        p_h[i].vy += mf*particles[i].ay;
+        p_h[i].vz += mf*particles[i].az;
+    }
+}
+
+/**
+ * Jump step. The jump Hamiltonian is a sum of terms p_i*p_j/m0 over pairs of particles. 
+ * Pairs of particles which are both in a close encounter are left out, they are done
+ * in reb_integrator_mercurius_encounter_step().
+ */
+static void reb_integrator_mercurius_jump_step(struct reb_simulation* const r, const double _dt){
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const p_h = r->ri_mercurius.p_h;
+    const int N_real = r->N-r->N_var;
+    const int* const flag = r->ri_mercurius.encounter_map + N_real;
+    const double m0 = particles[0].m;
+    double px=0, py=0, pz=0;
+    double pex=0, pey=0, pez=0;
+    for (int i=1;i<N_real;i++){
+        const double m = particles[i].m;
+        px += m * p_h[i].vx / (m0+m);
+        py += m * p_h[i].vy / (m0+m);
+        pz += m * p_h[i].vz / (m0+m);
+        if (flag[i]){
+            pex += m * p_h[i].vx / (m0+m);
+            pey += m * p_h[i].vy / (m0+m);
+            pez += m * p_h[i].vz / (m0+m);
+        }
+    }
+#pragma omp parallel for
+    for (int i=1;i<N_real;i++){
+        if (flag[i]){
+            p_h[i].x += _dt * (px - pex);
+            p_h[i].y += _dt * (py - pey);
+            p_h[i].z += _dt * (pz - pez);
+        }else{
+            const double m = particles[i].m;
+            p_h[i].x += _dt * (px - (m * p_h[i].vx / (m0+m)) );
+            p_h[i].y += _dt * (py - (m * p_h[i].vy / (m0+m)) );
+            p_h[i].z += _dt * (pz - (m * p_h[i].vz / (m0+m)) );
+        }
+    }
+}
+
+static void reb_integrator_mercurius_kepler_step(struct reb_simulation* const r, struct reb_particle* const p_h, const double _dt){
+    const int N_real = r->N-r->N_var;
+    const double m0 = r->particles[0].m;
+    PROFILING_START(r, REB_PROFILING_CAT_KEPLER)
+    const int N_batch = 1+(N_real-1)/WHFAST_KEPLER_BATCH*WHFAST_KEPLER_BATCH;
+#pragma omp parallel for
+    for (int i=1;i<N_batch;i+=WHFAST_KEPLER_BATCH){
+        double M[WHFAST_KEPLER_BATCH];
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            M[l] = r->G*(p_h[i+l].m + m0);
+        }
+        kepler_step_batch(r, p_h, M, i, _dt);
+    }
+#pragma omp parallel for
+    for (int i=N_batch;i<N_real;i++){
+        kepler_step(r, p_h, r->G*(p_h[i].m + m0), i, _dt);
+    }
+    p_h[0].x += _dt*p_h[0].vx;
+    p_h[0].y += _dt*p_h[0].vy;
+    p_h[0].z += _dt*p_h[0].vz;
+    PROFILING_STOP(r, REB_PROFILING_CAT_KEPLER)
+}
+
+/*****************************
+ * Close encounters          */
+
+/**
+ * Changeover radii, see the documentation of hillfac. They are kept fixed
+ * until the heliocentric coordinates are recalculated.
+ */
+static void reb_integrator_mercurius_calculate_dcrit(struct reb_simulation* const r){
+    struct reb_particle* const particles = r->particles;
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    const int N_real = r->N-r->N_var;
+    const double m0 = particles[0].m;
+    ri_mercurius->dcrit[0] = 0.;
+    for (int i=1;i<N_real;i++){
+        const double dx = particles[i].x - particles[0].x;
+        const double dy = particles[i].y - particles[0].y;
+        const double dz = particles[i].z - particles[0].z;
+        const double dvx = particles[i].vx - particles[0].vx;
+        const double dvy = particles[i].vy - particles[0].vy;
+        const double dvz = particles[i].vz - particles[0].vz;
+        const double _r = sqrt(dx*dx + dy*dy + dz*dz);
+        const double v2 = dvx*dvx + dvy*dvy + dvz*dvz;
+        const double GM = r->G*(m0+particles[i].m);
+        const double a = fabs(GM*_r/(2.*GM - _r*v2));
+        const double vc = sqrt(GM/a);
+        double dcrit = 0.;
+        dcrit = MAX(dcrit, 0.4*vc*r->dt);
+        dcrit = MAX(dcrit, 0.4*sqrt(v2)*r->dt);
+        dcrit = MAX(dcrit, ri_mercurius->hillfac*a*cbrt(particles[i].m/(3.*m0)));
+        dcrit = MAX(dcrit, 2.*particles[i].r);
+        ri_mercurius->dcrit[i] = dcrit;
+    }
+}
+
+/**
+ * Estimate of the minimum distance of two particles during the drift step from
+ * their relative positions and velocities at the beginning (x0, v0) and end (x1, v1).
+ */
+static double reb_integrator_mercurius_rmin2(const double* const x0, const double* const v0, const double* const x1, const double* const v1){
+    const double r02 = x0[0]*x0[0] + x0[1]*x0[1] + x0[2]*x0[2];
+    const double r12 = x1[0]*x1[0] + x1[1]*x1[1] + x1[2]*x1[2];
+    double rmin2 = MIN(r02, r12);
+    const double rv0 = x0[0]*v0[0] + x0[1]*v0[1] + x0[2]*v0[2];
+    const double rv1 = x1[0]*v1[0] + x1[1]*v1[1] + x1[2]*v1[2];
+    if (rv0<0. && rv1>0.){
+        // Closest approach during the step, linear estimate
+        const double v02 = v0[0]*v0[0] + v0[1]*v0[1] + v0[2]*v0[2];
+        const double d2 = MAX(0., r02 - rv0*rv0/v02);
+        rmin2 = MIN(rmin2, d2);
+    }
+    return rmin2;
+}
+
+/**
+ * Flags all particles which come within the changeover radius of another particle
+ * during a drift step of length _dt. The positions at the end of the drift step are 
+ * predicted with the Kepler solver. Returns the number of flagged particles.
+ */
+static int reb_integrator_mercurius_find_encounters(struct reb_simulation* const r, const double _dt){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    const int N_real = r->N-r->N_var;
+    const struct reb_particle* const p0 = ri_mercurius->p_h;
+    struct reb_particle* const p1 = ri_mercurius->p_h0;
+    memcpy(p1, p0, sizeof(struct reb_particle)*N_real);
+    reb_integrator_mercurius_kepler_step(r, p1, _dt);
+    const double* const dcrit = ri_mercurius->dcrit;
+    int* const map = ri_mercurius->encounter_map;
+    int* const flag = map + N_real;
+    const int N_active = ((r->N_active==-1)?r->N:r->N_active) - r->N_var;
+    const int testparticle_type = r->testparticle_type;
+    for (int i=0;i<N_real;i++){
+        flag[i] = 0;
+    }
+    for (int i=1;i<N_real;i++){
+        for (int j=1;j<i;j++){
+            if (!reb_integrator_mercurius_acts_on(j, i, N_active, testparticle_type)
+                && !reb_integrator_mercurius_acts_on(i, j, N_active, testparticle_type)) continue;
+            const double x0[3] = {p0[i].x-p0[j].x, p0[i].y-p0[j].y, p0[i].z-p0[j].z};
+            const double v0[3] = {p0[i].vx-p0[j].vx, p0[i].vy-p0[j].vy, p0[i].vz-p0[j].vz};
+            const double x1[3] = {p1[i].x-p1[j].x, p1[i].y-p1[j].y, p1[i].z-p1[j].z};
+            const double v1[3] = {p1[i].vx-p1[j].vx, p1[i].vy-p1[j].vy, p1[i].vz-p1[j].vz};
+            const double rcrit = MAX(dcrit[i], dcrit[j]);
+            if (reb_integrator_mercurius_rmin2(x0, v0, x1, v1)<rcrit*rcrit){
+                flag[i] = 1;
+                flag[j] = 1;
+            }
+        }
+    }
+    int N_enc = 0;
+    for (int i=1;i<N_real;i++){
+        if (flag[i]){
+            map[N_enc++] = i;
+        }
+    }
+    return N_enc;
+}
+
+/**
+ * Right hand side of the equations of motion in the drift step: Keplerian motion
+ * and the part 1-K of the interactions. y contains positions and velocities of
+ * the N_enc particles in map.
+ */
+static void reb_integrator_mercurius_encounter_derivatives(const struct reb_simulation* const r, const int N_enc, const double* const y, double* const dydt){
+    const struct reb_particle* const particles = r->particles;
+    const int* const map = r->ri_mercurius.encounter_map;
+    const double* const dcrit = r->ri_mercurius.dcrit;
+    const int N_active = ((r->N_active==-1)?r->N:r->N_active) - r->N_var;
+    const int testparticle_type = r->testparticle_type;
+    const double G = r->G;
+    const double softening2 = r->softening*r->softening;
+    const double m0 = particles[0].m;
+    // Jump terms of the pairs in the encounter, see reb_integrator_mercurius_jump_step()
+    double pex=0, pey=0, pez=0;
+    for (int a=0;a<N_enc;a++){
+        const double m = particles[map[a]].m;
+        pex += m * y[6*a+3] / (m0+m);
+        pey += m * y[6*a+4] / (m0+m);
+        pez += m * y[6*a+5] / (m0+m);
+    }
+    for (int a=0;a<N_enc;a++){
+        const int i = map[a];
+        const double* const xi = y+6*a;
+        const double mi = particles[i].m;
+        const double r2 = xi[0]*xi[0] + xi[1]*xi[1] + xi[2]*xi[2];
+        const double prefac0 = -G*(m0+mi)/(r2*sqrt(r2));
+        double ax = prefac0*xi[0];
+        double ay = prefac0*xi[1];
+        double az = prefac0*xi[2];
+        const double mf = (m0+mi)/m0;
+        for (int b=0;b<N_enc;b++){
+            const int j = map[b];
+            if (j==i || !reb_integrator_mercurius_acts_on(j, i, N_active, testparticle_type)) continue;
+            const double* const xj = y+6*b;
+            const double dx = xj[0] - xi[0];
+            const double dy = xj[1] - xi[1];
+            const double dz = xj[2] - xi[2];
+            const double rij2 = dx*dx + dy*dy + dz*dz + softening2;
+            const double rij = sqrt(rij2);
+            // Force from the potential -G*m_i*m_j*(1-K(r))/r
+            double dK;
+            const double K = reb_integrator_mercurius_K(rij, MAX(dcrit[i],dcrit[j]), &dK);
+            const double prefact = mf*G*particles[j].m*((1.-K)/(rij2*rij) + dK/rij2);
+            ax += prefact*dx;
+            ay += prefact*dy;
+            az += prefact*dz;
+        }
+        dydt[6*a+0] = xi[3] + pex - mi * xi[3] / (m0+mi);
+        dydt[6*a+1] = xi[4] + pey - mi * xi[4] / (m0+mi);
+        dydt[6*a+2] = xi[5] + pez - mi * xi[5] / (m0+mi);
+        dydt[6*a+3] = ax;
+        dydt[6*a+4] = ay;
+        dydt[6*a+5] = az;
+    }
+}
+
+/**
+ * Modified midpoint method with n substeps of size H/n, starting from y0.
+ * The result is stored in yn. z0, z1 and f are scratch space.
+ */
+static void reb_integrator_mercurius_midpoint(const struct reb_simulation* const r, const int N_enc, const double H, const int n, const double* const y0, double* const yn, double* const z0, double* const z1, double* const f){
+    const int N6 = 6*N_enc;
+    const double h = H/n;
+    reb_integrator_mercurius_encounter_derivatives(r, N_enc, y0, f);
+    for (int k=0;k<N6;k++){
+        z0[k] = y0[k];
+        z1[k] = y0[k] + h*f[k];
+    }
+    for (int m=1;m<n;m++){
+        reb_integrator_mercurius_encounter_derivatives(r, N_enc, z1, f);
+        for (int k=0;k<N6;k++){
+            const double z2 = z0[k] + 2.*h*f[k];
+            z0[k] = z1[k];
+            z1[k] = z2;
+        }
+    }
+    reb_integrator_mercurius_encounter_derivatives(r, N_enc, z1, f);
+    for (int k=0;k<N6;k++){
+        yn[k] = 0.5*(z1[k] + z0[k] + h*f[k]);
+    }
+}
+
+/**
+ * Integrates the particles in the encounter map over _dt with an adaptive
+ * Bulirsch-Stoer integrator (modified midpoint method and polynomial
+ * extrapolation). Positions and velocities are read from and written to p_h.
+ */
+static void reb_integrator_mercurius_encounter_step(struct reb_simulation* const r, const int N_enc, const double _dt){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    struct reb_particle* const p_h = ri_mercurius->p_h;
+    const int* const map = ri_mercurius->encounter_map;
+    const int N6 = 6*N_enc;
+    if ((int)ri_mercurius->encounter_allocated_N<N_enc){
+        ri_mercurius->encounter_allocated_N = N_enc;
+        ri_mercurius->encounter_buffer = realloc(ri_mercurius->encounter_buffer, sizeof(double)*6*N_enc*(MERCURIUS_BS_KMAX+5));
+    }
+    double* const y     = ri_mercurius->encounter_buffer;
+    double* const scale = y + N6;
+    double* const z0    = y + 2*N6;
+    double* const z1    = y + 3*N6;
+    double* const f     = y + 4*N6;
+    double* const T     = y + 5*N6;  // Last row of the extrapolation table
+    static const int nseq[MERCURIUS_BS_KMAX] = {2, 4, 6, 8, 10, 12, 14, 16};
+    const double eps = ri_mercurius->encounter_epsilon;
+
+    for (int a=0;a<N_enc;a++){
+        const struct reb_particle p = p_h[map[a]];
+        y[6*a+0] = p.x;  y[6*a+1] = p.y;  y[6*a+2] = p.z;
+        y[6*a+3] = p.vx; y[6*a+4] = p.vy; y[6*a+5] = p.vz;
+    }
+    double t = 0.;
+    double H = _dt;
+    int warning = 0;
+    while (fabs(t)<fabs(_dt)){
+        if (fabs(t+H)>fabs(_dt)){
+            H = _dt-t;
+        }
+        for (int a=0;a<N_enc;a++){
+            const double* const ya = y+6*a;
+            const double sx = sqrt(ya[0]*ya[0] + ya[1]*ya[1] + ya[2]*ya[2]);
+            const double sv = sqrt(ya[3]*ya[3] + ya[4]*ya[4] + ya[5]*ya[5]);
+            for (int k=0;k<3;k++){
+                scale[6*a+k]   = sx;
+                scale[6*a+3+k] = sv;
+            }
+        }
+        int converged = 0;
+        int k;
+        for (k=0;k<MERCURIUS_BS_KMAX;k++){
+            // Row k of the Aitken-Neville table replaces row k-1 in T.
+            reb_integrator_mercurius_midpoint(r, N_enc, H, nseq[k], y, T+k*N6, z0, z1, f);
+            double err = 0.;
+            for (int l=0;l<N6;l++){
+                double Tkj = T[k*N6+l];
+                for (int j=1;j<=k;j++){
+                    const double ratio = (double)nseq[k]/(double)nseq[k-j];
+                    const double Tkj1 = Tkj + (Tkj-T[(j-1)*N6+l])/(ratio*ratio-1.);
+                    T[(j-1)*N6+l] = Tkj;
+                    Tkj = Tkj1;
+                }
+                T[k*N6+l] = Tkj;
+                if (k>0){
+                    err = MAX(err, fabs(Tkj-T[(k-1)*N6+l])/scale[l]);
+                }
+            }
+            if (k>=2 && err<eps){
+                converged = 1;
+                break;
+            }
+        }
+        if (converged || fabs(H)<1e-10*fabs(_dt)){
+            if (!converged){
+                k = MERCURIUS_BS_KMAX-1;
+                if (!warning){
+                    reb_warning(r, "MERCURIUS: Bulirsch-Stoer integrator did not converge during a close encounter.");
+                    warning = 1;
+                }
+            }
+            memcpy(y, T+k*N6, sizeof(double)*N6);
+            t += H;
+            if (k<=3){
+                H *= 2.;
+            }
+        }else{
+            H *= 0.25;
+        }
+    }
+    for (int a=0;a<N_enc;a++){
+        struct reb_particle* const p = &(p_h[map[a]]);
+        p->x  = y[6*a+0]; p->y  = y[6*a+1]; p->z  = y[6*a+2];
+        p->vx = y[6*a+3]; p->vy = y[6*a+4]; p->vz = y[6*a+5];
+    }
+}
+
+/**
+ * Drift step for the particles found by reb_integrator_mercurius_find_encounters(). All 
+ * particles are moved on Keplerian orbits, then the particles in encounters are reset and
+ * integrated with the Bulirsch-Stoer integrator.
+ */
+static void reb_integrator_mercurius_drift_step(struct reb_simulation* const r, const int N_enc, const double _dt){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    const int* const map = ri_mercurius->encounter_map;
+    for (int a=0;a<N_enc;a++){
+        ri_mercurius->p_h0[map[a]] = ri_mercurius->p_h[map[a]];
+    }
+    reb_integrator_mercurius_kepler_step(r, ri_mercurius->p_h, _dt);
+    if (N_enc){
+        for (int a=0;a<N_enc;a++){
+            ri_mercurius->p_h[map[a]] = ri_mercurius->p_h0[map[a]];
+        }
+        reb_integrator_mercurius_encounter_step(r, N_enc, _dt);
+    }
+}
+
+/*****************************
+ * Integrator                */
+
+void reb_integrator_mercurius_part1(struct reb_simulation* const r){
+    if (r->var_config_N){
+        reb_exit("MERCURIUS does currently not work with variational equations.");
+    }
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    struct reb_particle* restrict const particles = r->particles;
+    const int N_real = r->N - r->N_var;
+    r->gravity_ignore_terms = 2;
+
+    if ((int)ri_mercurius->allocated_N != N_real){
+        ri_mercurius->allocated_N = N_real;
+        ri_mercurius->p_h = realloc(ri_mercurius->p_h,sizeof(struct reb_particle)*N_real);
+        ri_mercurius->p_h0 = realloc(ri_mercurius->p_h0,sizeof(struct reb_particle)*N_real);
+        ri_mercurius->dcrit = realloc(ri_mercurius->dcrit,sizeof(double)*N_real);
+        ri_mercurius->encounter_map = realloc(ri_mercurius->encounter_map,sizeof(int)*2*N_real);
+        ri_mercurius->recalculate_coordinates_this_timestep = 1;
+    }
+
+    if (ri_mercurius->safe_mode || ri_mercurius->recalculate_coordinates_this_timestep == 1){
+        if (ri_mercurius->is_synchronized==0){
+            reb_integrator_mercurius_synchronize(r);
+            reb_warning(r,"MERCURIUS: Recalculating heliocentric coordinates but pos/vel were not synchronized before.");
+        }
+        ri_mercurius->recalculate_coordinates_this_timestep = 0;
+        reb_transformations_inertial_to_democratic_heliocentric_posvel(particles, ri_mercurius->p_h, N_real);
+        reb_integrator_mercurius_calculate_dcrit(r);
+    }
+
+    if (ri_mercurius->is_synchronized==0){
+        // Positions for the force calculation
+        if (r->force_is_velocity_dependent){
+            reb_transformations_democratic_heliocentric_to_inertial_posvel(particles, ri_mercurius->p_h, N_real);
+        }else{
+            reb_transformations_democratic_heliocentric_to_inertial_pos(particles, ri_mercurius->p_h, N_real);
+        }
+    }
+}
+
+void reb_integrator_mercurius_part2(struct reb_simulation* const r){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    const double dt = r->dt;
+    if (ri_mercurius->is_synchronized){
+        reb_integrator_mercurius_interaction_step(r, dt/2.);
+    }else{
+        // Combined KICK step
+        reb_integrator_mercurius_interaction_step(r, dt);
+    }
+    const int N_enc = reb_integrator_mercurius_find_encounters(r, dt);
+    ri_mercurius->encounter_N = N_enc;
+    reb_integrator_mercurius_jump_step(r, dt/2.);
+    reb_integrator_mercurius_drift_step(r, N_enc, dt);
+    reb_integrator_mercurius_jump_step(r, dt/2.);
+
+    ri_mercurius->is_synchronized = 0;
+    r->t += dt;
+    r->dt_last_done = dt;
+    if (ri_mercurius->safe_mode){
+        reb_integrator_mercurius_synchronize(r);
+    }
+}
+
+void reb_integrator_mercurius_synchronize(struct reb_simulation* const r){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    if (ri_mercurius->is_synchronized==0){
+        struct reb_particle* restrict const particles = r->particles;
+        const int N_real = r->N - r->N_var;
+        if (r->force_is_velocity_dependent){
+            reb_transformations_democratic_heliocentric_to_inertial_posvel(particles, ri_mercurius->p_h, N_real);
+        }else{
+            reb_transformations_democratic_heliocentric_to_inertial_pos(particles, ri_mercurius->p_h, N_real);
+        }
+        reb_update_acceleration(r);
+        reb_integrator_mercurius_interaction_step(r, r->dt/2.);
+        reb_transformations_democratic_heliocentric_to_inertial_posvel(particles, ri_mercurius->p_h, N_real);
+        ri_mercurius->is_synchronized = 1;
+    }
+}
+
+void reb_integrator_mercurius_reset(struct reb_simulation* const r){
+    struct reb_simulation_integrator_mercurius* const ri_mercurius = &(r->ri_mercurius);
+    ri_mercurius->hillfac = 3.;
+    ri_mercurius->encounter_epsilon = 1e-12;
+    ri_mercurius->safe_mode = 1;
+    ri_mercurius->recalculate_coordinates_this_timestep = 0;
+    ri_mercurius->is_synchronized = 1;
+    ri_mercurius->encounter_N = 0;
+    ri_mercurius->allocated_N = 0;
+    ri_mercurius->encounter_allocated_N = 0;
+    free(ri_mercurius->p_h);
+    free(ri_mercurius->p_h0);
+    free(ri_mercurius->dcrit);
+    free(ri_mercurius->encounter_map);
+    free(ri_mercurius->encounter_buffer);
+    ri_mercurius->p_h = NULL;
+    ri_mercurius->p_h0 = NULL;
+    ri_mercurius->dcrit = NULL;
+    ri_mercurius->encounter_map = NULL;
+    ri_mercurius->encounter_buffer = NULL;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file    integrator_saba.c
+ * @brief   SABA integration schemes.
+ * @author  Hanno Rein <hanno@hanno-rein.de>
+ * @details This file implements the SABAn and SABACn integration schemes
+ * of Laskar & Robutel (2001). They use the same splitting of the
+ * Hamiltonian in Jacobi coordinates as WHFast, and the Kepler solver,
+ * interaction step and coordinate transformations of WHFast. A
+ * timestep consists of n kicks and n+1 drifts, placed like the nodes
+ * of a Gauss-Legendre quadrature.
+ *
+ * @section LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "rebound.h"
+#include "tools.h"
+#include "particle.h"
+#include "gravity.h"
+#include "integrator.h"
+#include "integrator_whfast.h"
+#include "integrator_saba.h"
+
+// Drift coefficients (n+1 per scheme) and kick coefficients (n per scheme), Laskar & Robutel (2001).
+static const double reb_saba_c[4][5] = {
+    {0.5, 0.5},
+    {0.2113248654051871177454257, 0.5773502691896257645091487, 0.2113248654051871177454257},
+    {0.1127016653792583114820735, 0.3872983346207416885179265, 0.3872983346207416885179265, 0.1127016653792583114820735},
+    {0.0694318442029737123880267, 0.2605776340045981552106404, 0.3399810435848562648026657, 0.2605776340045981552106404, 0.0694318442029737123880267},
+};
+static const double reb_saba_d[4][4] = {
+    {1.},
+    {0.5, 0.5},
+    {0.2777777777777777777777778, 0.4444444444444444444444444, 0.2777777777777777777777778},
+    {0.1739274225687269286865320, 0.3260725774312730713134680, 0.3260725774312730713134680, 0.1739274225687269286865320},
+};
+// Corrector coefficients g of SABACn. The corrector exp(-g/2 dt^3 L_{{A,B},B}) is applied before and after each step.
+static const double reb_saba_g[4] = {0.08333333333333333333333333, 0.01116454968463011276968975, 0.005634593363122809402267840, 0.003396775048208601331532158};
+
+/**
+ * Positions to inertial coordinates, interaction accelerations and
+ * Jacobi accelerations. Kicks are then done with reb_whfast_interaction_step().
+ */
+static void reb_saba_update_acceleration(struct reb_simulation* const r){
+    const int N_real = r->N-r->N_var;
+    if (r->force_is_velocity_dependent){
+        reb_whfast_jacobi_to_inertial_posvel(r, N_real);
+    }else{
+        reb_whfast_jacobi_to_inertial_pos(r, N_real);
+    }
+    r->gravity_ignore_terms = 1;
+    reb_update_acceleration(r);
+    reb_whfast_inertial_to_jacobi_acc(r, N_real);
+}
+
+/**
+ * Stores the Jacobi accelerations of the interaction Hamiltonian, including
+ * the terms which are not part of the inertial accelerations, in a.
+ * These are the velocity changes of an interaction step with dt=1.
+ */
+static void reb_saba_jacobi_acceleration(struct reb_simulation* const r, double* const a){
+    struct reb_particle* const p_j = r->ri_whfast.p_j;
+    const int N_real = r->N-r->N_var;
+    reb_saba_update_acceleration(r);
+    for (int i=0;i<N_real;i++){
+        a[3*i+0] = p_j[i].vx;   p_j[i].vx = 0.;
+        a[3*i+1] = p_j[i].vy;   p_j[i].vy = 0.;
+        a[3*i+2] = p_j[i].vz;   p_j[i].vz = 0.;
+    }
+    reb_whfast_interaction_step(r, 1., N_real);
+    for (int i=0;i<N_real;i++){
+        double tmp;
+        tmp = a[3*i+0]; a[3*i+0] = p_j[i].vx; p_j[i].vx = tmp;
+        tmp = a[3*i+1]; a[3*i+1] = p_j[i].vy; p_j[i].vy = tmp;
+        tmp = a[3*i+2]; a[3*i+2] = p_j[i].vz; p_j[i].vz = tmp;
+    }
+}
+
+/**
+ * Corrector exp(-s dt^3 L_C) with C = {{A,B},B} = sum_i m_i |a_i|^2.
+ * Its kick is v_k += 2 s dt^3 sum_i (d a_k / d q_i) a_i, where a are the
+ * Jacobi accelerations. This is the derivative of the accelerations in
+ * the direction of a, which is evaluated with a central difference.
+ * This needs three force evaluations.
+ */
+static void reb_saba_corrector(struct reb_simulation* const r, const double s){
+    struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
+    struct reb_particle* const p_j = r->ri_whfast.p_j;
+    const int N_real = r->N-r->N_var;
+    if ((int)ri_saba->corrector_buffer_N<N_real){
+        ri_saba->corrector_buffer_N = N_real;
+        ri_saba->corrector_buffer = realloc(ri_saba->corrector_buffer, sizeof(double)*12*N_real);
+    }
+    double* const q0 = ri_saba->corrector_buffer;
+    double* const a0 = q0 + 3*N_real;
+    double* const ap = q0 + 6*N_real;
+    double* const am = q0 + 9*N_real;
+    reb_saba_jacobi_acceleration(r, a0);
+    double q2 = 0.;
+    double a2 = 0.;
+    for (int i=1;i<N_real;i++){
+        q0[3*i+0] = p_j[i].x;
+        q0[3*i+1] = p_j[i].y;
+        q0[3*i+2] = p_j[i].z;
+        q2 += p_j[i].x*p_j[i].x + p_j[i].y*p_j[i].y + p_j[i].z*p_j[i].z;
+        a2 += a0[3*i+0]*a0[3*i+0] + a0[3*i+1]*a0[3*i+1] + a0[3*i+2]*a0[3*i+2];
+    }
+    if (a2==0.){
+        return;
+    }
+    // Displacements of 1e-5 times the typical distance balance truncation and round-off errors.
+    const double h = 1e-5*sqrt(q2/a2);
+    for (int i=1;i<N_real;i++){
+        p_j[i].x = q0[3*i+0] + h*a0[3*i+0];
+        p_j[i].y = q0[3*i+1] + h*a0[3*i+1];
+        p_j[i].z = q0[3*i+2] + h*a0[3*i+2];
+    }
+    reb_saba_jacobi_acceleration(r, ap);
+    for (int i=1;i<N_real;i++){
+        p_j[i].x = q0[3*i+0] - h*a0[3*i+0];
+        p_j[i].y = q0[3*i+1] - h*a0[3*i+1];
+        p_j[i].z = q0[3*i+2] - h*a0[3*i+2];
+    }
+    reb_saba_jacobi_acceleration(r, am);
+    const double prefac = s*r->dt*r->dt*r->dt/h;
+    for (int i=1;i<N_real;i++){
+        p_j[i].x = q0[3*i+0];
+        p_j[i].y = q0[3*i+1];
+        p_j[i].z = q0[3*i+2];
+        p_j[i].vx += prefac*(ap[3*i+0]-am[3*i+0]);
+        p_j[i].vy += prefac*(ap[3*i+1]-am[3*i+1]);
+        p_j[i].vz += prefac*(ap[3*i+2]-am[3*i+2]);
+    }
+}
+
+void reb_integrator_saba_part1(struct reb_simulation* const r){
+    struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    if (r->var_config_N){
+        reb_exit("Variational particles are not supported by SABA. Use WHFast or IAS15.");
+    }
+    if (ri_saba->type<1 || ri_saba->type>4){
+        reb_exit("SABA type needs to be 1, 2, 3 or 4.");
+    }
+    const int N = r->N;
+    const int N_real = N-r->N_var;
+    if ((int)ri_whfast->allocated_N != N){
+        ri_whfast->allocated_N = N;
+        ri_whfast->p_j = reb_tools_realloc(r, ri_whfast->p_j, 0, sizeof(struct reb_particle)*N);
+        ri_whfast->eta = realloc(ri_whfast->eta,sizeof(double)*N_real);
+        ri_whfast->recalculate_jacobi_this_timestep = 1;
+    }
+    if (ri_saba->safe_mode || ri_whfast->recalculate_jacobi_this_timestep){
+        if (ri_saba->is_synchronized==0){
+            reb_integrator_saba_synchronize(r);
+            if (ri_whfast->recalculate_jacobi_but_not_synchronized_warning==0){
+                reb_warning(r,"Recalculating Jacobi coordinates but pos/vel were not synchronized before.");
+                ri_whfast->recalculate_jacobi_but_not_synchronized_warning++;
+            }
+        }
+        reb_whfast_calculate_jacobi(r);
+    }
+    r->gravity_ignore_terms = 1;
+    const double c1 = reb_saba_c[ri_saba->type-1][0]*r->dt;
+    const double g = reb_saba_g[ri_saba->type-1];
+    if (ri_saba->is_synchronized){
+        if (ri_saba->corrector){
+            reb_saba_corrector(r, g/2.);
+        }
+        reb_whfast_kepler_drift(r, c1);
+    }else{
+        // Last drift and corrector of the previous step combined with the first ones of this step
+        if (ri_saba->corrector){
+            reb_whfast_kepler_drift(r, c1);
+            reb_saba_corrector(r, g);
+            reb_whfast_kepler_drift(r, c1);
+        }else{
+            reb_whfast_kepler_drift(r, 2.*c1);
+        }
+    }
+    // Prepare coordinates for the first KICK step
+    if (r->force_is_velocity_dependent){
+        reb_whfast_jacobi_to_inertial_posvel(r, N_real);
+    }else{
+        reb_whfast_jacobi_to_inertial_pos(r, N_real);
+    }
+    r->t+=r->dt/2.;
+}
+
+void reb_integrator_saba_synchronize(struct reb_simulation* const r){
+    struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
+    if (ri_saba->is_synchronized == 0){
+        const int N_real = r->N-r->N_var;
+        const int n = ri_saba->type;
+        reb_whfast_kepler_drift(r, reb_saba_c[n-1][n]*r->dt);
+        if (ri_saba->corrector){
+            reb_saba_corrector(r, reb_saba_g[n-1]/2.);
+        }
+        reb_whfast_jacobi_to_inertial_posvel(r, N_real);
+        ri_saba->is_synchronized = 1;
+    }
+}
+
+void reb_integrator_saba_part2(struct reb_simulation* const r){
+    struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
+    const int N_real = r->N-r->N_var;
+    const int n = ri_saba->type;
+    const double dt = r->dt;
+    // The accelerations for the first KICK step have been calculated in reb_step().
+    reb_whfast_inertial_to_jacobi_acc(r, N_real);
+    reb_whfast_interaction_step(r, reb_saba_d[n-1][0]*dt, N_real);
+    for (int k=1;k<n;k++){
+        reb_whfast_kepler_drift(r, reb_saba_c[n-1][k]*dt);
+        reb_saba_update_acceleration(r);
+        reb_whfast_interaction_step(r, reb_saba_d[n-1][k]*dt, N_real);
+    }
+    ri_saba->is_synchronized = 0;
+    if (ri_saba->safe_mode){
+        reb_integrator_saba_synchronize(r);
+    }
+    r->t+=dt/2.;
+    r->dt_last_done = dt;
+}
+
+void reb_integrator_saba_reset(struct reb_simulation* const r){
+    struct reb_simulation_integrator_saba* const ri_saba = &(r->ri_saba);
+    ri_saba->type = 2;
+    ri_saba->corrector = 0;
+    ri_saba->safe_mode = 1;
+    ri_saba->is_synchronized = 1;
+    free(ri_saba->corrector_buffer);
+    ri_saba->corrector_buffer = NULL;
+    ri_saba->corrector_buffer_N = 0;
+}
@@ -42,14 +42,41 @@
 #include "integrator_sei.h"
 
 
-static void operator_H012(double dt, const struct reb_simulation_integrator_sei ri_sei, struct reb_particle* p);
-static void operator_phi1(double dt, struct reb_particle* p);
+/**
+ * @brief Coefficients of operator_H012(), copied into local variables once per step.
+ */
+struct reb_sei_coefficients {
+	double OMEGA;
+	double OMEGAZ;
+	double sindt;
+	double tandt;
+	double sindtz;
+	double tandtz;
+};
+
+static inline void operator_H012(const double dt, const struct reb_sei_coefficients c, struct reb_particle* const p);
+static inline void operator_phi1(const double dt, struct reb_particle* const p);
+
+static struct reb_sei_coefficients reb_sei_get_coefficients(const struct reb_simulation_integrator_sei* const ri_sei){
+	struct reb_sei_coefficients c = {
+		.OMEGA = ri_sei->OMEGA, 
+		.OMEGAZ = ri_sei->OMEGAZ, 
+		.sindt = ri_sei->sindt, 
+		.tandt = ri_sei->tandt, 
+		.sindtz = ri_sei->sindtz, 
+		.tandtz = ri_sei->tandtz,
+	};
+	return c;
+}
 
 
 void reb_integrator_sei_init(struct reb_simulation* const r){
     /**
      * Pre-calculates sin() and tan() needed for SEI. 
      */
+    if (r->ri_sei.OMEGAZ==-1){
+        r->ri_sei.OMEGAZ=r->ri_sei.OMEGA;
+    }
     r->ri_sei.sindt = sin(r->ri_sei.OMEGA*(-r->dt/2.));
     r->ri_sei.tandt = tan(r->ri_sei.OMEGA*(-r->dt/4.));
     r->ri_sei.sindtz = sin(r->ri_sei.OMEGAZ*(-r->dt/2.));
@@ -61,16 +88,16 @@ void reb_integrator_sei_part1(struct reb_simulation* const r){
     r->gravity_ignore_terms = 0;
 	const int N = r->N;
 	struct reb_particle* const particles = r->particles;
-	if (r->ri_sei.OMEGAZ==-1){
-		r->ri_sei.OMEGAZ=r->ri_sei.OMEGA;
-	}
-	if (r->ri_sei.lastdt!=r->dt){
+	if (r->ri_sei.OMEGAZ==-1 || r->ri_sei.lastdt!=r->dt){
         reb_integrator_sei_init(r);
 	}
-	const struct reb_simulation_integrator_sei ri_sei = r->ri_sei;
-#pragma omp parallel for schedule(guided)
+	const struct reb_sei_coefficients c = reb_sei_get_coefficients(&(r->ri_sei));
+	const double dt = r->dt;
+	// The operators are inlined and all coefficients are loop invariant,
+	// so each thread works through its particles in SIMD batches.
+#pragma omp parallel for simd schedule(static)
 	for (int i=0;i<N;i++){
-		operator_H012(r->dt, ri_sei, &(particles[i]));
+		operator_H012(dt, c, &(particles[i]));
 	}
 	r->t+=r->dt/2.;
 }
@@ -78,11 +105,12 @@ void reb_integrator_sei_part1(struct reb_simulation* const r){
 void reb_integrator_sei_part2(struct reb_simulation* r){
 	const int N = r->N;
 	struct reb_particle* const particles = r->particles;
-	const struct reb_simulation_integrator_sei ri_sei = r->ri_sei;
-#pragma omp parallel for schedule(guided)
+	const struct reb_sei_coefficients c = reb_sei_get_coefficients(&(r->ri_sei));
+	const double dt = r->dt;
+#pragma omp parallel for simd schedule(static)
 	for (int i=0;i<N;i++){
-		operator_phi1(r->dt, &(particles[i]));
-		operator_H012(r->dt, ri_sei, &(particles[i]));
+		operator_phi1(dt, &(particles[i]));
+		operator_H012(dt, c, &(particles[i]));
 	}
 	r->t+=r->dt/2.;
 	r->dt_last_done = r->dt;
@@ -101,37 +129,37 @@ void reb_integrator_sei_reset(struct reb_simulation* r){
  * Hamiltonian H0 exactly up to machine precission.
  * @param p reb_particle to evolve.
  * @param dt Timestep
- * @param ri_sei Integrator struct
+ * @param c Coefficients (from the integrator struct)
  */
-static void operator_H012(double dt, const struct reb_simulation_integrator_sei ri_sei, struct reb_particle* p){
+static inline void operator_H012(const double dt, const struct reb_sei_coefficients c, struct reb_particle* const p){
 		
 	// Integrate vertical motion
-	const double zx = p->z * ri_sei.OMEGAZ;
+	const double zx = p->z * c.OMEGAZ;
 	const double zy = p->vz;
 	
 	// Rotation implemeted as 3 shear operators
 	// to avoid round-off errors
-	const double zt1 =  zx - ri_sei.tandtz*zy;			
-	const double zyt =  ri_sei.sindtz*zt1 + zy;
-	const double zxt =  zt1 - ri_sei.tandtz*zyt;	
-	p->z  = zxt/ri_sei.OMEGAZ;
+	const double zt1 =  zx - c.tandtz*zy;			
+	const double zyt =  c.sindtz*zt1 + zy;
+	const double zxt =  zt1 - c.tandtz*zyt;	
+	p->z  = zxt/c.OMEGAZ;
 	p->vz = zyt;
 
 	// Integrate motion in xy directions
-	const double aO = 2.*p->vy + 4.*p->x*ri_sei.OMEGA;	// Center of epicyclic motion
-	const double bO = p->y*ri_sei.OMEGA - 2.*p->vx;	
+	const double aO = 2.*p->vy + 4.*p->x*c.OMEGA;	// Center of epicyclic motion
+	const double bO = p->y*c.OMEGA - 2.*p->vx;	
 
-	const double ys = (p->y*ri_sei.OMEGA-bO)/2.; 		// Epicycle vector
-	const double xs = (p->x*ri_sei.OMEGA-aO); 
+	const double ys = (p->y*c.OMEGA-bO)/2.; 		// Epicycle vector
+	const double xs = (p->x*c.OMEGA-aO); 
 	
 	// Rotation implemeted as 3 shear operators
 	// to avoid round-off errors
-	const double xst1 =  xs - ri_sei.tandt*ys;			
-	const double yst  =  ri_sei.sindt*xst1 + ys;
-	const double xst  =  xst1 - ri_sei.tandt*yst;	
+	const double xst1 =  xs - c.tandt*ys;			
+	const double yst  =  c.sindt*xst1 + ys;
+	const double xst  =  xst1 - c.tandt*yst;	
 
-	p->x  = (xst+aO)    /ri_sei.OMEGA;			
-	p->y  = (yst*2.+bO) /ri_sei.OMEGA - 3./4.*aO*dt;	
+	p->x  = (xst+aO)    /c.OMEGA;			
+	p->y  = (yst*2.+bO) /c.OMEGA - 3./4.*aO*dt;	
 	p->vx = yst;
 	p->vy = -xst*2. -3./2.*aO;
 }
@@ -145,7 +173,7 @@ static void operator_H012(double dt, const struct reb_simulation_integrator_sei
  * @param p reb_particle to evolve.
  * @param dt Timestep
  */
-static void operator_phi1(double dt, struct reb_particle* p){
+static inline void operator_phi1(const double dt, struct reb_particle* const p){
 	// The force used here is for test cases 2 and 3 
 	// in Rein & Tremaine 2011. 
 	p->vx += p->ax * dt;
@@ -39,6 +39,7 @@
 #include "boundary.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
+#include "profiling.h"
 
 #define MAX(a, b) ((a) < (b) ? (b) : (a))   ///< Returns the maximum of a and b
 #define MIN(a, b) ((a) > (b) ? (b) : (a))   ///< Returns the minimum of a and b
@@ -199,7 +200,7 @@ void kepler_step(const struct reb_simulation* const r, struct reb_particle* cons
         // Quartic solver
         // Linear initial guess
         X = beta*_dt/M;
-        static double prevX[WHFAST_NMAX_QUART+1];
+        double prevX[WHFAST_NMAX_QUART+1];
         for(int n_lag=1; n_lag < WHFAST_NMAX_QUART; n_lag++){
             stiefel_Gs3(Gs, beta, X);
             const double f = r0*X + eta0*Gs[2] + zeta0*Gs[3] - _dt;
@@ -325,16 +326,189 @@ void kepler_step(const struct reb_simulation* const r, struct reb_particle* cons
 
 }
 
+/****************************** 
+ * Batched Keplerian motion   */
+
+#define B WHFAST_KEPLER_BATCH
+
+/**
+ * @brief Same as stiefel_Gs3() for B values of beta and X at once.
+ * @details The argument reduction (z/4 until |z|<=0.1) is done per lane. The 
+ * polynomial and the doubling steps are done for all lanes together. Lanes which
+ * need fewer doubling steps are masked, so that every lane performs exactly the 
+ * same floating point operations as stiefel_Gs3().
+ */
+static void stiefel_Gs3_batch(double Gs[4][B], const double* const restrict beta, const double* const restrict X){
+    double z[B];
+    unsigned int n[B];
+    unsigned int nmax_doubling = 0;
+    for (int l=0;l<B;l++){
+        z[l] = beta[l]*(X[l]*X[l]);
+        n[l] = 0;
+        while(fabs(z[l])>0.1){
+            z[l] = z[l]/4.;
+            n[l]++;
+        }
+        nmax_doubling = MAX(nmax_doubling, n[l]);
+    }
+    const int nmax = 13;
+#pragma omp simd
+    for (int l=0;l<B;l++){
+        double c_odd  = invfactorial[nmax];
+        double c_even = invfactorial[nmax-1];
+        for(int np=nmax-2;np>=3;np-=2){
+            c_odd  = invfactorial[np]    - z[l] *c_odd;
+            c_even = invfactorial[np-1]  - z[l] *c_even;
+        }
+        Gs[3][l] = c_odd;
+        Gs[2][l] = c_even;
+        Gs[1][l] = invfactorial[1]  - z[l] *c_odd;
+        Gs[0][l] = invfactorial[0]  - z[l] *c_even;
+    }
+    for (unsigned int k=0;k<nmax_doubling;k++){
+#pragma omp simd
+        for (int l=0;l<B;l++){
+            const double cs3 = (Gs[2][l]+Gs[0][l]*Gs[3][l])*0.25;
+            const double cs2 = Gs[1][l]*Gs[1][l]*0.5;
+            const double cs1 = Gs[0][l]*Gs[1][l];
+            const double cs0 = 2.*Gs[0][l]*Gs[0][l]-1.;
+            const int m = k<n[l];
+            Gs[3][l] = m?cs3:Gs[3][l];
+            Gs[2][l] = m?cs2:Gs[2][l];
+            Gs[1][l] = m?cs1:Gs[1][l];
+            Gs[0][l] = m?cs0:Gs[0][l];
+        }
+    }
+#pragma omp simd
+    for (int l=0;l<B;l++){
+        const double X2 = X[l]*X[l];
+        Gs[1][l] *= X[l]; 
+        Gs[2][l] *= X2; 
+        Gs[3][l] *= X2*X[l];
+    }
+}
+
+void kepler_step_batch(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double* const restrict M, unsigned int i, double _dt){
+    double x[B], y[B], z[B], vx[B], vy[B], vz[B];
+    double r0[B], r0i[B], beta[B], eta0[B], zeta0[B];
+    double X[B], oldX[B], oldX2[B], ri[B], X_per_period[B];
+    double Gs[4][B];
+    int active[B];  // 1 while Newton's method has not converged
+    int scalar[B];  // 1 if the lane needs the quartic solver or bisection
+    for (int l=0;l<B;l++){
+        x[l]  = p_j[i+l].x;  y[l]  = p_j[i+l].y;  z[l]  = p_j[i+l].z;
+        vx[l] = p_j[i+l].vx; vy[l] = p_j[i+l].vy; vz[l] = p_j[i+l].vz;
+    }
+#pragma omp simd
+    for (int l=0;l<B;l++){
+        r0[l] = sqrt(x[l]*x[l] + y[l]*y[l] + z[l]*z[l]);
+        r0i[l] = 1./r0[l];
+        const double v2 =  vx[l]*vx[l] + vy[l]*vy[l] + vz[l]*vz[l];
+        beta[l] = 2.*M[l]*r0i[l] - v2;
+        eta0[l] = x[l]*vx[l] + y[l]*vy[l] + z[l]*vz[l];
+        zeta0[l] = M[l] - beta[l]*r0[l];
+        // Same initial guesses as in kepler_step()
+        const double sqrt_beta = sqrt(beta[l]>0.?beta[l]:1.);
+        X_per_period[l] = beta[l]>0.?2.*M_PI/sqrt_beta:nan("");
+        const double dtr0i = _dt*r0i[l];
+        X[l] = beta[l]>0.?dtr0i * (1. - dtr0i*eta0[l]*0.5*r0i[l]):0.;
+        oldX[l] = X[l];
+    }
+    if (r->ri_whfast.timestep_warning == 0){
+        for (int l=0;l<B;l++){
+            if (beta[l]>0. && fabs(_dt)*(sqrt(beta[l])*beta[l]/(2.*M_PI*M[l]))>1.){
+                ((struct reb_simulation* const)r)->ri_whfast.timestep_warning++;
+                reb_warning((struct reb_simulation* const)r,"WHFast convergence issue. Timestep is larger than at least one orbital period.");
+                break;
+            }
+        }
+    }
+
+    // Do one Newton step
+    stiefel_Gs3_batch(Gs, beta, X);
+#pragma omp simd
+    for (int l=0;l<B;l++){
+        const double eta0Gs1zeta0Gs2 = eta0[l]*Gs[1][l] + zeta0[l]*Gs[2][l];
+        ri[l] = 1./(r0[l] + eta0Gs1zeta0Gs2);
+        X[l]  = ri[l]*(X[l]*eta0Gs1zeta0Gs2-eta0[l]*Gs[2][l]-zeta0[l]*Gs[3][l]+_dt);
+        // Lanes which need the quartic solver are done by kepler_step()
+        scalar[l] = fastabs(X[l]-oldX[l]) > 0.01*X_per_period[l];
+        active[l] = !scalar[l];
+        oldX2[l] = nan("");
+    }
+
+    // Newton's method for all lanes, converged lanes are masked
+    for (int n_hg=1;n_hg<WHFAST_NMAX_NEWT;n_hg++){
+        int N_active = 0;
+        for (int l=0;l<B;l++){
+            N_active += active[l];
+        }
+        if (N_active==0) break;
+        double Gsn[4][B];
+        stiefel_Gs3_batch(Gsn, beta, X);
+#pragma omp simd
+        for (int l=0;l<B;l++){
+            const int m = active[l];
+            const double eta0Gs1zeta0Gs2 = eta0[l]*Gsn[1][l] + zeta0[l]*Gsn[2][l];
+            const double rin = 1./(r0[l] + eta0Gs1zeta0Gs2);
+            const double Xn  = rin*(X[l]*eta0Gs1zeta0Gs2-eta0[l]*Gsn[2][l]-zeta0[l]*Gsn[3][l]+_dt);
+            oldX2[l] = m?oldX[l]:oldX2[l];
+            oldX[l] = m?X[l]:oldX[l];
+            for (int k=0;k<4;k++){
+                Gs[k][l] = m?Gsn[k][l]:Gs[k][l];
+            }
+            ri[l] = m?rin:ri[l];
+            X[l] = m?Xn:X[l];
+            active[l] = m && !(X[l]==oldX[l]||X[l]==oldX2[l]);
+        }
+    }
+
+#pragma omp simd
+    for (int l=0;l<B;l++){
+        // Lanes that did not converge fall back to bisection in kepler_step()
+        scalar[l] = scalar[l] || active[l];
+        if (isnan(ri[l])){
+            // Exception for (almost) straight line motion in hyperbolic case
+            ri[l] = 0.;
+            Gs[1][l] = 0.;
+            Gs[2][l] = 0.;
+            Gs[3][l] = 0.;
+        }
+    }
+
+    for (int l=0;l<B;l++){
+        if (scalar[l]){
+            kepler_step(r, p_j, M[l], i+l, _dt);
+            continue;
+        }
+        // Note: These are not the traditional f and g functions.
+        const double f = -M[l]*Gs[2][l]*r0i[l];
+        const double g = _dt - M[l]*Gs[3][l];
+        const double fd = -M[l]*Gs[1][l]*r0i[l]*ri[l]; 
+        const double gd = -M[l]*Gs[2][l]*ri[l]; 
+            
+        p_j[i+l].x += f*x[l] + g*vx[l];
+        p_j[i+l].y += f*y[l] + g*vy[l];
+        p_j[i+l].z += f*z[l] + g*vz[l];
+            
+        p_j[i+l].vx += fd*x[l] + gd*vx[l];
+        p_j[i+l].vy += fd*y[l] + gd*vy[l];
+        p_j[i+l].vz += fd*z[l] + gd*vz[l];
+    }
+}
+
+#undef B
+
 /***************************** 
  * Interaction Hamiltonian  */
 
 static void interaction_step(struct reb_simulation* const r, struct reb_particle* const p_j, const double* const eta, const double G, const double softening, const double _dt, const int N_real){
-    for (unsigned int i=1;i<N_real;i++){
+    for (int i=1;i<N_real;i++){
         // Eq 132
         const struct reb_particle pji = p_j[i];
-        static double rj2i;
-        static double rj3iM;
-        static double prefac1;
+        double rj2i = 0.;       // Only used for i>1
+        double rj3iM = 0.;
+        double prefac1 = 0.;
         p_j[i].vx += _dt * pji.ax;
         p_j[i].vy += _dt * pji.ay;
         p_j[i].vz += _dt * pji.az;
@@ -365,88 +539,377 @@ static void interaction_step(struct reb_simulation* const r, struct reb_particle
     }
 }
 
+/**
+ * @brief Interaction step for test particles.
+ * @details Same as interaction_step() for particles N_massive to N_real-1, which need 
+ * to be massless. The Jacobi accelerations are calculated from the inertial ones
+ * here, so that only one pass over the particles is needed. Every particle is 
+ * independent, so this is done in parallel.
+ */
+static void interaction_step_testparticles(const struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const double G, const double softening, const double _dt, const int N_massive, const int N_real){
+    const struct reb_particle com = p_j[0];
+#pragma omp parallel for
+    for (int i=N_massive;i<N_real;i++){
+        const struct reb_particle pji = p_j[i];
+        p_j[i].vx += _dt * (particles[i].ax - com.ax);
+        p_j[i].vy += _dt * (particles[i].ay - com.ay);
+        p_j[i].vz += _dt * (particles[i].az - com.az);
+        if (i>1){
+            const double rj2i = 1./(pji.x*pji.x + pji.y*pji.y + pji.z*pji.z + softening*softening);
+            const double rji  = sqrt(rj2i);
+            const double prefac1 = _dt*rji*rj2i*G*eta[i];
+            p_j[i].vx += prefac1*pji.x;
+            p_j[i].vy += prefac1*pji.y;
+            p_j[i].vz += prefac1*pji.z;
+        }
+    }
+}
+
+/***************************** 
+ * Test particles            */
+
+/**
+ * @brief Returns the number of particles which need the full Jacobi transformation.
+ * @details If N_active is set, there are no variational particles and all particles 
+ * with an index of N_active or larger are massless, only the first N_active particles
+ * are massive. The Jacobi coordinates of a massless particle are then simply its 
+ * coordinates relative to the centre of mass of all particles, and test particles can
+ * be transformed, drifted and kicked independently of each other. Otherwise N_real is
+ * returned.
+ */
+static int reb_whfast_N_massive(const struct reb_simulation* const r, const int N_real){
+    const int N_active = r->N_active;
+    if (N_active<=0 || N_active>=N_real || r->var_config_N){
+        return N_real;
+    }
+    const struct reb_particle* const particles = r->particles;
+    for (int i=N_active;i<N_real;i++){
+        if (particles[i].m!=0.){
+            return N_real;
+        }
+    }
+    return N_active;
+}
+
+/**
+ * @brief Returns the number of massive particles determined when the Jacobi coordinates were last calculated.
+ */
+static int reb_whfast_get_N_massive(const struct reb_simulation* const r, const int N_real){
+    const int N_massive = (int)r->ri_whfast.N_massive;
+    if (N_massive==0 || N_massive>N_real){
+        return reb_whfast_N_massive(r, N_real);
+    }
+    return N_massive;
+}
+
+static void reb_whfast_inertial_to_jacobi_posvel(struct reb_simulation* const r, const int N_real){
+    struct reb_particle* const particles = r->particles;
+    struct reb_particle* const p_j = r->ri_whfast.p_j;
+    const int N_massive = reb_whfast_get_N_massive(r, N_real);
+    reb_transformations_inertial_to_jacobi_posvel(particles, p_j, r->ri_whfast.eta, particles, N_massive);
+    const struct reb_particle com = p_j[0];
+#pragma omp parallel for
+    for (int i=N_massive;i<N_real;i++){
+        p_j[i].x = particles[i].x - com.x;
+        p_j[i].y = particles[i].y - com.y;
+        p_j[i].z = particles[i].z - com.z;
+        p_j[i].vx = particles[i].vx - com.vx;
+        p_j[i].vy = particles[i].vy - com.vy;
+        p_j[i].vz = particles[i].vz - com.vz;
+    }
+}
+
+// Test particles are done in reb_whfast_interaction_step(), which always follows.
+void reb_whfast_inertial_to_jacobi_acc(struct reb_simulation* const r, const int N_real){
+    const int N_massive = reb_whfast_get_N_massive(r, N_real);
+    reb_transformations_inertial_to_jacobi_acc(r->particles, r->ri_whfast.p_j, r->ri_whfast.eta, r->particles, N_massive);
+}
+
+void reb_whfast_jacobi_to_inertial_pos(struct reb_simulation* const r, const int N_real){
+    struct reb_particle* const particles = r->particles;
+    const struct reb_particle* const p_j = r->ri_whfast.p_j;
+    const int N_massive = reb_whfast_get_N_massive(r, N_real);
+    reb_transformations_jacobi_to_inertial_pos(particles, p_j, r->ri_whfast.eta, particles, N_massive);
+    const struct reb_particle com = p_j[0];
+#pragma omp parallel for
+    for (int i=N_massive;i<N_real;i++){
+        particles[i].x = p_j[i].x + com.x;
+        particles[i].y = p_j[i].y + com.y;
+        particles[i].z = p_j[i].z + com.z;
+    }
+}
+
+void reb_whfast_jacobi_to_inertial_posvel(struct reb_simulation* const r, const int N_real){
+    struct reb_particle* const particles = r->particles;
+    const struct reb_particle* const p_j = r->ri_whfast.p_j;
+    const int N_massive = reb_whfast_get_N_massive(r, N_real);
+    reb_transformations_jacobi_to_inertial_posvel(particles, p_j, r->ri_whfast.eta, particles, N_massive);
+    const struct reb_particle com = p_j[0];
+#pragma omp parallel for
+    for (int i=N_massive;i<N_real;i++){
+        particles[i].x = p_j[i].x + com.x;
+        particles[i].y = p_j[i].y + com.y;
+        particles[i].z = p_j[i].z + com.z;
+        particles[i].vx = p_j[i].vx + com.vx;
+        particles[i].vy = p_j[i].vy + com.vy;
+        particles[i].vz = p_j[i].vz + com.vz;
+    }
+}
+
+void reb_whfast_interaction_step(struct reb_simulation* const r, const double _dt, const int N_real){
+    const int N_massive = reb_whfast_get_N_massive(r, N_real);
+    interaction_step(r, r->ri_whfast.p_j, r->ri_whfast.eta, r->G, r->softening, _dt, N_massive);
+    interaction_step_testparticles(r->particles, r->ri_whfast.p_j, r->ri_whfast.eta, r->G, r->softening, _dt, N_massive, N_real);
+}
+
 /***************************** 
  * DKD Scheme                */
 
 static void kepler_drift(const struct reb_simulation* const r, struct reb_particle* const p_j, const double* const eta, const double G, const double _dt, const int N_real){
-    for (unsigned int i=1;i<N_real;i++){
+    // All particles are independent.
+    PROFILING_START(r, REB_PROFILING_CAT_KEPLER)
+    const int N_batch = (r->var_config_N==0)?(N_real-1)/WHFAST_KEPLER_BATCH:0;
+#pragma omp parallel for
+    for (int b=0;b<N_batch;b++){
+        const int i = 1+b*WHFAST_KEPLER_BATCH;
+        double M[WHFAST_KEPLER_BATCH];
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            M[l] = eta[i+l]*G;
+        }
+        kepler_step_batch(r, p_j, M, i, _dt);
+    }
+#pragma omp parallel for
+    for (int i=1+N_batch*WHFAST_KEPLER_BATCH;i<N_real;i++){
         kepler_step(r, p_j, eta[i]*G, i, _dt);
     }
     p_j[0].x += _dt*p_j[0].vx;
     p_j[0].y += _dt*p_j[0].vy;
     p_j[0].z += _dt*p_j[0].vz;
+    PROFILING_STOP(r, REB_PROFILING_CAT_KEPLER)
+}
+
+void reb_whfast_kepler_drift(struct reb_simulation* const r, const double _dt){
+    kepler_drift(r, r->ri_whfast.p_j, r->ri_whfast.eta, r->G, _dt, r->N-r->N_var);
 }
 
-static void reb_whfast_corrector_Z(struct reb_simulation* r, const double a, const double b){
+/**
+ * Kick part of the corrector stages: positions to inertial coordinates, 
+ * interaction accelerations, back to Jacobi accelerations and a kick by b.
+ */
+static void reb_whfast_corrector_kick(struct reb_simulation* r, const double b){
     struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
     struct reb_particle* restrict const particles = r->particles;
     const int N_real = r->N-r->N_var;
-    kepler_drift(r, ri_whfast->p_j, ri_whfast->eta,  r->G, a, N_real);
-    reb_transformations_jacobi_to_inertial_pos(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
+    reb_whfast_jacobi_to_inertial_pos(r, N_real);
     for (int v=0;v<r->var_config_N;v++){
         struct reb_variational_configuration const vc = r->var_config[v];
         reb_transformations_jacobi_to_inertial_pos(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
     }
     r->gravity_ignore_terms = 1;
     reb_update_acceleration(r);
-    reb_transformations_inertial_to_jacobi_acc(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
+    reb_whfast_inertial_to_jacobi_acc(r, N_real);
     for (int v=0;v<r->var_config_N;v++){
         struct reb_variational_configuration const vc = r->var_config[v];
         reb_transformations_inertial_to_jacobi_acc(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
     }
-    interaction_step(r, ri_whfast->p_j, ri_whfast->eta, r->G, r->softening, -b, N_real);
-    kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, -2.*a, N_real);
-    reb_transformations_jacobi_to_inertial_pos(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
-    for (int v=0;v<r->var_config_N;v++){
-        struct reb_variational_configuration const vc = r->var_config[v];
-        reb_transformations_jacobi_to_inertial_pos(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
+    reb_whfast_interaction_step(r, b, N_real);
+}
+
+void reb_whfast_apply_corrector(struct reb_simulation* r, double inv, int order){
+    // Each stage Z(a,b) is drift(a), kick(-b), drift(-2a), kick(b), drift(a) (Wisdom 2006). 
+    // The last drift of a stage and the first drift of the next stage are 
+    // combined into one Kepler step. In the antisymmetric sequences below, 
+    // the combined drift vanishes in the middle and is skipped. 
+    double a[10], b[10];
+    int stages = 0;
+    switch (order){
+        case 3:
+            stages = 2;
+            a[0] = reb_whfast_corrector_a_1;  b[0] = -reb_whfast_corrector_b_31;
+            a[1] = -reb_whfast_corrector_a_1; b[1] = reb_whfast_corrector_b_31;
+            break;
+        case 5:
+            stages = 4;
+            a[0] = -reb_whfast_corrector_a_2; b[0] = -reb_whfast_corrector_b_51;
+            a[1] = -reb_whfast_corrector_a_1; b[1] = -reb_whfast_corrector_b_52;
+            a[2] = reb_whfast_corrector_a_1;  b[2] = reb_whfast_corrector_b_52;
+            a[3] = reb_whfast_corrector_a_2;  b[3] = reb_whfast_corrector_b_51;
+            break;
+        case 7:
+            {
+                const double an[] = {reb_whfast_corrector_a_3, reb_whfast_corrector_a_2, reb_whfast_corrector_a_1};
+                const double bn[] = {reb_whfast_corrector_b_71, reb_whfast_corrector_b_72, reb_whfast_corrector_b_73};
+                stages = 6;
+                for (int k=0;k<3;k++){
+                    a[k] = -an[k];  b[k] = -bn[k];
+                    a[5-k] = an[k]; b[5-k] = bn[k];
+                }
+            }
+            break;
+        case 11:
+            {
+                const double an[] = {reb_whfast_corrector_a_5, reb_whfast_corrector_a_4, reb_whfast_corrector_a_3, reb_whfast_corrector_a_2, reb_whfast_corrector_a_1};
+                const double bn[] = {reb_whfast_corrector_b_111, reb_whfast_corrector_b_112, reb_whfast_corrector_b_113, reb_whfast_corrector_b_114, reb_whfast_corrector_b_115};
+                stages = 10;
+                for (int k=0;k<5;k++){
+                    a[k] = -an[k];  b[k] = -bn[k];
+                    a[9-k] = an[k]; b[9-k] = bn[k];
+                }
+            }
+            break;
+        default:
+            return;
     }
-    r->gravity_ignore_terms = 1;
-    reb_update_acceleration(r);
-    reb_transformations_inertial_to_jacobi_acc(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
-    for (int v=0;v<r->var_config_N;v++){
-        struct reb_variational_configuration const vc = r->var_config[v];
-        reb_transformations_inertial_to_jacobi_acc(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    const int N_real = r->N-r->N_var;
+    const double dt = r->dt;
+    double drift = 0.; // Pending drift from the previous stage
+    for (int k=0;k<stages;k++){
+        const double ak = a[k]*dt;
+        const double bk = inv*b[k]*dt;
+        if (drift+ak!=0.){
+            kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, drift+ak, N_real);
+        }
+        reb_whfast_corrector_kick(r, -bk);
+        kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, -2.*ak, N_real);
+        reb_whfast_corrector_kick(r, bk);
+        drift = ak;
     }
-    interaction_step(r, ri_whfast->p_j, ri_whfast->eta, r->G, r->softening, b, N_real);
-    kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, a, N_real);
+    kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, drift, N_real);
 }
 
-void reb_whfast_apply_corrector(struct reb_simulation* r, double inv, int order, void (*corrector_Z)(struct reb_simulation*, const double, const double)){
-    const double dt = r->dt;
-    if (order==3){
-        // Third order corrector
-        corrector_Z(r, reb_whfast_corrector_a_1*dt,-inv*reb_whfast_corrector_b_31*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_1*dt,inv*reb_whfast_corrector_b_31*dt);
-    }
-    if (order==5){
-        // Fifth order corrector
-        corrector_Z(r, -reb_whfast_corrector_a_2*dt,-inv*reb_whfast_corrector_b_51*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_1*dt,-inv*reb_whfast_corrector_b_52*dt);
-        corrector_Z(r, reb_whfast_corrector_a_1*dt,inv*reb_whfast_corrector_b_52*dt);
-        corrector_Z(r, reb_whfast_corrector_a_2*dt,inv*reb_whfast_corrector_b_51*dt);
-    }
-    if (order==7){
-        // Seventh order corrector
-        corrector_Z(r, -reb_whfast_corrector_a_3*dt,-inv*reb_whfast_corrector_b_71*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_2*dt,-inv*reb_whfast_corrector_b_72*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_1*dt,-inv*reb_whfast_corrector_b_73*dt);
-        corrector_Z(r, reb_whfast_corrector_a_1*dt,inv*reb_whfast_corrector_b_73*dt);
-        corrector_Z(r, reb_whfast_corrector_a_2*dt,inv*reb_whfast_corrector_b_72*dt);
-        corrector_Z(r, reb_whfast_corrector_a_3*dt,inv*reb_whfast_corrector_b_71*dt);
-    }
-    if (order==11){
-        // Eleventh order corrector
-        corrector_Z(r, -reb_whfast_corrector_a_5*dt,-inv*reb_whfast_corrector_b_111*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_4*dt,-inv*reb_whfast_corrector_b_112*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_3*dt,-inv*reb_whfast_corrector_b_113*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_2*dt,-inv*reb_whfast_corrector_b_114*dt);
-        corrector_Z(r, -reb_whfast_corrector_a_1*dt,-inv*reb_whfast_corrector_b_115*dt);
-        corrector_Z(r, reb_whfast_corrector_a_1*dt,inv*reb_whfast_corrector_b_115*dt);
-        corrector_Z(r, reb_whfast_corrector_a_2*dt,inv*reb_whfast_corrector_b_114*dt);
-        corrector_Z(r, reb_whfast_corrector_a_3*dt,inv*reb_whfast_corrector_b_113*dt);
-        corrector_Z(r, reb_whfast_corrector_a_4*dt,inv*reb_whfast_corrector_b_112*dt);
-        corrector_Z(r, reb_whfast_corrector_a_5*dt,inv*reb_whfast_corrector_b_111*dt);
+/**
+ * Returns 1 if positions, velocities and masses of all particles are the same as 
+ * right after the last synchronization.
+ */
+static int reb_whfast_particles_unchanged(const struct reb_simulation* const r){
+    const struct reb_particle* const p = r->particles;
+    const struct reb_particle* const q = r->ri_whfast.particles_resume;
+    for (int i=0;i<r->N;i++){
+        if (reb_whfast_particle_changed(p+i, q+i)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Updates the Jacobi coordinates after particles have been modified at a synchronization
+ * point. The modified (dirty) particles are found by comparing them to particles_resume,
+ * which is consistent with the synchronized Jacobi coordinates in p_j.
+ * The Jacobi coordinates of the particles before the first modified one do not change.
+ * The centre of mass of these particles is recovered from the unmodified Jacobi 
+ * coordinates of the remainder of the chain, so that only the suffix of the chain
+ * is transformed again. Massless test particles only depend on themselves and the 
+ * centre of mass; they are only updated if modified or if the centre of mass changed.
+ * Returns 0 if the Jacobi coordinates need to be recalculated from scratch.
+ */
+static int reb_whfast_update_jacobi(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    const struct reb_particle* const particles = r->particles;
+    const struct reb_particle* const q = ri_whfast->particles_resume;
+    struct reb_particle* const p_j = ri_whfast->p_j;
+    double* const eta = ri_whfast->eta;
+    const int N_real = r->N-r->N_var;
+    const int N_massive = ri_whfast->N_massive;
+    if (N_massive==0 || N_massive>N_real || reb_whfast_N_massive(r, N_real)!=N_massive){
+        return 0;
+    }
+    int k = N_massive; // First modified particle in the Jacobi chain
+    for (int i=0;i<N_massive;i++){
+        if (reb_whfast_particle_changed(particles+i, q+i)){
+            k = i;
+            break;
+        }
+    }
+    if (k==0){
+        return 0;
+    }
+    if (k<N_massive){
+        // Walk down the old chain to get eta[k-1] times the centre of mass of particles 0 to k-1.
+        const double Mtotal = eta[N_massive-1];
+        double s_x  = p_j[0].x  * Mtotal;
+        double s_y  = p_j[0].y  * Mtotal;
+        double s_z  = p_j[0].z  * Mtotal;
+        double s_vx = p_j[0].vx * Mtotal;
+        double s_vy = p_j[0].vy * Mtotal;
+        double s_vz = p_j[0].vz * Mtotal;
+        for (int i=N_massive-1;i>=k;i--){
+            const double m = p_j[i].m;
+            const double ei = eta[i-1]/eta[i];
+            s_x  = (s_x  - m * p_j[i].x ) * ei;
+            s_y  = (s_y  - m * p_j[i].y ) * ei;
+            s_z  = (s_z  - m * p_j[i].z ) * ei;
+            s_vx = (s_vx - m * p_j[i].vx) * ei;
+            s_vy = (s_vy - m * p_j[i].vy) * ei;
+            s_vz = (s_vz - m * p_j[i].vz) * ei;
+        }
+        for (int i=k;i<N_real;i++){
+            eta[i] = eta[i-1] + particles[i].m;
+            p_j[i].m = particles[i].m;
+        }
+        // Same as reb_transformations_inertial_to_jacobi_posvel(), starting at particle k.
+        for (int i=k;i<N_massive;i++){
+            const double ei = 1./eta[i-1];
+            const struct reb_particle pi = particles[i];
+            const double pme = eta[i]*ei;
+            p_j[i].x = pi.x - s_x*ei;
+            p_j[i].y = pi.y - s_y*ei;
+            p_j[i].z = pi.z - s_z*ei;
+            p_j[i].vx = pi.vx - s_vx*ei;
+            p_j[i].vy = pi.vy - s_vy*ei;
+            p_j[i].vz = pi.vz - s_vz*ei;
+            s_x  = s_x  * pme + pi.m*p_j[i].x ;
+            s_y  = s_y  * pme + pi.m*p_j[i].y ;
+            s_z  = s_z  * pme + pi.m*p_j[i].z ;
+            s_vx = s_vx * pme + pi.m*p_j[i].vx;
+            s_vy = s_vy * pme + pi.m*p_j[i].vy;
+            s_vz = s_vz * pme + pi.m*p_j[i].vz;
+        }
+        const double Mtotali = 1./eta[N_massive-1];
+        p_j[0].x = s_x * Mtotali;
+        p_j[0].y = s_y * Mtotali;
+        p_j[0].z = s_z * Mtotali;
+        p_j[0].vx = s_vx * Mtotali;
+        p_j[0].vy = s_vy * Mtotali;
+        p_j[0].vz = s_vz * Mtotali;
+    }
+    const struct reb_particle com = p_j[0];
+    const int com_changed = k<N_massive;
+#pragma omp parallel for
+    for (int i=N_massive;i<N_real;i++){
+        if (com_changed || reb_whfast_particle_changed(particles+i, q+i)){
+            p_j[i].x = particles[i].x - com.x;
+            p_j[i].y = particles[i].y - com.y;
+            p_j[i].z = particles[i].z - com.z;
+            p_j[i].vx = particles[i].vx - com.vx;
+            p_j[i].vy = particles[i].vy - com.vy;
+            p_j[i].vz = particles[i].vz - com.vz;
+        }
+    }
+    return 1;
+}
+
+void reb_whfast_calculate_jacobi(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
+    struct reb_particle* restrict const particles = r->particles;
+    const int N = r->N;
+    const int N_real = N-r->N_var;
+    ri_whfast->eta[0] = particles[0].m;
+    ri_whfast->p_j[0].m = particles[0].m;
+    for (int i=1;i<N_real;i++){
+        ri_whfast->eta[i] = ri_whfast->eta[i-1] + particles[i].m;
+        ri_whfast->p_j[i].m = particles[i].m;
+    }
+    for (int i=N_real;i<N;i++){
+        ri_whfast->p_j[i].m = particles[i].m;
+    }
+    ri_whfast->recalculate_jacobi_this_timestep = 0;
+    ri_whfast->N_massive = reb_whfast_N_massive(r, N_real);
+    reb_whfast_inertial_to_jacobi_posvel(r, N_real);
+    for (int v=0;v<r->var_config_N;v++){
+        struct reb_variational_configuration const vc = r->var_config[v];
+        reb_transformations_inertial_to_jacobi_posvel(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
     }
 }
 
@@ -465,12 +928,30 @@ void reb_integrator_whfast_part1(struct reb_simulation* const r){
     const int N = r->N;
     const int N_real = N-r->N_var;
     r->gravity_ignore_terms = 1;
-    if (ri_whfast->allocated_N != N){
+    if ((int)ri_whfast->allocated_N != N){
+        const int N_keep = (int)ri_whfast->allocated_N<N?(int)ri_whfast->allocated_N:N;
         ri_whfast->allocated_N = N;
-        ri_whfast->p_j = realloc(ri_whfast->p_j,sizeof(struct reb_particle)*N);
+        ri_whfast->p_j = reb_tools_realloc(r, ri_whfast->p_j, sizeof(struct reb_particle)*N_keep, sizeof(struct reb_particle)*N);
         ri_whfast->eta = realloc(ri_whfast->eta,sizeof(double)*N_real);
         ri_whfast->recalculate_jacobi_this_timestep = 1;
     }
+    // Resume from the unsynchronized Jacobi coordinates if the particles have 
+    // not been touched since the last synchronization. This avoids applying
+    // the corrector again. If particles have been modified, the simulation
+    // needs to stay synchronized (a modification does not commute with the 
+    // drift) but only the modified part of the Jacobi chain is recalculated.
+    if (ri_whfast->resume_N){
+        if (ri_whfast->is_synchronized && ri_whfast->safe_mode==0 && (int)ri_whfast->resume_N==N){
+            if (ri_whfast->resume_dt==r->dt && reb_whfast_particles_unchanged(r)){
+                memcpy(ri_whfast->p_j, ri_whfast->p_j_resume, sizeof(struct reb_particle)*N);
+                ri_whfast->is_synchronized = 0;
+                ri_whfast->recalculate_jacobi_this_timestep = 0;
+            }else if (ri_whfast->recalculate_jacobi_this_timestep && reb_whfast_update_jacobi(r)){
+                ri_whfast->recalculate_jacobi_this_timestep = 0;
+            }
+        }
+        ri_whfast->resume_N = 0;
+    }
     // Only recalculate Jacobi coordinates if needed
     if (ri_whfast->safe_mode || ri_whfast->recalculate_jacobi_this_timestep){
         if (ri_whfast->is_synchronized==0){
@@ -480,27 +961,13 @@ void reb_integrator_whfast_part1(struct reb_simulation* const r){
                 ri_whfast->recalculate_jacobi_but_not_synchronized_warning++;
             }
         }
-        ri_whfast->eta[0] = particles[0].m;
-        ri_whfast->p_j[0].m = particles[0].m;
-        for (unsigned int i=1;i<N_real;i++){
-            ri_whfast->eta[i] = ri_whfast->eta[i-1] + particles[i].m;
-            ri_whfast->p_j[i].m = particles[i].m;
-        }
-        for (unsigned int i=N_real;i<N;i++){
-            ri_whfast->p_j[i].m = particles[i].m;
-        }
-        ri_whfast->recalculate_jacobi_this_timestep = 0;
-        reb_transformations_inertial_to_jacobi_posvel(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
-        for (int v=0;v<r->var_config_N;v++){
-            struct reb_variational_configuration const vc = r->var_config[v];
-            reb_transformations_inertial_to_jacobi_posvel(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
-        }
+        reb_whfast_calculate_jacobi(r);
     }
     double _dt2 = r->dt/2.;
     if (ri_whfast->is_synchronized){
         // First half DRIFT step
         if (ri_whfast->corrector){
-            reb_whfast_apply_corrector(r, 1., ri_whfast->corrector, reb_whfast_corrector_Z);
+            reb_whfast_apply_corrector(r, 1., ri_whfast->corrector);
         }
         kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, _dt2, N_real);    // half timestep
     }else{
@@ -509,9 +976,9 @@ void reb_integrator_whfast_part1(struct reb_simulation* const r){
     }
     // Prepare coordinates for KICK step
     if (r->force_is_velocity_dependent){
-        reb_transformations_jacobi_to_inertial_posvel(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
+        reb_whfast_jacobi_to_inertial_posvel(r, N_real);
     }else{
-        reb_transformations_jacobi_to_inertial_pos(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
+        reb_whfast_jacobi_to_inertial_pos(r, N_real);
     }
     
     for (int v=0;v<r->var_config_N;v++){
@@ -538,11 +1005,23 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
             sync_pj = malloc(sizeof(struct reb_particle)*r->N);
             memcpy(sync_pj,r->ri_whfast.p_j,r->N*sizeof(struct reb_particle));
         }
+        // Without safe_mode, keep the unsynchronized coordinates so that 
+        // the next step can continue from them (see reb_integrator_whfast_part1()).
+        // The MEGNO update modifies the Jacobi coordinates after synchronizing.
+        const int resume = ri_whfast->safe_mode==0 && ri_whfast->keep_unsynchronized==0 && r->var_config_N==0;
+        if (resume){
+            if ((int)ri_whfast->resume_allocated_N<r->N){
+                ri_whfast->resume_allocated_N = r->N;
+                ri_whfast->p_j_resume = realloc(ri_whfast->p_j_resume, sizeof(struct reb_particle)*r->N);
+                ri_whfast->particles_resume = realloc(ri_whfast->particles_resume, sizeof(struct reb_particle)*r->N);
+            }
+            memcpy(ri_whfast->p_j_resume, ri_whfast->p_j, sizeof(struct reb_particle)*r->N);
+        }
         kepler_drift(r, ri_whfast->p_j, ri_whfast->eta, r->G, r->dt/2., N_real);
         if (ri_whfast->corrector){
-            reb_whfast_apply_corrector(r, -1., ri_whfast->corrector, reb_whfast_corrector_Z);
+            reb_whfast_apply_corrector(r, -1., ri_whfast->corrector);
         }
-        reb_transformations_jacobi_to_inertial_posvel(r->particles, ri_whfast->p_j, ri_whfast->eta, r->particles, N_real);
+        reb_whfast_jacobi_to_inertial_posvel(r, N_real);
         for (int v=0;v<r->var_config_N;v++){
             struct reb_variational_configuration const vc = r->var_config[v];
             reb_transformations_jacobi_to_inertial_posvel(r->particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta,r-> particles, N_real);
@@ -553,6 +1032,11 @@ void reb_integrator_whfast_synchronize(struct reb_simulation* const r){
         }else{
             ri_whfast->is_synchronized = 1;
         }
+        if (resume){
+            memcpy(ri_whfast->particles_resume, r->particles, sizeof(struct reb_particle)*r->N);
+            ri_whfast->resume_N = r->N;
+            ri_whfast->resume_dt = r->dt;
+        }
     }
 }
 
@@ -560,12 +1044,12 @@ void reb_integrator_whfast_part2(struct reb_simulation* const r){
     struct reb_particle* restrict const particles = r->particles;
     struct reb_simulation_integrator_whfast* const ri_whfast = &(r->ri_whfast);
     const int N_real = r->N-r->N_var;
-    reb_transformations_inertial_to_jacobi_acc(particles, ri_whfast->p_j, ri_whfast->eta, particles, N_real);
+    reb_whfast_inertial_to_jacobi_acc(r, N_real);
     for (int v=0;v<r->var_config_N;v++){
         struct reb_variational_configuration const vc = r->var_config[v];
         reb_transformations_inertial_to_jacobi_acc(particles+vc.index, ri_whfast->p_j+vc.index, ri_whfast->eta, particles, N_real);
     }
-    interaction_step(r, ri_whfast->p_j, ri_whfast->eta, r->G, r->softening, r->dt, N_real);
+    reb_whfast_interaction_step(r, r->dt, N_real);
 
     double _dt2 = r->dt/2.;
     ri_whfast->is_synchronized = 0;
@@ -641,6 +1125,7 @@ void reb_integrator_whfast_reset(struct reb_simulation* const r){
     ri_whfast->allocated_N = 0;
     ri_whfast->timestep_warning = 0;
     ri_whfast->recalculate_jacobi_but_not_synchronized_warning = 0;
+    ri_whfast->N_massive = 0;
     if (ri_whfast->p_j){
         free(ri_whfast->p_j);
         ri_whfast->p_j = NULL;
@@ -649,4 +1134,10 @@ void reb_integrator_whfast_reset(struct reb_simulation* const r){
         free(ri_whfast->eta);
         ri_whfast->eta = NULL;
     }
+    free(ri_whfast->p_j_resume);
+    free(ri_whfast->particles_resume);
+    ri_whfast->p_j_resume = NULL;
+    ri_whfast->particles_resume = NULL;
+    ri_whfast->resume_N = 0;
+    ri_whfast->resume_allocated_N = 0;
 }
@@ -29,6 +29,26 @@ void reb_integrator_whfast_part2(struct reb_simulation* r);		///< Internal funct
 void reb_integrator_whfast_synchronize(struct reb_simulation* r);	///< Internal function used to call a specific integrator
 void reb_integrator_whfast_reset(struct reb_simulation* r);		///< Internal function used to call a specific integrator
 void kepler_step(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double M, unsigned int i, double _dt);   ///< Internal function (Main WHFast Kepler Solver)
+#define WHFAST_KEPLER_BATCH 8   ///< Number of particles in kepler_step_batch()
+void kepler_step_batch(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double* const restrict M, unsigned int i, double _dt);   ///< Internal function (kepler_step() for particles i to i+WHFAST_KEPLER_BATCH-1 at once, same results, no variational particles)
 
-void reb_whfast_apply_corrector(struct reb_simulation* r, double inv, int order, void (*corrector_Z)(struct reb_simulation*, const double, const double)); ///< Internal function to apply correctors according to Wisdom (2006). 
+/**
+ * @brief Internal function. Returns 1 if the position, velocity or mass of p differs from the one of q.
+ */
+static inline int reb_whfast_particle_changed(const struct reb_particle* const p, const struct reb_particle* const q){
+    return p->x!=q->x || p->y!=q->y || p->z!=q->z
+        || p->vx!=q->vx || p->vy!=q->vy || p->vz!=q->vz
+        || p->m!=q->m;
+}
+
+void reb_whfast_apply_corrector(struct reb_simulation* r, double inv, int order); ///< Internal function to apply correctors according to Wisdom (2006). 
+
+// Building blocks shared with other integrators working in Jacobi coordinates (SABA).
+// They operate on r->ri_whfast.p_j and r->ri_whfast.eta, which need to be allocated.
+void reb_whfast_calculate_jacobi(struct reb_simulation* const r);  ///< Internal function (Jacobi masses and Jacobi coordinates from the inertial ones)
+void reb_whfast_kepler_drift(struct reb_simulation* const r, const double _dt);  ///< Internal function (Drift of all particles in Jacobi coordinates)
+void reb_whfast_interaction_step(struct reb_simulation* const r, const double _dt, const int N_real);  ///< Internal function (Kick of all particles using the Jacobi accelerations)
+void reb_whfast_inertial_to_jacobi_acc(struct reb_simulation* const r, const int N_real);  ///< Internal function (Jacobi accelerations of the massive particles)
+void reb_whfast_jacobi_to_inertial_pos(struct reb_simulation* const r, const int N_real);  ///< Internal function (Inertial positions from Jacobi coordinates)
+void reb_whfast_jacobi_to_inertial_posvel(struct reb_simulation* const r, const int N_real);  ///< Internal function (Inertial positions and velocities from Jacobi coordinates)
 #endif
@@ -39,11 +39,18 @@
 #include <string.h>
 #include <sys/time.h>
 #include "rebound.h"
+#include "tools.h"
 #include "particle.h"
 #include "gravity.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
 #include "integrator_whfasthelio.h"
+#include "profiling.h"
+
+// Below these numbers of particles the operators run on one thread.
+// A Kepler solve costs much more than a jump or a kick, so it pays off earlier.
+#define WHFASTHELIO_PARALLEL_N 1024
+#define WHFASTHELIO_PARALLEL_KEPLER_N 64
 
 /***************************** 
  * Operators                 */
@@ -52,30 +59,33 @@ static void reb_whfasthelio_jump_step(const struct reb_simulation* const r, doub
     struct reb_particle* const p_h = r->ri_whfasthelio.p_h;
     const double m0 = r->particles[0].m;
     double px=0, py=0, pz=0;
+#pragma omp parallel for simd reduction(+:px,py,pz) if(N_real>=WHFASTHELIO_PARALLEL_N && !r->reproducible)
     for(int i=1;i<N_real;i++){
-        const double m = r->particles[i].m;
-        px += m * p_h[i].vx / (m0+m);
-        py += m * p_h[i].vy / (m0+m);
-        pz += m * p_h[i].vz / (m0+m);
+        const double mf = p_h[i].m/(m0+p_h[i].m);
+        px += mf * p_h[i].vx;
+        py += mf * p_h[i].vy;
+        pz += mf * p_h[i].vz;
     }
+#pragma omp parallel for simd if(N_real>=WHFASTHELIO_PARALLEL_N)
     for(int i=1;i<N_real;i++){
-        const double m = r->particles[i].m;
-        p_h[i].x += _dt * (px - (m * p_h[i].vx / (m0+m)) );
-        p_h[i].y += _dt * (py - (m * p_h[i].vy / (m0+m)) );
-        p_h[i].z += _dt * (pz - (m * p_h[i].vz / (m0+m)) );
+        const double mf = p_h[i].m/(m0+p_h[i].m);
+        p_h[i].x += _dt * (px - mf * p_h[i].vx);
+        p_h[i].y += _dt * (py - mf * p_h[i].vy);
+        p_h[i].z += _dt * (pz - mf * p_h[i].vz);
     }
 }
 
 static void reb_whfasthelio_interaction_step(const struct reb_simulation* const r, const double _dt){
-    struct reb_particle* particles = r->particles;
+    struct reb_particle* const particles = r->particles;
     const int N_real = r->N-r->N_var;
     struct reb_particle* const p_h = r->ri_whfasthelio.p_h;
-    const double m0 = r->particles[0].m;   
-    for (unsigned int i=1;i<N_real;i++){
-        const double m = r->particles[i].m;  
-        p_h[i].vx += _dt*particles[i].ax*(m+m0)/m0;
-        p_h[i].vy += _dt*particles[i].ay*(m+m0)/m0;
-        p_h[i].vz += _dt*particles[i].az*(m+m0)/m0;
+    const double m0 = r->particles[0].m;
+#pragma omp parallel for simd if(N_real>=WHFASTHELIO_PARALLEL_N)
+    for (int i=1;i<N_real;i++){
+        const double f = _dt*(particles[i].m+m0)/m0;
+        p_h[i].vx += f*particles[i].ax;
+        p_h[i].vy += f*particles[i].ay;
+        p_h[i].vz += f*particles[i].az;
     }
 }
 
@@ -83,13 +93,101 @@ static void reb_whfasthelio_keplerstep(const struct reb_simulation* const r, con
     const int N_real = r->N-r->N_var;
     struct reb_particle* const p_h = r->ri_whfasthelio.p_h;
     const double m0 = r->particles[0].m;
-#pragma omp parallel for
-    for (unsigned int i=1;i<N_real;i++){
+    PROFILING_START(r, REB_PROFILING_CAT_KEPLER)
+    // Particles 1 to N_batch-1 are done in batches, the rest one at a time.
+    const int N_batch = (r->var_config_N==0)?1+(N_real-1)/WHFAST_KEPLER_BATCH*WHFAST_KEPLER_BATCH:1;
+#pragma omp parallel for schedule(static) if(N_real>=WHFASTHELIO_PARALLEL_KEPLER_N)
+    for (int i=1;i<N_batch;i+=WHFAST_KEPLER_BATCH){
+        double M[WHFAST_KEPLER_BATCH];
+        for (int l=0;l<WHFAST_KEPLER_BATCH;l++){
+            M[l] = r->G*(p_h[i+l].m + m0);
+        }
+        kepler_step_batch(r, p_h, M, i, _dt);
+    }
+#pragma omp parallel for if(N_real>=WHFASTHELIO_PARALLEL_KEPLER_N)
+    for (int i=N_batch;i<N_real;i++){
         kepler_step(r, p_h, r->G*(p_h[i].m + m0), i, _dt);
     }
     p_h[0].x += _dt*p_h[0].vx;
     p_h[0].y += _dt*p_h[0].vy;
     p_h[0].z += _dt*p_h[0].vz;
+    PROFILING_STOP(r, REB_PROFILING_CAT_KEPLER)
+}
+
+/**
+ * Updates the heliocentric coordinates after particles have been modified at a 
+ * synchronization point. The modified (dirty) particles are found by comparing 
+ * them to particles_sync, which is consistent with the synchronized coordinates in p_h.
+ * Only the modified particles and the centre of mass are transformed again. 
+ * If the barycentric velocity changed, the velocities of the other particles are shifted.
+ * Returns 0 if the heliocentric coordinates need to be recalculated from scratch.
+ */
+static int reb_whfasthelio_update_heliocentric(struct reb_simulation* const r){
+    struct reb_simulation_integrator_whfasthelio* const ri_whfasthelio = &(r->ri_whfasthelio);
+    const struct reb_particle* const particles = r->particles;
+    const struct reb_particle* const q = ri_whfasthelio->particles_sync;
+    struct reb_particle* const p_h = ri_whfasthelio->p_h;
+    const int N_real = r->N - r->N_var;
+    if (reb_whfast_particle_changed(particles, q)){
+        // All heliocentric positions change.
+        return 0;
+    }
+    double mtot = p_h[0].m;
+    double x  = p_h[0].x *mtot;
+    double y  = p_h[0].y *mtot;
+    double z  = p_h[0].z *mtot;
+    double vx = p_h[0].vx*mtot;
+    double vy = p_h[0].vy*mtot;
+    double vz = p_h[0].vz*mtot;
+    int N_dirty = 0;
+    for (int i=1;i<N_real;i++){
+        if (reb_whfast_particle_changed(particles+i, q+i)){
+            const double m = particles[i].m;
+            x  += m*particles[i].x  - q[i].m*q[i].x;
+            y  += m*particles[i].y  - q[i].m*q[i].y;
+            z  += m*particles[i].z  - q[i].m*q[i].z;
+            vx += m*particles[i].vx - q[i].m*q[i].vx;
+            vy += m*particles[i].vy - q[i].m*q[i].vy;
+            vz += m*particles[i].vz - q[i].m*q[i].vz;
+            mtot += m - q[i].m;
+            N_dirty++;
+        }
+    }
+    if (N_dirty==0){
+        return 1;
+    }
+    const double dvx = p_h[0].vx - vx/mtot;
+    const double dvy = p_h[0].vy - vy/mtot;
+    const double dvz = p_h[0].vz - vz/mtot;
+    p_h[0].x  = x /mtot;
+    p_h[0].y  = y /mtot;
+    p_h[0].z  = z /mtot;
+    p_h[0].vx = vx/mtot;
+    p_h[0].vy = vy/mtot;
+    p_h[0].vz = vz/mtot;
+    p_h[0].m  = mtot;
+    const int shift = dvx!=0. || dvy!=0. || dvz!=0.;
+
+    const double m0 = particles[0].m;
+    const double m0i = 1./m0;
+    const struct reb_particle com = p_h[0];
+    for (int i=1;i<N_real;i++){
+        const double mf = (m0 + particles[i].m)*m0i;
+        if (reb_whfast_particle_changed(particles+i, q+i)){
+            p_h[i].x  = particles[i].x  - particles[0].x;
+            p_h[i].y  = particles[i].y  - particles[0].y;
+            p_h[i].z  = particles[i].z  - particles[0].z;
+            p_h[i].vx = mf*(particles[i].vx - com.vx);
+            p_h[i].vy = mf*(particles[i].vy - com.vy);
+            p_h[i].vz = mf*(particles[i].vz - com.vz);
+            p_h[i].m  = particles[i].m;
+        }else if (shift){
+            p_h[i].vx += mf*dvx;
+            p_h[i].vy += mf*dvy;
+            p_h[i].vz += mf*dvz;
+        }
+    }
+    return 1;
 }
 
 void reb_integrator_whfasthelio_part1(struct reb_simulation* const r){
@@ -102,12 +200,23 @@ void reb_integrator_whfasthelio_part1(struct reb_simulation* const r){
     r->gravity_ignore_terms = 2;
 
 
-    if (ri_whfasthelio->allocated_N != N_real){
+    if ((int)ri_whfasthelio->allocated_N != N_real){
         ri_whfasthelio->allocated_N = N_real;
-        ri_whfasthelio->p_h = realloc(ri_whfasthelio->p_h,sizeof(struct reb_particle)*N_real);
+        ri_whfasthelio->p_h = reb_tools_realloc(r, ri_whfasthelio->p_h, 0, sizeof(struct reb_particle)*N_real);
         ri_whfasthelio->recalculate_heliocentric_this_timestep = 1;
     }
 
+    // Particles have been modified since the last synchronization. 
+    // Only update the coordinates of the modified ones.
+    if (ri_whfasthelio->sync_N){
+        if (ri_whfasthelio->recalculate_heliocentric_this_timestep && ri_whfasthelio->is_synchronized 
+                && ri_whfasthelio->safe_mode==0 && (int)ri_whfasthelio->sync_N==N_real
+                && reb_whfasthelio_update_heliocentric(r)){
+            ri_whfasthelio->recalculate_heliocentric_this_timestep = 0;
+        }
+        ri_whfasthelio->sync_N = 0;
+    }
+
     if (ri_whfasthelio->safe_mode || ri_whfasthelio->recalculate_heliocentric_this_timestep == 1){
         if (ri_whfasthelio->is_synchronized==0){
             reb_integrator_whfasthelio_synchronize(r);
@@ -157,6 +266,14 @@ void reb_integrator_whfasthelio_synchronize(struct reb_simulation* const r){
             free(sync_ph);
         }else{
             ri_whfasthelio->is_synchronized=1;
+            if (ri_whfasthelio->safe_mode==0){
+                if ((int)ri_whfasthelio->sync_allocated_N<N_real){
+                    ri_whfasthelio->sync_allocated_N = N_real;
+                    ri_whfasthelio->particles_sync = realloc(ri_whfasthelio->particles_sync, sizeof(struct reb_particle)*N_real);
+                }
+                memcpy(ri_whfasthelio->particles_sync, particles, sizeof(struct reb_particle)*N_real);
+                ri_whfasthelio->sync_N = N_real;
+            }
         }
     }
 }
@@ -187,4 +304,8 @@ void reb_integrator_whfasthelio_reset(struct reb_simulation* const r){
         free(ri_whfasthelio->p_h);
         ri_whfasthelio->p_h = NULL;
     }
+    free(ri_whfasthelio->particles_sync);
+    ri_whfasthelio->particles_sync = NULL;
+    ri_whfasthelio->sync_N = 0;
+    ri_whfasthelio->sync_allocated_N = 0;
 }
@@ -0,0 +1,160 @@
+/**
+ * @file 	metrics.c
+ * @brief 	Counters of the work done by a simulation and their export.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	The counters in r->metrics are incremented where the work is
+ * done (timesteps, force interactions, collisions, IAS15 iterations, ...).
+ * Unlike the profiling timers, they are always enabled. Only the wall time
+ * needs a system call, once at the beginning and once at the end of every
+ * integration. Rates are calculated when the metrics are read. The metrics
+ * can be exported in the OpenMetrics text format, which monitoring systems
+ * such as Prometheus can scrape.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/time.h>
+#include "rebound.h"
+#include "tools.h"
+#include "metrics.h"
+
+static double reb_metrics_time(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+void reb_metrics_reset(struct reb_simulation* const r){
+    const double walltime_start = r->metrics.walltime_start;
+    memset(&r->metrics, 0, sizeof(struct reb_metrics));
+    r->metrics.energy_initial = NAN;
+    r->metrics.energy_drift = NAN;
+    if (walltime_start!=0.){
+        // Integration is running, measure from now on.
+        r->metrics.walltime_start = reb_metrics_time();
+    }
+}
+
+void reb_metrics_integrate_start(struct reb_simulation* const r){
+    r->metrics.walltime_start = reb_metrics_time();
+}
+
+void reb_metrics_integrate_stop(struct reb_simulation* const r){
+    if (r->metrics.walltime_start!=0.){
+        r->metrics.walltime += reb_metrics_time()-r->metrics.walltime_start;
+        r->metrics.walltime_start = 0.;
+    }
+}
+
+struct reb_metrics reb_metrics_get(struct reb_simulation* const r, const int energy){
+    if (energy){
+        const double E = reb_tools_energy(r);
+        if (isnan(r->metrics.energy_initial)){
+            r->metrics.energy_initial = E;
+        }
+        const double E0 = r->metrics.energy_initial;
+        r->metrics.energy_drift = E0!=0.?fabs((E-E0)/E0):fabs(E-E0);
+    }
+    struct reb_metrics m = r->metrics;
+    if (m.walltime_start!=0.){
+        m.walltime += reb_metrics_time()-m.walltime_start;
+    }
+    if (m.walltime>0.){
+        m.steps_per_second = m.steps/m.walltime;
+        m.interactions_per_second = m.interactions/m.walltime;
+        m.collisions_per_second = m.collisions_found/m.walltime;
+    }
+    return m;
+}
+
+int reb_metrics_openmetrics(const struct reb_metrics* const m, char* const buf, const size_t size){
+    const struct {
+        const char* name;
+        const char* help;
+        uint64_t value;
+    } counters[] = {
+        {"steps", "Completed timesteps.", m->steps},
+        {"interactions", "Particle-particle and particle-cell force interactions.", m->interactions},
+        {"tree_cells_opened", "Tree cells opened in the gravity calculation.", m->cells_opened},
+        {"collisions_found", "Collisions found by the collision search.", m->collisions_found},
+        {"collisions_resolved", "Collisions passed to the collision resolve function.", m->collisions_resolved},
+        {"ias15_iterations", "Predictor corrector iterations of IAS15.", m->ias15_iterations},
+        {"ias15_rejections", "Rejected IAS15 timesteps.", m->ias15_rejections},
+        {"hermes_activations", "Timesteps in which the HERMES mini simulation became active.", m->hermes_activations},
+        {"simulationarchive_bytes", "Bytes written to the Simulation Archive.", m->simulationarchive_bytes},
+    };
+    const struct {
+        const char* name;
+        const char* help;
+        double value;
+    } gauges[] = {
+        {"steps_per_second", "Timesteps per second of wall time.", m->steps_per_second},
+        {"interactions_per_second", "Force interactions per second of wall time.", m->interactions_per_second},
+        {"collisions_per_second", "Collisions found per second of wall time.", m->collisions_per_second},
+        {"energy_drift", "Relative energy error.", m->energy_drift},
+    };
+    size_t n = 0;
+    // Appends to buf as long as there is space, but always counts the full length.
+#define REB_METRICS_PRINTF(...) n += snprintf(n<size?buf+n:NULL, n<size?size-n:0, __VA_ARGS__)
+    for (size_t i=0;i<sizeof(counters)/sizeof(counters[0]);i++){
+        REB_METRICS_PRINTF("# TYPE rebound_%s counter\n# HELP rebound_%s %s\nrebound_%s_total %llu\n", counters[i].name, counters[i].name, counters[i].help, counters[i].name, (unsigned long long)counters[i].value);
+    }
+    REB_METRICS_PRINTF("# TYPE rebound_walltime_seconds counter\n# UNIT rebound_walltime_seconds seconds\n# HELP rebound_walltime_seconds Wall time spent integrating.\nrebound_walltime_seconds_total %.17g\n", m->walltime);
+    for (size_t i=0;i<sizeof(gauges)/sizeof(gauges[0]);i++){
+        if (isnan(gauges[i].value)){
+            REB_METRICS_PRINTF("# TYPE rebound_%s gauge\n# HELP rebound_%s %s\nrebound_%s NaN\n", gauges[i].name, gauges[i].name, gauges[i].help, gauges[i].name);
+        }else{
+            REB_METRICS_PRINTF("# TYPE rebound_%s gauge\n# HELP rebound_%s %s\nrebound_%s %.17g\n", gauges[i].name, gauges[i].name, gauges[i].help, gauges[i].name, gauges[i].value);
+        }
+    }
+    REB_METRICS_PRINTF("# EOF\n");
+#undef REB_METRICS_PRINTF
+    return (int)n;
+}
+
+int reb_output_metrics(struct reb_simulation* const r, const char* const filename){
+    const struct reb_metrics m = reb_metrics_get(r, 0);
+    const int n = reb_metrics_openmetrics(&m, NULL, 0);
+    char* const buf = malloc(n+1);
+    reb_metrics_openmetrics(&m, buf, n+1);
+    char* const tmpname = malloc(strlen(filename)+5);
+    sprintf(tmpname, "%s.tmp", filename);
+    FILE* of = fopen(tmpname, "w");
+    if (of==NULL){
+        reb_error(r, "Can not open file.");
+        free(tmpname);
+        free(buf);
+        return -1;
+    }
+    const size_t written = fwrite(buf, 1, n, of);
+    const int error = fclose(of) || written!=(size_t)n || rename(tmpname, filename);
+    if (error){
+        remove(tmpname);
+        reb_error(r, "Error while writing metrics file.");
+    }
+    free(tmpname);
+    free(buf);
+    return error?-1:0;
+}
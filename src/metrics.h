@@ -0,0 +1,40 @@
+/**
+ * @file 	metrics.h
+ * @brief 	Counters of the work done by a simulation and their export.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/**
+  * @brief Starts measuring the wall time of an integration.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_metrics_integrate_start(struct reb_simulation* const r);
+
+/**
+  * @brief Adds the wall time since reb_metrics_integrate_start() to the metrics.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_metrics_integrate_stop(struct reb_simulation* const r);
+
+#endif // _METRICS_H
@@ -28,6 +28,8 @@
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include "particle.h"
 #include "rebound.h"
@@ -36,6 +38,7 @@
 #include "integrator.h"
 #include "integrator_sei.h"
 #include "input.h"
+#include "tree.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #include "mpi.h"
@@ -61,25 +64,6 @@ int reb_output_check(struct reb_simulation* r, double interval){
 }
 
 
-#ifdef PROFILING
-#warning PROFILING enabled. Rebound is NOT thread-safe.
-double profiling_time_sum[PROFILING_CAT_NUM];
-double profiling_time_initial   = 0;
-double profiling_timing_initial = 0;
-double profiling_time_final     = 0;
-void profiling_start(void){
-    struct timeval tim;
-    gettimeofday(&tim, NULL);
-    profiling_time_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-}
-void profiling_stop(int cat){
-    struct timeval tim;
-    gettimeofday(&tim, NULL);
-    profiling_time_final = tim.tv_sec+(tim.tv_usec/1000000.0);
-    profiling_time_sum[cat] += profiling_time_final - profiling_time_initial;
-}
-#endif // PROFILING
-
 void reb_output_timing(struct reb_simulation* r, const double tmax){
     const int N = r->N;
 #ifdef MPI
@@ -96,12 +80,12 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
         r->output_timing_last = temp;
     }else{
         printf("\r");
-#ifdef PROFILING
-        fputs("\033[A\033[2K",stdout);
-        for (int i=0;i<=PROFILING_CAT_NUM;i++){
+        if (r->profiling){
             fputs("\033[A\033[2K",stdout);
+            for (int i=0;i<REB_PROFILING_CAT_N;i++){ // header and one line per region
+                fputs("\033[A\033[2K",stdout);
+            }
         }
-#endif // PROFILING
     }
     printf("N_tot= %- 9d  ",N_tot);
     if (r->integrator==REB_INTEGRATOR_SEI){
@@ -114,45 +98,31 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
     if (tmax>0){
         printf("t/tmax= %5.2f%%",r->t/tmax*100.0);
     }
-#ifdef PROFILING
-    if (profiling_timing_initial==0){
-        struct timeval tim;
-        gettimeofday(&tim, NULL);
-        profiling_timing_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-    }
-    printf("\nCATEGORY       TIME \n");
-    double _sum = 0;
-    for (int i=0;i<=PROFILING_CAT_NUM;i++){
-        switch (i){
-            case PROFILING_CAT_INTEGRATOR:
-                printf("Integrator     ");
-                break;
-            case PROFILING_CAT_BOUNDARY:
-                printf("Boundary check ");
-                break;
-            case PROFILING_CAT_GRAVITY:
-                printf("Gravity/Forces ");
-                break;
-            case PROFILING_CAT_COLLISION:
-                printf("Collisions     ");
-                break;
-#ifdef OPENGL
-            case PROFILING_CAT_VISUALIZATION:
-                printf("Visualization  ");
-                break;
-#endif // OPENGL
-            case PROFILING_CAT_NUM:
-                printf("Other          ");
-                break;
-        }
-        if (i==PROFILING_CAT_NUM){
-            printf("%5.2f%%",(1.-_sum/(profiling_time_final - profiling_timing_initial))*100.);
-        }else{
-            printf("%5.2f%%\n",profiling_time_sum[i]/(profiling_time_final - profiling_timing_initial)*100.);
-            _sum += profiling_time_sum[i];
+    if (r->profiling){
+        struct reb_profiling_region regions[REB_PROFILING_CAT_N];
+        const double wall = reb_profiling_get(r, -1, regions);
+        const int counters = reb_profiling_get_counters_N(r)>0;
+        printf("\nCATEGORY             TIME %s\n",counters?"     IPC  LLC MISS":"");
+        double _sum = 0;
+        for (int i=0;i<REB_PROFILING_CAT_N;i++){
+            // Nested regions are indented. Only self times are summed, so nothing is counted twice.
+            if (regions[i].parent<0){
+                printf("%-21s",regions[i].name);
+            }else{
+                printf("  %-19s",regions[i].name);
+            }
+            _sum += regions[i].time_self;
+            printf("%6.2f%%",wall>0.?regions[i].time/wall*100.:0.);
+            if (counters){
+                const unsigned long long* const c = regions[i].counters;
+                printf("  %6.2f  %6.2f%%",
+                        c[REB_PROFILING_COUNTER_CYCLES]?(double)c[REB_PROFILING_COUNTER_INSTRUCTIONS]/c[REB_PROFILING_COUNTER_CYCLES]:0.,
+                        c[REB_PROFILING_COUNTER_CACHE_REFERENCES]?(double)c[REB_PROFILING_COUNTER_CACHE_MISSES]/c[REB_PROFILING_COUNTER_CACHE_REFERENCES]*100.:0.);
+            }
+            printf("\n");
         }
+        printf("%-21s%6.2f%%","other",wall>0.?(1.-_sum/wall)*100.:0.);
     }
-#endif // PROFILING
     fflush(stdout);
     r->output_timing_last = temp;
 }
@@ -208,6 +178,47 @@ void reb_save_dp7(struct reb_dp7* dp7, const int N3, FILE* of){
     fwrite(dp7->p6,sizeof(double),N3,of);
 }
 
+const struct reb_binary_column_layout reb_binary_column_layouts[] = {
+    {REB_BINARY_COLUMN_TYPE_X,              offsetof(struct reb_particle, x),               sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_Y,              offsetof(struct reb_particle, y),               sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_Z,              offsetof(struct reb_particle, z),               sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_VX,             offsetof(struct reb_particle, vx),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_VY,             offsetof(struct reb_particle, vy),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_VZ,             offsetof(struct reb_particle, vz),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_AX,             offsetof(struct reb_particle, ax),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_AY,             offsetof(struct reb_particle, ay),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_AZ,             offsetof(struct reb_particle, az),              sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_M,              offsetof(struct reb_particle, m),               sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_R,              offsetof(struct reb_particle, r),               sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_LASTCOLLISION,  offsetof(struct reb_particle, lastcollision),   sizeof(double)},
+    {REB_BINARY_COLUMN_TYPE_HASH,           offsetof(struct reb_particle, hash),            sizeof(uint32_t)},
+};
+const int reb_binary_column_layouts_N = sizeof(reb_binary_column_layouts)/sizeof(struct reb_binary_column_layout);
+
+void reb_save_particle_columns(const struct reb_particle* const particles, const int N, const enum REB_BINARY_FIELD_TYPE type, FILE* of){
+    struct reb_binary_field field = {.type = type, .size = sizeof(long)};
+    for (int c=0;c<reb_binary_column_layouts_N;c++){
+        field.size += sizeof(struct reb_binary_column) + reb_binary_column_layouts[c].size*N;
+    }
+    fwrite(&field,sizeof(struct reb_binary_field),1,of);
+    const long Nl = N;
+    fwrite(&Nl,sizeof(long),1,of);
+    // Columns are gathered in chunks, so only a small buffer is needed for large N.
+    char buffer[REB_BINARY_COLUMN_CHUNK*sizeof(double)];
+    for (int c=0;c<reb_binary_column_layouts_N;c++){
+        const struct reb_binary_column_layout l = reb_binary_column_layouts[c];
+        struct reb_binary_column column = {.type = l.type, .size = l.size*N};
+        fwrite(&column,sizeof(struct reb_binary_column),1,of);
+        for (int i=0;i<N;i+=REB_BINARY_COLUMN_CHUNK){
+            const int n = N-i<REB_BINARY_COLUMN_CHUNK?N-i:REB_BINARY_COLUMN_CHUNK;
+            for (int j=0;j<n;j++){
+                memcpy(buffer+j*l.size, (const char*)&particles[i+j]+l.offset, l.size);
+            }
+            fwrite(buffer,l.size,n,of);
+        }
+    }
+}
+
 // Macro to write a single field to a binary file.
 #define WRITE_FIELD(typename, value, length) {\
         struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_##typename, .size = (length)};\
@@ -215,20 +226,7 @@ void reb_save_dp7(struct reb_dp7* dp7, const int N3, FILE* of){
         fwrite(value,field.size,1,of);\
     }
 
-void reb_output_binary(struct reb_simulation* r, char* filename){
-#ifdef MPI
-    char filename_mpi[1024];
-    sprintf(filename_mpi,"%s_%d",filename,r->mpi_id);
-    FILE* of = fopen(filename_mpi,"wb"); 
-#else // MPI
-    FILE* of = fopen(filename,"wb"); 
-#endif // MPI
-    if (of==NULL){
-        reb_exit("Can not open file.");
-    }
-    // Init integrators. This helps with bit-by-bit reproducibility.
-    reb_integrator_init(r);
-
+void reb_output_binary_fields(struct reb_simulation* r, FILE* of){
     // Output header.
     const char str[] = "REBOUND Binary File. Version: ";
     char zero = '\0';
@@ -276,6 +274,7 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
     WRITE_FIELD(COLLISIONSPLOG,     &r->collisions_plog,                sizeof(double));
     WRITE_FIELD(MAXRADIUS,          &r->max_radius,                     2*sizeof(double));
     WRITE_FIELD(COLLISIONSNLOG,     &r->collisions_Nlog,                sizeof(long));
+    WRITE_FIELD(COLLISIONSSEED,     &r->collisions_seed,                sizeof(uint32_t));
     WRITE_FIELD(CALCULATEMEGNO,     &r->calculate_megno,                sizeof(int));
     WRITE_FIELD(MEGNOYS,            &r->megno_Ys,                       sizeof(double));
     WRITE_FIELD(MEGNOYSS,           &r->megno_Yss,                      sizeof(double));
@@ -289,6 +288,12 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
     WRITE_FIELD(SAINTERVALWALLTIME, &r->simulationarchive_interval_walltime, sizeof(double));
     WRITE_FIELD(SANEXT,             &r->simulationarchive_next,         sizeof(long));
     WRITE_FIELD(SAWALLTIME,         &r->simulationarchive_walltime,     sizeof(double));
+    WRITE_FIELD(SAFSYNCINTERVAL,    &r->simulationarchive_fsync_interval, sizeof(unsigned int));
+    WRITE_FIELD(SAASYNC,            &r->simulationarchive_async,        sizeof(unsigned int));
+    WRITE_FIELD(SACOMPRESSION,      &r->simulationarchive_compression,  sizeof(unsigned int));
+    WRITE_FIELD(SAKEYFRAMEINTERVAL, &r->simulationarchive_keyframe_interval, sizeof(unsigned int));
+    WRITE_FIELD(SAEXTRAS,           &r->simulationarchive_extras,       sizeof(unsigned int));
+    WRITE_FIELD(SAMEMBER,           &r->simulationarchive_member,       sizeof(long));
     WRITE_FIELD(COLLISION,          &r->collision,                      sizeof(int));
     WRITE_FIELD(VISUALIZATION,      &r->visualization,                  sizeof(int));
     WRITE_FIELD(INTEGRATOR,         &r->integrator,                     sizeof(int));
@@ -307,7 +312,7 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
     WRITE_FIELD(WHFAST_KEEPUNSYNC,  &r->ri_whfast.keep_unsynchronized,  sizeof(unsigned int));
     WRITE_FIELD(WHFAST_ISSYNCHRON,  &r->ri_whfast.is_synchronized,      sizeof(unsigned int));
     WRITE_FIELD(WHFAST_TIMESTEPWARN,&r->ri_whfast.timestep_warning,     sizeof(unsigned int));
-    WRITE_FIELD(WHFAST_PJ,          r->ri_whfast.p_j,                   sizeof(struct reb_particle)*r->ri_whfast.allocated_N);
+    reb_save_particle_columns(r->ri_whfast.p_j, r->ri_whfast.allocated_N, REB_BINARY_FIELD_TYPE_WHFAST_PJCOLUMNS, of);
     WRITE_FIELD(WHFAST_ETA,         r->ri_whfast.eta,                   sizeof(double)*r->ri_whfast.allocated_N);
     WRITE_FIELD(IAS15_EPSILON,      &r->ri_ias15.epsilon,               sizeof(double));
     WRITE_FIELD(IAS15_MINDT,        &r->ri_ias15.min_dt,                sizeof(double));
@@ -325,16 +330,56 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
     WRITE_FIELD(WHFASTH_SAFEMODE,   &r->ri_whfasthelio.safe_mode,       sizeof(unsigned int));
     WRITE_FIELD(WHFASTH_ISSYNCHRON, &r->ri_whfasthelio.is_synchronized, sizeof(unsigned int));
     WRITE_FIELD(WHFASTH_KEEPUNSYNC, &r->ri_whfasthelio.keep_unsynchronized, sizeof(unsigned int));
-    WRITE_FIELD(WHFASTH_PH,         r->ri_whfasthelio.p_h,              sizeof(struct reb_particle)*r->ri_whfasthelio.allocated_N);
+    reb_save_particle_columns(r->ri_whfasthelio.p_h, r->ri_whfasthelio.allocated_N, REB_BINARY_FIELD_TYPE_WHFASTH_PHCOLUMNS, of);
     WRITE_FIELD(JANUS_SCALEPOS,     &r->ri_janus.scale_pos,             sizeof(double));
     WRITE_FIELD(JANUS_SCALEVEL,     &r->ri_janus.scale_vel,             sizeof(double));
     WRITE_FIELD(JANUS_ORDER,        &r->ri_janus.order,                 sizeof(unsigned int));
     WRITE_FIELD(JANUS_ALLOCATEDN,   &r->ri_janus.allocated_N,           sizeof(unsigned int));
     WRITE_FIELD(JANUS_RECALC,       &r->ri_janus.recalculate_integer_coordinates_this_timestep, sizeof(unsigned int));
     WRITE_FIELD(JANUS_PINT,         r->ri_janus.p_int,                  sizeof(struct reb_particle_int)*r->ri_janus.allocated_N);
+    WRITE_FIELD(SABA_TYPE,          &r->ri_saba.type,                   sizeof(unsigned int));
+    WRITE_FIELD(SABA_CORRECTOR,     &r->ri_saba.corrector,              sizeof(unsigned int));
+    WRITE_FIELD(SABA_SAFEMODE,      &r->ri_saba.safe_mode,              sizeof(unsigned int));
+    WRITE_FIELD(SABA_ISSYNCHRON,    &r->ri_saba.is_synchronized,        sizeof(unsigned int));
+    WRITE_FIELD(MERCURIUS_HILLFAC,  &r->ri_mercurius.hillfac,           sizeof(double));
+    WRITE_FIELD(MERCURIUS_EPSILON,  &r->ri_mercurius.encounter_epsilon, sizeof(double));
+    WRITE_FIELD(MERCURIUS_SAFEMODE, &r->ri_mercurius.safe_mode,         sizeof(unsigned int));
+    WRITE_FIELD(MERCURIUS_RECALC,   &r->ri_mercurius.recalculate_coordinates_this_timestep, sizeof(unsigned int));
+    WRITE_FIELD(TREEFLATTEN,        &r->tree_flatten,                   sizeof(int));
+    WRITE_FIELD(TREEGROUPSIZE,      &r->tree_group_size,                sizeof(int));
+    WRITE_FIELD(FMMORDER,           &r->fmm_order,                      sizeof(int));
+    WRITE_FIELD(MULTIPOLEORDER,     &r->multipole_order,                sizeof(int));
+    WRITE_FIELD(TREEREBUILD,        &r->tree_rebuild,                   sizeof(int));
+    WRITE_FIELD(TREEREFIT,          &r->tree_refit,                     sizeof(int));
+    WRITE_FIELD(TREEACTIVEONLY,     &r->tree_active_only,               sizeof(int));
+    WRITE_FIELD(TREETASKS,          &r->tree_tasks,                     sizeof(int));
+    WRITE_FIELD(TREELEAFSIZE,       &r->tree_leaf_size,                 sizeof(int));
+    WRITE_FIELD(TREEFORCEACCURACY,  &r->tree_force_accuracy,            sizeof(double));
+    WRITE_FIELD(TREEFORCEACCINTERVAL, &r->tree_force_accuracy_interval, sizeof(unsigned int));
+    WRITE_FIELD(TREEFORCEACCSAMPLES, &r->tree_force_accuracy_samples,   sizeof(int));
+    WRITE_FIELD(TREEFORCEACCSTEPS,  &r->tree_force_accuracy_steps,      sizeof(unsigned int));
+    WRITE_FIELD(TREEFORCEERROR,     &r->tree_force_error,               sizeof(double));
+    WRITE_FIELD(HEARTBEATINTERVAL,  &r->heartbeat_interval,             sizeof(unsigned int));
+    WRITE_FIELD(REORDERINTERVAL,    &r->reorder_interval,               sizeof(unsigned int));
+    WRITE_FIELD(TREESINGLEPRECISION, &r->tree_single_precision,         sizeof(int));
+    WRITE_FIELD(REPRODUCIBLE,       &r->reproducible,                   sizeof(int));
+    WRITE_FIELD(RANDSEED,           &r->rand_seed,                      sizeof(uint64_t));
+    WRITE_FIELD(RANDSTREAMS,        &r->rand_streams,                   sizeof(uint64_t));
+    WRITE_FIELD(SLEEPVELOCITY,      &r->sleep_velocity,                 sizeof(double));
+    WRITE_FIELD(SLEEPSTEPS,         &r->sleep_steps,                    sizeof(unsigned int));
+    WRITE_FIELD(COLLISIONRESOLVEPARALLEL, &r->collision_resolve_parallel, sizeof(int));
+    WRITE_FIELD(COLLISIONSWEPT,     &r->collision_swept,                sizeof(int));
+    WRITE_FIELD(COLLISIONVERLETSKIN, &r->collision_verlet_skin,         sizeof(double));
+    WRITE_FIELD(COLLISIONFUSED,     &r->collision_fused,                sizeof(int));
+    WRITE_FIELD(IAS15_BLOCKLEVELS,  &r->ri_ias15.block_levels,          sizeof(unsigned int));
+    WRITE_FIELD(IAS15_LEAN,         &r->ri_ias15.lean,                  sizeof(unsigned int));
+    WRITE_FIELD(FFTNX,              &r->fft_nx,                         sizeof(int));
+    WRITE_FIELD(FFTNY,              &r->fft_ny,                         sizeof(int));
+    WRITE_FIELD(FFTRS,              &r->fft_rs,                         sizeof(double));
     int functionpointersused = 0;
     if (r->coefficient_of_restitution ||
         r->collision_resolve ||
+        r->collision_resolve_batch ||
         r->additional_forces ||
         r->heartbeat ||
         r->post_timestep_modifications ||
@@ -342,10 +387,12 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
         functionpointersused = 1;
     }
     WRITE_FIELD(FUNCTIONPOINTERS,   &functionpointersused,              sizeof(int));
-    WRITE_FIELD(PARTICLES,          r->particles,                       sizeof(struct reb_particle)*r->N);
     if (r->var_config){
         WRITE_FIELD(VARCONFIG,      r->var_config,                      sizeof(struct reb_variational_configuration)*r->var_config_N);
     }
+    if (r->forces_N){
+        WRITE_FIELD(FORCES,         r->forces,                          sizeof(struct reb_force)*r->forces_N);
+    }
     if (r->ri_ias15.allocatedN){
         int N3 = r->ri_ias15.allocatedN;
         WRITE_FIELD(IAS15_AT,   r->ri_ias15.at,     sizeof(double)*N3);
@@ -366,34 +413,147 @@ void reb_output_binary(struct reb_simulation* r, char* filename){
             reb_save_dp7(&(r->ri_ias15.b),N3,of);
         }
         {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_CSB, .size = sizeof(double)*N3*7};
+            const int N3cs = r->ri_ias15.csb_allocatedN;
+            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_CSB, .size = sizeof(double)*N3cs*7};
             fwrite(&field,sizeof(struct reb_binary_field),1,of);
-            reb_save_dp7(&(r->ri_ias15.csb),N3,of);
+            reb_save_dp7(&(r->ri_ias15.csb),N3cs,of);
         }
         {
             struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_E, .size = sizeof(double)*N3*7};
             fwrite(&field,sizeof(struct reb_binary_field),1,of);
             reb_save_dp7(&(r->ri_ias15.e),N3,of);
         }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_BR, .size = sizeof(double)*N3*7};
-            fwrite(&field,sizeof(struct reb_binary_field),1,of);
-            reb_save_dp7(&(r->ri_ias15.br),N3,of);
-        }
-        {
-            struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_ER, .size = sizeof(double)*N3*7};
-            fwrite(&field,sizeof(struct reb_binary_field),1,of);
-            reb_save_dp7(&(r->ri_ias15.er),N3,of);
+        if (r->ri_ias15.br.p0){ // Not allocated if lean is set.
+            {
+                struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_BR, .size = sizeof(double)*N3*7};
+                fwrite(&field,sizeof(struct reb_binary_field),1,of);
+                reb_save_dp7(&(r->ri_ias15.br),N3,of);
+            }
+            {
+                struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_IAS15_ER, .size = sizeof(double)*N3*7};
+                fwrite(&field,sizeof(struct reb_binary_field),1,of);
+                reb_save_dp7(&(r->ri_ias15.er),N3,of);
+            }
         }
     }
+}
+
+void reb_output_binary_stream(struct reb_simulation* r, FILE* of){
+    // Init integrators. This helps with bit-by-bit reproducibility.
+    reb_integrator_init(r);
+
+    reb_output_binary_fields(r, of);
+    reb_save_particle_columns(r->particles, r->N, REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS, of);
+#ifndef MPI
+    if (r->tree_root!=NULL && r->N>0){
+        // Particles might have left their cell since the last tree update. 
+        // The cells are needed to restore the same tree when the file is read.
+        double* const cells = malloc(sizeof(double)*3*r->N);
+        reb_tree_get_cells(r, cells);
+        WRITE_FIELD(TREECELLS, cells, sizeof(double)*3*r->N);
+        free(cells);
+    }
+#endif // MPI
     // To output size of binary file, need to calculate it first. 
     r->simulationarchive_size_first = ftell(of)+sizeof(struct reb_binary_field)*2+sizeof(long);
     WRITE_FIELD(SASIZEFIRST,        &r->simulationarchive_size_first,   sizeof(long));
     int end_null = 0;
     WRITE_FIELD(END, &end_null, 0);
+}
+
+void reb_output_binary(struct reb_simulation* r, char* filename){
+#ifdef MPI
+    char filename_mpi[1024];
+    sprintf(filename_mpi,"%s_%d",filename,r->mpi_id);
+    FILE* of = fopen(filename_mpi,"wb"); 
+#else // MPI
+    FILE* of = fopen(filename,"wb"); 
+#endif // MPI
+    if (of==NULL){
+        reb_exit("Can not open file.");
+    }
+    reb_output_binary_stream(r, of);
     fclose(of);
 }
 
+#ifdef MPI
+void reb_output_binary_mpi(struct reb_simulation* r, char* filename){
+    reb_integrator_init(r);
+    // Offset of the local particles in each column.
+    long N_local = r->N;
+    long N_nodes[r->mpi_num];
+    MPI_Allgather(&N_local,1,MPI_LONG,N_nodes,1,MPI_LONG,MPI_COMM_WORLD);
+    long N_total = 0;
+    long N_before = 0;
+    for (int i=0;i<r->mpi_num;i++){
+        if (i==r->mpi_id){
+            N_before = N_total;
+        }
+        N_total += N_nodes[i];
+    }
+
+    // All other fields are written by the root node. They are serialized 
+    // into memory first because the offset of the columns depends on their size.
+    char* header = NULL;
+    size_t header_size = 0;
+    if (r->mpi_id==0){
+        FILE* of = open_memstream(&header, &header_size);
+        r->N = N_total; // The file describes the whole simulation.
+        reb_output_binary_fields(r, of);
+        r->N = N_local;
+        fclose(of);
+    }
+    long offset = header_size;
+    MPI_Bcast(&offset,1,MPI_LONG,0,MPI_COMM_WORLD);
+
+    MPI_File fh;
+    if (MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_CREATE|MPI_MODE_WRONLY, MPI_INFO_NULL, &fh)!=MPI_SUCCESS){
+        reb_exit("Can not open file.");
+    }
+    MPI_File_set_size(fh, 0);
+    struct reb_binary_field field = {.type = REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS, .size = sizeof(long)};
+    for (int c=0;c<reb_binary_column_layouts_N;c++){
+        field.size += sizeof(struct reb_binary_column) + reb_binary_column_layouts[c].size*N_total;
+    }
+    if (r->mpi_id==0){
+        MPI_File_write_at(fh, 0, header, header_size, MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at(fh, offset, &field, sizeof(struct reb_binary_field), MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at(fh, offset+sizeof(struct reb_binary_field), &N_total, sizeof(long), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    free(header);
+    offset += sizeof(struct reb_binary_field)+sizeof(long);
+
+    // One collective write per column. 
+    char* const buffer = malloc((N_local>0?N_local:1)*sizeof(double));
+    for (int c=0;c<reb_binary_column_layouts_N;c++){
+        const struct reb_binary_column_layout l = reb_binary_column_layouts[c];
+        if (r->mpi_id==0){
+            struct reb_binary_column column = {.type = l.type, .size = l.size*N_total};
+            MPI_File_write_at(fh, offset, &column, sizeof(struct reb_binary_column), MPI_BYTE, MPI_STATUS_IGNORE);
+        }
+        offset += sizeof(struct reb_binary_column);
+        for (long i=0;i<N_local;i++){
+            memcpy(buffer+i*l.size, (const char*)&r->particles[i]+l.offset, l.size);
+        }
+        MPI_File_write_at_all(fh, offset+N_before*l.size, buffer, (int)(N_local*l.size), MPI_BYTE, MPI_STATUS_IGNORE);
+        offset += l.size*N_total;
+    }
+    free(buffer);
+
+    r->simulationarchive_size_first = offset+sizeof(struct reb_binary_field)*2+sizeof(long);
+    if (r->mpi_id==0){
+        struct reb_binary_field field_sasizefirst = {.type = REB_BINARY_FIELD_TYPE_SASIZEFIRST, .size = sizeof(long)};
+        MPI_File_write_at(fh, offset, &field_sasizefirst, sizeof(struct reb_binary_field), MPI_BYTE, MPI_STATUS_IGNORE);
+        offset += sizeof(struct reb_binary_field);
+        MPI_File_write_at(fh, offset, &r->simulationarchive_size_first, sizeof(long), MPI_BYTE, MPI_STATUS_IGNORE);
+        offset += sizeof(long);
+        struct reb_binary_field field_end = {.type = REB_BINARY_FIELD_TYPE_END, .size = 0};
+        MPI_File_write_at(fh, offset, &field_end, sizeof(struct reb_binary_field), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+}
+#endif // MPI
+
 void reb_output_binary_positions(struct reb_simulation* r, char* filename){
     const int N = r->N;
 #ifdef MPI
@@ -28,27 +28,19 @@ struct reb_simulation;
 
 void reb_save_dp7(struct reb_dp7* dp7, const int N3, FILE* of);  ///< Internal function to store dp7 struct to a file
 
-#ifdef PROFILING
 /**
- * Profiling categories
+ * Location of a column of a particle array field in struct reb_particle.
  */
-enum profiling_categories {
-	PROFILING_CAT_INTEGRATOR,
-	PROFILING_CAT_BOUNDARY,
-	PROFILING_CAT_GRAVITY,
-	PROFILING_CAT_COLLISION,
-#ifdef OPENGL
-	PROFILING_CAT_VISUALIZATION,
-#endif // OPENGL
-	PROFILING_CAT_NUM,
+struct reb_binary_column_layout {
+    enum REB_BINARY_COLUMN_TYPE type;   ///< Type of column
+    size_t offset;                      ///< Offset of the property in struct reb_particle
+    size_t size;                        ///< Size of one element in bytes
 };
-void profiling_start(void);
-void profiling_stop(int cat);
-#define PROFILING_START() profiling_start();	///< Start profiling block 
-#define PROFILING_STOP(C) profiling_stop(C);	///< Stop profiling block 
-#else // PROFILING
-#define PROFILING_START()	///< Start profiling block (dummy, does nothing) 
-#define PROFILING_STOP(C)	///< Stop profiling block (dummy, does nothing)
-#endif // PROFILING
+extern const struct reb_binary_column_layout reb_binary_column_layouts[];   ///< All columns written to binary files
+extern const int reb_binary_column_layouts_N;                               ///< Number of entries in reb_binary_column_layouts
+#define REB_BINARY_COLUMN_CHUNK 4096    ///< Number of particles copied at once when reading or writing columns
+void reb_output_binary_fields(struct reb_simulation* r, FILE* of); ///< Internal function to write the header and all fields except the particles to a binary file
+void reb_output_binary_stream(struct reb_simulation* r, FILE* of); ///< Internal function to write a complete binary file to a stream (starting at the current position)
+void reb_save_particle_columns(const struct reb_particle* const particles, const int N, const enum REB_BINARY_FIELD_TYPE type, FILE* of);  ///< Internal function to store a particle array to a file, one column per property
 
 #endif
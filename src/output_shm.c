@@ -0,0 +1,229 @@
+/**
+ * @file 	output_shm.c
+ * @brief 	Live snapshots of a simulation in a shared memory segment.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	The simulation publishes its particles and a few diagnostics
+ * into a POSIX shared memory segment. External viewers and analysis
+ * processes map the segment read-only. There is a single writer, so the
+ * segment is protected with a seqlock: the writer makes the sequence
+ * counter odd, updates the snapshot and makes it even again. Readers
+ * never take a lock. They copy or use the data in place and retry if the
+ * counter has changed in the meantime. The simulation therefore never
+ * waits for a reader.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "rebound.h"
+#include "tools.h"
+#include "output_shm.h"
+
+/**
+ * @brief Number of doubles stored per particle (m, x, y, z, vx, vy, vz).
+ */
+#define REB_OUTPUT_SHM_NCOLUMNS 7
+
+struct reb_output_shm {
+    char* name;                             ///< Name of the segment, needed for shm_unlink()
+    struct reb_output_shm_header* header;   ///< Start of the mapped segment
+    double interval;                        ///< Cadence in simulation time
+    double t_last;                          ///< Time of the last snapshot
+    unsigned int flags;                     ///< REB_OUTPUT_SHM_ENERGY
+    struct timeval walltime_start;          ///< Wall time when the segment was opened
+};
+
+static double reb_output_shm_walltime(const struct reb_output_shm* const s){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec-s->walltime_start.tv_sec) + 1e-6*(now.tv_usec-s->walltime_start.tv_usec);
+}
+
+int reb_output_shm_open(struct reb_simulation* const r, const char* const name, int N_max, double interval, unsigned int flags){
+    if (name==NULL){
+        reb_error(r,"Shared memory segment needs a name.");
+        return -1;
+    }
+    reb_output_shm_close(r);
+    if (N_max<=0){
+        N_max = r->N-r->N_var;
+    }
+    if (N_max<1){
+        N_max = 1;
+    }
+    // Columns are aligned to 8 bytes.
+    const uint64_t hash_offset = (sizeof(struct reb_output_shm_header)+7)&~(uint64_t)7;
+    const uint64_t data_offset = (hash_offset+sizeof(uint32_t)*N_max+7)&~(uint64_t)7;
+    const uint64_t size = data_offset+sizeof(double)*REB_OUTPUT_SHM_NCOLUMNS*N_max;
+
+    const int fd = shm_open(name, O_CREAT|O_RDWR, 0644);
+    if (fd<0){
+        reb_error(r,"Cannot create shared memory segment.");
+        return -1;
+    }
+    if (ftruncate(fd, size)){
+        close(fd);
+        shm_unlink(name);
+        reb_error(r,"Cannot resize shared memory segment.");
+        return -1;
+    }
+    void* const segment = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment==MAP_FAILED){
+        shm_unlink(name);
+        reb_error(r,"Cannot map shared memory segment.");
+        return -1;
+    }
+    struct reb_output_shm* const s = calloc(1, sizeof(struct reb_output_shm));
+    s->name = malloc(strlen(name)+1);
+    strcpy(s->name, name);
+    s->header = segment;
+    s->interval = interval;
+    s->flags = flags;
+    gettimeofday(&s->walltime_start, NULL);
+
+    struct reb_output_shm_header* const h = s->header;
+    memset(h, 0, sizeof(struct reb_output_shm_header));
+    h->version = 1;
+    h->size = size;
+    h->hash_offset = hash_offset;
+    h->data_offset = data_offset;
+    h->N_max = N_max;
+    h->energy = NAN;
+    r->output_shm = s;
+    reb_output_shm_publish(r);
+    // Readers check the magic number last.
+    __atomic_store_n(&h->magic, REB_OUTPUT_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void reb_output_shm_publish(struct reb_simulation* const r){
+    struct reb_output_shm* const s = r->output_shm;
+    if (s==NULL) return;
+    struct reb_output_shm_header* const h = s->header;
+    const int N_total = r->N-r->N_var;
+    const int N = N_total<h->N_max?N_total:h->N_max;
+    // Calculated before the update to keep the time in which readers retry short.
+    const double energy = (s->flags & REB_OUTPUT_SHM_ENERGY)?reb_tools_energy(r):NAN;
+    const double walltime = reb_output_shm_walltime(s);
+
+    const uint64_t seq = h->seq;
+    __atomic_store_n(&h->seq, seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    h->N = N;
+    h->N_total = N_total;
+    h->N_active = r->N_active;
+    h->snapshots++;
+    h->t = r->t;
+    h->dt = r->dt_last_done;
+    h->G = r->G;
+    h->walltime = walltime;
+    h->energy = energy;
+    uint32_t* const hash = (uint32_t*)((char*)h+h->hash_offset);
+    double* const m = (double*)((char*)h+h->data_offset);
+    const int N_max = h->N_max;
+    double* const x = m+N_max;
+    double* const y = m+2*N_max;
+    double* const z = m+3*N_max;
+    double* const vx = m+4*N_max;
+    double* const vy = m+5*N_max;
+    double* const vz = m+6*N_max;
+    const struct reb_particle* const particles = r->particles;
+    for (int i=0;i<N;i++){
+        hash[i] = particles[i].hash;
+        m[i] = particles[i].m;
+        x[i] = particles[i].x;
+        y[i] = particles[i].y;
+        z[i] = particles[i].z;
+        vx[i] = particles[i].vx;
+        vy[i] = particles[i].vy;
+        vz[i] = particles[i].vz;
+    }
+    __atomic_store_n(&h->seq, seq+2, __ATOMIC_RELEASE);
+    s->t_last = r->t;
+}
+
+void reb_output_shm_step(struct reb_simulation* const r){
+    struct reb_output_shm* const s = r->output_shm;
+    s->header->steps++;
+    if (s->interval<=0. || fabs(r->t-s->t_last)>=s->interval){
+        reb_output_shm_publish(r);
+    }
+}
+
+void reb_output_shm_close(struct reb_simulation* const r){
+    struct reb_output_shm* const s = r->output_shm;
+    if (s==NULL) return;
+    munmap(s->header, s->header->size);
+    shm_unlink(s->name);
+    free(s->name);
+    free(s);
+    r->output_shm = NULL;
+}
+
+const struct reb_output_shm_header* reb_output_shm_attach(const char* const name){
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd<0){
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size<(off_t)sizeof(struct reb_output_shm_header)){
+        close(fd);
+        return NULL;
+    }
+    void* const segment = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment==MAP_FAILED){
+        return NULL;
+    }
+    const struct reb_output_shm_header* const h = segment;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE)!=REB_OUTPUT_SHM_MAGIC || h->size!=(uint64_t)st.st_size){
+        munmap(segment, st.st_size);
+        return NULL;
+    }
+    return h;
+}
+
+void reb_output_shm_detach(const struct reb_output_shm_header* const h){
+    if (h==NULL) return;
+    munmap((void*)h, h->size);
+}
+
+uint64_t reb_output_shm_read_begin(const struct reb_output_shm_header* const h){
+    uint64_t seq;
+    while ((seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE))&1){
+        // The writer only copies the particles, this does not take long.
+    }
+    return seq;
+}
+
+int reb_output_shm_read_retry(const struct reb_output_shm_header* const h, const uint64_t seq){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&h->seq, __ATOMIC_RELAXED)!=seq;
+}
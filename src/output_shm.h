@@ -0,0 +1,35 @@
+/**
+ * @file 	output_shm.h
+ * @brief 	Live snapshots of a simulation in a shared memory segment.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _OUTPUT_SHM_H
+#define _OUTPUT_SHM_H
+
+/**
+  * @brief Publishes a snapshot if the cadence of the shared memory segment requires one.
+  * @details Called at the end of every timestep if a segment is open.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_output_shm_step(struct reb_simulation* const r);
+
+#endif // _OUTPUT_SHM_H
@@ -0,0 +1,231 @@
+/**
+ * @file 	output_stream.c
+ * @brief 	Streaming particle output to callbacks running on background threads.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	Every output stream owns a ring buffer of batches and a thread
+ * which drains it. reb_output_stream_push() only copies the particle data
+ * into the next free batch (structure of arrays). Orbital elements, formatting
+ * and any file system access happen on the stream's thread. There is a single
+ * producer (the integrator) and a single consumer per ring buffer, so the
+ * ring buffer does not need a lock: the producer owns the head and the consumer
+ * the tail index, both are accessed with atomic loads and stores. Threads
+ * wait for each other with short sleeps.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "rebound.h"
+#include "tools.h"
+#include "output_stream.h"
+
+/**
+ * @brief Number of doubles stored per particle in a batch (m, x, y, z, vx, vy, vz).
+ */
+#define REB_OUTPUT_STREAM_NCOLUMNS 7
+/**
+ * @brief Number of orbital elements stored per particle in a batch (a, e, inc, Omega, omega, f).
+ */
+#define REB_OUTPUT_STREAM_NORBITS 6
+
+struct reb_output_stream {
+    pthread_t thread;
+    void (*callback)(const struct reb_output_stream_batch* const batch, void* userdata);
+    void* userdata;
+    unsigned int flags;             ///< REB_OUTPUT_STREAM_ORBITS and REB_OUTPUT_STREAM_DROP
+    int capacity;                   ///< Number of batches in the ring buffer
+    struct reb_output_stream_batch* batches; ///< Ring buffer
+    int* allocatedN;                ///< Number of particles allocated in each batch
+    unsigned long head;             ///< Number of batches pushed. Written by the integrator only.
+    unsigned long tail;             ///< Number of batches processed. Written by the stream thread only.
+    unsigned long dropped;          ///< Batches dropped since the last pushed batch
+    int quit;                       ///< Set to 1 to stop the thread once all batches are processed
+    struct reb_output_stream* next; ///< Next stream of the same simulation
+};
+
+// Sleeps a short time. Used while waiting for the other side of the ring buffer.
+static void reb_output_stream_wait(int* const backoff){
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 1000L<<*backoff};
+    nanosleep(&ts, NULL);
+    if (*backoff<10){ // at most ~1ms
+        (*backoff)++;
+    }
+}
+
+// Calculates Jacobi orbital elements. Entry 0 (the primary) is set to zero.
+static void reb_output_stream_orbits(struct reb_output_stream_batch* const b){
+    if (b->N<1) return;
+    b->a[0] = b->e[0] = b->inc[0] = b->Omega[0] = b->omega[0] = b->f[0] = 0.;
+    struct reb_particle com = {0};
+    com.m = b->m[0]; com.x = b->x[0]; com.y = b->y[0]; com.z = b->z[0];
+    com.vx = b->vx[0]; com.vy = b->vy[0]; com.vz = b->vz[0];
+    for (int i=1;i<b->N;i++){
+        struct reb_particle p = {0};
+        p.m = b->m[i]; p.x = b->x[i]; p.y = b->y[i]; p.z = b->z[i];
+        p.vx = b->vx[i]; p.vy = b->vy[i]; p.vz = b->vz[i];
+        const struct reb_orbit o = reb_tools_particle_to_orbit(b->G, p, com);
+        b->a[i] = o.a;
+        b->e[i] = o.e;
+        b->inc[i] = o.inc;
+        b->Omega[i] = o.Omega;
+        b->omega[i] = o.omega;
+        b->f[i] = o.f;
+        com = reb_get_com_of_pair(com, p);
+    }
+}
+
+static void* reb_output_stream_thread(void* args){
+    struct reb_output_stream* const s = args;
+    int backoff = 0;
+    while (1){
+        const unsigned long head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+        if (s->tail==head){
+            if (__atomic_load_n(&s->quit, __ATOMIC_ACQUIRE)) break;
+            reb_output_stream_wait(&backoff);
+            continue;
+        }
+        backoff = 0;
+        struct reb_output_stream_batch* const b = &s->batches[s->tail%s->capacity];
+        if (s->flags & REB_OUTPUT_STREAM_ORBITS){
+            reb_output_stream_orbits(b);
+        }
+        s->callback(b, s->userdata);
+        __atomic_store_n(&s->tail, s->tail+1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+int reb_output_stream_add(struct reb_simulation* const r, void (*callback)(const struct reb_output_stream_batch* const batch, void* userdata), void* userdata, int capacity, unsigned int flags){
+    if (!callback){
+        reb_error(r,"Output stream needs a callback function.");
+        return -1;
+    }
+    if (capacity<1){
+        capacity = 1;
+    }
+    struct reb_output_stream* const s = calloc(1, sizeof(struct reb_output_stream));
+    s->callback = callback;
+    s->userdata = userdata;
+    s->flags = flags;
+    s->capacity = capacity;
+    s->batches = calloc(capacity, sizeof(struct reb_output_stream_batch));
+    s->allocatedN = calloc(capacity, sizeof(int));
+    if (pthread_create(&s->thread, NULL, reb_output_stream_thread, s)){
+        reb_error(r,"Cannot create output stream thread.");
+        free(s->batches);
+        free(s->allocatedN);
+        free(s);
+        return -1;
+    }
+    // Append, so that streams are served in the order they were added.
+    struct reb_output_stream** last = &r->output_streams;
+    while (*last){
+        last = &(*last)->next;
+    }
+    *last = s;
+    return 0;
+}
+
+// Makes sure batch b has space for N particles. The batch is owned by the integrator.
+static void reb_output_stream_batch_alloc(struct reb_output_stream* const s, struct reb_output_stream_batch* const b, int* const allocatedN, const int N){
+    if (*allocatedN>=N) return;
+    *allocatedN = N;
+    const int ncolumns = REB_OUTPUT_STREAM_NCOLUMNS + ((s->flags & REB_OUTPUT_STREAM_ORBITS)?REB_OUTPUT_STREAM_NORBITS:0);
+    free(b->m);
+    free(b->hash);
+    b->m = malloc(sizeof(double)*ncolumns*N);
+    b->hash = malloc(sizeof(uint32_t)*N);
+    b->x = b->m+N; b->y = b->m+2*N; b->z = b->m+3*N;
+    b->vx = b->m+4*N; b->vy = b->m+5*N; b->vz = b->m+6*N;
+    if (s->flags & REB_OUTPUT_STREAM_ORBITS){
+        double* const orbits = b->m+REB_OUTPUT_STREAM_NCOLUMNS*N;
+        b->a = orbits; b->e = orbits+N; b->inc = orbits+2*N;
+        b->Omega = orbits+3*N; b->omega = orbits+4*N; b->f = orbits+5*N;
+    }
+}
+
+void reb_output_stream_push(struct reb_simulation* const r){
+    const int N = r->N-r->N_var;
+    const struct reb_particle* const particles = r->particles;
+    for (struct reb_output_stream* s=r->output_streams; s; s=s->next){
+        int backoff = 0;
+        while (s->head-__atomic_load_n(&s->tail, __ATOMIC_ACQUIRE)>=(unsigned long)s->capacity){
+            if (s->flags & REB_OUTPUT_STREAM_DROP){
+                break;
+            }
+            reb_output_stream_wait(&backoff);
+        }
+        if (s->head-__atomic_load_n(&s->tail, __ATOMIC_ACQUIRE)>=(unsigned long)s->capacity){
+            s->dropped++;
+            continue;
+        }
+        const int i = s->head%s->capacity;
+        struct reb_output_stream_batch* const b = &s->batches[i];
+        reb_output_stream_batch_alloc(s, b, &s->allocatedN[i], N);
+        b->t = r->t;
+        b->G = r->G;
+        b->N = N;
+        b->dropped = s->dropped;
+        s->dropped = 0;
+        for (int j=0;j<N;j++){
+            b->hash[j] = particles[j].hash;
+            b->m[j] = particles[j].m;
+            b->x[j] = particles[j].x;
+            b->y[j] = particles[j].y;
+            b->z[j] = particles[j].z;
+            b->vx[j] = particles[j].vx;
+            b->vy[j] = particles[j].vy;
+            b->vz[j] = particles[j].vz;
+        }
+        __atomic_store_n(&s->head, s->head+1, __ATOMIC_RELEASE);
+    }
+}
+
+void reb_output_stream_flush(struct reb_simulation* const r){
+    for (struct reb_output_stream* s=r->output_streams; s; s=s->next){
+        int backoff = 0;
+        while (__atomic_load_n(&s->tail, __ATOMIC_ACQUIRE)!=s->head){
+            reb_output_stream_wait(&backoff);
+        }
+    }
+}
+
+void reb_output_stream_free(struct reb_simulation* const r){
+    struct reb_output_stream* s = r->output_streams;
+    while (s){
+        struct reb_output_stream* const next = s->next;
+        __atomic_store_n(&s->quit, 1, __ATOMIC_RELEASE);
+        pthread_join(s->thread, NULL);
+        for (int i=0;i<s->capacity;i++){
+            free(s->batches[i].m);
+            free(s->batches[i].hash);
+        }
+        free(s->batches);
+        free(s->allocatedN);
+        free(s);
+        s = next;
+    }
+    r->output_streams = NULL;
+}
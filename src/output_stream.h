@@ -0,0 +1,35 @@
+/**
+ * @file 	output_stream.h
+ * @brief 	Streaming particle output to callbacks running on background threads.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _OUTPUT_STREAM_H
+#define _OUTPUT_STREAM_H
+
+/**
+  * @brief Drains and stops all output streams of a simulation and frees them.
+  * @details Called when the simulation is freed.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_output_stream_free(struct reb_simulation* const r);
+
+#endif // _OUTPUT_STREAM_H
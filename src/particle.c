@@ -28,12 +28,15 @@
 #include <math.h>
 #include <time.h>
 #include <stdint.h>
+#include <string.h>
 #include "rebound.h"
+#include "tools.h"
 #include "tree.h"
 #include "boundary.h"
 #include "particle.h"
 #ifndef COLLISIONS_NONE
 #include "collision.h"
+#include "integrator.h"
 #endif // COLLISIONS_NONE
 #ifdef MPI
 #include "communication_mpi.h"
@@ -50,17 +53,21 @@ static void reb_add_local(struct reb_simulation* const r, struct reb_particle pt
 		reb_error(r,"Particle outside of box boundaries. Did not add particle.");
 		return;
 	}
-	while (r->allocatedN<=r->N){
-		r->allocatedN += 128;
-		r->particles = realloc(r->particles,sizeof(struct reb_particle)*r->allocatedN);
+	if (r->allocatedN<=r->N){
+		const int old_allocatedN = r->allocatedN;
+		while (r->allocatedN<=r->N){
+			r->allocatedN += 128;
+		}
+		r->particles = reb_tools_realloc(r, r->particles, sizeof(struct reb_particle)*old_allocatedN, sizeof(struct reb_particle)*r->allocatedN);
 	}
 
 	r->particles[r->N] = pt;
 	r->particles[r->N].sim = r;
-	if (r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE){
+	if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision==REB_COLLISION_TREE){
 		reb_tree_add_particle_to_tree(r, r->N);
 	}
 	(r->N)++;
+	reb_particle_lookup_table_set(r, r->N-1);
 }
 
 void reb_add(struct reb_simulation* const r, struct reb_particle pt){
@@ -80,19 +87,133 @@ void reb_add(struct reb_simulation* const r, struct reb_particle pt){
 	}
 #endif // GRAVITY_GRAPE
 #ifdef MPI
-	int rootbox = reb_get_rootbox_for_particle(r, pt);
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = rootbox/root_n_per_node;
-	if (proc_id != r->mpi_id && r->N >= r->N_active){
-		// Add particle to array and send them to proc_id later. 
-		reb_communication_mpi_add_particle_to_send_queue(r,pt,proc_id);
-		return;
+	if (r->mpi_num>0){ // Not a local simulation
+		int rootbox = reb_get_rootbox_for_particle(r, pt);
+		int proc_id = r->mpi_root_owner[rootbox];
+		if (proc_id != r->mpi_id && r->N >= r->N_active){
+			// Add particle to array and send them to proc_id later. 
+			reb_communication_mpi_add_particle_to_send_queue(r,pt,proc_id);
+			return;
+		}
 	}
 #endif // MPI
 	// Add particle to local partical array.
 	reb_add_local(r, pt);
 }
 
+void reb_add_many_reserve(struct reb_simulation* const r, const int N){
+	if (r->allocatedN<N){
+		const int old_allocatedN = r->allocatedN;
+		r->allocatedN = (N+127)/128*128;
+		r->particles = reb_tools_realloc(r, r->particles, sizeof(struct reb_particle)*old_allocatedN, sizeof(struct reb_particle)*r->allocatedN);
+	}
+}
+
+void reb_add_many_finish(struct reb_simulation* const r, const int first){
+	int N = first;
+	int outside = 0;
+	for (int i=first;i<r->N;i++){
+		struct reb_particle pt = r->particles[i];
+		if (reb_boundary_particle_is_in_box(r, pt)==0){
+			outside++;
+			continue;
+		}
+#ifndef COLLISIONS_NONE
+		if (pt.r>=r->max_radius[0]){
+			r->max_radius[1] = r->max_radius[0];
+			r->max_radius[0] = pt.r;
+		}else{
+			if (pt.r>=r->max_radius[1]){
+				r->max_radius[1] = pt.r;
+			}
+		}
+#endif 	// COLLISIONS_NONE
+#ifdef GRAVITY_GRAPE
+		if (pt.m<gravity_minimum_mass){
+			gravity_minimum_mass = pt.m;
+		}
+#endif // GRAVITY_GRAPE
+		pt.sim = r;
+		r->particles[N] = pt;
+		N++;
+	}
+	r->N = N;
+	if (outside){
+		reb_error(r,"Particle outside of box boundaries. Did not add particle.");
+	}
+	for (int i=first;i<r->N;i++){
+		reb_particle_lookup_table_set(r, i);
+	}
+	if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision==REB_COLLISION_TREE){
+		if (r->tree_root==NULL || 8*(r->N-first)>first){
+			reb_tree_build(r);
+		}else{
+			for (int i=first;i<r->N;i++){
+				reb_tree_add_particle_to_tree(r, i);
+			}
+		}
+	}
+}
+
+void reb_add_many(struct reb_simulation* const r, const struct reb_particle* const particles, const int N){
+#ifdef MPI
+	// Particles might need to be sent to other nodes.
+	for (int i=0;i<N;i++){
+		reb_add(r, particles[i]);
+	}
+#else // MPI
+	if (N<=0) return;
+	const int first = r->N;
+	reb_add_many_reserve(r, first+N);
+	memcpy(r->particles+first, particles, sizeof(struct reb_particle)*N);
+	r->N += N;
+	reb_add_many_finish(r, first);
+#endif // MPI
+}
+
+void reb_add_serialized_particle_data(struct reb_simulation* const r, const int N, const uint32_t* hash, const double* m, const double* radius, const double (*xyz)[3], const double (*vxvyvz)[3]){
+	if (N<=0) return;
+#ifdef MPI
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		if (hash) p.hash = hash[i];
+		if (m) p.m = m[i];
+		if (radius) p.r = radius[i];
+		if (xyz){ p.x = xyz[i][0]; p.y = xyz[i][1]; p.z = xyz[i][2]; }
+		if (vxvyvz){ p.vx = vxvyvz[i][0]; p.vy = vxvyvz[i][1]; p.vz = vxvyvz[i][2]; }
+		reb_add(r, p);
+	}
+#else // MPI
+	const int first = r->N;
+	reb_add_many_reserve(r, first+N);
+	struct reb_particle* const particles = r->particles+first;
+	memset(particles, 0, sizeof(struct reb_particle)*N);
+	for (int i=0;i<N;i++){
+		if (hash){
+			particles[i].hash = hash[i];
+		}
+		if (m){
+			particles[i].m = m[i];
+		}
+		if (radius){
+			particles[i].r = radius[i];
+		}
+		if (xyz){
+			particles[i].x = xyz[i][0];
+			particles[i].y = xyz[i][1];
+			particles[i].z = xyz[i][2];
+		}
+		if (vxvyvz){
+			particles[i].vx = vxvyvz[i][0];
+			particles[i].vy = vxvyvz[i][1];
+			particles[i].vz = vxvyvz[i][2];
+		}
+	}
+	r->N += N;
+	reb_add_many_finish(r, first);
+#endif // MPI
+}
+
 int reb_get_rootbox_for_particle(const struct reb_simulation* const r, struct reb_particle pt){
 	if (r->root_size==-1) return 0;
 	int i = ((int)floor((pt.x + r->boxsize.x/2.)/r->root_size)+r->root_nx)%r->root_nx;
@@ -115,70 +236,128 @@ int reb_get_particle_index(struct reb_particle* p){
 	return i;
 }
 
-static struct reb_particle* reb_search_lookup_table(struct reb_simulation* const r, uint32_t hash){
+/*
+ * The particle lookup table is an open addressing hash map with linear probing. 
+ * allocatedN_lookup is the number of slots (a power of two), N_lookup the number 
+ * of occupied slots. Empty slots have index -1. The table is only built on the first
+ * lookup and then kept up to date when particles are added, removed or moved. 
+ * Because hashes can be changed directly in the particle structure, every result 
+ * is checked against the particle array and the table is rebuilt if it is stale.
+ */
+
+static inline unsigned int reb_lookup_table_slot(uint32_t hash, const unsigned int mask){
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+    return hash & mask;
+}
+
+// Returns the slot containing hash, or the empty slot where it would be inserted.
+static inline unsigned int reb_lookup_table_find(const struct reb_simulation* const r, const uint32_t hash){
     const struct reb_hash_pointer_pair* const lookup = r->particle_lookup_table;
-    if (lookup == NULL){
-        return NULL;
+    const unsigned int mask = r->allocatedN_lookup-1;
+    unsigned int s = reb_lookup_table_slot(hash, mask);
+    while (lookup[s].index!=-1 && lookup[s].hash!=hash){
+        s = (s+1)&mask;
+    }
+    return s;
+}
+
+static void reb_lookup_table_insert(struct reb_simulation* const r, const uint32_t hash, const int index){
+    const unsigned int s = reb_lookup_table_find(r, hash);
+    if (r->particle_lookup_table[s].index==-1){
+        r->N_lookup++;
     }
+    r->particle_lookup_table[s].hash = hash;
+    r->particle_lookup_table[s].index = index;
+}
 
-    int left = 0;
-    int right = r->N_lookup-1;
-    int middle;
-    while(left <= right){
-        middle = (left + right)/2;
-        uint32_t lookuphash = lookup[middle].hash;
-        if(lookuphash < hash){
-            left = middle+1;
+// Resizes the table so that at most half of the slots are occupied by N entries.
+static void reb_lookup_table_resize(struct reb_simulation* const r, const int N){
+    int allocatedN = 16;
+    while (allocatedN<2*N){
+        allocatedN *= 2;
+    }
+    struct reb_hash_pointer_pair* const old = r->particle_lookup_table;
+    const int old_allocatedN = r->allocatedN_lookup;
+    r->particle_lookup_table = malloc(sizeof(struct reb_hash_pointer_pair)*allocatedN);
+    r->allocatedN_lookup = allocatedN;
+    r->N_lookup = 0;
+    for (int s=0;s<allocatedN;s++){
+        r->particle_lookup_table[s].index = -1;
+    }
+    if (old){
+        for (int s=0;s<old_allocatedN;s++){
+            if (old[s].index!=-1){
+                reb_lookup_table_insert(r, old[s].hash, old[s].index);
+            }
         }
-        else if(lookuphash > hash){
-            right = middle-1;
+        free(old);
+    }
+}
+
+void reb_particle_lookup_table_set(struct reb_simulation* const r, const int index){
+    if (r->particle_lookup_table==NULL){
+        return;
+    }
+    if (2*(r->N_lookup+1)>r->allocatedN_lookup){
+        reb_lookup_table_resize(r, r->N_lookup+1);
+    }
+    reb_lookup_table_insert(r, r->particles[index].hash, index);
+}
+
+void reb_particle_lookup_table_remove(struct reb_simulation* const r, const int index){
+    if (r->particle_lookup_table==NULL){
+        return;
+    }
+    struct reb_hash_pointer_pair* const lookup = r->particle_lookup_table;
+    const unsigned int mask = r->allocatedN_lookup-1;
+    unsigned int s = reb_lookup_table_find(r, r->particles[index].hash);
+    if (lookup[s].index!=index){
+        // Not in table or the hash belongs to another particle.
+        return;
+    }
+    lookup[s].index = -1;
+    r->N_lookup--;
+    // Move entries back which would otherwise not be found anymore (no tombstones).
+    unsigned int j = s;
+    while (1){
+        j = (j+1)&mask;
+        if (lookup[j].index==-1){
+            break;
         }
-        else if(lookuphash == hash){
-            if(lookup[middle].index < r->N){
-                return &r->particles[lookup[middle].index];
-            }
-            else{ // found lookup table entry pointing beyond r->N in particles array. Needs update
-                return NULL;
-            }
+        const unsigned int k = reb_lookup_table_slot(lookup[j].hash, mask);
+        if ((s<=j) ? (s<k && k<=j) : (s<k || k<=j)){
+            continue;
         }
+        lookup[s] = lookup[j];
+        lookup[j].index = -1;
+        s = j;
     }
-    return NULL;
 }
 
-static int compare_hash(const void* a, const void* b){
-    struct reb_hash_pointer_pair* ia = (struct reb_hash_pointer_pair*)a; 
-    struct reb_hash_pointer_pair* ib = (struct reb_hash_pointer_pair*)b;
-    return (ia->hash > ib->hash) - (ia->hash < ib->hash); // to avoid overflow possibilities
+static struct reb_particle* reb_search_lookup_table(struct reb_simulation* const r, uint32_t hash){
+    if (r->particle_lookup_table == NULL){
+        return NULL;
+    }
+    const struct reb_hash_pointer_pair entry = r->particle_lookup_table[reb_lookup_table_find(r, hash)];
+    if (entry.index==-1 || entry.index>=r->N || r->particles[entry.index].hash!=hash){
+        // Not found or stale entry. Needs update
+        return NULL;
+    }
+    return &r->particles[entry.index];
 }
 
 static void reb_update_particle_lookup_table(struct reb_simulation* const r){
-    const struct reb_particle* const particles = r->particles;
-    int N_hash = 0;
-    int zerohash = -1;
+    free(r->particle_lookup_table);
+    r->particle_lookup_table = NULL;
+    reb_lookup_table_resize(r, r->N);
+    // If several particles have the same hash (e.g. the default hash 0), the last one is used.
     for(int i=0; i<r->N; i++){
-        if(N_hash >= r->allocatedN_lookup){
-            r->allocatedN_lookup += 128;
-            r->particle_lookup_table = realloc(r->particle_lookup_table, sizeof(struct reb_hash_pointer_pair)*r->allocatedN_lookup);
-        }
-        if(particles[i].hash == 0){ // default hash (0) special case
-            if (zerohash == -1){    // first zero hash
-                zerohash = i;
-                r->particle_lookup_table[zerohash].hash = particles[i].hash;
-                r->particle_lookup_table[zerohash].index = i;
-                N_hash++;
-            }
-            else{                   // update zero hash entry in lookup without incrementing N_hash
-                r->particle_lookup_table[zerohash].index = i;
-            }
-        }
-        else{                   
-            r->particle_lookup_table[N_hash].hash = particles[i].hash;
-            r->particle_lookup_table[N_hash].index = i;
-            N_hash++;
-        }
+        reb_lookup_table_insert(r, r->particles[i].hash, i);
     }
-    r->N_lookup = N_hash;
-    qsort(r->particle_lookup_table, r->N_lookup, sizeof(*r->particle_lookup_table), compare_hash); // only sort the first N_lookup entries that are initialized.
 }
 
 struct reb_particle* reb_get_particle_by_hash(struct reb_simulation* const r, uint32_t hash){
@@ -188,13 +367,220 @@ struct reb_particle* reb_get_particle_by_hash(struct reb_simulation* const r, ui
         reb_update_particle_lookup_table(r);
         p = reb_search_lookup_table(r, hash);
     }
-    else{
-        if (p->hash != hash){
-            reb_update_particle_lookup_table(r);
-            p = reb_search_lookup_table(r, hash);
+    return p;
+}
+
+// Spreads the lowest 21 bits of x so that there are two zero bits between each of them.
+static inline uint64_t reb_morton_spread(uint64_t x){
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8)  & 0x100f00f00f00f00full;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2)  & 0x1249249249249249ull;
+    return x;
+}
+
+struct reb_reorder_entry {
+    uint64_t key;
+    int index;
+};
+
+static int reb_reorder_compare(const void* a, const void* b){
+    const struct reb_reorder_entry* const ea = a;
+    const struct reb_reorder_entry* const eb = b;
+    if (ea->key<eb->key) return -1;
+    if (ea->key>eb->key) return 1;
+    return ea->index-eb->index;
+}
+
+// Applies the permutation perm (new index -> old index) to an array of 3N doubles.
+static void reb_reorder_array3(double* const a, const int* const perm, const int N, double* const tmp){
+    if (a==NULL) return;
+    memcpy(tmp, a, sizeof(double)*3*N);
+    for (int i=0;i<N;i++){
+        a[3*i+0] = tmp[3*perm[i]+0];
+        a[3*i+1] = tmp[3*perm[i]+1];
+        a[3*i+2] = tmp[3*perm[i]+2];
+    }
+}
+
+static void reb_reorder_dp7(struct reb_dp7* const dp, const int* const perm, const int N, double* const tmp){
+    reb_reorder_array3(dp->p0, perm, N, tmp);
+    reb_reorder_array3(dp->p1, perm, N, tmp);
+    reb_reorder_array3(dp->p2, perm, N, tmp);
+    reb_reorder_array3(dp->p3, perm, N, tmp);
+    reb_reorder_array3(dp->p4, perm, N, tmp);
+    reb_reorder_array3(dp->p5, perm, N, tmp);
+    reb_reorder_array3(dp->p6, perm, N, tmp);
+}
+
+int reb_reorder_particles(struct reb_simulation* const r){
+    const int N = r->N;
+    switch (r->integrator){
+        case REB_INTEGRATOR_LEAPFROG:
+        case REB_INTEGRATOR_SEI:
+        case REB_INTEGRATOR_JANUS:
+        case REB_INTEGRATOR_WHFASTHELIO:
+        case REB_INTEGRATOR_MERCURIUS:
+            break;
+        case REB_INTEGRATOR_IAS15:
+            if (r->ri_ias15.block_levels==0){
+                break;
+            }
+            // fall through
+        default:
+            reb_warning(r, "Reordering particles is not supported by this integrator (the order of particles matters for WHFast, SABA and HERMES; not implemented for IAS15 block timesteps).");
+            return 0;
+    }
+    if (r->N_var){
+        reb_warning(r, "Reordering particles is not supported with variational particles.");
+        return 0;
+    }
+    if (N<3){
+        return 1;
+    }
+    reb_integrator_synchronize(r);
+    // The central object stays at index 0 for the heliocentric integrators.
+    const int first = (r->integrator==REB_INTEGRATOR_WHFASTHELIO || r->integrator==REB_INTEGRATOR_MERCURIUS)?1:0;
+    const int N_active = (r->N_active==-1 || r->N_active>N)?N:r->N_active;
+    struct reb_particle* const particles = r->particles;
+
+    // Bounding box of all particles
+    double min[3] = {INFINITY, INFINITY, INFINITY};
+    double max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i=first;i<N;i++){
+        const double x[3] = {particles[i].x, particles[i].y, particles[i].z};
+        for (int k=0;k<3;k++){
+            min[k] = x[k]<min[k]?x[k]:min[k];
+            max[k] = x[k]>max[k]?x[k]:max[k];
         }
     }
-    return p;
+    double scale[3];
+    for (int k=0;k<3;k++){
+        // Keys are 21 bits per dimension (0 to 2^21-1).
+        scale[k] = max[k]>min[k]?2097151./(max[k]-min[k]):0.;
+    }
+
+    // Active particles and test particles are sorted separately, so that N_active stays meaningful.
+    struct reb_reorder_entry* const entries = malloc(sizeof(struct reb_reorder_entry)*N);
+#pragma omp parallel for schedule(static)
+    for (int i=0;i<N;i++){
+        const double x[3] = {particles[i].x, particles[i].y, particles[i].z};
+        uint64_t key = 0;
+        for (int k=0;k<3;k++){
+            double u = (x[k]-min[k])*scale[k];
+            u = u<0.?0.:(u>2097151.?2097151.:u); // Also catches NaNs
+            key |= reb_morton_spread((uint64_t)u)<<k;
+        }
+        entries[i].key = key;
+        entries[i].index = i;
+    }
+    if (N_active-first>1){
+        qsort(entries+first, N_active-first, sizeof(struct reb_reorder_entry), reb_reorder_compare);
+    }
+    if (N-N_active>1){
+        qsort(entries+N_active, N-N_active, sizeof(struct reb_reorder_entry), reb_reorder_compare);
+    }
+    int* const perm = malloc(sizeof(int)*N);
+    for (int i=0;i<N;i++){
+        perm[i] = entries[i].index;
+    }
+    free(entries);
+
+    struct reb_particle* const tmp = malloc(sizeof(struct reb_particle)*N);
+    memcpy(tmp, particles, sizeof(struct reb_particle)*N);
+    for (int i=0;i<N;i++){
+        particles[i] = tmp[perm[i]];
+        // The tree cells stay the same, only the indices of the leaves change.
+        if (particles[i].c!=NULL){
+            particles[i].c->pt = i;
+        }
+    }
+    free(tmp);
+
+    // Buffers which carry information from one timestep to the next.
+    struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+    if (r->integrator==REB_INTEGRATOR_IAS15 && ri_ias15->allocatedN==3*N){
+        double* const tmp3 = malloc(sizeof(double)*3*N);
+        reb_reorder_array3(ri_ias15->csx, perm, N, tmp3);
+        reb_reorder_array3(ri_ias15->csv, perm, N, tmp3);
+        reb_reorder_dp7(&(ri_ias15->b), perm, N, tmp3);
+        if (ri_ias15->csb_allocatedN==3*N){
+            reb_reorder_dp7(&(ri_ias15->csb), perm, N, tmp3);
+        }
+        reb_reorder_dp7(&(ri_ias15->e), perm, N, tmp3);
+        if (ri_ias15->br.p0){ // Not allocated if lean is set.
+            reb_reorder_dp7(&(ri_ias15->br), perm, N, tmp3);
+            reb_reorder_dp7(&(ri_ias15->er), perm, N, tmp3);
+        }
+        free(tmp3);
+    }
+    reb_collision_sleep_reorder(r, perm);
+    free(perm);
+    r->ri_whfasthelio.recalculate_heliocentric_this_timestep = 1;
+    r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
+    r->ri_janus.recalculate_integer_coordinates_this_timestep = 1;
+    reb_collision_verlet_list_free(r);
+    if (r->particle_lookup_table){
+        reb_update_particle_lookup_table(r);
+    }
+    return 1;
+}
+
+void reb_particles_soa_update(struct reb_simulation* const r){
+    struct reb_particles_soa* const soa = &(r->particles_soa);
+    const int N = r->N;
+    if (soa->allocatedN<N){
+        free(soa->x);
+        soa->allocatedN = r->allocatedN>N?r->allocatedN:N;
+        const int n = soa->allocatedN;
+        soa->x  = malloc(8*n*sizeof(double));
+        soa->y  = soa->x  + n;
+        soa->z  = soa->y  + n;
+        soa->vx = soa->z  + n;
+        soa->vy = soa->vx + n;
+        soa->vz = soa->vy + n;
+        soa->m  = soa->vz + n;
+        soa->r  = soa->m  + n;
+    }
+    const struct reb_particle* const particles = r->particles;
+#pragma omp parallel for schedule(guided)
+    for (int i=0;i<N;i++){
+        soa->x[i]  = particles[i].x;
+        soa->y[i]  = particles[i].y;
+        soa->z[i]  = particles[i].z;
+        soa->vx[i] = particles[i].vx;
+        soa->vy[i] = particles[i].vy;
+        soa->vz[i] = particles[i].vz;
+        soa->m[i]  = particles[i].m;
+        soa->r[i]  = particles[i].r;
+    }
+    soa->N = N;
+}
+
+void reb_particles_soa_apply(struct reb_simulation* const r){
+    const struct reb_particles_soa* const soa = &(r->particles_soa);
+    const int N = r->N;
+    if (soa->N!=N){
+        reb_error(r, "Number of particles changed since the last call to reb_particles_soa_update(). Did not copy particle data.");
+        return;
+    }
+    struct reb_particle* const particles = r->particles;
+#pragma omp parallel for schedule(guided)
+    for (int i=0;i<N;i++){
+        particles[i].x  = soa->x[i];
+        particles[i].y  = soa->y[i];
+        particles[i].z  = soa->z[i];
+        particles[i].vx = soa->vx[i];
+        particles[i].vy = soa->vy[i];
+        particles[i].vz = soa->vz[i];
+        particles[i].m  = soa->m[i];
+        particles[i].r  = soa->r[i];
+    }
+    // Particle data changed. Need to recalculate internal coordinates.
+    r->ri_whfast.recalculate_jacobi_this_timestep = 1;
+    r->ri_whfasthelio.recalculate_heliocentric_this_timestep = 1;
 }
 
 void reb_remove_all(struct reb_simulation* const r){
@@ -204,6 +590,12 @@ void reb_remove_all(struct reb_simulation* const r){
 	r->N_var 	= 0;
 	free(r->particles);
 	r->particles 	= NULL;
+	free(r->particle_lookup_table);
+	r->particle_lookup_table = NULL;
+	r->N_lookup 	= 0;
+	r->allocatedN_lookup = 0;
+	r->sleep_N 	= 0;
+	r->sleeping_N 	= 0;
 }
 
 int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
@@ -252,6 +644,7 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
 		return 0;
 	}
 	if(keepSorted){
+        reb_particle_lookup_table_remove(r, index);
 	    r->N--;
         if(r->free_particle_ap){
             r->free_particle_ap(&r->particles[index]);
@@ -261,7 +654,9 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
         }
 		for(int j=index; j<r->N; j++){
 			r->particles[j] = r->particles[j+1];
+            reb_particle_lookup_table_set(r, j);
 		}
+        reb_collision_sleep_remove(r, index, 1);
         if (r->tree_root){
 		    reb_error(r, "REBOUND cannot remove a particle a tree and keep the particles sorted. Did not remove particle.");
 		    return 0;
@@ -274,17 +669,150 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
                 r->free_particle_ap(&r->particles[index]);
             }
         }else{
+            reb_particle_lookup_table_remove(r, index);
 	        r->N--;
             if(r->free_particle_ap){
                 r->free_particle_ap(&r->particles[index]);
             }
 		    r->particles[index] = r->particles[r->N];
+            if (index<r->N){
+                reb_particle_lookup_table_set(r, index);
+            }
+            reb_collision_sleep_remove(r, index, 0);
         }
 	}
 
 	return 1;
 }
 
+int reb_remove_mark(struct reb_simulation* const r, int index){
+	if (index<0 || index>=r->N){
+		char warning[1024];
+        sprintf(warning, "Index %d passed to reb_remove_mark was out of range (N=%d).  Did not mark particle.", index, r->N);
+		reb_error(r, warning);
+		return 0;
+	}
+	if (r->remove_marks_allocatedN<r->N){
+		r->remove_marks = realloc(r->remove_marks,sizeof(char)*r->allocatedN);
+		memset(r->remove_marks+r->remove_marks_allocatedN, 0, sizeof(char)*(r->allocatedN-r->remove_marks_allocatedN));
+		r->remove_marks_allocatedN = r->allocatedN;
+	}
+	if (r->remove_marks[index]==0){
+		r->remove_marks[index] = 1;
+		r->remove_marks_N++;
+	}
+	return 1;
+}
+
+int reb_remove_marked(struct reb_simulation* const r, int keepSorted){
+	const int N_marked = r->remove_marks_N;
+	if (N_marked==0){
+		return 0;
+	}
+	char* const marks = r->remove_marks;
+	const int N = r->N;
+	r->remove_marks_N = 0;
+	if (r->N_var){
+		reb_error(r, "Removing particles not supported when calculating MEGNO.  Did not remove particles.");
+		memset(marks, 0, sizeof(char)*N);
+		return 0;
+	}
+	if (r->ri_hermes.global || (r->tree_root && !keepSorted)){
+		// Mini simulations also need to remove particles from the global simulation. 
+		// With a tree, particles are only flagged and removed in the next tree update.
+		for (int i=N-1;i>=0;i--){
+			if (marks[i]){
+				marks[i] = 0;
+				reb_remove(r, i, keepSorted);
+			}
+		}
+		if (r->tree_root){
+			r->tree_needs_update = 1;
+		}
+		return N_marked;
+	}
+	if (r->tree_root){
+		reb_error(r, "REBOUND cannot remove a particle a tree and keep the particles sorted. Did not remove particles.");
+		memset(marks, 0, sizeof(char)*N);
+		return 0;
+	}
+	struct reb_particle* const particles = r->particles;
+	reb_collision_sleep_remove_marked(r, marks, keepSorted);
+	if (r->free_particle_ap){
+		for (int i=0;i<N;i++){
+			if (marks[i]){
+				r->free_particle_ap(&particles[i]);
+			}
+		}
+	}
+	if (keepSorted){
+		int N_active_removed = 0;
+		int j = 0;
+		for (int i=0;i<N;i++){
+			if (marks[i]){
+				marks[i] = 0;
+				if (i<r->N_active){
+					N_active_removed++;
+				}
+				reb_particle_lookup_table_remove(r, i);
+				continue;
+			}
+			if (i!=j){
+				particles[j] = particles[i];
+				reb_particle_lookup_table_set(r, j);
+			}
+			j++;
+		}
+		r->N = j;
+		r->N_active -= N_active_removed;
+	}else{
+		// Going backwards, the particle moved into a gap is never marked.
+		for (int i=N-1;i>=0;i--){
+			if (marks[i]){
+				marks[i] = 0;
+				reb_particle_lookup_table_remove(r, i);
+				r->N--;
+				particles[i] = particles[r->N];
+				if (i<r->N){
+					reb_particle_lookup_table_set(r, i);
+				}
+			}
+		}
+	}
+	if (r->N==0){
+		reb_warning(r, "Last particle removed.");
+	}
+	return N_marked;
+}
+
+double reb_particle_energy_contribution(const struct reb_simulation* const r, const int index, const int exclude){
+    const int N = r->N;
+    const int N_var = r->N_var;
+    const int _N_active = ((r->N_active==-1)?N:r->N_active) - N_var;
+    const int N_interact = (r->testparticle_type==0)?_N_active:(N-N_var);
+    const char* const marks = r->remove_marks_N?r->remove_marks:NULL;
+    const struct reb_particle* restrict const particles = r->particles;
+    const struct reb_particle p = particles[index];
+    double e = 0.;
+    if (index>=N_interact){
+        // Particle does not contribute to the energy.
+        return e;
+    }
+    e += 0.5 * p.m * (p.vx*p.vx + p.vy*p.vy + p.vz*p.vz);
+    // Pairs with at least one particle with index<_N_active and both indices<N_interact.
+    const int lmax = (index<_N_active)?N_interact:_N_active;
+    for (int l=0;l<lmax;l++){
+        if (l==index || l==exclude) continue;
+        if (marks && marks[l]) continue;
+        const struct reb_particle pl = particles[l];
+        const double dx = p.x - pl.x;
+        const double dy = p.y - pl.y;
+        const double dz = p.z - pl.z;
+        e -= r->G*p.m*pl.m/sqrt(dx*dx + dy*dy + dz*dz);
+    }
+    return e;
+}
+
 int reb_remove_by_hash(struct reb_simulation* const r, uint32_t hash, int keepSorted){
     struct reb_particle* p = reb_get_particle_by_hash(r, hash);
     if(p == NULL){
@@ -36,4 +36,51 @@ struct reb_treecell;
  */
 int reb_get_rootbox_for_particle(const struct reb_simulation* const r, struct reb_particle pt);
 
+/**
+ * @brief Returns the contribution of one particle to the total energy.
+ * @details This is the kinetic energy of the particle plus the potential energy of all 
+ * pairs it is part of, following the same rules for test particles as reb_tools_energy().
+ * Particles marked with reb_remove_mark() are ignored. The cost is O(N). The change in 
+ * energy when removing a particle is therefore obtained without two O(N^2) calls to 
+ * reb_tools_energy().
+ * @param r REBOUND simulation to be considered.
+ * @param index Index of the particle.
+ * @param exclude Index of an additional particle to ignore (-1 for none).
+ */
+double reb_particle_energy_contribution(const struct reb_simulation* const r, const int index, const int exclude);
+
+/**
+ * @brief Updates the particle lookup table after the particle at index has been added or moved there.
+ * @details Does nothing if the lookup table has not been built yet. O(1).
+ * @param r REBOUND simulation to be considered.
+ * @param index New index of the particle.
+ */
+void reb_particle_lookup_table_set(struct reb_simulation* const r, const int index);
+
+/**
+ * @brief Removes the particle at index from the particle lookup table.
+ * @details Needs to be called before the particle is removed or overwritten. 
+ * Does nothing if the lookup table has not been built yet. O(1).
+ * @param r REBOUND simulation to be considered.
+ * @param index Index of the particle.
+ */
+void reb_particle_lookup_table_remove(struct reb_simulation* const r, const int index);
+
+/**
+ * @brief Makes room for at least N particles in r->particles with a single realloc.
+ * @param r REBOUND simulation to be considered.
+ * @param N Total number of particles.
+ */
+void reb_add_many_reserve(struct reb_simulation* const r, const int N);
+
+/**
+ * @brief Finishes adding the particles first..r->N-1 which have already been copied into r->particles.
+ * @details Particles outside the box are dropped, max_radius and the
+ * lookup table are updated in one pass. The tree is then built once, unless only 
+ * a few particles were added to a large existing tree. Not for use with MPI.
+ * @param r REBOUND simulation to be considered.
+ * @param first Index of the first new particle.
+ */
+void reb_add_many_finish(struct reb_simulation* const r, const int first);
+
 #endif // _PARTICLE_H
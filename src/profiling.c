@@ -0,0 +1,494 @@
+/**
+ * @file 	profiling.c
+ * @brief 	Timing of the different parts of a simulation.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @details 	Every thread has its own counters, so regions can be timed 
+ * inside OpenMP parallel regions without locks. Each thread keeps track of 
+ * the innermost open region. When a region is stopped, its time is added to 
+ * the region it was nested in as time spent in children. This gives the 
+ * self time of each region, even if a region (for example the tree update) 
+ * is nested in different parents. Timing is enabled at runtime. If it is 
+ * disabled, every region costs a single branch.
+ *
+ * If compiled with PROFILING_PERF (PERF=1), each thread also opens a group of
+ * Linux perf_event counters (cycles, instructions, cache references and misses,
+ * branch misses) for itself. They are read with a single read() when a region
+ * starts and stops. Without PROFILING_PERF none of this code is compiled.
+ *
+ * The trace recorder (reb_profiling_trace_enable()) additionally stores every
+ * region as an event in a per-thread ring buffer and one record per timestep
+ * (step size, IAS15 iterations and rejections, collisions, tree depth, ...) in
+ * another ring buffer. Only the most recent events are kept. 
+ * reb_profiling_trace_write() exports them in the Chrome trace event format, 
+ * which can be viewed with chrome://tracing or ui.perfetto.dev.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rebound.h"
+#include "profiling.h"
+#include "tree.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+#ifdef PROFILING_PERF
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif // PROFILING_PERF
+
+/**
+ * @brief Counters of one thread.
+ */
+struct reb_profiling_thread {
+    double start[REB_PROFILING_CAT_N];          ///< Time the region was started
+    int parent[REB_PROFILING_CAT_N];            ///< Region which was open when the region was started, -1 if none
+    int current;                                ///< Innermost open region, -1 if none
+    unsigned long long calls[REB_PROFILING_CAT_N]; ///< Number of times the region was stopped
+    double time[REB_PROFILING_CAT_N];           ///< Total time spent in the region
+    double time_children[REB_PROFILING_CAT_N];  ///< Time spent in regions nested in the region
+#ifdef PROFILING_PERF
+    int perf_fd;                                ///< Leader of the counter group, -1 if not opened yet, -2 if not available
+    int perf_events_N;                          ///< Number of counters in the group
+    int perf_events[REB_PROFILING_COUNTER_N];   ///< Counter (REB_PROFILING_COUNTER) of each entry in the group
+    int perf_fds[REB_PROFILING_COUNTER_N];      ///< File descriptor of each entry in the group
+    uint64_t counters_start[REB_PROFILING_CAT_N][REB_PROFILING_COUNTER_N]; ///< Counters when the region was started
+    uint64_t counters[REB_PROFILING_CAT_N][REB_PROFILING_COUNTER_N];       ///< Counters accumulated in the region
+#endif // PROFILING_PERF
+    unsigned long trace_events_N;               ///< Number of events recorded in the trace (including overwritten ones)
+    char padding[64];                           ///< Keeps the counters of different threads in different cache lines
+};
+
+/**
+ * @brief One region in the trace.
+ */
+struct reb_profiling_event {
+    double start;                               ///< Start time, relative to time_start
+    double end;                                 ///< End time, relative to time_start
+    int cat;                                    ///< Region (REB_PROFILING_CAT)
+};
+
+/**
+ * @brief One timestep in the trace.
+ */
+struct reb_profiling_step {
+    double start;                               ///< Start time, relative to time_start
+    double end;                                 ///< End time, relative to time_start
+    double t;                                   ///< Simulation time after the step
+    double dt;                                  ///< Step size (dt_last_done)
+    int N;                                      ///< Number of particles
+    int tree_depth;                             ///< Depth of the tree, 0 if there is no tree
+    int hermes_mini_active;                     ///< 1 if the HERMES mini simulation was active
+    unsigned long long counts[REB_PROFILING_COUNT_N]; ///< Events counted during the step (REB_PROFILING_COUNT)
+};
+
+struct reb_profiling {
+    int threads_N;                              ///< Number of threads with counters
+    double time_start;                          ///< Time profiling was enabled or reset
+    struct reb_profiling_thread* threads;       ///< Counters, one per thread
+    int trace_capacity;                         ///< Size of the ring buffers, 0 if tracing is disabled
+    struct reb_profiling_event** trace_events;  ///< Ring buffer of events, one per thread
+    struct reb_profiling_step* trace_steps;     ///< Ring buffer of timesteps
+    unsigned long trace_steps_N;                ///< Number of timesteps recorded (including overwritten ones)
+    double step_start;                          ///< Start time of the current timestep
+    unsigned long long counts[REB_PROFILING_COUNT_N]; ///< Events counted during the current timestep
+};
+
+static const char* const reb_profiling_names[REB_PROFILING_CAT_N] = {
+    [REB_PROFILING_CAT_INTEGRATOR]        = "integrator",
+    [REB_PROFILING_CAT_BOUNDARY]          = "boundary",
+    [REB_PROFILING_CAT_GRAVITY]           = "gravity",
+    [REB_PROFILING_CAT_COLLISION]         = "collision",
+    [REB_PROFILING_CAT_VISUALIZATION]     = "visualization",
+    [REB_PROFILING_CAT_IO]                = "io",
+    [REB_PROFILING_CAT_TREE]              = "tree",
+    [REB_PROFILING_CAT_TREE_MOMENTS]      = "tree_moments",
+    [REB_PROFILING_CAT_FORCE]             = "force",
+    [REB_PROFILING_CAT_MPI]               = "mpi",
+    [REB_PROFILING_CAT_COLLISION_SEARCH]  = "collision_search",
+    [REB_PROFILING_CAT_COLLISION_RESOLVE] = "collision_resolve",
+    [REB_PROFILING_CAT_KEPLER]            = "kepler",
+    [REB_PROFILING_CAT_IAS15_PREDICTOR]   = "ias15_predictor",
+};
+
+// The region each region is usually nested in.
+static const int reb_profiling_parents[REB_PROFILING_CAT_N] = {
+    [REB_PROFILING_CAT_INTEGRATOR]        = -1,
+    [REB_PROFILING_CAT_BOUNDARY]          = -1,
+    [REB_PROFILING_CAT_GRAVITY]           = -1,
+    [REB_PROFILING_CAT_COLLISION]         = -1,
+    [REB_PROFILING_CAT_VISUALIZATION]     = -1,
+    [REB_PROFILING_CAT_IO]                = -1,
+    [REB_PROFILING_CAT_TREE]              = REB_PROFILING_CAT_GRAVITY,
+    [REB_PROFILING_CAT_TREE_MOMENTS]      = REB_PROFILING_CAT_GRAVITY,
+    [REB_PROFILING_CAT_FORCE]             = REB_PROFILING_CAT_GRAVITY,
+    [REB_PROFILING_CAT_MPI]               = REB_PROFILING_CAT_GRAVITY,
+    [REB_PROFILING_CAT_COLLISION_SEARCH]  = REB_PROFILING_CAT_COLLISION,
+    [REB_PROFILING_CAT_COLLISION_RESOLVE] = REB_PROFILING_CAT_COLLISION,
+    [REB_PROFILING_CAT_KEPLER]            = REB_PROFILING_CAT_INTEGRATOR,
+    [REB_PROFILING_CAT_IAS15_PREDICTOR]   = REB_PROFILING_CAT_INTEGRATOR,
+};
+
+double reb_profiling_clock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+#ifdef PROFILING_PERF
+static const uint64_t reb_profiling_perf_configs[REB_PROFILING_COUNTER_N] = {
+    [REB_PROFILING_COUNTER_CYCLES]           = PERF_COUNT_HW_CPU_CYCLES,
+    [REB_PROFILING_COUNTER_INSTRUCTIONS]     = PERF_COUNT_HW_INSTRUCTIONS,
+    [REB_PROFILING_COUNTER_CACHE_REFERENCES] = PERF_COUNT_HW_CACHE_REFERENCES,
+    [REB_PROFILING_COUNTER_CACHE_MISSES]     = PERF_COUNT_HW_CACHE_MISSES,
+    [REB_PROFILING_COUNTER_BRANCH_MISSES]    = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+// Opens the counters of the calling thread. Counters which cannot be opened are skipped.
+static void reb_profiling_perf_open(struct reb_profiling_thread* const t){
+    t->perf_fd = -2;
+    t->perf_events_N = 0;
+    for (int c=0;c<REB_PROFILING_COUNTER_N;c++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(struct perf_event_attr));
+        attr.size = sizeof(struct perf_event_attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = reb_profiling_perf_configs[c];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        const int leader = t->perf_fd>=0?t->perf_fd:-1;
+        const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd<0) continue;
+        if (leader<0){
+            t->perf_fd = fd;
+        }
+        t->perf_fds[t->perf_events_N] = fd;
+        t->perf_events[t->perf_events_N++] = c;
+    }
+}
+
+// Reads all counters of the calling thread into values (indexed by REB_PROFILING_COUNTER).
+static int reb_profiling_perf_read(struct reb_profiling_thread* const t, uint64_t* const values){
+    uint64_t buf[1+REB_PROFILING_COUNTER_N];
+    if (read(t->perf_fd, buf, sizeof(uint64_t)*(1+t->perf_events_N))<(ssize_t)sizeof(uint64_t)){
+        return 0;
+    }
+    for (uint64_t i=0;i<buf[0] && i<(uint64_t)t->perf_events_N;i++){
+        values[t->perf_events[i]] = buf[1+i];
+    }
+    return 1;
+}
+#endif // PROFILING_PERF
+
+static struct reb_profiling_thread* reb_profiling_thread(const struct reb_simulation* const r){
+#ifdef OPENMP
+    const int thread = omp_get_thread_num();
+#else // OPENMP
+    const int thread = 0;
+#endif // OPENMP
+    if (thread>=r->profiling->threads_N){
+        return NULL; // More threads than when profiling was enabled.
+    }
+    return &(r->profiling->threads[thread]);
+}
+
+void reb_profiling_start(const struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+    struct reb_profiling_thread* const t = reb_profiling_thread(r);
+    if (t==NULL) return;
+    t->parent[cat] = t->current;
+    t->current = cat;
+#ifdef PROFILING_PERF
+    if (t->perf_fd==-1){
+        reb_profiling_perf_open(t);
+    }
+    if (t->perf_fd>=0){
+        reb_profiling_perf_read(t, t->counters_start[cat]);
+    }
+#endif // PROFILING_PERF
+    t->start[cat] = reb_profiling_clock();
+}
+
+void reb_profiling_stop(const struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+    struct reb_profiling_thread* const t = reb_profiling_thread(r);
+    if (t==NULL || t->current!=(int)cat) return;
+    const double dt = reb_profiling_clock() - t->start[cat];
+#ifdef PROFILING_PERF
+    if (t->perf_fd>=0){
+        uint64_t values[REB_PROFILING_COUNTER_N] = {0};
+        if (reb_profiling_perf_read(t, values)){
+            for (int c=0;c<REB_PROFILING_COUNTER_N;c++){
+                t->counters[cat][c] += values[c] - t->counters_start[cat][c];
+            }
+        }
+    }
+#endif // PROFILING_PERF
+    t->time[cat] += dt;
+    t->calls[cat]++;
+    if (r->profiling->trace_capacity){
+        const int thread = t - r->profiling->threads;
+        struct reb_profiling_event* const e = &(r->profiling->trace_events[thread][t->trace_events_N%r->profiling->trace_capacity]);
+        e->start = t->start[cat] - r->profiling->time_start;
+        e->end = e->start + dt;
+        e->cat = cat;
+        t->trace_events_N++;
+    }
+    t->current = t->parent[cat];
+    if (t->current>=0){
+        t->time_children[t->current] += dt;
+    }
+}
+
+void reb_profiling_reset(struct reb_simulation* const r){
+    if (r->profiling==NULL) return;
+    for (int i=0;i<r->profiling->threads_N;i++){
+        struct reb_profiling_thread* const t = &(r->profiling->threads[i]);
+#ifdef PROFILING_PERF
+        // Counters stay open.
+        const int perf_fd = t->perf_fd;
+        const int perf_events_N = t->perf_events_N;
+        int perf_events[REB_PROFILING_COUNTER_N];
+        int perf_fds[REB_PROFILING_COUNTER_N];
+        memcpy(perf_events, t->perf_events, sizeof(perf_events));
+        memcpy(perf_fds, t->perf_fds, sizeof(perf_fds));
+#endif // PROFILING_PERF
+        memset(t, 0, sizeof(struct reb_profiling_thread));
+        t->current = -1;
+#ifdef PROFILING_PERF
+        t->perf_fd = perf_fd;
+        t->perf_events_N = perf_events_N;
+        memcpy(t->perf_events, perf_events, sizeof(perf_events));
+        memcpy(t->perf_fds, perf_fds, sizeof(perf_fds));
+#endif // PROFILING_PERF
+    }
+    r->profiling->trace_steps_N = 0;
+    memset(r->profiling->counts, 0, sizeof(r->profiling->counts));
+    r->profiling->time_start = reb_profiling_clock();
+    r->profiling->step_start = 0.;
+}
+
+void reb_profiling_enable(struct reb_simulation* const r){
+    if (r->profiling) return;
+    r->profiling = calloc(1, sizeof(struct reb_profiling));
+#ifdef OPENMP
+    r->profiling->threads_N = omp_get_max_threads();
+#else // OPENMP
+    r->profiling->threads_N = 1;
+#endif // OPENMP
+    r->profiling->threads = calloc(r->profiling->threads_N, sizeof(struct reb_profiling_thread));
+#ifdef PROFILING_PERF
+    for (int i=0;i<r->profiling->threads_N;i++){
+        r->profiling->threads[i].perf_fd = -1;
+    }
+#endif // PROFILING_PERF
+    reb_profiling_reset(r);
+}
+
+void reb_profiling_disable(struct reb_simulation* const r){
+    if (r->profiling==NULL) return;
+#ifdef PROFILING_PERF
+    for (int i=0;i<r->profiling->threads_N;i++){
+        const struct reb_profiling_thread* const t = &(r->profiling->threads[i]);
+        for (int e=0;e<t->perf_events_N;e++){
+            close(t->perf_fds[e]);
+        }
+    }
+#endif // PROFILING_PERF
+    reb_profiling_trace_disable(r);
+    free(r->profiling->threads);
+    free(r->profiling);
+    r->profiling = NULL;
+}
+
+int reb_profiling_get_threads_N(const struct reb_simulation* const r){
+    if (r->profiling==NULL) return 0;
+    return r->profiling->threads_N;
+}
+
+int reb_profiling_get_counters_N(const struct reb_simulation* const r){
+#ifdef PROFILING_PERF
+    if (r->profiling==NULL) return 0;
+    int counters_N = 0;
+    for (int i=0;i<r->profiling->threads_N;i++){
+        if (r->profiling->threads[i].perf_events_N>counters_N){
+            counters_N = r->profiling->threads[i].perf_events_N;
+        }
+    }
+    return counters_N;
+#else // PROFILING_PERF
+    return 0;
+#endif // PROFILING_PERF
+}
+
+double reb_profiling_get(const struct reb_simulation* const r, const int thread, struct reb_profiling_region* const regions){
+    for (int c=0;c<REB_PROFILING_CAT_N;c++){
+        regions[c] = (struct reb_profiling_region){
+            .name = reb_profiling_names[c], 
+            .parent = reb_profiling_parents[c],
+        };
+    }
+    if (r->profiling==NULL || thread>=r->profiling->threads_N){
+        return -1.;
+    }
+    for (int i=0;i<r->profiling->threads_N;i++){
+        if (thread>=0 && thread!=i) continue;
+        const struct reb_profiling_thread* const t = &(r->profiling->threads[i]);
+        for (int c=0;c<REB_PROFILING_CAT_N;c++){
+            regions[c].calls += t->calls[c];
+            regions[c].time += t->time[c];
+            regions[c].time_self += t->time[c] - t->time_children[c];
+#ifdef PROFILING_PERF
+            for (int e=0;e<REB_PROFILING_COUNTER_N;e++){
+                regions[c].counters[e] += t->counters[c][e];
+            }
+#endif // PROFILING_PERF
+        }
+    }
+    return reb_profiling_clock() - r->profiling->time_start;
+}
+
+static int reb_profiling_tree_depth(const struct reb_treecell* const c){
+    if (c==NULL) return 0;
+    int depth = 0;
+    for (int o=0;o<8;o++){
+        const int d = reb_profiling_tree_depth(c->oct[o]);
+        if (d>depth){
+            depth = d;
+        }
+    }
+    return depth+1;
+}
+
+void reb_profiling_step_start(struct reb_simulation* const r){
+    r->profiling->step_start = reb_profiling_clock() - r->profiling->time_start;
+}
+
+void reb_profiling_step_stop(struct reb_simulation* const r){
+    struct reb_profiling* const p = r->profiling;
+    if (p->trace_capacity){
+        struct reb_profiling_step* const s = &(p->trace_steps[p->trace_steps_N%p->trace_capacity]);
+        s->start = p->step_start;
+        s->end = reb_profiling_clock() - p->time_start;
+        s->t = r->t;
+        s->dt = r->dt_last_done;
+        s->N = r->N;
+        s->tree_depth = 0;
+        if (r->tree_root){
+            for (int i=0;i<r->root_n;i++){
+                const int d = reb_profiling_tree_depth(r->tree_root[i]);
+                if (d>s->tree_depth){
+                    s->tree_depth = d;
+                }
+            }
+        }
+        s->hermes_mini_active = r->integrator==REB_INTEGRATOR_HERMES?r->ri_hermes.mini_active:0;
+        memcpy(s->counts, p->counts, sizeof(p->counts));
+        p->trace_steps_N++;
+    }
+    memset(p->counts, 0, sizeof(p->counts));
+}
+
+void reb_profiling_count(const struct reb_simulation* const r, const enum REB_PROFILING_COUNT count, const unsigned long long n){
+    r->profiling->counts[count] += n;
+}
+
+void reb_profiling_trace_enable(struct reb_simulation* const r, int capacity){
+    reb_profiling_enable(r);
+    reb_profiling_trace_disable(r);
+    if (capacity<1){
+        capacity = 1;
+    }
+    struct reb_profiling* const p = r->profiling;
+    p->trace_events = malloc(sizeof(struct reb_profiling_event*)*p->threads_N);
+    for (int i=0;i<p->threads_N;i++){
+        p->trace_events[i] = malloc(sizeof(struct reb_profiling_event)*capacity);
+        p->threads[i].trace_events_N = 0;
+    }
+    p->trace_steps = malloc(sizeof(struct reb_profiling_step)*capacity);
+    p->trace_steps_N = 0;
+    p->trace_capacity = capacity;
+}
+
+void reb_profiling_trace_disable(struct reb_simulation* const r){
+    struct reb_profiling* const p = r->profiling;
+    if (p==NULL || p->trace_capacity==0) return;
+    for (int i=0;i<p->threads_N;i++){
+        free(p->trace_events[i]);
+    }
+    free(p->trace_events);
+    free(p->trace_steps);
+    p->trace_events = NULL;
+    p->trace_steps = NULL;
+    p->trace_capacity = 0;
+}
+
+int reb_profiling_trace_write(const struct reb_simulation* const r, const char* const filename){
+    const struct reb_profiling* const p = r->profiling;
+    if (p==NULL || p->trace_capacity==0){
+        return -1;
+    }
+    FILE* of = fopen(filename, "w");
+    if (of==NULL){
+        return -1;
+    }
+    const unsigned long capacity = p->trace_capacity;
+    // Times are written in microseconds.
+    fprintf(of, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(of, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"rebound\"}}");
+    for (int i=0;i<p->threads_N;i++){
+        const struct reb_profiling_thread* const t = &(p->threads[i]);
+        if (t->trace_events_N==0) continue;
+        fprintf(of, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}", i, i);
+        const unsigned long first = t->trace_events_N>capacity?t->trace_events_N-capacity:0;
+        for (unsigned long j=first;j<t->trace_events_N;j++){
+            const struct reb_profiling_event* const e = &(p->trace_events[i][j%capacity]);
+            fprintf(of, ",\n{\"name\": \"%s\", \"cat\": \"region\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", 
+                    reb_profiling_names[e->cat], i, e->start*1e6, (e->end-e->start)*1e6);
+        }
+    }
+    const unsigned long first = p->trace_steps_N>capacity?p->trace_steps_N-capacity:0;
+    for (unsigned long j=first;j<p->trace_steps_N;j++){
+        const struct reb_profiling_step* const s = &(p->trace_steps[j%capacity]);
+        const double ts = s->start*1e6;
+        fprintf(of, ",\n{\"name\": \"step\", \"cat\": \"step\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"t\": %.17g, \"dt\": %.17g, \"N\": %d, \"ias15_iterations\": %llu, \"ias15_rejected\": %llu, \"collisions\": %llu, \"tree_depth\": %d, \"hermes_mini_active\": %d}}",
+                ts, (s->end-s->start)*1e6, s->t, s->dt, s->N, 
+                s->counts[REB_PROFILING_COUNT_IAS15_ITERATIONS], s->counts[REB_PROFILING_COUNT_IAS15_REJECTED], s->counts[REB_PROFILING_COUNT_COLLISIONS],
+                s->tree_depth, s->hermes_mini_active);
+        // Counter tracks
+        fprintf(of, ",\n{\"name\": \"dt\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"dt\": %.17g}}", ts, s->dt);
+        fprintf(of, ",\n{\"name\": \"N\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"N\": %d}}", ts, s->N);
+        fprintf(of, ",\n{\"name\": \"ias15\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"iterations\": %llu, \"rejected\": %llu}}", 
+                ts, s->counts[REB_PROFILING_COUNT_IAS15_ITERATIONS], s->counts[REB_PROFILING_COUNT_IAS15_REJECTED]);
+        fprintf(of, ",\n{\"name\": \"collisions\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"collisions\": %llu}}", ts, s->counts[REB_PROFILING_COUNT_COLLISIONS]);
+        fprintf(of, ",\n{\"name\": \"tree_depth\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"tree_depth\": %d}}", ts, s->tree_depth);
+        fprintf(of, ",\n{\"name\": \"hermes_mini_active\", \"ph\": \"C\", \"pid\": 0, \"ts\": %.3f, \"args\": {\"active\": %d}}", ts, s->hermes_mini_active);
+    }
+    fprintf(of, "\n]}\n");
+    const int err = ferror(of);
+    fclose(of);
+    return err?-1:0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file 	profiling.h
+ * @brief 	Timing of the different parts of a simulation.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2017 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PROFILING_H
+#define _PROFILING_H
+
+/**
+  * @brief Starts timing region C on the calling thread. Does nothing unless profiling is enabled.
+  */
+#define PROFILING_START(r,C) if ((r)->profiling){ reb_profiling_start((r),(C)); }
+/**
+  * @brief Stops timing region C on the calling thread. Does nothing unless profiling is enabled.
+  */
+#define PROFILING_STOP(r,C) if ((r)->profiling){ reb_profiling_stop((r),(C)); }
+
+/**
+  * @brief Marks the beginning of a timestep for the trace recorder.
+  */
+#define PROFILING_STEP_START(r) if ((r)->profiling){ reb_profiling_step_start(r); }
+/**
+  * @brief Marks the end of a timestep for the trace recorder.
+  */
+#define PROFILING_STEP_STOP(r) if ((r)->profiling){ reb_profiling_step_stop(r); }
+/**
+  * @brief Adds n to counter C (REB_PROFILING_COUNT) of the current timestep in the trace.
+  */
+#define PROFILING_COUNT(r,C,n) if ((r)->profiling){ reb_profiling_count((r),(C),(n)); }
+
+/**
+ * @brief Events counted during a timestep and stored in the trace.
+ */
+enum REB_PROFILING_COUNT {
+    REB_PROFILING_COUNT_IAS15_ITERATIONS = 0,   ///< Predictor corrector iterations of IAS15
+    REB_PROFILING_COUNT_IAS15_REJECTED = 1,     ///< Rejected IAS15 steps
+    REB_PROFILING_COUNT_COLLISIONS = 2,         ///< Collisions found
+    REB_PROFILING_COUNT_N = 3,                  ///< Number of counters
+};
+
+/**
+  * @brief Starts a region. Use PROFILING_START instead.
+  * @details Regions can be nested. They need to be stopped on the same thread in reverse order.
+  * @param r REBOUND simulation to operate on
+  * @param cat Category of the region (see REB_PROFILING_CAT)
+  */
+void reb_profiling_start(const struct reb_simulation* const r, const enum REB_PROFILING_CAT cat);
+
+/**
+  * @brief Stops a region. Use PROFILING_STOP instead.
+  * @details Does nothing if cat is not the innermost region open on this thread.
+  * @param r REBOUND simulation to operate on
+  * @param cat Category of the region (see REB_PROFILING_CAT)
+  */
+void reb_profiling_stop(const struct reb_simulation* const r, const enum REB_PROFILING_CAT cat);
+
+/**
+  * @brief Marks the beginning of a timestep. Use PROFILING_STEP_START instead.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_profiling_step_start(struct reb_simulation* const r);
+
+/**
+  * @brief Records a timestep in the trace. Use PROFILING_STEP_STOP instead.
+  * @param r REBOUND simulation to operate on
+  */
+void reb_profiling_step_stop(struct reb_simulation* const r);
+
+/**
+  * @brief Adds to a counter of the current timestep. Use PROFILING_COUNT instead.
+  * @param r REBOUND simulation to operate on
+  * @param count Counter (see REB_PROFILING_COUNT)
+  * @param n Value to add
+  */
+void reb_profiling_count(const struct reb_simulation* const r, const enum REB_PROFILING_COUNT count, const unsigned long long n);
+
+/**
+  * @brief Returns the time of a monotonic clock in seconds.
+  */
+double reb_profiling_clock(void);
+
+#endif // _PROFILING_H
@@ -41,14 +41,25 @@
 #include "integrator_whfasthelio.h"
 #include "integrator_ias15.h"
 #include "integrator_hermes.h"
+#include "integrator_janus.h"
+#include "integrator_leapfrog.h"
+#include "integrator_saba.h"
+#include "integrator_mercurius.h"
 #include "boundary.h"
 #include "gravity.h"
+#include "gravity_opencl.h"
+#include "gravity_fft.h"
 #include "collision.h"
 #include "tree.h"
 #include "output.h"
 #include "tools.h"
 #include "particle.h"
 #include "simulationarchive.h"
+#include "output_stream.h"
+#include "output_shm.h"
+#include "metrics.h"
+#include "profiling.h"
+#include "forces.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
@@ -65,10 +76,34 @@ const int reb_max_messages_N = 10;
 const char* reb_build_str = __DATE__ " " __TIME__;  // Date and time build string. 
 const char* reb_version_str = "3.3.1";         // **VERSIONLINE** This line gets updated automatically. Do not edit manually.
 const char* reb_githash_str = STRINGIFY(GITHASH);             // This line gets updated automatically. Do not edit manually.
+#ifdef REB_ZLIB
+const int reb_zlib = 1;                         // Compiled with zlib (ZLIB=1).
+#else // REB_ZLIB
+const int reb_zlib = 0;
+#endif // REB_ZLIB
+
+// Work done at the end of every timestep, after the integrator and the collision search.
+static void reb_step_finish(struct reb_simulation* const r){
+    r->metrics.steps++;
+    if (r->reorder_interval && ++r->reorder_steps>=r->reorder_interval){
+        r->reorder_steps = 0;
+        if (!reb_reorder_particles(r)){
+            r->reorder_interval = 0;
+        }
+    }
+    if (r->particles_soa_enabled){
+        reb_particles_soa_update(r);
+    }
+    if (r->output_shm){
+        reb_output_shm_step(r);
+    }
+    PROFILING_STEP_STOP(r)
+}
 
 void reb_step(struct reb_simulation* const r){
+    PROFILING_STEP_START(r)
     // A 'DKD'-like integrator will do the first 'D' part.
-    PROFILING_START()
+    PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
     if (r->pre_timestep_modifications){
         reb_integrator_synchronize(r);
         r->pre_timestep_modifications(r);
@@ -76,53 +111,96 @@ void reb_step(struct reb_simulation* const r){
         r->ri_whfasthelio.recalculate_heliocentric_this_timestep = 1;
     }
     
+    PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
+
+    if (reb_integrator_leapfrog_fused_step(r)){
+        reb_step_finish(r);
+        return;
+    }
+
+    PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
     reb_integrator_part1(r);
-    PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+    PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
     // Update and simplify tree. 
     // Prepare particles for distribution to other nodes. 
     // This function also creates the tree if called for the first time.
-    if (r->tree_needs_update || r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE){
+    // If only the collision search uses the tree, this is done once, just before the search.
+    const int gravity_tree = (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM);
+    if (r->tree_needs_update || gravity_tree){
         // Check for root crossings.
-        PROFILING_START()
+        PROFILING_START(r, REB_PROFILING_CAT_BOUNDARY)
         reb_boundary_check(r);     
-        PROFILING_STOP(PROFILING_CAT_BOUNDARY)
+        PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
 
         // Update tree (this will remove particles which left the box)
-        PROFILING_START()
+        PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+        PROFILING_START(r, REB_PROFILING_CAT_TREE)
         reb_tree_update(r);          
-        PROFILING_STOP(PROFILING_CAT_GRAVITY)
+        PROFILING_STOP(r, REB_PROFILING_CAT_TREE)
+        PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
     }
 
-    PROFILING_START()
+    PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
 #ifdef MPI
-    // Distribute particles and add newly received particles to tree.
-    reb_communication_mpi_distribute_particles(r);
+    if (r->mpi_num>0 && (gravity_tree || r->collision!=REB_COLLISION_TREE)){ // Not a local simulation
+        // Distribute particles and add newly received particles to tree.
+        PROFILING_START(r, REB_PROFILING_CAT_MPI)
+        reb_communication_mpi_distribute_particles(r);
+        if (r->mpi_balance_interval>0 && ++r->mpi_balance_steps>=r->mpi_balance_interval){
+            reb_mpi_balance(r);
+        }
+        PROFILING_STOP(r, REB_PROFILING_CAT_MPI)
+    }
 #endif // MPI
 
-    if (r->tree_root!=NULL && r->gravity==REB_GRAVITY_TREE){
+    if (r->tree_root!=NULL && (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM)){
         // Update center of mass and quadrupole moments in tree in preparation of force calculation.
+        PROFILING_START(r, REB_PROFILING_CAT_TREE_MOMENTS)
         reb_tree_update_gravity_data(r); 
+        PROFILING_STOP(r, REB_PROFILING_CAT_TREE_MOMENTS)
 #ifdef MPI
-        // Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
-        reb_tree_prepare_essential_tree_for_gravity(r);
+        if (r->mpi_num>0){ // Not a local simulation
+            PROFILING_START(r, REB_PROFILING_CAT_MPI)
+            // Prepare essential tree for distribution to other nodes.
+            reb_tree_prepare_essential_tree_for_gravity(r);
 
-        // Transfer essential tree and particles needed for collisions.
-        reb_communication_mpi_distribute_essential_tree_for_gravity(r);
+            if (r->mpi_pipeline && r->gravity==REB_GRAVITY_TREE && !r->tree_flatten && r->tree_group_size==0){
+                // Start transfer of essential tree. It is completed while calculating the forces.
+                reb_communication_mpi_start_essential_tree_for_gravity(r);
+            }else{
+                // Transfer essential tree.
+                reb_communication_mpi_distribute_essential_tree_for_gravity(r);
+            }
+            PROFILING_STOP(r, REB_PROFILING_CAT_MPI)
+        }
 #endif // MPI
     }
 
     // Calculate accelerations. 
+    PROFILING_START(r, REB_PROFILING_CAT_FORCE)
     reb_calculate_acceleration(r);
     if (r->N_var){
         reb_calculate_acceleration_var(r);
     }
+    PROFILING_STOP(r, REB_PROFILING_CAT_FORCE)
+#ifndef MPI
+    if (r->tree_force_accuracy>0. && r->gravity==REB_GRAVITY_TREE){
+        // Sample the force error and adjust the opening angle.
+        const unsigned int interval = r->tree_force_accuracy_interval>0?r->tree_force_accuracy_interval:1;
+        if (r->tree_force_accuracy_steps%interval==0){
+            reb_calculate_acceleration_tree_accuracy(r);
+        }
+        r->tree_force_accuracy_steps++;
+    }
+#endif // MPI
     // Calculate non-gravity accelerations. 
+    if (r->forces_N) reb_forces_apply(r, r->forces, r->forces_N);
     if (r->additional_forces) r->additional_forces(r);
-    PROFILING_STOP(PROFILING_CAT_GRAVITY)
+    PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
 
     // A 'DKD'-like integrator will do the 'KD' part.
-    PROFILING_START()
+    PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
     reb_integrator_part2(r);
     
     if (r->post_timestep_modifications){
@@ -130,25 +208,39 @@ void reb_step(struct reb_simulation* const r){
         r->post_timestep_modifications(r);
         r->ri_whfast.recalculate_jacobi_this_timestep = 1;
         r->ri_whfasthelio.recalculate_heliocentric_this_timestep = 1;
+        r->ri_mercurius.recalculate_coordinates_this_timestep = 1;
     }
-    PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+    PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
     // Do collisions here. We need both the positions and velocities at the same time.
     // Check for root crossings.
-    PROFILING_START()
+    PROFILING_START(r, REB_PROFILING_CAT_BOUNDARY)
     reb_boundary_check(r);     
-    if (r->tree_needs_update){
-        // Update tree (this will remove particles which left the box)
+    if (r->tree_needs_update || r->collision==REB_COLLISION_TREE){
+        // Update tree (this will remove particles which left the box).
+        // This is the only tree update for the collision search.
+        PROFILING_START(r, REB_PROFILING_CAT_TREE)
         reb_tree_update(r);          
+        PROFILING_STOP(r, REB_PROFILING_CAT_TREE)
     }
-    PROFILING_STOP(PROFILING_CAT_BOUNDARY)
+    PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
+#ifdef MPI
+    if (r->mpi_num>0 && r->collision==REB_COLLISION_TREE){ // Not a local simulation
+        // Distribute particles and add newly received particles to tree.
+        PROFILING_START(r, REB_PROFILING_CAT_MPI)
+        reb_communication_mpi_distribute_particles(r);
+        PROFILING_STOP(r, REB_PROFILING_CAT_MPI)
+    }
+#endif // MPI
 
     // Search for collisions using local and essential tree.
-    PROFILING_START()
+    PROFILING_START(r, REB_PROFILING_CAT_COLLISION)
     if (r->integrator!=REB_INTEGRATOR_HERMES){ //Hybrid integrator will search for collisions in mini simulation.
         reb_collision_search(r);
     }
-    PROFILING_STOP(PROFILING_CAT_COLLISION)
+    PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION)
+
+    reb_step_finish(r);
 }
 
 void reb_exit(const char* const msg){
@@ -237,9 +329,9 @@ void reb_configure_box(struct reb_simulation* const r, const double root_size, c
 #ifdef MPI
 void reb_mpi_init(struct reb_simulation* const r){
     reb_communication_mpi_init(r,0,NULL);
-    // Make sure domain can be decomposed into equal number of root boxes per node.
-    if ((r->root_n/r->mpi_num)*r->mpi_num != r->root_n){
-        if (r->mpi_id==0) fprintf(stderr,"ERROR: Number of root boxes (%d) not a multiple of mpi nodes (%d).\n",r->root_n,r->mpi_num);
+    // Make sure every node gets at least one root box.
+    if (r->root_n < r->mpi_num){
+        if (r->mpi_id==0) fprintf(stderr,"ERROR: Number of root boxes (%d) smaller than number of mpi nodes (%d).\n",r->root_n,r->mpi_num);
         exit(-1);
     }
     printf("MPI-node: %d. Process id: %d.\n",r->mpi_id, getpid());
@@ -271,20 +363,43 @@ void reb_free_pointers(struct reb_simulation* const r){
     reb_tree_delete(r);
     if(r->display_data){
         pthread_mutex_destroy(&(r->display_data->mutex));
-        free(r->display_data->r_copy);
-        free(r->display_data->particles_copy);
-        free(r->display_data->eta_copy);
-        free(r->display_data->p_j_copy);
-        free(r->display_data->p_h_copy);
         free(r->display_data->particle_data);
+        free(r->display_data->particle_data_back);
+        free(r->display_data->particles_inertial);
         free(r->display_data->orbit_data);
+        free(r->display_data->orbit_state);
+        free(r->display_data->ghostbox_shifts);
         free(r->display_data); // TODO: Free other pointers in display_data
     }
     free(r->gravity_cs  );
+    free(r->gravity_soa );
+    free(r->particles_soa.x);
+    free(r->tree_flat);
+    free(r->tree_flat_order);
+    free(r->tree_flat_multipoles);
+    free(r->tree_groups);
+    free(r->tree_task_cost);
+    free(r->tree_task_order);
+    free(r->fmm_multipoles);
+    free(r->fmm_locals);
+    free(r->fmm_rmax);
+    reb_opencl_free(r);
+    reb_fft_free(r);
+    reb_output_stream_free(r);
+    reb_output_shm_close(r);
+    reb_simulationarchive_close(r);
+    reb_profiling_disable(r);
     free(r->collisions  );
+    free(r->sleep_state);
+    free(r->remove_marks);
+    reb_remove_forces(r);
+    reb_collision_verlet_list_free(r);
     reb_integrator_whfast_reset(r);
     reb_integrator_whfasthelio_reset(r);
     reb_integrator_ias15_reset(r);
+    reb_integrator_janus_reset(r);
+    reb_integrator_saba_reset(r);
+    reb_integrator_mercurius_reset(r);
     free(r->particles   );
     free(r->particle_lookup_table);
     if (r->messages){
@@ -299,8 +414,57 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     // Note: this will not clear the particle array.
     r->gravity_cs_allocatedN    = 0;
     r->gravity_cs           = NULL;
+    r->gravity_soa_allocatedN   = 0;
+    r->gravity_soa          = NULL;
+    r->particles_soa        = (struct reb_particles_soa){0};
+    r->tree_root            = NULL;
+    r->tree_cell_blocks     = NULL;
+    r->tree_cell_blocks_N   = 0;
+    r->tree_cell_multipoles = NULL;
+    r->tree_cell_free       = NULL;
+    r->tree_flat            = NULL;
+    r->tree_flat_N          = 0;
+    r->tree_flat_allocatedN = 0;
+    r->tree_flat_order      = NULL;
+    r->tree_flat_order_N    = 0;
+    r->tree_flat_order_allocatedN = 0;
+    r->tree_flat_multipoles = NULL;
+    r->tree_groups          = NULL;
+    r->tree_groups_N        = 0;
+    r->tree_groups_allocatedN = 0;
+    r->tree_task_cost       = NULL;
+    r->tree_task_order      = NULL;
+    r->tree_task_allocatedN = 0;
+    r->fmm_multipoles       = NULL;
+    r->fmm_locals           = NULL;
+    r->fmm_rmax             = NULL;
+    r->fmm_allocatedN       = 0;
+    r->fmm_allocated_order  = 0;
+    r->opencl               = NULL;
+    r->fft                  = NULL;
+    r->ri_janus.p_int_soa   = NULL;
+    r->ri_janus.allocated_N_soa = 0;
+    r->simulationarchive_fd = -1;
+    r->simulationarchive_buffer = NULL;
+    r->simulationarchive_buffer_allocated = 0;
+    r->simulationarchive_fsync_counter = 0;
+    r->simulationarchive_writer = NULL;
+    r->simulationarchive_encoder = NULL;
+    r->output_streams       = NULL;
+    r->output_shm           = NULL;
+    memset(&r->metrics, 0, sizeof(struct reb_metrics));
+    r->metrics.energy_initial = NAN;
+    r->metrics.energy_drift = NAN;
+    r->profiling            = NULL;
     r->collisions_allocatedN    = 0;
     r->collisions           = NULL;
+    r->sleep_state          = NULL;
+    r->sleep_allocatedN     = 0;
+    r->sleep_N              = 0;
+    r->remove_marks         = NULL;
+    r->collision_verlet_list = NULL;
+    r->remove_marks_allocatedN = 0;
+    r->remove_marks_N       = 0;
     r->extras               = NULL;
     r->messages             = NULL;
     // ********** Lookup Table
@@ -311,13 +475,21 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_whfast.allocated_N    = 0;
     r->ri_whfast.eta            = NULL;
     r->ri_whfast.p_j            = NULL;
+    r->ri_whfast.p_j_resume     = NULL;
+    r->ri_whfast.particles_resume = NULL;
+    r->ri_whfast.resume_N       = 0;
+    r->ri_whfast.resume_allocated_N = 0;
     r->ri_whfast.keep_unsynchronized = 0;
     // ********** WHFASTHELIO
     r->ri_whfasthelio.allocated_N  = 0;
     r->ri_whfasthelio.p_h          = NULL;
+    r->ri_whfasthelio.particles_sync = NULL;
+    r->ri_whfasthelio.sync_N       = 0;
+    r->ri_whfasthelio.sync_allocated_N = 0;
     r->ri_whfasthelio.keep_unsynchronized = 0;
     // ********** IAS15
     r->ri_ias15.allocatedN      = 0;
+    r->ri_ias15.csb_allocatedN  = 0;
     set_dp7_null(&(r->ri_ias15.g));
     set_dp7_null(&(r->ri_ias15.b));
     set_dp7_null(&(r->ri_ias15.csb));
@@ -332,6 +504,7 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_ias15.csv         = NULL;
     r->ri_ias15.csa0        = NULL;
     r->ri_ias15.at          = NULL;
+    r->ri_ias15.block       = NULL;
     // ********** HERMES
     r->ri_hermes.mini      = NULL;
     r->ri_hermes.global    = NULL;
@@ -343,9 +516,30 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
     r->ri_hermes.a_Nmax = 0;
     r->ri_hermes.a_i = NULL;
     r->ri_hermes.a_f = NULL;
+    r->ri_hermes.hill_radius = NULL;
+    r->ri_hermes.encounter_intervals = NULL;
+    r->ri_hermes.encounter_intervals_N = 0;
+    r->ri_hermes.encounter_open = NULL;
+    r->ri_hermes.encounter_Nmax = 0;
+    r->ri_hermes.encounter_pairs = NULL;
+    r->ri_hermes.encounter_pairs_N = 0;
+    r->ri_hermes.encounter_pairs_Nmax = 0;
+    // ********** SABA
+    r->ri_saba.corrector_buffer = NULL;
+    r->ri_saba.corrector_buffer_N = 0;
+    // ********** MERCURIUS
+    r->ri_mercurius.allocated_N = 0;
+    r->ri_mercurius.p_h = NULL;
+    r->ri_mercurius.p_h0 = NULL;
+    r->ri_mercurius.dcrit = NULL;
+    r->ri_mercurius.encounter_map = NULL;
+    r->ri_mercurius.encounter_buffer = NULL;
+    r->ri_mercurius.encounter_allocated_N = 0;
     // ********** JANUS
     r->ri_janus.allocated_N = 0;
     r->ri_janus.p_int = NULL;
+    r->ri_janus.allocated_N_soa = 0;
+    r->ri_janus.p_int_soa = NULL;
     r->ri_janus.recalculate_integer_coordinates_this_timestep = 0;
     r->ri_janus.order = 6;
     r->ri_janus.scale_pos = 1e16;
@@ -356,6 +550,7 @@ int reb_reset_function_pointers(struct reb_simulation* const r){
     int wasnotnull = 0;
     if (r->coefficient_of_restitution ||
         r->collision_resolve ||
+        r->collision_resolve_batch ||
         r->additional_forces ||
         r->heartbeat ||
         r->display_heartbeat ||
@@ -366,6 +561,7 @@ int reb_reset_function_pointers(struct reb_simulation* const r){
     }
     r->coefficient_of_restitution   = NULL;
     r->collision_resolve        = NULL;
+    r->collision_resolve_batch  = NULL;
     r->additional_forces        = NULL;
     r->heartbeat            = NULL;
     r->display_heartbeat    = NULL;
@@ -408,9 +604,13 @@ void reb_init_simulation(struct reb_simulation* r){
     r->testparticle_type = 0;   
     r->N_var    = 0;    
     r->var_config_N = 0;    
-    r->var_config   = NULL;     
+    r->var_config   = NULL;
+    r->forces       = NULL;
+    r->forces_N     = 0;
+    r->forces_allocatedN = 0;     
     r->exit_min_distance    = 0;    
     r->exit_max_distance    = 0;    
+    r->exit_min_distance_checked = 0;
     r->max_radius[0]    = 0.;   
     r->max_radius[1]    = 0.;   
     r->status       = REB_RUNNING;
@@ -421,12 +621,44 @@ void reb_init_simulation(struct reb_simulation* r){
     r->output_timing_last   = -1;
     r->save_messages = 0;
     r->track_energy_offset = 0;
+    r->particles_soa_enabled = 0;
+    r->tree_flatten = 0;
+    r->tree_tasks = 0;
+    r->tree_group_size = 0;
+    r->tree_leaf_size = 1;
+    r->fmm_order = 2;
+    r->fft_nx = 64;
+    r->fft_ny = 64;
+    r->fft_rs = 0.;
+    r->tree_rebuild = 0;
+    r->tree_refit = 0;
+    r->tree_active_only = 0;
+    r->tree_force_accuracy = 0.;
+    r->tree_force_accuracy_interval = 100;
+    r->tree_force_accuracy_samples = 32;
+    r->tree_force_accuracy_steps = 0;
+    r->tree_force_error = -1.;
+#ifdef QUADRUPOLE
+    r->multipole_order = 2;
+#else // QUADRUPOLE
+    r->multipole_order = 0;
+#endif // QUADRUPOLE
     r->display_data = NULL;
 
     r->minimum_collision_velocity = 0;
     r->collisions_plog  = 0;
     r->collisions_Nlog  = 0;    
+    r->collisions_seed  = rand();
+    r->rand_seed        = ((uint64_t)rand()<<32) ^ (uint64_t)rand();
+    r->rand_streams     = 0;
     r->collision_resolve_keep_sorted  = 0;    
+    r->collision_resolve_parallel  = 0;    
+    r->collision_swept  = 0;    
+    r->collision_verlet_skin = 0.;
+    r->collision_fused = 0;
+    r->sleep_velocity   = 0.;
+    r->sleep_steps      = 10;
+    r->sleeping_N       = 0;
     
     r->simulationarchive_size_first  = 0;    
     r->simulationarchive_size_snapshot   = 0;    
@@ -435,6 +667,12 @@ void reb_init_simulation(struct reb_simulation* r){
     r->simulationarchive_walltime    = 0.;    
     r->simulationarchive_next        = 0.;    
     r->simulationarchive_filename    = NULL;    
+    r->simulationarchive_fsync_interval = 0;
+    r->simulationarchive_async       = 0;
+    r->simulationarchive_compression = 0;
+    r->simulationarchive_keyframe_interval = 0;
+    r->simulationarchive_extras = 0;
+    r->simulationarchive_member = -1;
     
     // Default modules
 #ifdef OPENGL
@@ -463,11 +701,24 @@ void reb_init_simulation(struct reb_simulation* r){
     r->ri_whfasthelio.is_synchronized = 1;
     r->ri_whfasthelio.recalculate_heliocentric_this_timestep = 0;
     r->ri_whfasthelio.recalculate_heliocentric_but_not_synchronized_warning = 0;
+    // ********** SABA
+    r->ri_saba.type = 2;
+    r->ri_saba.corrector = 0;
+    r->ri_saba.safe_mode = 1;
+    r->ri_saba.is_synchronized = 1;
+    // ********** MERCURIUS
+    r->ri_mercurius.hillfac = 3.;
+    r->ri_mercurius.encounter_epsilon = 1e-12;
+    r->ri_mercurius.safe_mode = 1;
+    r->ri_mercurius.is_synchronized = 1;
+    r->ri_mercurius.recalculate_coordinates_this_timestep = 0;
     
     // ********** IAS15
     r->ri_ias15.epsilon         = 1e-9;
     r->ri_ias15.min_dt      = 0;
     r->ri_ias15.epsilon_global  = 1;
+    r->ri_ias15.block_levels    = 0;
+    r->ri_ias15.lean            = 0;
     r->ri_ias15.iterations_max_exceeded = 0;    
     
     // ********** SEI
@@ -495,6 +746,9 @@ void reb_init_simulation(struct reb_simulation* r){
 #ifdef MPI
     r->mpi_id = 0;                            
     r->mpi_num = 0;                           
+    r->mpi_root_owner = NULL;
+    r->mpi_balance_interval = 0;
+    r->mpi_balance_steps = 0;
     r->particles_send = NULL;  
     r->particles_send_N = 0;                  
     r->particles_send_Nmax = 0;               
@@ -508,6 +762,13 @@ void reb_init_simulation(struct reb_simulation* r){
     r->tree_essential_recv = NULL;
     r->tree_essential_recv_N = 0;             
     r->tree_essential_recv_Nmax = 0;          
+    r->tree_essential_cells = NULL;
+    r->tree_essential_cells_Nmax = NULL;
+    r->mpi_pipeline = 0;
+    r->mpi_thread_support = 0;
+    r->tree_essential_pending = 0;
+    r->tree_essential_recv_requests = NULL;
+    r->tree_essential_send_requests = NULL;
 
 #else // MPI
 #ifndef LIBREBOUND
@@ -517,6 +778,155 @@ void reb_init_simulation(struct reb_simulation* r){
 #ifdef OPENMP
     printf("Using OpenMP with %d threads per node.\n",omp_get_max_threads());
 #endif // OPENMP
+#ifdef PROFILING
+    reb_profiling_enable(r);
+#endif // PROFILING
+}
+
+// Returns a newly allocated copy of size bytes of src, or NULL if src is NULL.
+static void* reb_copy_buffer(const void* const src, const size_t size){
+    if (src==NULL || size==0){
+        return NULL;
+    }
+    void* const dst = malloc(size);
+    memcpy(dst, src, size);
+    return dst;
+}
+
+static void reb_copy_dp7(struct reb_dp7* const dst, const struct reb_dp7* const src, const int N3){
+    const size_t size = sizeof(double)*N3;
+    dst->p0 = reb_copy_buffer(src->p0, size);
+    dst->p1 = reb_copy_buffer(src->p1, size);
+    dst->p2 = reb_copy_buffer(src->p2, size);
+    dst->p3 = reb_copy_buffer(src->p3, size);
+    dst->p4 = reb_copy_buffer(src->p4, size);
+    dst->p5 = reb_copy_buffer(src->p5, size);
+    dst->p6 = reb_copy_buffer(src->p6, size);
+}
+
+void reb_init_simulation_copy(struct reb_simulation* const r_copy, const struct reb_simulation* const r){
+#ifdef MPI
+    if (r->mpi_num>0){
+        reb_init_simulation(r_copy);
+        reb_error(r_copy, "Copying a simulation is only supported for local simulations with MPI.");
+        return;
+    }
+#endif // MPI
+    memcpy(r_copy, r, sizeof(struct reb_simulation));
+    // Caches and scratch space are recreated when needed.
+    reb_reset_temporary_pointers(r_copy);
+    r_copy->ri_whfast.keep_unsynchronized = r->ri_whfast.keep_unsynchronized;
+    r_copy->ri_whfasthelio.keep_unsynchronized = r->ri_whfasthelio.keep_unsynchronized;
+    r_copy->ri_janus.recalculate_integer_coordinates_this_timestep = r->ri_janus.recalculate_integer_coordinates_this_timestep;
+    r_copy->ri_janus.order = r->ri_janus.order;
+    r_copy->ri_janus.scale_pos = r->ri_janus.scale_pos;
+    r_copy->ri_janus.scale_vel = r->ri_janus.scale_vel;
+    // Not shared with the copy: visualization, output files, particle properties added externally.
+    r_copy->display_data = NULL;
+    r_copy->display_heartbeat = NULL;
+    r_copy->simulationarchive_filename = NULL;
+    r_copy->free_particle_ap = NULL;
+    
+    // Particles
+    r_copy->particles = malloc(sizeof(struct reb_particle)*(r->allocatedN>0?r->allocatedN:1));
+    r_copy->allocatedN = r->allocatedN>0?r->allocatedN:1;
+    memcpy(r_copy->particles, r->particles, sizeof(struct reb_particle)*r->N);
+    for (int i=0;i<r->N;i++){
+        r_copy->particles[i].c = NULL;
+        r_copy->particles[i].ap = NULL;
+        r_copy->particles[i].sim = r_copy;
+    }
+    r_copy->var_config = reb_copy_buffer(r->var_config, sizeof(struct reb_variational_configuration)*r->var_config_N);
+    for (int v=0;v<r->var_config_N;v++){
+        r_copy->var_config[v].sim = r_copy;
+    }
+    r_copy->forces = reb_copy_buffer(r->forces, sizeof(struct reb_force)*r->forces_N);
+    r_copy->forces_allocatedN = r->forces_N;
+    r_copy->particle_lookup_table = reb_copy_buffer(r->particle_lookup_table, sizeof(struct reb_hash_pointer_pair)*r->allocatedN_lookup);
+    r_copy->N_lookup = r->N_lookup;
+    r_copy->allocatedN_lookup = r_copy->particle_lookup_table?r->allocatedN_lookup:0;
+    r_copy->remove_marks = reb_copy_buffer(r->remove_marks, sizeof(char)*r->remove_marks_allocatedN);
+    r_copy->remove_marks_allocatedN = r_copy->remove_marks?r->remove_marks_allocatedN:0;
+    r_copy->remove_marks_N = r_copy->remove_marks?r->remove_marks_N:0;
+    r_copy->sleep_state = reb_copy_buffer(r->sleep_state, sizeof(unsigned int)*r->sleep_allocatedN);
+    r_copy->sleep_allocatedN = r_copy->sleep_state?r->sleep_allocatedN:0;
+    r_copy->sleep_N = r_copy->sleep_state?r->sleep_N:0;
+
+    // Integrator state which carries over from one timestep to the next.
+    const int N3 = r->ri_ias15.allocatedN;
+    if (N3){
+        const size_t size = sizeof(double)*N3;
+        reb_copy_dp7(&r_copy->ri_ias15.g, &r->ri_ias15.g, N3);
+        reb_copy_dp7(&r_copy->ri_ias15.b, &r->ri_ias15.b, N3);
+        reb_copy_dp7(&r_copy->ri_ias15.csb, &r->ri_ias15.csb, r->ri_ias15.csb_allocatedN);
+        r_copy->ri_ias15.csb_allocatedN = r->ri_ias15.csb_allocatedN;
+        reb_copy_dp7(&r_copy->ri_ias15.e, &r->ri_ias15.e, N3);
+        reb_copy_dp7(&r_copy->ri_ias15.br, &r->ri_ias15.br, N3);
+        reb_copy_dp7(&r_copy->ri_ias15.er, &r->ri_ias15.er, N3);
+        r_copy->ri_ias15.at = reb_copy_buffer(r->ri_ias15.at, size);
+        r_copy->ri_ias15.x0 = reb_copy_buffer(r->ri_ias15.x0, size);
+        r_copy->ri_ias15.v0 = reb_copy_buffer(r->ri_ias15.v0, size);
+        r_copy->ri_ias15.a0 = reb_copy_buffer(r->ri_ias15.a0, size);
+        r_copy->ri_ias15.csx = reb_copy_buffer(r->ri_ias15.csx, size);
+        r_copy->ri_ias15.csv = reb_copy_buffer(r->ri_ias15.csv, size);
+        r_copy->ri_ias15.csa0 = reb_copy_buffer(r->ri_ias15.csa0, size);
+        r_copy->ri_ias15.allocatedN = N3;
+    }
+    reb_integrator_ias15_block_copy(r_copy, r);
+    if (r->ri_whfast.allocated_N){
+        const int N_real = r->ri_whfast.allocated_N - r->N_var;
+        r_copy->ri_whfast.p_j = reb_copy_buffer(r->ri_whfast.p_j, sizeof(struct reb_particle)*r->ri_whfast.allocated_N);
+        r_copy->ri_whfast.eta = reb_copy_buffer(r->ri_whfast.eta, sizeof(double)*(N_real>0?N_real:0));
+        r_copy->ri_whfast.allocated_N = r->ri_whfast.allocated_N;
+    }
+    if (r->ri_whfast.resume_N){
+        r_copy->ri_whfast.p_j_resume = reb_copy_buffer(r->ri_whfast.p_j_resume, sizeof(struct reb_particle)*r->ri_whfast.resume_N);
+        r_copy->ri_whfast.particles_resume = reb_copy_buffer(r->ri_whfast.particles_resume, sizeof(struct reb_particle)*r->ri_whfast.resume_N);
+        r_copy->ri_whfast.resume_N = r->ri_whfast.resume_N;
+        r_copy->ri_whfast.resume_allocated_N = r->ri_whfast.resume_N;
+        r_copy->ri_whfast.resume_dt = r->ri_whfast.resume_dt;
+    }
+    if (r->ri_whfasthelio.allocated_N){
+        r_copy->ri_whfasthelio.p_h = reb_copy_buffer(r->ri_whfasthelio.p_h, sizeof(struct reb_particle)*r->ri_whfasthelio.allocated_N);
+        r_copy->ri_whfasthelio.allocated_N = r->ri_whfasthelio.allocated_N;
+    }
+    if (r->ri_whfasthelio.sync_N){
+        r_copy->ri_whfasthelio.particles_sync = reb_copy_buffer(r->ri_whfasthelio.particles_sync, sizeof(struct reb_particle)*r->ri_whfasthelio.sync_N);
+        r_copy->ri_whfasthelio.sync_N = r->ri_whfasthelio.sync_N;
+        r_copy->ri_whfasthelio.sync_allocated_N = r->ri_whfasthelio.sync_N;
+    }
+    if (r->ri_janus.allocated_N){
+        r_copy->ri_janus.p_int = reb_copy_buffer(r->ri_janus.p_int, sizeof(struct reb_particle_int)*r->ri_janus.allocated_N);
+        r_copy->ri_janus.allocated_N = r->ri_janus.allocated_N;
+    }
+    if (r->ri_mercurius.allocated_N){
+        const unsigned int N = r->ri_mercurius.allocated_N;
+        r_copy->ri_mercurius.p_h = reb_copy_buffer(r->ri_mercurius.p_h, sizeof(struct reb_particle)*N);
+        r_copy->ri_mercurius.p_h0 = reb_copy_buffer(r->ri_mercurius.p_h0, sizeof(struct reb_particle)*N);
+        r_copy->ri_mercurius.dcrit = reb_copy_buffer(r->ri_mercurius.dcrit, sizeof(double)*N);
+        r_copy->ri_mercurius.encounter_map = reb_copy_buffer(r->ri_mercurius.encounter_map, sizeof(int)*2*N);
+        r_copy->ri_mercurius.allocated_N = N;
+    }
+    if (r->ri_mercurius.encounter_allocated_N){
+        const unsigned int N_enc = r->ri_mercurius.encounter_allocated_N;
+        r_copy->ri_mercurius.encounter_buffer = reb_copy_buffer(r->ri_mercurius.encounter_buffer, sizeof(double)*6*N_enc*(MERCURIUS_BS_KMAX+5));
+        r_copy->ri_mercurius.encounter_allocated_N = N_enc;
+    }
+#ifdef PROFILING
+    reb_profiling_enable(r_copy);
+#endif // PROFILING
+}
+
+struct reb_simulation* reb_copy_simulation(const struct reb_simulation* const r){
+#ifdef MPI
+    if (r->mpi_num>0){
+        reb_warning((struct reb_simulation*)r, "Copying a simulation is only supported for local simulations with MPI.");
+        return NULL;
+    }
+#endif // MPI
+    struct reb_simulation* const r_copy = malloc(sizeof(struct reb_simulation));
+    reb_init_simulation_copy(r_copy, r);
+    return r_copy;
 }
 
 int reb_check_exit(struct reb_simulation* const r, const double tmax, double* last_full_dt){
@@ -565,27 +975,41 @@ int reb_check_exit(struct reb_simulation* const r, const double tmax, double* la
             }
         }
     }
-#ifndef MPI
+#ifdef MPI
+    if (r->mpi_num>0){ // Not a local simulation
+        int status_max = 0;
+        MPI_Allreduce(&(r->status), &status_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD); 
+        if (status_max>=0){
+            r->status = status_max;
+        }
+        return r->status;
+    }
+#endif // MPI
     if (r->N<=0){
         reb_warning(r,"No particles found. Will exit.");
         r->status = REB_EXIT_NOPARTICLES; // Exit now.
     }
-#else
-    int status_max = 0;
-    MPI_Allreduce(&(r->status), &status_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD); 
-    if (status_max>=0){
-        r->status = status_max;
-    }
-
-#endif // MPI
     return r->status;
 }
 
 
 void reb_run_heartbeat(struct reb_simulation* const r){
-    if (r->simulationarchive_filename){ reb_simulationarchive_heartbeat(r);}
-    if (r->heartbeat){ r->heartbeat(r); }               // Heartbeat
-    if (r->display_heartbeat){ reb_check_for_display_heartbeat(r); } 
+    if (r->simulationarchive_filename){ 
+        PROFILING_START(r, REB_PROFILING_CAT_IO)
+        reb_simulationarchive_heartbeat(r);
+        PROFILING_STOP(r, REB_PROFILING_CAT_IO)
+    }
+    if (r->heartbeat){                                  // Heartbeat
+        if (r->heartbeat_interval<=1 || ++r->heartbeat_steps>=r->heartbeat_interval){
+            r->heartbeat_steps = 0;
+            r->heartbeat(r);
+        }
+    }
+    if (r->display_heartbeat){ 
+        PROFILING_START(r, REB_PROFILING_CAT_VISUALIZATION)
+        reb_check_for_display_heartbeat(r); 
+        PROFILING_STOP(r, REB_PROFILING_CAT_VISUALIZATION)
+    } 
     if (r->exit_max_distance){
         // Check for escaping particles
         const double max2 = r->exit_max_distance * r->exit_max_distance;
@@ -601,22 +1025,29 @@ void reb_run_heartbeat(struct reb_simulation* const r){
     }
     if (r->exit_min_distance){
         // Check for close encounters
-        const double min2 = r->exit_min_distance * r->exit_min_distance;
-        const struct reb_particle* const particles = r->particles;
-        const int N = r->N - r->N_var;
-        for (int i=0;i<N;i++){
-            struct reb_particle pi = particles[i];
-            for (int j=0;j<i;j++){
-                struct reb_particle pj = particles[j];
-                const double x = pi.x-pj.x;
-                const double y = pi.y-pj.y;
-                const double z = pi.z-pj.z;
-                const double r2 = x*x + y*y + z*z;
-                if (r2<min2){
-                    r->status = REB_EXIT_ENCOUNTER;
+        if (r->exit_min_distance_checked==2){
+            // Found during the force calculation
+            r->status = REB_EXIT_ENCOUNTER;
+        }else if (r->exit_min_distance_checked==0){
+            const double min2 = r->exit_min_distance * r->exit_min_distance;
+            const struct reb_particle* const particles = r->particles;
+            const int N = r->N - r->N_var;
+            for (int i=0;i<N && r->status!=REB_EXIT_ENCOUNTER;i++){
+                struct reb_particle pi = particles[i];
+                for (int j=0;j<i;j++){
+                    struct reb_particle pj = particles[j];
+                    const double x = pi.x-pj.x;
+                    const double y = pi.y-pj.y;
+                    const double z = pi.z-pj.z;
+                    const double r2 = x*x + y*y + z*z;
+                    if (r2<min2){
+                        r->status = REB_EXIT_ENCOUNTER;
+                        break;
+                    }
                 }
             }
         }
+        r->exit_min_distance_checked = 0;
     }
     if (r->usleep > 0){
         usleep(r->usleep);
@@ -629,37 +1060,144 @@ void reb_run_heartbeat(struct reb_simulation* const r){
 struct reb_thread_info {
     struct reb_simulation* r;
     double tmax;
+    struct reb_integrate_async* async;  // NULL unless started with reb_integrate_async()
+    const double* samples_times;        // NULL unless started with reb_integrate_samples(), tmax is not used otherwise
+    int samples_n;
+    int samples_done;
+    struct reb_samples* samples;
 };
 
+/**
+ * @brief Stores sample k of reb_integrate_samples() in the output buffers.
+ */
+static void reb_integrate_samples_store(struct reb_simulation* const r, struct reb_samples* const out, const int k){
+    const int N = out->N;
+    const int N_real = r->N - r->N_var;
+    const struct reb_particle* const particles = r->particles;
+    if (out->t){
+        out->t[k] = r->t;
+    }
+    if (out->xyz){
+        double* const xyz = out->xyz + 3*N*k;
+        for (int i=0;i<N;i++){
+            xyz[3*i+0] = i<N_real?particles[i].x:NAN;
+            xyz[3*i+1] = i<N_real?particles[i].y:NAN;
+            xyz[3*i+2] = i<N_real?particles[i].z:NAN;
+        }
+    }
+    if (out->vxvyvz){
+        double* const vxvyvz = out->vxvyvz + 3*N*k;
+        for (int i=0;i<N;i++){
+            vxvyvz[3*i+0] = i<N_real?particles[i].vx:NAN;
+            vxvyvz[3*i+1] = i<N_real?particles[i].vy:NAN;
+            vxvyvz[3*i+2] = i<N_real?particles[i].vz:NAN;
+        }
+    }
+    if (out->orbits && N>1){
+        double* const orbits = out->orbits + 6*(N-1)*k;
+        struct reb_particle com = particles[0];
+        for (int i=1;i<N;i++){
+            double* const o = orbits + 6*(i-1);
+            if (i<N_real){
+                struct reb_orbit orbit = reb_tools_particle_to_orbit(r->G, particles[i], com);
+                o[0] = orbit.a;
+                o[1] = orbit.e;
+                o[2] = orbit.inc;
+                o[3] = orbit.Omega;
+                o[4] = orbit.omega;
+                o[5] = orbit.f;
+                com = reb_get_com_of_pair(com, particles[i]);
+            }else{
+                for (int j=0;j<6;j++){
+                    o[j] = NAN;
+                }
+            }
+        }
+    }
+    if (out->energy){
+        out->energy[k] = reb_tools_energy(r);
+    }
+}
+
+/**
+ * @brief Called by the worker thread of reb_integrate_async() after every timestep.
+ * @details Publishes the progress and handles cancel and snapshot requests. 
+ * All communication with the caller's thread uses atomic operations.
+ */
+static void reb_integrate_async_step_done(struct reb_integrate_async* const a){
+    struct reb_simulation* const r = a->r;
+    __atomic_store(&(a->t), &(r->t), __ATOMIC_RELEASE);
+    __atomic_add_fetch(&(a->steps), 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&(a->cancel), __ATOMIC_ACQUIRE)){
+        r->status = REB_EXIT_USER;
+    }
+    if (__atomic_exchange_n(&(a->snapshot_requested), 0, __ATOMIC_ACQ_REL)){
+        struct reb_simulation* const copy = reb_copy_simulation(r);
+        struct reb_simulation* const old = __atomic_exchange_n(&(a->snapshot), copy, __ATOMIC_ACQ_REL);
+        if (old){
+            // Previous snapshot has not been picked up by the caller.
+            reb_free_simulation(old);
+        }
+    }
+}
+
 static void* reb_integrate_raw(void* args){
     struct reb_thread_info* thread_info = (struct reb_thread_info*)args;
+    struct reb_simulation* const r = thread_info->r;
 #ifdef MPI
-    // Distribute particles
-    reb_communication_mpi_distribute_particles(r);
+    if (r->mpi_num>0){ // Not a local simulation
+        // Distribute particles
+        reb_communication_mpi_distribute_particles(r);
+    }
 #endif // MPI
-    struct reb_simulation* const r = thread_info->r;
 
     double last_full_dt = r->dt; // need to store r->dt in case timestep gets artificially shrunk to meet exact_finish_time=1
     r->dt_last_done = 0.; // Reset in case first timestep attempt will fail
 
     r->status = REB_RUNNING;
+    reb_metrics_integrate_start(r);
+    r->heartbeat_steps = r->heartbeat_interval-1; // Always call the heartbeat function at the beginning
+    r->exit_min_distance_checked = 0; // Particles might have changed since the last force calculation
     reb_run_heartbeat(r);
-    while(reb_check_exit(r,thread_info->tmax,&last_full_dt)<0){
+    double tmax = thread_info->samples_times?thread_info->samples_times[0]:thread_info->tmax;
+    while(1){
+        while(reb_check_exit(r,tmax,&last_full_dt)<0){
 #ifdef OPENGL
-        if (r->display_data){
-            if (r->display_data->opengl_enabled){ pthread_mutex_lock(&(r->display_data->mutex)); }
-        }
+            if (r->display_data){
+                if (r->display_data->opengl_enabled){ pthread_mutex_lock(&(r->display_data->mutex)); }
+            }
 #endif // OPENGL
-        reb_step(r); 
-        reb_run_heartbeat(r);
+            reb_step(r); 
+            reb_run_heartbeat(r);
+            if (thread_info->async){
+                reb_integrate_async_step_done(thread_info->async);
+            }
 #ifdef OPENGL
-        if (r->display_data){
-            if (r->display_data->opengl_enabled){ pthread_mutex_unlock(&(r->display_data->mutex)); }
-        }
+            if (r->display_data){
+                if (r->display_data->opengl_enabled){ pthread_mutex_unlock(&(r->display_data->mutex)); }
+            }
 #endif // OPENGL
+        }
+        if (thread_info->samples_times==NULL || r->status!=REB_EXIT_SUCCESS){
+            break;
+        }
+        // Sample time reached. Continue with the next one as if reb_integrate() was called again.
+        reb_integrator_synchronize(r);
+        if(r->exact_finish_time==1){
+            r->dt = last_full_dt; 
+        }
+        reb_integrate_samples_store(r, thread_info->samples, thread_info->samples_done);
+        thread_info->samples_done++;
+        if (thread_info->samples_done>=thread_info->samples_n){
+            break;
+        }
+        tmax = thread_info->samples_times[thread_info->samples_done];
+        r->dt_last_done = 0.;
+        r->status = REB_RUNNING;
     }
 
     reb_integrator_synchronize(r);
+    reb_metrics_integrate_stop(r);
     if (r->display_heartbeat){                          // Display Heartbeat
         r->display_heartbeat(r); 
     }
@@ -670,18 +1208,15 @@ static void* reb_integrate_raw(void* args){
     return NULL;
 }
 
-enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax){
-    struct reb_thread_info thread_info = {
-        .r = r,
-        .tmax = tmax, 
-    };
+static void reb_integrate_with_visualization(struct reb_thread_info* const thread_info){
+    struct reb_simulation* const r = thread_info->r;
     switch (r->visualization){
         case REB_VISUALIZATION_NONE:
             {
                 if (r->display_data){
                     r->display_data->opengl_enabled = 0;
                 }
-                reb_integrate_raw(&thread_info);
+                reb_integrate_raw(thread_info);
             }
             break;
         case REB_VISUALIZATION_OPENGL:
@@ -691,7 +1226,7 @@ enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax){
                 r->display_data->opengl_enabled = 1;
 
                 pthread_t compute_thread;
-                if (pthread_create(&compute_thread,NULL,reb_integrate_raw,&thread_info)){
+                if (pthread_create(&compute_thread,NULL,reb_integrate_raw,thread_info)){
                     reb_error(r, "Error creating display thread.");
                 }
                 
@@ -702,17 +1237,125 @@ enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax){
                 }
 #else // OPENGL
                 reb_error(r,"REBOUND was not compiled/linked with OPENGL libraries.");
-                return REB_EXIT_ERROR; 
+                r->status = REB_EXIT_ERROR; 
 #endif // OPENGL
             }
             break;
         case REB_VISUALIZATION_WEBGL:
             {
                 reb_display_init_data(r);
-                reb_integrate_raw(&thread_info);
+                reb_integrate_raw(thread_info);
             }
             break;
     }
+}
+
+enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax){
+    struct reb_thread_info thread_info = {
+        .r = r,
+        .tmax = tmax, 
+        .async = NULL,
+        .samples_times = NULL,
+    };
+    reb_integrate_with_visualization(&thread_info);
+    return r->status;
+}
+
+int reb_integrate_samples(struct reb_simulation* const r, const double* const times, const int n, struct reb_samples* const out){
+    if (n<=0){
+        return 0;
+    }
+    const double dtsign = copysign(1.,r->dt);
+    for (int k=1;k<n;k++){
+        if (times[k]*dtsign<times[k-1]*dtsign){
+            reb_error(r, "Sample times need to be sorted in the direction of the integration.");
+            return -1;
+        }
+    }
+    if (out->N<=0){
+        out->N = r->N - r->N_var;
+    }
+    struct reb_thread_info thread_info = {
+        .r = r,
+        .tmax = times[n-1], 
+        .async = NULL,
+        .samples_times = times,
+        .samples_n = n,
+        .samples_done = 0,
+        .samples = out,
+    };
+    reb_integrate_with_visualization(&thread_info);
+    return thread_info.samples_done;
+}
+
+static void* reb_integrate_async_raw(void* args){
+    struct reb_integrate_async* const a = (struct reb_integrate_async*)args;
+    struct reb_thread_info thread_info = {
+        .r = a->r,
+        .tmax = a->tmax, 
+        .async = a,
+    };
+    reb_integrate_raw(&thread_info);
+    __atomic_store(&(a->t), &(a->r->t), __ATOMIC_RELEASE);
+    __atomic_store_n(&(a->status), a->r->status, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+struct reb_integrate_async* reb_integrate_async(struct reb_simulation* const r, double tmax){
+    if (r->visualization==REB_VISUALIZATION_OPENGL){
+        reb_error(r, "Asynchronous integrations do not support OpenGL visualization.");
+        return NULL;
+    }
+    if (r->visualization==REB_VISUALIZATION_WEBGL){
+        reb_display_init_data(r);
+    }
+    if (r->display_data){
+        r->display_data->opengl_enabled = 0;
+    }
+    struct reb_integrate_async* const a = calloc(1, sizeof(struct reb_integrate_async));
+    a->r = r;
+    a->tmax = tmax;
+    a->t = r->t;
+    a->status = REB_RUNNING;
+    if (pthread_create(&(a->thread), NULL, reb_integrate_async_raw, a)){
+        reb_error(r, "Error creating integration thread.");
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+enum REB_STATUS reb_integrate_async_poll(struct reb_integrate_async* const a, double* t, unsigned long long* steps){
+    if (t){
+        __atomic_load(&(a->t), t, __ATOMIC_ACQUIRE);
+    }
+    if (steps){
+        *steps = __atomic_load_n(&(a->steps), __ATOMIC_ACQUIRE);
+    }
+    return __atomic_load_n(&(a->status), __ATOMIC_ACQUIRE);
+}
+
+void reb_integrate_async_request_snapshot(struct reb_integrate_async* const a){
+    __atomic_store_n(&(a->snapshot_requested), 1, __ATOMIC_RELEASE);
+}
+
+struct reb_simulation* reb_integrate_async_snapshot(struct reb_integrate_async* const a){
+    return __atomic_exchange_n(&(a->snapshot), NULL, __ATOMIC_ACQ_REL);
+}
+
+void reb_integrate_async_cancel(struct reb_integrate_async* const a){
+    __atomic_store_n(&(a->cancel), 1, __ATOMIC_RELEASE);
+}
+
+enum REB_STATUS reb_integrate_async_wait(struct reb_integrate_async* const a){
+    struct reb_simulation* const r = a->r;
+    if (pthread_join(a->thread, NULL)){
+        reb_error(r, "Error joining integration thread.");
+    }
+    if (a->snapshot){
+        reb_free_simulation(a->snapshot);
+    }
+    free(a);
     return r->status;
 }
 
@@ -42,11 +42,22 @@
 extern const char* reb_build_str;   ///< Date and time build string.
 extern const char* reb_version_str; ///< Version string.
 extern const char* reb_githash_str; ///< Current git hash.
+extern const int reb_zlib;          ///< 1 if REBOUND has been compiled with zlib (ZLIB=1). Needed for compressed SimulationArchives.
 extern const char* reb_logo[26];    ///< Logo of rebound. 
 
 // Forward declarations
 struct reb_simulation;
 struct reb_display_data;
+struct reb_collision_verlet_list;
+struct reb_ias15_block;
+struct reb_hermes_interval;
+struct reb_opencl;
+struct reb_fft;
+struct reb_simulationarchive_writer;
+struct reb_simulationarchive_encoder;
+struct reb_output_stream;
+struct reb_output_shm;
+struct reb_profiling;
 
 /**
  * @brief Generic 3d vector, for internal use only.
@@ -114,6 +125,31 @@ struct reb_simulation_integrator_ias15 {
      **/
     unsigned int epsilon_global;
 
+    /**
+     * @brief Maximum number of block timestep levels.
+     * @details If set to a value larger than 0, particles which require a much smaller timestep 
+     * than the rest of the system (for example the components of a tight binary or particles 
+     * undergoing a close encounter) are integrated with 2^level substeps per global timestep, 
+     * where level is at most block_levels. All other particles use the global timestep. 
+     * The partition is chosen automatically after every step. This option requires 
+     * REB_GRAVITY_BASIC, no boundary ghost boxes, no additional forces, no variational 
+     * equations and no MEGNO. The default is 0 (block timesteps turned off, every particle 
+     * uses the same timestep).
+     **/
+    unsigned int block_levels;
+
+    /**
+     * @brief Memory-lean storage of the integrator state.
+     * @details If set to 1, the b and e values of the last successful step (br and er) are
+     * not stored. This saves 42 doubles per particle in memory and in every Simulation Archive snapshot.
+     * If a step gets rejected, the b values of the rejected step, rescaled to the new timestep, 
+     * are used as the initial guess instead. Dense output is not available in this mode. If set to 2, 
+     * test particles (those with an index larger or equal to N_active) additionally do not 
+     * use compensated summation for their b values, saving another 21 doubles per test particle.
+     * The value must not be changed after a Simulation Archive has been started. This does
+     * not affect the buffers used for block timesteps. The default is 0 (all buffers are used).
+     **/
+    unsigned int lean;
 
     
     /**
@@ -128,6 +164,7 @@ struct reb_simulation_integrator_ias15 {
 
 
     int allocatedN;             ///< Size of allocated arrays.
+    int csb_allocatedN;         ///< Size of the allocated csb arrays. Smaller than allocatedN if lean>=2.
 
     double* restrict at;            ///< Temporary buffer for acceleration
     double* restrict x0;            ///<                      position (used for initial values at h=0) 
@@ -145,6 +182,8 @@ struct reb_simulation_integrator_ias15 {
     // The following values are used for resetting the b and e coefficients if a timestep gets rejected
     struct reb_dp7 br;
     struct reb_dp7 er;
+
+    struct reb_ias15_block* block;  ///< Internal data structures for block timesteps. See block_levels.
     /**
      * @endcond
      */
@@ -182,6 +221,16 @@ struct reb_simulation_integrator_hermes {
     double* a_f;
     int a_Nmax;
     
+    double* hill_radius;                    ///< Hill radius of each particle, computed once per encounter check.
+    struct reb_hermes_interval* encounter_intervals; ///< Intervals of the encounter sweep, kept sorted between timesteps.
+    int encounter_intervals_N;              ///< Number of intervals (N-1 if the sorting is valid, 0 otherwise).
+    int encounter_axis;                     ///< Axis along which the sweep is performed (0=x, 1=y, 2=z).
+    int* encounter_open;                    ///< Open intervals during the sweep (2*encounter_Nmax).
+    int encounter_Nmax;                     ///< Allocated size of hill_radius, encounter_intervals and encounter_open.
+    int* encounter_pairs;                   ///< Particle pairs (i,j) that fulfill the encounter criterion.
+    int encounter_pairs_N;
+    int encounter_pairs_Nmax;
+    
     int timestep_too_large_warning;
     unsigned long long steps;
     unsigned long long steps_miniactive;
@@ -223,6 +272,11 @@ struct reb_simulation_integrator_whfast {
      * - 5: uses fifth order (four-stage) corrector 
      * - 7: uses seventh order (six-stage) corrector 
      * - 11: uses eleventh order (ten-stage) corrector 
+     *
+     * If safe_mode is 0 and the particles have not been modified since the last 
+     * synchronization, the integration resumes from the unsynchronized Jacobi 
+     * coordinates. The corrector is then only applied when the simulation gets
+     * synchronized (e.g. for an output), and outputs do not change the trajectory.
      */
     unsigned int corrector;
 
@@ -231,6 +285,9 @@ struct reb_simulation_integrator_whfast {
      * @details After the timestep, the flag gets set back to 0. 
      * If you want to change particles after every timestep, you 
      * also need to set this flag to 1 before every timestep.
+     * If safe_mode is 0 and the simulation was synchronized by WHFast, only the 
+     * Jacobi coordinates of the first modified particle and the ones following 
+     * it in the Jacobi chain are recalculated.
      * Default is 0.
      */ 
     unsigned int recalculate_jacobi_this_timestep;
@@ -272,6 +329,118 @@ struct reb_simulation_integrator_whfast {
     unsigned int allocated_N;   ///< Space allocated in arrays
     unsigned int timestep_warning;  ///< Counter of timestep warnings
     unsigned int recalculate_jacobi_but_not_synchronized_warning;   ///< Counter of Jacobi synchronization errors
+    unsigned int N_massive;     ///< Number of particles which are not massless test particles, set when Jacobi coordinates are recalculated (0 if unknown)
+    struct reb_particle* restrict p_j_resume;       ///< Unsynchronized Jacobi coordinates before the last synchronization (safe_mode=0 only)
+    struct reb_particle* restrict particles_resume; ///< Particles right after the last synchronization, used to detect modifications
+    unsigned int resume_N;      ///< Number of particles in p_j_resume, 0 if the integration cannot be resumed from it
+    unsigned int resume_allocated_N; ///< Space allocated in p_j_resume and particles_resume
+    double resume_dt;           ///< Timestep used by the last synchronization
+    /**
+     * @endcond
+     */
+};
+
+/**
+ * @brief This structure contains variables used by the SABA integrators.
+ * @details The SABAn and SABACn schemes of Laskar & Robutel (2001) split the Hamiltonian
+ * into the Keplerian part and the interaction part in Jacobi coordinates, like WHFast,
+ * but chain n kicks and n+1 drifts per timestep. For a perturbation of size epsilon, 
+ * the error of SABAn is of order epsilon*dt^(2n) + epsilon^2*dt^2. The SABACn schemes 
+ * additionally remove the epsilon^2*dt^2 term with a corrector. SABA uses the Jacobi 
+ * coordinates and masses in ri_whfast (p_j, eta and recalculate_jacobi_this_timestep).
+ */
+struct reb_simulation_integrator_saba {
+    /**
+     * @brief Number of stages (kicks) per timestep, between 1 and 4. 
+     * @details Default is 2 (SABA2). SABA1 is equivalent to WHFast without correctors.
+     */
+    unsigned int type;
+
+    /**
+     * @brief If this flag is set, the SABACn scheme is used instead of SABAn.
+     * @details The corrector needs three additional force evaluations per timestep 
+     * (six in safe_mode). Default is 0.
+     */
+    unsigned int corrector;
+
+    /**
+     * @brief If this flag is set (the default), SABA will recalculate Jacobi coordinates and synchronize
+     * every timestep. 
+     * @details Setting it to 0 combines the last drift of one timestep with the first drift
+     * of the next one (and the correctors if enabled). Care must then be taken to synchronize 
+     * and to set ri_whfast.recalculate_jacobi_this_timestep when particles are modified.
+     */
+    unsigned int safe_mode;
+
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    unsigned int is_synchronized;   ///< Flag to determine if current particle structure is synchronized
+    double* restrict corrector_buffer;  ///< Jacobi positions and accelerations used by the corrector
+    unsigned int corrector_buffer_N;    ///< Number of particles for which corrector_buffer has space
+    /**
+     * @endcond
+     */
+};
+
+/**
+ * @brief This structure contains variables used by the MERCURIUS integrator.
+ * @details MERCURIUS is a hybrid symplectic integrator in the democratic heliocentric
+ * coordinates of WHFastHelio. The interaction between two planets is split with a smooth 
+ * changeover function K(r) (Chambers 1999). The part K(r) is integrated in the kick step, the 
+ * part 1-K(r) together with the Keplerian motion. Particles which come closer than their 
+ * changeover radius during a drift step are integrated with an adaptive Bulirsch-Stoer 
+ * integrator, all other particles with the WHFast Kepler solver. No separate simulation 
+ * is created for encounters. The gravity routine is ignored, interactions are calculated by 
+ * direct summation.
+ */
+struct reb_simulation_integrator_mercurius {
+    /**
+     * @brief Changeover radius in units of the Hill radius. 
+     * @details The changeover radius of a particle is the largest of hillfac Hill radii, 
+     * 0.4 times the distance it travels in a timestep and twice its physical radius. 
+     * For a pair of particles, the larger of the two radii is used. Default is 3.
+     */
+    double hillfac;
+
+    /**
+     * @brief Relative accuracy of positions and velocities in the Bulirsch-Stoer integrator for close encounters.
+     * @details Default is 1e-12.
+     */
+    double encounter_epsilon;
+
+    /** 
+     * @brief Setting this flag to one will recalculate heliocentric coordinates and changeover radii from the particle structure in the next timestep. 
+     * @details After the timestep, the flag gets set back to 0. 
+     */ 
+    unsigned int recalculate_coordinates_this_timestep;
+
+    /**
+     * @brief If this flag is set (the default), MERCURIUS synchronizes and recalculates the heliocentric 
+     * coordinates and changeover radii every timestep.
+     * @details Setting it to 0 combines the last kick of one timestep with the first kick of the next one.
+     * The changeover radii are then kept fixed, which is needed for the scheme to be symplectic.
+     */
+    unsigned int safe_mode;
+
+    /**
+     * @brief Number of particles which were integrated with the Bulirsch-Stoer integrator in the last timestep.
+     */
+    unsigned int encounter_N;
+
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    unsigned int is_synchronized;   ///< Flag to determine if current particle structure is synchronized
+    unsigned int allocated_N;       ///< Space allocated in p_h, p_h0, dcrit and encounter_map
+    struct reb_particle* restrict p_h;  ///< Democratic heliocentric coordinates
+    struct reb_particle* restrict p_h0; ///< Scratch space for the drift step
+    double* restrict dcrit;         ///< Changeover radius of each particle
+    int* restrict encounter_map;    ///< Indices of the particles in close encounters, followed by a flag for every particle
+    double* restrict encounter_buffer;  ///< Bulirsch-Stoer state and extrapolation table
+    unsigned int encounter_allocated_N; ///< Number of particles for which encounter_buffer has space
     /**
      * @endcond
      */
@@ -283,6 +452,9 @@ struct reb_simulation_integrator_whfasthelio {
      * @details After the timestep, the flag gets set back to 0. 
      * If you want to change particles after every timestep, you 
      * also need to set this flag to 1 before every timestep.
+     * If safe_mode is 0 and the simulation was synchronized by WHFastHelio, only the 
+     * coordinates of the modified particles and the centre of mass are recalculated
+     * (unless the central object was modified).
      * Default is 0.
      */ 
     unsigned int recalculate_heliocentric_this_timestep;
@@ -317,6 +489,9 @@ struct reb_simulation_integrator_whfasthelio {
     unsigned int allocated_N;   ///< Space allocated in arrays
     unsigned int is_synchronized;   ///< Flag to determine if current particle structure is synchronized
     unsigned int recalculate_heliocentric_but_not_synchronized_warning;   ///< Counter of heliocentric synchronization errors
+    struct reb_particle* restrict particles_sync;   ///< Particles right after the last synchronization, used to detect modifications (safe_mode=0 only)
+    unsigned int sync_N;        ///< Number of particles in particles_sync, 0 if the heliocentric coordinates cannot be updated from it
+    unsigned int sync_allocated_N;  ///< Space allocated in particles_sync
     /**
      * @endcond
      */
@@ -368,6 +543,8 @@ struct reb_simulation_integrator_janus {
      */
     struct reb_particle_int* restrict p_int;    ///< Integer particle pos/vel
     unsigned int allocated_N;                   ///< Space allocated in arrays
+    REB_PARTICLE_INT_TYPE* restrict p_int_soa;  ///< Integer pos/vel as structure of arrays, used within a timestep
+    unsigned int allocated_N_soa;               ///< Space allocated in p_int_soa
     /**
      * @endcond
      */
@@ -387,13 +564,48 @@ struct reb_collision{
     int p1;         ///< One of the colliding particles
     int p2;         ///< One of the colliding particles
     struct reb_ghostbox gb; ///< Ghostbox (of particle p1, used for periodic and shearing sheet boundary conditions)
+    double time;        ///< Time of collision. Equal to the current time unless collision_swept is set.
 #if defined(COLLISIONS_SWEEP) || defined(COLLISIONS_SWEEPPHI)
-    double time;        ///< Time of collision.
     int crossing;       ///< Collision occurs at the interface of two sweep boxes.
 #endif // COLLISIONS_SWEEP
     int ri;         ///< Index of rootcell (needed for MPI only).
 };
 
+/**
+ * @brief Structure-of-arrays copy of the particle state.
+ * @details Each member points to a contiguous array with one entry per particle.
+ * The arrays are only allocated and filled if particles_soa_enabled is set in 
+ * reb_simulation, or if reb_particles_soa_update() is called. 
+ * All arrays are stored in one memory block, x being the beginning of that block.
+ */
+struct reb_particles_soa {
+    double* x;      ///< x-positions
+    double* y;      ///< y-positions
+    double* z;      ///< z-positions
+    double* vx;     ///< x-velocities
+    double* vy;     ///< y-velocities
+    double* vz;     ///< z-velocities
+    double* m;      ///< Masses
+    double* r;      ///< Radii
+    int N;          ///< Number of particles currently stored in the arrays
+    int allocatedN; ///< Allocated length of each array
+};
+
+/**
+ * @brief Flags for the memory_policy of a simulation.
+ * @details They can be combined, e.g. REB_MEMORY_ALIGNED|REB_MEMORY_FIRST_TOUCH.
+ */
+enum REB_MEMORY_POLICY {
+    REB_MEMORY_ALIGNED = 1,     ///< Align buffers to REB_MEMORY_ALIGNMENT bytes (suitable for AVX-512 loads).
+    REB_MEMORY_FIRST_TOUCH = 2, ///< Write every new page for the first time from the OpenMP thread which would work on it in a static schedule. On NUMA systems this places the pages in the memory of the socket running that thread. Implies REB_MEMORY_ALIGNED.
+    REB_MEMORY_HUGE_PAGES = 4,  ///< Align large buffers to 2 MB and ask the operating system to back them with transparent huge pages (Linux only). Implies REB_MEMORY_ALIGNED.
+};
+
+/**
+ * @brief Alignment in bytes of buffers allocated with a memory_policy other than 0.
+ */
+#define REB_MEMORY_ALIGNMENT 64
+
 /**
  * @brief Enumeration describing the return status of rebound_integrate
  */
@@ -429,6 +641,26 @@ struct reb_variational_configuration{
     int index_1st_order_b;      ///< Used for 2nd order variational particles only: Index of the first first order variational particle in the particles array.
 };
 
+/**
+ * @brief Built-in additional forces, see reb_add_force().
+ */
+enum REB_FORCE {
+    REB_FORCE_DRAG = 0,     ///< Linear drag, a = -gamma*v ("drag"). Parameter: gamma.
+    REB_FORCE_J2 = 1,       ///< Oblateness of the primary ("j2"). Parameters: J2, R (radius of the primary), obliquity.
+    REB_FORCE_PRDRAG = 2,   ///< Radiation pressure and Poynting-Robertson drag from the primary acting on massless particles ("prdrag"). Parameters: beta, c.
+    REB_FORCE_GR = 3,       ///< First order post-Newtonian correction from the primary for test particles ("gr"). Parameter: c.
+    REB_FORCE_N = 4,        ///< Number of built-in forces.
+};
+
+/**
+ * @brief A built-in additional force and its parameters.
+ */
+struct reb_force {
+    enum REB_FORCE type;    ///< Type of the force.
+    int primary;            ///< Index of the central body for j2, prdrag and gr. Default: 0.
+    double params[4];       ///< Parameters in the order given in enum REB_FORCE.
+};
+
 /**
  * @cond PRIVATE
  * Internal data structures below. Nothing to be changed by the user.
@@ -550,6 +782,57 @@ enum REB_BINARY_FIELD_TYPE {
     REB_BINARY_FIELD_TYPE_JANUS_SCALEVEL = 114,
     REB_BINARY_FIELD_TYPE_JANUS_ORDER = 115,
     REB_BINARY_FIELD_TYPE_JANUS_RECALC = 116,
+    REB_BINARY_FIELD_TYPE_TREEFLATTEN = 117,
+    REB_BINARY_FIELD_TYPE_TREEGROUPSIZE = 118,
+    REB_BINARY_FIELD_TYPE_FMMORDER = 119,
+    REB_BINARY_FIELD_TYPE_MULTIPOLEORDER = 120,
+    REB_BINARY_FIELD_TYPE_TREEREBUILD = 121,
+    REB_BINARY_FIELD_TYPE_TREEREFIT = 122,
+    REB_BINARY_FIELD_TYPE_COLLISIONRESOLVEPARALLEL = 123,
+    REB_BINARY_FIELD_TYPE_COLLISIONSWEPT = 124,
+    REB_BINARY_FIELD_TYPE_COLLISIONVERLETSKIN = 125,
+    REB_BINARY_FIELD_TYPE_IAS15_BLOCKLEVELS = 126,
+    REB_BINARY_FIELD_TYPE_FFTNX = 127,
+    REB_BINARY_FIELD_TYPE_FFTNY = 128,
+    REB_BINARY_FIELD_TYPE_FFTRS = 129,
+    REB_BINARY_FIELD_TYPE_SAFSYNCINTERVAL = 130,
+    REB_BINARY_FIELD_TYPE_SAASYNC = 131,
+    REB_BINARY_FIELD_TYPE_SACOMPRESSION = 132,
+    REB_BINARY_FIELD_TYPE_SAKEYFRAMEINTERVAL = 133,
+    REB_BINARY_FIELD_TYPE_SAEXTRAS = 134,
+    REB_BINARY_FIELD_TYPE_COLLISIONSSEED = 135,
+    REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS = 136,
+    REB_BINARY_FIELD_TYPE_WHFAST_PJCOLUMNS = 137,
+    REB_BINARY_FIELD_TYPE_WHFASTH_PHCOLUMNS = 138,
+    REB_BINARY_FIELD_TYPE_TREEFORCEACCURACY = 139,
+    REB_BINARY_FIELD_TYPE_TREEFORCEACCINTERVAL = 140,
+    REB_BINARY_FIELD_TYPE_TREEFORCEACCSAMPLES = 141,
+    REB_BINARY_FIELD_TYPE_TREEFORCEACCSTEPS = 142,
+    REB_BINARY_FIELD_TYPE_TREEFORCEERROR = 143,
+    REB_BINARY_FIELD_TYPE_HEARTBEATINTERVAL = 144,
+    REB_BINARY_FIELD_TYPE_FORCES = 145,
+    REB_BINARY_FIELD_TYPE_SABA_TYPE = 146,
+    REB_BINARY_FIELD_TYPE_SABA_CORRECTOR = 147,
+    REB_BINARY_FIELD_TYPE_SABA_SAFEMODE = 148,
+    REB_BINARY_FIELD_TYPE_SABA_ISSYNCHRON = 149,
+    REB_BINARY_FIELD_TYPE_MERCURIUS_HILLFAC = 150,
+    REB_BINARY_FIELD_TYPE_MERCURIUS_EPSILON = 151,
+    REB_BINARY_FIELD_TYPE_MERCURIUS_SAFEMODE = 152,
+    REB_BINARY_FIELD_TYPE_MERCURIUS_RECALC = 153,
+    REB_BINARY_FIELD_TYPE_REORDERINTERVAL = 154,
+    REB_BINARY_FIELD_TYPE_TREESINGLEPRECISION = 155,
+    REB_BINARY_FIELD_TYPE_REPRODUCIBLE = 156,
+    REB_BINARY_FIELD_TYPE_RANDSEED = 157,
+    REB_BINARY_FIELD_TYPE_RANDSTREAMS = 158,
+    REB_BINARY_FIELD_TYPE_SLEEPVELOCITY = 159,
+    REB_BINARY_FIELD_TYPE_SLEEPSTEPS = 160,
+    REB_BINARY_FIELD_TYPE_TREEACTIVEONLY = 161,
+    REB_BINARY_FIELD_TYPE_IAS15_LEAN = 162,
+    REB_BINARY_FIELD_TYPE_TREETASKS = 163,
+    REB_BINARY_FIELD_TYPE_TREELEAFSIZE = 164,
+    REB_BINARY_FIELD_TYPE_SAMEMBER = 165,
+    REB_BINARY_FIELD_TYPE_COLLISIONFUSED = 166,
+    REB_BINARY_FIELD_TYPE_TREECELLS = 167,
     REB_BINARY_FIELD_TYPE_END = 9999,
 };
 
@@ -561,6 +844,39 @@ struct reb_binary_field {
     long size;                          ///< Size in bytes of field (only what follows, not the binary field, itself).
 };
 
+/**
+ * @brief Enumeration describing the contents of a column in a particle array field.
+ * @details Particle arrays are not stored as a copy of struct reb_particle but
+ * one column per particle property, so that the binary format does not depend 
+ * on the layout of the struct. 
+ */
+enum REB_BINARY_COLUMN_TYPE {
+    REB_BINARY_COLUMN_TYPE_X = 0,
+    REB_BINARY_COLUMN_TYPE_Y = 1,
+    REB_BINARY_COLUMN_TYPE_Z = 2,
+    REB_BINARY_COLUMN_TYPE_VX = 3,
+    REB_BINARY_COLUMN_TYPE_VY = 4,
+    REB_BINARY_COLUMN_TYPE_VZ = 5,
+    REB_BINARY_COLUMN_TYPE_AX = 6,
+    REB_BINARY_COLUMN_TYPE_AY = 7,
+    REB_BINARY_COLUMN_TYPE_AZ = 8,
+    REB_BINARY_COLUMN_TYPE_M = 9,
+    REB_BINARY_COLUMN_TYPE_R = 10,
+    REB_BINARY_COLUMN_TYPE_LASTCOLLISION = 11,
+    REB_BINARY_COLUMN_TYPE_HASH = 12,
+};
+
+/**
+ * @brief Header of a column inside a particle array field (REB_BINARY_FIELD_TYPE_PARTICLECOLUMNS and similar).
+ * @details A particle array field contains the number of particles (long) 
+ * followed by the columns. The column data (one element per particle) follows 
+ * the header. Columns of unknown type can be skipped using size.
+ */
+struct reb_binary_column {
+    enum REB_BINARY_COLUMN_TYPE type;   ///< Type of column
+    long size;                          ///< Size in bytes of column (only what follows, not the header, itself).
+};
+
 /**
  * @brief Holds a particle's hash and the particle's index in the particles array.
  * @details This structure is used for the simulation's particle_lookup_table.
@@ -569,6 +885,27 @@ struct reb_hash_pointer_pair{
     uint32_t hash;
     int index;
 };
+
+/**
+ * @brief One result of a neighbour query, see reb_tree_query_radius().
+ */
+struct reb_neighbour {
+    int index;      ///< Index of the neighbour in the particles array.
+    double dx;      ///< x position of the neighbour relative to the query point (including the ghost box shift).
+    double dy;      ///< y position of the neighbour relative to the query point.
+    double dz;      ///< z position of the neighbour relative to the query point.
+    double r2;      ///< Square of the distance between the neighbour and the query point.
+};
+
+/**
+ * @brief Neighbours of all particles, see reb_tree_query_radius_all().
+ * @details The neighbours of particle i are neighbours[start[i]] to neighbours[start[i+1]-1].
+ */
+struct reb_neighbour_list {
+    int N;                              ///< Number of particles.
+    int* start;                         ///< Index of the first neighbour of each particle, N+1 entries.
+    struct reb_neighbour* neighbours;   ///< Neighbours of all particles.
+};
 /**
  * @endcond
  */
@@ -630,6 +967,82 @@ struct reb_orbit {
     double T;        ///< Time of pericenter passage
 };
 
+/**
+ * @brief State of one stream of the counter-based random number generator.
+ * @details The n-th random number of a stream is a hash (Philox4x32-10) of
+ * the key, the stream number and n. Streams are therefore independent of 
+ * each other and of the order in which they are used. This makes them 
+ * reentrant and allows for one stream per thread or per particle. 
+ * Use reb_rng_init() or reb_rng_stream() to create a stream.
+ */
+struct reb_rng {
+    uint64_t key;       ///< Key, the same for all streams of one simulation.
+    uint64_t stream;    ///< Stream number.
+    uint64_t counter;   ///< Number of random numbers drawn from this stream so far.
+};
+
+/**
+ * @brief Handle of an asynchronous integration, see reb_integrate_async().
+ * @details The fields are shared between the caller and the integration 
+ * thread and are only accessed with atomic operations. Use the 
+ * reb_integrate_async functions instead of accessing them directly.
+ */
+struct reb_integrate_async {
+    struct reb_simulation* r;           ///< Simulation being integrated.
+    double tmax;                        ///< Time to be integrated to.
+    pthread_t thread;                   ///< Integration thread.
+    double t;                           ///< Time at the end of the last completed timestep.
+    unsigned long long steps;           ///< Number of completed timesteps.
+    int status;                         ///< REB_RUNNING until the integration has finished, then its return value.
+    int cancel;                         ///< Set to 1 to stop the integration.
+    int snapshot_requested;             ///< Set to 1 to request a snapshot.
+    struct reb_simulation* snapshot;    ///< Snapshot made by the integration thread, NULL if none is ready.
+};
+
+/**
+ * @brief Output buffers of reb_integrate_samples().
+ * @details All buffers are allocated by the caller. NULL buffers are not written.
+ * Sample k of a buffer with M values per sample starts at index k*M. Quantities of
+ * particles which do not exist at the time of a sample (e.g. after a merger) are set to NAN.
+ */
+struct reb_samples {
+    int N;              ///< Number of particles per sample. If 0, set to the number of real particles at the beginning of reb_integrate_samples().
+    double* t;          ///< Time of each sample (n values). Differs from the requested time if exact_finish_time=0.
+    double* xyz;        ///< Positions (N*3 values per sample).
+    double* vxvyvz;     ///< Velocities (N*3 values per sample).
+    double* orbits;     ///< Jacobi orbital elements a, e, inc, Omega, omega, f of particles 1 to N-1 ((N-1)*6 values per sample).
+    double* energy;     ///< Total energy (1 value per sample).
+};
+
+/**
+ * @brief Counters of the work done by a simulation.
+ * @details The counters are updated during the integration at almost no cost.
+ * Interactions and opened cells are counted for direct summation and for the 
+ * tree code. A pair of interacting active particles counts as two interactions,
+ * one for each particle which feels the force. REBOUND never resets the 
+ * counters, use reb_metrics_reset(). Use reb_metrics_get() to read them, it 
+ * also calculates the rates and the energy drift, or reb_output_metrics() to 
+ * export them in the OpenMetrics text format.
+ */
+struct reb_metrics {
+    uint64_t steps;                     ///< Completed timesteps
+    uint64_t interactions;              ///< Particle-particle and particle-cell force interactions
+    uint64_t cells_opened;              ///< Tree cells opened while walking the tree for the gravity calculation
+    uint64_t collisions_found;          ///< Collisions found by the collision search
+    uint64_t collisions_resolved;       ///< Collisions passed to the collision resolve function
+    uint64_t ias15_iterations;          ///< Predictor corrector iterations of IAS15
+    uint64_t ias15_rejections;          ///< Rejected IAS15 timesteps
+    uint64_t hermes_activations;        ///< Timesteps in which the HERMES mini simulation became active
+    uint64_t simulationarchive_bytes;   ///< Bytes written to the Simulation Archive file
+    double walltime;                    ///< Wall time in seconds spent in reb_integrate() (and reb_integrate_samples())
+    double walltime_start;              ///< Start of the current integration (internal use), 0 if the simulation is not being integrated
+    double energy_initial;              ///< Energy at the first call of reb_metrics_get() with energy=1 after a reset, NAN before
+    double energy_drift;                ///< Relative energy error |E-E0|/|E0| at the last call of reb_metrics_get() with energy=1, NAN before
+    double steps_per_second;            ///< Only set in the copy returned by reb_metrics_get()
+    double interactions_per_second;     ///< Only set in the copy returned by reb_metrics_get()
+    double collisions_per_second;       ///< Collisions found per second. Only set in the copy returned by reb_metrics_get()
+};
+
 /**
  * @brief Main struct encapsulating one entire REBOUND simulation
  * @details This structure contains all variables, status flags and pointers of one 
@@ -660,9 +1073,58 @@ struct reb_simulation {
     struct reb_particle* particles; ///< Main particle array. This contains all particles on this node.  
     struct reb_vec3d* gravity_cs;   ///< Vector containing the information for compensated gravity summation 
     int     gravity_cs_allocatedN;  ///< Current number of allocated space for cs array
+    double* gravity_soa;            ///< Structure-of-arrays copy of positions and masses (x, y, z, m) used by the vectorized REB_GRAVITY_BASIC kernel
+    int     gravity_soa_allocatedN; ///< Current number of allocated space for each array in gravity_soa
+    struct reb_particles_soa particles_soa; ///< Structure-of-arrays copy of the particle state. Only updated if particles_soa_enabled=1 or reb_particles_soa_update() is called.
+    int     particles_soa_enabled;  ///< If set to 1, particles_soa is updated after every timestep. Default: 0.
+    char*   remove_marks;           ///< Flags of particles marked for removal with reb_remove_mark() (internal use).
+    int     remove_marks_allocatedN;///< Current number of allocated entries in remove_marks.
+    int     remove_marks_N;         ///< Number of particles currently marked for removal.
     struct reb_treecell** tree_root;///< Pointer to the roots of the trees. 
     int     tree_needs_update;      ///< Flag to force a tree update (after boundary check)
+    int     tree_rebuild;           ///< If set to 1, the tree is rebuilt from scratch (in parallel with OpenMP) whenever it is updated instead of moving particles between cells (default: 0).
+    int     tree_refit;             ///< If set to 1, particles which left their cell are moved to a nearby cell without changing the order of particles, and the tree is not walked if no particle left its cell (default: 0). Not supported with MPI.
+    int     tree_active_only;       ///< If set to 1, only the active particles (index<N_active) are added to the tree used by REB_GRAVITY_TREE. Test particles only receive forces from the tree. The tree is rebuilt every timestep (default: 0). Requires testparticle_type=0, not compatible with REB_COLLISION_TREE and MPI.
+    struct reb_treecell** tree_cell_blocks; ///< Memory blocks from which all tree cells are allocated.
+    int     tree_cell_blocks_N;     ///< Number of memory blocks in tree_cell_blocks.
+    struct reb_treecell_multipoles** tree_cell_multipoles; ///< Higher order multipole moments of the cells, one block for each block in tree_cell_blocks. Blocks are only allocated if multipole_order>=2.
+    struct reb_treecell* tree_cell_free; ///< Linked list of unused tree cells (linked via oct[0]).
     double opening_angle2;          ///< Square of the cell opening angle \f$ \theta \f$. 
+    int     multipole_order;        ///< Highest order of the multipole expansion of cells used by REB_GRAVITY_TREE. 0: monopole (default), 2: quadrupole, 3: octupole.
+    int     tree_flatten;           ///< If set to 1, a contiguous depth-first copy of the tree is used to calculate tree gravity (default: 0).
+    struct reb_treecell_flat* tree_flat; ///< Contiguous depth-first copy of the tree. Only used if tree_flatten=1.
+    int     tree_flat_N;            ///< Number of cells in tree_flat.
+    int     tree_flat_allocatedN;   ///< Current number of allocated cells in tree_flat.
+    int*    tree_flat_order;        ///< Indices of the local particles in the order of the leaves in tree_flat (Morton order).
+    int     tree_flat_order_N;      ///< Number of entries in tree_flat_order.
+    int     tree_flat_order_allocatedN; ///< Current number of allocated entries in tree_flat_order.
+    struct reb_treecell_multipoles* tree_flat_multipoles; ///< Higher order multipole moments of the cells in tree_flat. Only used if multipole_order>=2.
+    int     tree_group_size;        ///< If larger than 0, tree gravity walks the tree once for each group of at most this many particles instead of once per particle (default: 0). Implies tree_flatten.
+    int     tree_leaf_size;         ///< If larger than 1, cells of the flattened tree with at most this many particles are leaf buckets. The tree walk does not descend into a bucket but sums up the forces of its particles directly (default: 1). Typical values are 8-32. Used by REB_GRAVITY_TREE with tree_flatten or tree_group_size>0 and by REB_GRAVITY_TREEPM.
+    int     tree_single_precision;  ///< If set to 1, the far field interactions of the group-wise tree walk are evaluated in single precision. The centres of mass and multipole moments of accepted cells are stored as float relative to the centre of the group. Interactions with particles and the summation of accelerations remain in double precision (default: 0). Only used if tree_group_size>0.
+    struct reb_treegroup* tree_groups; ///< Groups of particles sharing one interaction list. Only used if tree_group_size>0.
+    int     tree_groups_N;          ///< Number of groups in tree_groups.
+    int     tree_groups_allocatedN; ///< Current number of allocated groups in tree_groups.
+    int     tree_tasks;             ///< If set to 1, REB_GRAVITY_TREE visits the particles in the order of the tree leaves, split into ranges of similar cost which are distributed over threads as OpenMP tasks. The cost of each particle is measured during the previous tree walk (default: 0). Not used with tree_group_size>0 and MPI.
+    float*  tree_task_cost;         ///< Number of interactions of each particle during the last tree walk. Only used if tree_tasks=1.
+    int*    tree_task_order;        ///< Particle indices in the order of the tree leaves. Only used if tree_tasks=1.
+    int     tree_task_allocatedN;   ///< Current number of allocated entries in tree_task_cost and tree_task_order.
+    double  tree_force_accuracy;    ///< If larger than 0, opening_angle2 is adjusted automatically so that the RMS relative error of the tree gravity accelerations is close to this value (default: 0). Only used by REB_GRAVITY_TREE. Not supported with MPI.
+    unsigned int tree_force_accuracy_interval; ///< Number of timesteps between measurements of the force error (default: 100).
+    int     tree_force_accuracy_samples; ///< Number of particles for which the force error is measured by direct summation (default: 32).
+    unsigned int tree_force_accuracy_steps; ///< Number of timesteps since tree_force_accuracy was enabled (internal use).
+    double  tree_force_error;       ///< RMS relative force error of the last measurement, -1 if not measured yet.
+    int     fmm_order;              ///< Expansion order of the multipoles used by REB_GRAVITY_FMM (1-8, default: 2).
+    double* fmm_multipoles;         ///< Multipole moments of all cells in tree_flat. Only used by REB_GRAVITY_FMM.
+    double* fmm_locals;             ///< Local expansion coefficients of all cells in tree_flat. Only used by REB_GRAVITY_FMM.
+    double* fmm_rmax;               ///< Radius of all cells in tree_flat around their center of mass. Only used by REB_GRAVITY_FMM.
+    int     fmm_allocatedN;         ///< Number of cells for which space has been allocated in the fmm arrays.
+    int     fmm_allocated_order;    ///< Expansion order for which space has been allocated in the fmm arrays.
+    struct reb_opencl* opencl;      ///< OpenCL context, kernel and device buffers. Only used by REB_GRAVITY_OPENCL.
+    int     fft_nx;                 ///< Number of grid cells in the x direction used by REB_GRAVITY_FFT and REB_GRAVITY_TREEPM (default: 64).
+    int     fft_ny;                 ///< Number of grid cells in the y direction used by REB_GRAVITY_FFT and REB_GRAVITY_TREEPM (default: 64).
+    double  fft_rs;                 ///< Splitting scale between the grid and the tree used by REB_GRAVITY_TREEPM, and softening scale of REB_GRAVITY_FFT. If 0 (default), 1.25 grid cells are used.
+    struct reb_fft* fft;            ///< Grid and FFT plans. Only used by REB_GRAVITY_FFT and REB_GRAVITY_TREEPM.
     enum REB_STATUS status;         ///< Set to 1 to exit the simulation at the end of the next timestep. 
     int     exact_finish_time;      ///< Set to 1 to finish the integration exactly at tmax. Set to 0 to finish at the next dt. Default is 1. 
 
@@ -674,10 +1136,22 @@ struct reb_simulation {
     char** messages;                ///< Array of strings containing last messages (only used if save_messages==1). 
     double exit_max_distance;       ///< Exit simulation if distance from origin larger than this value 
     double exit_min_distance;       ///< Exit simulation if distance from another particle smaller than this value 
+    int exit_min_distance_checked;  ///< Internal: 1 if the last force calculation checked all pairs for exit_min_distance, 2 if it found an encounter, 0 otherwise. Reset after every heartbeat.
     double usleep;                  ///< Wait this number of microseconds after each timestep, useful for slowing down visualization.  
+    unsigned int heartbeat_interval;///< If larger than 1, the heartbeat function is only called at the beginning of reb_integrate() and then after every heartbeat_interval timesteps. Reduces the overhead of expensive heartbeat functions, e.g. Python callbacks. Default: 0 (after every timestep).
+    unsigned int heartbeat_steps;   ///< Timesteps since the heartbeat function was called the last time (internal use).
+    unsigned int reorder_interval;  ///< If larger than 0, the particle array is sorted along a Morton (Z-order) curve every reorder_interval timesteps with reb_reorder_particles(). This keeps particles which are close in space close in memory. Default: 0 (never).
+    unsigned int reorder_steps;     ///< Timesteps since the particles were reordered the last time (internal use).
+    int     reproducible;           ///< If set to 1, OpenMP reductions are done in a fixed order, so that results are bitwise identical for any number of threads. The expensive loops still run in parallel (default: 0).
+    unsigned int memory_policy;     ///< Allocation policy for the particle array and the large integrator and gravity buffers, a combination of the REB_MEMORY_POLICY flags. Default: 0 (plain realloc). See reb_tools_realloc().
+    uint64_t rand_seed;             ///< Key of the counter-based random number generator used by reb_rng_stream(). Set randomly when the simulation is created.
+    uint64_t rand_streams;          ///< Number of random number streams handed out by reb_rng_stream() (internal use).
     struct reb_display_data* display_data; /// < Datastructure stores visualization related data. Does not have to be modified by the user. 
     int track_energy_offset;        ///< Track energy change during collisions and ejections (default: 0).
     double energy_offset;           ///< Energy offset due to collisions and ejections (only calculated if track_energy_offset=1).
+    struct reb_force* forces;       ///< Built-in additional forces added with reb_add_force().
+    int forces_N;                   ///< Number of built-in additional forces.
+    int forces_allocatedN;          ///< Current number of allocated entries in forces.
     /** @} */
 
     /**
@@ -702,21 +1176,39 @@ struct reb_simulation {
      */
     int    mpi_id;                              ///< Unique id of this node (starting at 0). Used for MPI only.
     int    mpi_num;                             ///< Number of MPI nodes. Used for MPI only.
-    MPI_Datatype mpi_particle;                  ///< MPI datatype corresponding to the C struct reb_particle. 
-    struct reb_particle** particles_send;       ///< Send buffer for particles. There is one buffer per node. 
+    int*   mpi_root_owner;                      ///< MPI node owning each root box. Set up by reb_mpi_init() and changed by reb_mpi_balance().
+    int    mpi_balance_interval;                ///< If >0, reb_mpi_balance() is called every mpi_balance_interval timesteps. Default: 0.
+    int    mpi_balance_steps;                   ///< Number of timesteps since the last call to reb_mpi_balance(). Used internally.
+    MPI_Datatype mpi_particle;                  ///< MPI datatype corresponding to the C struct reb_particle_mpi (wire format). 
+    MPI_Datatype mpi_particle_recv;             ///< MPI datatype for the fields of the wire format in the C struct reb_particle. 
+    struct reb_particle_mpi** particles_send;   ///< Send buffer for particles. There is one buffer per node. 
     int*   particles_send_N;                    ///< Current length of particle send buffer. 
     int*   particles_send_Nmax;                 ///< Maximal length of particle send beffer before realloc() is needed. 
     struct reb_particle** particles_recv;       ///< Receive buffer for particles. There is one buffer per node. 
     int*   particles_recv_N;                    ///< Current length of particle receive buffer. 
     int*   particles_recv_Nmax;                 ///< Maximal length of particle receive beffer before realloc() is needed. */
 
-    MPI_Datatype mpi_cell;                      ///< MPI datatype corresponding to the C struct reb_treecell. 
-    struct reb_treecell** tree_essential_send;  ///< Send buffer for cells. There is one buffer per node. 
+    struct reb_treecell_mpi** tree_essential_send;  ///< Send buffer for cells. There is one buffer per node. 
     int*   tree_essential_send_N;               ///< Current length of cell send buffer. 
     int*   tree_essential_send_Nmax;            ///< Maximal length of cell send beffer before realloc() is needed. 
-    struct reb_treecell** tree_essential_recv;  ///< Receive buffer for cells. There is one buffer per node. 
+    struct reb_treecell_mpi** tree_essential_recv;  ///< Receive buffer for cells (wire format). There is one buffer per node. 
     int*   tree_essential_recv_N;               ///< Current length of cell receive buffer. 
     int*   tree_essential_recv_Nmax;            ///< Maximal length of cell receive beffer before realloc() is needed. 
+    struct reb_treecell** tree_essential_cells; ///< Received cells added to the non-local root boxes. Their multipole moments point into tree_essential_recv. There is one buffer per node. 
+    int*   tree_essential_cells_Nmax;           ///< Maximal length of tree_essential_cells before realloc() is needed. 
+    /**
+     * @brief Overlap of the essential tree exchange with the force calculation. 
+     * @details Only used for REB_GRAVITY_TREE without tree_flatten and tree_group_size.
+     * - 0: The essential tree is exchanged before the forces are calculated (default).
+     * - 1: The forces from the local tree are calculated before waiting for the essential tree of each node.
+     * - 2: Same as 1, but with OpenMP the master thread receives the essential tree while all other 
+     *   threads calculate the forces from the local tree. Requires MPI_THREAD_FUNNELED support.
+     */
+    int    mpi_pipeline;
+    int    mpi_thread_support;                  ///< Level of thread support provided by MPI (MPI_THREAD_SINGLE, MPI_THREAD_FUNNELED, ...). Set by reb_mpi_init().
+    int    tree_essential_pending;              ///< Set to 1 while an essential tree exchange started with reb_communication_mpi_start_essential_tree_for_gravity() has not completed.
+    MPI_Request* tree_essential_recv_requests;  ///< Receive requests of a pending essential tree exchange. One per node. 
+    MPI_Request* tree_essential_send_requests;  ///< Send requests of a pending essential tree exchange. One per node. 
     /** @} */
 #endif // MPI
 
@@ -725,12 +1217,33 @@ struct reb_simulation {
      * @{
      */
     int collision_resolve_keep_sorted;      ///< Keep particles sorted if collision_resolve removes particles during a collision. 
+    int collision_resolve_parallel;         ///< If set to 1, hard sphere collisions are resolved in parallel in sets of collisions that do not share a particle (default: 0). Requires OpenMP. Has no effect for other collision_resolve functions or if coefficient_of_restitution is set.
+    int collision_swept;                    ///< If set to 1, the collision search also finds particles which touched during the last timestep, assuming straight line motion (default: 0). The time of impact is stored in reb_collision.time.
+    double collision_verlet_skin;           ///< If larger than 0, REB_COLLISION_TREE caches all pairs closer than r_i+r_j+collision_verlet_skin and only queries the tree again once particles have moved too far (default: 0). Not available with MPI.
+    int collision_fused;                    ///< If set to 1 and REB_GRAVITY_TREE is used with REB_COLLISION_TREE, collision candidates are collected during the gravity tree walk and checked after the timestep, instead of querying the tree a second time (default: 0). Not available with MPI, tree_flatten, tree_group_size, tree_tasks and variational particles.
+    struct reb_collision_verlet_list* collision_verlet_list; ///< Cached neighbour list used if collision_verlet_skin or collision_fused is set (internal use).
     struct reb_collision* collisions;       ///< Array of all collisions. 
     int collisions_allocatedN;          ///< Size allocated for collisions.
     double minimum_collision_velocity;      ///< Used for hard sphere collision model. 
     double collisions_plog;             ///< Keep track of momentum exchange (used to calculate collisional viscosity in ring systems.
     double max_radius[2];               ///< Two largest particle radii, set automatically, needed for collision search.
     long collisions_Nlog;               ///< Keep track of number of collisions. 
+    uint32_t collisions_seed;           ///< State of the random number generator used to shuffle the collisions before they are resolved. Set with rand() when the simulation is created. Calling srand() afterwards does not change the collision order, set collisions_seed instead.
+    /**
+     * @brief Speed below which particles fall asleep (default: 0, sleeping disabled).
+     * @details A particle whose speed stays below sleep_velocity for sleep_steps 
+     * consecutive timesteps is put to sleep: its velocity is set to zero, it is
+     * no longer moved by the LEAPFROG integrator and collisions between two 
+     * sleeping particles are not searched for. A sleeping particle wakes up as soon 
+     * as a collision with an awake particle gives it a speed above sleep_velocity.
+     * Intended for granular systems at rest. Not available with MPI.
+     */
+    double sleep_velocity;
+    unsigned int sleep_steps;           ///< Number of consecutive timesteps a particle needs to be slower than sleep_velocity before it falls asleep (default: 10).
+    unsigned int* sleep_state;          ///< Number of consecutive slow timesteps of each particle (internal use).
+    int sleep_allocatedN;               ///< Size allocated for sleep_state (internal use).
+    int sleep_N;                        ///< Number of particles sleep_state corresponds to. Reset if particles are added, removed or reordered (internal use).
+    int sleeping_N;                     ///< Number of particles currently asleep.
     /** @} */
 
     /**
@@ -760,8 +1273,39 @@ struct reb_simulation {
     char*  simulationarchive_filename;          ///< Name of output file
     double simulationarchive_walltime;          ///< Current walltime since beginning of simulation
     struct timeval simulationarchive_time;      ///< Time of last output
+    unsigned int simulationarchive_fsync_interval; ///< Flush snapshots to disk (fsync) every this many snapshots. Default: 0 (never, leave it to the operating system)
+    unsigned int simulationarchive_async;       ///< If set to 1, snapshots are written by a background thread. Default: 0 (write within the integration loop)
+    unsigned int simulationarchive_compression; ///< If set to 1, snapshots are compressed (lossless, byte shuffle and deflate). Needs to be set before the first output. Requires REBOUND to be compiled with zlib (ZLIB=1), otherwise the integration stops with an error. Default: 0
+    unsigned int simulationarchive_keyframe_interval; ///< If >0, only every n-th snapshot is stored in full (keyframe), the others as compressed differences to the previous snapshot. Implies compression (requires zlib). Needs to be set before the first output. Default: 0
+    long   simulationarchive_member;            ///< If >=0, the snapshots are appended as this member to the SimulationArchive container simulationarchive_filename instead of a file of their own. Default: -1
+    unsigned int simulationarchive_extras;      ///< Bitmask of optional data stored in every snapshot (particle hashes and radii, collision, MEGNO and tree state). Set automatically at the first output.
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    int    simulationarchive_fd;                ///< File descriptor of the open SA file, -1 if closed
+    char*  simulationarchive_buffer;            ///< Buffer in which a snapshot is serialized before being written
+    size_t simulationarchive_buffer_allocated;  ///< Space allocated in simulationarchive_buffer, in bytes
+    unsigned int simulationarchive_fsync_counter; ///< Snapshots written since the last fsync
+    struct reb_simulationarchive_writer* simulationarchive_writer; ///< Background writer thread, NULL if not running
+    struct reb_simulationarchive_encoder* simulationarchive_encoder; ///< Scratch space used to compress snapshots
+    /**
+     * @endcond
+     */
     /** @} */
 
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    struct reb_output_stream* output_streams;   ///< Output streams added with reb_output_stream_add(), NULL if none
+    struct reb_output_shm* output_shm;          ///< Shared memory segment opened with reb_output_shm_open(), NULL if none
+    struct reb_metrics metrics;                 ///< Counters, read them with reb_metrics_get()
+    struct reb_profiling* profiling;            ///< Timers, NULL unless enabled with reb_profiling_enable()
+    /**
+     * @endcond
+     */
+
     /**
      * \name Variables describing the current module selection 
      * @{
@@ -781,6 +1325,8 @@ struct reb_simulation {
         REB_COLLISION_NONE = 0,     ///< Do not search for collisions (default)
         REB_COLLISION_DIRECT = 1,   ///< Direct collision search O(N^2)
         REB_COLLISION_TREE = 2,     ///< Tree based collision search O(N log(N))
+        REB_COLLISION_SWEEP = 3,    ///< Sort and sweep collision search along the longest box dimension O(N log(N)), does not require a tree
+        REB_COLLISION_GRID = 4,     ///< Collision search on a hashed uniform grid O(N), does not require a tree
         } collision;
     /**
      * @brief Available integrators
@@ -794,6 +1340,8 @@ struct reb_simulation {
         REB_INTEGRATOR_WHFASTHELIO = 6,   ///< WHFastHelio integrator, symplectic, 2nd order, in democratic heliocentric coordinates
         REB_INTEGRATOR_NONE = 7,     ///< Do not integrate anything
         REB_INTEGRATOR_JANUS = 8,    ///< Bit-wise reversible JANUS integrator.
+        REB_INTEGRATOR_SABA = 9,     ///< SABAn/SABACn integrators (Laskar & Robutel 2001), symplectic, up to 8th order in dt
+        REB_INTEGRATOR_MERCURIUS = 10,   ///< MERCURIUS hybrid symplectic integrator with a smooth changeover function for close encounters
         } integrator;
 
     /**
@@ -814,6 +1362,10 @@ struct reb_simulation {
         REB_GRAVITY_BASIC = 1,      ///< Basic O(N^2) direct summation algorithm, choose this for shearing sheet and periodic boundary conditions
         REB_GRAVITY_COMPENSATED = 2,    ///< Direct summation algorithm O(N^2) but with compensated summation, slightly slower than BASIC but more accurate
         REB_GRAVITY_TREE = 3,       ///< Use the tree to calculate gravity, O(N log(N)), set opening_angle2 to adjust accuracy.
+        REB_GRAVITY_FMM = 4,        ///< Fast multipole method using the tree, O(N), set opening_angle2 and fmm_order to adjust accuracy.
+        REB_GRAVITY_OPENCL = 5,     ///< Direct summation on a GPU using OpenCL, O(N^2). Requires compiling with OPENCL=1.
+        REB_GRAVITY_FFT = 6,        ///< In-plane self-gravity of a thin sheet on a grid using an FFT, O(N + Ngrid log(Ngrid)). Requires periodic or shear periodic boundaries.
+        REB_GRAVITY_TREEPM = 7,     ///< Long range force on the grid as in REB_GRAVITY_FFT, short range force using the tree. Requires periodic or shear periodic boundaries.
         } gravity;
     /** @} */
 
@@ -828,6 +1380,8 @@ struct reb_simulation {
     struct reb_simulation_integrator_hermes ri_hermes;    ///< The HERMES struct
     struct reb_simulation_integrator_whfasthelio ri_whfasthelio;  ///< The WHFastDemocratic struct 
     struct reb_simulation_integrator_janus ri_janus;    ///< The JANUS struct 
+    struct reb_simulation_integrator_saba ri_saba;      ///< The SABA struct 
+    struct reb_simulation_integrator_mercurius ri_mercurius;    ///< The MERCURIUS struct 
     /** @} */
 
     /**
@@ -848,7 +1402,7 @@ struct reb_simulation {
     void (*post_timestep_modifications) (struct reb_simulation* const r);
     /**
      * @brief This function is called at the beginning of the simulation and at the end of
-     * each timestep.
+     * each timestep (or every heartbeat_interval timesteps).
      */
     void (*heartbeat) (struct reb_simulation* r);
     /**
@@ -869,6 +1423,16 @@ struct reb_simulation {
      */
     int (*collision_resolve) (struct reb_simulation* const r, struct reb_collision);
 
+    /**
+     * @brief Resolve all collisions of one timestep at once. By default it is NULL. If set, it is used instead of collision_resolve.
+     * @details The function receives all N collisions found in this timestep (in random order, 
+     * each pair of particles only once) and sets outcomes[i] for collision i, using the same values as the return value of 
+     * collision_resolve. The outcomes are initialized to 0. Particles are only removed after 
+     * the function returns, so all indices stay valid. Use reb_collision_relative_states() 
+     * to get the relative positions and velocities of all collisions at once.
+     */
+    void (*collision_resolve_batch) (struct reb_simulation* const r, struct reb_collision* const collisions, const int N, int* const outcomes);
+
     /**
      * @brief Free particle's ap pointer.  Called in reb_remove function.
      */
@@ -909,6 +1473,29 @@ struct reb_simulation* reb_create_simulation(void);
  */
 void reb_init_simulation(struct reb_simulation* r);
 
+/**
+ * @brief Creates a deep copy of a REBOUND simulation in memory.
+ * @details Particles, variational configurations, built-in forces and the
+ * integrator state which is kept from one timestep to the next (IAS15
+ * predictor/corrector arrays, WHFast Jacobi coordinates, etc) are copied.
+ * Integrating the copy gives bit-wise identical results to integrating the
+ * original. Caches such as the tree are rebuilt when needed. Function pointers
+ * are shared with the original. The copy does not inherit the visualization,
+ * the SimulationArchive file, output streams, or particle properties added
+ * externally (ap). This is much faster than going through a binary file.
+ * Not supported with MPI, returns NULL.
+ * @param r Simulation to be copied. It is not modified.
+ * @return New simulation which needs to be freed with reb_free_simulation().
+ */
+struct reb_simulation* reb_copy_simulation(const struct reb_simulation* const r);
+
+/**
+ * @brief Same as reb_copy_simulation() but does not allocate memory for the copy itself.
+ * @param r_copy Structure to be overwritten with the copy (needs to be allocated externally, must not hold any allocated memory).
+ * @param r Simulation to be copied.
+ */
+void reb_init_simulation_copy(struct reb_simulation* const r_copy, const struct reb_simulation* const r);
+
 /**
  * @brief Performon one integration step
  * @details You rarely want to call this function yourself.
@@ -926,6 +1513,77 @@ void reb_step(struct reb_simulation* const r);
  */
 enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tmax);
 
+/**
+ * @brief Integrates through a sorted array of times and stores outputs at every time.
+ * @details This is equivalent to calling reb_integrate() for every time and copying
+ * the requested quantities afterwards, but the setup of reb_integrate() is only done 
+ * once and particles are only synchronized at the sample times. The integration
+ * stops early if the status is not REB_EXIT_SUCCESS at a sample time, e.g. if a 
+ * particle escapes. 
+ * @param r The rebound simulation to be integrated.
+ * @param times Sample times, sorted in the direction of the integration.
+ * @param n Number of sample times.
+ * @param out Output buffers, each large enough for n samples.
+ * @return Number of samples stored, -1 if the arguments are not valid.
+ */
+int reb_integrate_samples(struct reb_simulation* const r, const double* const times, const int n, struct reb_samples* const out);
+
+/**
+ * @brief Starts an integration in a new thread and returns immediately.
+ * @details The integration is the same as with reb_integrate(). The simulation 
+ * must not be accessed by the caller until reb_integrate_async_wait() has 
+ * been called, except through the reb_integrate_async functions below. 
+ * OpenGL visualization is not supported.
+ * @param r The rebound simulation to be integrated.
+ * @param tmax The time to be integrated to. Set this to INFINITY to integrate forever.
+ * @return Handle of the integration, NULL if the thread could not be created.
+ */
+struct reb_integrate_async* reb_integrate_async(struct reb_simulation* const r, double tmax);
+
+/**
+ * @brief Returns the status of an asynchronous integration without blocking.
+ * @param a Handle returned by reb_integrate_async().
+ * @param t If not NULL, set to the time at the end of the last completed timestep.
+ * @param steps If not NULL, set to the number of completed timesteps.
+ * @return REB_RUNNING while the integration is running, the return value of reb_integrate() once it has finished.
+ */
+enum REB_STATUS reb_integrate_async_poll(struct reb_integrate_async* const a, double* t, unsigned long long* steps);
+
+/**
+ * @brief Requests a snapshot of an asynchronous integration.
+ * @details The integration thread makes a copy of the simulation (see reb_copy_simulation())
+ * after the next completed timestep. Use reb_integrate_async_snapshot() to retrieve it.
+ * @param a Handle returned by reb_integrate_async().
+ */
+void reb_integrate_async_request_snapshot(struct reb_integrate_async* const a);
+
+/**
+ * @brief Retrieves the snapshot requested with reb_integrate_async_request_snapshot().
+ * @details The snapshot is handed over without locks. It is a consistent copy 
+ * of the simulation between two timesteps. The caller takes ownership and needs
+ * to free it with reb_free_simulation(). 
+ * @param a Handle returned by reb_integrate_async().
+ * @return The snapshot, or NULL if it is not ready yet.
+ */
+struct reb_simulation* reb_integrate_async_snapshot(struct reb_integrate_async* const a);
+
+/**
+ * @brief Asks an asynchronous integration to stop after the current timestep.
+ * @details The integration then finishes with the status REB_EXIT_USER. 
+ * Call reb_integrate_async_wait() afterwards.
+ * @param a Handle returned by reb_integrate_async().
+ */
+void reb_integrate_async_cancel(struct reb_integrate_async* const a);
+
+/**
+ * @brief Waits for an asynchronous integration to finish and frees the handle.
+ * @details Needs to be called exactly once for every handle. Snapshots which have 
+ * not been retrieved are freed.
+ * @param a Handle returned by reb_integrate_async().
+ * @return The return value of reb_integrate().
+ */
+enum REB_STATUS reb_integrate_async_wait(struct reb_integrate_async* const a);
+
 /**
  * @brief Synchronize particles manually at end of timestep
  * @details This function should be called if the WHFAST integrator
@@ -943,6 +1601,21 @@ void reb_integrator_synchronize(struct reb_simulation* r);
  **/
 void reb_integrator_reset(struct reb_simulation* r);
 
+/**
+ * @brief Dense output of IAS15.
+ * @details Evaluates the positions and velocities at time t within the last 
+ * completed IAS15 timestep using the polynomial coefficients of that step. 
+ * No forces are evaluated. The accuracy is comparable to that of the
+ * step itself. Only the positions and velocities in particles are overwritten.
+ * Dense output is not available with block timesteps or if the particles
+ * have been modified after the last step.
+ * @param r The rebound simulation to be considered (not modified)
+ * @param t Time at which the particles are evaluated. Needs to be within r->t-r->dt_last_done and r->t.
+ * @param particles Array of r->N particles to which the positions and velocities are written.
+ * @return 1 on success, 0 if dense output is not available for this time.
+ */
+int reb_integrator_ias15_dense_output(const struct reb_simulation* const r, const double t, struct reb_particle* const particles);
+
 /**
  * @brief Configure the boundary/root box
  * @details This function helps to setup the variables for the simulation box.
@@ -972,9 +1645,23 @@ void reb_free_pointers(struct reb_simulation* const r);
 #ifdef MPI
 /**
  * @brief Init MPI for simulation r
+ * @details Simulations for which this function has not been called are 
+ * local simulations. They are integrated entirely on the calling node 
+ * without any communication, e.g. by reb_mpi_ensemble_run().
  */
 void reb_mpi_init(struct reb_simulation* const r);
 
+/**
+ * @brief Reassigns root boxes to MPI nodes so that every node has a similar number of particles.
+ * @details This is a collective call. The root boxes are split into contiguous 
+ * ranges (in the order of their index) with a similar number of particles, at 
+ * least one root box per node. Particles in root boxes which changed their 
+ * owner are sent to their new node and the tree is rebuilt. Called automatically
+ * if mpi_balance_interval is set.
+ * @param r The rebound simulation to be balanced
+ */
+void reb_mpi_balance(struct reb_simulation* const r);
+
 /**
  * @brief Finalize MPI for simulation r
  */
@@ -1004,6 +1691,31 @@ int reb_reset_function_pointers(struct reb_simulation* const r);
  */
 void reb_add(struct reb_simulation* const r, struct reb_particle pt);
 
+/** 
+ * @brief Adds many particles to the simulation at once. 
+ * @details Same as calling reb_add() for every particle, but the particle array 
+ * is only reallocated once and, if a tree is used, the tree is built once 
+ * after all particles have been added.
+ * @param r The rebound simulation to which the particles will be added
+ * @param particles Array of N particles to be added (copied).
+ * @param N Number of particles.
+ */
+void reb_add_many(struct reb_simulation* const r, const struct reb_particle* const particles, const int N);
+
+/** 
+ * @brief Adds many particles from arrays of particle data.
+ * @details This is the inverse of reb_serialize_particle_data(). 
+ * Fields with NULL pointers are set to zero. See reb_add_many().
+ * @param r The rebound simulation to which the particles will be added
+ * @param N Number of particles to add
+ * @param hash 1D array of particle hashes
+ * @param m 1D array of particle masses
+ * @param radius 1D array of particle radii
+ * @param xyz 3D array of particle positions
+ * @param vxvyvz 3D array of particle velocities
+ */
+void reb_add_serialized_particle_data(struct reb_simulation* const r, const int N, const uint32_t* hash, const double* m, const double* radius, const double (*xyz)[3], const double (*vxvyvz)[3]);
+
 /**
  * @brief Remove all particles
  * @param r The rebound simulation to be considered
@@ -1034,6 +1746,44 @@ int reb_remove(struct reb_simulation* const r, int index, int keepSorted);
  */
 int reb_remove_by_hash(struct reb_simulation* const r, uint32_t hash, int keepSorted);
 
+/**
+ * @brief Mark a particle for removal.
+ * @details The particle stays in the particles array until reb_remove_marked() is called.
+ * This is much faster than calling reb_remove() for each particle if many particles are
+ * removed at once. Particles must not be added or removed with other functions while
+ * particles are marked. Marking a particle twice has no effect.
+ * @param r The rebound simulation to be considered
+ * @param index The index in the particles array of the particle to be removed.
+ * @return Returns 1 if particle was successfully marked, 0 if index passed was 
+ * out of range.
+ */
+int reb_remove_mark(struct reb_simulation* const r, int index);
+
+/**
+ * @brief Remove all particles marked with reb_remove_mark().
+ * @details The particles array is compacted in one pass. 
+ * @param r The rebound simulation to be considered
+ * @param keepSorted Set to 1 to keep the order of the remaining particles. Otherwise, 
+ * particles from the end of the array are moved into the gaps.
+ * @return Returns the number of particles removed.
+ */
+int reb_remove_marked(struct reb_simulation* const r, int keepSorted);
+
+/**
+ * @brief Sorts the particle array along a Morton (Z-order) curve.
+ * @details Additions, removals and the tree code scramble the order of particles over time,
+ * so that particles which are close in space are far apart in memory. This function restores
+ * the spatial locality, which speeds up the tree code, the collision search and the direct 
+ * summation. Active particles and test particles are sorted separately. The central object 
+ * stays at index 0 for WHFASTHELIO and MERCURIUS. The indices in the tree, the hash lookup 
+ * table and the buffers of the integrators are updated. Not supported by integrators for which
+ * the order of particles matters (WHFast, SABA, HERMES), by IAS15 with block timesteps and with 
+ * variational particles. The simulation is synchronized first. Also see reorder_interval.
+ * @param r The rebound simulation to be considered.
+ * @return 1 if the particles have been reordered, 0 otherwise.
+ */
+int reb_reorder_particles(struct reb_simulation* const r);
+
 /**
  * @brief Get a pointer to a particle by its hash.
  * @details see examples/uniquely_identifying_particles_with_hashes.
@@ -1043,6 +1793,24 @@ int reb_remove_by_hash(struct reb_simulation* const r, uint32_t hash, int keepSo
 */
 struct reb_particle* reb_get_particle_by_hash(struct reb_simulation* const r, uint32_t hash);
 
+/**
+ * @brief Copy the particle state into the structure-of-arrays storage r->particles_soa.
+ * @details The arrays are (re)allocated if needed. Pointers to the arrays stay valid until the
+ * number of particles exceeds particles_soa.allocatedN. This is called automatically after
+ * every timestep if particles_soa_enabled is set.
+ * @param r The rebound simulation to be considered.
+ */
+void reb_particles_soa_update(struct reb_simulation* const r);
+
+/**
+ * @brief Copy the structure-of-arrays storage r->particles_soa back into the particles array.
+ * @details Use this function after modifying the arrays in r->particles_soa. 
+ * Nothing is copied and an error message is generated if the number of particles 
+ * changed since the last call to reb_particles_soa_update().
+ * @param r The rebound simulation to be considered.
+ */
+void reb_particles_soa_apply(struct reb_simulation* const r);
+
 /**
  * @brief Run the heartbeat function and check for escaping/colliding particles.
  * @details You rarely want to call this function yourself. It is used internally to 
@@ -1063,6 +1831,77 @@ int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_
  */
 int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_collision c);
 
+/**
+ * @brief Relative positions and velocities of the particles of many collisions.
+ * @details For collision i, the position and velocity of particle p2 are subtracted from 
+ * those of particle p1 shifted by its ghostbox. This is the same convention as in 
+ * reb_collision_resolve_hardsphere(). Intended for use in collision_resolve_batch.
+ * @param r The rebound simulation to be considered.
+ * @param collisions Array of N collisions.
+ * @param N Number of collisions.
+ * @param dxv Output. Array of 6*N doubles: x, y, z, vx, vy, vz of collision i start at dxv[6*i].
+ */
+void reb_collision_relative_states(struct reb_simulation* const r, const struct reb_collision* const collisions, const int N, double* const dxv);
+
+/**
+ * @brief Finds all particles within a distance radius of a point using the tree.
+ * @details Periodic images in the ghost boxes (nghostx, nghosty, nghostz) are included. 
+ * The function only reads the tree and the particles and can be called from several 
+ * threads at once, for example from an OpenMP parallel loop in additional_forces. 
+ * The tree needs to be set up (gravity or collision set to a tree method) and up to date,
+ * which is the case during additional_forces and after a timestep. 
+ * With MPI, only the particles of the local root boxes are searched.
+ * @param r The rebound simulation to be considered.
+ * @param x x position of the query point.
+ * @param y y position of the query point.
+ * @param z z position of the query point.
+ * @param radius Search radius.
+ * @param exclude Index of a particle which is not returned (in the original box), e.g. the particle at the query point. Use -1 to return all particles.
+ * @param neighbours Array in which the neighbours are stored in tree order. Can be NULL if neighbours_N is 0.
+ * @param neighbours_N Size of the neighbours array.
+ * @return Number of neighbours found. If this is larger than neighbours_N, only the first 
+ * neighbours_N are stored. Returns -1 if there is no tree.
+ */
+int reb_tree_query_radius(struct reb_simulation* const r, const double x, const double y, const double z, const double radius, const int exclude, struct reb_neighbour* const neighbours, const int neighbours_N);
+
+/**
+ * @brief Finds the k nearest particles to a point using the tree.
+ * @details Same conditions as for reb_tree_query_radius(). 
+ * @param r The rebound simulation to be considered.
+ * @param x x position of the query point.
+ * @param y y position of the query point.
+ * @param z z position of the query point.
+ * @param k Number of neighbours to find.
+ * @param exclude Index of a particle which is not returned (in the original box). Use -1 to return all particles.
+ * @param neighbours Array of at least k elements in which the neighbours are stored, sorted by distance.
+ * @return Number of neighbours found. Smaller than k only if there are not enough particles. Returns -1 if there is no tree.
+ */
+int reb_tree_query_knn(struct reb_simulation* const r, const double x, const double y, const double z, const int k, const int exclude, struct reb_neighbour* const neighbours);
+
+/**
+ * @brief Finds the neighbours within a distance radius of every particle.
+ * @details The particle itself is not included. The queries are done in parallel with OpenMP.
+ * @param r The rebound simulation to be considered.
+ * @param radius Search radius.
+ * @return List of neighbours, to be freed with reb_free_neighbour_list(). NULL if there is no tree.
+ */
+struct reb_neighbour_list* reb_tree_query_radius_all(struct reb_simulation* const r, const double radius);
+
+/**
+ * @brief Finds the k nearest neighbours of every particle.
+ * @details The particle itself is not included. The neighbours of each particle are sorted by distance. 
+ * The queries are done in parallel with OpenMP.
+ * @param r The rebound simulation to be considered.
+ * @param k Number of neighbours per particle.
+ * @return List of neighbours, to be freed with reb_free_neighbour_list(). NULL if there is no tree.
+ */
+struct reb_neighbour_list* reb_tree_query_knn_all(struct reb_simulation* const r, const int k);
+
+/**
+ * @brief Frees a list returned by reb_tree_query_radius_all() or reb_tree_query_knn_all().
+ */
+void reb_free_neighbour_list(struct reb_neighbour_list* const list);
+
 /** @} */
 
 /**
@@ -1103,6 +1942,46 @@ double reb_random_normal(double variance);
  */
 double reb_random_rayleigh(double sigma);
 
+/**
+ * @brief Creates a stream of the counter-based random number generator.
+ * @details The same seed and stream number always give the same sequence.
+ * @param seed Key of the generator.
+ * @param stream Stream number.
+ * @return A new stream.
+ */
+struct reb_rng reb_rng_init(uint64_t seed, uint64_t stream);
+
+/**
+ * @brief Creates a new stream which has not been used by this simulation before.
+ * @details The stream uses r->rand_seed as the key. Streams are numbered 
+ * consecutively, so a simulation created with the same rand_seed hands out 
+ * the same streams. This function is not thread-safe, but the returned 
+ * streams can be used concurrently.
+ * @param r The rebound simulation to be considered
+ * @return A new stream.
+ */
+struct reb_rng reb_rng_stream(struct reb_simulation* const r);
+
+/**
+ * @brief Same as reb_random_uniform() but draws from the stream rng.
+ */
+double reb_rng_uniform(struct reb_rng* const rng, double min, double max);
+
+/**
+ * @brief Same as reb_random_powerlaw() but draws from the stream rng.
+ */
+double reb_rng_powerlaw(struct reb_rng* const rng, double min, double max, double slope);
+
+/**
+ * @brief Same as reb_random_normal() but draws from the stream rng.
+ */
+double reb_rng_normal(struct reb_rng* const rng, double variance);
+
+/**
+ * @brief Same as reb_random_rayleigh() but draws from the stream rng.
+ */
+double reb_rng_rayleigh(struct reb_rng* const rng, double sigma);
+
 /**
  * @brief Move to center of momentum and center of mass frame.
  * @details This function moved all particles to the center of mass 
@@ -1224,6 +2103,21 @@ void reb_output_orbits(struct reb_simulation* r, char* filename);
  */
 void reb_output_binary(struct reb_simulation* r, char* filename);
 
+#ifdef MPI
+/**
+ * @brief Save the reb_simualtion structure of all MPI nodes into one binary file
+ * @details This is a collective call. Unlike reb_output_binary(), which creates
+ * one file per node, the particles of all nodes are written into a single file 
+ * using collective MPI-IO. All other fields are written by the root node. 
+ * Integrator buffers (IAS15, WHFast) are those of the root node only, so this 
+ * is meant for integrators without such buffers (leapfrog, SEI).
+ * Read the file with reb_create_simulation_from_binary_mpi(). 
+ * @param r The rebound simulation to be considered
+ * @param filename Output filename.
+ */
+void reb_output_binary_mpi(struct reb_simulation* r, char* filename);
+#endif // MPI
+
 /**
  * @brief Append the positions and velocities of all particles to an ASCII file.
  * @param r The rebound simulation to be considered
@@ -1244,24 +2138,392 @@ void reb_output_binary_positions(struct reb_simulation* r, char* filename);
  * @param filename Output filename.
  */
 void reb_output_velocity_dispersion(struct reb_simulation* r, char* filename);
-/** @} */
 
 /**
- * @defgroup SetupRebFunctions 
- * List of the built-in setup helper functions
- * @{
+ * @brief One batch of particle data passed to the callback of an output stream.
+ * @details All arrays are structure of arrays with N entries and are only valid 
+ * during the callback. The orbital elements are Jacobi elements. Entry 0 (the 
+ * central object) is zero. They are NULL unless REB_OUTPUT_STREAM_ORBITS is set.
+ */
+struct reb_output_stream_batch {
+    double t;               ///< Time of the batch
+    double G;               ///< Gravitational constant
+    int N;                  ///< Number of particles (variational particles are not included)
+    unsigned long dropped;  ///< Number of batches dropped before this one (only with REB_OUTPUT_STREAM_DROP)
+    uint32_t* hash;         ///< Hashes
+    double* m;              ///< Masses
+    double* x;              ///< x-positions
+    double* y;              ///< y-positions
+    double* z;              ///< z-positions
+    double* vx;             ///< x-velocities
+    double* vy;             ///< y-velocities
+    double* vz;             ///< z-velocities
+    double* a;              ///< Semi-major axes
+    double* e;              ///< Eccentricities
+    double* inc;            ///< Inclinations
+    double* Omega;          ///< Longitudes of ascending node
+    double* omega;          ///< Arguments of pericenter
+    double* f;              ///< True anomalies
+};
+
+/**
+ * @brief Flags of an output stream (can be combined).
  */
+enum {
+    REB_OUTPUT_STREAM_ORBITS = 1,   ///< Calculate orbital elements on the stream's thread
+    REB_OUTPUT_STREAM_DROP = 2,     ///< Drop batches if the ring buffer is full instead of waiting
+};
+
 /**
- * @brief returns the true anomaly for a given eccentricity and mean anomaly
- * @param e Eccentricity
- * @param M Mean anomaly
- * @return True anomaly
+ * @brief Adds an output stream, a consumer of particle data running on its own thread.
+ * @details Each call of reb_output_stream_push() copies the particle data into a 
+ * ring buffer with capacity batches. A background thread calls callback for every 
+ * batch, in order. The callback must not access the simulation. If the ring buffer
+ * is full, reb_output_stream_push() waits, or drops the batch if 
+ * REB_OUTPUT_STREAM_DROP is set. The streams are stopped when the simulation is freed,
+ * after all pending batches have been processed.
+ * @param r The rebound simulation to be considered
+ * @param callback Function called on the stream's thread for every batch.
+ * @param userdata Pointer passed on to callback.
+ * @param capacity Number of batches in the ring buffer.
+ * @param flags REB_OUTPUT_STREAM_ORBITS and/or REB_OUTPUT_STREAM_DROP, or 0.
+ * @return Returns 0 on success and -1 if the thread could not be created.
  */
-double reb_tools_M_to_f(double e, double M);
+int reb_output_stream_add(struct reb_simulation* const r, void (*callback)(const struct reb_output_stream_batch* const batch, void* userdata), void* userdata, int capacity, unsigned int flags);
 
 /**
- * @brief Initialize a particle on an orbit in the xy plane.
- * @param G Gravitational constant.
+ * @brief Pushes the current particle data to all output streams.
+ * @details Usually called from the heartbeat function, like reb_output_ascii(). 
+ * Only copies the data, the streams process it on their own threads.
+ * @param r The rebound simulation to be considered
+ */
+void reb_output_stream_push(struct reb_simulation* const r);
+
+/**
+ * @brief Waits until all output streams have processed all pushed batches.
+ * @param r The rebound simulation to be considered
+ */
+void reb_output_stream_flush(struct reb_simulation* const r);
+
+/**
+ * @brief Returns the metrics of a simulation.
+ * @details The copy contains the wall time of a running integration up to now and
+ * the rates, averaged over the wall time. It can be called from another thread
+ * while the simulation is being integrated, as long as energy is 0.
+ * @param r The rebound simulation to be considered
+ * @param energy If 1, the total energy is calculated (O(N^2)) and the energy drift is updated.
+ * @return Copy of r->metrics with rates.
+ */
+struct reb_metrics reb_metrics_get(struct reb_simulation* const r, const int energy);
+
+/**
+ * @brief Sets all metrics to zero.
+ * @details The energy drift is measured relative to the energy at the next call of reb_metrics_get() with energy=1.
+ * @param r The rebound simulation to be considered
+ */
+void reb_metrics_reset(struct reb_simulation* const r);
+
+/**
+ * @brief Formats the metrics in the OpenMetrics text format.
+ * @details Counters are exported as rebound_<name>_total. Rates and the energy drift are gauges.
+ * @param m Metrics, usually returned by reb_metrics_get().
+ * @param buf Output buffer.
+ * @param size Size of buf. The output is truncated if it does not fit.
+ * @return Length of the full output (excluding the terminating null character), as snprintf().
+ */
+int reb_metrics_openmetrics(const struct reb_metrics* const m, char* const buf, const size_t size);
+
+/**
+ * @brief Writes the metrics in the OpenMetrics text format to a file.
+ * @details The file is replaced atomically (written to a temporary file which is
+ * then renamed), so a scraper never reads a partial file. This is what 
+ * textfile collectors expect. Usually called from the heartbeat function.
+ * @param r The rebound simulation to be considered
+ * @param filename Output filename.
+ * @return Returns 0 on success and -1 if the file could not be written.
+ */
+int reb_output_metrics(struct reb_simulation* const r, const char* const filename);
+
+/**
+ * @brief Header of a shared memory segment created with reb_output_shm_open().
+ * @details The header is at the beginning of the segment. It is followed by
+ * the particle hashes (N_max uint32_t, at hash_offset) and the particle data,
+ * structure of arrays with N_max doubles per column (m, x, y, z, vx, vy, vz,
+ * starting at data_offset). Offsets are in bytes from the start of the segment.
+ * The writer increments seq before and after it updates a snapshot (seqlock),
+ * seq is odd while the snapshot is being written. Readers never block the 
+ * simulation. They read the snapshot in place between 
+ * reb_output_shm_read_begin() and reb_output_shm_read_retry() and try again
+ * if the latter returns 1.
+ */
+struct reb_output_shm_header {
+    uint32_t magic;         ///< REB_OUTPUT_SHM_MAGIC
+    uint32_t version;       ///< Version of the layout (currently 1)
+    uint64_t seq;           ///< Sequence counter of the seqlock
+    uint64_t size;          ///< Size of the segment in bytes
+    uint64_t hash_offset;   ///< Offset of the hashes
+    uint64_t data_offset;   ///< Offset of the masses. The other columns follow, N_max doubles each
+    int32_t N_max;          ///< Number of particles the segment can hold
+    int32_t N;              ///< Number of particles in the snapshot (at most N_max)
+    int32_t N_total;        ///< Number of real particles in the simulation (can be larger than N)
+    int32_t N_active;       ///< Number of active particles (-1 if all particles are active)
+    uint64_t snapshots;     ///< Number of snapshots published so far
+    uint64_t steps;         ///< Number of timesteps done since the segment was opened
+    double t;               ///< Time of the snapshot
+    double dt;              ///< Last timestep
+    double G;               ///< Gravitational constant
+    double walltime;        ///< Wall time in seconds since the segment was opened
+    double energy;          ///< Total energy, NAN unless REB_OUTPUT_SHM_ENERGY is set
+};
+
+/**
+ * @brief Magic number of a shared memory segment ("REBS").
+ */
+#define REB_OUTPUT_SHM_MAGIC 0x53424552u
+
+/**
+ * @brief Flags of a shared memory segment (can be combined).
+ */
+enum {
+    REB_OUTPUT_SHM_ENERGY = 1,      ///< Calculate the total energy for every snapshot (O(N^2))
+};
+
+/**
+ * @brief Opens a shared memory segment with live snapshots of the simulation.
+ * @details The segment is created with shm_open() (the name should start with
+ * a slash, e.g. "/rebound") and is mapped into memory. A snapshot of the 
+ * particles and diagnostics is published when the segment is opened and then 
+ * at the end of every timestep once the simulation time has advanced by at 
+ * least interval. Publishing only copies the data into the segment. Other 
+ * processes can attach with reb_output_shm_attach(). Only the first N_max 
+ * particles are published. A previously opened segment is closed. The segment
+ * is removed when the simulation is freed or reb_output_shm_close() is called.
+ * @param r The rebound simulation to be considered
+ * @param name Name of the segment.
+ * @param N_max Number of particles the segment can hold. If 0, the current number of particles is used.
+ * @param interval Cadence in simulation time. If 0, a snapshot is published after every timestep.
+ * @param flags REB_OUTPUT_SHM_ENERGY, or 0.
+ * @return Returns 0 on success and -1 if the segment could not be created.
+ */
+int reb_output_shm_open(struct reb_simulation* const r, const char* const name, int N_max, double interval, unsigned int flags);
+
+/**
+ * @brief Publishes a snapshot to the shared memory segment now.
+ * @param r The rebound simulation to be considered
+ */
+void reb_output_shm_publish(struct reb_simulation* const r);
+
+/**
+ * @brief Unmaps and removes the shared memory segment.
+ * @details Processes which are still attached can read the last snapshot until they detach.
+ * @param r The rebound simulation to be considered
+ */
+void reb_output_shm_close(struct reb_simulation* const r);
+
+/**
+ * @brief Attaches read-only to a shared memory segment, usually from another process.
+ * @param name Name of the segment, as passed to reb_output_shm_open().
+ * @return Returns the header of the segment, or NULL if the segment does not exist or is not a REBOUND segment.
+ */
+const struct reb_output_shm_header* reb_output_shm_attach(const char* const name);
+
+/**
+ * @brief Detaches from a segment attached with reb_output_shm_attach().
+ * @param h Header returned by reb_output_shm_attach().
+ */
+void reb_output_shm_detach(const struct reb_output_shm_header* const h);
+
+/**
+ * @brief Starts reading a snapshot.
+ * @details Waits if the writer is in the middle of an update.
+ * @param h Header of the segment.
+ * @return Sequence number to be passed to reb_output_shm_read_retry().
+ */
+uint64_t reb_output_shm_read_begin(const struct reb_output_shm_header* const h);
+
+/**
+ * @brief Finishes reading a snapshot.
+ * @param h Header of the segment.
+ * @param seq Sequence number returned by reb_output_shm_read_begin().
+ * @return Returns 1 if the snapshot has changed while it was read and the data needs to be read again, 0 otherwise.
+ */
+int reb_output_shm_read_retry(const struct reb_output_shm_header* const h, const uint64_t seq);
+
+/**
+ * @brief Adds a built-in additional force to the simulation.
+ * @details The forces are compiled C functions which are called in every force 
+ * evaluation, right before the additional_forces callback. Several forces can be 
+ * combined. The parameters are set with reb_set_force_parameter(). Forces act on 
+ * all real particles, except the primary. The primary does not feel any back-reaction.
+ * Adding a velocity dependent force (drag, prdrag, gr) sets force_is_velocity_dependent.
+ * With REB_GRAVITY_NONE, the accelerations are set to zero before the forces are added.
+ * The default speed of light is that in units where G=1, with masses in solar masses,
+ * distances in AU and time in yr/(2 pi).
+ * @param r The rebound simulation to be considered
+ * @param name One of "drag", "j2", "prdrag" or "gr", see enum REB_FORCE.
+ * @return Index of the new force or -1 if the name is unknown.
+ */
+int reb_add_force(struct reb_simulation* const r, const char* const name);
+
+/**
+ * @brief Sets a parameter of a built-in additional force.
+ * @param r The rebound simulation to be considered
+ * @param index Index of the force, as returned by reb_add_force().
+ * @param name Name of the parameter (see enum REB_FORCE) or "primary" for the index of the central body.
+ * @param value New value of the parameter.
+ * @return 0 on success, -1 if the force or the parameter does not exist.
+ */
+int reb_set_force_parameter(struct reb_simulation* const r, const int index, const char* const name, const double value);
+
+/**
+ * @brief Removes all built-in additional forces.
+ * @param r The rebound simulation to be considered
+ */
+void reb_remove_forces(struct reb_simulation* const r);
+
+/**
+ * @brief Regions of the code which are timed if profiling is enabled.
+ * @details The first group are the parts of a timestep (plus I/O and visualization). 
+ * The second group are nested in those.
+ */
+enum REB_PROFILING_CAT {
+    REB_PROFILING_CAT_INTEGRATOR = 0,       ///< Integrator, including the forces calculated within the integrator
+    REB_PROFILING_CAT_BOUNDARY = 1,         ///< Boundary conditions
+    REB_PROFILING_CAT_GRAVITY = 2,          ///< Everything needed to calculate the forces
+    REB_PROFILING_CAT_COLLISION = 3,        ///< Collision search and resolution
+    REB_PROFILING_CAT_VISUALIZATION = 4,    ///< Display heartbeat
+    REB_PROFILING_CAT_IO = 5,               ///< SimulationArchive output
+    REB_PROFILING_CAT_TREE = 6,             ///< Tree build and update
+    REB_PROFILING_CAT_TREE_MOMENTS = 7,     ///< Calculation of the centers of mass and multipole moments in the tree
+    REB_PROFILING_CAT_FORCE = 8,            ///< Gravity kernels (reb_calculate_acceleration(), direct summation or tree walk)
+    REB_PROFILING_CAT_MPI = 9,              ///< MPI communication
+    REB_PROFILING_CAT_COLLISION_SEARCH = 10,    ///< Collision search
+    REB_PROFILING_CAT_COLLISION_RESOLVE = 11,   ///< Collision resolution
+    REB_PROFILING_CAT_KEPLER = 12,          ///< Kepler drifts of WHFast and WHFastHelio
+    REB_PROFILING_CAT_IAS15_PREDICTOR = 13, ///< Predictor corrector loop of IAS15 (the force calculations are nested in it)
+    REB_PROFILING_CAT_N = 14,               ///< Number of categories
+};
+
+/**
+ * @brief Hardware performance counters recorded for every region.
+ * @details Only recorded if REBOUND is compiled with PERF=1 on Linux (perf_event).
+ * Counters the kernel or CPU do not provide stay zero.
+ */
+enum REB_PROFILING_COUNTER {
+    REB_PROFILING_COUNTER_CYCLES = 0,           ///< CPU cycles
+    REB_PROFILING_COUNTER_INSTRUCTIONS = 1,     ///< Instructions retired
+    REB_PROFILING_COUNTER_CACHE_REFERENCES = 2, ///< Last level cache references
+    REB_PROFILING_COUNTER_CACHE_MISSES = 3,     ///< Last level cache misses
+    REB_PROFILING_COUNTER_BRANCH_MISSES = 4,    ///< Mispredicted branches
+    REB_PROFILING_COUNTER_N = 5,                ///< Number of counters
+};
+
+/**
+ * @brief Timing data of one region (see reb_profiling_get()).
+ */
+struct reb_profiling_region {
+    const char* name;           ///< Name of the region
+    int parent;                 ///< Region this region is usually nested in, -1 for the parts of a timestep
+    unsigned long long calls;   ///< Number of times the region was timed
+    double time;                ///< Time spent in the region in seconds, including nested regions
+    double time_self;           ///< Time spent in the region in seconds, excluding nested regions
+    unsigned long long counters[REB_PROFILING_COUNTER_N];   ///< Hardware counters (see REB_PROFILING_COUNTER), including nested regions
+};
+
+/**
+ * @brief Enables profiling.
+ * @details The time spent in the regions listed in REB_PROFILING_CAT is 
+ * measured with a monotonic clock. Each OpenMP thread has its own counters.
+ * Profiling is enabled automatically if REBOUND is compiled with PROFILING=1.
+ * @param r The rebound simulation to be considered
+ */
+void reb_profiling_enable(struct reb_simulation* const r);
+
+/**
+ * @brief Disables profiling and discards all timing data.
+ * @param r The rebound simulation to be considered
+ */
+void reb_profiling_disable(struct reb_simulation* const r);
+
+/**
+ * @brief Sets all timing data to zero.
+ * @param r The rebound simulation to be considered
+ */
+void reb_profiling_reset(struct reb_simulation* const r);
+
+/**
+ * @brief Returns the number of threads with their own counters (0 if profiling is disabled).
+ * @param r The rebound simulation to be considered
+ */
+int reb_profiling_get_threads_N(const struct reb_simulation* const r);
+
+/**
+ * @brief Returns the number of hardware counters which are recorded.
+ * @details 0 unless REBOUND is compiled with PERF=1 and the kernel allows 
+ * perf_event_open() (see /proc/sys/kernel/perf_event_paranoid).
+ * Counters are opened by each thread when it enters its first region, so
+ * the number is only known after the first timestep.
+ * @param r The rebound simulation to be considered
+ */
+int reb_profiling_get_counters_N(const struct reb_simulation* const r);
+
+/**
+ * @brief Returns the timing data.
+ * @param r The rebound simulation to be considered
+ * @param thread Thread to return the data for, or -1 for the sum over all threads.
+ * @param regions Array with REB_PROFILING_CAT_N entries, filled with the data of each region.
+ * @return Wall time in seconds since profiling was enabled or reset, -1 if profiling is disabled.
+ */
+double reb_profiling_get(const struct reb_simulation* const r, const int thread, struct reb_profiling_region* const regions);
+
+/**
+ * @brief Enables the trace recorder (and profiling if it is not enabled yet).
+ * @details Every profiling region is recorded as an event with its start and end 
+ * time. For every timestep, the step size, the number of particles, the number of 
+ * IAS15 iterations and rejected steps, the number of collisions found, the depth 
+ * of the tree and whether the HERMES mini simulation was active are recorded. 
+ * Events and timesteps are stored in ring buffers, only the most recent ones are kept.
+ * Calling this function again discards the recorded trace.
+ * @param r The rebound simulation to be considered
+ * @param capacity Number of timesteps and of events per thread kept in the ring buffers.
+ */
+void reb_profiling_trace_enable(struct reb_simulation* const r, int capacity);
+
+/**
+ * @brief Stops recording the trace and discards it. Profiling stays enabled.
+ * @param r The rebound simulation to be considered
+ */
+void reb_profiling_trace_disable(struct reb_simulation* const r);
+
+/**
+ * @brief Writes the recorded trace to a file in the Chrome trace event format (JSON).
+ * @details The file can be opened with chrome://tracing or https://ui.perfetto.dev.
+ * Regions are shown as nested slices per thread, timesteps as slices with their data 
+ * as arguments, and the step size, particle number, IAS15 iterations, collisions, 
+ * tree depth and HERMES state as counter tracks.
+ * @param r The rebound simulation to be considered
+ * @param filename Output file
+ * @return 0 on success, -1 if tracing is not enabled or the file cannot be written.
+ */
+int reb_profiling_trace_write(const struct reb_simulation* const r, const char* const filename);
+/** @} */
+
+/**
+ * @defgroup SetupRebFunctions 
+ * List of the built-in setup helper functions
+ * @{
+ */
+/**
+ * @brief returns the true anomaly for a given eccentricity and mean anomaly
+ * @param e Eccentricity
+ * @param M Mean anomaly
+ * @return True anomaly
+ */
+double reb_tools_M_to_f(double e, double M);
+
+/**
+ * @brief Initialize a particle on an orbit in the xy plane.
+ * @param G Gravitational constant.
  * @param primary Particle structure for the orbit's reference body.
  * @param m Mass of the particle.
  * @param a Semi-major axis of the particle.
@@ -1331,6 +2593,40 @@ struct reb_orbit reb_tools_particle_to_orbit_err(double G, struct reb_particle p
  */
 struct reb_orbit reb_tools_particle_to_orbit(double G, struct reb_particle p, struct reb_particle primary);
 
+/**
+ * @brief Calculates orbital elements for many particles at once.
+ * @details The arrays are row major with 7 doubles per particle. Particles and primaries
+ * are stored as (m, x, y, z, vx, vy, vz), orbits as (m, a, e, inc, Omega, omega, f).
+ * The results are the same as those of reb_tools_particle_to_orbit_err(). The particles
+ * are processed in blocks, the algebra is vectorized and, with OpenMP, the blocks are
+ * distributed over threads. The output array must not overlap with the input arrays.
+ * @param G The gravitational constant.
+ * @param N Number of particles.
+ * @param particles Input array of size N*7.
+ * @param primaries Reference bodies. Array of size 7 if Nprimaries is 1 (the same primary
+ * for all particles), otherwise of size N*7 (one primary per particle).
+ * @param Nprimaries Either 1 or N.
+ * @param orbits Output array of size N*7. Rows which could not be converted are set to nan (the mass is copied).
+ * @param err Output array of size N with the error codes of reb_tools_particle_to_orbit_err(). 0 means no error. Can be NULL.
+ * @return Number of particles which could not be converted.
+ */
+int reb_tools_particles_to_orbits(const double G, const int N, const double* const particles, const double* const primaries, const int Nprimaries, double* const orbits, int* const err);
+
+/**
+ * @brief Calculates positions and velocities for many particles from their orbital elements at once.
+ * @details This is the inverse of reb_tools_particles_to_orbits() and uses the same array layouts.
+ * The results are the same as those of reb_tools_orbit_to_particle_err().
+ * @param G The gravitational constant.
+ * @param N Number of particles.
+ * @param orbits Input array of size N*7 with rows (m, a, e, inc, Omega, omega, f).
+ * @param primaries Reference bodies. Array of size 7 if Nprimaries is 1, otherwise of size N*7.
+ * @param Nprimaries Either 1 or N.
+ * @param particles Output array of size N*7 with rows (m, x, y, z, vx, vy, vz). Rows which could not be converted are set to nan.
+ * @param err Output array of size N with the error codes of reb_tools_orbit_to_particle_err(). 0 means no error. Can be NULL.
+ * @return Number of particles which could not be converted.
+ */
+int reb_tools_orbits_to_particles(const double G, const int N, const double* const orbits, const double* const primaries, const int Nprimaries, double* const particles, int* const err);
+
 /**
  * @brief Initialize a particle on a 3D orbit.  See Pal 2009 for a definition of these coordinates.
  * @detail Pal describes a coordinate system for Keplerian Orbits that is analytical (i.e. infinitely differentiable) between spatial coordinates and orbital elements. See http://adsabs.harvard.edu/abs/2009MNRAS.396.1737P
@@ -1356,6 +2652,21 @@ struct reb_particle reb_tools_pal_to_particle(double G, struct reb_particle prim
  */
 struct reb_simulation* reb_create_simulation_from_binary(char* filename);
 
+#ifdef MPI
+/**
+ * @brief Reads a binary file written by reb_output_binary_mpi() on all MPI nodes.
+ * @details This is a collective call. MPI is initialized if needed and 
+ * reb_mpi_init() is called. Every node reads an equal share of the particles 
+ * using collective MPI-IO, then the particles are sent to the nodes owning 
+ * their root boxes. The number of nodes does not have to be the same as 
+ * when the file was written, but the number of root boxes needs to be a 
+ * multiple of it.
+ * @param filename Filename to be read.
+ * @return Returns a pointer to a REBOUND simulation.
+ */
+struct reb_simulation* reb_create_simulation_from_binary_mpi(char* filename);
+#endif // MPI
+
 /**
  * @brief Enum describing possible errors that might occur during binary file reading.
  */
@@ -1382,6 +2693,38 @@ void reb_create_simulation_from_binary_with_messages(struct reb_simulation* r, c
  */
 void reb_tools_init_plummer(struct reb_simulation* r, int _N, double M, double R);
 
+/**
+ * @brief Same as reb_tools_init_plummer() but generates the particles in parallel.
+ * @details The particles are written directly into r->particles. Each particle 
+ * uses its own stream of the counter-based random number generator 
+ * (see reb_rng_stream()), so the result only depends on r->rand_seed and 
+ * not on the number of OpenMP threads.
+ * @param r The rebound simulation to be considered
+ * @param N Number of particles in the plummer sphere.
+ * @param M Total mass of the cluster.
+ * @param R Characteristic radius of the cluster.
+ */
+void reb_tools_add_plummer(struct reb_simulation* r, int N, double M, double R);
+
+/**
+ * @brief Adds a disc or ring of particles on Keplerian orbits around primary, generated in parallel.
+ * @details Semi-major axes follow a powerlaw distribution between a_min and a_max.
+ * Eccentricities and inclinations follow Rayleigh distributions, all angles are uniform.
+ * Use a_min=a_max for a narrow ring. As in reb_tools_add_plummer(), one stream of 
+ * the random number generator is used per particle and the particles are 
+ * written directly into r->particles.
+ * @param r The rebound simulation to be considered
+ * @param N Number of particles.
+ * @param primary Central object.
+ * @param m Mass of each particle.
+ * @param a_min Minimum semi-major axis.
+ * @param a_max Maximum semi-major axis.
+ * @param slope Slope of the powerlaw distribution of semi-major axes.
+ * @param sigma_e Scale parameter of the eccentricity distribution.
+ * @param sigma_inc Scale parameter of the inclination distribution.
+ */
+void reb_tools_add_disc(struct reb_simulation* r, int N, struct reb_particle primary, double m, double a_min, double a_max, double slope, double sigma_e, double sigma_inc);
+
 /**
  * @brief Reads arguments from the command line.
  * @param argc Number of command line arguments.
@@ -1495,6 +2838,29 @@ struct reb_particle reb_derivatives_m_Omega(double G, struct reb_particle primar
 struct reb_particle reb_derivatives_omega_f(double G, struct reb_particle primary, struct reb_particle po);
 struct reb_particle reb_derivatives_m_omega(double G, struct reb_particle primary, struct reb_particle po);
 struct reb_particle reb_derivatives_m_f(double G, struct reb_particle primary, struct reb_particle po);
+
+/**
+ * @brief Sets of orbital elements used by reb_derivatives_all().
+ */
+enum REB_DERIVATIVES_ELEMENTS {
+    REB_DERIVATIVES_PAL = 0,        ///< The elements of Pal (2009) in the order m, a, k, h, lambda, ix, iy.
+    REB_DERIVATIVES_ORBIT = 1,      ///< The classical orbital elements in the order m, a, e, inc, omega, Omega, f.
+};
+
+/**
+ * @brief Calculates all first and second derivatives of one or more particles at once.
+ * @details Returns the same values as the individual reb_derivatives_* functions, but the 
+ * orbital elements, the solution of Kepler's equation and the sines and cosines are only 
+ * calculated once per particle. With OpenMP, the particles are processed in parallel.
+ * @param G The gravitational constant
+ * @param primaries Array of length N with the primaries of the Keplerian orbits
+ * @param particles Array of length N with the particles for which the derivatives are calculated
+ * @param N Number of particles
+ * @param elements Set of orbital elements, see REB_DERIVATIVES_ELEMENTS.
+ * @param first Output array of length 7*N, or NULL. first[7*i+j] is the derivative of particle i with respect to element j.
+ * @param second Output array of length 49*N, or NULL. second[49*i+7*j+k] is the second derivative of particle i with respect to elements j and k. The matrix of each particle is symmetric.
+ */
+void reb_derivatives_all(double G, const struct reb_particle* const primaries, const struct reb_particle* const particles, const int N, const enum REB_DERIVATIVES_ELEMENTS elements, struct reb_particle* const first, struct reb_particle* const second);
 /** @} */
 /** @} */
 
@@ -1573,6 +2939,523 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
  * @returns Returns the approximate size of the SimulationArchive file in bytes.
  */
 long reb_simulationarchive_estimate_size(struct reb_simulation* const r, double tmax);
+
+/**
+ * @brief Wait until all snapshots have been written to the SimulationArchive file.
+ * @details Only needed if r->simulationarchive_async is set and the file is read 
+ * while the simulation is still in use. Snapshots are also flushed when the 
+ * simulation is freed.
+ * @param r The simulation to be considered.
+ */
+void reb_simulationarchive_flush(struct reb_simulation* const r);
+
+/**
+ * @brief Read-only, memory mapped view of a SimulationArchive file.
+ * @details The file stays mapped until reb_free_simulationarchive_map() is called.
+ * Snapshots appended after the map has been created are not visible.
+ */
+struct reb_simulationarchive_map {
+    const char* data;           ///< Start of the mapped file
+    size_t size;                ///< Size of the mapped file in bytes
+    long size_first;            ///< Size of the initial binary file in bytes
+    long size_snapshot;         ///< Size of a snapshot (other than the 1st) in bytes
+    long N_snapshots;           ///< Number of snapshots, including the initial binary file (snapshot 0)
+    long* offset;               ///< Offset of each snapshot in the file, in bytes (N_snapshots entries, offset[0] is the one of the initial binary file)
+    double* t;                  ///< Time of each snapshot (N_snapshots entries)
+    double* walltime;           ///< Walltime of each snapshot (N_snapshots entries)
+    int N;                      ///< Number of particles
+    int integrator;             ///< Integrator used (enum REB_INTEGRATOR)
+    int compression;            ///< 1 if snapshots are compressed
+    unsigned int keyframe_interval; ///< Keyframe interval, 0 if there are no delta snapshots
+    char* keyframe;             ///< 1 if a snapshot can be decoded without the previous one (N_snapshots entries)
+    int fd;                     ///< File descriptor of the mapped file, -1 if the file is mapped by a SimulationArchive container
+    char* buffer;               ///< Decompressed snapshot (compressed archives only)
+    long buffer_snapshot;       ///< Index of the snapshot in buffer, -1 if none
+    char* scratch;              ///< Scratch space for decompression (compressed archives only)
+    char* filename;             ///< Filename of the SimulationArchive
+};
+
+/**
+ * @brief Maps a SimulationArchive file into memory and builds the time index.
+ * @param filename Filename of the SimulationArchive.
+ * @returns Returns a pointer to the map, or NULL if the file cannot be read. 
+ * Needs to be freed with reb_free_simulationarchive_map().
+ */
+struct reb_simulationarchive_map* reb_create_simulationarchive_map(const char* filename);
+
+/**
+ * @brief Unmaps the file and frees the map.
+ * @param m The map to be freed.
+ */
+void reb_free_simulationarchive_map(struct reb_simulationarchive_map* const m);
+
+/**
+ * @brief Finds the last snapshot at or before a given time (bisection on the time index).
+ * @param m The SimulationArchive map.
+ * @param t Requested time.
+ * @returns Returns the index of the snapshot, 0 if t is before the first appended snapshot.
+ */
+long reb_simulationarchive_map_find(struct reb_simulationarchive_map* const m, const double t);
+
+/**
+ * @brief Returns a pointer to the particle data of a snapshot inside the mapped file (no copy).
+ * @details The data consists of 7 doubles per particle (m, x, y, z, vx, vy, vz). 
+ * Note that these are Jacobi coordinates for WHFast and democratic heliocentric 
+ * coordinates for WHFastHelio if safe_mode is turned off. The data is not 
+ * necessarily aligned to 8 bytes. For compressed archives, the snapshot is 
+ * decompressed into an internal buffer which is overwritten by the next call.
+ * Delta snapshots are reconstructed from the nearest keyframe (or from the
+ * snapshot currently in the buffer), so accessing snapshots in order is fast.
+ * @param m The SimulationArchive map.
+ * @param snapshot Index of the snapshot, 1 <= snapshot < m->N_snapshots.
+ * @returns Returns NULL for the initial binary file (snapshot 0), indices out of range and JANUS.
+ */
+const void* reb_simulationarchive_map_particles(struct reb_simulationarchive_map* const m, const long snapshot);
+
+/**
+ * @brief Loads a snapshot from a SimulationArchive map into a simulation.
+ * @details Same as reb_simulationarchive_load_snapshot() but reads from the mapped 
+ * file. The simulation needs to be created from the same SimulationArchive.
+ * @param r The simulation.
+ * @param m The SimulationArchive map.
+ * @param snapshot Index of the snapshot, negative values count from the end. 
+ * Snapshot 0 loads the initial binary file.
+ * @returns Returns 0 on success.
+ */
+int reb_simulationarchive_map_load_snapshot(struct reb_simulation* const r, struct reb_simulationarchive_map* const m, long snapshot);
+
+/**
+ * @brief Decodes many snapshots at once into caller provided arrays.
+ * @details The snapshots are loaded into temporary simulations (one per OpenMP
+ * thread) and synchronized, so the output is in inertial coordinates. 
+ * Additional forces are not applied during the synchronization. The snapshots
+ * are split into contiguous chunks, one per thread, so sorted indices make best
+ * use of delta snapshots. Each output array can be NULL. The map itself is not 
+ * modified.
+ * @param m The SimulationArchive map.
+ * @param snapshots Indices of the snapshots (N_snapshots entries), negative values count from the end.
+ * @param N_snapshots Number of snapshots to decode.
+ * @param t Times of the snapshots (N_snapshots entries).
+ * @param xyz Positions (N_snapshots*m->N rows).
+ * @param vxvyvz Velocities (N_snapshots*m->N rows).
+ * @param orbits Jacobi orbital elements a, e, inc, Omega, omega, f of particles 1 to N-1 
+ * (N_snapshots*(m->N-1) rows).
+ * @returns Returns 0 on success, -1 if the initial binary file cannot be read and 
+ * -3 if a snapshot index is out of range or a snapshot is corrupt.
+ */
+int reb_simulationarchive_map_extract(struct reb_simulationarchive_map* const m, const long* const snapshots, const long N_snapshots, double* const t, double (*xyz)[3], double (*vxvyvz)[3], double (*orbits)[6]);
+
+/**
+ * @brief Header of a record in a SimulationArchive container.
+ * @details A SimulationArchive container stores the Simulation Archives of many 
+ * simulations (members) in one file. Simulations with simulationarchive_member>=0 
+ * append to it. The file is a sequence of records, each consisting of this header 
+ * followed by size bytes of data. The first record of a member contains its initial 
+ * binary file, the following ones snapshots in the same format as in a Simulation
+ * Archive file. Every record is appended with a single write to a file opened with 
+ * O_APPEND, so many simulations (threads or processes) can append to the same 
+ * container at the same time. The records of different members are interleaved. 
+ * If a member writes a new initial binary file, its earlier records are ignored.
+ */
+struct reb_simulationarchive_container_record {
+    int64_t member;     ///< Index of the member
+    int64_t type;       ///< 0 if the data is the initial binary file, 1 if it is a snapshot
+    int64_t size;       ///< Size of the data following the header in bytes
+};
+
+/**
+ * @brief Read-only, memory mapped view of a SimulationArchive container.
+ * @details The index of all records is built in one pass over the record headers.
+ * The Simulation Archive of a member is only read when the member is first accessed.
+ * Records appended after the container has been created are not visible.
+ */
+struct reb_simulationarchive_container {
+    const char* data;           ///< Start of the mapped file
+    size_t size;                ///< Size of the mapped file in bytes
+    int fd;                     ///< File descriptor of the mapped file
+    char* filename;             ///< Filename of the container
+    long N_members;             ///< Number of members (largest member index plus one)
+    long* start;                ///< The records of member k are records[start[k]] to records[start[k+1]-1] (N_members+1 entries)
+    long* records;              ///< Offsets of the record headers in the file, grouped by member in the order in which they were written
+    struct reb_simulationarchive_map** maps; ///< Maps of the members which have been accessed, NULL otherwise (N_members entries)
+};
+
+/**
+ * @brief Maps a SimulationArchive container into memory and builds the index of its records.
+ * @param filename Filename of the container.
+ * @returns Returns a pointer to the container, or NULL if the file cannot be read. 
+ * Needs to be freed with reb_free_simulationarchive_container().
+ */
+struct reb_simulationarchive_container* reb_create_simulationarchive_container(const char* filename);
+
+/**
+ * @brief Unmaps the file and frees the container, including the maps of all members.
+ * @param c The container to be freed.
+ */
+void reb_free_simulationarchive_container(struct reb_simulationarchive_container* const c);
+
+/**
+ * @brief Returns the map of the Simulation Archive of one member.
+ * @details The map can be used with all reb_simulationarchive_map functions. It 
+ * belongs to the container. Do not free it. This function is not thread-safe 
+ * the first time a member is accessed.
+ * @param c The container.
+ * @param member Index of the member.
+ * @returns Returns the map, or NULL if the container does not contain the member.
+ */
+struct reb_simulationarchive_map* reb_simulationarchive_container_map(struct reb_simulationarchive_container* const c, const long member);
+
+/**
+ * @brief Loads a snapshot of one member of a SimulationArchive container into a simulation.
+ * @details The initial binary file of the member is loaded first, then the snapshot.
+ * @param r The simulation.
+ * @param c The container.
+ * @param member Index of the member.
+ * @param snapshot Index of the snapshot, negative values count from the end. 
+ * @returns Returns 0 on success, -1 if the member cannot be found and -3 if the snapshot cannot be read.
+ */
+int reb_simulationarchive_container_load_snapshot(struct reb_simulation* const r, struct reb_simulationarchive_container* const c, const long member, long snapshot);
+
+/**
+ * @brief Creates a simulation from a snapshot of one member of a SimulationArchive container.
+ * @param c The container.
+ * @param member Index of the member.
+ * @param snapshot Index of the snapshot, negative values count from the end. 
+ * @returns Returns a pointer to a new reb_simulation structure, or NULL if the snapshot cannot be read.
+ */
+struct reb_simulation* reb_create_simulation_from_simulationarchive_container(struct reb_simulationarchive_container* const c, const long member, const long snapshot);
+/** @} */
+
+/**
+ * @defgroup EnsembleFunctions
+ * Functions for integrating many independent small systems with WHFast at once.
+ * @{
+ */
+
+/**
+ * @brief Number of systems integrated together in one tile of a reb_ensemble.
+ */
+#define REB_ENSEMBLE_LANES 8
+
+/**
+ * @brief Ensemble of independent systems with the same number of particles.
+ * @details All systems share the time, the timestep and the gravitational 
+ * constant. They are integrated with WHFast in Jacobi coordinates (no 
+ * symplectic correctors, no softening, no additional forces). The particles
+ * are stored in one contiguous buffer. Use reb_ensemble_set_particles() and
+ * reb_ensemble_get_particles() to access them.
+ */
+struct reb_ensemble {
+    double t;                       ///< Current time of all systems.
+    double dt;                      ///< Timestep (default: 0.001).
+    double G;                       ///< Gravitational constant (default: 1).
+    int N_systems;                  ///< Number of systems.
+    int N;                          ///< Number of particles per system.
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    struct reb_simulation* r;       ///< Simulation used for warnings and error messages.
+    int N_tiles;                    ///< Number of tiles of REB_ENSEMBLE_LANES systems.
+    struct reb_particle* particles; ///< Inertial coordinates. Particle i of system k is at (k/LANES*N+i)*LANES+k%LANES.
+    struct reb_particle* p_j;       ///< Jacobi coordinates, same layout.
+    double* eta;                    ///< Interior masses, same layout.
+    int* is_set;                    ///< Flag for each system, set to 1 after the particles have been set.
+    /** @endcond */
+};
+
+/**
+ * @brief Creates an ensemble of systems.
+ * @param N_systems Number of systems.
+ * @param N Number of particles in each system. Needs to be at least 2.
+ * @returns Pointer to the new ensemble or NULL if the arguments are invalid. 
+ * Free it with reb_free_ensemble().
+ */
+struct reb_ensemble* reb_create_ensemble(const int N_systems, const int N);
+
+/**
+ * @brief Initializes an ensemble that has already been allocated (used by the python wrapper).
+ * @param e The ensemble to be initialized.
+ * @param N_systems Number of systems.
+ * @param N Number of particles in each system. Needs to be at least 2.
+ */
+void reb_init_ensemble(struct reb_ensemble* const e, const int N_systems, const int N);
+
+/**
+ * @brief Frees an ensemble and all its particles.
+ */
+void reb_free_ensemble(struct reb_ensemble* const e);
+
+/**
+ * @brief Frees the particles of an ensemble but not the ensemble itself (used by the python wrapper).
+ */
+void reb_free_ensemble_pointers(struct reb_ensemble* const e);
+
+/**
+ * @brief Sets the particles of one system.
+ * @details Only the positions, velocities and masses are used. All systems
+ * need to be set before calling reb_ensemble_integrate().
+ * @param e The ensemble to be modified.
+ * @param k Index of the system.
+ * @param particles Array of e->N particles (for example r->particles of a simulation).
+ */
+void reb_ensemble_set_particles(struct reb_ensemble* const e, const int k, const struct reb_particle* const particles);
+
+/**
+ * @brief Copies the particles of one system to an array.
+ * @param e The ensemble to be considered.
+ * @param k Index of the system.
+ * @param particles Array with space for e->N particles.
+ */
+void reb_ensemble_get_particles(const struct reb_ensemble* const e, const int k, struct reb_particle* const particles);
+
+/**
+ * @brief Integrates all systems until the time of the ensemble reaches tmax. 
+ * @details Takes the same number of timesteps as reb_integrate() with 
+ * exact_finish_time=0. The systems are integrated in tiles of REB_ENSEMBLE_LANES 
+ * systems, tiles are distributed over OpenMP threads.
+ * @param e The ensemble to be integrated.
+ * @param tmax The time to be reached.
+ */
+void reb_ensemble_integrate(struct reb_ensemble* const e, const double tmax);
+/** @} */
+
+/**
+ * @defgroup BatchFunctions
+ * Functions for integrating many copies of one simulation on a pool of threads.
+ * @{
+ */
+
+/**
+ * @brief Many independent copies of one simulation.
+ * @details The simulations are stored in one contiguous array. Each of them 
+ * can be modified individually (e.g. for a parameter sweep) before the batch 
+ * is integrated. Unlike a reb_ensemble, every copy is a complete simulation,
+ * so all integrators, gravity routines, collisions and forces can be used.
+ */
+struct reb_batch {
+    int N;                              ///< Number of simulations.
+    int threads;                        ///< Number of threads. 0: number of processors.
+    struct reb_simulation* simulations; ///< Array of N simulations.
+};
+
+/**
+ * @brief Creates a batch of N copies of a simulation.
+ * @details The copies are made with the binary file format, in memory, on 
+ * the thread pool. C function pointers (additional forces, heartbeat, 
+ * collision resolve, etc.) are copied as well. Visualization is disabled 
+ * in the copies.
+ * @param r Template simulation.
+ * @param N Number of copies.
+ * @param threads Number of threads used to create and integrate the copies. 0: number of processors.
+ * @returns Pointer to the new batch or NULL if N<1. Free it with reb_free_batch().
+ */
+struct reb_batch* reb_create_batch(struct reb_simulation* const r, const int N, const int threads);
+
+/**
+ * @brief Initializes a batch that has already been allocated (used by the python wrapper).
+ */
+void reb_init_batch(struct reb_batch* const b, struct reb_simulation* const r, const int N, const int threads);
+
+/**
+ * @brief Frees a batch and all its simulations.
+ */
+void reb_free_batch(struct reb_batch* const b);
+
+/**
+ * @brief Frees the simulations of a batch but not the batch itself (used by the python wrapper).
+ */
+void reb_free_batch_pointers(struct reb_batch* const b);
+
+/**
+ * @brief Integrates all simulations of a batch until tmax.
+ * @details Every thread repeatedly takes the next simulation which has not 
+ * been integrated yet and calls reb_integrate() for it. The status of every 
+ * simulation is stored in its status field. With OpenMP, every simulation is
+ * integrated by a single thread.
+ * @param b The batch to be integrated.
+ * @param tmax The time to be reached.
+ */
+void reb_batch_integrate(struct reb_batch* const b, double tmax);
+
+/**
+ * @brief Copies the time and the status of every simulation to arrays.
+ * @param b The batch to be considered.
+ * @param t Array of size b->N for the times. Can be NULL.
+ * @param status Array of size b->N for the status (enum REB_STATUS). Can be NULL.
+ */
+void reb_batch_get_status(const struct reb_batch* const b, double* const t, int* const status);
+
+/**
+ * @brief Copies the particles of all simulations to an array.
+ * @param b The batch to be considered.
+ * @param N Number of particles per simulation to copy.
+ * @param data Array of size b->N*N*7 with the rows (m, x, y, z, vx, vy, vz). 
+ * Particles which do not exist (e.g. after a merger) are set to nan.
+ * @returns Number of simulations with less than N particles.
+ */
+int reb_batch_get_particle_data(const struct reb_batch* const b, const int N, double* const data);
+
+/**
+ * @brief Sets the particles of all simulations from an array.
+ * @param b The batch to be modified.
+ * @param N Number of particles per simulation in data.
+ * @param data Array of size b->N*N*7 with the rows (m, x, y, z, vx, vy, vz).
+ * Only the first min(N, number of particles) particles of each simulation are set.
+ * @returns Number of simulations with less than N particles.
+ */
+int reb_batch_set_particle_data(struct reb_batch* const b, const int N, const double* const data);
+
+/**
+ * @brief Settings and results of a MEGNO stability map.
+ * @details The map is calculated on a regular grid of two parameters x and y. 
+ * For every grid point, a copy of a template simulation is modified by the 
+ * setup function, the variational particles for MEGNO are added (see 
+ * reb_tools_megno_init()) and the copy is integrated to tmax on a pool of 
+ * threads. An integration stops early once MEGNO exceeds megno_max or the 
+ * integration exits with an escape or a close encounter (see exit_max_distance
+ * and exit_min_distance of the template). With refine>0, the grid is refined 
+ * adaptively: in every level, the spacing is halved and only the cells whose 
+ * corners differ by more than refine_threshold in MEGNO are integrated. The 
+ * other new points are filled in with the mean of their neighbours (where
+ * MEGNO is limited to megno_max and escaped systems count as megno_max).
+ * Use reb_init_megno_map() to set the default values.
+ */
+struct reb_megno_map {
+    int Nx;                     ///< Number of grid points in x before refinement.
+    int Ny;                     ///< Number of grid points in y before refinement.
+    double xmin;                ///< First value of x.
+    double xmax;                ///< Last value of x.
+    double ymin;                ///< First value of y.
+    double ymax;                ///< Last value of y.
+    /**
+     * @brief Sets the initial conditions of the grid point (x, y) in r, a copy of the template.
+     * @details Called concurrently from several threads. Must not add variational particles.
+     */
+    void (*setup)(struct reb_simulation* const r, const double x, const double y, void* args);
+    void* setup_args;           ///< Passed to setup.
+    double tmax;                ///< Maximum integration time.
+    double check_interval;      ///< MEGNO and the exit status are checked after every check_interval. Default: tmax/100.
+    double t_min;               ///< MEGNO is not used to stop an integration before this time. Default: 0.
+    double megno_max;           ///< An integration is stopped once MEGNO exceeds this value. Default: 5.
+    int refine;                 ///< Number of refinement levels. Default: 0.
+    double refine_threshold;    ///< A cell is refined if MEGNO at its corners differs by more than this. Escaped systems count as megno_max. Default: 1.
+    int threads;                ///< Number of threads. 0: number of processors.
+    
+    int Nx_fine;                ///< Number of grid points in x after refinement, (Nx-1)*2^refine+1.
+    int Ny_fine;                ///< Number of grid points in y after refinement, (Ny-1)*2^refine+1.
+    double* megno;              ///< MEGNO at the end of the integration of every point, Nx_fine*Ny_fine values, x varies fastest.
+    double* t;                  ///< Time at which the integration of every point ended. 0 for filled in points.
+    int* status;                ///< Exit status of every point (enum REB_STATUS). Copied from a neighbour for filled in points.
+    int* level;                 ///< Refinement level in which the point has been integrated, -1 for filled in points.
+    long N_integrated;          ///< Number of integrations.
+};
+
+/**
+ * @brief Initializes a MEGNO map with the default settings.
+ * @param m The MEGNO map to be initialized.
+ * @param Nx Number of grid points in x.
+ * @param Ny Number of grid points in y.
+ * @param xmin First value of x.
+ * @param xmax Last value of x.
+ * @param ymin First value of y.
+ * @param ymax Last value of y.
+ * @param tmax Maximum integration time.
+ */
+void reb_init_megno_map(struct reb_megno_map* const m, const int Nx, const int Ny, const double xmin, const double xmax, const double ymin, const double ymax, const double tmax);
+
+/**
+ * @brief Calculates a MEGNO map.
+ * @details The result arrays are (re)allocated. Free them with reb_free_megno_map_pointers().
+ * Every point is integrated by a single thread. The initial displacements
+ * of the variational particles only depend on the rand_seed of the template 
+ * and the grid point, so the results do not depend on the number of threads.
+ * @param m The MEGNO map, including the settings.
+ * @param r The template simulation. It must not have any variational particles.
+ * @returns N_integrated, or -1 if the settings are invalid.
+ */
+long reb_megno_map_calculate(struct reb_megno_map* const m, struct reb_simulation* const r);
+
+/**
+ * @brief Frees the result arrays of a MEGNO map, but not the map itself.
+ */
+void reb_free_megno_map_pointers(struct reb_megno_map* const m);
+
+/**
+ * @brief Header of one simulation in an ensemble archive.
+ * @details An ensemble archive, written by reb_mpi_ensemble_run(), is a sequence 
+ * of records. Every record consists of this header, followed by a binary 
+ * file of the final state of the simulation (size bytes). The records are 
+ * in the order in which the simulations finished.
+ */
+struct reb_ensemble_archive_record {
+    long index;         ///< Index of the simulation in the ensemble.
+    double t;           ///< Time at the end of the integration.
+    int status;         ///< Exit status of the integration (enum REB_STATUS).
+    long size;          ///< Size of the binary file following the header in bytes.
+};
+
+/**
+ * @brief Loads one simulation from an ensemble archive.
+ * @param filename The ensemble archive.
+ * @param index Index of the simulation in the ensemble.
+ * @returns The simulation, or NULL if it cannot be found. Free it with reb_free_simulation().
+ */
+struct reb_simulation* reb_create_simulation_from_ensemble_archive(char* filename, const long index);
+
+#ifdef MPI
+/**
+ * @brief Settings and results of an ensemble of independent simulations distributed over MPI nodes.
+ * @details Simulation k is a copy of a template simulation which is modified 
+ * by setup and then integrated to tmax with reb_integrate(). Every node 
+ * integrates simulations on a pool of threads. The simulations are handed 
+ * out dynamically in chunks from a counter on the root node (with one-sided 
+ * MPI communication), so nodes which finish early take more simulations.
+ * Use reb_init_mpi_ensemble() to set the default values.
+ */
+struct reb_mpi_ensemble {
+    long N;                     ///< Number of simulations.
+    double tmax;                ///< Time to be reached by every simulation.
+    /**
+     * @brief Sets the initial conditions of simulation k in r, a copy of the template.
+     * @details Called concurrently from several threads. Can be NULL.
+     */
+    void (*setup)(struct reb_simulation* const r, const long k, void* args);
+    void* setup_args;           ///< Passed to setup.
+    int threads;                ///< Number of threads per node. 0: number of processors.
+    int chunk;                  ///< Number of simulations a node takes from the counter at once. 0: number of threads.
+    char* filename;             ///< If not NULL, the final states of all simulations are written to this ensemble archive.
+    double* t;                  ///< Time at the end of the integration of every simulation, N values. Set on all nodes.
+    int* status;                ///< Exit status of every simulation (enum REB_STATUS), N values. Set on all nodes.
+    long N_local;               ///< Number of simulations integrated by this node.
+};
+
+/**
+ * @brief Initializes an ensemble with the default settings.
+ * @param e The ensemble to be initialized.
+ * @param N Number of simulations.
+ * @param tmax Time to be reached by every simulation.
+ */
+void reb_init_mpi_ensemble(struct reb_mpi_ensemble* const e, const long N, const double tmax);
+
+/**
+ * @brief Integrates all simulations of an ensemble.
+ * @details This is a collective call on MPI_COMM_WORLD. MPI is initialized if 
+ * needed. The template needs to be the same on all nodes and has to be a local
+ * simulation (see reb_mpi_init()). MPI functions are only called by the 
+ * calling thread. The result arrays are (re)allocated. Free them with 
+ * reb_free_mpi_ensemble_pointers().
+ * @param e The ensemble, including the settings.
+ * @param r The template simulation.
+ * @returns 0 on success, -1 if the settings are invalid or the archive cannot be written.
+ */
+int reb_mpi_ensemble_run(struct reb_mpi_ensemble* const e, struct reb_simulation* const r);
+
+/**
+ * @brief Frees the result arrays of an ensemble, but not the ensemble itself.
+ */
+void reb_free_mpi_ensemble_pointers(struct reb_mpi_ensemble* const e);
+#endif // MPI
 /** @} */
 
 /**
@@ -1669,6 +3552,9 @@ void reb_transformations_democratic_heliocentric_to_inertial_posvel(struct reb_p
 /**
  * @brief Calculate the total energy (potential and kinetic).
  * @details Does not work for SEI (shearing sheet simulations). 
+ * The sums are parallelized with OpenMP and use compensated summation.
+ * Only pairs involving at least one active particle are considered, so if most
+ * particles are test particles (N_active small) the cost is O(N*N_active).
  * @param r The rebound simulation to be considered.
  * @return Total energy. 
  */
@@ -1782,21 +3668,34 @@ struct reb_orbit_opengl {
 
 struct reb_display_data {
     struct reb_simulation* r;
-    struct reb_simulation* r_copy;
-    struct reb_particle_opengl* particle_data;
+    struct reb_particle_opengl* particle_data;      ///< Front buffer, drawn and uploaded to the GPU
     struct reb_orbit_opengl* orbit_data;
-    struct reb_particle* particles_copy;
-    struct reb_particle* p_j_copy;
-    struct reb_particle* p_h_copy;
-    double* eta_copy;
     unsigned long allocated_N;
-    unsigned long allocated_N_whfast;
-    unsigned long allocated_N_whfasthelio;
+    int N;                                          ///< Number of particles in particle_data
     unsigned int opengl_enabled;
     double scale;
     double mouse_x;
     double mouse_y;
     double retina;
+    double max_bandwidth;                           ///< If >0, display heartbeats are skipped so that at most this many bytes per second are encoded with reb_display_encode_frame().
+    double bandwidth_budget;                        ///< Bytes which can be sent before the next heartbeat is skipped
+    size_t frame_size;                              ///< Bytes encoded since the last display heartbeat
+    struct reb_particle_opengl* particle_data_back; ///< Back buffer, filled by reb_display_copy_data() while the simulation is locked
+    int N_back;                                     ///< Number of particles in particle_data_back
+    int back_ready;                                 ///< Set if particle_data_back holds data which has not been drawn yet
+    int dirty;                                      ///< Set to copy data at the next frame even if the simulation has not advanced
+    int lod_N;                                      ///< Maximum number of points drawn. More particles are aggregated using the tree. 0 turns this off.
+    struct reb_particle* particles_inertial;        ///< Scratch space for positions of unsynchronized WHFast/WHFastHelio simulations
+    double* orbit_state;                            ///< Particles, Jacobi primaries and orbits of the current orbit sweep
+    int orbits;                                     ///< Set if orbits were requested in the last call to reb_display_prepare_data()
+    int orbit_N;                                    ///< Number of particles in the current orbit sweep
+    int orbit_next;                                 ///< Number of orbits of the current sweep already calculated
+    struct reb_ghostbox* ghostbox_shifts;           ///< Shifts of all ghost boxes at the time of the last copy
+    unsigned long ghostbox_shifts_allocatedN;
+    double t;                                       ///< Time, status and integrator at the time of the last copy (for onscreen text)
+    double OMEGA;
+    enum REB_STATUS status;
+    int integrator;
     pthread_mutex_t mutex;          /**< Mutex to guarantee non-flickering */
     int spheres;                    /**< Switches between point sprite and real spheres. */
     int pause;                      /**< Pauses visualization, but keep simulation running */
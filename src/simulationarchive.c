@@ -30,43 +30,272 @@
 #include <string.h>
 #include <sys/time.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef REB_ZLIB
+#include <zlib.h>
+#endif // REB_ZLIB
 #include "particle.h"
 #include "rebound.h"
 #include "tools.h"
 #include "input.h"
 #include "output.h"
 #include "integrator_ias15.h"
+#include "tree.h"
+#include "simulationarchive.h"
 
 
 
-int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename, long snapshot){
-    if (access(filename, F_OK) == -1) return -1;
-    if (!r) return -2;
-    if (snapshot==0){
-        // load original binary file
-        enum reb_input_binary_messages warnings = 0;
-        reb_create_simulation_from_binary_with_messages(r,filename,&warnings);
-        if (warnings & REB_INPUT_BINARY_ERROR_NOFILE){
-            reb_error(r,"Cannot read binary file. Check filename and file contents.");
+/**
+ * @brief Scratch space and state used to compress snapshots.
+ */
+struct reb_simulationarchive_encoder {
+    char* shuffled;             ///< Byte-shuffled snapshot
+    size_t shuffled_allocated;  ///< Space allocated in shuffled
+    char* record;               ///< Compressed record
+    size_t record_allocated;    ///< Space allocated in record
+    char* previous;             ///< Payload of the previous snapshot (delta snapshots only)
+    size_t previous_allocated;  ///< Space allocated in previous
+    int has_previous;           ///< 1 if previous contains the payload of the last snapshot written to the file
+    unsigned int since_keyframe;///< Number of delta snapshots since the last keyframe
+};
+
+static void reb_simulationarchive_encoder_free(struct reb_simulationarchive_encoder* const e){
+    free(e->shuffled);
+    free(e->record);
+    free(e->previous);
+    *e = (struct reb_simulationarchive_encoder){0};
+}
+
+// Size of the header (record size, time, walltime) and trailer (record size) 
+// of a compressed snapshot record. If keyframes are used, the header is 
+// followed by one byte which is REB_SA_KEYFRAME or REB_SA_DELTA.
+#define REB_SA_RECORD_HEADER (sizeof(int64_t)+2*sizeof(double))
+#define REB_SA_RECORD_TRAILER (sizeof(int64_t))
+#define REB_SA_KEYFRAME 1
+#define REB_SA_DELTA 2
+
+// Optional data appended to every snapshot (bitmask stored in simulationarchive_extras).
+// REB_SA_EXTRA_PARTICLES: hashes and radii of the particles. The tree moves particles 
+//                         within the particles array, so the ones of the initial 
+//                         binary file might not belong to the same slot anymore.
+// REB_SA_EXTRA_COLLISIONS: times of last collision, collisions_plog, collisions_Nlog, collisions_seed
+// REB_SA_EXTRA_MEGNO: running MEGNO sums and covariances
+// REB_SA_EXTRA_TREE: centres of the tree cells of the particles (see reb_tree_get_cells()). 
+//                    The tree is not updated before a snapshot, so particles might have
+//                    left their cell. The next update moves them, just as in the original run.
+#define REB_SA_EXTRA_PARTICLES 1
+#define REB_SA_EXTRA_COLLISIONS 2
+#define REB_SA_EXTRA_MEGNO 4
+#define REB_SA_EXTRA_TREE 8
+
+// Returns the optional data needed to restart the current simulation exactly.
+static unsigned int reb_simulationarchive_extras(const struct reb_simulation* const r){
+    unsigned int extras = 0;
+    if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision!=REB_COLLISION_NONE){
+        extras |= REB_SA_EXTRA_PARTICLES;
+    }
+    if (r->gravity==REB_GRAVITY_TREE || r->gravity==REB_GRAVITY_FMM || r->gravity==REB_GRAVITY_TREEPM || r->collision==REB_COLLISION_TREE){
+        extras |= REB_SA_EXTRA_TREE;
+    }
+    if (r->collision!=REB_COLLISION_NONE){
+        extras |= REB_SA_EXTRA_COLLISIONS;
+    }
+    if (r->calculate_megno){
+        extras |= REB_SA_EXTRA_MEGNO;
+    }
+    return extras;
+}
+
+// Snapshots are written as compressed records if compression or keyframes are turned on.
+static int reb_simulationarchive_records(const struct reb_simulation* const r){
+    return r->simulationarchive_compression || r->simulationarchive_keyframe_interval;
+}
+
+// Returns 1 and sets an error message if snapshots are compressed but 
+// REBOUND has been compiled without zlib (see ZLIB=1 in Makefile.defs).
+static int reb_simulationarchive_zlib_missing(struct reb_simulation* const r){
+#ifdef REB_ZLIB
+    return 0;
+#else // REB_ZLIB
+    if (reb_simulationarchive_records(r)){
+        reb_error(r,"Simulation Archive compression requires zlib. Compile REBOUND with ZLIB=1.");
+        return 1;
+    }
+    return 0;
+#endif // REB_ZLIB
+}
+
+// Returns 1 if a record is a delta snapshot.
+static int reb_simulationarchive_record_is_delta(const char* const record, const unsigned int keyframe_interval){
+    return keyframe_interval && record[REB_SA_RECORD_HEADER]==REB_SA_DELTA;
+}
+
+#ifdef REB_ZLIB
+// Byte shuffle: groups the k-th byte of all 8 byte words together. Sign and 
+// exponent bytes of doubles are then next to each other, which makes them
+// compress much better. Trailing bytes (if any) are copied. If previous is
+// not NULL, the XOR with previous is shuffled instead (delta snapshots). 
+// Slowly changing values then have mostly zero bytes.
+static void reb_simulationarchive_shuffle(char* restrict const out, const char* restrict const in, const char* restrict const previous, const size_t size){
+    const size_t n = size/8;
+    if (previous){
+        for (size_t i=0;i<n;i++){
+            for (int k=0;k<8;k++){
+                out[k*n+i] = in[8*i+k]^previous[8*i+k];
+            }
         }
-        return 0;
+        for (size_t j=8*n;j<size;j++){
+            out[j] = in[j]^previous[j];
+        }
+    }else{
+        for (size_t i=0;i<n;i++){
+            for (int k=0;k<8;k++){
+                out[k*n+i] = in[8*i+k];
+            }
+        }
+        memcpy(out+8*n, in+8*n, size-8*n);
     }
-    
-    FILE* fd = fopen(filename,"r");
-    int fseekret = 0;
-    if (snapshot<0){
-        // Find latest snapshot
-        fseekret = fseek(fd,-r->simulationarchive_size_snapshot,SEEK_END);
+}
+
+// Inverse of reb_simulationarchive_shuffle. For delta snapshots (delta=1), 
+// out needs to contain the payload of the previous snapshot.
+static void reb_simulationarchive_unshuffle(char* restrict const out, const char* restrict const in, const int delta, const size_t size){
+    const size_t n = size/8;
+    if (delta){
+        for (size_t i=0;i<n;i++){
+            for (int k=0;k<8;k++){
+                out[8*i+k] ^= in[k*n+i];
+            }
+        }
+        for (size_t j=8*n;j<size;j++){
+            out[j] ^= in[j];
+        }
     }else{
-        fseekret = fseek(fd,r->simulationarchive_size_first + (snapshot-1)*r->simulationarchive_size_snapshot,SEEK_SET);
+        for (size_t i=0;i<n;i++){
+            for (int k=0;k<8;k++){
+                out[8*i+k] = in[k*n+i];
+            }
+        }
+        memcpy(out+8*n, in+8*n, size-8*n);
     }
-    if (fseekret){
-        // Seek didn't work.
-        fclose(fd);
-        return -3;
+}
+
+// Compresses a serialized snapshot (time, walltime, payload) into e->record.
+// The record consists of its size, the time, the walltime, the type (only if
+// keyframe_interval>0), the compressed payload and the size again (so that 
+// the file can also be read backwards). If keyframe_interval>0, every 
+// keyframe_interval-th snapshot is a keyframe, all others only store the 
+// difference (XOR) to the previous snapshot.
+// Returns the size of the record, 0 on failure.
+static size_t reb_simulationarchive_encode(struct reb_simulationarchive_encoder* const e, const char* const snapshot, const size_t size, const unsigned int keyframe_interval){
+    const size_t payload = size-2*sizeof(double);
+    const size_t header = REB_SA_RECORD_HEADER + (keyframe_interval?1:0);
+    if (e->shuffled_allocated<payload){
+        e->shuffled = realloc(e->shuffled, payload);
+        e->shuffled_allocated = payload;
+    }
+    const size_t bound = header+compressBound(payload)+REB_SA_RECORD_TRAILER;
+    if (e->record_allocated<bound){
+        e->record = realloc(e->record, bound);
+        e->record_allocated = bound;
+    }
+    int delta = 0;
+    if (keyframe_interval){
+        if (e->has_previous && e->previous_allocated==payload && e->since_keyframe+1<keyframe_interval){
+            delta = 1;
+            e->since_keyframe++;
+        }else{
+            e->since_keyframe = 0;
+        }
+        e->record[REB_SA_RECORD_HEADER] = delta?REB_SA_DELTA:REB_SA_KEYFRAME;
     }
-    fread(&(r->t),sizeof(double),1,fd);
-    fread(&(r->simulationarchive_walltime),sizeof(double),1,fd);
+    reb_simulationarchive_shuffle(e->shuffled, snapshot+2*sizeof(double), delta?e->previous:NULL, payload);
+    uLongf compressed = bound-header-REB_SA_RECORD_TRAILER;
+    if (compress2((Bytef*)e->record+header, &compressed, (const Bytef*)e->shuffled, payload, Z_BEST_SPEED)!=Z_OK){
+        e->has_previous = 0;
+        return 0;
+    }
+    if (keyframe_interval){
+        if (e->previous_allocated!=payload){
+            e->previous = realloc(e->previous, payload);
+            e->previous_allocated = payload;
+        }
+        memcpy(e->previous, snapshot+2*sizeof(double), payload);
+        e->has_previous = 1;
+    }
+    const int64_t record_size = header+compressed+REB_SA_RECORD_TRAILER;
+    memcpy(e->record, &record_size, sizeof(int64_t));
+    memcpy(e->record+sizeof(int64_t), snapshot, 2*sizeof(double));
+    memcpy(e->record+header+compressed, &record_size, sizeof(int64_t));
+    return record_size;
+}
+
+// Decompresses a record into a serialized snapshot of the given size. 
+// For delta snapshots, snapshot needs to contain the previous snapshot.
+// scratch needs to hold size bytes. Returns 0 on success.
+static int reb_simulationarchive_decode(char* const snapshot, const size_t size, const char* const record, const size_t record_size, char* const scratch, const unsigned int keyframe_interval){
+    const size_t payload = size-2*sizeof(double);
+    const size_t header = REB_SA_RECORD_HEADER + (keyframe_interval?1:0);
+    if (record_size<header+REB_SA_RECORD_TRAILER) return -1;
+    const int delta = reb_simulationarchive_record_is_delta(record, keyframe_interval);
+    memcpy(snapshot, record+sizeof(int64_t), 2*sizeof(double));
+    uLongf uncompressed = payload;
+    if (uncompress((Bytef*)scratch, &uncompressed, (const Bytef*)record+header, record_size-header-REB_SA_RECORD_TRAILER)!=Z_OK || uncompressed!=payload){
+        return -1;
+    }
+    reb_simulationarchive_unshuffle(snapshot+2*sizeof(double), scratch, delta, payload);
+    return 0;
+}
+#else // REB_ZLIB
+// Compiled without zlib. Compressed archives are rejected by reb_simulationarchive_zlib_missing().
+static size_t reb_simulationarchive_encode(struct reb_simulationarchive_encoder* const e, const char* const snapshot, const size_t size, const unsigned int keyframe_interval){
+    return 0;
+}
+
+static int reb_simulationarchive_decode(char* const snapshot, const size_t size, const char* const record, const size_t record_size, char* const scratch, const unsigned int keyframe_interval){
+    return -1;
+}
+#endif // REB_ZLIB
+
+// Deserializes data from a snapshot.
+static inline void reb_simulationarchive_get(const char** const buf, void* const data, const size_t size){
+    memcpy(data, *buf, size);
+    *buf += size;
+}
+
+static void reb_simulationarchive_get_particles(const char** const buf, struct reb_particle* const masses, struct reb_particle* const ps, const int N){
+    for(int i=0;i<N;i++){
+        double data[7];
+        reb_simulationarchive_get(buf, data, sizeof(double)*7);
+        masses[i].m = data[0];
+        ps[i].x  = data[1];
+        ps[i].y  = data[2];
+        ps[i].z  = data[3];
+        ps[i].vx = data[4];
+        ps[i].vy = data[5];
+        ps[i].vz = data[6];
+    }
+}
+
+static void reb_simulationarchive_get_dp7(const char** const buf, struct reb_dp7* const dp7, const int N3){
+    reb_simulationarchive_get(buf, dp7->p0, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p1, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p2, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p3, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p4, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p5, sizeof(double)*N3);
+    reb_simulationarchive_get(buf, dp7->p6, sizeof(double)*N3);
+}
+
+// Restores the state of r from a snapshot (other than the initial binary) stored in buf.
+static void reb_simulationarchive_restore(struct reb_simulation* r, const char* buf){
+    reb_simulationarchive_get(&buf, &(r->t), sizeof(double));
+    reb_simulationarchive_get(&buf, &(r->simulationarchive_walltime), sizeof(double));
     gettimeofday(&r->simulationarchive_time,NULL);
     if (r->simulationarchive_interval){
         while (r->simulationarchive_next<=r->t){
@@ -76,14 +305,14 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
     switch (r->integrator){
         case REB_INTEGRATOR_JANUS:
             {
-                if (r->ri_janus.allocated_N<r->N){
+                if ((int)r->ri_janus.allocated_N<r->N){
                     if (r->ri_janus.p_int){
                         free(r->ri_janus.p_int);
                     }
                     r->ri_janus.p_int= malloc(sizeof(struct reb_particle)*r->N);
                     r->ri_janus.allocated_N = r->N;
                 }
-                fread(r->ri_janus.p_int,sizeof(struct reb_particle_int)*r->N,1,fd);
+                reb_simulationarchive_get(&buf, r->ri_janus.p_int, sizeof(struct reb_particle_int)*r->N);
                 reb_integrator_synchronize(r);  // get floating point coordinates 
             }
             break;
@@ -93,7 +322,7 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
                 struct reb_particle* ps = r->particles;
                 if (r->ri_whfast.safe_mode==0){
                     // If same mode is off, store unsynchronized Jacobi coordinates
-                    if (r->ri_whfast.allocated_N<r->N){
+                    if ((int)r->ri_whfast.allocated_N<r->N){
                         if (r->ri_whfast.p_j){
                             free(r->ri_whfast.p_j);
                         }
@@ -106,23 +335,19 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
                     }
                     ps = r->ri_whfast.p_j;
                 }
-                for(int i=0;i<r->N;i++){
-                    fread(&(r->particles[i].m),sizeof(double),1,fd);
-                    fread(&(ps[i].x),sizeof(double),1,fd);
-                    fread(&(ps[i].y),sizeof(double),1,fd);
-                    fread(&(ps[i].z),sizeof(double),1,fd);
-                    fread(&(ps[i].vx),sizeof(double),1,fd);
-                    fread(&(ps[i].vy),sizeof(double),1,fd);
-                    fread(&(ps[i].vz),sizeof(double),1,fd);
-                }
+                reb_simulationarchive_get_particles(&buf, r->particles, ps, r->N);
                 if (r->ri_whfast.safe_mode==0){
                     // Assume we are not synchronized
                     r->ri_whfast.is_synchronized=0.;
                     // Recalculate Jacobi masses
+                    // Variational particles do not contribute to the Jacobi masses
+                    const int N_real = r->N-r->N_var;
                     r->ri_whfast.eta[0] = r->particles[0].m;
                     r->ri_whfast.p_j[0].m = r->particles[0].m;
-                    for (unsigned int i=1;i<r->N;i++){
-                        r->ri_whfast.eta[i] = r->ri_whfast.eta[i-1] + r->particles[i].m;
+                    for (int i=1;i<r->N;i++){
+                        if (i<N_real){
+                            r->ri_whfast.eta[i] = r->ri_whfast.eta[i-1] + r->particles[i].m;
+                        }
                         r->ri_whfast.p_j[i].m = r->particles[i].m;
                     }
                 }
@@ -134,7 +359,7 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
                 struct reb_particle* ps = r->particles;
                 if (r->ri_whfasthelio.safe_mode==0){
                     // If same mode is off, store unsynchronized Heliocentric coordinates
-                    if (r->ri_whfasthelio.allocated_N<r->N){
+                    if ((int)r->ri_whfasthelio.allocated_N<r->N){
                         if (r->ri_whfasthelio.p_h){
                             free(r->ri_whfasthelio.p_h);
                         }
@@ -143,21 +368,13 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
                     }
                     ps = r->ri_whfasthelio.p_h;
                 }
-                for(int i=0;i<r->N;i++){
-                    fread(&(r->particles[i].m),sizeof(double),1,fd);
-                    fread(&(ps[i].x),sizeof(double),1,fd);
-                    fread(&(ps[i].y),sizeof(double),1,fd);
-                    fread(&(ps[i].z),sizeof(double),1,fd);
-                    fread(&(ps[i].vx),sizeof(double),1,fd);
-                    fread(&(ps[i].vy),sizeof(double),1,fd);
-                    fread(&(ps[i].vz),sizeof(double),1,fd);
-                }
+                reb_simulationarchive_get_particles(&buf, r->particles, ps, r->N);
                 if (r->ri_whfasthelio.safe_mode==0){
                     // Assume we are not synchronized
                     r->ri_whfasthelio.is_synchronized=0.;
                     // Recalculate Jacobi masses
                     r->ri_whfasthelio.p_h[0].m = r->particles[0].m;
-                    for (unsigned int i=1;i<r->N;i++){
+                    for (int i=1;i<r->N;i++){
                         r->ri_whfasthelio.p_h[0].m += r->particles[i].m;
                         r->ri_whfasthelio.p_h[i].m = r->particles[i].m;
                     }
@@ -166,38 +383,598 @@ int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename
             break;
         case REB_INTEGRATOR_IAS15:
             {
-                fread(&(r->dt),sizeof(double),1,fd);
-                fread(&(r->dt_last_done),sizeof(double),1,fd);
-                struct reb_particle* ps = r->particles;
-                for(int i=0;i<r->N;i++){
-                    fread(&(ps[i].m),sizeof(double),1,fd);
-                    fread(&(ps[i].x),sizeof(double),1,fd);
-                    fread(&(ps[i].y),sizeof(double),1,fd);
-                    fread(&(ps[i].z),sizeof(double),1,fd);
-                    fread(&(ps[i].vx),sizeof(double),1,fd);
-                    fread(&(ps[i].vy),sizeof(double),1,fd);
-                    fread(&(ps[i].vz),sizeof(double),1,fd);
-                }
+                reb_simulationarchive_get(&buf, &(r->dt), sizeof(double));
+                reb_simulationarchive_get(&buf, &(r->dt_last_done), sizeof(double));
+                reb_simulationarchive_get_particles(&buf, r->particles, r->particles, r->N);
                 reb_integrator_ias15_alloc(r);
                 const int N3 = r->N*3;
-                reb_read_dp7(&(r->ri_ias15.b)  ,N3,fd);
-                reb_read_dp7(&(r->ri_ias15.csb),N3,fd);
-                reb_read_dp7(&(r->ri_ias15.e)  ,N3,fd);
-                reb_read_dp7(&(r->ri_ias15.br) ,N3,fd);
-                reb_read_dp7(&(r->ri_ias15.er) ,N3,fd);
-                fread((r->ri_ias15.csx),sizeof(double)*N3,1,fd);
-                fread((r->ri_ias15.csv),sizeof(double)*N3,1,fd);
+                reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.b)  ,N3);
+                if (r->ri_ias15.lean){
+                    // csb is cleared at the beginning of every step, br and er are not used.
+                    reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.e)  ,N3);
+                }else{
+                    reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.csb),N3);
+                    reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.e)  ,N3);
+                    reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.br) ,N3);
+                    reb_simulationarchive_get_dp7(&buf, &(r->ri_ias15.er) ,N3);
+                }
+                reb_simulationarchive_get(&buf, r->ri_ias15.csx, sizeof(double)*N3);
+                reb_simulationarchive_get(&buf, r->ri_ias15.csv, sizeof(double)*N3);
+            }
+            break;
+        case REB_INTEGRATOR_LEAPFROG:
+        case REB_INTEGRATOR_SEI:
+            {
+                // Both are synchronized at the end of every timestep.
+                reb_simulationarchive_get_particles(&buf, r->particles, r->particles, r->N);
             }
             break;
         default:
             reb_error(r,"Simulation archive not implemented for this integrator.");
             break;
     }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_PARTICLES){
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_get(&buf, &(r->particles[i].hash), sizeof(uint32_t));
+        }
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_get(&buf, &(r->particles[i].r), sizeof(double));
+        }
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_COLLISIONS){
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_get(&buf, &(r->particles[i].lastcollision), sizeof(double));
+        }
+        reb_simulationarchive_get(&buf, &(r->collisions_plog), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->collisions_Nlog), sizeof(long));
+        reb_simulationarchive_get(&buf, &(r->collisions_seed), sizeof(uint32_t));
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_MEGNO){
+        reb_simulationarchive_get(&buf, &(r->megno_Ys), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_Yss), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_cov_Yt), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_var_t), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_mean_t), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_mean_Y), sizeof(double));
+        reb_simulationarchive_get(&buf, &(r->megno_n), sizeof(long));
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_TREE){
+        double* const cells = malloc(sizeof(double)*3*r->N);
+        reb_simulationarchive_get(&buf, cells, sizeof(double)*3*r->N);
+        reb_tree_build_from_cells(r, cells);
+        free(cells);
+    }else if (r->tree_root){
+        // The tree still sorts the particles of the initial binary file. 
+        reb_tree_build(r);
+    }
+}
+
+int reb_simulationarchive_load_snapshot(struct reb_simulation* r, char* filename, long snapshot){
+    if (access(filename, F_OK) == -1) return -1;
+    if (!r) return -2;
+    if (snapshot==0){
+        // load original binary file
+        enum reb_input_binary_messages warnings = 0;
+        reb_create_simulation_from_binary_with_messages(r,filename,&warnings);
+        if (warnings & REB_INPUT_BINARY_ERROR_NOFILE){
+            reb_error(r,"Cannot read binary file. Check filename and file contents.");
+        }
+        return 0;
+    }
+    
+    if (reb_simulationarchive_records(r)){
+        // Compressed snapshots have different sizes and delta snapshots depend 
+        // on the previous ones. Use the index of the memory mapped reader.
+        struct reb_simulationarchive_map* m = reb_create_simulationarchive_map(filename);
+        if (!m) return -3;
+        int ret = reb_simulationarchive_map_load_snapshot(r, m, snapshot);
+        reb_free_simulationarchive_map(m);
+        return ret;
+    }
+    FILE* fd = fopen(filename,"r");
+    int fseekret = 0;
+    if (snapshot<0){
+        // Find latest snapshot
+        fseekret = fseek(fd,-r->simulationarchive_size_snapshot,SEEK_END);
+    }else{
+        fseekret = fseek(fd,r->simulationarchive_size_first + (snapshot-1)*r->simulationarchive_size_snapshot,SEEK_SET);
+    }
+    if (fseekret){
+        // Seek didn't work.
+        fclose(fd);
+        return -3;
+    }
+    // Read the entire snapshot at once.
+    char* buf = malloc(r->simulationarchive_size_snapshot);
+    size_t objects = fread(buf,r->simulationarchive_size_snapshot,1,fd);
     fclose(fd);
+    if (objects!=1){
+        // Snapshot incomplete.
+        free(buf);
+        return -3;
+    }
+    reb_simulationarchive_restore(r, buf);
+    free(buf);
+    return 0;
+}
+
+// Creates a map of the snapshots in data, using the settings of r (created from
+// the initial binary file). The offsets of all snapshots other than the first one 
+// need to be set by the caller.
+static struct reb_simulationarchive_map* reb_simulationarchive_map_alloc(const struct reb_simulation* const r, const char* const data, const size_t size, const int fd, const char* const filename){
+    struct reb_simulationarchive_map* m = calloc(1, sizeof(struct reb_simulationarchive_map));
+    m->fd = fd;
+    m->data = data;
+    m->size = size;
+    m->size_first = r->simulationarchive_size_first;
+    m->size_snapshot = r->simulationarchive_size_snapshot;
+    m->N = r->N;
+    m->integrator = r->integrator;
+    m->compression = reb_simulationarchive_records(r);
+    m->keyframe_interval = r->simulationarchive_keyframe_interval;
+    m->buffer_snapshot = -1;
+    m->filename = strdup(filename);
+    if (m->compression){
+        m->buffer = malloc(m->size_snapshot);
+        m->scratch = malloc(m->size_snapshot);
+    }
+    return m;
+}
+
+// Builds the time index once the offsets are known.
+static void reb_simulationarchive_map_index_times(struct reb_simulationarchive_map* const m, const double t0){
+    m->t = malloc(sizeof(double)*m->N_snapshots);
+    m->walltime = malloc(sizeof(double)*m->N_snapshots);
+    m->t[0] = t0;
+    m->walltime[0] = 0.;
+    for (long i=1;i<m->N_snapshots;i++){
+        memcpy(&m->t[i], m->data+m->offset[i], sizeof(double));
+        memcpy(&m->walltime[i], m->data+m->offset[i]+sizeof(double), sizeof(double));
+    }
+}
+
+struct reb_simulationarchive_map* reb_create_simulationarchive_map(const char* filename){
+    struct reb_simulation* r = reb_create_simulation_from_binary((char*)filename);
+    if (!r) return NULL;
+    if (r->simulationarchive_size_snapshot<=0 || reb_simulationarchive_zlib_missing(r)){
+        reb_free_simulation(r);
+        return NULL;
+    }
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd<0 || fstat(fd, &st) || st.st_size<r->simulationarchive_size_first){
+        if (fd>=0) close(fd);
+        reb_free_simulation(r);
+        return NULL;
+    }
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data==MAP_FAILED){
+        close(fd);
+        reb_free_simulation(r);
+        return NULL;
+    }
+    struct reb_simulationarchive_map* m = reb_simulationarchive_map_alloc(r, data, st.st_size, fd, filename);
+    m->keyframe = malloc(sizeof(char));
+    m->keyframe[0] = 1;
+    if (m->compression){
+        // Walk through the records once. An incomplete record at the end is ignored.
+        long allocated = 16;
+        m->offset = malloc(sizeof(long)*allocated);
+        m->keyframe = realloc(m->keyframe, sizeof(char)*allocated);
+        m->offset[0] = 0;
+        m->N_snapshots = 1;
+        long offset = m->size_first;
+        while (offset+(long)(REB_SA_RECORD_HEADER+REB_SA_RECORD_TRAILER)<=(long)m->size){
+            int64_t record_size;
+            memcpy(&record_size, data+offset, sizeof(int64_t));
+            if (record_size<(int64_t)(REB_SA_RECORD_HEADER+REB_SA_RECORD_TRAILER) || offset+record_size>(long)m->size) break;
+            if (m->N_snapshots==allocated){
+                allocated *= 2;
+                m->offset = realloc(m->offset, sizeof(long)*allocated);
+                m->keyframe = realloc(m->keyframe, sizeof(char)*allocated);
+            }
+            m->keyframe[m->N_snapshots] = !reb_simulationarchive_record_is_delta(data+offset, m->keyframe_interval);
+            m->offset[m->N_snapshots++] = offset+sizeof(int64_t);
+            offset += record_size;
+        }
+    }else{
+        m->N_snapshots = (st.st_size-m->size_first)/m->size_snapshot+1;
+        m->offset = malloc(sizeof(long)*m->N_snapshots);
+        m->keyframe = realloc(m->keyframe, sizeof(char)*m->N_snapshots);
+        m->offset[0] = 0;
+        for (long i=1;i<m->N_snapshots;i++){
+            m->offset[i] = m->size_first + (i-1)*m->size_snapshot;
+            m->keyframe[i] = 1;
+        }
+    }
+    // Time index, built in one pass over the snapshots.
+    reb_simulationarchive_map_index_times(m, r->t);
+    reb_free_simulation(r);
+    return m;
+}
+
+void reb_free_simulationarchive_map(struct reb_simulationarchive_map* const m){
+    if (!m) return;
+    if (m->fd>=0){
+        munmap((void*)m->data, m->size);
+        close(m->fd);
+    }
+    free(m->offset);
+    free(m->keyframe);
+    free(m->t);
+    free(m->walltime);
+    free(m->buffer);
+    free(m->scratch);
+    free(m->filename);
+    free(m);
+}
+
+long reb_simulationarchive_map_find(struct reb_simulationarchive_map* const m, const double t){
+    // Bisection. Returns the last snapshot with m->t[i]<=t.
+    long l = 0;
+    long u = m->N_snapshots;
+    while (u-l>1){
+        const long i = l+(u-l)/2;
+        if (m->t[i]>t){
+            u = i;
+        }else{
+            l = i;
+        }
+    }
+    return l;
+}
+
+// Returns a pointer to the serialized snapshot. Compressed snapshots are 
+// decompressed into buffer (m->size_snapshot bytes, scratch has the same size). 
+// Delta snapshots are reconstructed starting from the last keyframe, or from 
+// the snapshot currently in buffer (*buffer_snapshot) if that is closer. 
+// Returns NULL on failure. Only reads from m, so that several threads can
+// decode snapshots at the same time, each with its own buffers.
+static const char* reb_simulationarchive_map_decode(const struct reb_simulationarchive_map* const m, const long snapshot, char* const buffer, char* const scratch, long* const buffer_snapshot){
+    if (snapshot<1 || snapshot>=m->N_snapshots) return NULL;
+    if (m->compression){
+        if (*buffer_snapshot==snapshot) return buffer;
+        long start = snapshot;
+        while (!m->keyframe[start] && start>1 && start-1!=*buffer_snapshot){
+            start--;
+        }
+        if (!m->keyframe[start]){
+            if (start-1!=*buffer_snapshot){
+                // First record is a delta. File is corrupt.
+                return NULL;
+            }
+        }
+        *buffer_snapshot = -1;
+        for (long i=start;i<=snapshot;i++){
+            const char* record = m->data+m->offset[i]-sizeof(int64_t);
+            int64_t record_size;
+            memcpy(&record_size, record, sizeof(int64_t));
+            if (reb_simulationarchive_decode(buffer, m->size_snapshot, record, record_size, scratch, m->keyframe_interval)){
+                return NULL;
+            }
+        }
+        *buffer_snapshot = snapshot;
+        return buffer;
+    }
+    return m->data+m->offset[snapshot];
+}
+
+static const char* reb_simulationarchive_map_snapshot(struct reb_simulationarchive_map* const m, const long snapshot){
+    return reb_simulationarchive_map_decode(m, snapshot, m->buffer, m->scratch, &m->buffer_snapshot);
+}
 
+const void* reb_simulationarchive_map_particles(struct reb_simulationarchive_map* const m, const long snapshot){
+    switch (m->integrator){
+        case REB_INTEGRATOR_WHFAST:
+        case REB_INTEGRATOR_WHFASTHELIO:
+        case REB_INTEGRATOR_IAS15:
+        case REB_INTEGRATOR_LEAPFROG:
+        case REB_INTEGRATOR_SEI:
+            break;
+        default:
+            return NULL;
+    }
+    const char* data = reb_simulationarchive_map_snapshot(m, snapshot);
+    if (!data) return NULL;
+    data += 2*sizeof(double); // t, walltime
+    if (m->integrator==REB_INTEGRATOR_IAS15){
+        data += 2*sizeof(double); // dt, dt_last_done
+    }
+    return data;
+}
+
+// Loads the initial binary file from the map into r.
+static int reb_simulationarchive_map_load_binary(struct reb_simulation* const r, const struct reb_simulationarchive_map* const m){
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    reb_create_simulation_from_binary_buffer_with_messages(r, m->data+m->offset[0], m->size_first, &warnings);
+    if (warnings & REB_INPUT_BINARY_ERROR_NOFILE){
+        reb_error(r,"Cannot read binary file. Check filename and file contents.");
+        return -3;
+    }
     return 0;
 }
 
+int reb_simulationarchive_map_load_snapshot(struct reb_simulation* const r, struct reb_simulationarchive_map* const m, long snapshot){
+    if (!r) return -2;
+    if (snapshot<0){
+        snapshot += m->N_snapshots;
+    }
+    if (snapshot==0){
+        return reb_simulationarchive_map_load_binary(r, m);
+    }
+    if (snapshot<1 || snapshot>=m->N_snapshots || r->N!=m->N || r->simulationarchive_size_snapshot!=m->size_snapshot){
+        return -3;
+    }
+    const char* data = reb_simulationarchive_map_snapshot(m, snapshot);
+    if (!data) return -3;
+    reb_simulationarchive_restore(r, data);
+    return 0;
+}
+
+// Writes the synchronized particle data of r into row i of the output arrays.
+static void reb_simulationarchive_map_extract_row(struct reb_simulation* const r, const long i, double* const t, double (*xyz)[3], double (*vxvyvz)[3], double (*orbits)[6]){
+    const int N = r->N;
+    const struct reb_particle* const ps = r->particles;
+    if (t){
+        t[i] = r->t;
+    }
+    if (xyz){
+        for (int j=0;j<N;j++){
+            xyz[i*N+j][0] = ps[j].x;
+            xyz[i*N+j][1] = ps[j].y;
+            xyz[i*N+j][2] = ps[j].z;
+        }
+    }
+    if (vxvyvz){
+        for (int j=0;j<N;j++){
+            vxvyvz[i*N+j][0] = ps[j].vx;
+            vxvyvz[i*N+j][1] = ps[j].vy;
+            vxvyvz[i*N+j][2] = ps[j].vz;
+        }
+    }
+    if (orbits){
+        // Jacobi coordinates, same as the default of Simulation.calculate_orbits() in python.
+        const int N_real = N-r->N_var;
+        struct reb_particle com = ps[0];
+        for (int j=1;j<N_real;j++){
+            const struct reb_orbit o = reb_tools_particle_to_orbit(r->G, ps[j], com);
+            double* const row = orbits[i*(N-1)+j-1];
+            row[0] = o.a;
+            row[1] = o.e;
+            row[2] = o.inc;
+            row[3] = o.Omega;
+            row[4] = o.omega;
+            row[5] = o.f;
+            com = reb_get_com_of_pair(com, ps[j]);
+        }
+    }
+}
+
+int reb_simulationarchive_map_extract(struct reb_simulationarchive_map* const m, const long* const snapshots, const long N_snapshots, double* const t, double (*xyz)[3], double (*vxvyvz)[3], double (*orbits)[6]){
+    int error = 0;
+#pragma omp parallel
+    {
+    // Every thread decodes snapshots into its own simulation and buffers.
+    struct reb_simulation* r = reb_create_simulation();
+    if (reb_simulationarchive_map_load_binary(r, m)){
+        reb_free_simulation(r);
+        r = NULL;
+    }
+    char* const buffer = m->compression?malloc(m->size_snapshot):NULL;
+    char* const scratch = m->compression?malloc(m->size_snapshot):NULL;
+    long buffer_snapshot = -1;
+    if (!r || r->N!=m->N || r->simulationarchive_size_snapshot!=m->size_snapshot){
+#pragma omp atomic write
+        error = -1;
+    }
+    // Contiguous chunks, so that sorted snapshots are decoded in order.
+#pragma omp for schedule(static)
+    for (long i=0;i<N_snapshots;i++){
+        if (error) continue;
+        long snapshot = snapshots[i];
+        if (snapshot<0){
+            snapshot += m->N_snapshots;
+        }
+        if (snapshot<0 || snapshot>=m->N_snapshots){
+#pragma omp atomic write
+            error = -3;
+            continue;
+        }
+        if (snapshot==0){
+            reb_free_simulation(r);
+            r = reb_create_simulation();
+            reb_simulationarchive_map_load_binary(r, m);
+            buffer_snapshot = -1;
+        }else{
+            const char* data = reb_simulationarchive_map_decode(m, snapshot, buffer, scratch, &buffer_snapshot);
+            if (!data){
+#pragma omp atomic write
+                error = -3;
+                continue;
+            }
+            reb_simulationarchive_restore(r, data);
+        }
+        r->ri_whfast.keep_unsynchronized = 0;
+        r->ri_whfasthelio.keep_unsynchronized = 0;
+        reb_integrator_synchronize(r);
+        reb_simulationarchive_map_extract_row(r, i, t, xyz, vxvyvz, orbits);
+    }
+    free(buffer);
+    free(scratch);
+    if (r){
+        reb_free_simulation(r);
+    }
+    }
+    return error;
+}
+
+struct reb_simulationarchive_container* reb_create_simulationarchive_container(const char* filename){
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd<0 || fstat(fd, &st)){
+        if (fd>=0) close(fd);
+        return NULL;
+    }
+    const char* data = NULL;
+    if (st.st_size>0){
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data==MAP_FAILED){
+            close(fd);
+            return NULL;
+        }
+    }
+    struct reb_simulationarchive_container* c = calloc(1, sizeof(struct reb_simulationarchive_container));
+    c->fd = fd;
+    c->data = data;
+    c->size = st.st_size;
+    c->filename = strdup(filename);
+
+    // First pass over the record headers: number of records of every member, 
+    // starting with its last initial binary file. An incomplete record at the end is ignored.
+    const size_t header = sizeof(struct reb_simulationarchive_container_record);
+    long allocated = 0;
+    long* count = NULL;
+    long* first = NULL; // Offset of the last initial binary file of every member, -1 if none
+    size_t offset = 0;
+    while (offset+header<=c->size){
+        struct reb_simulationarchive_container_record h;
+        memcpy(&h, data+offset, header);
+        if (h.member<0 || h.size<0 || (h.type!=0 && h.type!=1) || (uint64_t)h.size>c->size-offset-header) break;
+        if (h.member>=c->N_members){
+            if (h.member>=allocated){
+                const long allocated_new = h.member+1>2*allocated?h.member+1:2*allocated;
+                count = realloc(count, sizeof(long)*allocated_new);
+                first = realloc(first, sizeof(long)*allocated_new);
+                allocated = allocated_new;
+            }
+            for (long k=c->N_members;k<=h.member;k++){
+                count[k] = 0;
+                first[k] = -1;
+            }
+            c->N_members = h.member+1;
+        }
+        if (h.type==0){
+            first[h.member] = offset;
+            count[h.member] = 1;
+        }else if (first[h.member]>=0){
+            count[h.member]++;
+        }
+        offset += header+h.size;
+    }
+    const size_t end = offset;
+    c->start = malloc(sizeof(long)*(c->N_members+1));
+    c->start[0] = 0;
+    for (long k=0;k<c->N_members;k++){
+        c->start[k+1] = c->start[k]+count[k];
+        count[k] = 0;
+    }
+    // Second pass: offsets of the records, grouped by member.
+    c->records = malloc(sizeof(long)*(c->start[c->N_members]>0?c->start[c->N_members]:1));
+    offset = 0;
+    while (offset<end){
+        struct reb_simulationarchive_container_record h;
+        memcpy(&h, data+offset, header);
+        if (first[h.member]>=0 && (long)offset>=first[h.member]){
+            c->records[c->start[h.member]+count[h.member]++] = offset;
+        }
+        offset += header+h.size;
+    }
+    c->maps = calloc(c->N_members>0?c->N_members:1, sizeof(struct reb_simulationarchive_map*));
+    free(count);
+    free(first);
+    return c;
+}
+
+void reb_free_simulationarchive_container(struct reb_simulationarchive_container* const c){
+    if (!c) return;
+    for (long k=0;k<c->N_members;k++){
+        reb_free_simulationarchive_map(c->maps[k]);
+    }
+    free(c->maps);
+    free(c->start);
+    free(c->records);
+    if (c->data){
+        munmap((void*)c->data, c->size);
+    }
+    close(c->fd);
+    free(c->filename);
+    free(c);
+}
+
+struct reb_simulationarchive_map* reb_simulationarchive_container_map(struct reb_simulationarchive_container* const c, const long member){
+    if (member<0 || member>=c->N_members || c->start[member]==c->start[member+1]){
+        return NULL;
+    }
+    if (c->maps[member]){
+        return c->maps[member];
+    }
+    const long* const records = c->records + c->start[member];
+    const long N_records = c->start[member+1]-c->start[member];
+    const size_t header = sizeof(struct reb_simulationarchive_container_record);
+    struct reb_simulationarchive_container_record h;
+    memcpy(&h, c->data+records[0], header);
+    struct reb_simulation* r = reb_create_simulation();
+    enum reb_input_binary_messages warnings = REB_INPUT_BINARY_WARNING_NONE;
+    reb_create_simulation_from_binary_buffer_with_messages(r, c->data+records[0]+header, h.size, &warnings);
+    if ((warnings & REB_INPUT_BINARY_ERROR_NOFILE) || r->simulationarchive_size_snapshot<=0 || reb_simulationarchive_zlib_missing(r)){
+        reb_free_simulation(r);
+        return NULL;
+    }
+    // The map shares the memory mapped file with the container.
+    struct reb_simulationarchive_map* m = reb_simulationarchive_map_alloc(r, c->data, c->size, -1, c->filename);
+    m->size_first = h.size;
+    m->offset = malloc(sizeof(long)*N_records);
+    m->keyframe = malloc(sizeof(char)*N_records);
+    m->offset[0] = records[0]+header;
+    m->keyframe[0] = 1;
+    m->N_snapshots = 1;
+    for (long i=1;i<N_records;i++){
+        memcpy(&h, c->data+records[i], header);
+        const char* const record = c->data+records[i]+header;
+        if (m->compression){
+            int64_t record_size;
+            if (h.size<(int64_t)(REB_SA_RECORD_HEADER+REB_SA_RECORD_TRAILER)) break;
+            memcpy(&record_size, record, sizeof(int64_t));
+            if (record_size!=h.size) break;
+            m->keyframe[i] = !reb_simulationarchive_record_is_delta(record, m->keyframe_interval);
+            m->offset[i] = records[i]+header+sizeof(int64_t);
+        }else{
+            if (h.size!=m->size_snapshot) break;
+            m->keyframe[i] = 1;
+            m->offset[i] = records[i]+header;
+        }
+        m->N_snapshots++;
+    }
+    reb_simulationarchive_map_index_times(m, r->t);
+    reb_free_simulation(r);
+    c->maps[member] = m;
+    return m;
+}
+
+int reb_simulationarchive_container_load_snapshot(struct reb_simulation* const r, struct reb_simulationarchive_container* const c, const long member, long snapshot){
+    if (!r) return -2;
+    struct reb_simulationarchive_map* const m = reb_simulationarchive_container_map(c, member);
+    if (!m) return -1;
+    if (snapshot<0){
+        snapshot += m->N_snapshots;
+    }
+    if (snapshot<0 || snapshot>=m->N_snapshots) return -3;
+    if (reb_simulationarchive_map_load_snapshot(r, m, 0)) return -3;
+    if (snapshot>0){
+        return reb_simulationarchive_map_load_snapshot(r, m, snapshot);
+    }
+    return 0;
+}
+
+struct reb_simulation* reb_create_simulation_from_simulationarchive_container(struct reb_simulationarchive_container* const c, const long member, const long snapshot){
+    struct reb_simulation* r = reb_create_simulation();
+    if (reb_simulationarchive_container_load_snapshot(r, c, member, snapshot)){
+        reb_free_simulation(r);
+        return NULL;
+    }
+    return r;
+}
+
 static int reb_simulationarchive_snapshotsize(struct reb_simulation* const r){
     int size_snapshot = 0;
     switch (r->integrator){
@@ -206,51 +983,66 @@ static int reb_simulationarchive_snapshotsize(struct reb_simulation* const r){
             break;
         case REB_INTEGRATOR_WHFAST:
         case REB_INTEGRATOR_WHFASTHELIO:
+        case REB_INTEGRATOR_LEAPFROG:
+        case REB_INTEGRATOR_SEI:
             size_snapshot = sizeof(double)*2+sizeof(double)*7*r->N;
             break;
         case REB_INTEGRATOR_IAS15:
             size_snapshot =  sizeof(double)*4  // time, walltime, dt, dt_last_done
-                             +sizeof(double)*3*r->N*5*7  // dp7 arrays
+                             +sizeof(double)*3*r->N*(r->ri_ias15.lean?2:5)*7  // dp7 arrays (b, e and if not lean csb, br, er)
                              +sizeof(double)*7*r->N      // particle m, pos, vel
                              +sizeof(double)*3*r->N*2;   // csx, csv
             break;
         default:
             reb_error(r,"Simulation archive not implemented for this integrator.");
-            break;
+            return 0;
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_PARTICLES){
+        size_snapshot += (sizeof(uint32_t)+sizeof(double))*r->N;
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_COLLISIONS){
+        size_snapshot += sizeof(double)*r->N+sizeof(double)+sizeof(long)+sizeof(uint32_t);
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_MEGNO){
+        size_snapshot += sizeof(double)*6+sizeof(long);
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_TREE){
+        size_snapshot += sizeof(double)*3*r->N;
     }
     return size_snapshot;
 }
 
-long reb_simulationarchive_estimate_size(struct reb_simulation* const r, double tmax){
-    if (r->simulationarchive_interval){
-        long blobsize = reb_simulationarchive_snapshotsize(r);
-        return blobsize*(long)ceil((tmax-r->t)/r->simulationarchive_interval);
-    }else{
-        reb_warning(r, "Variable simulationarchive_interval not set. Cannot estimate filesize.");
-        return 0;
-    }
+// Serializes data into the snapshot buffer.
+static inline void reb_simulationarchive_put(char** const buf, const void* const data, const size_t size){
+    memcpy(*buf, data, size);
+    *buf += size;
 }
 
-struct reb_simulation* reb_create_simulation_from_simulationarchive(char* filename){
-    if (access(filename, F_OK) == -1) return NULL;
-    struct reb_simulation* r = reb_create_simulation_from_binary(filename);
-    if (r){
-        int ret = reb_simulationarchive_load_snapshot(r, filename, -1);
-        if (ret){
-            reb_warning(r,"Did not find any snapshots other than the initial one.");
-        }
+static void reb_simulationarchive_put_dp7(char** const buf, struct reb_dp7* const dp7, const int N3){
+    reb_simulationarchive_put(buf, dp7->p0, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p1, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p2, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p3, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p4, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p5, sizeof(double)*N3);
+    reb_simulationarchive_put(buf, dp7->p6, sizeof(double)*N3);
+}
+
+static void reb_simulationarchive_put_particles(char** const buf, struct reb_particle* const masses, struct reb_particle* const ps, const int N){
+    for(int i=0;i<N;i++){
+        const double data[7] = {masses[i].m, ps[i].x, ps[i].y, ps[i].z, ps[i].vx, ps[i].vy, ps[i].vz};
+        reb_simulationarchive_put(buf, data, sizeof(double)*7);
     }
-    return r;
 }
 
-static void reb_simulationarchive_append(struct reb_simulation* r){
-    FILE* of = fopen(r->simulationarchive_filename,"a");
-    fwrite(&(r->t),sizeof(double),1, of);
-    fwrite(&(r->simulationarchive_walltime),sizeof(double),1, of);
+// Serializes the current state into buf (reb_simulationarchive_snapshotsize() bytes).
+static void reb_simulationarchive_serialize(struct reb_simulation* const r, char* buf){
+    reb_simulationarchive_put(&buf, &(r->t), sizeof(double));
+    reb_simulationarchive_put(&buf, &(r->simulationarchive_walltime), sizeof(double));
     switch (r->integrator){
         case REB_INTEGRATOR_JANUS:
             {
-                fwrite(r->ri_janus.p_int,sizeof(struct reb_particle_int)*r->N,1,of);
+                reb_simulationarchive_put(&buf, r->ri_janus.p_int, sizeof(struct reb_particle_int)*r->N);
             }
             break;
         case REB_INTEGRATOR_WHFASTHELIO:
@@ -259,15 +1051,7 @@ static void reb_simulationarchive_append(struct reb_simulation* r){
                 if (r->ri_whfasthelio.safe_mode==0){
                     ps = r->ri_whfasthelio.p_h;
                 }
-                for(int i=0;i<r->N;i++){
-                    fwrite(&(r->particles[i].m),sizeof(double),1,of);
-                    fwrite(&(ps[i].x),sizeof(double),1,of);
-                    fwrite(&(ps[i].y),sizeof(double),1,of);
-                    fwrite(&(ps[i].z),sizeof(double),1,of);
-                    fwrite(&(ps[i].vx),sizeof(double),1,of);
-                    fwrite(&(ps[i].vy),sizeof(double),1,of);
-                    fwrite(&(ps[i].vz),sizeof(double),1,of);
-                }
+                reb_simulationarchive_put_particles(&buf, r->particles, ps, r->N);
             }
             break;
         case REB_INTEGRATOR_WHFAST:
@@ -276,64 +1060,438 @@ static void reb_simulationarchive_append(struct reb_simulation* r){
                 if (r->ri_whfast.safe_mode==0){
                     ps = r->ri_whfast.p_j;
                 }
-                for(int i=0;i<r->N;i++){
-                    fwrite(&(r->particles[i].m),sizeof(double),1,of);
-                    fwrite(&(ps[i].x),sizeof(double),1,of);
-                    fwrite(&(ps[i].y),sizeof(double),1,of);
-                    fwrite(&(ps[i].z),sizeof(double),1,of);
-                    fwrite(&(ps[i].vx),sizeof(double),1,of);
-                    fwrite(&(ps[i].vy),sizeof(double),1,of);
-                    fwrite(&(ps[i].vz),sizeof(double),1,of);
-                }
+                reb_simulationarchive_put_particles(&buf, r->particles, ps, r->N);
             }
             break;
         case REB_INTEGRATOR_IAS15:
             {
-                fwrite(&(r->dt),sizeof(double),1,of);
-                fwrite(&(r->dt_last_done),sizeof(double),1,of);
-                struct reb_particle* ps = r->particles;
+                reb_simulationarchive_put(&buf, &(r->dt), sizeof(double));
+                reb_simulationarchive_put(&buf, &(r->dt_last_done), sizeof(double));
                 const int N3 = r->N*3;
-                for(int i=0;i<r->N;i++){
-                    fwrite(&(ps[i].m),sizeof(double),1,of);
-                    fwrite(&(ps[i].x),sizeof(double),1,of);
-                    fwrite(&(ps[i].y),sizeof(double),1,of);
-                    fwrite(&(ps[i].z),sizeof(double),1,of);
-                    fwrite(&(ps[i].vx),sizeof(double),1,of);
-                    fwrite(&(ps[i].vy),sizeof(double),1,of);
-                    fwrite(&(ps[i].vz),sizeof(double),1,of);
+                reb_simulationarchive_put_particles(&buf, r->particles, r->particles, r->N);
+                reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.b)  ,N3);
+                if (r->ri_ias15.lean){
+                    reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.e)  ,N3);
+                }else{
+                    reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.csb),N3);
+                    reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.e)  ,N3);
+                    reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.br) ,N3);
+                    reb_simulationarchive_put_dp7(&buf, &(r->ri_ias15.er) ,N3);
                 }
-                reb_save_dp7(&(r->ri_ias15.b)  ,N3,of);
-                reb_save_dp7(&(r->ri_ias15.csb),N3,of);
-                reb_save_dp7(&(r->ri_ias15.e)  ,N3,of);
-                reb_save_dp7(&(r->ri_ias15.br) ,N3,of);
-                reb_save_dp7(&(r->ri_ias15.er) ,N3,of);
-                fwrite((r->ri_ias15.csx),sizeof(double)*N3,1,of);
-                fwrite((r->ri_ias15.csv),sizeof(double)*N3,1,of);
+                reb_simulationarchive_put(&buf, r->ri_ias15.csx, sizeof(double)*N3);
+                reb_simulationarchive_put(&buf, r->ri_ias15.csv, sizeof(double)*N3);
+            }
+            break;
+        case REB_INTEGRATOR_LEAPFROG:
+        case REB_INTEGRATOR_SEI:
+            {
+                reb_simulationarchive_put_particles(&buf, r->particles, r->particles, r->N);
             }
             break;
         default:
-            reb_error(r,"Simulation archive not implemented for this integrator.");
             break;
     }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_PARTICLES){
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_put(&buf, &(r->particles[i].hash), sizeof(uint32_t));
+        }
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_put(&buf, &(r->particles[i].r), sizeof(double));
+        }
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_COLLISIONS){
+        for (int i=0;i<r->N;i++){
+            reb_simulationarchive_put(&buf, &(r->particles[i].lastcollision), sizeof(double));
+        }
+        reb_simulationarchive_put(&buf, &(r->collisions_plog), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->collisions_Nlog), sizeof(long));
+        reb_simulationarchive_put(&buf, &(r->collisions_seed), sizeof(uint32_t));
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_MEGNO){
+        reb_simulationarchive_put(&buf, &(r->megno_Ys), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_Yss), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_cov_Yt), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_var_t), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_mean_t), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_mean_Y), sizeof(double));
+        reb_simulationarchive_put(&buf, &(r->megno_n), sizeof(long));
+    }
+    if (r->simulationarchive_extras & REB_SA_EXTRA_TREE){
+        double* const cells = malloc(sizeof(double)*3*r->N);
+        reb_tree_get_cells(r, cells);
+        reb_simulationarchive_put(&buf, cells, sizeof(double)*3*r->N);
+        free(cells);
+    }
+}
+
+long reb_simulationarchive_estimate_size(struct reb_simulation* const r, double tmax){
+    if (r->simulationarchive_interval){
+        if (r->simulationarchive_walltime==0){
+            // Before the first output. Set again in reb_simulationarchive_heartbeat().
+            r->simulationarchive_extras = reb_simulationarchive_extras(r);
+        }
+        long blobsize = reb_simulationarchive_snapshotsize(r);
+        if (blobsize && reb_simulationarchive_records(r)){
+            if (reb_simulationarchive_zlib_missing(r)){
+                return 0;
+            }
+            // Size of the current state as a compressed keyframe. This is an upper
+            // bound for delta snapshots. If the integrator has not been initialized
+            // yet, use the size of an uncompressed record.
+            int initialized = 1;
+            switch (r->integrator){
+                case REB_INTEGRATOR_JANUS:
+                    initialized = (int)r->ri_janus.allocated_N==r->N;
+                    break;
+                case REB_INTEGRATOR_WHFAST:
+                    initialized = r->ri_whfast.safe_mode || (int)r->ri_whfast.allocated_N>=r->N;
+                    break;
+                case REB_INTEGRATOR_WHFASTHELIO:
+                    initialized = r->ri_whfasthelio.safe_mode || (int)r->ri_whfasthelio.allocated_N>=r->N;
+                    break;
+                case REB_INTEGRATOR_IAS15:
+                    initialized = r->ri_ias15.allocatedN>=3*r->N;
+                    break;
+                default:
+                    break;
+            }
+            if (!initialized){
+                return (blobsize+REB_SA_RECORD_HEADER+REB_SA_RECORD_TRAILER)*(long)ceil((tmax-r->t)/r->simulationarchive_interval);
+            }
+            char* buf = malloc(blobsize);
+            reb_simulationarchive_serialize(r, buf);
+            struct reb_simulationarchive_encoder e = {0};
+            blobsize = reb_simulationarchive_encode(&e, buf, blobsize, r->simulationarchive_keyframe_interval);
+            reb_simulationarchive_encoder_free(&e);
+            free(buf);
+        }
+        return blobsize*(long)ceil((tmax-r->t)/r->simulationarchive_interval);
+    }else{
+        reb_warning(r, "Variable simulationarchive_interval not set. Cannot estimate filesize.");
+        return 0;
+    }
+}
+
+struct reb_simulation* reb_create_simulation_from_simulationarchive(char* filename){
+    if (access(filename, F_OK) == -1) return NULL;
+    struct reb_simulation* r = reb_create_simulation_from_binary(filename);
+    if (r){
+        int ret = reb_simulationarchive_load_snapshot(r, filename, -1);
+        if (ret){
+            reb_warning(r,"Did not find any snapshots other than the initial one.");
+        }
+    }
+    return r;
+}
+
+// Writes size bytes with as few write calls as possible. Retries if the 
+// write was interrupted or is partial. Returns 0 on success.
+static int reb_simulationarchive_write(const int fd, const char* data, size_t size){
+    while (size){
+        ssize_t written = write(fd, data, size);
+        if (written<0){
+            if (errno==EINTR) continue;
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// Writes a snapshot (type 1) or the initial binary file (type 0). For a 
+// SimulationArchive container (member>=0) the record header and the data are 
+// written with a single call. The file is opened with O_APPEND, so records of 
+// simulations appending to the same container at the same time do not interleave.
+// Returns 0 on success.
+static int reb_simulationarchive_write_record(const int fd, const long member, const int64_t type, const char* data, const size_t size){
+    if (member<0){
+        return reb_simulationarchive_write(fd, data, size);
+    }
+    const struct reb_simulationarchive_container_record header = {.member = member, .type = type, .size = size};
+    struct iovec iov[2] = {{.iov_base = (void*)&header, .iov_len = sizeof(header)}, {.iov_base = (void*)data, .iov_len = size}};
+    ssize_t written;
+    do {
+        written = writev(fd, iov, 2);
+    } while (written<0 && errno==EINTR);
+    if (written<0) return -1;
+    // Partial writes only happen if the disk is full or on a signal. Complete the record.
+    if ((size_t)written<sizeof(header)){
+        if (reb_simulationarchive_write(fd, (const char*)&header+written, sizeof(header)-written)) return -1;
+        written = sizeof(header);
+    }
+    return reb_simulationarchive_write(fd, data+(written-sizeof(header)), size-(written-sizeof(header)));
+}
+
+// Size of a record on disk, including the header for containers.
+static size_t reb_simulationarchive_record_size(const long member, const size_t size){
+    return size + (member>=0?sizeof(struct reb_simulationarchive_container_record):0);
+}
+
+/**
+ * @brief Background writer used if r->simulationarchive_async is set.
+ * @details Snapshots are double buffered. The integrator serializes a snapshot 
+ * into r->simulationarchive_buffer and swaps it with the (empty) buffer of the 
+ * writer. If the writer is still busy with the previous snapshot, the integrator
+ * waits (back-pressure), so at most one snapshot is in flight.
+ */
+struct reb_simulationarchive_writer {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int fd;                 ///< File descriptor (owned by the simulation)
+    char* buffer;           ///< Snapshot being written
+    size_t allocated;       ///< Space allocated in buffer
+    size_t size;            ///< Size of the snapshot in buffer
+    int fsync;              ///< Call fsync after writing the snapshot
+    int compression;        ///< Compress the snapshot before writing it
+    unsigned int keyframe_interval; ///< Keyframe interval used to compress the snapshot
+    long member;            ///< Member of a SimulationArchive container, -1 for a file of its own
+    struct reb_simulationarchive_encoder encoder; ///< Scratch space for compression
+    int pending;            ///< 1 while a snapshot is waiting to be or being written
+    int quit;               ///< Set to 1 to stop the thread once all snapshots are written
+    int error;              ///< Set to 1 if a write failed. Reported by the integrator thread.
+    uint64_t* bytes;        ///< Bytes written are added to r->metrics.simulationarchive_bytes
+};
+
+static void* reb_simulationarchive_writer_thread(void* args){
+    struct reb_simulationarchive_writer* const w = args;
+    pthread_mutex_lock(&w->mutex);
+    while (1){
+        while (!w->pending && !w->quit){
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        if (!w->pending) break; // quit
+        pthread_mutex_unlock(&w->mutex);
+        int error = 0;
+        size_t size = w->size;
+        if (w->compression){
+            size = reb_simulationarchive_encode(&w->encoder, w->buffer, w->size, w->keyframe_interval);
+            error = size ? reb_simulationarchive_write_record(w->fd, w->member, 1, w->encoder.record, size) : -1;
+        }else{
+            error = reb_simulationarchive_write_record(w->fd, w->member, 1, w->buffer, size);
+        }
+        if (!error){
+            __atomic_fetch_add(w->bytes, reb_simulationarchive_record_size(w->member, size), __ATOMIC_RELAXED);
+        }
+        if (w->fsync){
+            fsync(w->fd);
+        }
+        pthread_mutex_lock(&w->mutex);
+        w->error |= error;
+        w->pending = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+// Waits until the writer is idle. Must be called with the mutex locked.
+static void reb_simulationarchive_writer_wait(struct reb_simulation* const r, struct reb_simulationarchive_writer* const w){
+    while (w->pending){
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    if (w->error){
+        reb_error(r,"Error while writing to Simulation Archive file.");
+        w->error = 0;
+    }
+}
+
+void reb_simulationarchive_flush(struct reb_simulation* const r){
+    struct reb_simulationarchive_writer* const w = r->simulationarchive_writer;
+    if (w){
+        pthread_mutex_lock(&w->mutex);
+        reb_simulationarchive_writer_wait(r, w);
+        pthread_mutex_unlock(&w->mutex);
+    }
+}
+
+static void reb_simulationarchive_writer_stop(struct reb_simulation* const r){
+    struct reb_simulationarchive_writer* const w = r->simulationarchive_writer;
+    if (w){
+        pthread_mutex_lock(&w->mutex);
+        reb_simulationarchive_writer_wait(r, w);
+        w->quit = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+        free(w->buffer);
+        reb_simulationarchive_encoder_free(&w->encoder);
+        free(w);
+        r->simulationarchive_writer = NULL;
+        if (r->simulationarchive_encoder){
+            // The last snapshot was not written by this encoder. 
+            r->simulationarchive_encoder->has_previous = 0;
+        }
+    }
+}
+
+static void reb_simulationarchive_writer_start(struct reb_simulation* const r){
+    struct reb_simulationarchive_writer* const w = calloc(1, sizeof(struct reb_simulationarchive_writer));
+    w->fd = r->simulationarchive_fd;
+    w->bytes = &r->metrics.simulationarchive_bytes;
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, reb_simulationarchive_writer_thread, w)){
+        reb_warning(r,"Cannot create Simulation Archive writer thread. Writing snapshots synchronously.");
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+        free(w);
+        r->simulationarchive_async = 0;
+        return;
+    }
+    r->simulationarchive_writer = w;
+}
+
+void reb_simulationarchive_close(struct reb_simulation* const r){
+    reb_simulationarchive_writer_stop(r);
+    if (r->simulationarchive_fd>=0){
+        if (r->simulationarchive_fsync_interval && r->simulationarchive_fsync_counter){
+            fsync(r->simulationarchive_fd);
+        }
+        close(r->simulationarchive_fd);
+        r->simulationarchive_fd = -1;
+    }
+    r->simulationarchive_fsync_counter = 0;
+    free(r->simulationarchive_buffer);
+    r->simulationarchive_buffer = NULL;
+    r->simulationarchive_buffer_allocated = 0;
+    if (r->simulationarchive_encoder){
+        reb_simulationarchive_encoder_free(r->simulationarchive_encoder);
+        free(r->simulationarchive_encoder);
+        r->simulationarchive_encoder = NULL;
+    }
+}
+
+// Opens the Simulation Archive file for appending. Returns 0 on success.
+static int reb_simulationarchive_open(struct reb_simulation* const r){
+    if (r->simulationarchive_fd<0){
+        // The file stays open until the simulation is freed or the archive is reinitialized.
+        r->simulationarchive_fd = open(r->simulationarchive_filename, O_WRONLY|O_APPEND|O_CREAT, 0666);
+        if (r->simulationarchive_fd<0){
+            reb_error(r,"Cannot open Simulation Archive file for appending.");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Appends the initial binary file to a SimulationArchive container as the first record of the member.
+static void reb_simulationarchive_container_output_binary(struct reb_simulation* const r){
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* of = open_memstream(&buf, &size);
+    if (of==NULL){
+        reb_error(r,"Cannot serialize binary file.");
+        return;
+    }
+    reb_output_binary_stream(r, of);
     fclose(of);
+    if (reb_simulationarchive_open(r)==0){
+        if (reb_simulationarchive_write_record(r->simulationarchive_fd, r->simulationarchive_member, 0, buf, size)){
+            reb_error(r,"Error while writing to Simulation Archive file.");
+        }else{
+            r->metrics.simulationarchive_bytes += reb_simulationarchive_record_size(r->simulationarchive_member, size);
+        }
+    }
+    free(buf);
+}
+
+static void reb_simulationarchive_append(struct reb_simulation* r){
+    const size_t size = reb_simulationarchive_snapshotsize(r);
+    if (size==0) return; // Integrator not supported. Error message already set.
+    if (reb_simulationarchive_open(r)) return;
+    if (r->simulationarchive_buffer_allocated<size){
+        r->simulationarchive_buffer = realloc(r->simulationarchive_buffer, size);
+        r->simulationarchive_buffer_allocated = size;
+    }
+    reb_simulationarchive_serialize(r, r->simulationarchive_buffer);
+
+    int fsync_now = 0;
+    if (r->simulationarchive_fsync_interval){
+        r->simulationarchive_fsync_counter++;
+        if (r->simulationarchive_fsync_counter>=r->simulationarchive_fsync_interval){
+            fsync_now = 1;
+            r->simulationarchive_fsync_counter = 0;
+        }
+    }
+
+    if (r->simulationarchive_async && !r->simulationarchive_writer){
+        reb_simulationarchive_writer_start(r);
+    }
+    struct reb_simulationarchive_writer* const w = r->simulationarchive_writer;
+    if (w){
+        pthread_mutex_lock(&w->mutex);
+        reb_simulationarchive_writer_wait(r, w);
+        if (r->simulationarchive_async){
+            // Hand the snapshot over and continue with the writer's old buffer.
+            char* const buffer = w->buffer;
+            const size_t allocated = w->allocated;
+            w->buffer = r->simulationarchive_buffer;
+            w->allocated = r->simulationarchive_buffer_allocated;
+            w->size = size;
+            w->fsync = fsync_now;
+            w->compression = reb_simulationarchive_records(r);
+            w->keyframe_interval = r->simulationarchive_keyframe_interval;
+            w->member = r->simulationarchive_member;
+            w->pending = 1;
+            r->simulationarchive_buffer = buffer;
+            r->simulationarchive_buffer_allocated = allocated;
+            pthread_cond_broadcast(&w->cond);
+            pthread_mutex_unlock(&w->mutex);
+            return;
+        }
+        // Asynchronous writing has been turned off. 
+        pthread_mutex_unlock(&w->mutex);
+        reb_simulationarchive_writer_stop(r);
+    }
+
+    const char* data = r->simulationarchive_buffer;
+    size_t data_size = size;
+    if (reb_simulationarchive_records(r)){
+        if (!r->simulationarchive_encoder){
+            r->simulationarchive_encoder = calloc(1, sizeof(struct reb_simulationarchive_encoder));
+        }
+        data_size = reb_simulationarchive_encode(r->simulationarchive_encoder, r->simulationarchive_buffer, size, r->simulationarchive_keyframe_interval);
+        if (!data_size){
+            reb_error(r,"Error while compressing Simulation Archive snapshot.");
+            return;
+        }
+        data = r->simulationarchive_encoder->record;
+    }
+    // Single write of the entire snapshot.
+    if (reb_simulationarchive_write_record(r->simulationarchive_fd, r->simulationarchive_member, 1, data, data_size)){
+        reb_error(r,"Error while writing to Simulation Archive file.");
+        return;
+    }
+    r->metrics.simulationarchive_bytes += reb_simulationarchive_record_size(r->simulationarchive_member, data_size);
+    if (fsync_now){
+        fsync(r->simulationarchive_fd);
+    }
 }
 
 void reb_simulationarchive_heartbeat(struct reb_simulation* const r){
+    if (reb_simulationarchive_zlib_missing(r)){
+        r->status = REB_EXIT_ERROR;
+        return;
+    }
     if (r->simulationarchive_walltime==0){
         // First output
+        // All gravity modules only depend on the particles. Trees are restored when a snapshot is loaded.
+        r->simulationarchive_extras = reb_simulationarchive_extras(r);
         r->simulationarchive_size_snapshot = reb_simulationarchive_snapshotsize(r);
-        switch (r->gravity){
-            case REB_GRAVITY_BASIC:
-            case REB_GRAVITY_NONE:
-                break;
-            default:
-                reb_error(r,"Simulation archive not implemented for this gravity module.");
-                break;
-        }
         r->simulationarchive_next = r->t + r->simulationarchive_interval;
         r->simulationarchive_walltime = 1e-300;
         gettimeofday(&r->simulationarchive_time,NULL);
-        reb_output_binary(r,r->simulationarchive_filename);
+        reb_simulationarchive_close(r); // In case the archive was reinitialized
+        if (r->simulationarchive_member>=0){
+            reb_simulationarchive_container_output_binary(r);
+        }else{
+            reb_output_binary(r,r->simulationarchive_filename);
+            r->metrics.simulationarchive_bytes += r->simulationarchive_size_first;
+        }
     }else{
         // Appending outputs
         if (r->simulationarchive_interval){
@@ -35,4 +35,10 @@ struct reb_particles;
  */
 void reb_simulationarchive_heartbeat(struct reb_simulation* const r);
 
+/**
+ * @brief Internal function to close the Simulation Archive file (if open) and free the snapshot buffer.
+ * @details Snapshots not yet flushed to disk are flushed if simulationarchive_fsync_interval is set.
+ */
+void reb_simulationarchive_close(struct reb_simulation* const r);
+
 #endif 	// SIMULATIONARCHIVE_H
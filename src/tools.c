@@ -30,6 +30,9 @@
 #include <string.h>
 #include <sys/time.h>
 #include <stdint.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif // __linux__
 #include "particle.h"
 #include "rebound.h"
 #include "tools.h"
@@ -41,6 +44,57 @@ void reb_tools_init_srand(void){
 	srand ( tim.tv_usec + getpid());
 }
 
+// Size of the chunks written by one thread during the first touch. One page. 
+#define REB_MEMORY_FIRST_TOUCH_CHUNK 4096
+// Size of a transparent huge page (x86_64 and most other 64 bit Linux platforms). 
+#define REB_MEMORY_HUGE_PAGE_SIZE (2*1024*1024)
+
+void* reb_tools_realloc(const struct reb_simulation* const r, void* ptr, size_t old_size, size_t new_size){
+    const unsigned int policy = r?r->memory_policy:0;
+    if (policy==0 || new_size==0){
+        return realloc(ptr, new_size);
+    }
+    size_t alignment = REB_MEMORY_ALIGNMENT;
+    const int huge_pages = (policy & REB_MEMORY_HUGE_PAGES) && new_size>=REB_MEMORY_HUGE_PAGE_SIZE;
+    if (huge_pages){
+        alignment = REB_MEMORY_HUGE_PAGE_SIZE;
+    }
+    void* p = NULL;
+    if (posix_memalign(&p, alignment, new_size)){
+        // Keep the old buffer, the same as a failed realloc().
+        return NULL;
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge_pages){
+        // Only a hint. Has no effect if transparent huge pages are disabled.
+        madvise(p, new_size, MADV_HUGEPAGE);
+    }
+#endif
+    const size_t copy_size = old_size<new_size?old_size:new_size;
+    if (policy & REB_MEMORY_FIRST_TOUCH){
+        char* const dst = p;
+        const char* const src = ptr;
+        const long Nchunks = (long)((new_size+REB_MEMORY_FIRST_TOUCH_CHUNK-1)/REB_MEMORY_FIRST_TOUCH_CHUNK);
+#pragma omp parallel for schedule(static)
+        for (long c=0; c<Nchunks; c++){
+            const size_t start = (size_t)c*REB_MEMORY_FIRST_TOUCH_CHUNK;
+            const size_t end = start+REB_MEMORY_FIRST_TOUCH_CHUNK<new_size?start+REB_MEMORY_FIRST_TOUCH_CHUNK:new_size;
+            const size_t copy_end = end<copy_size?end:copy_size;
+            if (copy_end>start){
+                memcpy(dst+start, src+start, copy_end-start);
+            }
+            if (end>(copy_end>start?copy_end:start)){
+                const size_t zero_start = copy_end>start?copy_end:start;
+                memset(dst+zero_start, 0, end-zero_start);
+            }
+        }
+    }else if (copy_size){
+        memcpy(p, ptr, copy_size);
+    }
+    free(ptr);
+    return p;
+}
+
 double reb_random_uniform(double min, double max){
 	return ((double)rand())/((double)(RAND_MAX))*(max-min)+min;
 }
@@ -68,45 +122,197 @@ double reb_random_rayleigh(double sigma){
 	return sigma*sqrt(-2*log(y));
 }
 
+/**
+ * @brief Philox4x32-10 block function (Salmon et al. 2011). 
+ * @details Hashes the 128 bit counter ctr with the 64 bit key in place.
+ */
+static void reb_rng_philox4x32(uint32_t ctr[4], const uint64_t key){
+	uint32_t k0 = (uint32_t)key;
+	uint32_t k1 = (uint32_t)(key>>32);
+	for (int i=0;i<10;i++){
+		const uint64_t p0 = (uint64_t)0xD2511F53u*ctr[0];
+		const uint64_t p1 = (uint64_t)0xCD9E8D57u*ctr[2];
+		const uint32_t c0 = (uint32_t)(p1>>32)^ctr[1]^k0;
+		const uint32_t c2 = (uint32_t)(p0>>32)^ctr[3]^k1;
+		ctr[1] = (uint32_t)p1;
+		ctr[3] = (uint32_t)p0;
+		ctr[0] = c0;
+		ctr[2] = c2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+}
+
+struct reb_rng reb_rng_init(uint64_t seed, uint64_t stream){
+	struct reb_rng rng = {.key = seed, .stream = stream, .counter = 0};
+	return rng;
+}
+
+struct reb_rng reb_rng_stream(struct reb_simulation* const r){
+	return reb_rng_init(r->rand_seed, r->rand_streams++);
+}
+
+/**
+ * @brief Returns the next random number of the stream, uniformly distributed in [0,1).
+ */
+static double reb_rng_next(struct reb_rng* const rng){
+	uint32_t ctr[4] = {(uint32_t)rng->counter, (uint32_t)(rng->counter>>32), (uint32_t)rng->stream, (uint32_t)(rng->stream>>32)};
+	rng->counter++;
+	reb_rng_philox4x32(ctr, rng->key);
+	const uint64_t x = ((uint64_t)ctr[1]<<32) | ctr[0];
+	return (double)(x>>11)*(1./9007199254740992.); // 53 bits
+}
+
+double reb_rng_uniform(struct reb_rng* const rng, double min, double max){
+	return reb_rng_next(rng)*(max-min)+min;
+}
+
+double reb_rng_powerlaw(struct reb_rng* const rng, double min, double max, double slope){
+	double y = reb_rng_uniform(rng, 0., 1.);
+	if(slope == -1) return exp(y*log(max/min) + log(min));
+    else return pow( (pow(max,slope+1.)-pow(min,slope+1.))*y+pow(min,slope+1.), 1./(slope+1.));
+}
+
+double reb_rng_normal(struct reb_rng* const rng, double variance){
+	double v1,v2,rsq=1.;
+	while(rsq>=1. || rsq<1.0e-12){
+		v1=2.*reb_rng_next(rng)-1.0;
+		v2=2.*reb_rng_next(rng)-1.0;
+		rsq=v1*v1+v2*v2;
+	}
+	return 	v1*sqrt(-2.*log(rsq)/rsq*variance);
+}
+
+double reb_rng_rayleigh(struct reb_rng* const rng, double sigma){
+	double y = 1.-reb_rng_next(rng); // In (0,1]
+	return sigma*sqrt(-2*log(y));
+}
+
 /// Other helper routines
+
+/**
+ * @brief Adds x to the sum using Neumaier's compensated summation.
+ * @details The rounding error is accumulated in c and should be added to sum at the end.
+ */
+static inline void reb_tools_compensated_add(double* const sum, double* const c, const double x){
+    const double t = *sum + x;
+    if (fabs(*sum)>=fabs(x)){
+        *c += (*sum - t) + x;
+    }else{
+        *c += (x - t) + *sum;
+    }
+    *sum = t;
+}
+
 double reb_tools_energy(const struct reb_simulation* const r){
     const int N = r->N;
     const int N_var = r->N_var;
     const int _N_active = ((r->N_active==-1)?N:r->N_active) - N_var;
     const struct reb_particle* restrict const particles = r->particles;
-    double e_kin = 0.;
-    double e_pot = 0.;
+    const double G = r->G;
+    double e_kin = 0., c_kin = 0.;
+    double e_pot = 0., c_pot = 0.;
     int N_interact = (r->testparticle_type==0)?_N_active:(N-N_var);
-    for (int i=0;i<N_interact;i++){
-        struct reb_particle pi = particles[i];
-        e_kin += 0.5 * pi.m * (pi.vx*pi.vx + pi.vy*pi.vy + pi.vz*pi.vz);
+    // In reproducible mode, the terms are stored (kinetic energy of particle i in terms[i], 
+    // potential energy of row i in terms[N_interact+i]) and summed up in order afterwards.
+    double* const terms = r->reproducible?malloc(sizeof(double)*2*N_interact):NULL;
+#pragma omp parallel
+    {
+        double s_kin = 0., cs_kin = 0.;
+        double s_pot = 0., cs_pot = 0.;
+#pragma omp for schedule(guided) nowait
+        for (int i=0;i<N_interact;i++){
+            const struct reb_particle pi = particles[i];
+            const double e = 0.5 * pi.m * (pi.vx*pi.vx + pi.vy*pi.vy + pi.vz*pi.vz);
+            if (terms){
+                terms[i] = e;
+            }else{
+                reb_tools_compensated_add(&s_kin, &cs_kin, e);
+            }
+        }
+        // Pairs of active particles. Each row is summed directly, the rows are summed with compensation.
+#pragma omp for schedule(guided) nowait
+        for (int i=0;i<_N_active;i++){
+            const struct reb_particle pi = particles[i];
+            double row = 0.;
+#pragma omp simd reduction(+:row)
+            for (int j=i+1;j<_N_active;j++){
+                const double dx = pi.x - particles[j].x;
+                const double dy = pi.y - particles[j].y;
+                const double dz = pi.z - particles[j].z;
+                row += particles[j].m/sqrt(dx*dx + dy*dy + dz*dz);
+            }
+            if (terms){
+                terms[N_interact+i] = -G*pi.m*row;
+            }else{
+                reb_tools_compensated_add(&s_pot, &cs_pot, -G*pi.m*row);
+            }
+        }
+        // Test particles (testparticle_type=1) only interact with active particles.
+        // The loop runs over the test particles, so the cost is O(N*N_active) 
+        // and this parallelizes well even if there are only a few active particles.
+#pragma omp for schedule(guided) nowait
+        for (int j=_N_active;j<N_interact;j++){
+            const struct reb_particle pj = particles[j];
+            double row = 0.;
+#pragma omp simd reduction(+:row)
+            for (int i=0;i<_N_active;i++){
+                const double dx = particles[i].x - pj.x;
+                const double dy = particles[i].y - pj.y;
+                const double dz = particles[i].z - pj.z;
+                row += particles[i].m/sqrt(dx*dx + dy*dy + dz*dz);
+            }
+            if (terms){
+                terms[N_interact+j] = -G*pj.m*row;
+            }else{
+                reb_tools_compensated_add(&s_pot, &cs_pot, -G*pj.m*row);
+            }
+        }
+#pragma omp critical
+        {
+            reb_tools_compensated_add(&e_kin, &c_kin, s_kin);
+            reb_tools_compensated_add(&e_kin, &c_kin, cs_kin);
+            reb_tools_compensated_add(&e_pot, &c_pot, s_pot);
+            reb_tools_compensated_add(&e_pot, &c_pot, cs_pot);
+        }
     }
-    for (int i=0;i<_N_active;i++){
-        struct reb_particle pi = particles[i];
-        for (int j=i+1;j<N_interact;j++){
-            struct reb_particle pj = particles[j];
-            double dx = pi.x - pj.x;
-            double dy = pi.y - pj.y;
-            double dz = pi.z - pj.z;
-            e_pot -= r->G*pj.m*pi.m/sqrt(dx*dx + dy*dy + dz*dz);
+    if (terms){
+        for (int i=0;i<N_interact;i++){
+            reb_tools_compensated_add(&e_kin, &c_kin, terms[i]);
+            reb_tools_compensated_add(&e_pot, &c_pot, terms[N_interact+i]);
         }
+        free(terms);
     }
     
-    return e_kin + e_pot + r->energy_offset;
+    return (e_kin + c_kin) + (e_pot + c_pot) + r->energy_offset;
 }
 
 struct reb_vec3d reb_tools_angular_momentum(const struct reb_simulation* const r){
 	const int N = r->N;
 	const struct reb_particle* restrict const particles = r->particles;
 	const int N_var = r->N_var;
-    struct reb_vec3d L = {0};
-    for (int i=0;i<N-N_var;i++){
-		struct reb_particle pi = particles[i];
-        L.x += pi.m*(pi.y*pi.vz - pi.z*pi.vy);
-        L.y += pi.m*(pi.z*pi.vx - pi.x*pi.vz);
-        L.z += pi.m*(pi.x*pi.vy - pi.y*pi.vx);
-	}
-	return L;
+    double L[3] = {0}, c[3] = {0};
+    // O(N), summed up on one thread in reproducible mode.
+#pragma omp parallel if(!r->reproducible)
+    {
+        double Ls[3] = {0}, cs[3] = {0};
+#pragma omp for schedule(static) nowait
+        for (int i=0;i<N-N_var;i++){
+            const struct reb_particle pi = particles[i];
+            reb_tools_compensated_add(&Ls[0], &cs[0], pi.m*(pi.y*pi.vz - pi.z*pi.vy));
+            reb_tools_compensated_add(&Ls[1], &cs[1], pi.m*(pi.z*pi.vx - pi.x*pi.vz));
+            reb_tools_compensated_add(&Ls[2], &cs[2], pi.m*(pi.x*pi.vy - pi.y*pi.vx));
+        }
+#pragma omp critical
+        {
+            for (int k=0;k<3;k++){
+                reb_tools_compensated_add(&L[k], &c[k], Ls[k]);
+                reb_tools_compensated_add(&L[k], &c[k], cs[k]);
+            }
+        }
+    }
+    struct reb_vec3d Lv = {.x = L[0]+c[0], .y = L[1]+c[1], .z = L[2]+c[2]};
+	return Lv;
 }
 
 void reb_move_to_com(struct reb_simulation* const r){
@@ -354,10 +560,49 @@ struct reb_particle reb_get_com_without_particle(struct reb_particle com, struct
 }
 
 struct reb_particle reb_get_com_range(struct reb_simulation* r, int first, int last){
+    // Mass weighted sums, divided by the total mass only once at the end.
+    // Order: m, x, y, z, vx, vy, vz, ax, ay, az
+    const struct reb_particle* restrict const particles = r->particles;
+    double s[10] = {0}, c[10] = {0};
+    // O(N), summed up on one thread in reproducible mode.
+#pragma omp parallel if(!r->reproducible)
+    {
+        double ss[10] = {0}, cs[10] = {0};
+#pragma omp for schedule(static) nowait
+        for(int i=first; i<last; i++){
+            const struct reb_particle p = particles[i];
+            reb_tools_compensated_add(&ss[0], &cs[0], p.m);
+            reb_tools_compensated_add(&ss[1], &cs[1], p.x*p.m);
+            reb_tools_compensated_add(&ss[2], &cs[2], p.y*p.m);
+            reb_tools_compensated_add(&ss[3], &cs[3], p.z*p.m);
+            reb_tools_compensated_add(&ss[4], &cs[4], p.vx*p.m);
+            reb_tools_compensated_add(&ss[5], &cs[5], p.vy*p.m);
+            reb_tools_compensated_add(&ss[6], &cs[6], p.vz*p.m);
+            reb_tools_compensated_add(&ss[7], &cs[7], p.ax*p.m);
+            reb_tools_compensated_add(&ss[8], &cs[8], p.ay*p.m);
+            reb_tools_compensated_add(&ss[9], &cs[9], p.az*p.m);
+        }
+#pragma omp critical
+        {
+            for (int k=0;k<10;k++){
+                reb_tools_compensated_add(&s[k], &c[k], ss[k]);
+                reb_tools_compensated_add(&s[k], &c[k], cs[k]);
+            }
+        }
+    }
 	struct reb_particle com = {0};
-	for(int i=first; i<last; i++){
-		com = reb_get_com_of_pair(com, r->particles[i]);
-	}
+    com.m = s[0] + c[0];
+    if (com.m>0.){
+        com.x  = (s[1]+c[1])/com.m;
+        com.y  = (s[2]+c[2])/com.m;
+        com.z  = (s[3]+c[3])/com.m;
+        com.vx = (s[4]+c[4])/com.m;
+        com.vy = (s[5]+c[5])/com.m;
+        com.vz = (s[6]+c[6])/com.m;
+        com.ax = (s[7]+c[7])/com.m;
+        com.ay = (s[8]+c[8])/com.m;
+        com.az = (s[9]+c[9])/com.m;
+    }
 	return com;
 }
 
@@ -413,6 +658,115 @@ void reb_tools_init_plummer(struct reb_simulation* r, int _N, double M, double R
 	}
 }
 
+/**
+ * @brief Draws one star of a Plummer sphere, the same algorithm as reb_tools_init_plummer().
+ */
+static struct reb_particle reb_tools_plummer_particle(struct reb_rng* const rng, int N, double M, double R){
+	double E = 3./64.*M_PI*M*M/R;
+	struct reb_particle star = {0};
+	double _r = pow(pow(reb_rng_uniform(rng,0,1),-2./3.)-1.,-1./2.);
+	double x2 = reb_rng_uniform(rng,0,1);
+	double x3 = reb_rng_uniform(rng,0,2.*M_PI);
+	star.z = (1.-2.*x2)*_r;
+	star.x = sqrt(_r*_r-star.z*star.z)*cos(x3);
+	star.y = sqrt(_r*_r-star.z*star.z)*sin(x3);
+	double x5,g,q;
+	do{
+		x5 = reb_rng_uniform(rng,0.,1.);
+		q = reb_rng_uniform(rng,0.,1.);
+		g = q*q*pow(1.-q*q,7./2.);
+	}while(0.1*x5>g);
+	double ve = pow(2.,1./2.)*pow(1.+_r*_r,-1./4.);
+	double v = q*ve;
+	double x6 = reb_rng_uniform(rng,0.,1.);
+	double x7 = reb_rng_uniform(rng,0.,2.*M_PI);
+	star.vz = (1.-2.*x6)*v;
+	star.vx = sqrt(v*v-star.vz*star.vz)*cos(x7);
+	star.vy = sqrt(v*v-star.vz*star.vz)*sin(x7);
+	
+	star.x *= 3.*M_PI/64.*M*M/E;
+	star.y *= 3.*M_PI/64.*M*M/E;
+	star.z *= 3.*M_PI/64.*M*M/E;
+	
+	star.vx *= sqrt(E*64./3./M_PI/M);
+	star.vy *= sqrt(E*64./3./M_PI/M);
+	star.vz *= sqrt(E*64./3./M_PI/M);
+
+	star.m = M/(double)N;
+	return star;
+}
+
+/**
+ * @brief Draws one particle of a disc, see reb_tools_add_disc().
+ */
+static struct reb_particle reb_tools_disc_particle(struct reb_rng* const rng, double G, struct reb_particle primary, double m, double a_min, double a_max, double slope, double sigma_e, double sigma_inc){
+	const double a = a_min==a_max?a_min:reb_rng_powerlaw(rng, a_min, a_max, slope);
+	const double e = sigma_e>0.?reb_rng_rayleigh(rng, sigma_e):0.;
+	const double inc = sigma_inc>0.?reb_rng_rayleigh(rng, sigma_inc):0.;
+	const double Omega = reb_rng_uniform(rng, 0., 2.*M_PI);
+	const double omega = reb_rng_uniform(rng, 0., 2.*M_PI);
+	const double f = reb_rng_uniform(rng, 0., 2.*M_PI);
+	int err = 0;
+	return reb_tools_orbit_to_particle_err(G, primary, m, a, e, inc, Omega, omega, f, &err);
+}
+
+/**
+ * @brief Makes room for N particles and returns the first stream to be used.
+ * @details With MPI, the particles need to be distributed with reb_add(). They 
+ * are then generated into a temporary buffer which is returned in particles.
+ */
+static uint64_t reb_tools_add_generated_begin(struct reb_simulation* const r, const int N, struct reb_particle** particles){
+	const uint64_t stream = r->rand_streams;
+	r->rand_streams += N;
+#ifdef MPI
+	*particles = malloc(sizeof(struct reb_particle)*N);
+#else // MPI
+	reb_add_many_reserve(r, r->N+N);
+	*particles = r->particles+r->N;
+#endif // MPI
+	return stream;
+}
+
+static void reb_tools_add_generated_finish(struct reb_simulation* const r, const int N, struct reb_particle* particles){
+#ifdef MPI
+	for (int i=0;i<N;i++){
+		reb_add(r, particles[i]);
+	}
+	free(particles);
+#else // MPI
+	const int first = r->N;
+	r->N += N;
+	reb_add_many_finish(r, first);
+#endif // MPI
+}
+
+void reb_tools_add_plummer(struct reb_simulation* r, int N, double M, double R){
+	if (N<=0) return;
+	struct reb_particle* particles;
+	const uint64_t stream = reb_tools_add_generated_begin(r, N, &particles);
+	const uint64_t key = r->rand_seed;
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<N;i++){
+		struct reb_rng rng = reb_rng_init(key, stream+i);
+		particles[i] = reb_tools_plummer_particle(&rng, N, M, R);
+	}
+	reb_tools_add_generated_finish(r, N, particles);
+}
+
+void reb_tools_add_disc(struct reb_simulation* r, int N, struct reb_particle primary, double m, double a_min, double a_max, double slope, double sigma_e, double sigma_inc){
+	if (N<=0) return;
+	struct reb_particle* particles;
+	const uint64_t stream = reb_tools_add_generated_begin(r, N, &particles);
+	const uint64_t key = r->rand_seed;
+	const double G = r->G;
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<N;i++){
+		struct reb_rng rng = reb_rng_init(key, stream+i);
+		particles[i] = reb_tools_disc_particle(&rng, G, primary, m, a_min, a_max, slope, sigma_e, sigma_inc);
+	}
+	reb_tools_add_generated_finish(r, N, particles);
+}
+
 static double mod2pi(double f){
 	while(f < 0.){
 		f += 2*M_PI;
@@ -690,6 +1044,180 @@ struct reb_orbit reb_tools_particle_to_orbit(double G, struct reb_particle p, st
 	return reb_tools_particle_to_orbit_err(G, p, primary, &err);
 }
 
+/**
+ * @brief Number of particles converted together by the batched orbit routines.
+ * @details Each block is processed in a vectorizable pass which does all the 
+ * algebra and a scalar pass for the inverse trigonometric functions and branches.
+ */
+#define REB_ORBIT_BLOCK 256
+
+int reb_tools_particles_to_orbits(const double G, const int N, const double* const particles, const double* const primaries, const int Nprimaries, double* const orbits, int* const err){
+    if (N<=0) return 0;
+    const int nblocks = (N+REB_ORBIT_BLOCK-1)/REB_ORBIT_BLOCK;
+    const int pstride = (Nprimaries==1)?0:7;
+    int nerr = 0;
+#pragma omp parallel for schedule(static) reduction(+:nerr)
+    for (int b=0;b<nblocks;b++){
+        const int i0 = b*REB_ORBIT_BLOCK;
+        const int n = (N-i0<REB_ORBIT_BLOCK)?(N-i0):REB_ORBIT_BLOCK;
+        double d[REB_ORBIT_BLOCK], a[REB_ORBIT_BLOCK], e[REB_ORBIT_BLOCK], h[REB_ORBIT_BLOCK], hz[REB_ORBIT_BLOCK];
+        double nx[REB_ORBIT_BLOCK], ny[REB_ORBIT_BLOCK], nn[REB_ORBIT_BLOCK];
+        double ex[REB_ORBIT_BLOCK], ey[REB_ORBIT_BLOCK], ez[REB_ORBIT_BLOCK];
+        double dx[REB_ORBIT_BLOCK], dy[REB_ORBIT_BLOCK], dz[REB_ORBIT_BLOCK], vr[REB_ORBIT_BLOCK];
+        // Same operations as in reb_tools_particle_to_orbit_err(), without branches.
+#pragma omp simd
+        for (int k=0;k<n;k++){
+            const double* const p = particles+7*(i0+k);
+            const double* const c = primaries+pstride*(i0+k);
+            const double mu = G*(p[0]+c[0]);
+            const double x = p[1]-c[1];
+            const double y = p[2]-c[2];
+            const double z = p[3]-c[3];
+            const double vx = p[4]-c[4];
+            const double vy = p[5]-c[5];
+            const double vz = p[6]-c[6];
+            const double dk = sqrt(x*x + y*y + z*z);
+            const double vsquared = vx*vx + vy*vy + vz*vz;
+            const double vcircsquared = mu/dk;
+            a[k] = -mu/(vsquared - 2.*vcircsquared);
+            const double hx = (y*vz - z*vy);
+            const double hy = (z*vx - x*vz);
+            hz[k] = (x*vy - y*vx);
+            h[k] = sqrt(hx*hx + hy*hy + hz[k]*hz[k]);
+            const double vdiffsquared = vsquared - vcircsquared;
+            vr[k] = (x*vx + y*vy + z*vz)/dk;
+            const double rvr = dk*vr[k];
+            const double muinv = 1./mu;
+            ex[k] = muinv*(vdiffsquared*x - rvr*vx);
+            ey[k] = muinv*(vdiffsquared*y - rvr*vy);
+            ez[k] = muinv*(vdiffsquared*z - rvr*vz);
+            e[k] = sqrt(ex[k]*ex[k] + ey[k]*ey[k] + ez[k]*ez[k]);
+            nx[k] = -hy;
+            ny[k] = hx;
+            nn[k] = sqrt(nx[k]*nx[k] + ny[k]*ny[k]);
+            d[k] = dk;
+            dx[k] = x; dy[k] = y; dz[k] = z;
+        }
+        for (int k=0;k<n;k++){
+            const int i = i0+k;
+            double* const o = orbits+7*i;
+            o[0] = particles[7*i];
+            int erri = 0;
+            if (primaries[pstride*i] <= TINY){
+                erri = 1;
+            }else if (d[k] <= TINY){
+                erri = 2;
+            }
+            if (err){
+                err[i] = erri;
+            }
+            if (erri){
+                nerr++;
+                o[1] = o[2] = o[3] = o[4] = o[5] = o[6] = nan("");
+                continue;
+            }
+            const double inc = acos2(hz[k], h[k], 1.);
+            const double Omega = acos2(nx[k], nn[k], ny[k]);
+            double omega, f;
+            if(inc < MIN_INC || inc > M_PI - MIN_INC){
+                const double pomega = acos2(ex[k], e[k], ey[k]);
+                const double theta = acos2(dx[k], d[k], dy[k]);
+                if(inc < M_PI/2.){
+                    omega = pomega - Omega;
+                    f = theta - pomega;
+                }else{
+                    omega = Omega - pomega;
+                    f = pomega - theta;
+                }
+            }else{
+                const double wpf = acos2(nx[k]*dx[k] + ny[k]*dy[k], nn[k]*d[k], dz[k]);
+                omega = acos2(nx[k]*ex[k] + ny[k]*ey[k], nn[k]*e[k], ez[k]);
+                f = wpf - omega;
+            }
+            o[1] = a[k];
+            o[2] = e[k];
+            o[3] = inc;
+            o[4] = Omega;
+            o[5] = omega;
+            o[6] = f;
+        }
+    }
+    return nerr;
+}
+
+int reb_tools_orbits_to_particles(const double G, const int N, const double* const orbits, const double* const primaries, const int Nprimaries, double* const particles, int* const err){
+    if (N<=0) return 0;
+    const int nblocks = (N+REB_ORBIT_BLOCK-1)/REB_ORBIT_BLOCK;
+    const int pstride = (Nprimaries==1)?0:7;
+    int nerr = 0;
+#pragma omp parallel for schedule(static) reduction(+:nerr)
+    for (int b=0;b<nblocks;b++){
+        const int i0 = b*REB_ORBIT_BLOCK;
+        const int n = (N-i0<REB_ORBIT_BLOCK)?(N-i0):REB_ORBIT_BLOCK;
+        double cO[REB_ORBIT_BLOCK], sO[REB_ORBIT_BLOCK], co[REB_ORBIT_BLOCK], so[REB_ORBIT_BLOCK];
+        double cf[REB_ORBIT_BLOCK], sf[REB_ORBIT_BLOCK], ci[REB_ORBIT_BLOCK], si[REB_ORBIT_BLOCK];
+        int bad[REB_ORBIT_BLOCK];
+        // Checks and trigonometric functions. Same checks as in reb_tools_orbit_to_particle_err().
+        for (int k=0;k<n;k++){
+            const int i = i0+k;
+            const double* const o = orbits+7*i;
+            const double a = o[1];
+            const double e = o[2];
+            cf[k] = cos(o[6]);
+            int erri = 0;
+            if (e == 1.){
+                erri = 1;
+            }else if (e < 0.){
+                erri = 2;
+            }else if (e > 1. && a > 0.){
+                erri = 3;
+            }else if (e < 1. && a < 0.){
+                erri = 4;
+            }else if (e*cf[k] < -1.){
+                erri = 5;
+            }
+            if (err){
+                err[i] = erri;
+            }
+            bad[k] = erri;
+            nerr += (erri!=0);
+            cO[k] = cos(o[4]);
+            sO[k] = sin(o[4]);
+            co[k] = cos(o[5]);
+            so[k] = sin(o[5]);
+            sf[k] = sin(o[6]);
+            ci[k] = cos(o[3]);
+            si[k] = sin(o[3]);
+        }
+        // Murray & Dermott Eq 2.122 and 2.36, see reb_tools_orbit_to_particle_err().
+#pragma omp simd
+        for (int k=0;k<n;k++){
+            const double* const o = orbits+7*(i0+k);
+            const double* const c = primaries+pstride*(i0+k);
+            double* const p = particles+7*(i0+k);
+            const double m = o[0];
+            const double a = o[1];
+            const double e = o[2];
+            const double r = a*(1-e*e)/(1 + e*cf[k]);
+            const double v0 = sqrt(G*(m+c[0])/a/(1.-e*e));
+            p[0] = m;
+            p[1] = c[1] + r*(cO[k]*(co[k]*cf[k]-so[k]*sf[k]) - sO[k]*(so[k]*cf[k]+co[k]*sf[k])*ci[k]);
+            p[2] = c[2] + r*(sO[k]*(co[k]*cf[k]-so[k]*sf[k]) + cO[k]*(so[k]*cf[k]+co[k]*sf[k])*ci[k]);
+            p[3] = c[3] + r*(so[k]*cf[k]+co[k]*sf[k])*si[k];
+            p[4] = c[4] + v0*((e+cf[k])*(-ci[k]*co[k]*sO[k] - cO[k]*so[k]) - sf[k]*(co[k]*cO[k] - ci[k]*so[k]*sO[k]));
+            p[5] = c[5] + v0*((e+cf[k])*(ci[k]*co[k]*cO[k] - sO[k]*so[k])  - sf[k]*(co[k]*sO[k] + ci[k]*so[k]*cO[k]));
+            p[6] = c[6] + v0*((e+cf[k])*co[k]*si[k] - sf[k]*si[k]*so[k]);
+        }
+        for (int k=0;k<n;k++){
+            if (bad[k]){
+                double* const p = particles+7*(i0+k);
+                p[0] = p[1] = p[2] = p[3] = p[4] = p[5] = p[6] = nan("");
+            }
+        }
+    }
+    return nerr;
+}
+
 
 void reb_tools_solve_kepler_pal(double h, double k, double lambda, double* p, double* q){
     double e2 = h*h + k*k;
@@ -800,15 +1328,16 @@ int reb_add_var_1st_order(struct reb_simulation* const r, int testparticle){
     r->var_config[r->var_config_N-1].index = index;
     r->var_config[r->var_config_N-1].testparticle = testparticle;
     struct reb_particle p0 = {0};
+    // N_var is incremented first so that variational particles are not added to the tree.
     if (testparticle>=0){
-        reb_add(r,p0);
         r->N_var++;
+        reb_add(r,p0);
     }else{
         int N_real = r->N - r->N_var;
         for (int i=0;i<N_real;i++){
+            r->N_var++;
             reb_add(r,p0);
         }
-        r->N_var += N_real;
     }
     return index;
 }
@@ -825,20 +1354,24 @@ int reb_add_var_2nd_order(struct reb_simulation* const r, int testparticle, int
     r->var_config[r->var_config_N-1].index_1st_order_a = index_1st_order_a;
     r->var_config[r->var_config_N-1].index_1st_order_b = index_1st_order_b;
     struct reb_particle p0 = {0};
+    // N_var is incremented first so that variational particles are not added to the tree.
     if (testparticle>=0){
-        reb_add(r,p0);
         r->N_var++;
+        reb_add(r,p0);
     }else{
         int N_real = r->N - r->N_var;
         for (int i=0;i<N_real;i++){
+            r->N_var++;
             reb_add(r,p0);
         }
-        r->N_var += N_real;
     }
     return index;
 }
 
 void reb_tools_megno_init(struct reb_simulation* const r){
+    reb_tools_megno_init_rng(r, NULL);
+}
+void reb_tools_megno_init_rng(struct reb_simulation* const r, struct reb_rng* const rng){
 	r->megno_Ys = 0.;
 	r->megno_Yss = 0.;
 	r->megno_cov_Yt = 0.;
@@ -852,12 +1385,12 @@ void reb_tools_megno_init(struct reb_simulation* const r){
     struct reb_particle* const particles = r->particles;
     for (;i<imax;i++){ 
         particles[i].m  = 0.;
-		particles[i].x  = reb_random_normal(1.);
-		particles[i].y  = reb_random_normal(1.);
-		particles[i].z  = reb_random_normal(1.);
-		particles[i].vx = reb_random_normal(1.);
-		particles[i].vy = reb_random_normal(1.);
-		particles[i].vz = reb_random_normal(1.);
+		particles[i].x  = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
+		particles[i].y  = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
+		particles[i].z  = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
+		particles[i].vx = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
+		particles[i].vy = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
+		particles[i].vz = rng?reb_rng_normal(rng,1.):reb_random_normal(1.);
 		double deltad = 1./sqrt(
                 particles[i].x*particles[i].x 
                 + particles[i].y*particles[i].y 
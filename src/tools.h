@@ -26,9 +26,11 @@
 #define TOOLS_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 struct reb_simulation;
 struct reb_particles;
+struct reb_rng;
 
 /**
  * @brief Returns deltad/delta 
@@ -44,11 +46,35 @@ double reb_tools_megno_deltad_delta(struct reb_simulation* const r);
  */
 void reb_tools_megno_update(struct reb_simulation* r, double dY);
 
+/**
+ * @brief Same as reb_tools_megno_init() but draws the initial displacements from the stream rng.
+ * @details Uses reb_random_normal() if rng is NULL. Used where reproducible and thread-safe
+ * initial conditions are needed.
+ */
+void reb_tools_megno_init_rng(struct reb_simulation* const r, struct reb_rng* const rng);
+
 /**
  * @brief Init random number generator based on time and process id.
  */
 void reb_tools_init_srand(void);
 
+/**
+ * @brief Resizes a buffer according to r->memory_policy.
+ * @details With the default policy (0) this is the same as realloc(). Otherwise a new 
+ * buffer is allocated with posix_memalign() (aligned to REB_MEMORY_ALIGNMENT bytes, 
+ * or to the huge page size if REB_MEMORY_HUGE_PAGES is set and the buffer is large enough),
+ * the first old_size bytes are copied, and the old buffer is freed. With 
+ * REB_MEMORY_FIRST_TOUCH all pages are written for the first time by the OpenMP threads
+ * in a static schedule, so that the operating system places them close to the threads
+ * that work on them. The buffer can be freed with free().
+ * @param r REBOUND simulation to be considered (can be NULL).
+ * @param ptr Old buffer (can be NULL).
+ * @param old_size Number of bytes in the old buffer which need to be kept.
+ * @param new_size Size of the new buffer in bytes.
+ * @return The new buffer.
+ */
+void* reb_tools_realloc(const struct reb_simulation* const r, void* ptr, size_t old_size, size_t new_size);
+
 /**
  * @brief Convert angles for orbit routines
  */
@@ -28,19 +28,150 @@
 #include "transformations.h"
 #include "rebound.h"
 
+/**
+ * @brief Minimum number of particles for which the transformations run in parallel.
+ * @details Below this number the thread overhead dominates and the serial loops are used.
+ * For the Jacobi transformations, the serial recursion is replaced by a parallel scan.
+ * Note that the parallel scan sums the mass-weighted coordinates in a different order,
+ * so results differ from the serial recursion at the level of floating point rounding.
+ */
+#define REB_TRANSFORMATIONS_PARALLEL_N 4096
+
+#ifdef OPENMP
+#include <stdlib.h>
+#include <stddef.h>
+#include <omp.h>
+
+#define REB_TRANSFORMATIONS_FIELD(p, offset) (*(double*)((char*)(p)+(offset)))
+static const size_t reb_transformations_fields_pos[3] = {offsetof(struct reb_particle,x), offsetof(struct reb_particle,y), offsetof(struct reb_particle,z)};
+static const size_t reb_transformations_fields_acc[3] = {offsetof(struct reb_particle,ax), offsetof(struct reb_particle,ay), offsetof(struct reb_particle,az)};
+static const size_t reb_transformations_fields_posvel[6] = {offsetof(struct reb_particle,x), offsetof(struct reb_particle,y), offsetof(struct reb_particle,z), offsetof(struct reb_particle,vx), offsetof(struct reb_particle,vy), offsetof(struct reb_particle,vz)};
+static const size_t reb_transformations_fields_posvelacc[9] = {offsetof(struct reb_particle,x), offsetof(struct reb_particle,y), offsetof(struct reb_particle,z), offsetof(struct reb_particle,vx), offsetof(struct reb_particle,vy), offsetof(struct reb_particle,vz), offsetof(struct reb_particle,ax), offsetof(struct reb_particle,ay), offsetof(struct reb_particle,az)};
+
+/**
+ * @brief Returns 1 if the parallel scan should be used for N particles.
+ */
+static inline int reb_transformations_use_parallel(const int N){
+    return N>=REB_TRANSFORMATIONS_PARALLEL_N && omp_get_max_threads()>1;
+}
+
+/**
+ * @brief Inertial to Jacobi transformation as a parallel prefix sum.
+ * @details The serial recursion accumulates s_i = sum_{k<i} m_k x_k, the mass-weighted
+ * coordinates of all interior particles. The Jacobi coordinate is then p_j[i] = x_i - s_i/eta[i-1].
+ * Here, each thread first sums its block of particles, then computes its offset from the
+ * block sums of all preceding threads, and finally calculates the Jacobi coordinates of its block.
+ * @param fields Offsets of the coordinates of struct reb_particle to be transformed.
+ * @param Nf Number of coordinates.
+ */
+static inline void reb_transformations_inertial_to_jacobi_scan(const struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N, const size_t* const fields, const int Nf){
+    double* const blocksums = malloc(sizeof(double)*Nf*omp_get_max_threads());
+#pragma omp parallel
+    {
+        const int nt = omp_get_num_threads();
+        const int t = omp_get_thread_num();
+        const int start = 1 + (int)((long)(N-1)*t/nt);
+        const int end = 1 + (int)((long)(N-1)*(t+1)/nt);
+        double s[9] = {0.};
+        for (int i=start;i<end;i++){
+            const double m = p_mass[i].m;
+            for (int f=0;f<Nf;f++){
+                s[f] += m*REB_TRANSFORMATIONS_FIELD(&particles[i],fields[f]);
+            }
+        }
+        for (int f=0;f<Nf;f++){
+            blocksums[t*Nf+f] = s[f];
+        }
+#pragma omp barrier
+        for (int f=0;f<Nf;f++){
+            s[f] = eta[0]*REB_TRANSFORMATIONS_FIELD(&particles[0],fields[f]);
+            for (int k=0;k<t;k++){
+                s[f] += blocksums[k*Nf+f];
+            }
+        }
+        for (int i=start;i<end;i++){
+            const double ei = 1./eta[i-1];
+            const double m = p_mass[i].m;
+            for (int f=0;f<Nf;f++){
+                const double q = REB_TRANSFORMATIONS_FIELD(&particles[i],fields[f]);
+                REB_TRANSFORMATIONS_FIELD(&p_j[i],fields[f]) = q - s[f]*ei;
+                s[f] += m*q;
+            }
+        }
+        if (t==nt-1){
+            const double Mtotali = 1./eta[N-1];
+            for (int f=0;f<Nf;f++){
+                REB_TRANSFORMATIONS_FIELD(&p_j[0],fields[f]) = s[f]*Mtotali;
+            }
+        }
+    }
+    free(blocksums);
+}
+
+/**
+ * @brief Jacobi to inertial transformation as a parallel suffix sum.
+ * @details The centre of mass of particles 0..i-1 is c_i = p_j[0] - sum_{k>=i} m_k/eta[k] p_j[k],
+ * and x_i = p_j[i] + c_i. The suffix sum is calculated blockwise in parallel as in
+ * reb_transformations_inertial_to_jacobi_scan().
+ * @param fields Offsets of the coordinates of struct reb_particle to be transformed.
+ * @param Nf Number of coordinates.
+ */
+static inline void reb_transformations_jacobi_to_inertial_scan(struct reb_particle* const particles, const struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N, const size_t* const fields, const int Nf){
+    double* const blocksums = malloc(sizeof(double)*Nf*omp_get_max_threads());
+#pragma omp parallel
+    {
+        const int nt = omp_get_num_threads();
+        const int t = omp_get_thread_num();
+        const int start = 1 + (int)((long)(N-1)*t/nt);
+        const int end = 1 + (int)((long)(N-1)*(t+1)/nt);
+        double s[9] = {0.};
+        for (int i=start;i<end;i++){
+            const double w = p_mass[i].m/eta[i];
+            for (int f=0;f<Nf;f++){
+                s[f] += w*REB_TRANSFORMATIONS_FIELD(&p_j[i],fields[f]);
+            }
+        }
+        for (int f=0;f<Nf;f++){
+            blocksums[t*Nf+f] = s[f];
+        }
+#pragma omp barrier
+        for (int f=0;f<Nf;f++){
+            s[f] = 0.;
+            for (int k=nt-1;k>t;k--){
+                s[f] += blocksums[k*Nf+f];
+            }
+        }
+        for (int i=end-1;i>=start;i--){
+            const double w = p_mass[i].m/eta[i];
+            for (int f=0;f<Nf;f++){
+                const double q = REB_TRANSFORMATIONS_FIELD(&p_j[i],fields[f]);
+                s[f] += w*q;
+                REB_TRANSFORMATIONS_FIELD(&particles[i],fields[f]) = q + (REB_TRANSFORMATIONS_FIELD(&p_j[0],fields[f]) - s[f]);
+            }
+        }
+        if (t==0){
+            for (int f=0;f<Nf;f++){
+                REB_TRANSFORMATIONS_FIELD(&particles[0],fields[f]) = REB_TRANSFORMATIONS_FIELD(&p_j[0],fields[f]) - s[f];
+            }
+        }
+    }
+    free(blocksums);
+}
+#endif // OPENMP
+
 /******************************
  * Jacobi */
 
 void reb_transformations_calculate_jacobi_eta(const struct reb_particle* const ps, double* const eta, const int N){
       eta[0] = ps[0].m;
-      for (unsigned int i=1;i<N;i++){
+      for (int i=1;i<N;i++){
           eta[i] = eta[i-1] + ps[i].m;
       }
 }
 
 void reb_transformations_calculate_jacobi_masses(const struct reb_particle* const ps, double* const m_j, double* const eta, const int N){
     eta[0] = ps[0].m;
-    for (unsigned int i=1;i<N;i++){
+    for (int i=1;i<N;i++){
         eta[i] = eta[i-1] + ps[i].m;
         m_j[i] = ps[i].m*eta[i-1]/eta[i];
     }
@@ -48,13 +179,19 @@ void reb_transformations_calculate_jacobi_masses(const struct reb_particle* cons
 }
 
 void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_posvel, 6);
+        return;
+    }
+#endif // OPENMP
     double s_x = eta[0] * particles[0].x;
     double s_y = eta[0] * particles[0].y;
     double s_z = eta[0] * particles[0].z;
     double s_vx = eta[0] * particles[0].vx;
     double s_vy = eta[0] * particles[0].vy;
     double s_vz = eta[0] * particles[0].vz;
-    for (unsigned int i=1;i<N;i++){
+    for (int i=1;i<N;i++){
         const double ei = 1./eta[i-1];
         const struct reb_particle pi = particles[i];
         const double pme = eta[i]*ei;
@@ -82,6 +219,12 @@ void reb_transformations_inertial_to_jacobi_posvel(const struct reb_particle* co
 }
 
 void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_posvelacc, 9);
+        return;
+    }
+#endif // OPENMP
     double s_x = eta[0] * particles[0].x;
     double s_y = eta[0] * particles[0].y;
     double s_z = eta[0] * particles[0].z;
@@ -91,7 +234,7 @@ void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle*
     double s_ax = eta[0] * particles[0].ax;
     double s_ay = eta[0] * particles[0].ay;
     double s_az = eta[0] * particles[0].az;
-    for (unsigned int i=1;i<N;i++){
+    for (int i=1;i<N;i++){
         const double ei = 1./eta[i-1];
         const struct reb_particle pi = particles[i];
         const double pme = eta[i]*ei;
@@ -128,10 +271,16 @@ void reb_transformations_inertial_to_jacobi_posvelacc(const struct reb_particle*
 }
 
 void reb_transformations_inertial_to_jacobi_acc(const struct reb_particle* const particles, struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_inertial_to_jacobi_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_acc, 3);
+        return;
+    }
+#endif // OPENMP
     double s_ax = eta[0] * particles[0].ax;
     double s_ay = eta[0] * particles[0].ay;
     double s_az = eta[0] * particles[0].az;
-    for (unsigned int i=1;i<N;i++){
+    for (int i=1;i<N;i++){
         const double ei = 1./eta[i-1];
         const struct reb_particle pi = particles[i];
         const double pme = eta[i]*ei;
@@ -150,6 +299,12 @@ void reb_transformations_inertial_to_jacobi_acc(const struct reb_particle* const
 }
 
 void reb_transformations_jacobi_to_inertial_posvel(struct reb_particle* const particles, const struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_posvel, 6);
+        return;
+    }
+#endif // OPENMP
     const double Mtotal  = eta[N-1];
     double s_x  = p_j[0].x  * Mtotal;
     double s_y  = p_j[0].y  * Mtotal;
@@ -189,6 +344,12 @@ void reb_transformations_jacobi_to_inertial_posvel(struct reb_particle* const pa
 }
 
 void reb_transformations_jacobi_to_inertial_pos(struct reb_particle* const particles, const struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_pos, 3);
+        return;
+    }
+#endif // OPENMP
     const double Mtotal  = eta[N-1];
     double s_x  = p_j[0].x  * Mtotal;
     double s_y  = p_j[0].y  * Mtotal;
@@ -213,6 +374,12 @@ void reb_transformations_jacobi_to_inertial_pos(struct reb_particle* const parti
 }
 
 void reb_transformations_jacobi_to_inertial_acc(struct reb_particle* const particles, const struct reb_particle* const p_j, const double* const eta, const struct reb_particle* const p_mass, const int N){
+#ifdef OPENMP
+    if (reb_transformations_use_parallel(N)){
+        reb_transformations_jacobi_to_inertial_scan(particles, p_j, eta, p_mass, N, reb_transformations_fields_acc, 3);
+        return;
+    }
+#endif // OPENMP
     const double Mtotal  = eta[N-1];
     double s_ax  = p_j[0].ax  * Mtotal;
     double s_ay  = p_j[0].ay  * Mtotal;
@@ -240,59 +407,67 @@ void reb_transformations_jacobi_to_inertial_acc(struct reb_particle* const parti
  * Democratic heliocentric.   */
 
 void reb_transformations_inertial_to_democratic_heliocentric_posvel(const struct reb_particle* const particles, struct reb_particle* const p_h, const int N){
-    p_h[0].x  = 0.;
-    p_h[0].y  = 0.;
-    p_h[0].z  = 0.;
-    p_h[0].vx = 0.;
-    p_h[0].vy = 0.;
-    p_h[0].vz = 0.;
-    p_h[0].m  = 0.;
-    for (unsigned int i=0;i<N;i++){
-        double m = particles[i].m;
-        p_h[0].x  += particles[i].x *m;
-        p_h[0].y  += particles[i].y *m;
-        p_h[0].z  += particles[i].z *m;
-        p_h[0].vx += particles[i].vx*m;
-        p_h[0].vy += particles[i].vy*m;
-        p_h[0].vz += particles[i].vz*m;
-        p_h[0].m  += m;
+    // Centre of mass. Summed sequentially so that the result does not depend on the compiler.
+    double x = 0., y = 0., z = 0., vx = 0., vy = 0., vz = 0., mtot = 0.;
+    for (int i=0;i<N;i++){
+        const double m = particles[i].m;
+        x  += particles[i].x *m;
+        y  += particles[i].y *m;
+        z  += particles[i].z *m;
+        vx += particles[i].vx*m;
+        vy += particles[i].vy*m;
+        vz += particles[i].vz*m;
+        mtot += m;
     }
-    double mtot = p_h[0].m;
-    p_h[0].x  /= mtot;
-    p_h[0].y  /= mtot;
-    p_h[0].z  /= mtot;
-    p_h[0].vx /= mtot;
-    p_h[0].vy /= mtot;
-    p_h[0].vz /= mtot;
+    p_h[0].x  = x /mtot;
+    p_h[0].y  = y /mtot;
+    p_h[0].z  = z /mtot;
+    p_h[0].vx = vx/mtot;
+    p_h[0].vy = vy/mtot;
+    p_h[0].vz = vz/mtot;
+    p_h[0].m  = mtot;
     
     const double m0 = particles[0].m;
-    for (unsigned int i=1;i<N;i++){
-        p_h[i].x  = particles[i].x  - particles[0].x ;
-        p_h[i].y  = particles[i].y  - particles[0].y ;
-        p_h[i].z  = particles[i].z  - particles[0].z ;
-        double mf = m0 + particles[i].m;
-        p_h[i].vx = mf*(particles[i].vx - p_h[0].vx)/m0;
-        p_h[i].vy = mf*(particles[i].vy - p_h[0].vy)/m0;
-        p_h[i].vz = mf*(particles[i].vz - p_h[0].vz)/m0;
+    const double m0i = 1./m0;
+    const double x0 = particles[0].x;
+    const double y0 = particles[0].y;
+    const double z0 = particles[0].z;
+    const double vxcom = p_h[0].vx;
+    const double vycom = p_h[0].vy;
+    const double vzcom = p_h[0].vz;
+#pragma omp parallel for simd if(N>=REB_TRANSFORMATIONS_PARALLEL_N)
+    for (int i=1;i<N;i++){
+        p_h[i].x  = particles[i].x  - x0;
+        p_h[i].y  = particles[i].y  - y0;
+        p_h[i].z  = particles[i].z  - z0;
+        const double mf = (m0 + particles[i].m)*m0i;
+        p_h[i].vx = mf*(particles[i].vx - vxcom);
+        p_h[i].vy = mf*(particles[i].vy - vycom);
+        p_h[i].vz = mf*(particles[i].vz - vzcom);
         p_h[i].m  = particles[i].m;
     }
 }
 
 void reb_transformations_democratic_heliocentric_to_inertial_pos(struct reb_particle* const particles, const struct reb_particle* const p_h, const int N){
     const double mtot = p_h[0].m;
-    particles[0].x  = p_h[0].x;
-    particles[0].y  = p_h[0].y;
-    particles[0].z  = p_h[0].z;
-    for (unsigned int i=1;i<N;i++){
-        double m = particles[i].m;
-        particles[0].x  -= p_h[i].x*m/mtot;
-        particles[0].y  -= p_h[i].y*m/mtot;
-        particles[0].z  -= p_h[i].z*m/mtot;
+    double x = 0., y = 0., z = 0.;
+    for (int i=1;i<N;i++){
+        const double m = particles[i].m;
+        x += p_h[i].x*m;
+        y += p_h[i].y*m;
+        z += p_h[i].z*m;
     }
-    for (unsigned int i=1;i<N;i++){
-        particles[i].x = p_h[i].x+particles[0].x;
-        particles[i].y = p_h[i].y+particles[0].y;
-        particles[i].z = p_h[i].z+particles[0].z;
+    const double x0 = p_h[0].x - x/mtot;
+    const double y0 = p_h[0].y - y/mtot;
+    const double z0 = p_h[0].z - z/mtot;
+    particles[0].x  = x0;
+    particles[0].y  = y0;
+    particles[0].z  = z0;
+#pragma omp parallel for simd if(N>=REB_TRANSFORMATIONS_PARALLEL_N)
+    for (int i=1;i<N;i++){
+        particles[i].x = p_h[i].x+x0;
+        particles[i].y = p_h[i].y+y0;
+        particles[i].z = p_h[i].z+z0;
     }
 }
 
@@ -300,23 +475,25 @@ void reb_transformations_democratic_heliocentric_to_inertial_posvel(struct reb_p
     reb_transformations_democratic_heliocentric_to_inertial_pos(particles,p_h,N);
     const double mtot = p_h[0].m;
     const double m0 = particles[0].m;
-    for (unsigned int i=1;i<N;i++){
-        double mf = particles[i].m + m0;
-        particles[i].vx = m0*p_h[i].vx/mf+p_h[0].vx;
-        particles[i].vy = m0*p_h[i].vy/mf+p_h[0].vy;
-        particles[i].vz = m0*p_h[i].vz/mf+p_h[0].vz;
-    }
-    particles[0].vx = p_h[0].vx*mtot;
-    particles[0].vy = p_h[0].vy*mtot;
-    particles[0].vz = p_h[0].vz*mtot;
-    for (unsigned int i=1;i<N;i++){
-        double m = particles[i].m;
-        particles[0].vx -= particles[i].vx*m;
-        particles[0].vy -= particles[i].vy*m;
-        particles[0].vz -= particles[i].vz*m;
+    const double vxcom = p_h[0].vx;
+    const double vycom = p_h[0].vy;
+    const double vzcom = p_h[0].vz;
+    double vx = 0., vy = 0., vz = 0.;
+    for (int i=1;i<N;i++){
+        const double m = particles[i].m;
+        const double mf = m0/(m + m0);
+        const double vxi = mf*p_h[i].vx+vxcom;
+        const double vyi = mf*p_h[i].vy+vycom;
+        const double vzi = mf*p_h[i].vz+vzcom;
+        particles[i].vx = vxi;
+        particles[i].vy = vyi;
+        particles[i].vz = vzi;
+        vx += vxi*m;
+        vy += vyi*m;
+        vz += vzi*m;
     }
-    particles[0].vx /= m0;
-    particles[0].vy /= m0;
-    particles[0].vz /= m0;
+    particles[0].vx = (vxcom*mtot - vx)/m0;
+    particles[0].vy = (vycom*mtot - vy)/m0;
+    particles[0].vz = (vzcom*mtot - vz)/m0;
 }
 
@@ -28,13 +28,18 @@
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
 #include "particle.h"
 #include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "collision.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
 
 
 /**
@@ -63,7 +68,342 @@ static int reb_reb_tree_get_octant_for_particle_in_cell(const struct reb_particl
   */
 static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation* const r, struct reb_treecell *node, int pt, struct reb_treecell *parent, int o);
 
+/**
+  * @brief Number of tree cells allocated at once by reb_tree_cell_alloc().
+  */
+#define REB_TREE_CELL_BLOCKSIZE 4096
+
+/**
+  * @brief Returns a new, zeroed tree cell.
+  * @details Cells are taken from the list of unused cells r->tree_cell_free. If the list
+  * is empty, a new block of REB_TREE_CELL_BLOCKSIZE cells is allocated. 
+  * @param r REBOUND simulation to operate on
+  */
+static struct reb_treecell* reb_tree_cell_alloc(struct reb_simulation* const r);
+
+/**
+  * @brief Allocates the multipole moments of all cell blocks which do not have them yet.
+  * @details Called if r->multipole_order>=2. Each cell keeps its moments when it is reused.
+  * @param r REBOUND simulation to operate on
+  */
+static void reb_tree_cell_multipoles_alloc(struct reb_simulation* const r);
+
+/**
+  * @brief Returns a cell to the list of unused cells so it can be reused.
+  * @param r REBOUND simulation to operate on
+  * @param node is the pointer to the cell that is no longer used.
+  */
+static void reb_tree_cell_free(struct reb_simulation* const r, struct reb_treecell* node);
+
+static struct reb_treecell* reb_tree_cell_alloc(struct reb_simulation* const r){
+	if (r->tree_cell_free==NULL){
+		struct reb_treecell* block = malloc(sizeof(struct reb_treecell)*REB_TREE_CELL_BLOCKSIZE);
+		r->tree_cell_blocks = realloc(r->tree_cell_blocks, sizeof(struct reb_treecell*)*(r->tree_cell_blocks_N+1));
+		r->tree_cell_blocks[r->tree_cell_blocks_N] = block;
+		r->tree_cell_multipoles = realloc(r->tree_cell_multipoles, sizeof(struct reb_treecell_multipoles*)*(r->tree_cell_blocks_N+1));
+		r->tree_cell_multipoles[r->tree_cell_blocks_N] = NULL;
+		r->tree_cell_blocks_N++;
+		for (int i=0; i<REB_TREE_CELL_BLOCKSIZE-1; i++){
+			block[i].oct[0] = &(block[i+1]);
+			block[i].mp = NULL;
+		}
+		block[REB_TREE_CELL_BLOCKSIZE-1].oct[0] = NULL;
+		block[REB_TREE_CELL_BLOCKSIZE-1].mp = NULL;
+		r->tree_cell_free = block;
+		if (r->multipole_order>=2){
+			reb_tree_cell_multipoles_alloc(r);
+		}
+	}
+	struct reb_treecell* node = r->tree_cell_free;
+	r->tree_cell_free = node->oct[0];
+	struct reb_treecell_multipoles* const mp = node->mp;
+	memset(node, 0, sizeof(struct reb_treecell));
+	node->mp = mp;
+	return node;
+}
+
+static void reb_tree_cell_multipoles_alloc(struct reb_simulation* const r){
+	for (int b=0; b<r->tree_cell_blocks_N; b++){
+		if (r->tree_cell_multipoles[b]!=NULL) continue;
+		struct reb_treecell_multipoles* const mp = malloc(sizeof(struct reb_treecell_multipoles)*REB_TREE_CELL_BLOCKSIZE);
+		struct reb_treecell* const block = r->tree_cell_blocks[b];
+		for (int i=0; i<REB_TREE_CELL_BLOCKSIZE; i++){
+			block[i].mp = &(mp[i]);
+		}
+		r->tree_cell_multipoles[b] = mp;
+	}
+}
+
+static void reb_tree_cell_free(struct reb_simulation* const r, struct reb_treecell* node){
+	node->oct[0] = r->tree_cell_free;
+	r->tree_cell_free = node;
+}
+
+/**
+  * @brief Minimum number of particles in a cell for which reb_tree_build() and 
+  * reb_tree_update_gravity_data() create a separate task for each daughter.
+  */
+#define REB_TREE_TASK_MIN 2048
+
+/**
+  * @brief Number of cells which a thread takes from the shared list of unused cells at once in reb_tree_build().
+  */
+#define REB_TREE_CELL_BATCHSIZE 256
+
+/**
+  * @brief State shared by all tasks of reb_tree_build().
+  */
+struct reb_tree_build_context {
+	struct reb_simulation* r;       ///< REBOUND simulation to operate on
+	struct reb_treecell** cache;    ///< List of unused cells for each thread (linked via oct[0])
+};
+
+/**
+  * @brief Returns a new, zeroed tree cell. Can be called from several threads at once.
+  * @details Each thread takes cells from its own list and refills it from r->tree_cell_free 
+  * in batches of REB_TREE_CELL_BATCHSIZE.
+  */
+static struct reb_treecell* reb_tree_build_cell_alloc(struct reb_tree_build_context* const bc){
+#ifdef OPENMP
+	const int thread = omp_get_thread_num();
+#else // OPENMP
+	const int thread = 0;
+#endif // OPENMP
+	if (bc->cache[thread]==NULL){
+#pragma omp critical (reb_tree_cell_alloc)
+		{
+			for (int i=0; i<REB_TREE_CELL_BATCHSIZE; i++){
+				struct reb_treecell* node = reb_tree_cell_alloc(bc->r);
+				node->oct[0] = bc->cache[thread];
+				bc->cache[thread] = node;
+			}
+		}
+	}
+	struct reb_treecell* node = bc->cache[thread];
+	bc->cache[thread] = node->oct[0];
+	node->oct[0] = NULL;
+	return node;
+}
+
+/**
+  * @brief Creates a cell containing the particles idx[0..n-1] and all its daughters.
+  * @details The particle indices are sorted into the octants of the cell using the scratch 
+  * array tmp, which then holds the indices of the daughters (the roles of the arrays are 
+  * swapped in each level). After the build, both arrays are in Morton order. Large daughters 
+  * are built in separate tasks. The geometry of the cells is the same as in 
+  * reb_tree_add_particle_to_cell().
+  * @param bc Build context
+  * @param idx Indices of the particles in this cell
+  * @param tmp Scratch array with the same length as idx
+  * @param n Number of particles, n>=1
+  * @param parent Parent cell, NULL for a root cell
+  * @param o Octant of the cell in the parent cell
+  */
+static struct reb_treecell* reb_tree_build_cell(struct reb_tree_build_context* const bc, int* const idx, int* const tmp, const int n, struct reb_treecell* const parent, const int o){
+	struct reb_simulation* const r = bc->r;
+	struct reb_particle* const particles = r->particles;
+	struct reb_treecell* const node = reb_tree_build_cell_alloc(bc);
+	if (parent == NULL){ // The new node is a root
+		const struct reb_particle p = particles[idx[0]];
+		node->w = r->root_size;
+		int i = (((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx+r->root_nx)%r->root_nx;
+		int j = (((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny+r->root_ny)%r->root_ny;
+		int k = (((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz+r->root_nz)%r->root_nz;
+		node->x = -r->boxsize.x/2.+r->root_size*(0.5+(double)i);
+		node->y = -r->boxsize.y/2.+r->root_size*(0.5+(double)j);
+		node->z = -r->boxsize.z/2.+r->root_size*(0.5+(double)k);
+	}else{ // The new node is a normal node
+		node->w 	= parent->w/2.;
+		node->x 	= parent->x + node->w/2.*((o>>0)%2==0?1.:-1);
+		node->y 	= parent->y + node->w/2.*((o>>1)%2==0?1.:-1);
+		node->z 	= parent->z + node->w/2.*((o>>2)%2==0?1.:-1);
+	}
+	if (n==1){ // Leaf
+		node->pt = idx[0];
+		particles[idx[0]].c = node;
+		return node;
+	}
+	node->pt = -n;
+	int count[8] = {0};
+	for (int l=0; l<n; l++){
+		count[reb_reb_tree_get_octant_for_particle_in_cell(particles[idx[l]], node)]++;
+	}
+	int offset[8];
+	offset[0] = 0;
+	for (int d=1; d<8; d++){
+		offset[d] = offset[d-1] + count[d-1];
+	}
+	int fill[8];
+	memcpy(fill, offset, sizeof(int)*8);
+	for (int l=0; l<n; l++){
+		tmp[fill[reb_reb_tree_get_octant_for_particle_in_cell(particles[idx[l]], node)]++] = idx[l];
+	}
+	for (int d=0; d<8; d++){
+		if (count[d]==0) continue;
+#pragma omp task if(count[d]>=REB_TREE_TASK_MIN)
+		node->oct[d] = reb_tree_build_cell(bc, tmp+offset[d], idx+offset[d], count[d], node, d);
+	}
+#pragma omp taskwait
+	return node;
+}
+
+/**
+  * @brief Returns the number of particles which are added to the tree.
+  * @details This is the number of real particles (variational particles are never part 
+  * of the tree), or r->N_active if tree_active_only is set. In that case the particles 
+  * with larger indices are not part of the tree.
+  */
+static int reb_tree_particles_N(struct reb_simulation* const r){
+	const int N_real = r->N - r->N_var;
+	if (r->tree_active_only==0 || r->N_active<0 || r->N_active>=N_real){
+		return N_real;
+	}
+#ifdef MPI
+	const int mpi = 1;
+#else // MPI
+	const int mpi = 0;
+#endif // MPI
+	if (mpi || r->gravity!=REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE || r->testparticle_type==1){
+		reb_warning(r, "tree_active_only requires REB_GRAVITY_TREE and testparticle_type=0 and is not compatible with REB_COLLISION_TREE and MPI. All particles are added to the tree.");
+		r->tree_active_only = 0;
+		return N_real;
+	}
+	return r->N_active;
+}
+
+void reb_tree_build(struct reb_simulation* const r){
+	if (r->root_size==-1){
+		reb_error(r, "Cannot build the tree. The simulation box has not been configured.");
+		return;
+	}
+	// Remove particles flagged for removal.
+	for (int i=0; i<r->N; i++){
+		if (isnan(r->particles[i].y)){
+			reb_particle_lookup_table_remove(r, i);
+			(r->N)--;
+			r->particles[i] = r->particles[r->N];
+			if (i<r->N){
+				reb_particle_lookup_table_set(r, i);
+			}
+			i--;
+		}
+	}
+	// Put all cells back into the list of unused cells.
+	r->tree_cell_free = NULL;
+	for (int b=r->tree_cell_blocks_N-1; b>=0; b--){
+		struct reb_treecell* const block = r->tree_cell_blocks[b];
+		for (int i=REB_TREE_CELL_BLOCKSIZE-1; i>=0; i--){
+			block[i].oct[0] = r->tree_cell_free;
+			r->tree_cell_free = &(block[i]);
+		}
+	}
+	if (r->tree_root==NULL){
+		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
+	}
+	const int N = reb_tree_particles_N(r);
+	const int root_n = r->root_n;
+	for (int i=N; i<r->N; i++){
+		r->particles[i].c = NULL;
+	}
+	// Sort particles by root box.
+	int* const rootbox = malloc(sizeof(int)*N);
+	int* const count = calloc(root_n+1,sizeof(int));
+	for (int i=0; i<N; i++){
+		rootbox[i] = reb_get_rootbox_for_particle(r, r->particles[i]);
+		count[rootbox[i]+1]++;
+	}
+	for (int i=0; i<root_n; i++){
+		count[i+1] += count[i];
+	}
+	int* const idx = malloc(sizeof(int)*N);
+	int* const tmp = malloc(sizeof(int)*N);
+	int* const fill = malloc(sizeof(int)*root_n);
+	memcpy(fill, count, sizeof(int)*root_n);
+	for (int i=0; i<N; i++){
+		idx[fill[rootbox[i]]++] = i;
+	}
+#ifdef OPENMP
+	const int Nthreads = omp_get_max_threads();
+#else // OPENMP
+	const int Nthreads = 1;
+#endif // OPENMP
+	struct reb_tree_build_context bc = {.r = r, .cache = calloc(Nthreads, sizeof(struct reb_treecell*))};
+#pragma omp parallel
+#pragma omp single
+	for (int i=0; i<root_n; i++){
+		r->tree_root[i] = NULL;
+		const int n = count[i+1]-count[i];
+#ifdef MPI
+		// Do not add particles that do not belong to this tree
+		if (reb_communication_mpi_rootbox_is_local(r, i)==0) continue;
+#endif // MPI
+		if (n==0) continue;
+#pragma omp task
+		r->tree_root[i] = reb_tree_build_cell(&bc, idx+count[i], tmp+count[i], n, NULL, 0);
+	}
+	// Return unused cells.
+	for (int t=0; t<Nthreads; t++){
+		while (bc.cache[t]!=NULL){
+			struct reb_treecell* node = bc.cache[t];
+			bc.cache[t] = node->oct[0];
+			reb_tree_cell_free(r, node);
+		}
+	}
+	free(bc.cache);
+	free(fill);
+	free(tmp);
+	free(idx);
+	free(count);
+	free(rootbox);
+	r->tree_needs_update = 0;
+}
+
+void reb_tree_get_cells(const struct reb_simulation* const r, double* const cells){
+	const struct reb_particle* const particles = r->particles;
+	for (int i=0; i<r->N; i++){
+		const struct reb_treecell* const c = particles[i].c;
+		if (c!=NULL && c->pt==i){
+			cells[3*i+0] = c->x;
+			cells[3*i+1] = c->y;
+			cells[3*i+2] = c->z;
+		}else{
+			// Not part of the tree. The next update rebuilds the tree (see reb_tree_add_particle_to_tree()).
+			// A particle flagged for removal must not be removed by reb_tree_build_from_cells().
+			cells[3*i+0] = particles[i].x;
+			cells[3*i+1] = isnan(particles[i].y)?0.:particles[i].y;
+			cells[3*i+2] = particles[i].z;
+		}
+	}
+}
+
+void reb_tree_build_from_cells(struct reb_simulation* const r, const double* const cells){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	double* const x = malloc(sizeof(double)*3*N);
+	for (int i=0; i<N; i++){
+		x[3*i+0] = particles[i].x;
+		x[3*i+1] = particles[i].y;
+		x[3*i+2] = particles[i].z;
+		particles[i].x = cells[3*i+0];
+		particles[i].y = cells[3*i+1];
+		particles[i].z = cells[3*i+2];
+	}
+	reb_tree_build(r); // No particle is removed, all y are finite.
+	for (int i=0; i<N; i++){
+		particles[i].x = x[3*i+0];
+		particles[i].y = x[3*i+1];
+		particles[i].z = x[3*i+2];
+	}
+	free(x);
+}
+
 void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt){
+	if (r->tree_active_only || r->N_var){
+		// The tree is rebuilt in the next update.
+		r->particles[pt].c = NULL;
+		r->tree_needs_update = 1;
+		return;
+	}
 	if (r->tree_root==NULL){
 		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
 	}
@@ -71,9 +411,7 @@ void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt){
 	int rootbox = reb_get_rootbox_for_particle(r, p);
 #ifdef MPI
 	// Do not add particles that do not belong to this tree (avoid removing active particles)
-	int root_n_per_node = r->root_n/r->mpi_num;
-	int proc_id = rootbox/root_n_per_node;
-	if (proc_id!=r->mpi_id) return;
+	if (reb_communication_mpi_rootbox_is_local(r, rootbox)==0) return;
 #endif 	// MPI
 	r->tree_root[rootbox] = reb_tree_add_particle_to_cell(r, r->tree_root[rootbox],pt,NULL,0);
 }
@@ -82,13 +420,13 @@ static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation*
 	struct reb_particle* const particles = r->particles;
 	// Initialize a new node
 	if (node == NULL) {  
-		node = calloc(1, sizeof(struct reb_treecell));
+		node = reb_tree_cell_alloc(r);
 		struct reb_particle p = particles[pt];
 		if (parent == NULL){ // The new node is a root
 			node->w = r->root_size;
-			int i = ((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx;
-			int j = ((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny;
-			int k = ((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz;
+			int i = (((int)floor((p.x + r->boxsize.x/2.)/r->root_size))%r->root_nx+r->root_nx)%r->root_nx;
+			int j = (((int)floor((p.y + r->boxsize.y/2.)/r->root_size))%r->root_ny+r->root_ny)%r->root_ny;
+			int k = (((int)floor((p.z + r->boxsize.z/2.)/r->root_size))%r->root_nz+r->root_nz)%r->root_nz;
 			node->x = -r->boxsize.x/2.+r->root_size*(0.5+(double)i);
 			node->y = -r->boxsize.y/2.+r->root_size*(0.5+(double)j);
 			node->z = -r->boxsize.z/2.+r->root_size*(0.5+(double)k);
@@ -176,12 +514,12 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 		}
 		// Check if the node requires derefinement.
 		if (node->pt == 0) {	// The node is empty.
-			free(node);
+			reb_tree_cell_free(r, node);
 			return NULL;
 		} else if (node->pt == -1) { // The node becomes a leaf.
 			node->pt = node->oct[test]->pt;
 			r->particles[node->pt].c = node;
-			free(node->oct[test]);
+			reb_tree_cell_free(r, node->oct[test]);
 			node->oct[test]=NULL;
 			return node;
 		}
@@ -191,13 +529,20 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 	if (reb_tree_particle_is_inside_cell(r, node) == 0) {
 		int oldpos = node->pt;
 		struct reb_particle reinsertme = r->particles[oldpos];
+		reb_particle_lookup_table_remove(r, oldpos);
 		(r->N)--;
+		// The particle is added again at the end of the array below.
+		reb_collision_verlet_list_swap(r, oldpos, r->N);
+		reb_collision_sleep_remove(r, oldpos, 0);
 		r->particles[oldpos] = r->particles[r->N];
 		r->particles[oldpos].c->pt = oldpos;
+		if (oldpos<r->N){
+			reb_particle_lookup_table_set(r, oldpos);
+		}
         if (!isnan(reinsertme.y)){ // Do not reinsert if flagged for removal
 		    reb_add(r, reinsertme);
         }
-		free(node);
+		reb_tree_cell_free(r, node);
 		return NULL; 
 	} else {
 		r->particles[node->pt].c = node;
@@ -206,17 +551,13 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 }
 
 /**
-  * @brief The function calculates the total mass and center of mass of a node. When QUADRUPOLE is defined, it also calculates the mass quadrupole tensor for all non-leaf nodes.
+  * @brief The function calculates the total mass and center of mass of a node. If r->multipole_order>=2, it also calculates the mass quadrupole tensor for all non-leaf nodes. If r->multipole_order>=3, it also calculates the third moments of mass.
   */
 static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* const r, struct reb_treecell *node){
-#ifdef QUADRUPOLE
-	node->mxx = 0;
-	node->mxy = 0;
-	node->mxz = 0;
-	node->myy = 0;
-	node->myz = 0;
-	node->mzz = 0;
-#endif // QUADRUPOLE
+	const int order = r->multipole_order;
+	if (order>=2){
+		*(node->mp) = (struct reb_treecell_multipoles){0};
+	}
 	if (node->pt < 0) {
 		// Non-leaf nodes	
 		node->m  = 0;
@@ -226,7 +567,14 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 		for (int o=0; o<8; o++) {
 			struct reb_treecell* d = node->oct[o];
 			if (d!=NULL){
+#pragma omp task if(-d->pt>=REB_TREE_TASK_MIN)
 				reb_tree_update_gravity_data_in_cell(r, d);
+			}
+		}
+#pragma omp taskwait
+		for (int o=0; o<8; o++) {
+			struct reb_treecell* d = node->oct[o];
+			if (d!=NULL){
 				// Calculate the total mass and the center of mass
 				double d_m = d->m;
 				node->mx += d->mx*d_m;
@@ -241,25 +589,47 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 			node->my /= m_tot;
 			node->mz /= m_tot;
 		}
-#ifdef QUADRUPOLE
-		for (int o=0; o<8; o++) {
-			struct reb_treecell* d = node->oct[o];
-			if (d!=NULL){
-				// Ref: Hernquist, L., 1987, APJS
-				double d_m = d->m;
-				double qx  = d->mx - node->mx;
-				double qy  = d->my - node->my;
-				double qz  = d->mz - node->mz;
-				double qr2 = qx*qx + qy*qy + qz*qz;
-				node->mxx += d->mxx + d_m*(3.*qx*qx - qr2);
-				node->mxy += d->mxy + d_m*3.*qx*qy;
-				node->mxz += d->mxz + d_m*3.*qx*qz;
-				node->myy += d->myy + d_m*(3.*qy*qy - qr2);
-				node->myz += d->myz + d_m*3.*qy*qz;
+		if (order>=2){
+			struct reb_treecell_multipoles* const mp = node->mp;
+			for (int o=0; o<8; o++) {
+				struct reb_treecell* d = node->oct[o];
+				if (d!=NULL){
+					const struct reb_treecell_multipoles* const dp = d->mp;
+					// Ref: Hernquist, L., 1987, APJS
+					double d_m = d->m;
+					double qx  = d->mx - node->mx;
+					double qy  = d->my - node->my;
+					double qz  = d->mz - node->mz;
+					double qr2 = qx*qx + qy*qy + qz*qz;
+					mp->mxx += dp->mxx + d_m*(3.*qx*qx - qr2);
+					mp->mxy += dp->mxy + d_m*3.*qx*qy;
+					mp->mxz += dp->mxz + d_m*3.*qx*qz;
+					mp->myy += dp->myy + d_m*(3.*qy*qy - qr2);
+					mp->myz += dp->myz + d_m*3.*qy*qz;
+					if (order>=3){
+						// Second moments of the daughter about its center of mass
+						const double pxx = (dp->mxx + dp->mr2)/3.;
+						const double pxy = dp->mxy/3.;
+						const double pxz = dp->mxz/3.;
+						const double pyy = (dp->myy + dp->mr2)/3.;
+						const double pyz = dp->myz/3.;
+						const double pzz = (-dp->mxx - dp->myy + dp->mr2)/3.;
+						mp->mr2  += dp->mr2 + d_m*qr2;
+						mp->mxxx += dp->mxxx + 3.*qx*pxx + d_m*qx*qx*qx;
+						mp->mxxy += dp->mxxy + 2.*qx*pxy + qy*pxx + d_m*qx*qx*qy;
+						mp->mxxz += dp->mxxz + 2.*qx*pxz + qz*pxx + d_m*qx*qx*qz;
+						mp->mxyy += dp->mxyy + 2.*qy*pxy + qx*pyy + d_m*qx*qy*qy;
+						mp->mxyz += dp->mxyz + qx*pyz + qy*pxz + qz*pxy + d_m*qx*qy*qz;
+						mp->mxzz += dp->mxzz + 2.*qz*pxz + qx*pzz + d_m*qx*qz*qz;
+						mp->myyy += dp->myyy + 3.*qy*pyy + d_m*qy*qy*qy;
+						mp->myyz += dp->myyz + 2.*qy*pyz + qz*pyy + d_m*qy*qy*qz;
+						mp->myzz += dp->myzz + 2.*qz*pyz + qy*pzz + d_m*qy*qz*qz;
+						mp->mzzz += dp->mzzz + 3.*qz*pzz + d_m*qz*qz*qz;
+					}
+				}
 			}
+			mp->mzz = -mp->mxx -mp->myy;
 		}
-		node->mzz = -node->mxx -node->myy;
-#endif // QUADRUPOLE
 	}else{ 
 		// Leaf nodes
 		struct reb_particle p = r->particles[node->pt];
@@ -271,11 +641,18 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 }
 
 void reb_tree_update_gravity_data(struct reb_simulation* const r){
+	if (r->multipole_order>=2){
+		// multipole_order might have been changed after the cells were allocated.
+		reb_tree_cell_multipoles_alloc(r);
+	}
+#pragma omp parallel
+#pragma omp single
 	for(int i=0;i<r->root_n;i++){
 #ifdef MPI
 		if (reb_communication_mpi_rootbox_is_local(r, i)==1){
 #endif // MPI
 			if (r->tree_root[i]!=NULL){
+#pragma omp task
 				reb_tree_update_gravity_data_in_cell(r, r->tree_root[i]);
 			}
 #ifdef MPI
@@ -284,7 +661,269 @@ void reb_tree_update_gravity_data(struct reb_simulation* const r){
 	}
 }
 
+/**
+  * @brief Appends the particle indices of all leaves of a cell to r->tree_flat_order.
+  * @param r REBOUND simulation to operate on
+  * @param node is the pointer to a node cell
+  */
+static void reb_tree_flatten_bucket(struct reb_simulation* const r, struct reb_treecell *node){
+	if (node->pt < 0){
+		for (int o=0; o<8; o++) {
+			if (node->oct[o]!=NULL){
+				reb_tree_flatten_bucket(r, node->oct[o]);
+			}
+		}
+	}else{
+		r->tree_flat_order[r->tree_flat_order_N++] = node->pt;
+	}
+}
+
+/**
+  * @brief Appends a cell and all its daughters to r->tree_flat.
+  * @param r REBOUND simulation to operate on
+  * @param node is the pointer to a node cell
+  * @param local If set to 1, the particle indices of the leaves are added to r->tree_flat_order.
+  * @param ingroup Set to 1 if one of the parents of this cell is already a group.
+  * @param leaf_size Cells with at most this many particles are stored as leaf buckets if local is set.
+  */
+static void reb_tree_flatten_cell(struct reb_simulation* const r, struct reb_treecell *node, const int local, int ingroup, const int leaf_size){
+	if (r->tree_flat_N>=r->tree_flat_allocatedN){
+		r->tree_flat_allocatedN = r->tree_flat_allocatedN?2*r->tree_flat_allocatedN:1024;
+		r->tree_flat = realloc(r->tree_flat, sizeof(struct reb_treecell_flat)*r->tree_flat_allocatedN);
+		if (r->multipole_order>=2 || r->tree_flat_multipoles!=NULL){
+			r->tree_flat_multipoles = realloc(r->tree_flat_multipoles, sizeof(struct reb_treecell_multipoles)*r->tree_flat_allocatedN);
+		}
+	}
+	const int c = r->tree_flat_N++;
+	struct reb_treecell_flat* flat = &(r->tree_flat[c]);
+	flat->mx = node->mx;
+	flat->my = node->my;
+	flat->mz = node->mz;
+	flat->m  = node->m;
+	flat->w2 = node->w*node->w;
+	if (r->multipole_order>=2){
+		r->tree_flat_multipoles[c] = *(node->mp);
+	}
+	flat->pt = node->pt;
+	const int count = node->pt<0?-node->pt:1;
+	const int bucket = local && node->pt<0 && count<=leaf_size;
+	flat->first = bucket?r->tree_flat_order_N:-1;
+	// The group walk does not descend into buckets, so a bucket is always (part of) a group.
+	if (local && !ingroup && r->tree_group_size>0 && (count<=r->tree_group_size || bucket)){
+		if (r->tree_groups_N>=r->tree_groups_allocatedN){
+			r->tree_groups_allocatedN = r->tree_groups_allocatedN?2*r->tree_groups_allocatedN:128;
+			r->tree_groups = realloc(r->tree_groups, sizeof(struct reb_treegroup)*r->tree_groups_allocatedN);
+		}
+		struct reb_treegroup* group = &(r->tree_groups[r->tree_groups_N++]);
+		group->cell = c;
+		group->first = r->tree_flat_order_N;
+		group->N = count;
+		ingroup = 1;
+	}
+	if (bucket){
+		reb_tree_flatten_bucket(r, node);
+	}else if (node->pt < 0){
+		for (int o=0; o<8; o++) {
+			if (node->oct[o]!=NULL){
+				reb_tree_flatten_cell(r, node->oct[o], local, ingroup, leaf_size);
+			}
+		}
+	}else if (local){
+		r->tree_flat_order[r->tree_flat_order_N++] = node->pt;
+	}
+	// Array might have been reallocated.
+	r->tree_flat[c].next = r->tree_flat_N;
+}
+
+void reb_tree_flatten(struct reb_simulation* const r){
+	r->tree_flat_N = 0;
+	r->tree_flat_order_N = 0;
+	r->tree_groups_N = 0;
+	if (r->tree_root==NULL){
+		return;
+	}
+	if (r->multipole_order>=2 && r->tree_flat_multipoles==NULL && r->tree_flat_allocatedN>0){
+		r->tree_flat_multipoles = malloc(sizeof(struct reb_treecell_multipoles)*r->tree_flat_allocatedN);
+	}
+	// With leaf buckets there are fewer cells than particles.
+	if (r->tree_flat_order_allocatedN<r->N){
+		r->tree_flat_order_allocatedN = r->N;
+		r->tree_flat_order = realloc(r->tree_flat_order, sizeof(int)*r->tree_flat_order_allocatedN);
+	}
+	// The FMM passes need one particle per leaf.
+	const int leaf_size = r->gravity==REB_GRAVITY_FMM?1:r->tree_leaf_size;
+	for(int i=0;i<r->root_n;i++){
+		if (r->tree_root[i]!=NULL){
+#ifdef MPI
+			const int local = reb_communication_mpi_rootbox_is_local(r, i);
+#else // MPI
+			const int local = 1;
+#endif // MPI
+			reb_tree_flatten_cell(r, r->tree_root[i], local, 0, leaf_size);
+		}
+	}
+}
+
+#ifndef MPI
+/**
+  * @brief Particles collected during reb_tree_update_refit().
+  */
+struct reb_tree_refit_context {
+	int* pending;           ///< Particles which left their cell and have not been reinserted yet
+	int pending_N;          ///< Number of entries in pending
+	int pending_allocatedN; ///< Allocated length of pending
+	int* removed;           ///< Particles flagged for removal
+	int removed_N;          ///< Number of entries in removed
+	int removed_allocatedN; ///< Allocated length of removed
+};
+
+static void reb_tree_refit_push(int** list, int* N, int* allocatedN, const int pt){
+	if (*N>=*allocatedN){
+		*allocatedN = *allocatedN?2*(*allocatedN):128;
+		*list = realloc(*list, sizeof(int)*(*allocatedN));
+	}
+	(*list)[(*N)++] = pt;
+}
+
+static int reb_tree_refit_compare_descending(const void* a, const void* b){
+	return *(const int*)b - *(const int*)a;
+}
+
+/**
+  * @brief Same as reb_tree_update_cell() but particles which left their cell are not removed from the particle array.
+  * @details Leaves of such particles are removed and the particles are collected in rc->pending. 
+  * Once the walk returns to a cell which contains a pending particle, the particle is inserted into 
+  * that cell. Particles therefore only move to nearby cells. Particles flagged for removal are 
+  * collected in rc->removed.
+  * @param r REBOUND simulation to operate on
+  * @param rc Refit context
+  * @param node is the pointer to a node cell
+  */
+static struct reb_treecell *reb_tree_refit_cell(struct reb_simulation* const r, struct reb_tree_refit_context* const rc, struct reb_treecell *node){
+	int test = -1;
+	if (node == NULL) {
+		return NULL;
+	}
+	// Leaf nodes
+	if (node->pt >= 0) {
+		if (isnan(r->particles[node->pt].y)){
+			reb_tree_refit_push(&rc->removed, &rc->removed_N, &rc->removed_allocatedN, node->pt);
+			reb_tree_cell_free(r, node);
+			return NULL;
+		}
+		if (reb_tree_particle_is_inside_cell(r, node) == 0) {
+			reb_tree_refit_push(&rc->pending, &rc->pending_N, &rc->pending_allocatedN, node->pt);
+			reb_tree_cell_free(r, node);
+			return NULL;
+		}
+		r->particles[node->pt].c = node;
+		return node;
+	}
+	// Non-leaf nodes	
+	const int start = rc->pending_N;
+	for (int o=0; o<8; o++) {
+		node->oct[o] = reb_tree_refit_cell(r, rc, node->oct[o]);
+	}
+	// Reinsert particles which are now in this cell.
+	int keep = start;
+	for (int k=start; k<rc->pending_N; k++){
+		const int pt = rc->pending[k];
+		const struct reb_particle p = r->particles[pt];
+		if (fabs(p.x-node->x) > node->w/2. || fabs(p.y-node->y) > node->w/2. || fabs(p.z-node->z) > node->w/2.){
+			rc->pending[keep++] = pt;
+		}else{
+			reb_tree_add_particle_to_cell(r, node, pt, NULL, 0);
+		}
+	}
+	rc->pending_N = keep;
+	node->pt = 0;
+	for (int o=0; o<8; o++) {
+		struct reb_treecell *d = node->oct[o];
+		if (d != NULL) {
+			if (d->pt >= 0) {
+				node->pt--;
+				test = o;
+			}else{
+				node->pt += d->pt;
+			}
+		}
+	}
+	// Check if the node requires derefinement.
+	if (node->pt == 0) {
+		reb_tree_cell_free(r, node);
+		return NULL;
+	} else if (node->pt == -1) {
+		node->pt = node->oct[test]->pt;
+		r->particles[node->pt].c = node;
+		reb_tree_cell_free(r, node->oct[test]);
+		node->oct[test]=NULL;
+	}
+	return node;
+}
+
+/**
+  * @brief Updates the tree without changing the order of particles (used if r->tree_refit=1).
+  * @details First checks whether any particle has left its cell. If not, the tree is not walked.
+  * Otherwise, see reb_tree_refit_cell(). Particles flagged for removal are removed at the end.
+  * @param r REBOUND simulation to operate on
+  */
+static void reb_tree_update_refit(struct reb_simulation* const r){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	int moved = 0;
+#pragma omp parallel for reduction(+:moved)
+	for (int i=0; i<N; i++){
+		const struct reb_treecell* const c = particles[i].c;
+		if (c==NULL || c->pt!=i || isnan(particles[i].y)
+				|| fabs(particles[i].x-c->x) > c->w/2. 
+				|| fabs(particles[i].y-c->y) > c->w/2. 
+				|| fabs(particles[i].z-c->z) > c->w/2.){
+			moved++;
+		}
+	}
+	if (moved==0){
+		return;
+	}
+	struct reb_tree_refit_context rc = {0};
+	for(int i=0;i<r->root_n;i++){
+		r->tree_root[i] = reb_tree_refit_cell(r, &rc, r->tree_root[i]);
+	}
+	// Particles which left their root box.
+	for (int k=0; k<rc.pending_N; k++){
+		reb_tree_add_particle_to_tree(r, rc.pending[k]);
+	}
+	// Remove flagged particles, starting with the largest index. All particles with a 
+	// larger index are not flagged, so the last particle can be moved into the gap.
+	qsort(rc.removed, rc.removed_N, sizeof(int), reb_tree_refit_compare_descending);
+	for (int k=0; k<rc.removed_N; k++){
+		const int oldpos = rc.removed[k];
+		reb_particle_lookup_table_remove(r, oldpos);
+		(r->N)--;
+		if (oldpos!=r->N){
+			r->particles[oldpos] = r->particles[r->N];
+			r->particles[oldpos].c->pt = oldpos;
+			reb_particle_lookup_table_set(r, oldpos);
+		}
+	}
+	free(rc.pending);
+	free(rc.removed);
+}
+#endif // MPI
+
 void reb_tree_update(struct reb_simulation* const r){
+	if (r->tree_rebuild || r->tree_active_only || r->N_var || (r->tree_root==NULL && r->N>0)){
+		// With tree_active_only, moving particles between cells would mix active and test particles.
+		// Variational particles are appended to the real particles and have to be left out.
+		reb_tree_build(r);
+		return;
+	}
+#ifndef MPI
+	if (r->tree_refit && r->tree_root!=NULL){
+		reb_tree_update_refit(r);
+		r->tree_needs_update= 0;
+		return;
+	}
+#endif // MPI
 	if (r->tree_root==NULL){
 		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
 	}
@@ -300,22 +939,252 @@ void reb_tree_update(struct reb_simulation* const r){
 	}
     r->tree_needs_update= 0;
 }
-static void reb_tree_delete_cell(struct reb_treecell* node){
-	if (node==NULL){
+void reb_tree_delete(struct reb_simulation* const r){
+	// All cells are allocated in blocks. No need to walk the tree.
+	for (int i=0; i<r->tree_cell_blocks_N; i++){
+		free(r->tree_cell_blocks[i]);
+		free(r->tree_cell_multipoles[i]);
+	}
+	free(r->tree_cell_blocks);
+	free(r->tree_cell_multipoles);
+	r->tree_cell_blocks = NULL;
+	r->tree_cell_multipoles = NULL;
+	r->tree_cell_blocks_N = 0;
+	r->tree_cell_free = NULL;
+	free(r->tree_root);
+	r->tree_root = NULL;
+}
+
+/**
+ * @brief State of a neighbour query.
+ */
+struct reb_tree_query {
+	double x;                           ///< Query point, shifted by minus the ghost box shift (also y, z)
+	double y;
+	double z;
+	double r2max;                       ///< Squared search radius, or for k nearest neighbours the squared distance of the k-th neighbour found so far
+	int exclude;                        ///< Particle which is not returned, -1 for none
+	int k;                              ///< Number of neighbours for a k nearest neighbour query, 0 for a radius query
+	int found;                          ///< Number of neighbours found so far
+	int neighbours_N;                   ///< Size of neighbours
+	struct reb_neighbour* neighbours;   ///< Results. Used as a max-heap ordered by r2 for k nearest neighbour queries.
+};
+
+// Square of the distance between the query point and the closest point of cell c.
+static inline double reb_tree_query_cell_distance2(const struct reb_tree_query* const q, const struct reb_treecell* const c){
+	const double hw = 0.5*c->w;
+	double dx = fabs(q->x - c->x) - hw;
+	double dy = fabs(q->y - c->y) - hw;
+	double dz = fabs(q->z - c->z) - hw;
+	dx = dx>0.?dx:0.;
+	dy = dy>0.?dy:0.;
+	dz = dz>0.?dz:0.;
+	return dx*dx + dy*dy + dz*dz;
+}
+
+static void reb_tree_query_heap_push(struct reb_tree_query* const q, const struct reb_neighbour n){
+	struct reb_neighbour* const h = q->neighbours;
+	int i;
+	if (q->found<q->k){
+		// Sift up
+		i = q->found++;
+		while (i>0 && h[(i-1)/2].r2<n.r2){
+			h[i] = h[(i-1)/2];
+			i = (i-1)/2;
+		}
+	}else{
+		// Replace the farthest neighbour and sift down
+		i = 0;
+		while (1){
+			int l = 2*i+1;
+			if (l>=q->k) break;
+			if (l+1<q->k && h[l+1].r2>h[l].r2) l++;
+			if (h[l].r2<=n.r2) break;
+			h[i] = h[l];
+			i = l;
+		}
+	}
+	h[i] = n;
+	if (q->found==q->k){
+		q->r2max = h[0].r2;
+	}
+}
+
+static void reb_tree_query_cell(const struct reb_simulation* const r, struct reb_tree_query* const q, const struct reb_treecell* const c){
+	if (c->pt>=0){
+		// c is a leaf node
+		if (c->pt==q->exclude) return;
+		const struct reb_particle p = r->particles[c->pt];
+		struct reb_neighbour n;
+		n.index = c->pt;
+		n.dx = p.x - q->x;
+		n.dy = p.y - q->y;
+		n.dz = p.z - q->z;
+		n.r2 = n.dx*n.dx + n.dy*n.dy + n.dz*n.dz;
+		if (q->k){
+			if (q->found<q->k || n.r2<q->r2max){
+				reb_tree_query_heap_push(q, n);
+			}
+		}else if (n.r2<=q->r2max){
+			if (q->found<q->neighbours_N){
+				q->neighbours[q->found] = n;
+			}
+			q->found++;
+		}
 		return;
 	}
-	for (int o=0; o<8; o++) {
-		reb_tree_delete_cell(node->oct[o]);
+	if (reb_tree_query_cell_distance2(q, c)>q->r2max) return;
+	if (q->k==0){
+		for (int o=0;o<8;o++){
+			if (c->oct[o]!=NULL){
+				reb_tree_query_cell(r, q, c->oct[o]);
+			}
+		}
+		return;
+	}
+	// Open the closest daughters first so that the search radius shrinks quickly.
+	double d2[8];
+	int order[8];
+	int n = 0;
+	for (int o=0;o<8;o++){
+		const struct reb_treecell* const d = c->oct[o];
+		if (d==NULL) continue;
+		const double d2o = d->pt>=0?0.:reb_tree_query_cell_distance2(q, d);
+		int i = n++;
+		while (i>0 && d2[i-1]>d2o){
+			d2[i] = d2[i-1];
+			order[i] = order[i-1];
+			i--;
+		}
+		d2[i] = d2o;
+		order[i] = o;
+	}
+	for (int i=0;i<n;i++){
+		if (d2[i]>q->r2max) break;
+		reb_tree_query_cell(r, q, c->oct[order[i]]);
 	}
 }
 
-void reb_tree_delete(struct reb_simulation* const r){
-	if (r->tree_root!=NULL){
-		for(int i=0;i<r->root_n;i++){
-			reb_tree_delete_cell(r->tree_root[i]);
+// Runs a query on all local root boxes and ghost boxes.
+static int reb_tree_query(struct reb_simulation* const r, const double x, const double y, const double z, struct reb_tree_query* const q, const int exclude){
+	if (r->tree_root==NULL){
+		return -1;
+	}
+	for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+	for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+	for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+		const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx, gby, gbz);
+		q->x = x - gb.shiftx;
+		q->y = y - gb.shifty;
+		q->z = z - gb.shiftz;
+		q->exclude = (gbx==0 && gby==0 && gbz==0)?exclude:-1;
+		for (int ri=0;ri<r->root_n;ri++){
+#ifdef MPI
+			if (reb_communication_mpi_rootbox_is_local(r, ri)==0) continue;
+#endif // MPI
+			const struct reb_treecell* const root = r->tree_root[ri];
+			if (root!=NULL){
+				reb_tree_query_cell(r, q, root);
+			}
+		}
+	}
+	}
+	}
+	return q->found;
+}
+
+int reb_tree_query_radius(struct reb_simulation* const r, const double x, const double y, const double z, const double radius, const int exclude, struct reb_neighbour* const neighbours, const int neighbours_N){
+	struct reb_tree_query q = {0};
+	q.r2max = radius*radius;
+	q.neighbours = neighbours;
+	q.neighbours_N = neighbours?neighbours_N:0;
+	return reb_tree_query(r, x, y, z, &q, exclude);
+}
+
+static int reb_tree_query_compare(const void* a, const void* b){
+	const struct reb_neighbour* const na = a;
+	const struct reb_neighbour* const nb = b;
+	if (na->r2<nb->r2) return -1;
+	if (na->r2>nb->r2) return 1;
+	return na->index-nb->index;
+}
+
+int reb_tree_query_knn(struct reb_simulation* const r, const double x, const double y, const double z, const int k, const int exclude, struct reb_neighbour* const neighbours){
+	if (k<=0){
+		return 0;
+	}
+	struct reb_tree_query q = {0};
+	q.r2max = INFINITY;
+	q.k = k;
+	q.neighbours = neighbours;
+	q.neighbours_N = k;
+	const int found = reb_tree_query(r, x, y, z, &q, exclude);
+	if (found>1){
+		qsort(neighbours, found, sizeof(struct reb_neighbour), reb_tree_query_compare);
+	}
+	return found;
+}
+
+struct reb_neighbour_list* reb_tree_query_radius_all(struct reb_simulation* const r, const double radius){
+	if (r->tree_root==NULL){
+		reb_error(r, "Neighbour queries require a tree. Use a tree based gravity or collision module.");
+		return NULL;
+	}
+	const int N = r->N-r->N_var;
+	const struct reb_particle* const particles = r->particles;
+	struct reb_neighbour_list* const list = malloc(sizeof(struct reb_neighbour_list));
+	list->N = N;
+	list->start = malloc(sizeof(int)*(N+1));
+	// The tree is walked twice: once to count the neighbours, once to store them.
+#pragma omp parallel for schedule(guided)
+	for (int i=0;i<N;i++){
+		list->start[i+1] = reb_tree_query_radius(r, particles[i].x, particles[i].y, particles[i].z, radius, i, NULL, 0);
+	}
+	list->start[0] = 0;
+	for (int i=0;i<N;i++){
+		list->start[i+1] += list->start[i];
+	}
+	list->neighbours = malloc(sizeof(struct reb_neighbour)*(list->start[N]>0?list->start[N]:1));
+#pragma omp parallel for schedule(guided)
+	for (int i=0;i<N;i++){
+		reb_tree_query_radius(r, particles[i].x, particles[i].y, particles[i].z, radius, i, list->neighbours+list->start[i], list->start[i+1]-list->start[i]);
+	}
+	return list;
+}
+
+struct reb_neighbour_list* reb_tree_query_knn_all(struct reb_simulation* const r, const int k){
+	if (r->tree_root==NULL){
+		reb_error(r, "Neighbour queries require a tree. Use a tree based gravity or collision module.");
+		return NULL;
+	}
+	const int N = r->N-r->N_var;
+	const int kk = k>0?k:0;
+	const struct reb_particle* const particles = r->particles;
+	struct reb_neighbour_list* const list = malloc(sizeof(struct reb_neighbour_list));
+	list->N = N;
+	list->start = malloc(sizeof(int)*(N+1));
+	list->neighbours = malloc(sizeof(struct reb_neighbour)*((long)N*kk>0?(long)N*kk:1));
+#pragma omp parallel for schedule(guided)
+	for (int i=0;i<N;i++){
+		list->start[i+1] = reb_tree_query_knn(r, particles[i].x, particles[i].y, particles[i].z, kk, i, list->neighbours+(long)i*kk);
+	}
+	// Remove the gaps left by particles with fewer than k neighbours.
+	list->start[0] = 0;
+	for (int i=0;i<N;i++){
+		const int found = list->start[i+1];
+		if (list->start[i]!=(long)i*kk){
+			memmove(list->neighbours+list->start[i], list->neighbours+(long)i*kk, sizeof(struct reb_neighbour)*found);
 		}
-		free(r->tree_root);
+		list->start[i+1] = list->start[i] + found;
 	}
+	return list;
+}
+
+void reb_free_neighbour_list(struct reb_neighbour_list* const list){
+	if (list==NULL) return;
+	free(list->start);
+	free(list->neighbours);
+	free(list);
 }
 
 
@@ -381,7 +1250,7 @@ void reb_tree_prepare_essential_tree_for_gravity(struct reb_simulation* const r)
 			reb_communication_mpi_prepare_essential_tree_for_gravity(r, r->tree_root[i]);
 		}else{
 			// Delete essential tree reference. 
-			// Tree itself is saved in tree_essential_recv[][] and
+			// Tree itself is saved in tree_essential_cells[][] and
 			// will be overwritten the next timestep.
 			r->tree_root[i] = NULL;
 		}
@@ -393,7 +1262,7 @@ void reb_tree_prepare_essential_tree_for_collisions(struct reb_simulation* const
 			reb_communication_mpi_prepare_essential_tree_for_collisions(r, r->tree_root[i]);
 		}else{
 			// Delete essential tree reference. 
-			// Tree itself is saved in tree_essential_recv[][] and
+			// Tree itself is saved in tree_essential_cells[][] and
 			// will be overwritten the next timestep.
 			r->tree_root[i] = NULL;
 		}
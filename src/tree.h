@@ -28,6 +28,31 @@
 
 struct reb_treecell; 
 
+/**
+ * @brief Higher order multipole moments of a cell about its center of mass.
+ * @details The quadrupole moments are only calculated if r->multipole_order>=2, 
+ * the octupole moments only if r->multipole_order>=3.
+ */
+struct reb_treecell_multipoles {
+	double mxx; /**< The xx component of the quadrupole tensor of mass of a cell */
+	double mxy; /**< The xy component of the quadrupole tensor of mass of a cell */
+	double mxz; /**< The xz component of the quadrupole tensor of mass of a cell */
+	double myy; /**< The yy component of the quadrupole tensor of mass of a cell */
+	double myz; /**< The yz component of the quadrupole tensor of mass of a cell */
+	double mzz; /**< The zz component of the quadrupole tensor of mass of a cell */
+	double mxxx; /**< The xxx component of the third moment of mass of a cell */
+	double mxxy; /**< The xxy component of the third moment of mass of a cell */
+	double mxxz; /**< The xxz component of the third moment of mass of a cell */
+	double mxyy; /**< The xyy component of the third moment of mass of a cell */
+	double mxyz; /**< The xyz component of the third moment of mass of a cell */
+	double mxzz; /**< The xzz component of the third moment of mass of a cell */
+	double myyy; /**< The yyy component of the third moment of mass of a cell */
+	double myyz; /**< The yyz component of the third moment of mass of a cell */
+	double myzz; /**< The yzz component of the third moment of mass of a cell */
+	double mzzz; /**< The zzz component of the third moment of mass of a cell */
+	double mr2;  /**< Trace of the second moment of mass of a cell (sum of m*r^2). Only used to calculate the third moments. */
+};
+
 /**
  * @brief The data structure of one node of a tree 
  */
@@ -40,20 +65,45 @@ struct reb_treecell {
 	double mx; /**< The x position of the center of mass of a cell */
 	double my; /**< The y position of the center of mass of a cell */
 	double mz; /**< The z position of the center of mass of a cell */
-#ifdef QUADRUPOLE
-	double mxx; /**< The xx component of the quadrupole tensor of mass of a cell */
-	double mxy; /**< The xy component of the quadrupole tensor of mass of a cell */
-	double mxz; /**< The xz component of the quadrupole tensor of mass of a cell */
-	double myy; /**< The yy component of the quadrupole tensor of mass of a cell */
-	double myz; /**< The yz component of the quadrupole tensor of mass of a cell */
-	double mzz; /**< The zz component of the quadrupole tensor of mass of a cell */
-#endif // QUADRUPOLE
+	struct reb_treecell_multipoles* mp; /**< Higher order multipole moments of a cell. Only allocated if r->multipole_order>=2, NULL otherwise (see r->tree_cell_multipoles). */
 	struct reb_treecell *oct[8]; /**< The pointer array to the octants of a cell */
 	int pt;		/**< It has double usages: in a leaf node, it stores the index 
 			  * of a particle; in a non-leaf node, it equals to (-1)*Total 
 			  * Number of particles within that cell. */ 
 };
 
+/**
+ * @brief One cell of the flattened tree.
+ * @details The cells are stored in depth-first order in r->tree_flat. The first daughter
+ * of a non-leaf cell directly follows the cell itself. The index of the next cell which is 
+ * not a descendent of a cell is stored in next. The tree can therefore be walked with a 
+ * simple loop: go to c+1 to open a cell, go to next to skip it. The higher order 
+ * multipole moments of cell c are stored separately in r->tree_flat_multipoles[c] 
+ * if r->multipole_order>=2. If r->tree_leaf_size>1, cells with at most that many 
+ * particles are stored without their daughters as a leaf bucket. The -pt particles of 
+ * a bucket are stored contiguously in r->tree_flat_order, starting at first.
+ */
+struct reb_treecell_flat {
+	double mx; /**< The x position of the center of mass of a cell */
+	double my; /**< The y position of the center of mass of a cell */
+	double mz; /**< The z position of the center of mass of a cell */
+	double m;  /**< The total mass of a cell */
+	double w2; /**< The square of the width of a cell */
+	int pt;    /**< Same as in reb_treecell: particle index for a leaf, (-1)*number of particles otherwise. */
+	int next;  /**< Index of the next cell in tree_flat after all descendents of this cell. */
+	int first; /**< For a leaf bucket, index of its first particle in r->tree_flat_order. -1 for all other cells. */
+};
+
+/**
+ * @brief A group of particles which share one interaction list in the tree gravity calculation.
+ * @details The particles of a group are the leaves of one cell of the flattened tree.
+ */
+struct reb_treegroup {
+	int cell;  /**< Index of the cell in r->tree_flat containing all particles of this group. */
+	int first; /**< Index of the first particle of this group in r->tree_flat_order. */
+	int N;     /**< Number of particles in this group. */
+};
+
 /**
   * @brief This function updates the tree.
   * @details The tree needs to be updated when particles move, this function does that.
@@ -61,8 +111,41 @@ struct reb_treecell {
   */
 void reb_tree_update(struct reb_simulation* const r);
 
+/**
+  * @brief Builds the tree from scratch.
+  * @details All existing cells are discarded (but their memory is reused). Particles flagged 
+  * for removal are removed first. The particles are then sorted into the cells top-down. 
+  * With OpenMP, root boxes and large cells are built in parallel tasks. The tree is identical 
+  * to the one obtained by adding the particles one by one. This function is called by 
+  * reb_tree_update() if r->tree_rebuild is set or if the tree does not exist yet.
+  * @param r Rebound simulation to operate on
+  */
+void reb_tree_build(struct reb_simulation* const r);
+
+/**
+  * @brief Stores the centre of the leaf cell of each particle in cells (3*r->N entries).
+  * @details Particles which are not part of the tree store their position instead. 
+  * Together with reb_tree_build_from_cells(), this restores the tree exactly, even if 
+  * particles have left their cell since the last update.
+  * @param r Rebound simulation to operate on
+  * @param cells Output array
+  */
+void reb_tree_get_cells(const struct reb_simulation* const r, double* const cells);
+
+/**
+  * @brief Builds the tree with each particle placed at the position stored in cells.
+  * @details The particle positions are not modified. Since the tree only depends on 
+  * which cell each particle is in, the tree is the same as the one that was saved 
+  * with reb_tree_get_cells(). Particles flagged for removal stay in the tree until 
+  * the next update.
+  * @param r Rebound simulation to operate on
+  * @param cells 3*r->N positions, see reb_tree_get_cells()
+  */
+void reb_tree_build_from_cells(struct reb_simulation* const r, const double* const cells);
+
 /**
   * @brief The wrap function calls reb_tree_update_gravity_data_in_cell() for each tree.
+  * @details With OpenMP, root boxes and large cells are processed in parallel tasks.
   * @param r Rebound simulation to operate on
   */
 void reb_tree_update_gravity_data(struct reb_simulation* const r);
@@ -74,6 +157,20 @@ void reb_tree_update_gravity_data(struct reb_simulation* const r);
   */
 void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt);
 
+/**
+  * @brief Copies the tree (including the gravity data) into the contiguous array r->tree_flat. 
+  * @details The cells are stored in depth-first order. The particle indices of the leaves 
+  * in the local root boxes are stored in r->tree_flat_order in the same order. This 
+  * corresponds to a Morton (Z-order) ordering of the particles. The function needs to 
+  * be called after reb_tree_update_gravity_data(). If r->tree_group_size>0, the
+  * largest cells in the local root boxes that contain at most r->tree_group_size 
+  * particles are stored in r->tree_groups. If r->tree_leaf_size>1, the largest cells in 
+  * the local root boxes with at most r->tree_leaf_size particles become leaf buckets 
+  * (not for REB_GRAVITY_FMM). Each leaf bucket is also a group.
+  * @param r Rebound simulation to operate on
+  */
+void reb_tree_flatten(struct reb_simulation* const r);
+
 /**
  * @brief Free up all space occupied by the tree structure.
  * This will not modify particles.